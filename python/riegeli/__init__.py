@@ -17,7 +17,10 @@ from __future__ import absolute_import
 from __future__ import division
 from __future__ import print_function
 
+import sys
+
 from riegeli.base import riegeli_error
+from riegeli.records import multi_record_reader
 from riegeli.records import record_position
 from riegeli.records import record_reader
 from riegeli.records import record_writer
@@ -33,7 +36,7 @@ __all__ = ('RiegeliError', 'CancelledError', 'UnknownError',
            'UnimplementedError', 'InternalError', 'UnavailableError',
            'DataLossError', 'FlushType', 'RecordPosition', 'SkippedRegion',
            'RecordsMetadata', 'set_record_type', 'RecordWriter',
-           'get_record_type', 'RecordReader')
+           'get_record_type', 'RecordReader', 'MultiRecordReader')
 
 # pylint: disable=invalid-name
 RiegeliError = riegeli_error.RiegeliError
@@ -61,3 +64,10 @@ set_record_type = record_writer.set_record_type
 RecordWriter = record_writer.RecordWriter
 get_record_type = record_reader.get_record_type
 RecordReader = record_reader.RecordReader
+MultiRecordReader = multi_record_reader.MultiRecordReader
+
+if sys.version_info[0] >= 3:
+  # AsyncRecordReader uses asyncio and is available in Python 3 only.
+  from riegeli.records import async_record_reader
+  AsyncRecordReader = async_record_reader.AsyncRecordReader
+  __all__ += ('AsyncRecordReader',)
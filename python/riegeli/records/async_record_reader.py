@@ -0,0 +1,145 @@
+# Copyright 2019 Google LLC
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+"""Reads records from a Riegeli/records file in asyncio applications.
+
+This module requires Python 3.
+"""
+
+import asyncio
+
+from riegeli.records import record_reader
+
+__all__ = ('AsyncRecordReader',)
+
+_DEFAULT_BATCH_SIZE = 64
+
+
+class AsyncRecordReader(object):
+  """Reads records from a Riegeli/records file, integrating with asyncio.
+
+  Wraps a RecordReader. Records are read in batches on an executor, with
+  decoding performed with the GIL released, and the next batch is prefetched
+  in the background while records of the current batch are being consumed.
+  Awaiting a record thus typically completes without blocking on reading or
+  decoding, and the executor handoff overhead is paid once per batch instead
+  of once per record.
+
+  AsyncRecordReader is an asynchronous iterator of records and an asynchronous
+  context manager. It must be used from a single asyncio event loop.
+
+  With prefetching the underlying RecordReader advances ahead of the records
+  returned so far, hence its position is not meaningful between reads; seeking
+  is not supported.
+  """
+
+  __slots__ = ('_reader', '_batch_size', '_executor', '_batch', '_index',
+               '_pending', '_exhausted')
+
+  def __init__(self, src, batch_size=_DEFAULT_BATCH_SIZE, executor=None,
+               **record_reader_options):
+    """Creates an AsyncRecordReader.
+
+    Args:
+      src: Binary IO stream to read from, like for RecordReader.
+      batch_size: The maximal number of records read on the executor in one
+        call.
+      executor: concurrent.futures.Executor to read on, or None to use the
+        default executor of the event loop.
+      **record_reader_options: Remaining arguments for RecordReader.
+    """
+    self._reader = record_reader.RecordReader(src, **record_reader_options)
+    self._batch_size = batch_size
+    self._executor = executor
+    self._batch = []
+    self._index = 0
+    self._pending = None
+    self._exhausted = False
+
+  @property
+  def src(self):
+    """Binary IO stream being read from."""
+    return self._reader.src
+
+  def _start_prefetch(self):
+    if self._pending is None and not self._exhausted:
+      loop = asyncio.get_event_loop()
+      self._pending = loop.run_in_executor(
+          self._executor, self._reader.read_record_batch, self._batch_size)
+
+  async def _next_batch(self):
+    self._start_prefetch()
+    pending = self._pending
+    self._pending = None
+    batch = await pending
+    if batch:
+      # Prefetch the next batch while this one is being consumed.
+      self._start_prefetch()
+    else:
+      self._exhausted = True
+    return batch
+
+  async def read_record(self):
+    """Reads the next record.
+
+    Returns:
+      The record read as bytes, or None at end of file.
+
+    Raises:
+      RiegeliError: If the file is invalid, like for
+        RecordReader.read_record().
+    """
+    if self._index >= len(self._batch):
+      batch = await self._next_batch()
+      if not batch:
+        return None
+      self._batch = batch
+      self._index = 0
+    record = self._batch[self._index]
+    self._index += 1
+    return record
+
+  def __aiter__(self):
+    return self
+
+  async def __anext__(self):
+    record = await self.read_record()
+    if record is None:
+      raise StopAsyncIteration
+    return record
+
+  async def close(self):
+    """Indicates that reading is done, like RecordReader.close()."""
+    pending = self._pending
+    self._pending = None
+    self._exhausted = True
+    try:
+      if pending is not None:
+        await pending
+    finally:
+      loop = asyncio.get_event_loop()
+      await loop.run_in_executor(self._executor, self._reader.close)
+
+  async def __aenter__(self):
+    return self
+
+  async def __aexit__(self, exc_type, exc_value, traceback):
+    if exc_type is None:
+      await self.close()
+    else:
+      # Suppress exceptions from close() if an exception is already in flight.
+      try:
+        await self.close()
+      except Exception:  # pylint: disable=broad-except
+        pass
+    return False
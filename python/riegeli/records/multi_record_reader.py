@@ -0,0 +1,165 @@
+# Copyright 2019 Google LLC
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+"""Reads records from multiple Riegeli/records files concurrently."""
+
+from __future__ import absolute_import
+from __future__ import division
+from __future__ import print_function
+
+import collections
+import threading
+
+from concurrent import futures
+
+try:
+  import queue
+except ImportError:
+  import Queue as queue  # Python 2.
+
+from riegeli.records import record_reader
+
+__all__ = ('MultiRecordReader',)
+
+_DEFAULT_NUM_PARALLEL = 4
+_DEFAULT_BATCH_SIZE = 64
+
+# The maximal number of batches buffered per file being read.
+_QUEUE_BATCHES = 2
+
+# Marks the end of reading of one file in a queue of batches.
+_SENTINEL = object()
+
+
+class MultiRecordReader(object):
+  """Reads records from a list of Riegeli/records files concurrently.
+
+  Files are read by a pool of threads, each reading batches of records with
+  the GIL released, so decompression and decoding of multiple files proceed
+  on multiple cores within one process. MultiRecordReader is an iterator of
+  all their records and a context manager.
+
+  In the ordered mode records are yielded in the order of the sources, with
+  the order of records within each file preserved; following files are read
+  ahead concurrently. In the unordered mode records of different files are
+  interleaved arbitrarily, whenever they become available, with the order of
+  records within each file still preserved.
+
+  Records can be iterated only once. Exiting the context manager stops the
+  reading threads, also if iteration was abandoned before the end.
+  """
+
+  __slots__ = ('_sources', '_ordered', '_num_parallel', '_batch_size',
+               '_options', '_executor', '_cancel')
+
+  def __init__(self,
+               sources,
+               ordered=True,
+               num_parallel=None,
+               batch_size=_DEFAULT_BATCH_SIZE,
+               **record_reader_options):
+    """Creates a MultiRecordReader.
+
+    Args:
+      sources: An iterable of functions, each returning a binary IO stream of
+        one file to read, like the src argument of RecordReader. Files are
+        opened lazily when their reading begins.
+      ordered: If True, records are yielded in the order of the sources. If
+        False, records of different files are interleaved arbitrarily.
+      num_parallel: The number of files read concurrently, or None to read
+        min(4, number of sources) files concurrently.
+      batch_size: The maximal number of records read with the GIL released in
+        one call.
+      **record_reader_options: Remaining arguments for each RecordReader.
+    """
+    self._sources = list(sources)
+    self._ordered = ordered
+    if num_parallel is None:
+      num_parallel = min(_DEFAULT_NUM_PARALLEL, max(len(self._sources), 1))
+    self._num_parallel = num_parallel
+    self._batch_size = batch_size
+    self._options = record_reader_options
+    self._executor = futures.ThreadPoolExecutor(max_workers=num_parallel)
+    self._cancel = threading.Event()
+
+  def _put(self, out_queue, item):
+    while not self._cancel.is_set():
+      try:
+        out_queue.put(item, timeout=0.1)
+        return
+      except queue.Full:
+        pass
+
+  def _read_file(self, source, out_queue):
+    try:
+      with record_reader.RecordReader(source(), **self._options) as reader:
+        while not self._cancel.is_set():
+          batch = reader.read_record_batch(self._batch_size)
+          if not batch:
+            break
+          self._put(out_queue, batch)
+    except Exception as error:  # pylint: disable=broad-except
+      self._put(out_queue, error)
+    self._put(out_queue, _SENTINEL)
+
+  def _iter_ordered(self):
+    pending = collections.deque()
+    index = 0
+    while index < len(self._sources) or pending:
+      while index < len(self._sources) and len(pending) < self._num_parallel:
+        file_queue = queue.Queue(_QUEUE_BATCHES)
+        self._executor.submit(self._read_file, self._sources[index],
+                              file_queue)
+        pending.append(file_queue)
+        index += 1
+      file_queue = pending.popleft()
+      while True:
+        item = file_queue.get()
+        if item is _SENTINEL:
+          break
+        if isinstance(item, Exception):
+          raise item
+        for record in item:
+          yield record
+
+  def _iter_unordered(self):
+    out_queue = queue.Queue(self._num_parallel * _QUEUE_BATCHES)
+    for source in self._sources:
+      self._executor.submit(self._read_file, source, out_queue)
+    finished = 0
+    while finished < len(self._sources):
+      item = out_queue.get()
+      if item is _SENTINEL:
+        finished += 1
+      elif isinstance(item, Exception):
+        raise item
+      else:
+        for record in item:
+          yield record
+
+  def __iter__(self):
+    if self._ordered:
+      return self._iter_ordered()
+    return self._iter_unordered()
+
+  def close(self):
+    """Stops the reading threads and waits until they finish."""
+    self._cancel.set()
+    self._executor.shutdown(wait=True)
+
+  def __enter__(self):
+    return self
+
+  def __exit__(self, exc_type, exc_value, traceback):
+    self.close()
+    return False
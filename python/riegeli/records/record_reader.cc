@@ -23,14 +23,20 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <limits>
 #include <memory>
+#include <string>
 #include <utility>
+#include <vector>
 
 #include "absl/base/optimization.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
 #include "python/riegeli/base/utils.h"
 #include "python/riegeli/bytes/python_reader.h"
 #include "python/riegeli/records/record_position.h"
 #include "riegeli/base/base.h"
+#include "riegeli/base/canonical_errors.h"
 #include "riegeli/base/chain.h"
 #include "riegeli/chunk_encoding/field_projection.h"
 #include "riegeli/records/record_position.h"
@@ -135,6 +141,36 @@ struct PyRecordIterObject {
 
 extern PyTypeObject PyRecordIter_Type;
 
+struct PyRecordViewObject {
+  // clang-format off
+  PyObject_HEAD
+  static_assert(true, "");  // clang-format workaround.
+  // clang-format on
+
+  PythonWrapped<Chain> record;
+};
+
+extern PyTypeObject PyRecordView_Type;
+
+// Returns a read-only memoryview of the record. The record is moved into a
+// RecordView object which backs the memoryview, so the record data are not
+// copied but shared with the internally decoded chunk, which stays alive as
+// long as the memoryview is alive.
+PyObject* ChainToMemoryView(Chain&& record) {
+  if (ABSL_PREDICT_FALSE(!record.TryFlat().has_value())) {
+    // The record spans multiple blocks of the decoded chunk and cannot be
+    // viewed as a contiguous buffer directly. Flattening it copies the record
+    // once.
+    record = Chain(std::string(std::move(record)));
+  }
+  std::unique_ptr<PyRecordViewObject, Deleter> view(
+      reinterpret_cast<PyRecordViewObject*>(
+          PyRecordView_Type.tp_alloc(&PyRecordView_Type, 0)));
+  if (ABSL_PREDICT_FALSE(view == nullptr)) return nullptr;
+  view->record.emplace(std::move(record));
+  return PyMemoryView_FromObject(reinterpret_cast<PyObject*>(view.get()));
+}
+
 bool RecordReaderHasException(PyRecordReaderObject* self) {
   return self->recovery_exception.has_value() ||
          !self->record_reader->healthy();
@@ -223,6 +259,211 @@ bool TagFromPython(PyObject* object, uint32_t* value) {
   return VerifyTag(tag_value, value);
 }
 
+bool FieldPathFromPython(PyObject* object, std::vector<uint32_t>* path) {
+  const PythonPtr iter(PyObject_GetIter(object));
+  if (ABSL_PREDICT_FALSE(iter == nullptr)) return false;
+  while (const PythonPtr tag_object{PyIter_Next(iter.get())}) {
+    uint32_t tag;
+    if (ABSL_PREDICT_FALSE(!TagFromPython(tag_object.get(), &tag))) {
+      return false;
+    }
+    path->push_back(tag);
+  }
+  if (ABSL_PREDICT_FALSE(PyErr_Occurred() != nullptr)) return false;
+  if (ABSL_PREDICT_FALSE(path->empty())) {
+    PyErr_SetString(PyExc_ValueError, "Empty field path");
+    return false;
+  }
+  return true;
+}
+
+// Wire format interpretation of values of a numeric column.
+enum class NumericKind {
+  kFloat,   // 32-bit fixed (float).
+  kDouble,  // 64-bit fixed (double).
+  kInt,     // Varint (int32, int64, uint32, bool, enum), kept as int64.
+  kUint,    // Varint (uint64), kept as uint64.
+  kSint,    // Zigzag varint (sint32, sint64), kept as int64.
+};
+
+bool NumericKindFromPython(PyObject* object, NumericKind* kind) {
+  TextOrBytes name;
+  if (ABSL_PREDICT_FALSE(!name.FromPython(object))) return false;
+  if (name.data() == "float") {
+    *kind = NumericKind::kFloat;
+  } else if (name.data() == "double") {
+    *kind = NumericKind::kDouble;
+  } else if (name.data() == "int") {
+    *kind = NumericKind::kInt;
+  } else if (name.data() == "uint") {
+    *kind = NumericKind::kUint;
+  } else if (name.data() == "sint") {
+    *kind = NumericKind::kSint;
+  } else {
+    PyErr_Format(PyExc_ValueError, "Unknown numeric kind: %s",
+                 std::string(name.data()).c_str());
+    return false;
+  }
+  return true;
+}
+
+// Parsing of the proto wire format, used by read_numeric_column() to extract
+// values of one numeric field without constructing per-record proto objects.
+
+bool ParseVarint64(const char** src, const char* limit, uint64_t* data) {
+  uint64_t acc = 0;
+  int shift = 0;
+  while (*src < limit && shift < 64) {
+    const uint8_t byte = static_cast<uint8_t>(*(*src)++);
+    acc |= uint64_t{byte & 0x7f} << shift;
+    if ((byte & 0x80) == 0) {
+      *data = acc;
+      return true;
+    }
+    shift += 7;
+  }
+  return false;
+}
+
+bool SkipField(uint32_t wire_type, const char** src, const char* limit) {
+  switch (wire_type) {
+    case 0: {  // Varint.
+      uint64_t data;
+      return ParseVarint64(src, limit, &data);
+    }
+    case 1:  // 64-bit fixed.
+      if (ABSL_PREDICT_FALSE(limit - *src < 8)) return false;
+      *src += 8;
+      return true;
+    case 2: {  // Length-delimited.
+      uint64_t length;
+      if (ABSL_PREDICT_FALSE(!ParseVarint64(src, limit, &length))) {
+        return false;
+      }
+      if (ABSL_PREDICT_FALSE(length > IntCast<uint64_t>(limit - *src))) {
+        return false;
+      }
+      *src += IntCast<size_t>(length);
+      return true;
+    }
+    case 3: {  // Start of a group: skip until the matching end of the group.
+      for (;;) {
+        uint64_t key;
+        if (ABSL_PREDICT_FALSE(!ParseVarint64(src, limit, &key))) return false;
+        const uint32_t nested_wire_type = static_cast<uint32_t>(key & 7);
+        if (nested_wire_type == 4) return true;
+        if (ABSL_PREDICT_FALSE(!SkipField(nested_wire_type, src, limit))) {
+          return false;
+        }
+      }
+    }
+    case 5:  // 32-bit fixed.
+      if (ABSL_PREDICT_FALSE(limit - *src < 4)) return false;
+      *src += 4;
+      return true;
+    default:  // End of a group without its start, or invalid wire type.
+      return false;
+  }
+}
+
+void AppendValue(uint64_t value, std::string* dest) {
+  dest->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// Appends values of the numeric field at path[depth..] in the serialized
+// message to *dest, in the native byte order. Returns false if the message is
+// malformed or the field does not match kind.
+bool ExtractNumericValues(absl::string_view message,
+                          const std::vector<uint32_t>& path, size_t depth,
+                          NumericKind kind, std::string* dest) {
+  const char* src = message.data();
+  const char* const limit = src + message.size();
+  while (src < limit) {
+    uint64_t key;
+    if (ABSL_PREDICT_FALSE(!ParseVarint64(&src, limit, &key))) return false;
+    const uint32_t field_number = static_cast<uint32_t>(key >> 3);
+    const uint32_t wire_type = static_cast<uint32_t>(key & 7);
+    if (ABSL_PREDICT_FALSE(field_number == 0)) return false;
+    if (field_number != path[depth]) {
+      if (ABSL_PREDICT_FALSE(!SkipField(wire_type, &src, limit))) return false;
+      continue;
+    }
+    if (depth + 1 < path.size()) {
+      // An intermediate field of the path: descend into the submessage.
+      if (ABSL_PREDICT_FALSE(wire_type != 2)) return false;
+      uint64_t length;
+      if (ABSL_PREDICT_FALSE(!ParseVarint64(&src, limit, &length))) {
+        return false;
+      }
+      if (ABSL_PREDICT_FALSE(length > IntCast<uint64_t>(limit - src))) {
+        return false;
+      }
+      if (ABSL_PREDICT_FALSE(!ExtractNumericValues(
+              absl::string_view(src, IntCast<size_t>(length)), path,
+              depth + 1, kind, dest))) {
+        return false;
+      }
+      src += IntCast<size_t>(length);
+      continue;
+    }
+    // The terminal field of the path: extract the value, or all values of a
+    // packed repeated field.
+    size_t fixed_size = 0;
+    if (kind == NumericKind::kFloat) {
+      fixed_size = 4;
+    } else if (kind == NumericKind::kDouble) {
+      fixed_size = 8;
+    }
+    if (fixed_size > 0) {
+      if (wire_type == (fixed_size == 4 ? 5 : 1)) {
+        if (ABSL_PREDICT_FALSE(IntCast<size_t>(limit - src) < fixed_size)) {
+          return false;
+        }
+        dest->append(src, fixed_size);
+        src += fixed_size;
+      } else if (wire_type == 2) {
+        uint64_t length;
+        if (ABSL_PREDICT_FALSE(!ParseVarint64(&src, limit, &length))) {
+          return false;
+        }
+        if (ABSL_PREDICT_FALSE(length > IntCast<uint64_t>(limit - src) ||
+                               length % fixed_size != 0)) {
+          return false;
+        }
+        dest->append(src, IntCast<size_t>(length));
+        src += IntCast<size_t>(length);
+      } else {
+        return false;
+      }
+      continue;
+    }
+    const char* varint_limit = limit;
+    if (wire_type == 2) {
+      uint64_t length;
+      if (ABSL_PREDICT_FALSE(!ParseVarint64(&src, limit, &length))) {
+        return false;
+      }
+      if (ABSL_PREDICT_FALSE(length > IntCast<uint64_t>(limit - src))) {
+        return false;
+      }
+      varint_limit = src + IntCast<size_t>(length);
+    } else if (ABSL_PREDICT_FALSE(wire_type != 0)) {
+      return false;
+    }
+    do {
+      uint64_t value;
+      if (ABSL_PREDICT_FALSE(!ParseVarint64(&src, varint_limit, &value))) {
+        return false;
+      }
+      if (kind == NumericKind::kSint) {
+        value = (value >> 1) ^ (uint64_t{0} - (value & 1));
+      }
+      AppendValue(value, dest);
+    } while (wire_type == 2 && src < varint_limit);
+  }
+  return true;
+}
+
 extern "C" int RecordReaderInit(PyRecordReaderObject* self, PyObject* args,
                                 PyObject* kwargs) {
   static constexpr const char* keywords[] = {
@@ -510,6 +751,113 @@ extern "C" PyObject* RecordReaderReadRecordWithKey(PyRecordReaderObject* self,
   return PyTuple_Pack(2, key_object.get(), record_object.get());
 }
 
+extern "C" PyObject* RecordReaderReadRecordView(PyRecordReaderObject* self,
+                                                PyObject* args) {
+  if (ABSL_PREDICT_FALSE(!self->record_reader.Verify())) return nullptr;
+  Chain record;
+  const bool ok =
+      PythonUnlocked([&] { return self->record_reader->ReadRecord(&record); });
+  if (ABSL_PREDICT_FALSE(!ok)) {
+    if (ABSL_PREDICT_FALSE(RecordReaderHasException(self))) {
+      SetExceptionFromRecordReader(self);
+      return nullptr;
+    }
+    Py_RETURN_NONE;
+  }
+  return ChainToMemoryView(std::move(record));
+}
+
+extern "C" PyObject* RecordReaderReadRecordBatch(PyRecordReaderObject* self,
+                                                 PyObject* args,
+                                                 PyObject* kwargs) {
+  static constexpr const char* keywords[] = {"max_records", nullptr};
+  PyObject* max_records_arg;
+  if (ABSL_PREDICT_FALSE(!PyArg_ParseTupleAndKeywords(
+          args, kwargs, "O:read_record_batch", const_cast<char**>(keywords),
+          &max_records_arg))) {
+    return nullptr;
+  }
+  size_t max_records;
+  if (ABSL_PREDICT_FALSE(!SizeFromPython(max_records_arg, &max_records))) {
+    return nullptr;
+  }
+  if (ABSL_PREDICT_FALSE(!self->record_reader.Verify())) return nullptr;
+  std::vector<Chain> records;
+  PythonUnlocked([&] {
+    while (records.size() < max_records) {
+      if (self->record_reader->ReadRecords(
+              &records, max_records - records.size()) == 0) {
+        break;
+      }
+    }
+  });
+  if (ABSL_PREDICT_FALSE(records.empty())) {
+    if (ABSL_PREDICT_FALSE(RecordReaderHasException(self))) {
+      SetExceptionFromRecordReader(self);
+      return nullptr;
+    }
+  }
+  PythonPtr list(PyList_New(IntCast<Py_ssize_t>(records.size())));
+  if (ABSL_PREDICT_FALSE(list == nullptr)) return nullptr;
+  for (size_t i = 0; i < records.size(); ++i) {
+    PythonPtr record_object = ChainToPython(records[i]);
+    if (ABSL_PREDICT_FALSE(record_object == nullptr)) return nullptr;
+    PyList_SET_ITEM(list.get(), IntCast<Py_ssize_t>(i),
+                    record_object.release());
+  }
+  return list.release();
+}
+
+extern "C" PyObject* RecordReaderReadNumericColumn(PyRecordReaderObject* self,
+                                                   PyObject* args,
+                                                   PyObject* kwargs) {
+  static constexpr const char* keywords[] = {"field_path", "kind", nullptr};
+  PyObject* field_path_arg;
+  PyObject* kind_arg;
+  if (ABSL_PREDICT_FALSE(!PyArg_ParseTupleAndKeywords(
+          args, kwargs, "OO:read_numeric_column", const_cast<char**>(keywords),
+          &field_path_arg, &kind_arg))) {
+    return nullptr;
+  }
+  std::vector<uint32_t> path;
+  if (ABSL_PREDICT_FALSE(!FieldPathFromPython(field_path_arg, &path))) {
+    return nullptr;
+  }
+  NumericKind kind;
+  if (ABSL_PREDICT_FALSE(!NumericKindFromPython(kind_arg, &kind))) {
+    return nullptr;
+  }
+  if (ABSL_PREDICT_FALSE(!self->record_reader.Verify())) return nullptr;
+  std::vector<absl::string_view> records;
+  std::string values;
+  bool malformed = false;
+  const size_t num_read = PythonUnlocked([&] {
+    const size_t num_records = self->record_reader->ReadRecords(
+        &records, std::numeric_limits<size_t>::max());
+    for (const absl::string_view record : records) {
+      if (ABSL_PREDICT_FALSE(
+              !ExtractNumericValues(record, path, 0, kind, &values))) {
+        malformed = true;
+        break;
+      }
+    }
+    return num_records;
+  });
+  if (ABSL_PREDICT_FALSE(malformed)) {
+    SetRiegeliError(DataLossError(
+        "Malformed message while extracting a numeric column"));
+    return nullptr;
+  }
+  if (ABSL_PREDICT_FALSE(num_read == 0)) {
+    if (ABSL_PREDICT_FALSE(RecordReaderHasException(self))) {
+      SetExceptionFromRecordReader(self);
+      return nullptr;
+    }
+    Py_RETURN_NONE;
+  }
+  return ChainToMemoryView(Chain(std::move(values)));
+}
+
 extern "C" PyObject* RecordReaderReadMessage(PyRecordReaderObject* self,
                                              PyObject* args, PyObject* kwargs) {
   static constexpr const char* keywords[] = {"message_type", nullptr};
@@ -603,6 +951,20 @@ extern "C" PyRecordIterObject* RecordReaderReadRecordsWithKeys(
   return iter.release();
 }
 
+extern "C" PyRecordIterObject* RecordReaderReadRecordViews(
+    PyRecordReaderObject* self, PyObject* args) {
+  std::unique_ptr<PyRecordIterObject, Deleter> iter(
+      PyObject_GC_New(PyRecordIterObject, &PyRecordIter_Type));
+  if (ABSL_PREDICT_FALSE(iter == nullptr)) return nullptr;
+  iter->read_record = [](PyRecordReaderObject* self, PyObject* args) {
+    return RecordReaderReadRecordView(self, args);
+  };
+  Py_INCREF(self);
+  iter->record_reader = self;
+  iter->args = nullptr;
+  return iter.release();
+}
+
 extern "C" PyRecordIterObject* RecordReaderReadMessages(
     PyRecordReaderObject* self, PyObject* args, PyObject* kwargs) {
   static constexpr const char* keywords[] = {"message_type", nullptr};
@@ -820,6 +1182,70 @@ Reads the next record.
 Returns:
   If successful, a tuple of canonical record position and the record read as
   bytes. Returns None at end of file.
+)doc"},
+    {"read_record_view",
+     reinterpret_cast<PyCFunction>(RecordReaderReadRecordView), METH_NOARGS,
+     R"doc(
+read_record_view(self) -> Optional[memoryview]
+
+Reads the next record, without copying it out of the decoded chunk.
+
+This is like read_record(), but the record is returned as a read-only
+memoryview sharing memory with the internally decoded chunk instead of a
+separate bytes object. This avoids copying the record, which matters for
+filtering large records, at the cost that the memoryview keeps data of the
+chunk alive. Convert records which should outlive reading of their chunk to
+bytes.
+
+Returns:
+  The record read as a read-only memoryview, or None at end of file.
+)doc"},
+    {"read_record_batch",
+     reinterpret_cast<PyCFunction>(RecordReaderReadRecordBatch),
+     METH_VARARGS | METH_KEYWORDS, R"doc(
+read_record_batch(self, max_records: int) -> List[bytes]
+
+Reads up to max_records next records in one call.
+
+Records are read with the GIL released; only the final bytes objects are
+constructed with the GIL held. This amortizes the per-record Python call
+overhead over a whole batch.
+
+Args:
+  max_records: The maximal number of records to read.
+
+Returns:
+  A list of the records read as bytes. An empty list means end of file.
+)doc"},
+    {"read_numeric_column",
+     reinterpret_cast<PyCFunction>(RecordReaderReadNumericColumn),
+     METH_VARARGS | METH_KEYWORDS, R"doc(
+read_numeric_column(
+    self, field_path: Iterable[int], kind: str) -> Optional[memoryview]
+
+Reads values of one numeric field from all remaining records of the current
+chunk into one contiguous buffer.
+
+Records are decoded and the field values are extracted with the GIL released,
+without constructing per-record proto objects. The buffer can be wrapped by
+numpy.frombuffer() without copying. Together with a field_projection limited
+to field_path this decodes a numeric column and nothing else. Call
+read_numeric_column() again for the following chunks. Records with the field
+absent contribute no values; repeated fields, also packed, contribute all
+their values.
+
+Args:
+  field_path: Path of the field as an iterable of proto field tags descending
+    from the root message.
+  kind: Wire format interpretation of the values: 'float' (4-byte values, for
+    numpy.float32), 'double' (8-byte values, for numpy.float64), 'int'
+    (varint, 8-byte values, for numpy.int64), 'uint' (varint, 8-byte values,
+    for numpy.uint64), or 'sint' (zigzag varint, 8-byte values, for
+    numpy.int64). Values are in the native byte order.
+
+Returns:
+  Values of the field in records of the chunk as a read-only memoryview, or
+  None at end of file.
 )doc"},
     {"read_message", reinterpret_cast<PyCFunction>(RecordReaderReadMessage),
      METH_VARARGS | METH_KEYWORDS, R"doc(
@@ -868,6 +1294,19 @@ Returns an iterator which reads all remaining records.
 Yields:
   If successful, a tuple of canonical record position and the next record read
   as bytes.
+)doc"},
+    {"read_record_views",
+     reinterpret_cast<PyCFunction>(RecordReaderReadRecordViews), METH_NOARGS,
+     R"doc(
+read_record_views(self) -> Iterator[memoryview]
+
+Returns an iterator which reads all remaining records, without copying them
+out of the decoded chunk.
+
+See read_record_view() for the memory sharing implications.
+
+Yields:
+  The next record read as a read-only memoryview.
 )doc"},
     {"read_messages", reinterpret_cast<PyCFunction>(RecordReaderReadMessages),
      METH_VARARGS | METH_KEYWORDS, R"doc(
@@ -1160,6 +1599,95 @@ PyTypeObject PyRecordIter_Type = {
 #endif
 };
 
+extern "C" void RecordViewDestructor(PyRecordViewObject* self) {
+  self->record.reset();
+  Py_TYPE(self)->tp_free(self);
+}
+
+extern "C" int RecordViewGetBuffer(PyRecordViewObject* self, Py_buffer* view,
+                                   int flags) {
+  const absl::optional<absl::string_view> flat = self->record->TryFlat();
+  RIEGELI_ASSERT(flat.has_value())
+      << "Failed invariant of RecordView: record not flat";
+  return PyBuffer_FillInfo(view, reinterpret_cast<PyObject*>(self),
+                           const_cast<char*>(flat->data()),
+                           IntCast<Py_ssize_t>(flat->size()), 1, flags);
+}
+
+PyBufferProcs RecordViewAsBuffer = {
+#if PY_MAJOR_VERSION < 3
+    nullptr,  // bf_getreadbuffer
+    nullptr,  // bf_getwritebuffer
+    nullptr,  // bf_getsegcount
+    nullptr,  // bf_getcharbuffer
+#endif
+    reinterpret_cast<getbufferproc>(RecordViewGetBuffer),  // bf_getbuffer
+    nullptr,                                               // bf_releasebuffer
+};
+
+PyTypeObject PyRecordView_Type = {
+    // clang-format off
+    PyVarObject_HEAD_INIT(&PyType_Type, 0)
+    // clang-format on
+    "RecordView",                                        // tp_name
+    sizeof(PyRecordViewObject),                          // tp_basicsize
+    0,                                                   // tp_itemsize
+    reinterpret_cast<destructor>(RecordViewDestructor),  // tp_dealloc
+    nullptr,                                             // tp_print
+    nullptr,                                             // tp_getattr
+    nullptr,                                             // tp_setattr
+#if PY_MAJOR_VERSION >= 3
+    nullptr,  // tp_as_async
+#else
+    nullptr,  // tp_compare
+#endif
+    nullptr,               // tp_repr
+    nullptr,               // tp_as_number
+    nullptr,               // tp_as_sequence
+    nullptr,               // tp_as_mapping
+    nullptr,               // tp_hash
+    nullptr,               // tp_call
+    nullptr,               // tp_str
+    nullptr,               // tp_getattro
+    nullptr,               // tp_setattro
+    &RecordViewAsBuffer,   // tp_as_buffer
+#if PY_MAJOR_VERSION >= 3
+    Py_TPFLAGS_DEFAULT,                                // tp_flags
+#else
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_NEWBUFFER,    // tp_flags
+#endif
+    nullptr,               // tp_doc
+    nullptr,               // tp_traverse
+    nullptr,               // tp_clear
+    nullptr,               // tp_richcompare
+    0,                     // tp_weaklistoffset
+    nullptr,               // tp_iter
+    nullptr,               // tp_iternext
+    nullptr,               // tp_methods
+    nullptr,               // tp_members
+    nullptr,               // tp_getset
+    nullptr,               // tp_base
+    nullptr,               // tp_dict
+    nullptr,               // tp_descr_get
+    nullptr,               // tp_descr_set
+    0,                     // tp_dictoffset
+    nullptr,               // tp_init
+    nullptr,               // tp_alloc
+    nullptr,               // tp_new
+    nullptr,               // tp_free
+    nullptr,               // tp_is_gc
+    nullptr,               // tp_bases
+    nullptr,               // tp_mro
+    nullptr,               // tp_cache
+    nullptr,               // tp_subclasses
+    nullptr,               // tp_weaklist
+    nullptr,               // tp_del
+    0,                     // tp_version_tag
+#if PY_VERSION_HEX >= 0x030400a1
+    nullptr,  // tp_finalize
+#endif
+};
+
 const char* const kModuleName = "riegeli.records.record_reader";
 const char kModuleDoc[] = R"doc(Reads records from a Riegeli/records file.)doc";
 
@@ -1203,6 +1731,9 @@ PyObject* InitModule() {
   if (ABSL_PREDICT_FALSE(PyType_Ready(&PyRecordIter_Type) < 0)) {
     return nullptr;
   }
+  if (ABSL_PREDICT_FALSE(PyType_Ready(&PyRecordView_Type) < 0)) {
+    return nullptr;
+  }
 #if PY_MAJOR_VERSION >= 3
   PythonPtr module(PyModule_Create(&kModuleDef));
 #else
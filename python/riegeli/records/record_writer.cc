@@ -23,7 +23,9 @@
 #include <stddef.h>
 
 #include <utility>
+#include <vector>
 
+#include "absl/base/attributes.h"
 #include "absl/base/optimization.h"
 #include "python/riegeli/base/utils.h"
 #include "python/riegeli/bytes/python_writer.h"
@@ -42,6 +44,74 @@ namespace {
 constexpr ImportedCapsule<RecordPositionApi> kRecordPositionApi(
     kRecordPositionCapsuleName);
 
+// Wraps an exported Py_buffer in a Chain block without copying the data. The
+// buffer is released under the Python GIL when the Chain no longer needs it,
+// possibly on an internal thread after the chunk containing the record is
+// encoded.
+class PyBufferRef {
+ public:
+  explicit PyBufferRef(const Py_buffer& buffer) : buffer_(buffer) {}
+
+  PyBufferRef(PyBufferRef&& that) noexcept;
+  ABSL_ATTRIBUTE_UNUSED PyBufferRef& operator=(PyBufferRef&& that) noexcept;
+
+  ~PyBufferRef();
+
+  absl::string_view data() const {
+    return absl::string_view(static_cast<const char*>(buffer_.buf),
+                             IntCast<size_t>(buffer_.len));
+  }
+
+ private:
+  void Release();
+
+  Py_buffer buffer_;
+};
+
+PyBufferRef::PyBufferRef(PyBufferRef&& that) noexcept : buffer_(that.buffer_) {
+  that.buffer_.obj = nullptr;
+}
+
+PyBufferRef& PyBufferRef::operator=(PyBufferRef&& that) noexcept {
+  // Exchange that.buffer_ early to support self-assignment.
+  const Py_buffer buffer = that.buffer_;
+  that.buffer_.obj = nullptr;
+  Release();
+  buffer_ = buffer;
+  return *this;
+}
+
+PyBufferRef::~PyBufferRef() { Release(); }
+
+void PyBufferRef::Release() {
+  if (buffer_.obj != nullptr) {
+    PythonLock lock;
+    PyBuffer_Release(&buffer_);
+  }
+}
+
+// Converts a bytes-like Python object to a Chain using the buffer protocol.
+// Data of a long enough object are not copied: the buffer is attached to the
+// Chain and released when the record is no longer needed, hence the object
+// must not be modified in the meantime if it is mutable.
+bool RecordFromPython(PyObject* object, Chain* record) {
+  Py_buffer buffer;
+  if (ABSL_PREDICT_FALSE(PyObject_GetBuffer(object, &buffer, PyBUF_CONTIG_RO) <
+                         0)) {
+    return false;
+  }
+  const absl::string_view data(static_cast<const char*>(buffer.buf),
+                               IntCast<size_t>(buffer.len));
+  if (data.size() <= kMaxBytesToCopy) {
+    record->Clear();
+    record->Append(data, data.size());
+    PyBuffer_Release(&buffer);
+  } else {
+    *record = Chain::FromExternal(PyBufferRef(buffer), data);
+  }
+  return true;
+}
+
 PyObject* PyFlushType_Type;
 
 PythonPtr DefineFlushType() {
@@ -400,11 +470,13 @@ extern "C" PyObject* RecordWriterWriteRecord(PyRecordWriterObject* self,
           &record_arg))) {
     return nullptr;
   }
-  BytesLike record;
-  if (ABSL_PREDICT_FALSE(!record.FromPython(record_arg))) return nullptr;
+  Chain record;
+  if (ABSL_PREDICT_FALSE(!RecordFromPython(record_arg, &record))) {
+    return nullptr;
+  }
   if (ABSL_PREDICT_FALSE(!self->record_writer.Verify())) return nullptr;
   const bool ok = PythonUnlocked(
-      [&] { return self->record_writer->WriteRecord(record.data()); });
+      [&] { return self->record_writer->WriteRecord(std::move(record)); });
   if (ABSL_PREDICT_FALSE(!ok)) {
     SetExceptionFromRecordWriter(self);
     return nullptr;
@@ -422,12 +494,15 @@ extern "C" PyObject* RecordWriterWriteRecordWithKey(PyRecordWriterObject* self,
           &record_arg))) {
     return nullptr;
   }
-  BytesLike record;
-  if (ABSL_PREDICT_FALSE(!record.FromPython(record_arg))) return nullptr;
+  Chain record;
+  if (ABSL_PREDICT_FALSE(!RecordFromPython(record_arg, &record))) {
+    return nullptr;
+  }
   if (ABSL_PREDICT_FALSE(!self->record_writer.Verify())) return nullptr;
   FutureRecordPosition key;
-  const bool ok = PythonUnlocked(
-      [&] { return self->record_writer->WriteRecord(record.data(), &key); });
+  const bool ok = PythonUnlocked([&] {
+    return self->record_writer->WriteRecord(std::move(record), &key);
+  });
   if (ABSL_PREDICT_FALSE(!ok)) {
     SetExceptionFromRecordWriter(self);
     return nullptr;
@@ -507,24 +582,33 @@ extern "C" PyObject* RecordWriterWriteRecords(PyRecordWriterObject* self,
           &records_arg))) {
     return nullptr;
   }
-  // for record in records:
-  //   self.write_record(record)
+  // Extract buffers of all records first, so that they can be written in one
+  // go with the GIL released.
+  std::vector<Chain> records;
   const PythonPtr iter(PyObject_GetIter(records_arg));
   if (ABSL_PREDICT_FALSE(iter == nullptr)) return nullptr;
   while (const PythonPtr record_object{PyIter_Next(iter.get())}) {
-    BytesLike record;
-    if (ABSL_PREDICT_FALSE(!record.FromPython(record_object.get()))) {
-      return nullptr;
-    }
-    if (ABSL_PREDICT_FALSE(!self->record_writer.Verify())) return nullptr;
-    const bool ok = PythonUnlocked(
-        [&] { return self->record_writer->WriteRecord(record.data()); });
-    if (ABSL_PREDICT_FALSE(!ok)) {
-      SetExceptionFromRecordWriter(self);
+    records.emplace_back();
+    if (ABSL_PREDICT_FALSE(
+            !RecordFromPython(record_object.get(), &records.back()))) {
       return nullptr;
     }
   }
   if (ABSL_PREDICT_FALSE(PyErr_Occurred() != nullptr)) return nullptr;
+  if (ABSL_PREDICT_FALSE(!self->record_writer.Verify())) return nullptr;
+  const bool ok = PythonUnlocked([&] {
+    for (Chain& record : records) {
+      if (ABSL_PREDICT_FALSE(
+              !self->record_writer->WriteRecord(std::move(record)))) {
+        return false;
+      }
+    }
+    return true;
+  });
+  if (ABSL_PREDICT_FALSE(!ok)) {
+    SetExceptionFromRecordWriter(self);
+    return nullptr;
+  }
   Py_RETURN_NONE;
 }
 
@@ -537,35 +621,47 @@ extern "C" PyObject* RecordWriterWriteRecordsWithKeys(
           const_cast<char**>(keywords), &records_arg))) {
     return nullptr;
   }
-  // keys = []
-  PythonPtr keys(PyList_New(0));
-  // for record in records:
-  //   keys.append(self.write_record_with_key(record))
+  // Extract buffers of all records first, so that they can be written in one
+  // go with the GIL released.
+  std::vector<Chain> records;
   const PythonPtr iter(PyObject_GetIter(records_arg));
   if (ABSL_PREDICT_FALSE(iter == nullptr)) return nullptr;
   while (const PythonPtr record_object{PyIter_Next(iter.get())}) {
-    BytesLike record;
-    if (ABSL_PREDICT_FALSE(!record.FromPython(record_object.get()))) {
-      return nullptr;
-    }
-    if (ABSL_PREDICT_FALSE(!self->record_writer.Verify())) return nullptr;
-    FutureRecordPosition key;
-    const bool ok = PythonUnlocked(
-        [&] { return self->record_writer->WriteRecord(record.data(), &key); });
-    if (ABSL_PREDICT_FALSE(!ok)) {
-      SetExceptionFromRecordWriter(self);
-      return nullptr;
-    }
-    if (ABSL_PREDICT_FALSE(!kRecordPositionApi.Verify())) return nullptr;
-    const PythonPtr key_object(
-        kRecordPositionApi->RecordPositionToPython(std::move(key)));
-    if (ABSL_PREDICT_FALSE(key_object == nullptr)) return nullptr;
-    if (ABSL_PREDICT_FALSE(PyList_Append(keys.get(), key_object.get()) < 0)) {
+    records.emplace_back();
+    if (ABSL_PREDICT_FALSE(
+            !RecordFromPython(record_object.get(), &records.back()))) {
       return nullptr;
     }
   }
   if (ABSL_PREDICT_FALSE(PyErr_Occurred() != nullptr)) return nullptr;
+  if (ABSL_PREDICT_FALSE(!self->record_writer.Verify())) return nullptr;
+  std::vector<FutureRecordPosition> key_values;
+  key_values.reserve(records.size());
+  const bool ok = PythonUnlocked([&] {
+    for (Chain& record : records) {
+      FutureRecordPosition key;
+      if (ABSL_PREDICT_FALSE(
+              !self->record_writer->WriteRecord(std::move(record), &key))) {
+        return false;
+      }
+      key_values.push_back(std::move(key));
+    }
+    return true;
+  });
+  if (ABSL_PREDICT_FALSE(!ok)) {
+    SetExceptionFromRecordWriter(self);
+    return nullptr;
+  }
+  if (ABSL_PREDICT_FALSE(!kRecordPositionApi.Verify())) return nullptr;
   // return keys
+  PythonPtr keys(PyList_New(IntCast<Py_ssize_t>(key_values.size())));
+  if (ABSL_PREDICT_FALSE(keys == nullptr)) return nullptr;
+  for (size_t i = 0; i < key_values.size(); ++i) {
+    PythonPtr key_object(
+        kRecordPositionApi->RecordPositionToPython(std::move(key_values[i])));
+    if (ABSL_PREDICT_FALSE(key_object == nullptr)) return nullptr;
+    PyList_SET_ITEM(keys.get(), IntCast<Py_ssize_t>(i), key_object.release());
+  }
   return keys.release();
 }
 
@@ -720,6 +816,10 @@ write_record(self, record: Union[bytes, bytearray, memoryview]) -> None
 
 Writes the next record.
 
+Data of a long enough record are not copied: the buffer of the object is kept
+until the chunk containing the record is encoded. A mutable object, like
+bytearray or a writable memoryview, must not be modified in the meantime.
+
 Args:
   record: Record to write as a bytes-like object.
 )doc"},
@@ -766,6 +866,11 @@ write_records(
 
 Writes a number of records.
 
+Buffers of all records are extracted first, then the records are written with
+the GIL released, so encoding and compression do not compete with Python
+threads. This pays the per-record Python call overhead once per call instead
+of once per record.
+
 Args:
   records: Records to write as an iterable of bytes-like objects.
 )doc"},
@@ -778,6 +883,9 @@ write_records_with_keys(
 
 Writes a number of records.
 
+Buffers of all records are extracted first, then the records are written with
+the GIL released, like in write_records().
+
 Args:
   records: Records to write as an iterable of bytes-like objects.
 
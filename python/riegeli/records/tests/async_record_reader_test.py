@@ -0,0 +1,93 @@
+# Copyright 2019 Google LLC
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+import asyncio
+import io
+
+from absl.testing import absltest
+import riegeli
+
+
+def sample_string(i, size):
+  piece = '{} '.format(i).encode()
+  result = piece * -(-size // len(piece))  # len(result) >= size
+  return result[:size]
+
+
+def sample_file_contents():
+  byte_writer = io.BytesIO()
+  with riegeli.RecordWriter(
+      byte_writer, close=False,
+      options='uncompressed,chunk_size:35000') as writer:
+    for i in range(23):
+      writer.write_record(sample_string(i, 10000))
+  return byte_writer.getvalue()
+
+
+class AsyncRecordReaderTest(absltest.TestCase):
+
+  def run_until_complete(self, coroutine):
+    loop = asyncio.new_event_loop()
+    try:
+      return loop.run_until_complete(coroutine)
+    finally:
+      loop.close()
+
+  def test_read_record(self):
+    contents = sample_file_contents()
+
+    async def read():
+      async with riegeli.AsyncRecordReader(
+          io.BytesIO(contents), batch_size=10) as reader:
+        for i in range(23):
+          self.assertEqual(await reader.read_record(),
+                           sample_string(i, 10000))
+        self.assertIsNone(await reader.read_record())
+
+    self.run_until_complete(read())
+
+  def test_iterate(self):
+    contents = sample_file_contents()
+
+    async def read():
+      records = []
+      async with riegeli.AsyncRecordReader(
+          io.BytesIO(contents), batch_size=10) as reader:
+        async for record in reader:
+          records.append(record)
+      return records
+
+    self.assertEqual(
+        self.run_until_complete(read()),
+        [sample_string(i, 10000) for i in range(23)])
+
+  def test_corrupted_file(self):
+    contents = sample_file_contents()
+    index = len(contents) // 2
+    corrupted = (contents[:index] +
+                 bytes([(contents[index] + 1) % 256]) +
+                 contents[index + 1:])
+
+    async def read():
+      async with riegeli.AsyncRecordReader(
+          io.BytesIO(corrupted), batch_size=10) as reader:
+        async for _ in reader:
+          pass
+
+    with self.assertRaises(riegeli.RiegeliError):
+      self.run_until_complete(read())
+
+
+if __name__ == '__main__':
+  absltest.main()
@@ -0,0 +1,97 @@
+# Copyright 2019 Google LLC
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+from __future__ import absolute_import
+from __future__ import division
+from __future__ import print_function
+
+import functools
+import io
+
+from absl.testing import absltest
+from builtins import bytes  # pylint: disable=redefined-builtin
+from builtins import range  # pylint: disable=redefined-builtin
+import riegeli
+
+
+def sample_string(file_index, i, size):
+  piece = '{}/{} '.format(file_index, i).encode()
+  result = piece * -(-size // len(piece))  # len(result) >= size
+  return result[:size]
+
+
+def sample_file_contents(file_index, num_records):
+  byte_writer = io.BytesIO()
+  with riegeli.RecordWriter(
+      byte_writer, close=False,
+      options='uncompressed,chunk_size:35000') as writer:
+    for i in range(num_records):
+      writer.write_record(sample_string(file_index, i, 10000))
+  return byte_writer.getvalue()
+
+
+class MultiRecordReaderTest(absltest.TestCase):
+
+  def sample_sources(self, num_files, num_records):
+    return [
+        functools.partial(io.BytesIO,
+                          sample_file_contents(file_index, num_records))
+        for file_index in range(num_files)
+    ]
+
+  def test_read_ordered(self):
+    with riegeli.MultiRecordReader(
+        self.sample_sources(5, 23), ordered=True, batch_size=10) as reader:
+      self.assertEqual(
+          list(reader), [
+              sample_string(file_index, i, 10000)
+              for file_index in range(5)
+              for i in range(23)
+          ])
+
+  def test_read_unordered(self):
+    with riegeli.MultiRecordReader(
+        self.sample_sources(5, 23), ordered=False, batch_size=10) as reader:
+      self.assertCountEqual(
+          list(reader), [
+              sample_string(file_index, i, 10000)
+              for file_index in range(5)
+              for i in range(23)
+          ])
+
+  def test_read_no_files(self):
+    with riegeli.MultiRecordReader([]) as reader:
+      self.assertEqual(list(reader), [])
+
+  def test_abandoned_iteration(self):
+    with riegeli.MultiRecordReader(
+        self.sample_sources(5, 23), ordered=True, batch_size=10) as reader:
+      for record in reader:
+        self.assertEqual(record, sample_string(0, 0, 10000))
+        break
+
+  def test_corrupted_file(self):
+    contents = sample_file_contents(0, 23)
+    index = len(contents) // 2
+    corrupted = (contents[:index] +
+                 bytes([(bytes(contents)[index] + 1) % 256]) +
+                 contents[index + 1:])
+    with riegeli.MultiRecordReader(
+        [functools.partial(io.BytesIO, corrupted)], ordered=True) as reader:
+      with self.assertRaises(riegeli.RiegeliError):
+        list(reader)
+
+
+if __name__ == '__main__':
+  absltest.main()
@@ -20,6 +20,7 @@ import abc
 import contextlib
 import io
 import itertools
+import struct
 
 from absl import logging
 from absl.testing import absltest
@@ -303,6 +304,71 @@ class RecordsTest(parameterized.TestCase):
           self.assertEqual(reader.read_record(), sample_string(i, 10000))
         self.assertIsNone(reader.read_record())
 
+  @_PARAMETERIZE_BY_RANDOM_ACCESS
+  def test_write_read_record_non_adaptive_parallelism(self, random_access):
+    with contextlib.closing(BytesIOSpec(self.create_tempfile,
+                                        random_access)) as files:
+      with riegeli.RecordWriter(
+          files.writing_open(),
+          close=files.writing_should_close,
+          assumed_pos=files.writing_assumed_pos,
+          options=record_writer_options(10) +
+          ',adaptive_parallelism:false') as writer:
+        for i in range(23):
+          writer.write_record(sample_string(i, 10000))
+      with riegeli.RecordReader(
+          files.reading_open(),
+          close=files.reading_should_close,
+          assumed_pos=files.reading_assumed_pos) as reader:
+        for i in range(23):
+          self.assertEqual(reader.read_record(), sample_string(i, 10000))
+        self.assertIsNone(reader.read_record())
+
+  @_PARAMETERIZE_BY_FILE_SPEC_AND_RANDOM_ACCESS_AND_PARALLELISM
+  def test_write_read_record_view(self, file_spec, random_access, parallelism):
+    with contextlib.closing(file_spec(self.create_tempfile,
+                                      random_access)) as files:
+      with riegeli.RecordWriter(
+          files.writing_open(),
+          close=files.writing_should_close,
+          assumed_pos=files.writing_assumed_pos,
+          options=record_writer_options(parallelism)) as writer:
+        for i in range(23):
+          writer.write_record(sample_string(i, 10000))
+      with riegeli.RecordReader(
+          files.reading_open(),
+          close=files.reading_should_close,
+          assumed_pos=files.reading_assumed_pos) as reader:
+        for i in range(23):
+          view = reader.read_record_view()
+          self.assertIsInstance(view, memoryview)
+          self.assertTrue(view.readonly)
+          self.assertEqual(view.tobytes(), sample_string(i, 10000))
+        self.assertIsNone(reader.read_record_view())
+
+  @_PARAMETERIZE_BY_RANDOM_ACCESS_AND_PARALLELISM
+  def test_write_read_bytes_like_record(self, random_access, parallelism):
+    with contextlib.closing(BytesIOSpec(self.create_tempfile,
+                                        random_access)) as files:
+      with riegeli.RecordWriter(
+          files.writing_open(),
+          close=files.writing_should_close,
+          assumed_pos=files.writing_assumed_pos,
+          options=record_writer_options(parallelism)) as writer:
+        for i in range(23):
+          record = sample_string(i, 10000)
+          if i % 2 == 0:
+            writer.write_record(bytearray(record))
+          else:
+            writer.write_record(memoryview(record))
+      with riegeli.RecordReader(
+          files.reading_open(),
+          close=files.reading_should_close,
+          assumed_pos=files.reading_assumed_pos) as reader:
+        for i in range(23):
+          self.assertEqual(reader.read_record(), sample_string(i, 10000))
+        self.assertIsNone(reader.read_record())
+
   @_PARAMETERIZE_BY_FILE_SPEC_AND_RANDOM_ACCESS_AND_PARALLELISM
   def test_write_read_record_with_key(self, file_spec, random_access,
                                       parallelism):
@@ -412,6 +478,75 @@ class RecordsTest(parameterized.TestCase):
             list(reader.read_records()),
             [sample_string(i, 10000) for i in range(23)])
 
+  @_PARAMETERIZE_BY_FILE_SPEC_AND_RANDOM_ACCESS_AND_PARALLELISM
+  def test_write_read_record_batch(self, file_spec, random_access,
+                                   parallelism):
+    with contextlib.closing(file_spec(self.create_tempfile,
+                                      random_access)) as files:
+      with riegeli.RecordWriter(
+          files.writing_open(),
+          close=files.writing_should_close,
+          assumed_pos=files.writing_assumed_pos,
+          options=record_writer_options(parallelism)) as writer:
+        writer.write_records(sample_string(i, 10000) for i in range(23))
+      with riegeli.RecordReader(
+          files.reading_open(),
+          close=files.reading_should_close,
+          assumed_pos=files.reading_assumed_pos) as reader:
+        records = []
+        while True:
+          batch = reader.read_record_batch(10)
+          if not batch:
+            break
+          self.assertLessEqual(len(batch), 10)
+          records.extend(batch)
+        self.assertEqual(records, [sample_string(i, 10000) for i in range(23)])
+
+  @_PARAMETERIZE_BY_FILE_SPEC_AND_RANDOM_ACCESS_AND_PARALLELISM
+  def test_read_numeric_column(self, file_spec, random_access, parallelism):
+    with contextlib.closing(file_spec(self.create_tempfile,
+                                      random_access)) as files:
+      with riegeli.RecordWriter(
+          files.writing_open(),
+          close=files.writing_should_close,
+          assumed_pos=files.writing_assumed_pos,
+          options=record_writer_options(parallelism) +
+          ',transpose') as writer:
+        writer.write_messages(sample_message(i, 1000) for i in range(23))
+      with riegeli.RecordReader(
+          files.reading_open(),
+          close=files.reading_should_close,
+          assumed_pos=files.reading_assumed_pos,
+          field_projection=[[1]]) as reader:
+        ids = []
+        while True:
+          column = reader.read_numeric_column([1], 'int')
+          if column is None:
+            break
+          self.assertEqual(len(column) % 8, 0)
+          ids.extend(
+              struct.unpack('{}q'.format(len(column) // 8), column))
+        self.assertEqual(ids, list(range(23)))
+
+  @_PARAMETERIZE_BY_FILE_SPEC_AND_RANDOM_ACCESS_AND_PARALLELISM
+  def test_write_read_record_views(self, file_spec, random_access,
+                                   parallelism):
+    with contextlib.closing(file_spec(self.create_tempfile,
+                                      random_access)) as files:
+      with riegeli.RecordWriter(
+          files.writing_open(),
+          close=files.writing_should_close,
+          assumed_pos=files.writing_assumed_pos,
+          options=record_writer_options(parallelism)) as writer:
+        writer.write_records(sample_string(i, 10000) for i in range(23))
+      with riegeli.RecordReader(
+          files.reading_open(),
+          close=files.reading_should_close,
+          assumed_pos=files.reading_assumed_pos) as reader:
+        self.assertEqual(
+            [view.tobytes() for view in reader.read_record_views()],
+            [sample_string(i, 10000) for i in range(23)])
+
   @_PARAMETERIZE_BY_FILE_SPEC_AND_RANDOM_ACCESS_AND_PARALLELISM
   def test_write_read_records_with_keys(self, file_spec, random_access,
                                         parallelism):
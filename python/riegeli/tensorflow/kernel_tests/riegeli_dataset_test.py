@@ -199,6 +199,130 @@ class RiegeliDatasetTest(DatasetTestBase):
           [self._record(j, i) for i in range(self._num_records)])
     self.assertDatasetProduces(dataset, expected_output=expected_output)
 
+  def test_read_with_parallel_reads(self):
+    # Records of files read in parallel are interleaved in an arbitrary
+    # order.
+    dataset = riegeli_dataset_ops.RiegeliDataset(
+        self.test_filenames, num_parallel_reads=self._num_files)
+    expected_output = []
+    for j in range(self._num_files):
+      expected_output.extend(
+          [self._record(j, i) for i in range(self._num_records)])
+    self.assertDatasetProduces(
+        dataset, expected_output=expected_output, assert_items_equal=True)
+
+  def test_read_with_shards(self):
+    # Use files with tiny chunks so that each record gets its own chunk;
+    # sharding assigns whole chunks to shards.
+    num_shards = 2
+    filenames = []
+    for i in range(self._num_files):
+      filename = os.path.join(self.get_temp_dir(),
+                              'riegeli_sharded.{}'.format(i))
+      filenames.append(filename)
+      with riegeli.RecordWriter(
+          tf.gfile.GFile(filename, 'wb'), options='chunk_size:1') as writer:
+        for j in range(self._num_records):
+          writer.write_record(self._record(i, j))
+
+    expected_outputs = []
+    for shard_index in range(num_shards):
+      expected_output = []
+      for j in range(self._num_files):
+        expected_output.extend([
+            self._record(j, i)
+            for i in range(shard_index, self._num_records, num_shards)
+        ])
+      expected_outputs.append(expected_output)
+    # The shards are disjoint and together cover all records.
+    self.assertItemsEqual(
+        [record for shard in expected_outputs for record in shard],
+        [self._record(j, i) for j in range(self._num_files)
+         for i in range(self._num_records)])
+
+    for shard_index in range(num_shards):
+      dataset = riegeli_dataset_ops.RiegeliDataset(
+          filenames, num_shards=num_shards, shard_index=shard_index)
+      self.assertDatasetProduces(
+          dataset, expected_output=expected_outputs[shard_index])
+
+  def test_read_batches_of_records(self):
+    # Each element is a 1-D tensor of up to batch_size records. A batch does
+    # not span a chunk or file boundary; each test file is a single chunk.
+    batch_size = 4
+    expected_output = []
+    for j in range(self._num_files):
+      records = [self._record(j, i) for i in range(self._num_records)]
+      for begin in range(0, self._num_records, batch_size):
+        expected_output.append(records[begin:begin + batch_size])
+    dataset = riegeli_dataset_ops.RiegeliDataset(
+        self.test_filenames, batch_size=batch_size)
+    self.assertDatasetProduces(dataset, expected_output=expected_output)
+
+  def test_read_with_field_projection(self):
+    # Records are tf.Example protos written with transposition. The field
+    # projection includes feature names ('1.1.1') and int64 values
+    # ('1.1.2.3'); bytes values are skipped before decoding.
+    filename = os.path.join(self.get_temp_dir(), 'riegeli_examples')
+    with riegeli.RecordWriter(
+        tf.gfile.GFile(filename, 'wb'), options='transpose') as writer:
+      for i in range(self._num_records):
+        writer.write_message(
+            tf.train.Example(
+                features=tf.train.Features(
+                    feature={
+                        'index':
+                            tf.train.Feature(
+                                int64_list=tf.train.Int64List(value=[i])),
+                        'payload':
+                            tf.train.Feature(
+                                bytes_list=tf.train.BytesList(
+                                    value=[b'x' * 100])),
+                    })))
+
+    dataset = riegeli_dataset_ops.RiegeliDataset(
+        filename, fields=['1.1.1', '1.1.2.3'])
+    get_next = self.getNext(dataset)
+    for i in range(self._num_records):
+      example = tf.train.Example.FromString(self.evaluate(get_next()))
+      feature = example.features.feature
+      self.assertEqual(list(feature['index'].int64_list.value), [i])
+      self.assertFalse(feature['payload'].HasField('bytes_list'))
+    with self.assertRaises(errors.OutOfRangeError):
+      self.evaluate(get_next())
+
+  def test_read_parsed_examples(self):
+    # RiegeliExampleDataset parses tf.Example records into dense feature
+    # tensors while reading.
+    filename = os.path.join(self.get_temp_dir(), 'riegeli_parsed_examples')
+    with riegeli.RecordWriter(tf.gfile.GFile(filename, 'wb')) as writer:
+      for i in range(self._num_records):
+        writer.write_message(
+            tf.train.Example(
+                features=tf.train.Features(
+                    feature={
+                        'index':
+                            tf.train.Feature(
+                                int64_list=tf.train.Int64List(value=[i])),
+                        'label':
+                            tf.train.Feature(
+                                bytes_list=tf.train.BytesList(
+                                    value=[self._record(0, i)])),
+                    })))
+
+    dataset = riegeli_dataset_ops.RiegeliExampleDataset(
+        filename,
+        dense_keys=['index', 'label'],
+        dense_types=[tf.int64, tf.string],
+        dense_shapes=[[], []])
+    get_next = self.getNext(dataset)
+    for i in range(self._num_records):
+      index, label = self.evaluate(get_next())
+      self.assertEqual(index, i)
+      self.assertEqual(label, self._record(0, i))
+    with self.assertRaises(errors.OutOfRangeError):
+      self.evaluate(get_next())
+
   def test_read_ten_epochs(self):
     dataset = self.dataset_fn(self.test_filenames, num_epochs=10)
     expected_output = []
@@ -28,24 +28,120 @@ from tensorflow.python.platform import resource_loader
 load_library.load_op_library(
     resource_loader.get_path_to_datafile('_riegeli_dataset_ops.so'))
 
-__all__ = ('RiegeliDataset',)
+__all__ = ('RiegeliDataset', 'RiegeliExampleDataset')
 
 
 class RiegeliDataset(dataset_ops.DatasetSource):
   """A `Dataset` comprising records from one or more Riegeli/records files."""
 
-  __slots__ = ('_filenames',)
+  __slots__ = ('_filenames', '_num_parallel_reads', '_num_shards',
+               '_shard_index', '_batch_size', '_fields')
 
-  def __init__(self, filenames):
+  def __init__(self,
+               filenames,
+               num_parallel_reads=None,
+               num_shards=None,
+               shard_index=None,
+               batch_size=None,
+               fields=None):
     """Creates a `RiegeliDataset`.
 
     Args:
       filenames: A `tf.string` tensor containing one or more filenames.
+      num_parallel_reads: (Optional.) A `tf.int64` scalar representing the
+        number of files to read in parallel, interleaving their records. If
+        `None` or 1, files are read sequentially, in order. With parallel
+        reads the order of records is not deterministic, and checkpointing
+        the iterator is not supported.
+      num_shards: (Optional.) A `tf.int64` scalar representing the number of
+        shards the records are split into. Each file is split at chunk
+        boundaries; this dataset reads only the chunks of shard
+        `shard_index`, skipping the data of the remaining chunks. Unlike
+        `tf.data.Dataset.shard()` applied afterwards, this avoids reading
+        and decoding records of the other shards. If `None` or 1, all
+        records are read.
+      shard_index: (Optional.) A `tf.int64` scalar representing the shard to
+        read, if `num_shards` > 1.
+      batch_size: (Optional.) A `tf.int64` scalar representing the maximal
+        number of records in each element of the dataset. If `None` or 0,
+        each element is a scalar string containing one record, otherwise
+        each element is a 1-D string tensor containing up to `batch_size`
+        records; a batch does not span a chunk boundary, so it can be
+        shorter than `batch_size` even in the middle of a file. This pays
+        the per-element overhead once per batch instead of once per record.
+      fields: (Optional.) A list of `tf.string` scalars representing proto
+        field paths to include when reading records written with
+        transposition, e.g. with `options='transpose'` passed to
+        `RecordWriter`. Each path is a sequence of proto field numbers
+        separated by dots, descending from the root message, e.g. `'1.1.2'`.
+        Data of the remaining fields are skipped before decoding, which
+        makes reading a subset of fields cheaper. If `None` or empty, all
+        fields are read. For `tf.Example`, `'1.1.1'` is the path of feature
+        names and `'1.1.2'` is the path of feature values; individual
+        features cannot be distinguished at this level because all entries
+        of the feature map share one field path.
     """
     self._filenames = tf.convert_to_tensor(filenames, name='filenames')
-    variant_tensor = gen_riegeli_dataset_ops.riegeli_dataset(self._filenames)
+    self._num_parallel_reads = num_parallel_reads
+    self._num_shards = num_shards
+    self._shard_index = shard_index
+    self._batch_size = batch_size
+    self._fields = fields
+    variant_tensor = gen_riegeli_dataset_ops.riegeli_dataset(
+        self._filenames,
+        num_parallel_reads=num_parallel_reads or 1,
+        num_shards=num_shards or 1,
+        shard_index=shard_index or 0,
+        batch_size=batch_size or 0,
+        fields=fields or [])
     super(RiegeliDataset, self).__init__(variant_tensor)
 
   @property
   def _element_structure(self):
+    if self._batch_size:
+      return structure.TensorStructure(tf.dtypes.string, [None])
     return structure.TensorStructure(tf.dtypes.string, [])
+
+
+class RiegeliExampleDataset(dataset_ops.DatasetSource):
+  """A `Dataset` of dense feature tensors parsed from tf.Example records.
+
+  Reading and parsing are fused: each record is parsed directly from the
+  decoded chunk, without materializing the serialized record as an
+  intermediate string tensor. Each element of the dataset is a tuple of
+  tensors, one per requested feature.
+  """
+
+  __slots__ = ('_filenames', '_dense_keys', '_dense_types', '_dense_shapes')
+
+  def __init__(self, filenames, dense_keys, dense_types, dense_shapes):
+    """Creates a `RiegeliExampleDataset`.
+
+    Args:
+      filenames: A `tf.string` tensor containing one or more filenames.
+      dense_keys: A list of keys of the features to emit. Each record must
+        contain all of them.
+      dense_types: A list of the type of each feature, matching the kind of
+        its values: `tf.int64` for `int64_list`, `tf.float32` for
+        `float_list`, `tf.string` for `bytes_list`.
+      dense_shapes: A list of the shape of each feature. The number of
+        values of the feature in each record must match the number of
+        elements of the shape.
+    """
+    self._filenames = tf.convert_to_tensor(filenames, name='filenames')
+    self._dense_keys = list(dense_keys)
+    self._dense_types = [tf.dtypes.as_dtype(dtype) for dtype in dense_types]
+    self._dense_shapes = [tf.TensorShape(shape) for shape in dense_shapes]
+    variant_tensor = gen_riegeli_dataset_ops.riegeli_example_dataset(
+        self._filenames,
+        dense_keys=self._dense_keys,
+        dense_types=self._dense_types,
+        dense_shapes=self._dense_shapes)
+    super(RiegeliExampleDataset, self).__init__(variant_tensor)
+
+  @property
+  def _element_structure(self):
+    return structure.NestedStructure(
+        tuple(
+            structure.TensorStructure(dtype, shape) for dtype, shape in zip(
+                self._dense_types, self._dense_shapes)))
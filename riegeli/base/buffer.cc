@@ -0,0 +1,91 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/base/buffer.h"
+
+#include <stddef.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#include "riegeli/base/base.h"
+#include "riegeli/base/sized_allocator.h"
+
+namespace riegeli {
+
+namespace {
+
+#ifdef __linux__
+// The typical transparent huge page size. Buffers of at least this size
+// requested with Allocation::kHugePages are mapped with this alignment so that
+// the kernel can back them with huge pages.
+constexpr size_t kHugePageSize = size_t{2} << 20;
+
+// The typical page size. mmap() returns memory with at least this alignment.
+constexpr size_t kPageSize = 4096;
+#endif
+
+}  // namespace
+
+void Buffer::AllocateData() {
+  RIEGELI_ASSERT_GT(size_, 0u)
+      << "Failed precondition of Buffer::GetData(): no buffer size specified";
+#ifdef __linux__
+  if (allocation_ == Allocation::kHugePages && size_ >= kHugePageSize) {
+    const size_t capacity = RoundUp<kHugePageSize>(size_);
+    void* const data = mmap(nullptr, capacity, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data != MAP_FAILED) {
+      // mmap() of a multiple of kHugePageSize returns memory aligned enough
+      // in practice; MADV_HUGEPAGE is best effort and failure is not an error.
+#ifdef MADV_HUGEPAGE
+      madvise(data, capacity, MADV_HUGEPAGE);
+#endif
+      data_ = static_cast<char*>(data);
+      size_ = capacity;
+      mapped_ = true;
+      return;
+    }
+    // Fall back to operator new if mmap() failed.
+  }
+  if (allocation_ == Allocation::kPageAligned) {
+    const size_t capacity = RoundUp<kPageSize>(size_);
+    void* const data = mmap(nullptr, capacity, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data != MAP_FAILED) {
+      data_ = static_cast<char*>(data);
+      size_ = capacity;
+      mapped_ = true;
+      return;
+    }
+    // Fall back to operator new if mmap() failed.
+  }
+#endif
+  size_t capacity;
+  data_ = static_cast<char*>(AllocateSized(size_, &capacity));
+  size_ = capacity;
+}
+
+void Buffer::DeleteBuffer() {
+  if (data_ == nullptr) return;
+#ifdef __linux__
+  if (mapped_) {
+    munmap(data_, size_);
+    return;
+  }
+#endif
+  DeallocateSized(data_, size_);
+}
+
+}  // namespace riegeli
@@ -16,6 +16,7 @@
 
 #include <stddef.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cstring>
 #include <functional>
@@ -25,14 +26,15 @@
 #include <string>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
 #include "absl/base/optimization.h"
 #include "absl/strings/string_view.h"
 #include "absl/types/span.h"
 #include "absl/utility/utility.h"
 #include "riegeli/base/base.h"
-#include "riegeli/base/memory.h"
 #include "riegeli/base/memory_estimator.h"
+#include "riegeli/base/sized_allocator.h"
 
 namespace riegeli {
 
@@ -156,20 +158,24 @@ inline void Chain::StringRef::DumpStructure(std::ostream& out) const {
 inline Chain::Block* Chain::Block::NewInternal(size_t min_capacity) {
   RIEGELI_ASSERT_GT(min_capacity, 0u)
       << "Failed precondition of Chain::Block::NewInternal(): zero capacity";
+  static_assert(alignof(Block) <= alignof(max_align_t),
+                "Block must not be over-aligned for AllocateSized()");
   size_t raw_capacity;
-  return SizeReturningNewAligned<Block>(
-      kInternalAllocatedOffset() + min_capacity, &raw_capacity, &raw_capacity,
-      ForAppend());
+  void* const allocated = AllocateSized(
+      kInternalAllocatedOffset() + min_capacity, &raw_capacity);
+  return new (allocated) Block(&raw_capacity, ForAppend());
 }
 
 inline Chain::Block* Chain::Block::NewInternalForPrepend(size_t min_capacity) {
   RIEGELI_ASSERT_GT(min_capacity, 0u)
       << "Failed precondition of Chain::Block::NewInternalForPrepend(): "
          "zero capacity";
+  static_assert(alignof(Block) <= alignof(max_align_t),
+                "Block must not be over-aligned for AllocateSized()");
   size_t raw_capacity;
-  return SizeReturningNewAligned<Block>(
-      kInternalAllocatedOffset() + min_capacity, &raw_capacity, &raw_capacity,
-      ForPrepend());
+  void* const allocated = AllocateSized(
+      kInternalAllocatedOffset() + min_capacity, &raw_capacity);
+  return new (allocated) Block(&raw_capacity, ForPrepend());
 }
 
 inline Chain::Block::Block(const size_t* raw_capacity, ForAppend)
@@ -198,7 +204,9 @@ inline void Chain::Block::Unref() {
   if (has_unique_owner() ||
       ref_count_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
     if (is_internal()) {
-      DeleteAligned<Block>(this, kInternalAllocatedOffset() + capacity());
+      const size_t num_bytes = kInternalAllocatedOffset() + capacity();
+      this->~Block();
+      DeallocateSized(this, num_bytes);
     } else {
       external_.methods->delete_block(this);
     }
@@ -462,6 +470,87 @@ void Chain::BlockIterator::AppendSubstrTo(absl::string_view substr, Chain* dest,
   }
 }
 
+Chain::BlockIndex::BlockIndex(const Chain& chain) {
+  block_ends_.reserve(chain.blocks().size());
+  size_t block_end = 0;
+  for (const absl::string_view block : chain.blocks()) {
+    block_end += block.size();
+    block_ends_.push_back(block_end);
+  }
+}
+
+size_t Chain::BlockIndex::FindBlock(size_t pos,
+                                    size_t* offset_in_block) const {
+  RIEGELI_ASSERT_LE(pos, size())
+      << "Failed precondition of Chain::BlockIndex::FindBlock(): "
+         "position out of range";
+  const std::vector<size_t>::const_iterator found =
+      std::upper_bound(block_ends_.cbegin(), block_ends_.cend(), pos);
+  const size_t block_index = IntCast<size_t>(found - block_ends_.cbegin());
+  if (offset_in_block != nullptr) {
+    *offset_in_block =
+        block_index == 0 ? pos : pos - block_ends_[block_index - 1];
+  }
+  return block_index;
+}
+
+Chain::BlockIterator Chain::FindBlock(size_t pos,
+                                      size_t* offset_in_block) const {
+  RIEGELI_ASSERT_LE(pos, size())
+      << "Failed precondition of Chain::FindBlock(): position out of range";
+  if (pos == size()) {
+    if (offset_in_block != nullptr) *offset_in_block = 0;
+    return blocks().cend();
+  }
+  if (size() - pos < pos) {
+    // Iterate backwards from the end, it is closer.
+    BlockIterator iter = blocks().cend();
+    size_t block_begin = size();
+    do {
+      RIEGELI_ASSERT(iter != blocks().cbegin()) << "Malformed Chain";
+      --iter;
+      RIEGELI_ASSERT_LE(iter->size(), block_begin) << "Malformed Chain";
+      block_begin -= iter->size();
+    } while (pos < block_begin);
+    if (offset_in_block != nullptr) *offset_in_block = pos - block_begin;
+    return iter;
+  }
+  // Iterate forwards from the beginning, it is closer.
+  BlockIterator iter = blocks().cbegin();
+  size_t block_begin = 0;
+  while (pos >= block_begin + iter->size()) {
+    block_begin += iter->size();
+    RIEGELI_ASSERT(iter != blocks().cend()) << "Malformed Chain";
+    ++iter;
+  }
+  if (offset_in_block != nullptr) *offset_in_block = pos - block_begin;
+  return iter;
+}
+
+Chain Chain::Substr(size_t pos, size_t length) const {
+  RIEGELI_CHECK_LE(pos, size())
+      << "Failed precondition of Chain::Substr(): position out of range";
+  length = UnsignedMin(length, size() - pos);
+  Chain result;
+  if (length == 0) return result;
+  size_t offset_in_block;
+  BlockIterator iter = FindBlock(pos, &offset_in_block);
+  size_t remaining = length;
+  for (;;) {
+    RIEGELI_ASSERT(iter != blocks().cend()) << "Malformed Chain";
+    const size_t length_in_block =
+        UnsignedMin(iter->size() - offset_in_block, remaining);
+    iter.AppendSubstrTo(
+        absl::string_view(iter->data() + offset_in_block, length_in_block),
+        &result, length);
+    remaining -= length_in_block;
+    if (remaining == 0) break;
+    ++iter;
+    offset_in_block = 0;
+  }
+  return result;
+}
+
 constexpr size_t Chain::kMaxShortDataSize;
 
 // In converting constructors below, size_hint being src.size() optimizes for
@@ -528,6 +617,18 @@ void Chain::UnrefBlocksSlow(Block* const* begin, Block* const* end) {
   } while (begin != end);
 }
 
+absl::string_view Chain::Flatten() {
+  if (begin_ == end_) return short_data();
+  if (end_ - begin_ == 1) return front()->data();
+  // Consolidate the blocks into one, replacing the Chain contents so that
+  // subsequent calls find a single block.
+  Chain flat;
+  const absl::Span<char> buffer = flat.AppendFixedBuffer(size_, size_);
+  CopyTo(buffer.data());
+  *this = std::move(flat);
+  return absl::string_view(buffer.data(), buffer.size());
+}
+
 void Chain::CopyTo(char* dest) const {
   if (empty()) return;  // memcpy(nullptr, _, 0) is undefined.
   Block* const* iter = begin_;
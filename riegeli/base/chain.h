@@ -27,6 +27,7 @@
 #include <string>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
 #include "absl/base/optimization.h"
 #include "absl/meta/type_traits.h"
@@ -56,6 +57,7 @@ namespace riegeli {
 class Chain {
  public:
   class Blocks;
+  class BlockIndex;
   class BlockIterator;
   struct PinnedBlock;
 
@@ -98,9 +100,29 @@ class Chain {
   // A container of string_view blocks comprising data of the Chain.
   Blocks blocks() const;
 
+  // Returns an iterator to the block containing the given position, and sets
+  // *offset_in_block (if not nullptr) to the offset of the position within
+  // that block. If pos == size(), returns blocks().cend().
+  //
+  // Iterates from the nearer end of the Chain, which takes time proportional
+  // to the number of blocks skipped. For repeated random access into a large
+  // Chain a BlockIndex answers the same question in O(log n) time.
+  //
+  // Precondition: pos <= size()
+  BlockIterator FindBlock(size_t pos, size_t* offset_in_block = nullptr) const;
+
   size_t size() const { return size_; }
   bool empty() const { return size_ == 0; }
 
+  // Returns a Chain containing length bytes starting at pos. The result shares
+  // the underlying blocks with this Chain instead of copying the data, except
+  // that fragments not longer than kMaxBytesToCopy are copied.
+  //
+  // If length extends past size(), it is truncated to size() - pos.
+  //
+  // Precondition: pos <= size()
+  Chain Substr(size_t pos, size_t length) const;
+
   void CopyTo(char* dest) const;
   void AppendTo(std::string* dest) const;
   explicit operator std::string() const&;
@@ -109,6 +131,15 @@ class Chain {
   // If the Chain contents are flat, returns them, otherwise returns nullopt.
   absl::optional<absl::string_view> TryFlat() const;
 
+  // Returns the Chain contents as a contiguous array of bytes.
+  //
+  // If the Chain consists of at most one block this is free, otherwise the
+  // blocks are consolidated into one block, copying the data once; subsequent
+  // calls are free again until the Chain is modified.
+  //
+  // The returned view is valid until the Chain is modified or destroyed.
+  absl::string_view Flatten();
+
   // Estimates the amount of memory used by this Chain.
   size_t EstimateMemory() const;
   // Registers this Chain with MemoryEstimator.
@@ -501,6 +532,47 @@ class Chain::Blocks {
   const Chain* chain_ = nullptr;
 };
 
+// An index over block boundaries of a Chain, answering which block contains a
+// given position in O(log n) time, where n is the number of blocks. Building
+// the index takes O(n) time, which pays off for repeated random access into a
+// Chain with many blocks.
+//
+// The index identifies blocks by their ordinal numbers rather than iterators,
+// hence it remains valid when the Chain is moved, as long as the shape of
+// blocks (their number and sizes) is unchanged.
+class Chain::BlockIndex {
+ public:
+  // Creates an empty BlockIndex, as if for an empty Chain.
+  BlockIndex() noexcept {}
+
+  // Builds an index of block boundaries of the given Chain.
+  explicit BlockIndex(const Chain& chain);
+
+  BlockIndex(BlockIndex&& that) noexcept = default;
+  BlockIndex& operator=(BlockIndex&& that) noexcept = default;
+
+  // The total size of the indexed Chain.
+  size_t size() const {
+    return block_ends_.empty() ? size_t{0} : block_ends_.back();
+  }
+
+  // The number of blocks of the indexed Chain.
+  size_t num_blocks() const { return block_ends_.size(); }
+
+  // Returns the ordinal number of the block containing the given position, and
+  // sets *offset_in_block (if not nullptr) to the offset of the position
+  // within that block. If pos == size(), returns num_blocks().
+  //
+  // Precondition: pos <= size()
+  size_t FindBlock(size_t pos, size_t* offset_in_block = nullptr) const;
+
+ private:
+  // The end position of each block, i.e. cumulative sums of block sizes.
+  //
+  // Invariant: block_ends_ is non-decreasing
+  std::vector<size_t> block_ends_;
+};
+
 // Implementation details follow.
 
 // Chain representation consists of blocks.
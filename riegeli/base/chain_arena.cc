@@ -0,0 +1,150 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/base/chain_arena.h"
+
+#include <stddef.h>
+
+#include <atomic>
+#include <cstring>
+#include <new>
+#include <ostream>
+#include <utility>
+
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "absl/utility/utility.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
+#include "riegeli/base/sized_allocator.h"
+
+namespace riegeli {
+
+// Before C++17 if a constexpr static data member is ODR-used, its definition at
+// namespace scope is required. Since C++17 these definitions are deprecated:
+// http://en.cppreference.com/w/cpp/language/static
+#if __cplusplus < 201703
+constexpr size_t ChainBlockArena::kDefaultSlabSize;
+#endif
+
+constexpr size_t ChainBlockArena::Slab::kAllocatedOffset() {
+  return offsetof(Slab, allocated_begin_);
+}
+
+inline ChainBlockArena::Slab* ChainBlockArena::Slab::New(size_t min_capacity) {
+  RIEGELI_ASSERT_GT(min_capacity, 0u)
+      << "Failed precondition of ChainBlockArena::Slab::New(): zero capacity";
+  static_assert(alignof(Slab) <= alignof(max_align_t),
+                "Slab must not be over-aligned for AllocateSized()");
+  size_t raw_capacity;
+  void* const allocated =
+      AllocateSized(kAllocatedOffset() + min_capacity, &raw_capacity);
+  return new (allocated) Slab(&raw_capacity);
+}
+
+inline ChainBlockArena::Slab::Slab(const size_t* raw_capacity)
+    : allocated_end_(allocated_begin_ +
+                     (*raw_capacity - kAllocatedOffset())) {}
+
+inline ChainBlockArena::Slab* ChainBlockArena::Slab::Ref() {
+  ref_count_.fetch_add(1, std::memory_order_relaxed);
+  return this;
+}
+
+inline void ChainBlockArena::Slab::Unref() {
+  if (ref_count_.load(std::memory_order_acquire) == 1 ||
+      ref_count_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    const size_t num_bytes = kAllocatedOffset() + capacity();
+    this->~Slab();
+    DeallocateSized(this, num_bytes);
+  }
+}
+
+inline ChainBlockArena::SlabRef::SlabRef(SlabRef&& that) noexcept
+    : slab_(absl::exchange(that.slab_, nullptr)) {}
+
+inline ChainBlockArena::SlabRef& ChainBlockArena::SlabRef::operator=(
+    SlabRef&& that) noexcept {
+  // Exchange that.slab_ early to support self-assignment.
+  Slab* const slab = absl::exchange(that.slab_, nullptr);
+  if (slab_ != nullptr) slab_->Unref();
+  slab_ = slab;
+  return *this;
+}
+
+inline ChainBlockArena::SlabRef::~SlabRef() {
+  if (slab_ != nullptr) slab_->Unref();
+}
+
+void ChainBlockArena::SlabRef::RegisterSubobjects(
+    absl::string_view data, MemoryEstimator* memory_estimator) const {
+  if (memory_estimator->RegisterNode(slab_)) {
+    memory_estimator->RegisterDynamicMemory(Slab::kAllocatedOffset() +
+                                            slab_->capacity());
+  }
+}
+
+void ChainBlockArena::SlabRef::DumpStructure(std::ostream& out) const {
+  out << "arena slab";
+}
+
+ChainBlockArena::~ChainBlockArena() {
+  if (slab_ != nullptr) slab_->Unref();
+}
+
+absl::Span<char> ChainBlockArena::AppendFixedBuffer(size_t length, Chain* dest,
+                                                    size_t size_hint) {
+  if (length <= kMaxBytesToCopy) {
+    return dest->AppendFixedBuffer(length, size_hint);
+  }
+  EnsureSpace(length);
+  const absl::Span<char> buffer(cursor_, length);
+  cursor_ += length;
+  dest->AppendExternal(SlabRef(slab_),
+                       absl::string_view(buffer.data(), buffer.size()),
+                       size_hint);
+  return buffer;
+}
+
+void ChainBlockArena::Append(absl::string_view src, Chain* dest,
+                             size_t size_hint) {
+  if (src.size() <= kMaxBytesToCopy) {
+    dest->Append(src, size_hint);
+    return;
+  }
+  const absl::Span<char> buffer = AppendFixedBuffer(src.size(), dest,
+                                                    size_hint);
+  std::memcpy(buffer.data(), src.data(), src.size());
+}
+
+void ChainBlockArena::Release() {
+  if (slab_ != nullptr) {
+    slab_->Unref();
+    slab_ = nullptr;
+    cursor_ = nullptr;
+  }
+}
+
+void ChainBlockArena::EnsureSpace(size_t length) {
+  if (slab_ != nullptr &&
+      length <= PtrDistance(cursor_, slab_->data_end())) {
+    return;
+  }
+  if (slab_ != nullptr) slab_->Unref();
+  slab_ = Slab::New(UnsignedMax(slab_size_, length));
+  cursor_ = slab_->data_begin();
+}
+
+}  // namespace riegeli
@@ -0,0 +1,139 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BASE_CHAIN_ARENA_H_
+#define RIEGELI_BASE_CHAIN_ARENA_H_
+
+#include <stddef.h>
+
+#include <atomic>
+#include <iosfwd>
+
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
+
+namespace riegeli {
+
+// ChainBlockArena carves Chain block data out of large slabs instead of
+// allocating each block separately. This reduces allocator traffic when many
+// short-lived Chains are built and destroyed, e.g. by chunk encoders.
+//
+// Data appended through the arena is added to a Chain as external blocks which
+// share ownership of the slab. A slab is returned to the allocator wholesale
+// when the arena no longer writes to it and all Chains referring to it are
+// destroyed.
+//
+// ChainBlockArena is not thread-safe, like Chain. Distinct Chains filled from
+// the same arena may be used from distinct threads as long as the arena itself
+// is used from one thread at a time.
+class ChainBlockArena {
+ public:
+  // The default slab size requested from the allocator.
+  static constexpr size_t kDefaultSlabSize = size_t{64} << 10;
+
+  // Creates an arena which allocates slabs of at least the given size.
+  explicit ChainBlockArena(size_t slab_size = kDefaultSlabSize) noexcept
+      : slab_size_(slab_size) {}
+
+  ChainBlockArena(const ChainBlockArena&) = delete;
+  ChainBlockArena& operator=(const ChainBlockArena&) = delete;
+
+  ~ChainBlockArena();
+
+  // Appends a fixed amount of uninitialized space carved from the arena to
+  // *dest, and returns the buffer to be filled by the caller. The block added
+  // to *dest shares ownership of the slab containing the buffer.
+  //
+  // If length > the remaining space of the current slab, a new slab is
+  // allocated, of at least the configured slab size.
+  //
+  // If length <= kMaxBytesToCopy, the buffer is allocated directly in *dest
+  // instead, because Chain would copy such a short external block anyway.
+  absl::Span<char> AppendFixedBuffer(size_t length, Chain* dest,
+                                     size_t size_hint = 0);
+
+  // Copies src into the arena and appends it to *dest, sharing ownership of
+  // the slab instead of allocating a separate block.
+  void Append(absl::string_view src, Chain* dest, size_t size_hint = 0);
+
+  // Drops the reference to the current slab. The space remaining in it becomes
+  // unavailable for further appends; its memory is freed when all Chains
+  // referring to it are destroyed. This bounds slab memory retained by an
+  // idle arena.
+  void Release();
+
+ private:
+  // A reference-counted slab. Slab data directly follow the Slab object in the
+  // same allocation, like in an internal Chain::Block.
+  class Slab {
+   public:
+    static constexpr size_t kAllocatedOffset();
+
+    static Slab* New(size_t min_capacity);
+
+    explicit Slab(const size_t* raw_capacity);
+
+    Slab* Ref();
+    void Unref();
+
+    char* data_begin() { return allocated_begin_; }
+    char* data_end() { return allocated_end_; }
+    size_t capacity() const {
+      return PtrDistance(allocated_begin_, allocated_end_);
+    }
+
+   private:
+    std::atomic<size_t> ref_count_{1};
+    char* allocated_end_;
+    char allocated_begin_[1];
+  };
+
+  // The external object type of blocks appended to Chains: keeps a slab alive.
+  class SlabRef {
+   public:
+    explicit SlabRef(Slab* slab) : slab_(slab->Ref()) {}
+
+    SlabRef(SlabRef&& that) noexcept;
+    SlabRef& operator=(SlabRef&& that) noexcept;
+
+    ~SlabRef();
+
+    void RegisterSubobjects(absl::string_view data,
+                            MemoryEstimator* memory_estimator) const;
+    void DumpStructure(std::ostream& out) const;
+
+   private:
+    Slab* slab_;
+  };
+
+  // Ensures that the current slab has at least length bytes of remaining
+  // space.
+  void EnsureSpace(size_t length);
+
+  size_t slab_size_;
+  // The slab being carved from, or nullptr. The arena holds one reference.
+  Slab* slab_ = nullptr;
+  // The beginning of the space remaining in *slab_.
+  //
+  // Invariant: if slab_ != nullptr then
+  //     cursor_ >= slab_->data_begin() && cursor_ <= slab_->data_end()
+  char* cursor_ = nullptr;
+};
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_BASE_CHAIN_ARENA_H_
@@ -0,0 +1,80 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/base/chain_cord.h"
+
+#ifdef RIEGELI_HAS_CORD
+
+#include <stddef.h>
+
+#include <ostream>
+#include <utility>
+
+#include "absl/strings/cord.h"
+#include "absl/strings/string_view.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+
+namespace riegeli {
+
+namespace {
+
+// The external object type of Chain blocks referring to Cord data: keeps a
+// (refcounted) copy of the Cord alive.
+class CordRef {
+ public:
+  explicit CordRef(const absl::Cord& cord) : cord_(cord) {}
+
+  CordRef(CordRef&& that) noexcept : cord_(std::move(that.cord_)) {}
+
+  void DumpStructure(std::ostream& out) const { out << "cord"; }
+
+ private:
+  absl::Cord cord_;
+};
+
+}  // namespace
+
+Chain ChainFromCord(const absl::Cord& cord) {
+  Chain result;
+  for (const absl::string_view chunk : cord.Chunks()) {
+    if (chunk.size() <= kMaxBytesToCopy) {
+      result.Append(chunk, cord.size());
+    } else {
+      result.AppendExternal(CordRef(cord), chunk, cord.size());
+    }
+  }
+  return result;
+}
+
+absl::Cord CordFromChain(const Chain& chain) {
+  absl::Cord result;
+  for (Chain::BlockIterator iter = chain.blocks().cbegin();
+       iter != chain.blocks().cend(); ++iter) {
+    if (iter->size() <= kMaxBytesToCopy) {
+      result.Append(*iter);
+    } else {
+      const Chain::PinnedBlock pinned = iter.Pin();
+      void* const token = pinned.token;
+      result.Append(absl::MakeCordFromExternal(
+          pinned.data,
+          [token](absl::string_view) { Chain::PinnedBlock::Unpin(token); }));
+    }
+  }
+  return result;
+}
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_HAS_CORD
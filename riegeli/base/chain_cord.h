@@ -0,0 +1,52 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BASE_CHAIN_CORD_H_
+#define RIEGELI_BASE_CHAIN_CORD_H_
+
+// Conversions between Chain and absl::Cord which share the data instead of
+// copying it, for passing riegeli records to and from Cord-based interfaces.
+//
+// absl::Cord is available only in sufficiently new Abseil versions. With older
+// Abseil, as currently imported by the workspace, these functions compile out;
+// RIEGELI_HAS_CORD tells whether they are available.
+
+#if defined(__has_include)
+#if __has_include("absl/strings/cord.h")
+#define RIEGELI_HAS_CORD 1
+#endif
+#endif
+
+#ifdef RIEGELI_HAS_CORD
+
+#include "absl/strings/cord.h"
+#include "riegeli/base/chain.h"
+
+namespace riegeli {
+
+// Converts absl::Cord to Chain. Chunks of the Cord longer than
+// kMaxBytesToCopy are wrapped as external Chain blocks which keep the Cord
+// data alive, instead of copying the bytes.
+Chain ChainFromCord(const absl::Cord& cord);
+
+// Converts Chain to absl::Cord. Blocks of the Chain longer than
+// kMaxBytesToCopy are wrapped as external Cord chunks which keep the Chain
+// blocks pinned, instead of copying the bytes.
+absl::Cord CordFromChain(const Chain& chain);
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_HAS_CORD
+
+#endif  // RIEGELI_BASE_CHAIN_CORD_H_
@@ -15,8 +15,21 @@
 #ifndef RIEGELI_BASE_ENDIAN_H_
 #define RIEGELI_BASE_ENDIAN_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include <cstring>
+
+// Host endianness, if known at compile time. If neither macro is defined to 1,
+// the batch conversion functions below use a portable element-wise loop.
+#if defined(__BYTE_ORDER__) && defined(__ORDER_LITTLE_ENDIAN__) && \
+    __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define RIEGELI_INTERNAL_LITTLE_ENDIAN 1
+#elif defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__) && \
+    __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define RIEGELI_INTERNAL_BIG_ENDIAN 1
+#endif
+
 namespace riegeli {
 
 // Converts a native 16-bit number to a word such that writing the word to a
@@ -157,6 +170,153 @@ inline uint64_t ReadBigEndian64(uint64_t word) {
          (uint64_t{ptr[6]} << 8) | uint64_t{ptr[7]};
 }
 
+// Batch conversions, for materializing or serializing arrays of fixed-width
+// numbers. Reading functions read size numbers from a byte array of
+// size * sizeof(number) bytes to an array of numbers; writing functions do the
+// converse. Source and destination must not overlap.
+//
+// On a host whose endianness matches the encoding this is a single memcpy()
+// running at memory bandwidth; otherwise an element-wise loop which compilers
+// vectorize.
+
+inline void ReadLittleEndian16s(const char* src, uint16_t* dest, size_t size) {
+#if RIEGELI_INTERNAL_LITTLE_ENDIAN
+  std::memcpy(dest, src, size * sizeof(uint16_t));
+#else
+  for (size_t i = 0; i < size; ++i) {
+    uint16_t word;
+    std::memcpy(&word, src + i * sizeof(uint16_t), sizeof(uint16_t));
+    dest[i] = ReadLittleEndian16(word);
+  }
+#endif
+}
+
+inline void ReadLittleEndian32s(const char* src, uint32_t* dest, size_t size) {
+#if RIEGELI_INTERNAL_LITTLE_ENDIAN
+  std::memcpy(dest, src, size * sizeof(uint32_t));
+#else
+  for (size_t i = 0; i < size; ++i) {
+    uint32_t word;
+    std::memcpy(&word, src + i * sizeof(uint32_t), sizeof(uint32_t));
+    dest[i] = ReadLittleEndian32(word);
+  }
+#endif
+}
+
+inline void ReadLittleEndian64s(const char* src, uint64_t* dest, size_t size) {
+#if RIEGELI_INTERNAL_LITTLE_ENDIAN
+  std::memcpy(dest, src, size * sizeof(uint64_t));
+#else
+  for (size_t i = 0; i < size; ++i) {
+    uint64_t word;
+    std::memcpy(&word, src + i * sizeof(uint64_t), sizeof(uint64_t));
+    dest[i] = ReadLittleEndian64(word);
+  }
+#endif
+}
+
+inline void WriteLittleEndian16s(const uint16_t* src, char* dest, size_t size) {
+#if RIEGELI_INTERNAL_LITTLE_ENDIAN
+  std::memcpy(dest, src, size * sizeof(uint16_t));
+#else
+  for (size_t i = 0; i < size; ++i) {
+    const uint16_t word = WriteLittleEndian16(src[i]);
+    std::memcpy(dest + i * sizeof(uint16_t), &word, sizeof(uint16_t));
+  }
+#endif
+}
+
+inline void WriteLittleEndian32s(const uint32_t* src, char* dest, size_t size) {
+#if RIEGELI_INTERNAL_LITTLE_ENDIAN
+  std::memcpy(dest, src, size * sizeof(uint32_t));
+#else
+  for (size_t i = 0; i < size; ++i) {
+    const uint32_t word = WriteLittleEndian32(src[i]);
+    std::memcpy(dest + i * sizeof(uint32_t), &word, sizeof(uint32_t));
+  }
+#endif
+}
+
+inline void WriteLittleEndian64s(const uint64_t* src, char* dest, size_t size) {
+#if RIEGELI_INTERNAL_LITTLE_ENDIAN
+  std::memcpy(dest, src, size * sizeof(uint64_t));
+#else
+  for (size_t i = 0; i < size; ++i) {
+    const uint64_t word = WriteLittleEndian64(src[i]);
+    std::memcpy(dest + i * sizeof(uint64_t), &word, sizeof(uint64_t));
+  }
+#endif
+}
+
+inline void ReadBigEndian16s(const char* src, uint16_t* dest, size_t size) {
+#if RIEGELI_INTERNAL_BIG_ENDIAN
+  std::memcpy(dest, src, size * sizeof(uint16_t));
+#else
+  for (size_t i = 0; i < size; ++i) {
+    uint16_t word;
+    std::memcpy(&word, src + i * sizeof(uint16_t), sizeof(uint16_t));
+    dest[i] = ReadBigEndian16(word);
+  }
+#endif
+}
+
+inline void ReadBigEndian32s(const char* src, uint32_t* dest, size_t size) {
+#if RIEGELI_INTERNAL_BIG_ENDIAN
+  std::memcpy(dest, src, size * sizeof(uint32_t));
+#else
+  for (size_t i = 0; i < size; ++i) {
+    uint32_t word;
+    std::memcpy(&word, src + i * sizeof(uint32_t), sizeof(uint32_t));
+    dest[i] = ReadBigEndian32(word);
+  }
+#endif
+}
+
+inline void ReadBigEndian64s(const char* src, uint64_t* dest, size_t size) {
+#if RIEGELI_INTERNAL_BIG_ENDIAN
+  std::memcpy(dest, src, size * sizeof(uint64_t));
+#else
+  for (size_t i = 0; i < size; ++i) {
+    uint64_t word;
+    std::memcpy(&word, src + i * sizeof(uint64_t), sizeof(uint64_t));
+    dest[i] = ReadBigEndian64(word);
+  }
+#endif
+}
+
+inline void WriteBigEndian16s(const uint16_t* src, char* dest, size_t size) {
+#if RIEGELI_INTERNAL_BIG_ENDIAN
+  std::memcpy(dest, src, size * sizeof(uint16_t));
+#else
+  for (size_t i = 0; i < size; ++i) {
+    const uint16_t word = WriteBigEndian16(src[i]);
+    std::memcpy(dest + i * sizeof(uint16_t), &word, sizeof(uint16_t));
+  }
+#endif
+}
+
+inline void WriteBigEndian32s(const uint32_t* src, char* dest, size_t size) {
+#if RIEGELI_INTERNAL_BIG_ENDIAN
+  std::memcpy(dest, src, size * sizeof(uint32_t));
+#else
+  for (size_t i = 0; i < size; ++i) {
+    const uint32_t word = WriteBigEndian32(src[i]);
+    std::memcpy(dest + i * sizeof(uint32_t), &word, sizeof(uint32_t));
+  }
+#endif
+}
+
+inline void WriteBigEndian64s(const uint64_t* src, char* dest, size_t size) {
+#if RIEGELI_INTERNAL_BIG_ENDIAN
+  std::memcpy(dest, src, size * sizeof(uint64_t));
+#else
+  for (size_t i = 0; i < size; ++i) {
+    const uint64_t word = WriteBigEndian64(src[i]);
+    std::memcpy(dest + i * sizeof(uint64_t), &word, sizeof(uint64_t));
+  }
+#endif
+}
+
 }  // namespace riegeli
 
 #endif  // RIEGELI_BASE_ENDIAN_H_
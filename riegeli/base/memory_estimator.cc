@@ -14,30 +14,88 @@
 
 #include "riegeli/base/memory_estimator.h"
 
+#include <stddef.h>
+
+#include <functional>
+#include <utility>
+#include <vector>
+
 #include "absl/container/flat_hash_set.h"
+#include "absl/hash/hash.h"
+#include "absl/synchronization/mutex.h"
 #include "absl/utility/utility.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/parallelism.h"
 
 namespace riegeli {
 
+#if __cplusplus < 201703
+constexpr size_t MemoryEstimator::SharedRegistry::kNumShards;
+#endif
+
 MemoryEstimator::MemoryEstimator(const MemoryEstimator& that)
-    : total_memory_(that.total_memory_), objects_seen_(that.objects_seen_) {}
+    : total_memory_(that.total_memory_),
+      objects_seen_(that.objects_seen_),
+      shared_registry_(that.shared_registry_) {}
 
 MemoryEstimator& MemoryEstimator::operator=(const MemoryEstimator& that) {
   total_memory_ = that.total_memory_;
   objects_seen_ = that.objects_seen_;
+  shared_registry_ = that.shared_registry_;
   return *this;
 }
 
 MemoryEstimator::MemoryEstimator(MemoryEstimator&& that) noexcept
     : total_memory_(absl::exchange(that.total_memory_, 0)),
       objects_seen_(absl::exchange(that.objects_seen_,
-                                   absl::flat_hash_set<const void*>())) {}
+                                   absl::flat_hash_set<const void*>())),
+      shared_registry_(absl::exchange(that.shared_registry_, nullptr)) {}
 
 MemoryEstimator& MemoryEstimator::operator=(MemoryEstimator&& that) noexcept {
   total_memory_ = absl::exchange(that.total_memory_, 0);
   objects_seen_ =
       absl::exchange(that.objects_seen_, absl::flat_hash_set<const void*>());
+  shared_registry_ = absl::exchange(that.shared_registry_, nullptr);
   return *this;
 }
 
+bool MemoryEstimator::SharedRegistry::RegisterNode(const void* ptr) {
+  Shard& shard = shards_[absl::Hash<const void*>()(ptr) % kNumShards];
+  absl::MutexLock lock(&shard.mutex);
+  return shard.objects_seen.insert(ptr).second;
+}
+
+size_t EstimateMemoryInParallel(
+    std::vector<std::function<void(MemoryEstimator*)>> register_objects) {
+  MemoryEstimator::SharedRegistry registry;
+  std::vector<MemoryEstimator> estimators;
+  estimators.reserve(register_objects.size());
+  for (size_t i = 0; i < register_objects.size(); ++i) {
+    estimators.emplace_back(&registry);
+  }
+  absl::Mutex mutex;
+  size_t remaining = register_objects.size();
+  for (size_t i = 0; i < register_objects.size(); ++i) {
+    const std::function<void(MemoryEstimator*)>& register_object =
+        register_objects[i];
+    MemoryEstimator* const estimator = &estimators[i];
+    internal::ThreadPool::global_cpu().Schedule(
+        [&register_object, estimator, &mutex, &remaining] {
+          register_object(estimator);
+          absl::MutexLock lock(&mutex);
+          --remaining;
+        });
+  }
+  {
+    absl::MutexLock lock(&mutex);
+    mutex.Await(absl::Condition(
+        +[](size_t* remaining) { return *remaining == 0; }, &remaining));
+  }
+  size_t total_memory = 0;
+  for (const MemoryEstimator& estimator : estimators) {
+    total_memory = SaturatingAdd(total_memory, estimator.TotalMemory());
+  }
+  return total_memory;
+}
+
 }  // namespace riegeli
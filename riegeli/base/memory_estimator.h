@@ -17,7 +17,13 @@
 
 #include <stddef.h>
 
+#include <functional>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
 #include "absl/container/flat_hash_set.h"
+#include "absl/hash/hash.h"
+#include "absl/synchronization/mutex.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/memory.h"
 
@@ -67,8 +73,16 @@ namespace riegeli {
 // The estimation can thus be inexact.
 class MemoryEstimator {
  public:
+  class SharedRegistry;
+
   MemoryEstimator() {}
 
+  // The MemoryEstimator will consult the given registry of objects seen,
+  // shared between several MemoryEstimators cooperating on one estimation,
+  // instead of a private one. The registry must outlive the MemoryEstimator.
+  explicit MemoryEstimator(SharedRegistry* registry)
+      : shared_registry_(registry) {}
+
   MemoryEstimator(const MemoryEstimator& that);
   MemoryEstimator& operator=(const MemoryEstimator& that);
 
@@ -100,8 +114,46 @@ class MemoryEstimator {
  private:
   size_t total_memory_ = 0;
   absl::flat_hash_set<const void*> objects_seen_;
+  SharedRegistry* shared_registry_ = nullptr;
 };
 
+// A thread-safe set of objects seen, shared between several MemoryEstimators
+// cooperating on one estimation so that subobjects shared between the
+// estimated objects are counted once. The set is sharded by pointer hash to
+// reduce mutex contention.
+class MemoryEstimator::SharedRegistry {
+ public:
+  SharedRegistry() {}
+
+  SharedRegistry(const SharedRegistry&) = delete;
+  SharedRegistry& operator=(const SharedRegistry&) = delete;
+
+  // Analogous to MemoryEstimator::RegisterNode(). Thread-safe.
+  bool RegisterNode(const void* ptr);
+
+ private:
+  static constexpr size_t kNumShards = 16;
+
+  struct Shard {
+    absl::Mutex mutex;
+    absl::flat_hash_set<const void*> objects_seen GUARDED_BY(mutex);
+  };
+
+  Shard shards_[kNumShards];
+};
+
+// Estimates the total amount of memory used by multiple objects which may
+// share their subobjects, traversing the objects in parallel over the internal
+// thread pool. Each function registers one object with the MemoryEstimator
+// passed to it; the MemoryEstimators share one SharedRegistry, hence shared
+// subobjects are counted once.
+//
+// This distributes the cost of estimating memory of a large pipeline over
+// worker threads instead of stalling the calling thread for the whole
+// traversal.
+size_t EstimateMemoryInParallel(
+    std::vector<std::function<void(MemoryEstimator*)>> register_objects);
+
 // Implementation details follow.
 
 inline void MemoryEstimator::RegisterMemory(size_t memory) {
@@ -113,6 +165,7 @@ inline void MemoryEstimator::RegisterDynamicMemory(size_t memory) {
 }
 
 inline bool MemoryEstimator::RegisterNode(const void* ptr) {
+  if (shared_registry_ != nullptr) return shared_registry_->RegisterNode(ptr);
   return objects_seen_.insert(ptr).second;
 }
 
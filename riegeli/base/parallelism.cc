@@ -14,10 +14,25 @@
 
 #include "riegeli/base/parallelism.h"
 
+#include <stddef.h>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <atomic>
+#ifdef __linux__
+#include <cstdio>
+#include <cstdlib>
+#endif
 #include <functional>
 #include <thread>
 #include <utility>
+#ifdef __linux__
+#include <vector>
+#endif
 
+#include "absl/base/optimization.h"
 #include "absl/base/thread_annotations.h"
 #include "absl/synchronization/mutex.h"
 #include "absl/time/time.h"
@@ -27,6 +42,84 @@
 namespace riegeli {
 namespace internal {
 
+namespace {
+
+inline size_t NumQueues(size_t max_threads) {
+  if (max_threads > 0) return max_threads;
+  return UnsignedMax(size_t{std::thread::hardware_concurrency()}, size_t{1});
+}
+
+#ifdef __linux__
+
+// The set of CPUs of each NUMA node, read from sysfs. Empty if there is only
+// one node or the topology could not be determined; workers are not pinned
+// then.
+const std::vector<cpu_set_t>& NumaTopology() {
+  static const NoDestructor<std::vector<cpu_set_t>> kTopology([] {
+    std::vector<cpu_set_t> nodes;
+    for (int node = 0;; ++node) {
+      char filename[64];
+      std::snprintf(filename, sizeof(filename),
+                    "/sys/devices/system/node/node%d/cpulist", node);
+      std::FILE* const file = std::fopen(filename, "r");
+      if (file == nullptr) break;
+      cpu_set_t cpus;
+      CPU_ZERO(&cpus);
+      char cpulist[512];
+      if (std::fgets(cpulist, sizeof(cpulist), file) != nullptr) {
+        // Parse a list of CPU ranges, e.g. "0-15,32-47".
+        char* ptr = cpulist;
+        for (;;) {
+          char* end;
+          const long first = std::strtol(ptr, &end, 10);
+          if (end == ptr) break;
+          long last = first;
+          ptr = end;
+          if (*ptr == '-') {
+            last = std::strtol(ptr + 1, &end, 10);
+            if (end == ptr + 1) break;
+            ptr = end;
+          }
+          for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu) {
+            CPU_SET(cpu, &cpus);
+          }
+          if (*ptr != ',') break;
+          ++ptr;
+        }
+      }
+      std::fclose(file);
+      nodes.push_back(cpus);
+    }
+    if (nodes.size() <= 1) nodes.clear();
+    return nodes;
+  }());
+  return *kTopology;
+}
+
+// Pins the calling worker thread to the NUMA node containing the CPU with
+// the same index as its home queue, so that the worker runs near the memory
+// of tasks scheduled from that CPU. No-op if the topology is unknown or the
+// queue does not correspond to a CPU.
+void PinToNodeOfQueue(size_t home_queue) {
+  if (home_queue >= CPU_SETSIZE) return;
+  for (const cpu_set_t& cpus : NumaTopology()) {
+    if (CPU_ISSET(home_queue, &cpus)) {
+      // Failure to pin is not an error; placement is only a hint.
+      pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpus);
+      return;
+    }
+  }
+}
+
+#endif  // __linux__
+
+}  // namespace
+
+ThreadPool::ThreadPool(size_t max_threads)
+    : num_queues_(NumQueues(max_threads)),
+      max_threads_(max_threads),
+      queues_(new Queue[num_queues_]) {}
+
 ThreadPool::~ThreadPool() {
   absl::MutexLock lock(&mutex_);
   exiting_ = true;
@@ -34,43 +127,109 @@ ThreadPool::~ThreadPool() {
       +[](size_t* num_threads) { return *num_threads == 0; }, &num_threads_));
 }
 
-void ThreadPool::Schedule(std::function<void()> task) {
+bool ThreadPool::PopTask(size_t home_queue, std::function<void()>* task) {
+  if (num_pending_tasks_.load(std::memory_order_acquire) == 0) return false;
+  for (size_t i = 0; i < num_queues_; ++i) {
+    Queue& queue = queues_[(home_queue + i) % num_queues_];
+    absl::MutexLock lock(&queue.mutex);
+    if (!queue.high_priority_tasks.empty()) {
+      *task = std::move(queue.high_priority_tasks.front());
+      queue.high_priority_tasks.pop_front();
+      num_pending_tasks_.fetch_sub(1, std::memory_order_release);
+      return true;
+    }
+    if (!queue.tasks.empty()) {
+      *task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+      num_pending_tasks_.fetch_sub(1, std::memory_order_release);
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPool::WorkerLoop(size_t home_queue) {
+#ifdef __linux__
+  PinToNodeOfQueue(home_queue);
+#endif
+  for (;;) {
+    std::function<void()> task;
+    if (PopTask(home_queue, &task)) {
+      task();
+      task = nullptr;
+      continue;
+    }
+    absl::MutexLock lock(&mutex_);
+    ++num_idle_threads_;
+    const bool have_work = mutex_.AwaitWithTimeout(
+        absl::Condition(
+            +[](ThreadPool* self) EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+              return self->num_pending_tasks_.load(
+                         std::memory_order_acquire) > 0 ||
+                     self->exiting_;
+            },
+            this),
+        absl::Seconds(60));
+    --num_idle_threads_;
+    if ((!have_work || exiting_) &&
+        num_pending_tasks_.load(std::memory_order_acquire) == 0) {
+      // Idle for a long time, or the thread pool is exiting and remaining
+      // tasks are drained.
+      --num_threads_;
+      return;
+    }
+  }
+}
+
+size_t ThreadPool::HomeQueueOfThisThread() {
+#ifdef __linux__
+  const int cpu = sched_getcpu();
+  if (ABSL_PREDICT_TRUE(cpu >= 0)) return IntCast<size_t>(cpu) % num_queues_;
+#endif
+  return next_queue_.fetch_add(1, std::memory_order_relaxed) % num_queues_;
+}
+
+void ThreadPool::Schedule(std::function<void()> task, Priority priority) {
+  const size_t queue_index = HomeQueueOfThisThread();
+  {
+    absl::MutexLock lock(&queues_[queue_index].mutex);
+    switch (priority) {
+      case Priority::kRegular:
+        queues_[queue_index].tasks.push_back(std::move(task));
+        break;
+      case Priority::kHigh:
+        queues_[queue_index].high_priority_tasks.push_back(std::move(task));
+        break;
+    }
+  }
+  num_pending_tasks_.fetch_add(1, std::memory_order_release);
   {
     absl::MutexLock lock(&mutex_);
     RIEGELI_ASSERT(!exiting_)
-        << "Failed precondition of ThreadPool::Schedule(): no new threads may "
+        << "Failed precondition of ThreadPool::Schedule(): no new tasks may "
            "be scheduled while the thread pool is exiting";
-    tasks_.push_back(std::move(task));
-    if (num_idle_threads_ >= tasks_.size()) return;
+    if (num_idle_threads_ >=
+        num_pending_tasks_.load(std::memory_order_relaxed)) {
+      // An idle worker will pick the task up.
+      return;
+    }
+    if (max_threads_ > 0 && num_threads_ >= max_threads_) {
+      // A busy worker will pick the task up when it finishes its current task.
+      return;
+    }
     ++num_threads_;
   }
-  std::thread([this] {
-    for (;;) {
-      absl::ReleasableMutexLock lock(&mutex_);
-      ++num_idle_threads_;
-      mutex_.AwaitWithTimeout(
-          absl::Condition(
-              +[](ThreadPool* self) EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
-                return !self->tasks_.empty() || self->exiting_;
-              },
-              this),
-          absl::Seconds(60));
-      --num_idle_threads_;
-      if (tasks_.empty() || exiting_) {
-        --num_threads_;
-        return;
-      }
-      const std::function<void()> task = std::move(tasks_.front());
-      tasks_.pop_front();
-      lock.Release();
-      task();
-    }
-  }).detach();
+  std::thread([this, queue_index] { WorkerLoop(queue_index); }).detach();
+}
+
+ThreadPool& ThreadPool::global_cpu() {
+  static NoDestructor<ThreadPool> kStaticCpuThreadPool;
+  return *kStaticCpuThreadPool;
 }
 
-ThreadPool& ThreadPool::global() {
-  static NoDestructor<ThreadPool> kStaticThreadPool;
-  return *kStaticThreadPool;
+ThreadPool& ThreadPool::global_io() {
+  static NoDestructor<ThreadPool> kStaticIoThreadPool;
+  return *kStaticIoThreadPool;
 }
 
 }  // namespace internal
@@ -17,8 +17,10 @@
 
 #include <stddef.h>
 
+#include <atomic>
 #include <deque>
 #include <functional>
+#include <memory>
 
 #include "absl/base/thread_annotations.h"
 #include "absl/synchronization/mutex.h"
@@ -26,27 +28,103 @@
 namespace riegeli {
 namespace internal {
 
-// A thread pool with lazily created worker threads, without a thread count
-// limit. Worker threads exit after being idle for one minute.
+// A thread pool with lazily created worker threads and per-worker task queues
+// with work stealing: a task is scheduled onto one of the queues, and a worker
+// which finds its own queue empty takes tasks from other queues. This avoids
+// contending on a single queue mutex when tasks are scheduled and finished at
+// a high rate from many threads.
+//
+// The number of worker threads can be bounded. Worker threads exit after being
+// idle for one minute.
+//
+// Scheduled tasks may block, also waiting for effects of tasks scheduled
+// later; this is how a parallel RecordWriter uses the pool. Hence with a
+// bounded pool the bound must exceed the number of tasks which can block at
+// the same time, otherwise tasks they wait for would never run. The unbounded
+// default is safe for arbitrary numbers of pipelines.
+//
+// There are two shared pools: global_cpu() for CPU bound tasks like
+// compression and encoding, and global_io() for tasks which mostly block on
+// I/O like background fsync() and read ahead. Keeping them separate prevents
+// a burst of slow I/O tasks from occupying the workers which CPU bound tasks
+// are waiting for, and conversely.
+//
+// Scheduling is locality aware: a task is scheduled onto the queue
+// corresponding to the CPU of the scheduling thread, so tasks produced by
+// the same thread tend to run on the same worker. On Linux each worker is
+// additionally pinned to the NUMA node of its home queue. Together these
+// keep a task near the memory its producer allocated, e.g. a chunk
+// compression task near the Chain blocks filled by the encoding stage, which
+// matters on multi-socket machines where cross-node memory traffic is slow.
 class ThreadPool {
  public:
-  ThreadPool() {}
+  // The urgency of a scheduled task relative to other tasks in the same pool.
+  //
+  // High priority tasks are picked up before regular tasks waiting in the
+  // same queue, e.g. a flush which a caller is about to block on ahead of
+  // speculative read ahead.
+  enum class Priority {
+    kRegular,
+    kHigh,
+  };
+
+  // Creates a thread pool with at most max_threads worker threads.
+  //
+  // max_threads == 0 means no limit.
+  explicit ThreadPool(size_t max_threads = 0);
 
   ThreadPool(const ThreadPool&) = delete;
   ThreadPool& operator=(const ThreadPool&) = delete;
 
   ~ThreadPool();
 
-  static ThreadPool& global();
+  // The shared pool for CPU bound tasks.
+  static ThreadPool& global_cpu();
+
+  // The shared pool for tasks which mostly block on I/O.
+  static ThreadPool& global_io();
 
-  void Schedule(std::function<void()> task);
+  void Schedule(std::function<void()> task,
+                Priority priority = Priority::kRegular);
 
  private:
+  // A task queue served primarily by one worker thread, with its own mutex.
+  // High priority tasks are picked up before regular tasks.
+  struct Queue {
+    absl::Mutex mutex;
+    std::deque<std::function<void()>> high_priority_tasks GUARDED_BY(mutex);
+    std::deque<std::function<void()>> tasks GUARDED_BY(mutex);
+  };
+
+  // Takes a task from the queue with the given index, or steals one from
+  // another queue. Returns false if all queues are empty.
+  bool PopTask(size_t home_queue, std::function<void()>* task);
+
+  // The main loop of a worker thread serving primarily the queue with the
+  // given index.
+  void WorkerLoop(size_t home_queue);
+
+  // Returns the index of the queue which a task scheduled from the calling
+  // thread should be pushed onto: the queue of the current CPU where the CPU
+  // can be determined, round robin otherwise.
+  size_t HomeQueueOfThisThread();
+
+  // The number of task queues. Fixed at construction.
+  const size_t num_queues_;
+  // The maximal number of worker threads, or 0 if unbounded.
+  const size_t max_threads_;
+  const std::unique_ptr<Queue[]> queues_;
+  // The queue which the next task will be scheduled onto when the current
+  // CPU cannot be determined (round robin).
+  std::atomic<size_t> next_queue_{0};
+  // The total number of tasks waiting in all queues. Tracked separately so
+  // that idle workers can wait for work without holding queue mutexes.
+  std::atomic<size_t> num_pending_tasks_{0};
+
   absl::Mutex mutex_;
   bool exiting_ GUARDED_BY(mutex_) = false;
   size_t num_threads_ GUARDED_BY(mutex_) = 0;
   size_t num_idle_threads_ GUARDED_BY(mutex_) = 0;
-  std::deque<std::function<void()>> tasks_ GUARDED_BY(mutex_);
 };
 
 }  // namespace internal
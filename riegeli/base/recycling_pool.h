@@ -17,6 +17,7 @@
 
 #include <stddef.h>
 
+#include <atomic>
 #include <deque>
 #include <list>
 #include <memory>
@@ -25,12 +26,28 @@
 #include "absl/base/optimization.h"
 #include "absl/base/thread_annotations.h"
 #include "absl/container/flat_hash_map.h"
+#include "absl/hash/hash.h"
 #include "absl/synchronization/mutex.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/memory.h"
 
 namespace riegeli {
 
+namespace internal {
+
+// Returns a small number identifying the current thread, used to spread
+// threads over pool shards. Distinct live threads can get the same index, but
+// indices are assigned round robin so collisions of concurrently running
+// threads are rare.
+inline size_t RecyclingPoolThreadIndex() {
+  static std::atomic<size_t> next_index{0};
+  thread_local const size_t index =
+      next_index.fetch_add(1, std::memory_order_relaxed);
+  return index;
+}
+
+}  // namespace internal
+
 // RecyclingPool<T, Deleter, Key> keeps a pool of idle objects of type T, so
 // that instead of creating a new object of type T, an existing object can be
 // recycled. This is helpful if constructing a new object is more expensive than
@@ -43,6 +60,11 @@ namespace riegeli {
 // objects, which should be assigned the same key. The Key type must be equality
 // comparable, hashable (by absl::Hash), default constructible, and copyable.
 // If Key is void, all objects are considered compatible.
+//
+// The pool is internally sharded: objects are distributed over several
+// independently locked shards by the hash of their key, so that concurrent
+// Get()/Put() calls from many threads do not contend on a single mutex. LRU
+// eviction applies within each shard.
 template <typename T, typename Deleter = std::default_delete<T>,
           typename Key = void>
 class RecyclingPool {
@@ -83,9 +105,14 @@ class RecyclingPool {
   // The default value of the constructor argument.
   static constexpr size_t kDefaultMaxSize = 16;
 
-  // Creates a pool with the given maximal number of objects to keep.
+  // The number of independently locked shards.
+  static constexpr size_t kNumShards = 8;
+
+  // Creates a pool with the given maximal number of objects to keep. The limit
+  // is divided among shards, each shard keeping at least one object, hence the
+  // effective limit is rounded up to a multiple of the number of shards.
   explicit RecyclingPool(size_t max_size = kDefaultMaxSize)
-      : max_size_(max_size), cache_(by_key_.end()) {}
+      : max_size_per_shard_(UnsignedMax(max_size / kNumShards, size_t{1})) {}
 
   RecyclingPool(const RecyclingPool&) = delete;
   RecyclingPool& operator=(const RecyclingPool&) = delete;
@@ -105,6 +132,12 @@ class RecyclingPool {
   Handle Get(Key key, Factory factory,
              Refurbisher refurbisher = DefaultRefurbisher());
 
+  // Puts an object into the pool, associating it with key. This happens
+  // automatically when a Handle is destroyed; explicit Put() supports callers
+  // which had released the object from its Handle and keep it in a plain
+  // unique_ptr.
+  void Put(const Key& key, std::unique_ptr<T, Deleter> object);
+
  private:
   // Adding or removing elements in ByFreshness must not invalidate other
   // iterators.
@@ -124,25 +157,35 @@ class RecyclingPool {
 
   using ByKey = absl::flat_hash_map<Key, Entries>;
 
-  void Put(const Key& key, std::unique_ptr<T, Deleter> object);
+  // A shard of the pool, holding objects whose keys hash to it.
+  struct Shard {
+    Shard() : cache(by_key.end()) {}
+
+    absl::Mutex mutex;
+    // The key of each object, ordered by the freshness of the object (older to
+    // newer).
+    ByFreshness by_freshness GUARDED_BY(mutex);
+    // Objects grouped by their keys. Within each map value the list of objects
+    // is non-empty and is ordered by their freshness (older to newer). Each
+    // object is associated with the matching by_freshness iterator.
+    ByKey by_key GUARDED_BY(mutex);
+    // Optimization for Get() followed by Put() with a matching key.
+    // If cache != by_key.end(), then cache->second.back().object is replaced
+    // with nullptr instead of erasing its entries.
+    typename ByKey::iterator cache GUARDED_BY(mutex);
+  };
 
-  size_t max_size_;
-  absl::Mutex mutex_;
-  // The key of each object, ordered by the freshness of the object (older to
-  // newer).
-  ByFreshness by_freshness_ GUARDED_BY(mutex_);
-  // Objects grouped by their keys. Within each map value the list of objects is
-  // non-empty and is ordered by their freshness (older to newer). Each object
-  // is associated with the matching by_freshness_ iterator.
-  ByKey by_key_ GUARDED_BY(mutex_);
-  // Optimization for Get() followed by Put() with a matching key.
-  // If cache_ != by_key_.end(), then cache_->second.back().object is replaced
-  // with nullptr instead of erasing its entries.
-  typename ByKey::iterator cache_ GUARDED_BY(mutex_);
+  Shard& ShardForKey(const Key& key) {
+    return shards_[absl::Hash<Key>()(key) % kNumShards];
+  }
+
+  size_t max_size_per_shard_;
+  Shard shards_[kNumShards];
 };
 
 // Specialization of RecyclingPool when Key is void. In this case Get() does not
-// take a key as a parameter.
+// take a key as a parameter, and objects are distributed over shards by the
+// calling thread.
 template <typename T, typename Deleter>
 class RecyclingPool<T, Deleter, void> {
  public:
@@ -174,8 +217,10 @@ class RecyclingPool<T, Deleter, void> {
 
   static constexpr size_t kDefaultMaxSize = 16;
 
+  static constexpr size_t kNumShards = 8;
+
   explicit RecyclingPool(size_t max_size = kDefaultMaxSize)
-      : max_size_(max_size) {}
+      : max_size_per_shard_(UnsignedMax(max_size / kNumShards, size_t{1})) {}
 
   RecyclingPool(const RecyclingPool&) = delete;
   RecyclingPool& operator=(const RecyclingPool&) = delete;
@@ -185,13 +230,24 @@ class RecyclingPool<T, Deleter, void> {
   template <typename Factory, typename Refurbisher = DefaultRefurbisher>
   Handle Get(Factory factory, Refurbisher refurbisher = DefaultRefurbisher());
 
- private:
+  // Puts an object into the pool. This happens automatically when a Handle is
+  // destroyed; explicit Put() supports callers which had released the object
+  // from its Handle and keep it in a plain unique_ptr.
   void Put(std::unique_ptr<T, Deleter> object);
 
-  size_t max_size_;
-  absl::Mutex mutex_;
-  // All objects, ordered by freshness (older to newer).
-  std::deque<std::unique_ptr<T, Deleter>> by_freshness_ GUARDED_BY(mutex_);
+ private:
+  struct Shard {
+    absl::Mutex mutex;
+    // All objects of the shard, ordered by freshness (older to newer).
+    std::deque<std::unique_ptr<T, Deleter>> by_freshness GUARDED_BY(mutex);
+  };
+
+  Shard& ShardForThisThread() {
+    return shards_[internal::RecyclingPoolThreadIndex() % kNumShards];
+  }
+
+  size_t max_size_per_shard_;
+  Shard shards_[kNumShards];
 };
 
 // Implementation details follow.
@@ -215,33 +271,34 @@ template <typename Factory, typename Refurbisher>
 typename RecyclingPool<T, Deleter, Key>::Handle
 RecyclingPool<T, Deleter, Key>::Get(Key key, Factory factory,
                                     Refurbisher refurbisher) {
+  Shard& shard = ShardForKey(key);
   std::unique_ptr<T, Deleter> returned;
   {
-    absl::MutexLock lock(&mutex_);
-    if (cache_ != by_key_.end()) {
+    absl::MutexLock lock(&shard.mutex);
+    if (shard.cache != shard.by_key.end()) {
       // Finish erasing the cached entry.
-      Entries& entries = cache_->second;
+      Entries& entries = shard.cache->second;
       RIEGELI_ASSERT(!entries.empty()) << "Failed invariant of RecyclingPool: "
-                                          "empty by_key_ value";
+                                          "empty by_key value";
       RIEGELI_ASSERT(entries.back().object == nullptr)
           << "Failed invariant of RecyclingPool: "
-             "non-nullptr object pointed to by cache_";
-      by_freshness_.erase(entries.back().by_freshness_iter);
+             "non-nullptr object pointed to by cache";
+      shard.by_freshness.erase(entries.back().by_freshness_iter);
       entries.pop_back();
-      if (entries.empty()) by_key_.erase(cache_);
+      if (entries.empty()) shard.by_key.erase(shard.cache);
     }
-    const typename ByKey::iterator by_key_iter = by_key_.find(key);
-    if (ABSL_PREDICT_TRUE(by_key_iter != by_key_.end())) {
+    const typename ByKey::iterator by_key_iter = shard.by_key.find(key);
+    if (ABSL_PREDICT_TRUE(by_key_iter != shard.by_key.end())) {
       // Return the newest entry with this key.
       Entries& entries = by_key_iter->second;
       RIEGELI_ASSERT(!entries.empty()) << "Failed invariant of RecyclingPool: "
-                                          "empty by_key_ value";
+                                          "empty by_key value";
       RIEGELI_ASSERT(entries.back().object != nullptr)
           << "Failed invariant of RecyclingPool: "
-             "nullptr object not pointed to by cache_";
+             "nullptr object not pointed to by cache";
       returned = std::move(entries.back().object);
     }
-    cache_ = by_key_iter;
+    shard.cache = by_key_iter;
   }
   if (ABSL_PREDICT_TRUE(returned != nullptr)) {
     refurbisher(returned.get());
@@ -256,52 +313,53 @@ RecyclingPool<T, Deleter, Key>::Get(Key key, Factory factory,
 template <typename T, class Deleter, typename Key>
 void RecyclingPool<T, Deleter, Key>::Put(const Key& key,
                                          std::unique_ptr<T, Deleter> object) {
+  Shard& shard = ShardForKey(key);
   std::unique_ptr<T, Deleter> evicted;
-  absl::MutexLock lock(&mutex_);
+  absl::MutexLock lock(&shard.mutex);
   // Add a newest entry with this key.
-  if (ABSL_PREDICT_TRUE(cache_ != by_key_.end())) {
-    Entries& entries = cache_->second;
+  if (ABSL_PREDICT_TRUE(shard.cache != shard.by_key.end())) {
+    Entries& entries = shard.cache->second;
     RIEGELI_ASSERT(!entries.empty()) << "Failed invariant of RecyclingPool: "
-                                        "empty by_key_ value";
-    if (ABSL_PREDICT_TRUE(cache_->first == key)) {
-      // cache_ hit. Set the object pointer again.
+                                        "empty by_key value";
+    if (ABSL_PREDICT_TRUE(shard.cache->first == key)) {
+      // cache hit. Set the object pointer again.
       RIEGELI_ASSERT(entries.back().object == nullptr)
           << "Failed invariant of RecyclingPool: "
-             "non-nullptr object pointed to by cache_";
+             "non-nullptr object pointed to by cache";
       entries.back().object = std::move(object);
-      cache_ = by_key_.end();
+      shard.cache = shard.by_key.end();
       return;
     }
-    // cache_ miss. Finish erasing the cached entry.
-    by_freshness_.erase(entries.back().by_freshness_iter);
+    // cache miss. Finish erasing the cached entry.
+    shard.by_freshness.erase(entries.back().by_freshness_iter);
     entries.pop_back();
-    if (entries.empty()) by_key_.erase(cache_);
+    if (entries.empty()) shard.by_key.erase(shard.cache);
   }
-  by_freshness_.push_back(key);
-  typename ByFreshness::iterator by_freshness_iter = by_freshness_.end();
+  shard.by_freshness.push_back(key);
+  typename ByFreshness::iterator by_freshness_iter = shard.by_freshness.end();
   --by_freshness_iter;
-  // This invalidates by_key_ iterators, including cache_.
-  by_key_[key].emplace_back(std::move(object), by_freshness_iter);
-  if (ABSL_PREDICT_FALSE(by_freshness_.size() > max_size_)) {
+  // This invalidates by_key iterators, including cache.
+  shard.by_key[key].emplace_back(std::move(object), by_freshness_iter);
+  if (ABSL_PREDICT_FALSE(shard.by_freshness.size() > max_size_per_shard_)) {
     // Evict the oldest entry.
-    const Key& evicted_key = by_freshness_.front();
-    const typename ByKey::iterator by_key_iter = by_key_.find(evicted_key);
-    RIEGELI_ASSERT(by_key_iter != by_key_.end())
+    const Key& evicted_key = shard.by_freshness.front();
+    const typename ByKey::iterator by_key_iter = shard.by_key.find(evicted_key);
+    RIEGELI_ASSERT(by_key_iter != shard.by_key.end())
         << "Failed invariant of RecyclingPool: "
-           "a key from by_freshness_ absent in by_key_";
+           "a key from by_freshness absent in by_key";
     Entries& entries = by_key_iter->second;
     RIEGELI_ASSERT(!entries.empty()) << "Failed invariant of RecyclingPool: "
-                                        "empty by_key_ value";
+                                        "empty by_key value";
     RIEGELI_ASSERT(entries.back().object != nullptr)
         << "Failed invariant of RecyclingPool: "
-           "nullptr object not pointed to by cache_";
+           "nullptr object not pointed to by cache";
     evicted = std::move(entries.front().object);
     entries.pop_front();
-    if (entries.empty()) by_key_.erase(by_key_iter);
-    by_freshness_.pop_front();
+    if (entries.empty()) shard.by_key.erase(by_key_iter);
+    shard.by_freshness.pop_front();
   }
-  cache_ = by_key_.end();
-  // Destroy evicted after releasing mutex_.
+  shard.cache = shard.by_key.end();
+  // Destroy evicted after releasing the shard mutex.
 }
 
 template <typename T, class Deleter>
@@ -322,13 +380,14 @@ template <typename T, class Deleter>
 template <typename Factory, typename Refurbisher>
 typename RecyclingPool<T, Deleter>::Handle RecyclingPool<T, Deleter>::Get(
     Factory factory, Refurbisher refurbisher) {
+  Shard& shard = ShardForThisThread();
   std::unique_ptr<T, Deleter> returned;
   {
-    absl::MutexLock lock(&mutex_);
-    if (ABSL_PREDICT_TRUE(!by_freshness_.empty())) {
+    absl::MutexLock lock(&shard.mutex);
+    if (ABSL_PREDICT_TRUE(!shard.by_freshness.empty())) {
       // Return the newest entry.
-      returned = std::move(by_freshness_.back());
-      by_freshness_.pop_back();
+      returned = std::move(shard.by_freshness.back());
+      shard.by_freshness.pop_back();
     }
   }
   if (ABSL_PREDICT_TRUE(returned != nullptr)) {
@@ -342,15 +401,17 @@ typename RecyclingPool<T, Deleter>::Handle RecyclingPool<T, Deleter>::Get(
 
 template <typename T, class Deleter>
 void RecyclingPool<T, Deleter>::Put(std::unique_ptr<T, Deleter> object) {
+  Shard& shard = ShardForThisThread();
   std::unique_ptr<T, Deleter> evicted;
-  absl::MutexLock lock(&mutex_);
+  absl::MutexLock lock(&shard.mutex);
   // Add a newest entry.
-  by_freshness_.push_back(std::move(object));
-  if (ABSL_PREDICT_TRUE(by_freshness_.size() <= max_size_)) return;
+  shard.by_freshness.push_back(std::move(object));
+  if (ABSL_PREDICT_TRUE(shard.by_freshness.size() <= max_size_per_shard_))
+    return;
   // Evict the oldest entry.
-  evicted = std::move(by_freshness_.front());
-  by_freshness_.pop_front();
-  // Destroy evicted after releasing mutex_.
+  evicted = std::move(shard.by_freshness.front());
+  shard.by_freshness.pop_front();
+  // Destroy evicted after releasing the shard mutex.
 }
 
 }  // namespace riegeli
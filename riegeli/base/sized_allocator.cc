@@ -0,0 +1,226 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/base/sized_allocator.h"
+
+#include <stddef.h>
+
+#include <new>
+
+#include "absl/base/optimization.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/memory.h"
+
+namespace riegeli {
+
+namespace {
+
+void* DefaultAllocate(size_t num_bytes) { return operator new(num_bytes); }
+
+void DefaultDeallocate(void* allocated, size_t num_bytes) {
+#if __cpp_sized_deallocation || __GXX_DELETE_WITH_SIZE__
+  operator delete(allocated, num_bytes);
+#else
+  operator delete(allocated);
+#endif
+}
+
+SizedAllocatorBackend backend = {DefaultAllocate, DefaultDeallocate};
+
+// A thread-local free list of allocations, grouped into power-of-2 size
+// classes. No synchronization is needed because each thread caches its own
+// free allocations.
+class ThreadLocalSizeClassCache {
+ public:
+  // Cached allocation sizes: powers of 2 from 1 << kMinSizeClassShift to
+  // 1 << kMaxSizeClassShift. The range covers internal Chain blocks sized by
+  // Chain::NewBlockCapacity() between Chain::kMinBufferSize and
+  // Chain::kMaxBufferSize including the block header, and typical Buffer and
+  // compressor scratch sizes.
+  static constexpr size_t kMinSizeClassShift = 9;
+  static constexpr size_t kMaxSizeClassShift = 17;
+  static constexpr size_t kNumSizeClasses =
+      kMaxSizeClassShift - kMinSizeClassShift + 1;
+  // Maximal number of cached free allocations in each size class.
+  static constexpr size_t kMaxFreeAllocationsPerClass = 8;
+
+  ThreadLocalSizeClassCache() noexcept {}
+
+  ThreadLocalSizeClassCache(const ThreadLocalSizeClassCache&) = delete;
+  ThreadLocalSizeClassCache& operator=(const ThreadLocalSizeClassCache&) =
+      delete;
+
+  ~ThreadLocalSizeClassCache();
+
+  // If num_bytes can be cached, rounds *num_bytes up to the nearest cached
+  // allocation size, sets *size_class accordingly, and returns true.
+  static bool RoundUpToSizeClass(size_t* num_bytes, size_t* size_class);
+
+  // If num_bytes is exactly a cached allocation size, sets *size_class
+  // accordingly and returns true.
+  static bool ExactSizeClass(size_t num_bytes, size_t* size_class);
+
+  // Returns a cached free allocation of the given size class, or nullptr.
+  void* Get(size_t size_class);
+
+  // Caches a free allocation of the given size class. Returns false if the
+  // size class is full, in which case the caller must free the allocation.
+  bool Put(size_t size_class, void* allocated);
+
+ private:
+  // A free allocation, linked intrusively through its initial bytes (each
+  // cached allocation is large enough to hold the pointer).
+  struct FreeAllocation {
+    FreeAllocation* next;
+  };
+
+  FreeAllocation* free_[kNumSizeClasses] = {};
+  size_t num_free_[kNumSizeClasses] = {};
+};
+
+#if __cplusplus < 201703
+constexpr size_t ThreadLocalSizeClassCache::kMinSizeClassShift;
+constexpr size_t ThreadLocalSizeClassCache::kMaxSizeClassShift;
+constexpr size_t ThreadLocalSizeClassCache::kNumSizeClasses;
+constexpr size_t ThreadLocalSizeClassCache::kMaxFreeAllocationsPerClass;
+#endif
+
+ThreadLocalSizeClassCache::~ThreadLocalSizeClassCache() {
+  for (size_t size_class = 0; size_class < kNumSizeClasses; ++size_class) {
+    FreeAllocation* free_allocation = free_[size_class];
+    while (free_allocation != nullptr) {
+      FreeAllocation* const next = free_allocation->next;
+      free_allocation->~FreeAllocation();
+      backend.deallocate(free_allocation,
+                         size_t{1} << (kMinSizeClassShift + size_class));
+      free_allocation = next;
+    }
+  }
+}
+
+inline bool ThreadLocalSizeClassCache::RoundUpToSizeClass(
+    size_t* num_bytes, size_t* size_class) {
+  if (ABSL_PREDICT_FALSE(*num_bytes > size_t{1} << kMaxSizeClassShift)) {
+    return false;
+  }
+  size_t shift = kMinSizeClassShift;
+  while ((size_t{1} << shift) < *num_bytes) ++shift;
+  *num_bytes = size_t{1} << shift;
+  *size_class = shift - kMinSizeClassShift;
+  return true;
+}
+
+inline bool ThreadLocalSizeClassCache::ExactSizeClass(size_t num_bytes,
+                                                      size_t* size_class) {
+  if (num_bytes < size_t{1} << kMinSizeClassShift ||
+      num_bytes > size_t{1} << kMaxSizeClassShift ||
+      (num_bytes & (num_bytes - 1)) != 0) {
+    return false;
+  }
+  size_t shift = kMinSizeClassShift;
+  while ((size_t{1} << shift) < num_bytes) ++shift;
+  *size_class = shift - kMinSizeClassShift;
+  return true;
+}
+
+inline void* ThreadLocalSizeClassCache::Get(size_t size_class) {
+  RIEGELI_ASSERT_LT(size_class, kNumSizeClasses)
+      << "Failed precondition of ThreadLocalSizeClassCache::Get(): "
+         "size class out of range";
+  FreeAllocation* const free_allocation = free_[size_class];
+  if (free_allocation == nullptr) return nullptr;
+  free_[size_class] = free_allocation->next;
+  --num_free_[size_class];
+  free_allocation->~FreeAllocation();
+  return free_allocation;
+}
+
+inline bool ThreadLocalSizeClassCache::Put(size_t size_class,
+                                           void* allocated) {
+  RIEGELI_ASSERT_LT(size_class, kNumSizeClasses)
+      << "Failed precondition of ThreadLocalSizeClassCache::Put(): "
+         "size class out of range";
+  if (ABSL_PREDICT_FALSE(num_free_[size_class] >=
+                         kMaxFreeAllocationsPerClass)) {
+    return false;
+  }
+  FreeAllocation* const free_allocation =
+      new (allocated) FreeAllocation{free_[size_class]};
+  free_[size_class] = free_allocation;
+  ++num_free_[size_class];
+  return true;
+}
+
+ThreadLocalSizeClassCache& Cache() {
+  thread_local ThreadLocalSizeClassCache cache;
+  return cache;
+}
+
+// The header of allocations made through the C callback wrappers, keeping
+// the data maximally aligned.
+constexpr size_t kCHeaderSize = alignof(max_align_t);
+static_assert(kCHeaderSize >= sizeof(size_t),
+              "The C callback header must be able to hold the size");
+
+}  // namespace
+
+void* AllocateSized(size_t min_num_bytes, size_t* actual_num_bytes) {
+  size_t num_bytes = min_num_bytes;
+  size_t size_class;
+  if (ABSL_PREDICT_TRUE(ThreadLocalSizeClassCache::RoundUpToSizeClass(
+          &num_bytes, &size_class))) {
+    *actual_num_bytes = num_bytes;
+    void* const allocated = Cache().Get(size_class);
+    if (ABSL_PREDICT_TRUE(allocated != nullptr)) return allocated;
+    return backend.allocate(num_bytes);
+  }
+  *actual_num_bytes = EstimatedAllocatedSize(min_num_bytes);
+  return backend.allocate(*actual_num_bytes);
+}
+
+void DeallocateSized(void* allocated, size_t num_bytes) {
+  size_t size_class;
+  if (ABSL_PREDICT_TRUE(ThreadLocalSizeClassCache::ExactSizeClass(
+          num_bytes, &size_class)) &&
+      ABSL_PREDICT_TRUE(Cache().Put(size_class, allocated))) {
+    return;
+  }
+  backend.deallocate(allocated, num_bytes);
+}
+
+void* SizedAllocatorCAlloc(void* opaque, size_t num_bytes) {
+  size_t actual_num_bytes;
+  void* const allocated =
+      AllocateSized(kCHeaderSize + num_bytes, &actual_num_bytes);
+  *static_cast<size_t*>(allocated) = actual_num_bytes;
+  return static_cast<char*>(allocated) + kCHeaderSize;
+}
+
+void SizedAllocatorCFree(void* opaque, void* ptr) {
+  if (ptr == nullptr) return;
+  void* const allocated = static_cast<char*>(ptr) - kCHeaderSize;
+  DeallocateSized(allocated, *static_cast<size_t*>(allocated));
+}
+
+void SetSizedAllocatorBackend(SizedAllocatorBackend new_backend) {
+  RIEGELI_ASSERT(new_backend.allocate != nullptr)
+      << "Failed precondition of SetSizedAllocatorBackend(): "
+         "null allocate function";
+  RIEGELI_ASSERT(new_backend.deallocate != nullptr)
+      << "Failed precondition of SetSizedAllocatorBackend(): "
+         "null deallocate function";
+  backend = new_backend;
+}
+
+}  // namespace riegeli
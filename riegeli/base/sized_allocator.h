@@ -0,0 +1,71 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BASE_SIZED_ALLOCATOR_H_
+#define RIEGELI_BASE_SIZED_ALLOCATOR_H_
+
+#include <stddef.h>
+
+namespace riegeli {
+
+// A central size-classed allocation facility for raw memory blocks, shared by
+// internal Chain blocks, Buffer, ChainBlockArena slabs, and compressor
+// scratch memory.
+//
+// Allocations up to 128K are rounded up to power-of-2 size classes, and freed
+// allocations are cached in per-thread free lists. Blocks of nearly identical
+// sizes are allocated and freed at a high rate on the chunk encoding and
+// decoding paths, alternating between these subsystems; caching them per
+// thread lets one subsystem reuse blocks freed by another without contention
+// on the underlying allocator.
+
+// Allocates at least min_num_bytes, aligned like operator new. Sets
+// *actual_num_bytes to the size of the allocation, which is at least
+// min_num_bytes. The allocation must be freed with DeallocateSized(), passing
+// *actual_num_bytes.
+void* AllocateSized(size_t min_num_bytes, size_t* actual_num_bytes);
+
+// Frees an allocation obtained from AllocateSized(). num_bytes must be the
+// *actual_num_bytes which AllocateSized() returned.
+void DeallocateSized(void* allocated, size_t num_bytes);
+
+// Callback-compatible wrappers for C libraries which obtain scratch memory
+// through user-supplied functions whose free callback does not receive the
+// size, e.g. Brotli and zlib. The allocation size is stored in a header
+// before the returned pointer, so that the allocation still goes through the
+// size classes. opaque is ignored.
+void* SizedAllocatorCAlloc(void* opaque, size_t num_bytes);
+void SizedAllocatorCFree(void* opaque, void* ptr);
+
+// The underlying allocator used when the per-thread cache has no free
+// allocation of the needed size class, and for sizes outside the cached
+// range.
+struct SizedAllocatorBackend {
+  // Must return memory aligned like operator new; may not return nullptr
+  // (it should throw std::bad_alloc or terminate on failure).
+  void* (*allocate)(size_t num_bytes);
+  // num_bytes is the same as in the corresponding allocate() call.
+  void (*deallocate)(void* allocated, size_t num_bytes);
+};
+
+// Replaces the underlying allocator, e.g. with a tcmalloc arena.
+//
+// Must be called at most once, before the first allocation through this
+// facility; all allocations, including those cached per thread, are freed
+// through the backend installed at the time.
+void SetSizedAllocatorBackend(SizedAllocatorBackend backend);
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_BASE_SIZED_ALLOCATOR_H_
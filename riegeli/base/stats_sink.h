@@ -0,0 +1,70 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BASE_STATS_SINK_H_
+#define RIEGELI_BASE_STATS_SINK_H_
+
+#include <stddef.h>
+
+#include "absl/time/time.h"
+
+namespace riegeli {
+
+// Receives instrumentation events from objects which were given the StatsSink
+// in their options, e.g. with FdReaderBase::Options::set_stats_sink(). This
+// exposes what happens between the application and the operating system:
+// syscalls with their byte counts, time spent waiting for files, and chunk
+// encoding and decoding durations, typically exported to a monitoring system.
+//
+// The default implementation of each method does nothing; an implementation
+// overrides only the events it cares about. Methods are called from inside
+// reading and writing loops and should return quickly, e.g. increment
+// counters. Durations are measured only if a StatsSink is present, hence
+// objects without a StatsSink do not pay for reading the clock.
+//
+// Method implementations must be thread-safe: events can come from background
+// threads, e.g. with RecordWriterBase::Options::set_parallelism() or
+// FdReaderBase::Options::set_background_read_ahead().
+//
+// The StatsSink is not owned and must not be destroyed until all objects
+// using it are closed or no longer used.
+class StatsSink {
+ public:
+  virtual ~StatsSink() {}
+
+  // A read syscall returned, having transferred length bytes (0 at end of
+  // file or on failure).
+  virtual void OnReadSyscall(size_t length) {}
+
+  // A write syscall returned, having transferred length bytes (0 on failure).
+  virtual void OnWriteSyscall(size_t length) {}
+
+  // Pulling data from the source stalled for duration (the time of one read
+  // syscall).
+  virtual void OnPullStall(absl::Duration duration) {}
+
+  // Pushing data to the destination stalled for duration (the time of one
+  // write syscall).
+  virtual void OnPushStall(absl::Duration duration) {}
+
+  // Encoding a chunk of records, including compression, took duration.
+  virtual void OnChunkEncoded(absl::Duration duration) {}
+
+  // Decoding a chunk of records, including decompression, took duration.
+  virtual void OnChunkDecoded(absl::Duration duration) {}
+};
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_BASE_STATS_SINK_H_
@@ -15,6 +15,7 @@
 #ifndef RIEGELI_BYTES_BACKWARD_WRITER_UTILS_H_
 #define RIEGELI_BYTES_BACKWARD_WRITER_UTILS_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include "absl/base/optimization.h"
@@ -38,9 +39,10 @@ bool WriteVarint64Slow(BackwardWriter* dest, uint64_t data);
 
 inline bool WriteVarint32(BackwardWriter* dest, uint32_t data) {
   if (ABSL_PREDICT_TRUE(dest->available() >= kMaxLengthVarint32)) {
-    char* start = dest->cursor() - LengthVarint32(data);
+    const size_t length = LengthVarint32(data);
+    char* const start = dest->cursor() - length;
     dest->set_cursor(start);
-    WriteVarint32(start, data);
+    WriteVarint32WithLength(start, data, length);
     return true;
   }
   return internal::WriteVarint32Slow(dest, data);
@@ -48,9 +50,10 @@ inline bool WriteVarint32(BackwardWriter* dest, uint32_t data) {
 
 inline bool WriteVarint64(BackwardWriter* dest, uint64_t data) {
   if (ABSL_PREDICT_TRUE(dest->available() >= kMaxLengthVarint64)) {
-    char* start = dest->cursor() - LengthVarint64(data);
+    const size_t length = LengthVarint64(data);
+    char* const start = dest->cursor() - length;
     dest->set_cursor(start);
-    WriteVarint64(start, data);
+    WriteVarint64WithLength(start, data, length);
     return true;
   }
   return internal::WriteVarint64Slow(dest, data);
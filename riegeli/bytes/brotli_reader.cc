@@ -21,10 +21,13 @@
 
 #include "absl/base/optimization.h"
 #include "absl/strings/str_cat.h"
+#include "absl/types/span.h"
 #include "brotli/decode.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/canonical_errors.h"
+#include "riegeli/base/chain.h"
 #include "riegeli/base/object.h"
+#include "riegeli/base/sized_allocator.h"
 #include "riegeli/bytes/reader.h"
 
 namespace riegeli {
@@ -37,11 +40,14 @@ void BrotliReaderBase::Initialize(Reader* src) {
     Fail(*src);
     return;
   }
-  decompressor_.reset(BrotliDecoderCreateInstance(nullptr, nullptr, nullptr));
+  decompressor_.reset(BrotliDecoderCreateInstance(
+      SizedAllocatorCAlloc, SizedAllocatorCFree, nullptr));
   if (ABSL_PREDICT_FALSE(decompressor_ == nullptr)) {
     Fail(InternalError("BrotliDecoderCreateInstance() failed"));
     return;
   }
+  // Enable accepting the large-window brotli format unconditionally; streams
+  // in the regular format are unaffected.
   if (ABSL_PREDICT_FALSE(!BrotliDecoderSetParameter(
           decompressor_.get(), BROTLI_DECODER_PARAM_LARGE_WINDOW,
           uint32_t{true}))) {
@@ -58,6 +64,32 @@ void BrotliReaderBase::Done() {
   Reader::Done();
 }
 
+bool BrotliReaderBase::ReadSlow(Chain* dest, size_t length) {
+  RIEGELI_ASSERT_GT(length, UnsignedMin(available(), kMaxBytesToCopy))
+      << "Failed precondition of Reader::ReadSlow(Chain*): "
+         "length too small, use Read(Chain*) instead";
+  RIEGELI_ASSERT_LE(length, std::numeric_limits<size_t>::max() - dest->size())
+      << "Failed precondition of Reader::ReadSlow(Chain*): "
+         "Chain size overflow";
+  if (length < kDefaultBufferSize) return Reader::ReadSlow(dest, length);
+  // Data are copied from the decompressor's internal buffer in any case, and
+  // callers like ChunkDecoder know the exact decompressed size in advance, so
+  // read into a single right-sized flat block instead of letting dest grow
+  // block by block.
+  const absl::Span<char> flat_buffer = dest->AppendFixedBuffer(length);
+  const Position pos_before = pos();
+  if (ABSL_PREDICT_FALSE(!Read(flat_buffer.data(), flat_buffer.size()))) {
+    RIEGELI_ASSERT_GE(pos(), pos_before)
+        << "Reader::Read(char*) decreased pos()";
+    const Position length_read = pos() - pos_before;
+    RIEGELI_ASSERT_LE(length_read, flat_buffer.size())
+        << "Reader::Read(char*) read more than requested";
+    dest->RemoveSuffix(flat_buffer.size() - IntCast<size_t>(length_read));
+    return false;
+  }
+  return true;
+}
+
 bool BrotliReaderBase::PullSlow() {
   RIEGELI_ASSERT_EQ(available(), 0u)
       << "Failed precondition of Reader::PullSlow(): "
@@ -15,12 +15,15 @@
 #ifndef RIEGELI_BYTES_BROTLI_READER_H_
 #define RIEGELI_BYTES_BROTLI_READER_H_
 
+#include <stddef.h>
+
 #include <memory>
 #include <utility>
 
 #include "absl/base/optimization.h"
 #include "absl/utility/utility.h"
 #include "brotli/decode.h"
+#include "riegeli/base/chain.h"
 #include "riegeli/base/dependency.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/reader.h"
@@ -45,6 +48,11 @@ class BrotliReaderBase : public Reader {
   void Initialize(Reader* src);
   void Done() override;
   bool PullSlow() override;
+  using Reader::ReadSlow;
+  // For large lengths reads into a single right-sized flat block instead of
+  // letting dest grow block by block; the exact length is typically known to
+  // the caller from the decompressed size stored before the stream.
+  bool ReadSlow(Chain* dest, size_t length) override;
 
  private:
   struct BrotliDecoderStateDeleter {
@@ -69,6 +77,9 @@ class BrotliReaderBase : public Reader {
 // A Reader which decompresses data with Brotli after getting it from another
 // Reader.
 //
+// Accepts both the regular and the large-window brotli format; the format is
+// recognized from the stream header.
+//
 // The Src template parameter specifies the type of the object providing and
 // possibly owning the compressed Reader. Src must support
 // Dependency<Reader*, Src>, e.g. Reader* (not owned, default),
@@ -24,6 +24,7 @@
 #include "brotli/encode.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/canonical_errors.h"
+#include "riegeli/base/sized_allocator.h"
 #include "riegeli/bytes/buffered_writer.h"
 #include "riegeli/bytes/writer.h"
 
@@ -50,7 +51,8 @@ void BrotliWriterBase::Initialize(Writer* dest, int compression_level,
     Fail(*dest);
     return;
   }
-  compressor_.reset(BrotliEncoderCreateInstance(nullptr, nullptr, nullptr));
+  compressor_.reset(BrotliEncoderCreateInstance(
+      SizedAllocatorCAlloc, SizedAllocatorCFree, nullptr));
   if (ABSL_PREDICT_FALSE(compressor_ == nullptr)) {
     Fail(InternalError("BrotliEncoderCreateInstance() failed"));
     return;
@@ -67,6 +67,10 @@ class BrotliWriterBase : public BufferedWriter {
     //
     // window_log must be between kMinWindowLog (10) and kMaxWindowLog (30).
     // Default: kDefaultWindowLog (22).
+    //
+    // A window_log above BROTLI_MAX_WINDOW_BITS (24) uses the large-window
+    // brotli format, which is accepted by BrotliReader but not by all other
+    // brotli decoders.
     static constexpr int kMinWindowLog = BROTLI_MIN_WINDOW_BITS;
     static constexpr int kMaxWindowLog = BROTLI_LARGE_MAX_WINDOW_BITS;
     static constexpr int kDefaultWindowLog = BROTLI_DEFAULT_WINDOW;
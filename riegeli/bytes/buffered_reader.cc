@@ -18,21 +18,52 @@
 
 #include <cstring>
 #include <limits>
+#include <memory>
 #include <utility>
 
 #include "absl/base/optimization.h"
+#include "absl/memory/memory.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
 #include "absl/types/span.h"
+#include "absl/utility/utility.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/parallelism.h"
+#include "riegeli/base/recycling_pool.h"
 #include "riegeli/bytes/backward_writer.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/bytes/writer.h"
 
 namespace riegeli {
 
+namespace {
+
+// The starting and minimum buffer size for adaptive buffer sizing.
+constexpr size_t kMinAdaptiveBufferSize = size_t{4} << 10;
+
+}  // namespace
+
+BufferedReader::BufferPool::Handle BufferedReader::GetPooledBuffer(
+    size_t size) {
+  // Recycled buffers are keyed by the size they were requested with. The
+  // capacity of a recycled Chain can nevertheless differ from size, e.g. if
+  // its block was shared with another Chain and had to be reallocated before
+  // the buffer was returned to the pool; this only makes the reuse of its
+  // capacity less likely, nothing breaks.
+  return BufferPool::global().Get(
+      size, [] { return absl::make_unique<Chain>(); },
+      [](Chain* buffer) {
+        // The buffer might have been returned to the pool non-empty, e.g. by
+        // the destructor of a reader with buffered data. Clearing it keeps
+        // its block for reuse if the block is not shared.
+        buffer->Clear();
+      });
+}
+
 inline size_t BufferedReader::next_buffer_size() const {
-  size_t length = buffer_size_;
+  size_t length =
+      current_buffer_size_ > 0 ? current_buffer_size_ : buffer_size_;
   if (limit_pos_ < size_hint_) {
     // Avoid allocating more than needed for size_hint_.
     length = UnsignedMin(length, size_hint_ - limit_pos_);
@@ -48,7 +79,8 @@ inline size_t BufferedReader::LengthToReadDirectly() const {
 
 inline bool BufferedReader::TooSmall(size_t flat_buffer_size) const {
   // This is at least as strict as the condition in Chain::Block::wasteful().
-  const size_t buffer_size = UnsignedMax(next_buffer_size(), buffer_.size());
+  const size_t buffer_size = UnsignedMax(
+      next_buffer_size(), buffer_ == nullptr ? size_t{0} : buffer_->size());
   RIEGELI_ASSERT_LE(flat_buffer_size, buffer_size)
       << "Failed precondition of BufferedReader::TooSmall(): "
          "flat buffer larger than buffer size";
@@ -56,9 +88,90 @@ inline bool BufferedReader::TooSmall(size_t flat_buffer_size) const {
 }
 
 inline Chain::BlockIterator BufferedReader::iter() const {
-  RIEGELI_ASSERT_EQ(buffer_.blocks().size(), 1u)
+  RIEGELI_ASSERT_EQ(buffer_->blocks().size(), 1u)
       << "Failed precondition of BufferedReader::iter(): single block expected";
-  return buffer_.blocks().begin();
+  return buffer_->blocks().begin();
+}
+
+void BufferedReader::set_adaptive_buffer_sizing(bool adaptive) {
+  current_buffer_size_ =
+      adaptive ? UnsignedMin(kMinAdaptiveBufferSize, buffer_size_) : size_t{0};
+}
+
+inline void BufferedReader::GrowBufferSize() {
+  if (current_buffer_size_ == 0) return;
+  if (buffer_ != nullptr && buffer_->size() >= current_buffer_size_) {
+    // The whole previous buffer was used; grow geometrically.
+    current_buffer_size_ = UnsignedMin(
+        SaturatingAdd(current_buffer_size_, current_buffer_size_),
+        buffer_size_);
+  }
+}
+
+inline absl::Span<char> BufferedReader::NewBuffer() {
+  if (buffer_ == nullptr) {
+    buffer_ = GetPooledBuffer(next_buffer_size());
+  } else {
+    buffer_->Clear();
+  }
+  return buffer_->AppendFixedBuffer(next_buffer_size(), next_buffer_size());
+}
+
+size_t BufferedReader::ReadAheadInternal(char* dest, size_t max_length,
+                                         Position pos) {
+  return 0;
+}
+
+inline void BufferedReader::ScheduleReadAhead() {
+  if (read_ahead_pool_ == nullptr) return;
+  if (read_ahead_ == nullptr) read_ahead_ = absl::make_unique<ReadAhead>();
+  {
+    absl::MutexLock lock(&read_ahead_->mutex);
+    RIEGELI_ASSERT(!read_ahead_->pending)
+        << "Failed precondition of BufferedReader::ScheduleReadAhead(): "
+           "a read-ahead task is already scheduled";
+    read_ahead_->pos = limit_pos_;
+    read_ahead_->length = next_buffer_size();
+    read_ahead_->pending = true;
+  }
+  read_ahead_pool_->Schedule([this] { ReadAheadTask(); });
+}
+
+void BufferedReader::ReadAheadTask() {
+  // read_ahead_->pos and read_ahead_->length do not change while
+  // read_ahead_->pending, hence they can be read without locking.
+  BufferPool::Handle data = GetPooledBuffer(read_ahead_->length);
+  const absl::Span<char> flat_buffer =
+      data->AppendFixedBuffer(read_ahead_->length);
+  const size_t length_read =
+      ReadAheadInternal(flat_buffer.data(), flat_buffer.size(),
+                        read_ahead_->pos);
+  RIEGELI_ASSERT_LE(length_read, flat_buffer.size())
+      << "BufferedReader::ReadAheadInternal() read more than requested";
+  data->RemoveSuffix(flat_buffer.size() - length_read);
+  absl::MutexLock lock(&read_ahead_->mutex);
+  read_ahead_->data = std::move(data);
+  read_ahead_->pending = false;
+}
+
+void BufferedReader::SyncReadAhead() {
+  if (read_ahead_ == nullptr) return;
+  absl::MutexLock lock(&read_ahead_->mutex);
+  read_ahead_->mutex.Await(absl::Condition(
+      +[](bool* pending) { return !*pending; }, &read_ahead_->pending));
+  read_ahead_->data = nullptr;
+}
+
+std::unique_ptr<BufferedReader::ReadAhead> BufferedReader::ReleaseReadAhead() {
+  SyncReadAhead();
+  return std::move(read_ahead_);
+}
+
+void BufferedReader::Done() {
+  SyncReadAhead();
+  Reader::Done();
+  // Return the buffer to the pool for reuse by other readers.
+  buffer_ = nullptr;
 }
 
 void BufferedReader::VerifyEnd() {
@@ -73,14 +186,41 @@ bool BufferedReader::PullSlow() {
       << "Failed precondition of Reader::PullSlow(): "
          "data available, use Pull() instead";
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
-  absl::Span<char> flat_buffer = buffer_.AppendBuffer(0);
+  if (read_ahead_ != nullptr) {
+    bool adopted = false;
+    {
+      absl::MutexLock lock(&read_ahead_->mutex);
+      read_ahead_->mutex.Await(absl::Condition(
+          +[](bool* pending) { return !*pending; }, &read_ahead_->pending));
+      if (read_ahead_->data != nullptr && !read_ahead_->data->empty() &&
+          read_ahead_->pos == limit_pos_) {
+        // Adopt the prefetched buffer.
+        buffer_ = std::move(read_ahead_->data);
+        limit_pos_ += buffer_->size();
+        start_ = iter()->data();
+        cursor_ = start_;
+        limit_ = start_ + buffer_->size();
+        adopted = true;
+      } else {
+        // The prefetched data are stale (e.g. after a seek), or end of file
+        // or failure was encountered at read_ahead_->pos, which will be
+        // rediscovered by reading synchronously below.
+        read_ahead_->data = nullptr;
+      }
+    }
+    if (adopted) {
+      ScheduleReadAhead();
+      return true;
+    }
+  }
+  GrowBufferSize();
+  absl::Span<char> flat_buffer =
+      buffer_ == nullptr ? absl::Span<char>() : buffer_->AppendBuffer(0);
   if (TooSmall(flat_buffer.size())) {
     // Make a new buffer.
     RIEGELI_ASSERT_GT(buffer_size_, 0u)
         << "Failed invariant of BufferedReader: no buffer size specified";
-    buffer_.Clear();
-    flat_buffer =
-        buffer_.AppendFixedBuffer(next_buffer_size(), next_buffer_size());
+    flat_buffer = NewBuffer();
     start_ = flat_buffer.data();
     cursor_ = start_;
   } else if (start_ == nullptr) {
@@ -100,11 +240,65 @@ bool BufferedReader::PullSlow() {
   const Position length_read = limit_pos_ - pos_before;
   RIEGELI_ASSERT_LE(length_read, flat_buffer.size())
       << "BufferedReader::ReadInternal() read more than requested";
-  buffer_.RemoveSuffix(flat_buffer.size() - IntCast<size_t>(length_read));
+  buffer_->RemoveSuffix(flat_buffer.size() - IntCast<size_t>(length_read));
   limit_ += length_read;
+  if (ok) ScheduleReadAhead();
   return ok;
 }
 
+bool BufferedReader::PullSlow(size_t min_length) {
+  RIEGELI_ASSERT_GT(min_length, available())
+      << "Failed precondition of Reader::PullSlow(size_t): "
+         "enough data available, use Pull(size_t) instead";
+  if (available() == 0) {
+    if (ABSL_PREDICT_FALSE(!PullSlow())) return false;
+    if (ABSL_PREDICT_TRUE(available() >= min_length)) return true;
+  }
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  // Data straddle the buffer boundary. Prefetched data would be stale after
+  // reading synchronously below.
+  SyncReadAhead();
+  const size_t available_length = available();
+  absl::Span<char> flat_buffer =
+      buffer_ == nullptr ? absl::Span<char>() : buffer_->AppendBuffer(0);
+  if (available_length + flat_buffer.size() < min_length) {
+    // Compact: move the available data to the beginning of a new buffer with
+    // room for at least min_length contiguous bytes.
+    const size_t buffer_length = UnsignedMax(next_buffer_size(), min_length);
+    BufferPool::Handle new_buffer = GetPooledBuffer(buffer_length);
+    flat_buffer = new_buffer->AppendFixedBuffer(buffer_length, buffer_length);
+    if (available_length > 0) {  // memcpy(_, nullptr, 0) is undefined.
+      std::memcpy(flat_buffer.data(), cursor_, available_length);
+    }
+    buffer_ = std::move(new_buffer);
+    start_ = flat_buffer.data();
+    cursor_ = start_;
+    limit_ = start_ + available_length;
+    flat_buffer.remove_prefix(available_length);
+  } else if (start_ == nullptr) {
+    // buffer_ was empty.
+    start_ = iter()->data();
+    cursor_ = start_;
+    limit_ = start_;
+  }
+  RIEGELI_ASSERT(flat_buffer.data() == limit_)
+      << "Failed invariant of BufferedReader: "
+         "flat buffer does not begin at the end of the buffered data";
+  // Read more data into buffer_.
+  const Position pos_before = limit_pos_;
+  const bool ok = ReadInternal(flat_buffer.data(), min_length - available(),
+                               flat_buffer.size());
+  RIEGELI_ASSERT_GE(limit_pos_, pos_before)
+      << "BufferedReader::ReadInternal() decreased limit_pos_";
+  const Position length_read = limit_pos_ - pos_before;
+  RIEGELI_ASSERT_LE(length_read, flat_buffer.size())
+      << "BufferedReader::ReadInternal() read more than requested";
+  buffer_->RemoveSuffix(flat_buffer.size() - IntCast<size_t>(length_read));
+  limit_ += length_read;
+  if (ok) ScheduleReadAhead();
+  return available() >= min_length;
+}
+
 bool BufferedReader::ReadSlow(char* dest, size_t length) {
   RIEGELI_ASSERT_GT(length, available())
       << "Failed precondition of Reader::ReadSlow(char*): "
@@ -138,7 +332,7 @@ bool BufferedReader::ReadSlow(Chain* dest, size_t length) {
     // calls.
     const size_t available_length = available();
     if (available_length > 0) {  // iter() is undefined if
-                                 // buffer_.blocks().size() != 1.
+                                 // buffer_->blocks().size() != 1.
       iter().AppendSubstrTo(absl::string_view(cursor_, available_length), dest);
       length -= available_length;
     }
@@ -160,21 +354,21 @@ bool BufferedReader::ReadSlow(Chain* dest, size_t length) {
 
   bool ok = true;
   while (length > available()) {
-    absl::Span<char> flat_buffer = buffer_.AppendBuffer(0);
+    GrowBufferSize();
+    absl::Span<char> flat_buffer =
+        buffer_ == nullptr ? absl::Span<char>() : buffer_->AppendBuffer(0);
     if (TooSmall(flat_buffer.size())) {
       // Append a part of buffer_ to dest and make a new buffer.
       RIEGELI_ASSERT_GT(buffer_size_, 0u)
           << "Failed invariant of BufferedReader: no buffer size specified";
       const size_t available_length = available();
       if (available_length > 0) {  // iter() is undefined if
-                                   // buffer_.blocks().size() != 1.
+                                   // buffer_->blocks().size() != 1.
         iter().AppendSubstrTo(absl::string_view(cursor_, available_length),
                               dest);
         length -= available_length;
       }
-      buffer_.Clear();
-      flat_buffer =
-          buffer_.AppendFixedBuffer(next_buffer_size(), next_buffer_size());
+      flat_buffer = NewBuffer();
       start_ = flat_buffer.data();
       cursor_ = start_;
     } else if (start_ == nullptr) {
@@ -194,7 +388,7 @@ bool BufferedReader::ReadSlow(Chain* dest, size_t length) {
     const Position length_read = limit_pos_ - pos_before;
     RIEGELI_ASSERT_LE(length_read, flat_buffer.size())
         << "BufferedReader::ReadInternal() read more than requested";
-    buffer_.RemoveSuffix(flat_buffer.size() - IntCast<size_t>(length_read));
+    buffer_->RemoveSuffix(flat_buffer.size() - IntCast<size_t>(length_read));
     limit_ += length_read;
     if (ABSL_PREDICT_FALSE(!ok)) {
       if (length > available()) {
@@ -208,7 +402,7 @@ bool BufferedReader::ReadSlow(Chain* dest, size_t length) {
   RIEGELI_ASSERT_LE(length, available())
       << "Bug in BufferedReader::ReadSlow(Chain*): "
          "remaining length larger than available data";
-  if (length > 0) {  // iter() is undefined if buffer_.blocks().size() != 1.
+  if (length > 0) {  // iter() is undefined if buffer_->blocks().size() != 1.
     iter().AppendSubstrTo(absl::string_view(cursor_, length), dest);
     cursor_ += length;
   }
@@ -222,17 +416,19 @@ bool BufferedReader::CopyToSlow(Writer* dest, Position length) {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
   bool read_ok = true;
   while (length > available()) {
-    absl::Span<char> flat_buffer = buffer_.AppendBuffer(0);
+    GrowBufferSize();
+    absl::Span<char> flat_buffer =
+        buffer_ == nullptr ? absl::Span<char>() : buffer_->AppendBuffer(0);
     if (TooSmall(flat_buffer.size())) {
       // Write a part of buffer_ to dest and make a new buffer.
       RIEGELI_ASSERT_GT(buffer_size_, 0u)
           << "Failed invariant of BufferedReader: no buffer size specified";
       const size_t available_length = available();
       if (available_length > 0) {  // iter() is undefined if
-                                   // buffer_.blocks().size() != 1.
+                                   // buffer_->blocks().size() != 1.
         bool write_ok;
-        if (available_length == buffer_.size()) {
-          write_ok = dest->Write(buffer_);
+        if (available_length == buffer_->size()) {
+          write_ok = dest->Write(*buffer_);
         } else {
           Chain data;
           iter().AppendSubstrTo(absl::string_view(cursor_, available_length),
@@ -245,9 +441,7 @@ bool BufferedReader::CopyToSlow(Writer* dest, Position length) {
         }
         length -= available_length;
       }
-      buffer_.Clear();
-      flat_buffer =
-          buffer_.AppendFixedBuffer(next_buffer_size(), next_buffer_size());
+      flat_buffer = NewBuffer();
       start_ = flat_buffer.data();
       cursor_ = start_;
     } else if (start_ == nullptr) {
@@ -267,7 +461,7 @@ bool BufferedReader::CopyToSlow(Writer* dest, Position length) {
     const Position length_read = limit_pos_ - pos_before;
     RIEGELI_ASSERT_LE(length_read, flat_buffer.size())
         << "BufferedReader::ReadInternal() read more than requested";
-    buffer_.RemoveSuffix(flat_buffer.size() - IntCast<size_t>(length_read));
+    buffer_->RemoveSuffix(flat_buffer.size() - IntCast<size_t>(length_read));
     limit_ += length_read;
     if (ABSL_PREDICT_FALSE(!read_ok)) {
       if (length > available()) {
@@ -282,9 +476,9 @@ bool BufferedReader::CopyToSlow(Writer* dest, Position length) {
       << "Bug in BufferedReader::CopyToSlow(Writer*): "
          "remaining length larger than available data";
   bool write_ok = true;
-  if (length > 0) {  // iter() is undefined if buffer_.blocks().size() != 1.
-    if (length == buffer_.size()) {
-      write_ok = dest->Write(buffer_);
+  if (length > 0) {  // iter() is undefined if buffer_->blocks().size() != 1.
+    if (length == buffer_->size()) {
+      write_ok = dest->Write(*buffer_);
     } else {
       Chain data;
       iter().AppendSubstrTo(absl::string_view(cursor_, length), &data, length);
@@ -310,7 +504,14 @@ bool BufferedReader::CopyToSlow(BackwardWriter* dest, size_t length) {
 }
 
 void BufferedReader::ClearBuffer() {
-  buffer_.Clear();
+  if (current_buffer_size_ > 0) {
+    // Shrink so that reading after a seek or a direct read starts with a
+    // smaller buffer again.
+    current_buffer_size_ =
+        UnsignedMax(current_buffer_size_ / 2,
+                    UnsignedMin(kMinAdaptiveBufferSize, buffer_size_));
+  }
+  if (buffer_ != nullptr) buffer_->Clear();
   start_ = nullptr;
   cursor_ = nullptr;
   limit_ = nullptr;
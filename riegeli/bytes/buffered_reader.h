@@ -17,12 +17,17 @@
 
 #include <stddef.h>
 
+#include <memory>
 #include <utility>
 
+#include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
 #include "absl/utility/utility.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
 #include "riegeli/base/object.h"
+#include "riegeli/base/parallelism.h"
+#include "riegeli/base/recycling_pool.h"
 #include "riegeli/bytes/backward_writer.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/bytes/writer.h"
@@ -46,13 +51,22 @@ class BufferedReader : public Reader {
   // This avoids allocating a larger buffer than necessary.
   //
   // If the size hint turns out to not match reality, nothing breaks.
-  explicit BufferedReader(size_t buffer_size, Position size_hint = 0) noexcept;
+  //
+  // If read_ahead_pool is not nullptr, whenever the buffer needs to be
+  // refilled, the following buffer is filled by a task running in the thread
+  // pool while the current buffer is being consumed. This is effective only
+  // if ReadAheadInternal() is overridden.
+  explicit BufferedReader(
+      size_t buffer_size, Position size_hint = 0,
+      internal::ThreadPool* read_ahead_pool = nullptr) noexcept;
 
   BufferedReader(BufferedReader&& that) noexcept;
   BufferedReader& operator=(BufferedReader&& that) noexcept;
 
+  void Done() override;
   void VerifyEnd() override;
   bool PullSlow() override;
+  bool PullSlow(size_t min_length) override;
   using Reader::ReadSlow;
   bool ReadSlow(char* dest, size_t length) override;
   bool ReadSlow(Chain* dest, size_t length) override;
@@ -74,13 +88,64 @@ class BufferedReader : public Reader {
   virtual bool ReadInternal(char* dest, size_t min_length,
                             size_t max_length) = 0;
 
+  // Reads ahead from the source, from the given physical source position,
+  // which is unrelated to limit_pos_.
+  //
+  // In contrast to ReadInternal(), must not change the state of the Reader:
+  // it is called from a thread pool thread, possibly concurrently with
+  // reading from the buffer.
+  //
+  // Returns the length read; 0 means end of file or failure, which will be
+  // rediscovered with ReadInternal() when reading reaches pos.
+  //
+  // The default implementation returns 0, which makes background read-ahead
+  // ineffective. A source which can read at an explicit position without
+  // changing the state of the Reader, e.g. with pread(), can override this.
+  // Such a class must stop the background task with SyncReadAhead() before
+  // state used by ReadAheadInternal() is destroyed, in particular in its
+  // destructor if the Reader might not be closed first.
+  virtual size_t ReadAheadInternal(char* dest, size_t max_length, Position pos);
+
+  // Waits until no background read-ahead task is running, and discards its
+  // result.
+  void SyncReadAhead();
+
   // Discards buffer contents.
   void ClearBuffer();
 
   // Changes the size hint after construction.
   void set_size_hint(Position size_hint) { size_hint_ = size_hint; }
 
+  // If true, buffer allocations start small and grow geometrically, up to the
+  // buffer size given in the constructor, as long as reading keeps exhausting
+  // full buffers; the current size shrinks again when the buffer is cleared,
+  // e.g. by seeking. This reduces memory usage and allocation cost when only
+  // small pieces of the source are read.
+  void set_adaptive_buffer_sizing(bool adaptive);
+
  private:
+  // Pool of idle buffers shared between BufferedReader instances, keyed by the
+  // buffer size, so that short-lived readers reuse buffers from recently
+  // destroyed readers instead of allocating fresh ones.
+  using BufferPool = RecyclingPool<Chain, std::default_delete<Chain>, size_t>;
+
+  // State shared with a background read-ahead task.
+  struct ReadAhead {
+    absl::Mutex mutex;
+    // True while a task is scheduled or running.
+    bool pending = false;
+    // Position to prefetch from; set before scheduling a task.
+    Position pos = 0;
+    // Length to prefetch; set before scheduling a task.
+    size_t length = 0;
+    // Prefetched data: a single flat block of up to length bytes. nullptr or
+    // empty if end of file or failure was encountered at pos.
+    BufferPool::Handle data;
+  };
+
+  // Returns an empty buffer from BufferPool, with capacity likely to be size.
+  static BufferPool::Handle GetPooledBuffer(size_t size);
+
   // The size of buffer_ to use for the next allocation.
   size_t next_buffer_size() const;
 
@@ -94,25 +159,56 @@ class BufferedReader : public Reader {
 
   // Iterator pointing to the block of buffer_ which holds the actual data.
   //
-  // Precondition: buffer_.blocks().size() == 1
+  // Precondition: buffer_->blocks().size() == 1
   Chain::BlockIterator iter() const;
 
+  // Grows the current buffer size geometrically if adaptive buffer sizing is
+  // enabled and the previous buffer was fully used.
+  void GrowBufferSize();
+
+  // Replaces buffer_ with a buffer of capacity next_buffer_size(), obtained
+  // from BufferPool if buffer_ was not allocated yet, and returns its space.
+  absl::Span<char> NewBuffer();
+
+  // Schedules a background task filling the following buffer, if background
+  // read-ahead is enabled.
+  void ScheduleReadAhead();
+  // The body of the background read-ahead task.
+  void ReadAheadTask();
+  // Waits until no background read-ahead task of that is running, and takes
+  // over its state, for moving.
+  std::unique_ptr<ReadAhead> ReleaseReadAhead();
+
   size_t buffer_size_ = 0;
+  // The current target size of buffer allocations if adaptive buffer sizing
+  // is enabled, or 0 if it is disabled and buffer_size_ is used directly.
+  size_t current_buffer_size_ = 0;
   Position size_hint_ = 0;
   // Buffered data, read directly before the physical source position which is
-  // limit_pos_.
-  Chain buffer_;
+  // limit_pos_. Obtained from BufferPool and returned there when the reader
+  // is closed; nullptr if no buffer has been allocated.
+  BufferPool::Handle buffer_;
+  // Thread pool for background read-ahead, or nullptr if background
+  // read-ahead is disabled.
+  internal::ThreadPool* read_ahead_pool_ = nullptr;
+  // Created when the first read-ahead task is scheduled.
+  std::unique_ptr<ReadAhead> read_ahead_;
 
   // Invariants:
-  //   start_ == nullptr ? buffer_.empty() : start_ == iter()->data()
+  //   if start_ == nullptr then buffer_ == nullptr || buffer_->empty()
+  //   if start_ != nullptr then start_ == iter()->data()
   //   buffer_size() == (start_ == nullptr ? 0 : iter()->size())
 };
 
 // Implementation details follow.
 
-inline BufferedReader::BufferedReader(size_t buffer_size,
-                                      Position size_hint) noexcept
-    : Reader(State::kOpen), buffer_size_(buffer_size), size_hint_(size_hint) {
+inline BufferedReader::BufferedReader(
+    size_t buffer_size, Position size_hint,
+    internal::ThreadPool* read_ahead_pool) noexcept
+    : Reader(State::kOpen),
+      buffer_size_(buffer_size),
+      size_hint_(size_hint),
+      read_ahead_pool_(read_ahead_pool) {
   RIEGELI_ASSERT_GT(buffer_size, 0u)
       << "Failed precondition of BufferedReader::BufferedReader(size_t): "
          "zero buffer size";
@@ -121,15 +217,22 @@ inline BufferedReader::BufferedReader(size_t buffer_size,
 inline BufferedReader::BufferedReader(BufferedReader&& that) noexcept
     : Reader(std::move(that)),
       buffer_size_(absl::exchange(that.buffer_size_, 0)),
+      current_buffer_size_(absl::exchange(that.current_buffer_size_, 0)),
       size_hint_(absl::exchange(that.size_hint_, 0)),
-      buffer_(absl::exchange(that.buffer_, Chain())) {}
+      buffer_(std::move(that.buffer_)),
+      read_ahead_pool_(absl::exchange(that.read_ahead_pool_, nullptr)),
+      read_ahead_(that.ReleaseReadAhead()) {}
 
 inline BufferedReader& BufferedReader::operator=(
     BufferedReader&& that) noexcept {
+  SyncReadAhead();
   Reader::operator=(std::move(that));
   buffer_size_ = absl::exchange(that.buffer_size_, 0);
+  current_buffer_size_ = absl::exchange(that.current_buffer_size_, 0);
   size_hint_ = absl::exchange(that.size_hint_, 0);
-  buffer_ = absl::exchange(that.buffer_, Chain());
+  buffer_ = std::move(that.buffer_);
+  read_ahead_pool_ = absl::exchange(that.read_ahead_pool_, nullptr);
+  read_ahead_ = that.ReleaseReadAhead();
   return *this;
 }
 
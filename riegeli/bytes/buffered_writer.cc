@@ -21,10 +21,29 @@
 #include "absl/base/optimization.h"
 #include "absl/strings/string_view.h"
 #include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
 #include "riegeli/bytes/writer.h"
 
 namespace riegeli {
 
+namespace {
+
+// The starting and minimum buffer size for adaptive buffer sizing.
+constexpr size_t kMinAdaptiveBufferSize = size_t{4} << 10;
+
+}  // namespace
+
+void BufferedWriter::set_adaptive_buffer_sizing(bool adaptive) {
+  RIEGELI_ASSERT_EQ(written_to_buffer(), 0u)
+      << "Failed precondition of BufferedWriter::set_adaptive_buffer_sizing(): "
+         "buffer not empty";
+  current_buffer_size_ =
+      adaptive ? UnsignedMin(kMinAdaptiveBufferSize, buffer_size_) : size_t{0};
+  if (adaptive && !buffer_.is_allocated()) {
+    buffer_ = Buffer(current_buffer_size_, allocation_);
+  }
+}
+
 inline size_t BufferedWriter::LengthToWriteDirectly() const {
   size_t length = buffer_.size();
   if (written_to_buffer() > 0) {
@@ -55,15 +74,24 @@ bool BufferedWriter::PushSlow() {
   if (ABSL_PREDICT_FALSE(start_pos_ == std::numeric_limits<Position>::max())) {
     return FailOverflow();
   }
+  if (current_buffer_size_ > 0 && start_ != nullptr &&
+      current_buffer_size_ < buffer_size_) {
+    // The buffer keeps being filled completely; grow it geometrically.
+    current_buffer_size_ = UnsignedMin(
+        SaturatingAdd(current_buffer_size_, current_buffer_size_),
+        buffer_size_);
+  }
+  const size_t buffer_size =
+      current_buffer_size_ > 0 ? current_buffer_size_ : buffer_size_;
   if (ABSL_PREDICT_FALSE(!buffer_.is_allocated())) {
     if (start_pos_ < size_hint_ && buffer_.size() > size_hint_ - start_pos_) {
       // Avoid allocating more than needed for size_hint_.
-      buffer_ = Buffer(size_hint_ - start_pos_);
+      buffer_ = Buffer(size_hint_ - start_pos_, allocation_);
     }
-  } else if (ABSL_PREDICT_FALSE(buffer_.size() < buffer_size_)) {
-    // buffer_ is too small. It must have been tuned for size_hint_ but more
-    // data are being written.
-    buffer_ = Buffer(buffer_size_);
+  } else if (ABSL_PREDICT_FALSE(buffer_.size() < buffer_size)) {
+    // buffer_ is too small. It must have been tuned for size_hint_, or adaptive
+    // buffer sizing grew the target size, but more data are being written.
+    buffer_ = Buffer(buffer_size, allocation_);
   }
   start_ = buffer_.GetData();
   cursor_ = start_;
@@ -92,4 +120,31 @@ bool BufferedWriter::WriteSlow(absl::string_view src) {
   return Writer::WriteSlow(src);
 }
 
+bool BufferedWriter::WriteSlow(const Chain& src) {
+  RIEGELI_ASSERT_GT(src.size(), UnsignedMin(available(), kMaxBytesToCopy))
+      << "Failed precondition of Writer::WriteSlow(Chain): "
+         "length too small, use Write(Chain) instead";
+  if (src.size() >= LengthToWriteDirectly()) {
+    if (ABSL_PREDICT_FALSE(!PushInternal())) return false;
+    return WriteInternal(src);
+  }
+  return Writer::WriteSlow(src);
+}
+
+bool BufferedWriter::WriteInternal(const Chain& src) {
+  RIEGELI_ASSERT(!src.empty())
+      << "Failed precondition of BufferedWriter::WriteInternal(Chain): "
+         "nothing to write";
+  RIEGELI_ASSERT(healthy())
+      << "Failed precondition of BufferedWriter::WriteInternal(Chain): "
+      << status();
+  RIEGELI_ASSERT_EQ(written_to_buffer(), 0u)
+      << "Failed precondition of BufferedWriter::WriteInternal(Chain): "
+         "buffer not empty";
+  for (const absl::string_view fragment : src.blocks()) {
+    if (ABSL_PREDICT_FALSE(!WriteInternal(fragment))) return false;
+  }
+  return true;
+}
+
 }  // namespace riegeli
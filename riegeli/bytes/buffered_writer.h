@@ -23,6 +23,7 @@
 #include "absl/utility/utility.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/buffer.h"
+#include "riegeli/base/chain.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/writer.h"
 
@@ -35,6 +36,9 @@ namespace riegeli {
 // BufferedWriter accumulates data to be pushed in a flat buffer. Writing a
 // large enough array bypasses the buffer.
 class BufferedWriter : public Writer {
+ public:
+  void SetSizeHint(Position size_hint) override { size_hint_ = size_hint; }
+
  protected:
   // Creates a closed BufferedWriter.
   BufferedWriter() noexcept : Writer(State::kClosed) {}
@@ -45,7 +49,12 @@ class BufferedWriter : public Writer {
   // This avoids allocating a larger buffer than necessary.
   //
   // If the size hint turns out to not match reality, nothing breaks.
-  explicit BufferedWriter(size_t buffer_size, Position size_hint = 0) noexcept;
+  //
+  // The allocation policy is passed to the Buffer, e.g. to request
+  // hugepage-backed memory for a large buffer.
+  explicit BufferedWriter(
+      size_t buffer_size, Position size_hint = 0,
+      Buffer::Allocation allocation = Buffer::Allocation::kDefault) noexcept;
 
   BufferedWriter(BufferedWriter&& that) noexcept;
   BufferedWriter& operator=(BufferedWriter&& that) noexcept;
@@ -53,6 +62,7 @@ class BufferedWriter : public Writer {
   bool PushSlow() override;
   using Writer::WriteSlow;
   bool WriteSlow(absl::string_view src) override;
+  bool WriteSlow(const Chain& src) override;
 
   // Writes buffered data to the destination, but unlike PushSlow(), does not
   // ensure that a buffer is allocated.
@@ -71,13 +81,38 @@ class BufferedWriter : public Writer {
   //   written_to_buffer() == 0
   virtual bool WriteInternal(absl::string_view src) = 0;
 
+  // Writes data to the destination, like WriteInternal(string_view) but from
+  // possibly multiple blocks of a Chain.
+  //
+  // By default writes each block separately with WriteInternal(string_view).
+  // A destination which can accept scattered data in one operation, e.g. with
+  // writev(), can override this to avoid copying blocks together.
+  //
+  // Preconditions:
+  //   !src.empty()
+  //   healthy()
+  //   written_to_buffer() == 0
+  virtual bool WriteInternal(const Chain& src);
+
+  // If true, the buffer starts small and grows geometrically, up to the buffer
+  // size given in the constructor, as long as writing keeps filling it
+  // completely. This reduces memory usage and allocation cost when many
+  // destinations are open and only small amounts of data are written to them.
+  //
+  // Must be called while no data are buffered, e.g. right after construction.
+  void set_adaptive_buffer_sizing(bool adaptive);
+
  private:
   // Minimum length for which it is better to push current contents of buffer_
   // and write the data directly than to write the data through buffer_.
   size_t LengthToWriteDirectly() const;
 
   size_t buffer_size_ = 0;
+  // The current target size of buffer_ if adaptive buffer sizing is enabled,
+  // or 0 if it is disabled and buffer_size_ is used directly.
+  size_t current_buffer_size_ = 0;
   Position size_hint_ = 0;
+  Buffer::Allocation allocation_ = Buffer::Allocation::kDefault;
   // Buffered data, to be written directly after the physical destination
   // position which is start_pos_.
   //
@@ -87,12 +122,13 @@ class BufferedWriter : public Writer {
 
 // Implementation details follow.
 
-inline BufferedWriter::BufferedWriter(size_t buffer_size,
-                                      Position size_hint) noexcept
+inline BufferedWriter::BufferedWriter(size_t buffer_size, Position size_hint,
+                                      Buffer::Allocation allocation) noexcept
     : Writer(State::kOpen),
       buffer_size_(buffer_size),
       size_hint_(size_hint),
-      buffer_(buffer_size) {
+      allocation_(allocation),
+      buffer_(buffer_size, allocation) {
   RIEGELI_ASSERT_GT(buffer_size, 0u)
       << "Failed precondition of BufferedWriter::BufferedWriter(size_t): "
          "zero buffer size";
@@ -101,14 +137,18 @@ inline BufferedWriter::BufferedWriter(size_t buffer_size,
 inline BufferedWriter::BufferedWriter(BufferedWriter&& that) noexcept
     : Writer(std::move(that)),
       buffer_size_(absl::exchange(that.buffer_size_, 0)),
+      current_buffer_size_(absl::exchange(that.current_buffer_size_, 0)),
       size_hint_(absl::exchange(that.size_hint_, 0)),
+      allocation_(that.allocation_),
       buffer_(std::move(that.buffer_)) {}
 
 inline BufferedWriter& BufferedWriter::operator=(
     BufferedWriter&& that) noexcept {
   Writer::operator=(std::move(that));
   buffer_size_ = absl::exchange(that.buffer_size_, 0);
+  current_buffer_size_ = absl::exchange(that.current_buffer_size_, 0);
   size_hint_ = absl::exchange(that.size_hint_, 0);
+  allocation_ = that.allocation_;
   buffer_ = std::move(that.buffer_);
   return *this;
 }
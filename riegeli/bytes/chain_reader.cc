@@ -32,6 +32,14 @@ namespace riegeli {
 void ChainReaderBase::Done() {
   Reader::Done();
   iter_ = Chain::BlockIterator();
+  has_block_index_ = false;
+  block_index_ = Chain::BlockIndex();
+}
+
+void ChainReaderBase::PrepareForRandomAccess() {
+  if (ABSL_PREDICT_FALSE(!healthy()) || has_block_index_) return;
+  block_index_ = Chain::BlockIndex(*iter_.chain());
+  has_block_index_ = true;
 }
 
 bool ChainReaderBase::PullSlow() {
@@ -186,6 +194,10 @@ bool ChainReaderBase::SeekSlow(Position new_pos) {
       limit_pos_ = src->size();
       return false;
     }
+    if (has_block_index_) {
+      SeekUsingBlockIndex(new_pos);
+      return true;
+    }
     if (src->size() - new_pos < new_pos - limit_pos_) {
       // Iterate backwards from the end, it is closer.
       iter_ = src->blocks().cend();
@@ -214,6 +226,10 @@ bool ChainReaderBase::SeekSlow(Position new_pos) {
     }
   } else {
     // Seeking backwards.
+    if (has_block_index_) {
+      SeekUsingBlockIndex(new_pos);
+      return true;
+    }
     Position block_begin = start_pos();
     if (new_pos < block_begin - new_pos) {
       // Iterate forwards from the beginning, it is closer.
@@ -250,6 +266,36 @@ bool ChainReaderBase::SeekSlow(Position new_pos) {
   return true;
 }
 
+void ChainReaderBase::SeekUsingBlockIndex(Position new_pos) {
+  RIEGELI_ASSERT(has_block_index_)
+      << "Failed precondition of ChainReaderBase::SeekUsingBlockIndex(): "
+         "block index not built";
+  const Chain* const src = iter_.chain();
+  RIEGELI_ASSERT_LE(new_pos, src->size())
+      << "Failed precondition of ChainReaderBase::SeekUsingBlockIndex(): "
+         "position out of range";
+  size_t block_index;
+  size_t offset_in_block;
+  if (new_pos == src->size()) {
+    RIEGELI_ASSERT_GT(src->size(), 0u)
+        << "Seeking an empty Chain outside of the current buffer "
+           "should have been handled by SeekSlow()";
+    // Land at the end of the block containing the last character, so that the
+    // buffer remains valid.
+    block_index =
+        block_index_.FindBlock(IntCast<size_t>(new_pos) - 1, &offset_in_block);
+    ++offset_in_block;
+  } else {
+    block_index =
+        block_index_.FindBlock(IntCast<size_t>(new_pos), &offset_in_block);
+  }
+  iter_ = Chain::BlockIterator(src, block_index);
+  start_ = iter_->data();
+  limit_ = start_ + iter_->size();
+  cursor_ = start_ + offset_in_block;
+  limit_pos_ = new_pos + (iter_->size() - offset_in_block);
+}
+
 bool ChainReaderBase::Size(Position* size) {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
   const Chain* const src = iter_.chain();
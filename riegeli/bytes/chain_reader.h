@@ -37,8 +37,18 @@ class ChainReaderBase : public Reader {
   virtual const Chain* src_chain() const = 0;
 
   bool SupportsRandomAccess() const override { return true; }
+  // The buffer is a block of the Chain, whose blocks are alive as long as the
+  // Chain, so views returned by ReadZeroCopy() do not get invalidated by
+  // further reading.
+  bool SupportsStableViews() const override { return true; }
   bool Size(Position* size) override;
 
+  // Builds an index of block boundaries of the Chain, making each following
+  // Seek() find the target block in O(log n) time instead of iterating over
+  // blocks from the nearer end. This pays off for scattered random access into
+  // a Chain with many blocks.
+  void PrepareForRandomAccess();
+
  protected:
   explicit ChainReaderBase(State state) noexcept : Reader(state) {}
 
@@ -54,8 +64,20 @@ class ChainReaderBase : public Reader {
   bool CopyToSlow(BackwardWriter* dest, size_t length) override;
   bool SeekSlow(Position new_pos) override;
 
+  // Implementation of SeekSlow() using block_index_.
+  //
+  // Preconditions:
+  //   has_block_index_
+  //   new_pos <= src_chain()->size()
+  void SeekUsingBlockIndex(Position new_pos);
+
   Chain::BlockIterator iter_;
 
+  // If has_block_index_, an index of block boundaries of *src_chain() used by
+  // SeekSlow().
+  bool has_block_index_ = false;
+  Chain::BlockIndex block_index_;
+
   // Invariants if healthy():
   //   iter_.chain() == src_chain()
   //   start_ ==
@@ -103,12 +125,16 @@ class ChainReader : public ChainReaderBase {
 
 inline ChainReaderBase::ChainReaderBase(ChainReaderBase&& that) noexcept
     : Reader(std::move(that)),
-      iter_(absl::exchange(that.iter_, Chain::BlockIterator())) {}
+      iter_(absl::exchange(that.iter_, Chain::BlockIterator())),
+      has_block_index_(absl::exchange(that.has_block_index_, false)),
+      block_index_(std::move(that.block_index_)) {}
 
 inline ChainReaderBase& ChainReaderBase::operator=(
     ChainReaderBase&& that) noexcept {
   Reader::operator=(std::move(that));
   iter_ = absl::exchange(that.iter_, Chain::BlockIterator());
+  has_block_index_ = absl::exchange(that.has_block_index_, false);
+  block_index_ = std::move(that.block_index_);
   return *this;
 }
 
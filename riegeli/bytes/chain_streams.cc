@@ -0,0 +1,100 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/bytes/chain_streams.h"
+
+#include <stddef.h>
+
+#include <limits>
+
+#include "absl/base/optimization.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+
+namespace riegeli {
+
+bool ChainInputStream::Next(const void** data, int* size) {
+  if (iter_ != src_->blocks().cend() && offset_ == iter_->size()) {
+    ++iter_;
+    offset_ = 0;
+  }
+  if (ABSL_PREDICT_FALSE(iter_ == src_->blocks().cend())) return false;
+  const absl::string_view fragment = *iter_;
+  *data = fragment.data() + offset_;
+  *size = IntCast<int>(UnsignedMin(fragment.size() - offset_,
+                                   size_t{std::numeric_limits<int>::max()}));
+  offset_ += IntCast<size_t>(*size);
+  pos_ += IntCast<size_t>(*size);
+  return true;
+}
+
+void ChainInputStream::BackUp(int length) {
+  RIEGELI_ASSERT_GE(length, 0)
+      << "Failed precondition of ZeroCopyInputStream::BackUp(): "
+         "negative length";
+  RIEGELI_ASSERT_LE(IntCast<size_t>(length), offset_)
+      << "Failed precondition of ZeroCopyInputStream::BackUp(): "
+         "length larger than the last returned buffer";
+  offset_ -= IntCast<size_t>(length);
+  pos_ -= IntCast<size_t>(length);
+}
+
+bool ChainInputStream::Skip(int length) {
+  RIEGELI_ASSERT_GE(length, 0)
+      << "Failed precondition of ZeroCopyInputStream::Skip(): negative length";
+  size_t remaining = IntCast<size_t>(length);
+  while (iter_ != src_->blocks().cend()) {
+    const size_t available_length = iter_->size() - offset_;
+    if (remaining <= available_length) {
+      offset_ += remaining;
+      pos_ += remaining;
+      return true;
+    }
+    remaining -= available_length;
+    pos_ += available_length;
+    ++iter_;
+    offset_ = 0;
+  }
+  return false;
+}
+
+google::protobuf::int64 ChainInputStream::ByteCount() const {
+  return IntCast<google::protobuf::int64>(pos_);
+}
+
+bool ChainOutputStream::Next(void** data, int* size) {
+  const absl::Span<char> buffer = dest_->AppendBuffer(
+      1, 0, size_t{std::numeric_limits<int>::max()}, size_hint_);
+  *data = buffer.data();
+  *size = IntCast<int>(buffer.size());
+  return true;
+}
+
+void ChainOutputStream::BackUp(int length) {
+  RIEGELI_ASSERT_GE(length, 0)
+      << "Failed precondition of ZeroCopyOutputStream::BackUp(): "
+         "negative length";
+  RIEGELI_ASSERT_LE(IntCast<size_t>(length), dest_->size() - initial_size_)
+      << "Failed precondition of ZeroCopyOutputStream::BackUp(): "
+         "length larger than the last returned buffer";
+  dest_->RemoveSuffix(IntCast<size_t>(length), size_hint_);
+}
+
+google::protobuf::int64 ChainOutputStream::ByteCount() const {
+  return IntCast<google::protobuf::int64>(dest_->size() - initial_size_);
+}
+
+}  // namespace riegeli
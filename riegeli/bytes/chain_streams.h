@@ -0,0 +1,78 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BYTES_CHAIN_STREAMS_H_
+#define RIEGELI_BYTES_CHAIN_STREAMS_H_
+
+#include <stddef.h>
+
+#include "google/protobuf/io/zero_copy_stream.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+
+namespace riegeli {
+
+// A ZeroCopyInputStream which iterates over blocks of a Chain, exposing them
+// directly to the consumer without copying and without going through a Reader.
+//
+// The Chain must not be changed until the ChainInputStream is no longer used.
+class ChainInputStream : public google::protobuf::io::ZeroCopyInputStream {
+ public:
+  explicit ChainInputStream(const Chain* src)
+      : src_(RIEGELI_ASSERT_NOTNULL(src)), iter_(src_->blocks().cbegin()) {}
+
+  bool Next(const void** data, int* size) override;
+  void BackUp(int length) override;
+  bool Skip(int length) override;
+  google::protobuf::int64 ByteCount() const override;
+
+ private:
+  const Chain* src_;
+  Chain::BlockIterator iter_;
+  // Length of the prefix of *iter_ which was already returned.
+  //
+  // Invariant: if iter_ != src_->blocks().cend() then offset_ <= iter_->size()
+  size_t offset_ = 0;
+  // Invariant: pos_ <= src_->size()
+  size_t pos_ = 0;
+};
+
+// A ZeroCopyOutputStream which appends to a Chain, filling the Chain's
+// internal buffers directly, without going through a Writer.
+//
+// size_hint announces the expected total size of the Chain, which tunes the
+// sizes of the blocks being allocated.
+//
+// The Chain must not be changed until the ChainOutputStream is no longer used.
+class ChainOutputStream : public google::protobuf::io::ZeroCopyOutputStream {
+ public:
+  explicit ChainOutputStream(Chain* dest, size_t size_hint = 0)
+      : dest_(RIEGELI_ASSERT_NOTNULL(dest)),
+        size_hint_(size_hint),
+        initial_size_(dest_->size()) {}
+
+  bool Next(void** data, int* size) override;
+  void BackUp(int length) override;
+  google::protobuf::int64 ByteCount() const override;
+
+ private:
+  Chain* dest_;
+  size_t size_hint_ = 0;
+  // Invariant: dest_->size() >= initial_size_
+  size_t initial_size_ = 0;
+};
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_BYTES_CHAIN_STREAMS_H_
@@ -61,6 +61,9 @@ class ChainWriterBase : public Writer {
   virtual Chain* dest_chain() = 0;
   virtual const Chain* dest_chain() const = 0;
 
+  void SetSizeHint(Position size_hint) override {
+    size_hint_ = UnsignedMin(size_hint, std::numeric_limits<size_t>::max());
+  }
   bool Flush(FlushType flush_type) override;
   bool SupportsTruncate() const override { return true; }
   bool Truncate(Position new_size) override;
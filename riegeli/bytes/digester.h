@@ -0,0 +1,43 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BYTES_DIGESTER_H_
+#define RIEGELI_BYTES_DIGESTER_H_
+
+#include "absl/strings/string_view.h"
+#include "riegeli/base/chain.h"
+
+namespace riegeli {
+
+// A Digester accumulates data flowing through a DigestingWriter or
+// DigestingReader, e.g. into a hash state or a checksum.
+//
+// How the accumulated digest is exposed, and whether accumulation can be
+// restarted, is specific to the concrete class.
+class Digester {
+ public:
+  virtual ~Digester() {}
+
+  // Accumulates a fragment of data.
+  virtual void Update(absl::string_view data) = 0;
+
+  // Accumulates data from a Chain, block by block.
+  void Update(const Chain& data) {
+    for (const absl::string_view fragment : data.blocks()) Update(fragment);
+  }
+};
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_BYTES_DIGESTER_H_
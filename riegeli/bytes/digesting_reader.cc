@@ -0,0 +1,105 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/bytes/digesting_reader.h"
+
+#include <stddef.h>
+
+#include <limits>
+#include <memory>
+#include <utility>
+
+#include "absl/base/optimization.h"
+#include "absl/strings/string_view.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/object.h"
+#include "riegeli/bytes/digester.h"
+#include "riegeli/bytes/reader.h"
+
+namespace riegeli {
+
+void DigestingReaderBase::Done() {
+  if (ABSL_PREDICT_TRUE(healthy())) {
+    Reader* const src = src_reader();
+    SyncBuffer(src);
+  }
+  Reader::Done();
+}
+
+bool DigestingReaderBase::PullSlow() {
+  RIEGELI_ASSERT_EQ(available(), 0u)
+      << "Failed precondition of Reader::PullSlow(): "
+         "data available, use Pull() instead";
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  Reader* const src = src_reader();
+  SyncBuffer(src);
+  const bool ok = src->Pull();
+  MakeBuffer(src);
+  return ok;
+}
+
+bool DigestingReaderBase::PullSlow(size_t min_length) {
+  RIEGELI_ASSERT_GT(min_length, available())
+      << "Failed precondition of Reader::PullSlow(size_t): "
+         "enough data available, use Pull(size_t) instead";
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  Reader* const src = src_reader();
+  SyncBuffer(src);
+  const bool ok = src->Pull(min_length);
+  MakeBuffer(src);
+  return ok;
+}
+
+bool DigestingReaderBase::ReadSlow(char* dest, size_t length) {
+  RIEGELI_ASSERT_GT(length, available())
+      << "Failed precondition of Reader::ReadSlow(char*): "
+         "length too small, use Read(char*) instead";
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  Reader* const src = src_reader();
+  SyncBuffer(src);
+  const Position pos_before = src->pos();
+  const bool ok = src->Read(dest, length);
+  RIEGELI_ASSERT_GE(src->pos(), pos_before)
+      << "Reader::Read(char*) decreased pos()";
+  digester()->Update(
+      absl::string_view(dest, IntCast<size_t>(src->pos() - pos_before)));
+  MakeBuffer(src);
+  return ok;
+}
+
+bool DigestingReaderBase::ReadSlow(Chain* dest, size_t length) {
+  RIEGELI_ASSERT_GT(length, UnsignedMin(available(), kMaxBytesToCopy))
+      << "Failed precondition of Reader::ReadSlow(Chain*): "
+         "length too small, use Read(Chain*) instead";
+  RIEGELI_ASSERT_LE(length, std::numeric_limits<size_t>::max() - dest->size())
+      << "Failed precondition of Reader::ReadSlow(Chain*): "
+         "Chain size overflow";
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  Reader* const src = src_reader();
+  SyncBuffer(src);
+  // Read into a separate Chain so that the newly read data can be digested
+  // block by block; appending the Chain shares its blocks with dest.
+  Chain data;
+  const bool ok = src->Read(&data, length);
+  digester()->Update(data);
+  dest->Append(std::move(data));
+  MakeBuffer(src);
+  return ok;
+}
+
+template class DigestingReader<Reader*>;
+template class DigestingReader<std::unique_ptr<Reader>>;
+
+}  // namespace riegeli
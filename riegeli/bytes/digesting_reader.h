@@ -0,0 +1,226 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BYTES_DIGESTING_READER_H_
+#define RIEGELI_BYTES_DIGESTING_READER_H_
+
+#include <stddef.h>
+
+#include <memory>
+#include <utility>
+
+#include "absl/base/optimization.h"
+#include "absl/strings/string_view.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/dependency.h"
+#include "riegeli/base/object.h"
+#include "riegeli/bytes/digester.h"
+#include "riegeli/bytes/reader.h"
+
+namespace riegeli {
+
+// Template parameter invariant part of DigestingReader.
+class DigestingReaderBase : public Reader {
+ public:
+  // Returns the Digester being updated.
+  Digester* digester() const { return digester_; }
+
+  // Returns the original Reader. Unchanged by Close().
+  virtual Reader* src_reader() = 0;
+  virtual const Reader* src_reader() const = 0;
+
+ protected:
+  DigestingReaderBase() noexcept : Reader(State::kClosed) {}
+
+  explicit DigestingReaderBase(Digester* digester)
+      : Reader(State::kOpen), digester_(digester) {}
+
+  DigestingReaderBase(DigestingReaderBase&& that) noexcept;
+  DigestingReaderBase& operator=(DigestingReaderBase&& that) noexcept;
+
+  void Done() override;
+  bool PullSlow() override;
+  bool PullSlow(size_t min_length) override;
+  using Reader::ReadSlow;
+  bool ReadSlow(char* dest, size_t length) override;
+  bool ReadSlow(Chain* dest, size_t length) override;
+  // CopyToSlow() is inherited from Reader: its default implementations pass
+  // all data through the shared buffer or ReadSlow(), hence through the
+  // Digester.
+
+  // Sets cursor of src to cursor of this, and digests data read from the
+  // buffer since the buffer was last made.
+  void SyncBuffer(Reader* src);
+
+  // Sets buffer pointers of this to buffer pointers of src. Fails this if
+  // src failed.
+  void MakeBuffer(Reader* src);
+
+ private:
+  // The Digester being updated. Not owned.
+  Digester* digester_ = nullptr;
+  // Pointer into the shared buffer up to which data have been digested.
+  const char* digested_from_ = nullptr;
+
+  // Invariants if healthy():
+  //   start_ == src_reader()->start_
+  //   limit_ == src_reader()->limit_
+  //   limit_pos_ == src_reader()->limit_pos_
+  //   start_ <= digested_from_ <= cursor_
+};
+
+// A Reader which forwards reads to another Reader, updating a Digester with
+// all read data. This folds computing a digest into the reading pass, instead
+// of a separate pass over data which may have fallen out of cache.
+//
+// The buffer is shared with the original Reader, hence data read from the
+// buffer are digested lazily, when the buffer is synced.
+//
+// The Src template parameter specifies the type of the object providing and
+// possibly owning the original Reader. Src must support
+// Dependency<Reader*, Src>, e.g. Reader* (not owned, default),
+// unique_ptr<Reader> (owned), ChainReader<> (owned).
+//
+// The original Reader must not be accessed until the DigestingReader is
+// closed or no longer used.
+template <typename Src = Reader*>
+class DigestingReader : public DigestingReaderBase {
+ public:
+  // Creates a closed DigestingReader.
+  DigestingReader() noexcept {}
+
+  // Will read from the original Reader provided by src, updating *digester.
+  //
+  // *digester is not owned and must outlive the DigestingReader.
+  explicit DigestingReader(Src src, Digester* digester);
+
+  DigestingReader(DigestingReader&& that) noexcept;
+  DigestingReader& operator=(DigestingReader&& that) noexcept;
+
+  // Returns the object providing and possibly owning the original Reader.
+  // Unchanged by Close().
+  Src& src() { return src_.manager(); }
+  const Src& src() const { return src_.manager(); }
+  Reader* src_reader() override { return src_.get(); }
+  const Reader* src_reader() const override { return src_.get(); }
+
+ protected:
+  void Done() override;
+  void VerifyEnd() override;
+
+ private:
+  void MoveSrc(DigestingReader&& that);
+
+  // The object providing and possibly owning the original Reader.
+  Dependency<Reader*, Src> src_;
+};
+
+// Implementation details follow.
+
+inline DigestingReaderBase::DigestingReaderBase(
+    DigestingReaderBase&& that) noexcept
+    : Reader(std::move(that)),
+      digester_(that.digester_),
+      digested_from_(that.digested_from_) {}
+
+inline DigestingReaderBase& DigestingReaderBase::operator=(
+    DigestingReaderBase&& that) noexcept {
+  Reader::operator=(std::move(that));
+  digester_ = that.digester_;
+  digested_from_ = that.digested_from_;
+  return *this;
+}
+
+inline void DigestingReaderBase::SyncBuffer(Reader* src) {
+  RIEGELI_ASSERT(digested_from_ <= cursor_)
+      << "Failed invariant of DigestingReaderBase: "
+         "buffer digested beyond the cursor";
+  digester_->Update(
+      absl::string_view(digested_from_, PtrDistance(digested_from_, cursor_)));
+  src->set_cursor(cursor_);
+}
+
+inline void DigestingReaderBase::MakeBuffer(Reader* src) {
+  start_ = src->start();
+  cursor_ = src->cursor();
+  limit_ = src->limit();
+  limit_pos_ = src->pos() + src->available();  // src->limit_pos_
+  digested_from_ = cursor_;
+  if (ABSL_PREDICT_FALSE(!src->healthy())) Fail(*src);
+}
+
+template <typename Src>
+inline DigestingReader<Src>::DigestingReader(Src src, Digester* digester)
+    : DigestingReaderBase(digester), src_(std::move(src)) {
+  RIEGELI_ASSERT(src_.get() != nullptr)
+      << "Failed precondition of "
+         "DigestingReader<Src>::DigestingReader(Src): "
+         "null Reader pointer";
+  RIEGELI_ASSERT(digester != nullptr)
+      << "Failed precondition of "
+         "DigestingReader<Src>::DigestingReader(Src): "
+         "null Digester pointer";
+  MakeBuffer(src_.get());
+}
+
+template <typename Src>
+inline DigestingReader<Src>::DigestingReader(DigestingReader&& that) noexcept
+    : DigestingReaderBase(std::move(that)) {
+  MoveSrc(std::move(that));
+}
+
+template <typename Src>
+inline DigestingReader<Src>& DigestingReader<Src>::operator=(
+    DigestingReader&& that) noexcept {
+  DigestingReaderBase::operator=(std::move(that));
+  MoveSrc(std::move(that));
+  return *this;
+}
+
+template <typename Src>
+inline void DigestingReader<Src>::MoveSrc(DigestingReader&& that) {
+  if (src_.kIsStable()) {
+    src_ = std::move(that.src_);
+  } else {
+    SyncBuffer(src_.get());
+    src_ = std::move(that.src_);
+    MakeBuffer(src_.get());
+  }
+}
+
+template <typename Src>
+void DigestingReader<Src>::Done() {
+  DigestingReaderBase::Done();
+  if (src_.is_owning()) {
+    if (ABSL_PREDICT_FALSE(!src_->Close())) Fail(*src_);
+  }
+}
+
+template <typename Src>
+void DigestingReader<Src>::VerifyEnd() {
+  DigestingReaderBase::VerifyEnd();
+  if (src_.is_owning() && ABSL_PREDICT_TRUE(healthy())) {
+    SyncBuffer(src_.get());
+    src_->VerifyEnd();
+    MakeBuffer(src_.get());
+  }
+}
+
+extern template class DigestingReader<Reader*>;
+extern template class DigestingReader<std::unique_ptr<Reader>>;
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_BYTES_DIGESTING_READER_H_
@@ -0,0 +1,104 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/bytes/digesting_writer.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "absl/base/optimization.h"
+#include "absl/strings/string_view.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/object.h"
+#include "riegeli/bytes/digester.h"
+#include "riegeli/bytes/writer.h"
+
+namespace riegeli {
+
+void DigestingWriterBase::Done() {
+  if (ABSL_PREDICT_TRUE(healthy())) {
+    Writer* const dest = dest_writer();
+    SyncBuffer(dest);
+  }
+  Writer::Done();
+}
+
+bool DigestingWriterBase::PushSlow() {
+  RIEGELI_ASSERT_EQ(available(), 0u)
+      << "Failed precondition of Writer::PushSlow(): "
+         "space available, use Push() instead";
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  Writer* const dest = dest_writer();
+  SyncBuffer(dest);
+  const bool ok = dest->Push();
+  MakeBuffer(dest);
+  return ok;
+}
+
+bool DigestingWriterBase::WriteSlow(absl::string_view src) {
+  RIEGELI_ASSERT_GT(src.size(), available())
+      << "Failed precondition of Writer::WriteSlow(string_view): "
+         "length too small, use Write(string_view) instead";
+  return WriteInternal(src);
+}
+
+bool DigestingWriterBase::WriteSlow(std::string&& src) {
+  RIEGELI_ASSERT_GT(src.size(), available())
+      << "Failed precondition of Writer::WriteSlow(string&&): "
+         "length too small, use Write(string&&) instead";
+  return WriteInternal(std::move(src));
+}
+
+bool DigestingWriterBase::WriteSlow(const Chain& src) {
+  RIEGELI_ASSERT_GT(src.size(), UnsignedMin(available(), kMaxBytesToCopy))
+      << "Failed precondition of Writer::WriteSlow(Chain): "
+         "length too small, use Write(Chain) instead";
+  return WriteInternal(src);
+}
+
+bool DigestingWriterBase::WriteSlow(Chain&& src) {
+  RIEGELI_ASSERT_GT(src.size(), UnsignedMin(available(), kMaxBytesToCopy))
+      << "Failed precondition of Writer::WriteSlow(Chain&&): "
+         "length too small, use Write(Chain&&) instead";
+  return WriteInternal(std::move(src));
+}
+
+template <typename Src>
+inline bool DigestingWriterBase::WriteInternal(Src&& src) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  Writer* const dest = dest_writer();
+  SyncBuffer(dest);
+  // Digest src before it is moved away; src as an lvalue selects
+  // Digester::Update(string_view) or Digester::Update(const Chain&).
+  digester()->Update(src);
+  const bool ok = dest->Write(std::forward<Src>(src));
+  MakeBuffer(dest);
+  return ok;
+}
+
+bool DigestingWriterBase::Flush(FlushType flush_type) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  Writer* const dest = dest_writer();
+  SyncBuffer(dest);
+  const bool ok = dest->Flush(flush_type);
+  MakeBuffer(dest);
+  return ok;
+}
+
+template class DigestingWriter<Writer*>;
+template class DigestingWriter<std::unique_ptr<Writer>>;
+
+}  // namespace riegeli
@@ -0,0 +1,218 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BYTES_DIGESTING_WRITER_H_
+#define RIEGELI_BYTES_DIGESTING_WRITER_H_
+
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "absl/base/optimization.h"
+#include "absl/strings/string_view.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/dependency.h"
+#include "riegeli/base/object.h"
+#include "riegeli/bytes/digester.h"
+#include "riegeli/bytes/writer.h"
+
+namespace riegeli {
+
+// Template parameter invariant part of DigestingWriter.
+class DigestingWriterBase : public Writer {
+ public:
+  // Returns the Digester being updated.
+  Digester* digester() const { return digester_; }
+
+  // Returns the original Writer. Unchanged by Close().
+  virtual Writer* dest_writer() = 0;
+  virtual const Writer* dest_writer() const = 0;
+
+  bool Flush(FlushType flush_type) override;
+
+ protected:
+  DigestingWriterBase() noexcept : Writer(State::kClosed) {}
+
+  explicit DigestingWriterBase(Digester* digester)
+      : Writer(State::kOpen), digester_(digester) {}
+
+  DigestingWriterBase(DigestingWriterBase&& that) noexcept;
+  DigestingWriterBase& operator=(DigestingWriterBase&& that) noexcept;
+
+  void Done() override;
+  bool PushSlow() override;
+  using Writer::WriteSlow;
+  bool WriteSlow(absl::string_view src) override;
+  bool WriteSlow(std::string&& src) override;
+  bool WriteSlow(const Chain& src) override;
+  bool WriteSlow(Chain&& src) override;
+
+  // Sets cursor of dest to cursor of this, and digests data written to the
+  // buffer since the buffer was last made.
+  void SyncBuffer(Writer* dest);
+
+  // Sets buffer pointers of this to buffer pointers of dest. Fails this if
+  // dest failed.
+  void MakeBuffer(Writer* dest);
+
+ private:
+  template <typename Src>
+  bool WriteInternal(Src&& src);
+
+  // The Digester being updated. Not owned.
+  Digester* digester_ = nullptr;
+  // Pointer into the shared buffer up to which data have been digested.
+  const char* digested_from_ = nullptr;
+
+  // Invariants if healthy():
+  //   start_ == dest_writer()->start_
+  //   limit_ == dest_writer()->limit_
+  //   start_pos_ == dest_writer()->start_pos_
+  //   start_ <= digested_from_ <= cursor_
+};
+
+// A Writer which forwards data to another Writer, updating a Digester with
+// all written data. This folds computing a digest into the writing pass,
+// instead of a separate pass over data which may have fallen out of cache.
+//
+// The buffer is shared with the original Writer, hence data written to the
+// buffer are digested lazily, when the buffer is synced.
+//
+// The Dest template parameter specifies the type of the object providing and
+// possibly owning the original Writer. Dest must support
+// Dependency<Writer*, Dest>, e.g. Writer* (not owned, default),
+// unique_ptr<Writer> (owned), ChainWriter<> (owned).
+//
+// The original Writer must not be accessed until the DigestingWriter is
+// closed or no longer used, except that it is allowed to read the destination
+// of the original Writer immediately after Flush().
+template <typename Dest = Writer*>
+class DigestingWriter : public DigestingWriterBase {
+ public:
+  // Creates a closed DigestingWriter.
+  DigestingWriter() noexcept {}
+
+  // Will write to the original Writer provided by dest, updating *digester.
+  //
+  // *digester is not owned and must outlive the DigestingWriter.
+  explicit DigestingWriter(Dest dest, Digester* digester);
+
+  DigestingWriter(DigestingWriter&& that) noexcept;
+  DigestingWriter& operator=(DigestingWriter&& that) noexcept;
+
+  // Returns the object providing and possibly owning the original Writer.
+  // Unchanged by Close().
+  Dest& dest() { return dest_.manager(); }
+  const Dest& dest() const { return dest_.manager(); }
+  Writer* dest_writer() override { return dest_.get(); }
+  const Writer* dest_writer() const override { return dest_.get(); }
+
+ protected:
+  void Done() override;
+
+ private:
+  void MoveDest(DigestingWriter&& that);
+
+  // The object providing and possibly owning the original Writer.
+  Dependency<Writer*, Dest> dest_;
+};
+
+// Implementation details follow.
+
+inline DigestingWriterBase::DigestingWriterBase(
+    DigestingWriterBase&& that) noexcept
+    : Writer(std::move(that)),
+      digester_(that.digester_),
+      digested_from_(that.digested_from_) {}
+
+inline DigestingWriterBase& DigestingWriterBase::operator=(
+    DigestingWriterBase&& that) noexcept {
+  Writer::operator=(std::move(that));
+  digester_ = that.digester_;
+  digested_from_ = that.digested_from_;
+  return *this;
+}
+
+inline void DigestingWriterBase::SyncBuffer(Writer* dest) {
+  RIEGELI_ASSERT(digested_from_ <= cursor_)
+      << "Failed invariant of DigestingWriterBase: "
+         "buffer digested beyond the cursor";
+  digester_->Update(
+      absl::string_view(digested_from_, PtrDistance(digested_from_, cursor_)));
+  dest->set_cursor(cursor_);
+}
+
+inline void DigestingWriterBase::MakeBuffer(Writer* dest) {
+  start_ = dest->start();
+  cursor_ = dest->cursor();
+  limit_ = dest->limit();
+  start_pos_ = dest->pos() - dest->written_to_buffer();  // dest->start_pos_
+  digested_from_ = cursor_;
+  if (ABSL_PREDICT_FALSE(!dest->healthy())) Fail(*dest);
+}
+
+template <typename Dest>
+inline DigestingWriter<Dest>::DigestingWriter(Dest dest, Digester* digester)
+    : DigestingWriterBase(digester), dest_(std::move(dest)) {
+  RIEGELI_ASSERT(dest_.get() != nullptr)
+      << "Failed precondition of "
+         "DigestingWriter<Dest>::DigestingWriter(Dest): "
+         "null Writer pointer";
+  RIEGELI_ASSERT(digester != nullptr)
+      << "Failed precondition of "
+         "DigestingWriter<Dest>::DigestingWriter(Dest): "
+         "null Digester pointer";
+  MakeBuffer(dest_.get());
+}
+
+template <typename Dest>
+inline DigestingWriter<Dest>::DigestingWriter(DigestingWriter&& that) noexcept
+    : DigestingWriterBase(std::move(that)) {
+  MoveDest(std::move(that));
+}
+
+template <typename Dest>
+inline DigestingWriter<Dest>& DigestingWriter<Dest>::operator=(
+    DigestingWriter&& that) noexcept {
+  DigestingWriterBase::operator=(std::move(that));
+  MoveDest(std::move(that));
+  return *this;
+}
+
+template <typename Dest>
+inline void DigestingWriter<Dest>::MoveDest(DigestingWriter&& that) {
+  if (dest_.kIsStable()) {
+    dest_ = std::move(that.dest_);
+  } else {
+    SyncBuffer(dest_.get());
+    dest_ = std::move(that.dest_);
+    MakeBuffer(dest_.get());
+  }
+}
+
+template <typename Dest>
+void DigestingWriter<Dest>::Done() {
+  DigestingWriterBase::Done();
+  if (dest_.is_owning()) {
+    if (ABSL_PREDICT_FALSE(!dest_->Close())) Fail(*dest_);
+  }
+}
+
+extern template class DigestingWriter<Writer*>;
+extern template class DigestingWriter<std::unique_ptr<Writer>>;
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_BYTES_DIGESTING_WRITER_H_
@@ -18,6 +18,7 @@
 #include <unistd.h>
 
 #include <cerrno>
+#include <memory>
 
 #include "absl/base/optimization.h"
 #include "absl/strings/string_view.h"
@@ -64,6 +65,35 @@ class OwnedFd {
   int fd_ = -1;
 };
 
+// Shares ownership of a file descriptor (-1 means none) between multiple
+// objects. The fd is closed when the last SharedFd sharing it is destroyed.
+//
+// This allows e.g. multiple FdReaders with Options::set_initial_pos() to read
+// concurrently from one file opened once, instead of each of them opening the
+// file separately.
+class SharedFd {
+ public:
+  // Creates a SharedFd which does not share a fd.
+  SharedFd() noexcept {}
+
+  // Creates a SharedFd which shares ownership of fd if fd >= 0.
+  explicit SharedFd(int fd)
+      : fd_(fd >= 0 ? std::make_shared<OwnedFd>(fd) : nullptr) {}
+
+  // Copying shares the fd, it does not duplicate it.
+  SharedFd(const SharedFd& that) noexcept = default;
+  SharedFd& operator=(const SharedFd& that) noexcept = default;
+
+  SharedFd(SharedFd&& that) noexcept = default;
+  SharedFd& operator=(SharedFd&& that) noexcept = default;
+
+  // Returns the shared file descriptor, or -1 if none.
+  int get() const { return fd_ == nullptr ? -1 : fd_->get(); }
+
+ private:
+  std::shared_ptr<OwnedFd> fd_;
+};
+
 // Specializations of Dependency<int, Manager>.
 
 template <>
@@ -78,6 +108,24 @@ class Dependency<int, OwnedFd> : public DependencyBase<OwnedFd> {
   static constexpr bool kIsStable() { return true; }
 };
 
+template <>
+class Dependency<int, SharedFd> : public DependencyBase<SharedFd> {
+ public:
+  using DependencyBase<SharedFd>::DependencyBase;
+
+  int get() const { return this->manager().get(); }
+  int Release() {
+    RIEGELI_ASSERT_UNREACHABLE()
+        << "Dependency<int, SharedFd>::Release() called "
+           "but the fd is shared, not exclusively owned";
+  }
+
+  // The fd is closed by the last SharedFd sharing it, not by Close() of the
+  // dependent object.
+  bool is_owning() const { return false; }
+  static constexpr bool kIsStable() { return true; }
+};
+
 template <>
 class Dependency<int, int> {
  public:
@@ -0,0 +1,576 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Make off_t 64-bit even on 32-bit systems.
+#undef _FILE_OFFSET_BITS
+#define _FILE_OFFSET_BITS 64
+
+#include "riegeli/bytes/fd_io_uring.h"
+
+#ifdef RIEGELI_HAS_IO_URING
+
+#include <fcntl.h>
+#include <liburing.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <limits>
+#include <string>
+
+#include "absl/base/optimization.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/errno_mapping.h"
+#include "riegeli/bytes/fd_dependency.h"
+
+namespace riegeli {
+
+IoUringFdWriter::IoUringFdWriter(int dest, Options options)
+    : Writer(State::kOpen), fd_(dest) {
+  RIEGELI_ASSERT_GE(dest, 0)
+      << "Failed precondition of IoUringFdWriter::IoUringFdWriter(int): "
+         "negative file descriptor";
+  filename_ = absl::StrCat("/proc/self/fd/", dest);
+  Initialize(options.initial_pos_, 0, options);
+}
+
+IoUringFdWriter::IoUringFdWriter(absl::string_view filename, int flags,
+                                 Options options)
+    : Writer(State::kOpen) {
+  RIEGELI_ASSERT((flags & O_ACCMODE) == O_WRONLY ||
+                 (flags & O_ACCMODE) == O_RDWR)
+      << "Failed precondition of "
+         "IoUringFdWriter::IoUringFdWriter(string_view): "
+         "flags must include O_WRONLY or O_RDWR";
+  filename_.assign(filename.data(), filename.size());
+again:
+  const int dest = open(filename_.c_str(), flags, options.permissions_);
+  if (ABSL_PREDICT_FALSE(dest < 0)) {
+    if (errno == EINTR) goto again;
+    FailOperation("open()");
+    return;
+  }
+  fd_ = dest;
+  owns_fd_ = true;
+  Initialize(options.initial_pos_, flags, options);
+}
+
+IoUringFdWriter::~IoUringFdWriter() {
+  if (ring_initialized_) {
+    // The kernel may still read from buffers_; wait for in-flight writes.
+    struct io_uring_cqe* cqe;
+    while (in_flight_ > 0) {
+      if (io_uring_wait_cqe(&ring_, &cqe) < 0) break;
+      io_uring_cqe_seen(&ring_, cqe);
+      --in_flight_;
+    }
+    io_uring_queue_exit(&ring_);
+  }
+}
+
+void IoUringFdWriter::Initialize(absl::optional<Position> initial_pos,
+                                 int flags, const Options& options) {
+  if (initial_pos.has_value()) {
+    if (ABSL_PREDICT_FALSE(*initial_pos >
+                           Position{std::numeric_limits<off_t>::max()})) {
+      FailOverflow();
+      return;
+    }
+    start_pos_ = *initial_pos;
+  } else {
+    const off_t file_pos =
+        lseek(fd_, 0, (flags & O_APPEND) != 0 ? SEEK_END : SEEK_CUR);
+    if (ABSL_PREDICT_FALSE(file_pos < 0)) {
+      FailOperation("lseek()");
+      return;
+    }
+    start_pos_ = IntCast<Position>(file_pos);
+  }
+  if (ABSL_PREDICT_FALSE(!InitializeRing(options.queue_depth_))) return;
+  buffers_.reserve(options.queue_depth_);
+  for (size_t i = 0; i < options.queue_depth_; ++i) {
+    buffers_.emplace_back(options.buffer_size_);
+  }
+  operations_.resize(options.queue_depth_);
+  free_buffers_.reserve(options.queue_depth_);
+  for (size_t i = 1; i < options.queue_depth_; ++i) free_buffers_.push_back(i);
+  current_buffer_ = 0;
+  start_ = buffers_[0].GetData();
+  cursor_ = start_;
+  limit_ = start_ + UnsignedMin(buffers_[0].size(),
+                                Position{std::numeric_limits<off_t>::max()} -
+                                    start_pos_);
+}
+
+bool IoUringFdWriter::InitializeRing(size_t queue_depth) {
+  const int result = io_uring_queue_init(
+      IntCast<unsigned>(UnsignedMin(
+          queue_depth, size_t{std::numeric_limits<unsigned>::max() / 2})),
+      &ring_, 0);
+  if (ABSL_PREDICT_FALSE(result < 0)) {
+    errno = -result;
+    return FailOperation("io_uring_queue_init()");
+  }
+  ring_initialized_ = true;
+  return true;
+}
+
+bool IoUringFdWriter::FailOperation(absl::string_view operation) {
+  const int error_number = errno;
+  RIEGELI_ASSERT_NE(error_number, 0)
+      << "Failed precondition of IoUringFdWriter::FailOperation(): "
+         "zero errno";
+  return Fail(ErrnoToCanonicalStatus(
+      error_number, absl::StrCat(operation, " failed writing ", filename_)));
+}
+
+bool IoUringFdWriter::SubmitOperation(size_t buffer_index) {
+  Operation& op = operations_[buffer_index];
+  struct io_uring_sqe* sqe = io_uring_get_sqe(&ring_);
+  if (ABSL_PREDICT_FALSE(sqe == nullptr)) {
+    // Make room in the submission queue.
+    io_uring_submit(&ring_);
+    sqe = io_uring_get_sqe(&ring_);
+    RIEGELI_ASSERT(sqe != nullptr) << "io_uring submission queue full";
+  }
+  io_uring_prep_writev(sqe, fd_, &op.iov, 1, IntCast<off_t>(op.pos));
+  io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(uintptr_t{buffer_index}));
+  const int result = io_uring_submit(&ring_);
+  if (ABSL_PREDICT_FALSE(result < 0)) {
+    errno = -result;
+    free_buffers_.push_back(buffer_index);
+    return FailOperation("io_uring_submit()");
+  }
+  ++in_flight_;
+  return true;
+}
+
+bool IoUringFdWriter::SubmitBuffer() {
+  const size_t length = written_to_buffer();
+  RIEGELI_ASSERT_GT(length, 0u)
+      << "Failed precondition of IoUringFdWriter::SubmitBuffer(): "
+         "nothing to write";
+  const size_t buffer_index = current_buffer_;
+  Operation& op = operations_[buffer_index];
+  op.iov.iov_base = start_;
+  op.iov.iov_len = length;
+  op.pos = start_pos_;
+  start_pos_ += length;
+  current_buffer_ = buffers_.size();
+  start_ = nullptr;
+  cursor_ = nullptr;
+  limit_ = nullptr;
+  return SubmitOperation(buffer_index);
+}
+
+bool IoUringFdWriter::ReapCompletion(bool wait) {
+  struct io_uring_cqe* cqe;
+  int result;
+  if (wait) {
+    RIEGELI_ASSERT_GT(in_flight_, 0u)
+        << "Failed precondition of IoUringFdWriter::ReapCompletion(): "
+           "no operations in flight";
+    result = io_uring_wait_cqe(&ring_, &cqe);
+  } else {
+    result = io_uring_peek_cqe(&ring_, &cqe);
+    if (result == -EAGAIN) return true;
+  }
+  if (ABSL_PREDICT_FALSE(result < 0)) {
+    errno = -result;
+    return FailOperation(wait ? "io_uring_wait_cqe()" : "io_uring_peek_cqe()");
+  }
+  const size_t buffer_index =
+      IntCast<size_t>(reinterpret_cast<uintptr_t>(io_uring_cqe_get_data(cqe)));
+  const int res = cqe->res;
+  io_uring_cqe_seen(&ring_, cqe);
+  --in_flight_;
+  Operation& op = operations_[buffer_index];
+  if (ABSL_PREDICT_FALSE(res < 0)) {
+    if (res == -EINTR || res == -EAGAIN) return SubmitOperation(buffer_index);
+    free_buffers_.push_back(buffer_index);
+    if (ABSL_PREDICT_TRUE(healthy())) {
+      errno = -res;
+      return FailOperation("write (io_uring)");
+    }
+    return false;
+  }
+  RIEGELI_ASSERT_GT(res, 0) << "io_uring write returned 0";
+  RIEGELI_ASSERT_LE(IntCast<size_t>(res), op.iov.iov_len)
+      << "io_uring write wrote more than requested";
+  if (IntCast<size_t>(res) < op.iov.iov_len) {
+    op.iov.iov_base = static_cast<char*>(op.iov.iov_base) + res;
+    op.iov.iov_len -= IntCast<size_t>(res);
+    op.pos += IntCast<size_t>(res);
+    return SubmitOperation(buffer_index);
+  }
+  free_buffers_.push_back(buffer_index);
+  return true;
+}
+
+bool IoUringFdWriter::DrainInFlight() {
+  bool ok = true;
+  while (in_flight_ > 0) {
+    if (ABSL_PREDICT_FALSE(!ReapCompletion(true))) ok = false;
+  }
+  return ok;
+}
+
+bool IoUringFdWriter::PushSlow() {
+  RIEGELI_ASSERT_EQ(available(), 0u)
+      << "Failed precondition of Writer::PushSlow(): "
+         "space available, use Push() instead";
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  if (written_to_buffer() > 0) {
+    if (ABSL_PREDICT_FALSE(!SubmitBuffer())) return false;
+  }
+  while (free_buffers_.empty()) {
+    if (ABSL_PREDICT_FALSE(!ReapCompletion(true))) return false;
+  }
+  if (ABSL_PREDICT_FALSE(start_pos_ ==
+                         Position{std::numeric_limits<off_t>::max()})) {
+    return FailOverflow();
+  }
+  current_buffer_ = free_buffers_.back();
+  free_buffers_.pop_back();
+  start_ = buffers_[current_buffer_].GetData();
+  cursor_ = start_;
+  limit_ = start_ + UnsignedMin(buffers_[current_buffer_].size(),
+                                Position{std::numeric_limits<off_t>::max()} -
+                                    start_pos_);
+  return true;
+}
+
+bool IoUringFdWriter::Flush(FlushType flush_type) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  if (written_to_buffer() > 0) {
+    if (ABSL_PREDICT_FALSE(!SubmitBuffer())) return false;
+  }
+  if (ABSL_PREDICT_FALSE(!DrainInFlight())) return false;
+  switch (flush_type) {
+    case FlushType::kFromObject:
+    case FlushType::kFromProcess:
+      return true;
+    case FlushType::kFromMachine:
+      if (ABSL_PREDICT_FALSE(fsync(fd_) < 0)) {
+        return FailOperation("fsync()");
+      }
+      return true;
+  }
+  RIEGELI_ASSERT_UNREACHABLE()
+      << "Unknown flush type: " << static_cast<int>(flush_type);
+}
+
+void IoUringFdWriter::Done() {
+  if (ABSL_PREDICT_TRUE(healthy()) && written_to_buffer() > 0) {
+    SubmitBuffer();
+  }
+  DrainInFlight();
+  start_ = nullptr;
+  cursor_ = nullptr;
+  limit_ = nullptr;
+  current_buffer_ = buffers_.size();
+  if (ring_initialized_) {
+    io_uring_queue_exit(&ring_);
+    ring_initialized_ = false;
+  }
+  if (owns_fd_ && fd_ >= 0) {
+    const int dest = fd_;
+    fd_ = -1;
+    if (ABSL_PREDICT_FALSE(internal::CloseFd(dest) < 0) &&
+        ABSL_PREDICT_TRUE(healthy())) {
+      FailOperation(internal::CloseFunctionName());
+    }
+  }
+}
+
+IoUringFdReader::IoUringFdReader(int src, Options options)
+    : Reader(State::kOpen), fd_(src) {
+  RIEGELI_ASSERT_GE(src, 0)
+      << "Failed precondition of IoUringFdReader::IoUringFdReader(int): "
+         "negative file descriptor";
+  filename_ = absl::StrCat("/proc/self/fd/", src);
+  Initialize(options.initial_pos_, options);
+}
+
+IoUringFdReader::IoUringFdReader(absl::string_view filename, int flags,
+                                 Options options)
+    : Reader(State::kOpen) {
+  RIEGELI_ASSERT((flags & O_ACCMODE) == O_RDONLY ||
+                 (flags & O_ACCMODE) == O_RDWR)
+      << "Failed precondition of "
+         "IoUringFdReader::IoUringFdReader(string_view): "
+         "flags must include O_RDONLY or O_RDWR";
+  filename_.assign(filename.data(), filename.size());
+again:
+  const int src = open(filename_.c_str(), flags);
+  if (ABSL_PREDICT_FALSE(src < 0)) {
+    if (errno == EINTR) goto again;
+    FailOperation("open()");
+    return;
+  }
+  fd_ = src;
+  owns_fd_ = true;
+  Initialize(options.initial_pos_, options);
+}
+
+IoUringFdReader::~IoUringFdReader() {
+  if (ring_initialized_) {
+    // The kernel may still write into buffers_; wait for in-flight reads.
+    struct io_uring_cqe* cqe;
+    while (in_flight_ > 0) {
+      if (io_uring_wait_cqe(&ring_, &cqe) < 0) break;
+      io_uring_cqe_seen(&ring_, cqe);
+      --in_flight_;
+    }
+    io_uring_queue_exit(&ring_);
+  }
+}
+
+void IoUringFdReader::Initialize(absl::optional<Position> initial_pos,
+                                 const Options& options) {
+  if (initial_pos.has_value()) {
+    if (ABSL_PREDICT_FALSE(*initial_pos >
+                           Position{std::numeric_limits<off_t>::max()})) {
+      FailOverflow();
+      return;
+    }
+    limit_pos_ = *initial_pos;
+  } else {
+    const off_t file_pos = lseek(fd_, 0, SEEK_CUR);
+    if (ABSL_PREDICT_FALSE(file_pos < 0)) {
+      FailOperation("lseek()");
+      return;
+    }
+    limit_pos_ = IntCast<Position>(file_pos);
+  }
+  next_read_pos_ = limit_pos_;
+  if (ABSL_PREDICT_FALSE(!InitializeRing(options.queue_depth_))) return;
+  buffer_size_ = options.buffer_size_;
+  buffers_.reserve(options.queue_depth_);
+  for (size_t i = 0; i < options.queue_depth_; ++i) {
+    buffers_.emplace_back(options.buffer_size_);
+  }
+  operations_.resize(options.queue_depth_);
+  free_buffers_.reserve(options.queue_depth_);
+  current_buffer_ = buffers_.size();
+  for (size_t i = 0; i < options.queue_depth_; ++i) {
+    if (ABSL_PREDICT_FALSE(!SubmitReadAhead(i))) return;
+  }
+}
+
+bool IoUringFdReader::InitializeRing(size_t queue_depth) {
+  const int result = io_uring_queue_init(
+      IntCast<unsigned>(UnsignedMin(
+          queue_depth, size_t{std::numeric_limits<unsigned>::max() / 2})),
+      &ring_, 0);
+  if (ABSL_PREDICT_FALSE(result < 0)) {
+    errno = -result;
+    return FailOperation("io_uring_queue_init()");
+  }
+  ring_initialized_ = true;
+  return true;
+}
+
+bool IoUringFdReader::FailOperation(absl::string_view operation) {
+  const int error_number = errno;
+  RIEGELI_ASSERT_NE(error_number, 0)
+      << "Failed precondition of IoUringFdReader::FailOperation(): "
+         "zero errno";
+  return Fail(ErrnoToCanonicalStatus(
+      error_number, absl::StrCat(operation, " failed reading ", filename_)));
+}
+
+bool IoUringFdReader::SubmitReadAhead(size_t buffer_index) {
+  RIEGELI_ASSERT(!end_of_file_)
+      << "Failed precondition of IoUringFdReader::SubmitReadAhead(): "
+         "end of file reached";
+  Operation& op = operations_[buffer_index];
+  char* const data = buffers_[buffer_index].GetData();
+  op.pos = next_read_pos_;
+  op.length =
+      UnsignedMin(buffers_[buffer_index].size(),
+                  Position{std::numeric_limits<off_t>::max()} - next_read_pos_);
+  if (ABSL_PREDICT_FALSE(op.length == 0)) {
+    // The fd position limit is reached; behave like end of file.
+    end_of_file_ = true;
+    free_buffers_.push_back(buffer_index);
+    return true;
+  }
+  op.iov.iov_base = data;
+  op.iov.iov_len = op.length;
+  op.result = 0;
+  op.done = false;
+  next_read_pos_ += op.length;
+  struct io_uring_sqe* sqe = io_uring_get_sqe(&ring_);
+  if (ABSL_PREDICT_FALSE(sqe == nullptr)) {
+    // Make room in the submission queue.
+    io_uring_submit(&ring_);
+    sqe = io_uring_get_sqe(&ring_);
+    RIEGELI_ASSERT(sqe != nullptr) << "io_uring submission queue full";
+  }
+  io_uring_prep_readv(sqe, fd_, &op.iov, 1, IntCast<off_t>(op.pos));
+  io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(uintptr_t{buffer_index}));
+  const int result = io_uring_submit(&ring_);
+  if (ABSL_PREDICT_FALSE(result < 0)) {
+    errno = -result;
+    free_buffers_.push_back(buffer_index);
+    return FailOperation("io_uring_submit()");
+  }
+  ++in_flight_;
+  pending_.push_back(buffer_index);
+  return true;
+}
+
+bool IoUringFdReader::ReapCompletion(bool wait) {
+  struct io_uring_cqe* cqe;
+  int result;
+  if (wait) {
+    RIEGELI_ASSERT_GT(in_flight_, 0u)
+        << "Failed precondition of IoUringFdReader::ReapCompletion(): "
+           "no operations in flight";
+    result = io_uring_wait_cqe(&ring_, &cqe);
+  } else {
+    result = io_uring_peek_cqe(&ring_, &cqe);
+    if (result == -EAGAIN) return true;
+  }
+  if (ABSL_PREDICT_FALSE(result < 0)) {
+    errno = -result;
+    return FailOperation(wait ? "io_uring_wait_cqe()" : "io_uring_peek_cqe()");
+  }
+  const size_t buffer_index =
+      IntCast<size_t>(reinterpret_cast<uintptr_t>(io_uring_cqe_get_data(cqe)));
+  const int res = cqe->res;
+  io_uring_cqe_seen(&ring_, cqe);
+  --in_flight_;
+  Operation& op = operations_[buffer_index];
+  if (ABSL_PREDICT_FALSE(res == -EINTR || res == -EAGAIN)) {
+    // Resubmit the read; pending_ order is unchanged.
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&ring_);
+    if (ABSL_PREDICT_FALSE(sqe == nullptr)) {
+      io_uring_submit(&ring_);
+      sqe = io_uring_get_sqe(&ring_);
+      RIEGELI_ASSERT(sqe != nullptr) << "io_uring submission queue full";
+    }
+    io_uring_prep_readv(sqe, fd_, &op.iov, 1, IntCast<off_t>(op.pos));
+    io_uring_sqe_set_data(sqe,
+                          reinterpret_cast<void*>(uintptr_t{buffer_index}));
+    const int submitted = io_uring_submit(&ring_);
+    if (ABSL_PREDICT_FALSE(submitted < 0)) {
+      errno = -submitted;
+      return FailOperation("io_uring_submit()");
+    }
+    ++in_flight_;
+    return true;
+  }
+  op.result = res;
+  op.done = true;
+  return true;
+}
+
+bool IoUringFdReader::DrainInFlight() {
+  bool ok = true;
+  while (in_flight_ > 0) {
+    if (ABSL_PREDICT_FALSE(!ReapCompletion(true))) ok = false;
+  }
+  return ok;
+}
+
+bool IoUringFdReader::PullSlow() {
+  RIEGELI_ASSERT_EQ(available(), 0u)
+      << "Failed precondition of Reader::PullSlow(): "
+         "data available, use Pull() instead";
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  if (pending_.empty()) {
+    // End of file was reached before; check whether the file has grown.
+    if (free_buffers_.empty()) return false;
+    end_of_file_ = false;
+    const size_t buffer_index = free_buffers_.back();
+    free_buffers_.pop_back();
+    if (ABSL_PREDICT_FALSE(!SubmitReadAhead(buffer_index))) return false;
+    if (pending_.empty()) return false;
+  }
+  const size_t buffer_index = pending_.front();
+  Operation& op = operations_[buffer_index];
+  while (!op.done) {
+    if (ABSL_PREDICT_FALSE(!ReapCompletion(true))) return false;
+  }
+  pending_.pop_front();
+  if (current_buffer_ < buffers_.size()) {
+    free_buffers_.push_back(current_buffer_);
+    current_buffer_ = buffers_.size();
+  }
+  if (ABSL_PREDICT_FALSE(op.result < 0)) {
+    free_buffers_.push_back(buffer_index);
+    errno = -op.result;
+    return FailOperation("read (io_uring)");
+  }
+  if (IntCast<size_t>(op.result) < op.length) {
+    // End of file after op.pos + op.result. Later queued reads would leave a
+    // gap; discard them and continue from the end of file when retried.
+    end_of_file_ = true;
+    DrainInFlight();
+    while (!pending_.empty()) {
+      free_buffers_.push_back(pending_.front());
+      pending_.pop_front();
+    }
+    next_read_pos_ = op.pos + IntCast<size_t>(op.result);
+    if (op.result == 0) {
+      free_buffers_.push_back(buffer_index);
+      return false;
+    }
+  } else if (!end_of_file_) {
+    // Top up the read-ahead queue.
+    while (!free_buffers_.empty() && !end_of_file_) {
+      const size_t free_index = free_buffers_.back();
+      free_buffers_.pop_back();
+      if (ABSL_PREDICT_FALSE(!SubmitReadAhead(free_index))) return false;
+    }
+  }
+  current_buffer_ = buffer_index;
+  start_ = buffers_[buffer_index].GetData();
+  cursor_ = start_;
+  limit_ = start_ + IntCast<size_t>(op.result);
+  limit_pos_ = op.pos + IntCast<size_t>(op.result);
+  return true;
+}
+
+void IoUringFdReader::Done() {
+  DrainInFlight();
+  pending_.clear();
+  start_ = nullptr;
+  cursor_ = nullptr;
+  limit_ = nullptr;
+  current_buffer_ = buffers_.size();
+  if (ring_initialized_) {
+    io_uring_queue_exit(&ring_);
+    ring_initialized_ = false;
+  }
+  if (owns_fd_ && fd_ >= 0) {
+    const int src = fd_;
+    fd_ = -1;
+    if (ABSL_PREDICT_FALSE(internal::CloseFd(src) < 0) &&
+        ABSL_PREDICT_TRUE(healthy())) {
+      FailOperation(internal::CloseFunctionName());
+    }
+  }
+}
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_HAS_IO_URING
@@ -0,0 +1,339 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BYTES_FD_IO_URING_H_
+#define RIEGELI_BYTES_FD_IO_URING_H_
+
+// IoUringFdReader and IoUringFdWriter are available if the library is built
+// with io_uring support, i.e. on Linux with liburing installed and
+// --define=riegeli_io_uring=enabled passed to Bazel. The build system defines
+// RIEGELI_HAS_IO_URING and links against liburing in that case.
+
+#ifdef RIEGELI_HAS_IO_URING
+
+#include <liburing.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/attributes.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/buffer.h"
+#include "riegeli/base/object.h"
+#include "riegeli/bytes/reader.h"
+#include "riegeli/bytes/writer.h"
+
+namespace riegeli {
+
+// A Writer which writes to a fd using io_uring. Writes are positioned, like
+// in FdWriter.
+//
+// Up to queue_depth buffers of written data are in flight in the kernel at
+// once. Push() submits the filled buffer and continues into a buffer whose
+// write has completed, so the writing thread rarely blocks for the duration
+// of a write, and one thread can keep many files busy.
+//
+// Reporting of write errors is delayed until the completion is reaped, i.e.
+// until a later Push(), Flush(), or Close().
+class IoUringFdWriter final : public Writer {
+ public:
+  class Options {
+   public:
+    Options() noexcept {}
+
+    // Permissions to use in case a new file is created (9 bits). The effective
+    // permissions are modified by the process's umask.
+    //
+    // Default: 0666
+    Options& set_permissions(mode_t permissions) & {
+      permissions_ = permissions;
+      return *this;
+    }
+    Options&& set_permissions(mode_t permissions) && {
+      return std::move(set_permissions(permissions));
+    }
+
+    // If nullopt, writing starts from the current fd position.
+    //
+    // If not nullopt, writing starts from this position, like in FdWriter.
+    //
+    // Default: nullopt.
+    Options& set_initial_pos(absl::optional<Position> initial_pos) & {
+      initial_pos_ = initial_pos;
+      return *this;
+    }
+    Options&& set_initial_pos(absl::optional<Position> initial_pos) && {
+      return std::move(set_initial_pos(initial_pos));
+    }
+
+    // Tunes the size of each buffer submitted in one write operation.
+    //
+    // Default: 64K
+    Options& set_buffer_size(size_t buffer_size) & {
+      RIEGELI_ASSERT_GT(buffer_size, 0u)
+          << "Failed precondition of "
+             "IoUringFdWriter::Options::set_buffer_size(): "
+             "zero buffer size";
+      buffer_size_ = buffer_size;
+      return *this;
+    }
+    Options&& set_buffer_size(size_t buffer_size) && {
+      return std::move(set_buffer_size(buffer_size));
+    }
+
+    // Tunes how many write operations may be in flight at once.
+    //
+    // Default: 4
+    Options& set_queue_depth(size_t queue_depth) & {
+      RIEGELI_ASSERT_GT(queue_depth, 0u)
+          << "Failed precondition of "
+             "IoUringFdWriter::Options::set_queue_depth(): "
+             "zero queue depth";
+      queue_depth_ = queue_depth;
+      return *this;
+    }
+    Options&& set_queue_depth(size_t queue_depth) && {
+      return std::move(set_queue_depth(queue_depth));
+    }
+
+   private:
+    friend class IoUringFdWriter;
+
+    mode_t permissions_ = 0666;
+    absl::optional<Position> initial_pos_;
+    size_t buffer_size_ = kDefaultBufferSize;
+    size_t queue_depth_ = 4;
+  };
+
+  // Creates a closed IoUringFdWriter.
+  IoUringFdWriter() noexcept : Writer(State::kClosed) {}
+
+  // Will write to the fd, which is not owned.
+  explicit IoUringFdWriter(int dest, Options options = Options());
+
+  // Opens a file for writing. The fd is owned.
+  //
+  // flags is the second argument of open, it must include O_WRONLY or O_RDWR.
+  explicit IoUringFdWriter(absl::string_view filename, int flags,
+                           Options options = Options());
+
+  IoUringFdWriter(const IoUringFdWriter&) = delete;
+  IoUringFdWriter& operator=(const IoUringFdWriter&) = delete;
+
+  ~IoUringFdWriter();
+
+  // Returns the fd being written to. If the fd is owned then changed to -1 by
+  // Close(), otherwise unchanged.
+  int dest_fd() const { return fd_; }
+
+  // Returns the original name of the file being written to (or
+  // /proc/self/fd/<fd> if fd was given). Unchanged by Close().
+  const std::string& filename() const { return filename_; }
+
+  bool Flush(FlushType flush_type) override;
+
+ protected:
+  void Done() override;
+  bool PushSlow() override;
+
+ private:
+  // State of one in-flight write, indexed by the buffer it writes from.
+  // user_data of the operation is the buffer index. iov describes the
+  // unwritten part and must stay valid while the operation is in flight.
+  struct Operation {
+    struct iovec iov {};
+    Position pos = 0;  // File position of the unwritten part.
+  };
+
+  void Initialize(absl::optional<Position> initial_pos, int flags,
+                  const Options& options);
+  bool InitializeRing(size_t queue_depth);
+  // Submits a write of the unwritten part of operations_[buffer_index].
+  bool SubmitOperation(size_t buffer_index);
+  // Submits writing buffered data [start_, cursor_) and detaches the buffer.
+  bool SubmitBuffer();
+  // Processes one completion. If wait is false and no completion is pending,
+  // returns true without processing anything.
+  bool ReapCompletion(bool wait);
+  // Waits until no operations are in flight.
+  bool DrainInFlight();
+  ABSL_ATTRIBUTE_COLD bool FailOperation(absl::string_view operation);
+
+  int fd_ = -1;
+  bool owns_fd_ = false;
+  std::string filename_;
+  struct io_uring ring_;
+  bool ring_initialized_ = false;
+  std::vector<Buffer> buffers_;
+  std::vector<Operation> operations_;
+  // Indices of buffers_ which are neither in flight nor being filled.
+  std::vector<size_t> free_buffers_;
+  // Index of the buffer being filled, or buffers_.size() if none.
+  size_t current_buffer_ = 0;
+  size_t in_flight_ = 0;
+
+  // Invariant: pos() <= numeric_limits<off_t>::max()
+};
+
+// A Reader which reads from a fd using io_uring. Reads are positioned, like
+// in FdReader, and the fd must support random access.
+//
+// Up to queue_depth buffers are read ahead in the background by the kernel
+// while earlier buffers are being consumed, so for sequential scans the
+// reading thread rarely blocks for the duration of a read.
+class IoUringFdReader final : public Reader {
+ public:
+  class Options {
+   public:
+    Options() noexcept {}
+
+    // If nullopt, reading starts from the current fd position.
+    //
+    // If not nullopt, reading starts from this position, like in FdReader.
+    //
+    // Default: nullopt.
+    Options& set_initial_pos(absl::optional<Position> initial_pos) & {
+      initial_pos_ = initial_pos;
+      return *this;
+    }
+    Options&& set_initial_pos(absl::optional<Position> initial_pos) && {
+      return std::move(set_initial_pos(initial_pos));
+    }
+
+    // Tunes the size of each buffer read in one read operation.
+    //
+    // Default: 64K
+    Options& set_buffer_size(size_t buffer_size) & {
+      RIEGELI_ASSERT_GT(buffer_size, 0u)
+          << "Failed precondition of "
+             "IoUringFdReader::Options::set_buffer_size(): "
+             "zero buffer size";
+      buffer_size_ = buffer_size;
+      return *this;
+    }
+    Options&& set_buffer_size(size_t buffer_size) && {
+      return std::move(set_buffer_size(buffer_size));
+    }
+
+    // Tunes how many read operations may be in flight at once.
+    //
+    // Default: 4
+    Options& set_queue_depth(size_t queue_depth) & {
+      RIEGELI_ASSERT_GT(queue_depth, 0u)
+          << "Failed precondition of "
+             "IoUringFdReader::Options::set_queue_depth(): "
+             "zero queue depth";
+      queue_depth_ = queue_depth;
+      return *this;
+    }
+    Options&& set_queue_depth(size_t queue_depth) && {
+      return std::move(set_queue_depth(queue_depth));
+    }
+
+   private:
+    friend class IoUringFdReader;
+
+    absl::optional<Position> initial_pos_;
+    size_t buffer_size_ = kDefaultBufferSize;
+    size_t queue_depth_ = 4;
+  };
+
+  // Creates a closed IoUringFdReader.
+  IoUringFdReader() noexcept : Reader(State::kClosed) {}
+
+  // Will read from the fd, which is not owned.
+  explicit IoUringFdReader(int src, Options options = Options());
+
+  // Opens a file for reading. The fd is owned.
+  //
+  // flags is the second argument of open, it must include O_RDONLY or O_RDWR.
+  explicit IoUringFdReader(absl::string_view filename, int flags,
+                           Options options = Options());
+
+  IoUringFdReader(const IoUringFdReader&) = delete;
+  IoUringFdReader& operator=(const IoUringFdReader&) = delete;
+
+  ~IoUringFdReader();
+
+  // Returns the fd being read from. If the fd is owned then changed to -1 by
+  // Close(), otherwise unchanged.
+  int src_fd() const { return fd_; }
+
+  // Returns the original name of the file being read from (or
+  // /proc/self/fd/<fd> if fd was given). Unchanged by Close().
+  const std::string& filename() const { return filename_; }
+
+ protected:
+  void Done() override;
+  bool PullSlow() override;
+
+ private:
+  // State of one in-flight read, indexed by the buffer it reads into.
+  // user_data of the operation is the buffer index. iov must stay valid
+  // while the operation is in flight.
+  struct Operation {
+    struct iovec iov {};
+    Position pos = 0;   // File position of the read.
+    size_t length = 0;  // Requested length.
+    int result = 0;     // Result of the read when done.
+    bool done = false;
+  };
+
+  void Initialize(absl::optional<Position> initial_pos, const Options& options);
+  bool InitializeRing(size_t queue_depth);
+  // Submits a read of buffer_size_ bytes at next_read_pos_ into the given
+  // buffer and appends it to pending_.
+  bool SubmitReadAhead(size_t buffer_index);
+  // Processes one completion. If wait is false and no completion is pending,
+  // returns true without processing anything.
+  bool ReapCompletion(bool wait);
+  // Waits until no operations are in flight.
+  bool DrainInFlight();
+  ABSL_ATTRIBUTE_COLD bool FailOperation(absl::string_view operation);
+
+  int fd_ = -1;
+  bool owns_fd_ = false;
+  std::string filename_;
+  struct io_uring ring_;
+  bool ring_initialized_ = false;
+  size_t buffer_size_ = 0;
+  std::vector<Buffer> buffers_;
+  std::vector<Operation> operations_;
+  // Buffer indices of submitted reads, in the order of file positions.
+  std::deque<size_t> pending_;
+  // Indices of buffers_ which are neither in flight nor being consumed.
+  std::vector<size_t> free_buffers_;
+  // Index of the buffer being consumed, or buffers_.size() if none.
+  size_t current_buffer_ = 0;
+  size_t in_flight_ = 0;
+  // File position after the last submitted read.
+  Position next_read_pos_ = 0;
+  // True after a read ended before its requested length, i.e. at end of file;
+  // no further reads are submitted.
+  bool end_of_file_ = false;
+
+  // Invariant: limit_pos_ <= numeric_limits<off_t>::max()
+};
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_HAS_IO_URING
+
+#endif  // RIEGELI_BYTES_FD_IO_URING_H_
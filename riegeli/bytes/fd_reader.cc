@@ -12,10 +12,10 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
-// Make pread() available.
-#if !defined(_XOPEN_SOURCE) || _XOPEN_SOURCE < 500
+// Make pread() and posix_fadvise() available.
+#if !defined(_XOPEN_SOURCE) || _XOPEN_SOURCE < 600
 #undef _XOPEN_SOURCE
-#define _XOPEN_SOURCE 500
+#define _XOPEN_SOURCE 600
 #endif
 
 // Make off_t 64-bit even on 32-bit systems.
@@ -32,23 +32,33 @@
 #include <unistd.h>
 
 #include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <future>
 #include <limits>
+#include <memory>
 #include <string>
+#include <utility>
 
 #include "absl/base/attributes.h"
 #include "absl/base/optimization.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
 #include "absl/utility/utility.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/canonical_errors.h"
 #include "riegeli/base/chain.h"
 #include "riegeli/base/errno_mapping.h"
-#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
+#include "riegeli/base/parallelism.h"
+#include "riegeli/base/stats_sink.h"
 #include "riegeli/bytes/backward_writer.h"
 #include "riegeli/bytes/buffered_reader.h"
 #include "riegeli/bytes/fd_dependency.h"
+#include "riegeli/bytes/fd_writer.h"
+#include "riegeli/bytes/mmap_ref.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/bytes/writer.h"
 
@@ -56,52 +66,10 @@ namespace riegeli {
 
 namespace {
 
-class MMapRef {
- public:
-  MMapRef(void* data, size_t size) : data_(data), size_(size) {}
-
-  MMapRef(MMapRef&& that) noexcept;
-  ABSL_ATTRIBUTE_UNUSED MMapRef& operator=(MMapRef&& that) noexcept;
-
-  ~MMapRef();
-
-  absl::string_view data() const {
-    return absl::string_view(static_cast<const char*>(data_), size_);
-  }
-  void RegisterSubobjects(MemoryEstimator* memory_estimator) const;
-  void DumpStructure(std::ostream& out) const;
-
- private:
-  void* data_;
-  size_t size_;
-};
-
-MMapRef::MMapRef(MMapRef&& that) noexcept
-    : data_(absl::exchange(that.data_, nullptr)),
-      size_(absl::exchange(that.size_, 0)) {}
-
-MMapRef& MMapRef::operator=(MMapRef&& that) noexcept {
-  // Exchange that.data_ early to support self-assignment.
-  void* const data = absl::exchange(that.data_, nullptr);
-  if (data_ != nullptr) {
-    RIEGELI_CHECK_EQ(munmap(data_, size_), 0)
-        << ErrnoToCanonicalStatus(errno, "munmap() failed").message();
-  }
-  data_ = data;
-  size_ = absl::exchange(that.size_, 0);
-  return *this;
-}
-
-MMapRef::~MMapRef() {
-  if (data_ != nullptr) {
-    RIEGELI_CHECK_EQ(munmap(data_, size_), 0)
-        << ErrnoToCanonicalStatus(errno, "munmap() failed").message();
-  }
-}
-
-void MMapRef::RegisterSubobjects(MemoryEstimator* memory_estimator) const {}
-
-void MMapRef::DumpStructure(std::ostream& out) const { out << "mmap"; }
+// Data behind the reading position are dropped from the operating system
+// cache in multiples of this length, to avoid issuing posix_fadvise() for
+// every read.
+ABSL_ATTRIBUTE_UNUSED constexpr size_t kDropCacheGranularity = size_t{1} << 20;
 
 }  // namespace
 
@@ -156,6 +124,35 @@ void FdReaderBase::Initialize(absl::optional<Position> initial_pos, int src) {
   }
 }
 
+void FdReaderBase::InitializeFadvise(int src, bool fadvise_sequential,
+                                     bool fadvise_willneed,
+                                     bool drop_cache_behind) {
+#ifdef POSIX_FADV_SEQUENTIAL
+  // posix_fadvise() is advisory; failures are ignored.
+  if (fadvise_sequential) posix_fadvise(src, 0, 0, POSIX_FADV_SEQUENTIAL);
+  if (fadvise_willneed) posix_fadvise(src, 0, 0, POSIX_FADV_WILLNEED);
+  if (drop_cache_behind) {
+    drop_cache_behind_ = true;
+    cache_dropped_pos_ = limit_pos_;
+  }
+#endif
+}
+
+inline void FdReaderBase::DropCacheBehind(int src) {
+#ifdef POSIX_FADV_DONTNEED
+  if (limit_pos_ < SaturatingAdd(cache_dropped_pos_,
+                                 Position{kDropCacheGranularity})) {
+    return;
+  }
+  const Position drop_end = RoundDown<kDropCacheGranularity>(limit_pos_);
+  // posix_fadvise() is advisory; failures are ignored.
+  posix_fadvise(src, IntCast<off_t>(cache_dropped_pos_),
+                IntCast<off_t>(drop_end - cache_dropped_pos_),
+                POSIX_FADV_DONTNEED);
+  cache_dropped_pos_ = drop_end;
+#endif
+}
+
 void FdReaderBase::SyncPos(int src) {
   if (sync_pos_) {
     if (ABSL_PREDICT_FALSE(lseek(src, IntCast<off_t>(pos()), SEEK_SET) < 0)) {
@@ -180,12 +177,22 @@ bool FdReaderBase::ReadInternal(char* dest, size_t min_length,
                              limit_pos_)) {
     return FailOverflow();
   }
+  if (ABSL_PREDICT_FALSE(deadline_ != absl::InfiniteDuration())) {
+    return ReadInternalWithDeadline(src, dest, min_length, max_length);
+  }
   for (;;) {
   again:
+    absl::Time time_before;
+    if (ABSL_PREDICT_FALSE(stats_sink_ != nullptr)) time_before = absl::Now();
     const ssize_t length_read = pread(
         src, dest,
         UnsignedMin(max_length, size_t{std::numeric_limits<ssize_t>::max()}),
         IntCast<off_t>(limit_pos_));
+    if (ABSL_PREDICT_FALSE(stats_sink_ != nullptr)) {
+      stats_sink_->OnPullStall(absl::Now() - time_before);
+      stats_sink_->OnReadSyscall(
+          length_read > 0 ? IntCast<size_t>(length_read) : size_t{0});
+    }
     if (ABSL_PREDICT_FALSE(length_read < 0)) {
       if (errno == EINTR) goto again;
       return FailOperation("pread()");
@@ -194,6 +201,7 @@ bool FdReaderBase::ReadInternal(char* dest, size_t min_length,
     RIEGELI_ASSERT_LE(IntCast<size_t>(length_read), max_length)
         << "pread() read more than requested";
     limit_pos_ += IntCast<size_t>(length_read);
+    if (ABSL_PREDICT_FALSE(drop_cache_behind_)) DropCacheBehind(src);
     if (IntCast<size_t>(length_read) >= min_length) return true;
     dest += length_read;
     min_length -= IntCast<size_t>(length_read);
@@ -201,6 +209,137 @@ bool FdReaderBase::ReadInternal(char* dest, size_t min_length,
   }
 }
 
+bool FdReaderBase::ReadInternalWithDeadline(int src, char* dest,
+                                            size_t min_length,
+                                            size_t max_length) {
+  // pread() on a regular file ignores O_NONBLOCK, and poll() reports regular
+  // files as always readable, hence the deadline is enforced by performing
+  // pread() on an I/O thread and waiting for its completion with a timeout.
+  //
+  // A read which exceeded the deadline is abandoned. Its task reads into a
+  // buffer owned by the task itself, not into dest, hence the task can
+  // outlive this FdReaderBase. The promise is deleted by the task after the
+  // result is set.
+  struct ReadResult {
+    ssize_t length_read = 0;
+    int error_number = 0;
+    std::unique_ptr<char[]> buffer;
+  };
+  const std::chrono::system_clock::time_point deadline =
+      absl::ToChronoTime(absl::Now() + deadline_);
+  for (;;) {
+    const size_t length_to_read =
+        UnsignedMin(max_length, size_t{std::numeric_limits<ssize_t>::max()});
+    std::promise<ReadResult>* const done = new std::promise<ReadResult>();
+    std::future<ReadResult> done_future = done->get_future();
+    const Position pos_to_read = limit_pos_;
+    internal::ThreadPool::global_io().Schedule(
+        [src, length_to_read, pos_to_read, done] {
+          ReadResult result;
+          result.buffer = std::unique_ptr<char[]>(new char[length_to_read]);
+        again:
+          result.length_read = pread(src, result.buffer.get(), length_to_read,
+                                     IntCast<off_t>(pos_to_read));
+          if (ABSL_PREDICT_FALSE(result.length_read < 0)) {
+            if (errno == EINTR) goto again;
+            result.error_number = errno;
+          }
+          done->set_value(std::move(result));
+          delete done;
+        });
+    absl::Time time_before;
+    if (ABSL_PREDICT_FALSE(stats_sink_ != nullptr)) time_before = absl::Now();
+    if (ABSL_PREDICT_FALSE(done_future.wait_until(deadline) ==
+                           std::future_status::timeout)) {
+      return Fail(DeadlineExceededError(absl::StrCat(
+          "pread() did not complete before the deadline reading ",
+          filename_)));
+    }
+    const ReadResult result = done_future.get();
+    if (ABSL_PREDICT_FALSE(stats_sink_ != nullptr)) {
+      stats_sink_->OnPullStall(absl::Now() - time_before);
+      stats_sink_->OnReadSyscall(result.length_read > 0
+                                     ? IntCast<size_t>(result.length_read)
+                                     : size_t{0});
+    }
+    if (ABSL_PREDICT_FALSE(result.length_read < 0)) {
+      errno = result.error_number;
+      return FailOperation("pread()");
+    }
+    if (ABSL_PREDICT_FALSE(result.length_read == 0)) return false;
+    RIEGELI_ASSERT_LE(IntCast<size_t>(result.length_read), max_length)
+        << "pread() read more than requested";
+    std::memcpy(dest, result.buffer.get(),
+                IntCast<size_t>(result.length_read));
+    limit_pos_ += IntCast<size_t>(result.length_read);
+    if (ABSL_PREDICT_FALSE(drop_cache_behind_)) DropCacheBehind(src);
+    if (IntCast<size_t>(result.length_read) >= min_length) return true;
+    dest += result.length_read;
+    min_length -= IntCast<size_t>(result.length_read);
+    max_length -= IntCast<size_t>(result.length_read);
+  }
+}
+
+size_t FdReaderBase::ReadAheadInternal(char* dest, size_t max_length,
+                                       Position pos) {
+  RIEGELI_ASSERT_LE(pos, Position{std::numeric_limits<off_t>::max()})
+      << "Failed precondition of FdReaderBase::ReadAheadInternal(): "
+         "position out of range";
+  const int src = src_fd();
+  max_length =
+      UnsignedMin(max_length, Position{std::numeric_limits<off_t>::max()} - pos,
+                  size_t{std::numeric_limits<ssize_t>::max()});
+again:
+  absl::Time time_before;
+  if (ABSL_PREDICT_FALSE(stats_sink_ != nullptr)) time_before = absl::Now();
+  const ssize_t length_read = pread(src, dest, max_length, IntCast<off_t>(pos));
+  if (ABSL_PREDICT_FALSE(stats_sink_ != nullptr)) {
+    stats_sink_->OnPullStall(absl::Now() - time_before);
+    stats_sink_->OnReadSyscall(
+        length_read > 0 ? IntCast<size_t>(length_read) : size_t{0});
+  }
+  if (ABSL_PREDICT_FALSE(length_read < 0)) {
+    if (errno == EINTR) goto again;
+    // The failure will be rediscovered and reported by ReadInternal() when
+    // reading reaches pos.
+    return 0;
+  }
+  RIEGELI_ASSERT_LE(IntCast<size_t>(length_read), max_length)
+      << "pread() read more than requested";
+  return IntCast<size_t>(length_read);
+}
+
+bool FdReaderBase::CopyToSlow(Writer* dest, Position length) {
+  RIEGELI_ASSERT_GT(length, UnsignedMin(available(), kMaxBytesToCopy))
+      << "Failed precondition of Reader::CopyToSlow(Writer*): "
+         "length too small, use CopyTo(Writer*) instead";
+  if (dest->GetTypeId() == TypeId::For<FdWriterBase>() &&
+      ABSL_PREDICT_TRUE(healthy())) {
+    // Both ends are fds; let the kernel copy the data directly between the
+    // files, bypassing buffers of both objects.
+    if (available() > 0) {
+      const absl::string_view data(cursor_, UnsignedMin(available(), length));
+      cursor_ += data.size();
+      if (ABSL_PREDICT_FALSE(!dest->Write(data))) return false;
+      if (data.size() == length) return true;
+      length -= data.size();
+    }
+    ClearBuffer();
+    FdWriterBase* const fd_dest = static_cast<FdWriterBase*>(dest);
+    const Position length_copied =
+        fd_dest->CopyFromFd(src_fd(), limit_pos_, length);
+    if (ABSL_PREDICT_FALSE(!fd_dest->healthy())) return false;
+    limit_pos_ += length_copied;
+    if (ABSL_PREDICT_FALSE(drop_cache_behind_)) DropCacheBehind(src_fd());
+    if (length_copied == length) return true;
+    // copy_file_range() is not supported between these fds, or the copy was
+    // cut short; copy the remaining data through the buffer. If the source
+    // file ends before length bytes, this reports the failure.
+    length -= length_copied;
+  }
+  return BufferedReader::CopyToSlow(dest, length);
+}
+
 bool FdReaderBase::SeekSlow(Position new_pos) {
   RIEGELI_ASSERT(new_pos < start_pos() || new_pos > limit_pos_)
       << "Failed precondition of Reader::SeekSlow(): "
@@ -224,6 +363,23 @@ bool FdReaderBase::SeekSlow(Position new_pos) {
   return true;
 }
 
+void FdReaderBase::ReadHintSlow(size_t length) {
+  RIEGELI_ASSERT_GT(length, available())
+      << "Failed precondition of Reader::ReadHintSlow(): "
+         "enough data available, use ReadHint() instead";
+  if (ABSL_PREDICT_FALSE(!healthy())) return;
+#ifdef POSIX_FADV_WILLNEED
+  // Data beyond the buffer begin at limit_pos_. posix_fadvise() is advisory;
+  // failures are ignored.
+  posix_fadvise(
+      src_fd(), IntCast<off_t>(limit_pos_),
+      IntCast<off_t>(UnsignedMin(
+          length - available(),
+          Position{std::numeric_limits<off_t>::max()} - limit_pos_)),
+      POSIX_FADV_WILLNEED);
+#endif
+}
+
 bool FdReaderBase::Size(Position* size) {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
   const int src = src_fd();
@@ -270,6 +426,39 @@ bool FdStreamReaderBase::ReadInternal(char* dest, size_t min_length,
   }
 }
 
+bool FdStreamReaderBase::CopyToSlow(Writer* dest, Position length) {
+  RIEGELI_ASSERT_GT(length, UnsignedMin(available(), kMaxBytesToCopy))
+      << "Failed precondition of Reader::CopyToSlow(Writer*): "
+         "length too small, use CopyTo(Writer*) instead";
+  if (dest->GetTypeId() == TypeId::For<FdStreamWriterBase>() &&
+      ABSL_PREDICT_TRUE(healthy())) {
+    // Both ends are stream fds; if one of them is a pipe, the kernel can move
+    // the data directly between them, bypassing buffers of both objects.
+    if (available() > 0) {
+      const absl::string_view data(cursor_, UnsignedMin(available(), length));
+      cursor_ += data.size();
+      if (ABSL_PREDICT_FALSE(!dest->Write(data))) return false;
+      if (data.size() == length) return true;
+      length -= data.size();
+    }
+    if (ABSL_PREDICT_FALSE(length > std::numeric_limits<Position>::max() -
+                                        limit_pos_)) {
+      return FailOverflow();
+    }
+    ClearBuffer();
+    FdStreamWriterBase* const fd_dest = static_cast<FdStreamWriterBase*>(dest);
+    const Position length_spliced = fd_dest->SpliceFromFd(src_fd(), length);
+    if (ABSL_PREDICT_FALSE(!fd_dest->healthy())) return false;
+    limit_pos_ += length_spliced;
+    if (length_spliced == length) return true;
+    // splice() is not supported between these fds, or the splice was cut
+    // short; copy the remaining data through the buffer. If the source ends
+    // before length bytes, this reports the failure.
+    length -= length_spliced;
+  }
+  return BufferedReader::CopyToSlow(dest, length);
+}
+
 void FdMMapReaderBase::SetFilename(int src) {
   if (src == 0) {
     filename_ = "/dev/stdin";
@@ -319,6 +508,8 @@ void FdMMapReaderBase::Initialize(absl::optional<Position> initial_pos,
     FailOperation("mmap()");
     return;
   }
+  mapped_data_ = data;
+  mapped_size_ = IntCast<size_t>(stat_info.st_size);
   // FdMMapReaderBase derives from ChainReader<Chain> but the Chain to read from
   // was not known in FdMMapReaderBase constructor. This sets the Chain and
   // updates ChainReader to read from it.
@@ -336,6 +527,74 @@ void FdMMapReaderBase::Initialize(absl::optional<Position> initial_pos,
   }
 }
 
+void FdMMapReaderBase::InitializeMadvise(Options::AccessPattern access_pattern,
+                                         bool madvise_willneed,
+                                         bool huge_pages,
+                                         bool drop_cache_behind) {
+  if (mapped_data_ == nullptr) return;
+  // madvise() is advisory; failures are ignored.
+  switch (access_pattern) {
+    case Options::AccessPattern::kNormal:
+      break;
+    case Options::AccessPattern::kSequential:
+#ifdef MADV_SEQUENTIAL
+      madvise(mapped_data_, mapped_size_, MADV_SEQUENTIAL);
+#endif
+      break;
+    case Options::AccessPattern::kRandom:
+#ifdef MADV_RANDOM
+      madvise(mapped_data_, mapped_size_, MADV_RANDOM);
+#endif
+      break;
+  }
+#ifdef MADV_WILLNEED
+  if (madvise_willneed) madvise(mapped_data_, mapped_size_, MADV_WILLNEED);
+#endif
+#ifdef MADV_HUGEPAGE
+  if (huge_pages) madvise(mapped_data_, mapped_size_, MADV_HUGEPAGE);
+#endif
+#ifdef MADV_DONTNEED
+  if (drop_cache_behind) {
+    drop_cache_behind_ = true;
+    // Rounded down so that madvise() offsets stay page aligned.
+    cache_dropped_pos_ = RoundDown<kDropCacheGranularity>(pos());
+  }
+#endif
+}
+
+inline void FdMMapReaderBase::DropCacheBehind() {
+#ifdef MADV_DONTNEED
+  if (pos() < SaturatingAdd(cache_dropped_pos_,
+                            Position{kDropCacheGranularity})) {
+    return;
+  }
+  const Position drop_end = RoundDown<kDropCacheGranularity>(pos());
+  // madvise() is advisory; failures are ignored.
+  madvise(
+      static_cast<char*>(mapped_data_) + IntCast<size_t>(cache_dropped_pos_),
+      IntCast<size_t>(drop_end - cache_dropped_pos_), MADV_DONTNEED);
+  cache_dropped_pos_ = drop_end;
+#endif
+}
+
+bool FdMMapReaderBase::ReadSlow(Chain* dest, size_t length) {
+  const bool ok = ChainReader::ReadSlow(dest, length);
+  if (ABSL_PREDICT_FALSE(drop_cache_behind_)) DropCacheBehind();
+  return ok;
+}
+
+bool FdMMapReaderBase::CopyToSlow(Writer* dest, Position length) {
+  const bool ok = ChainReader::CopyToSlow(dest, length);
+  if (ABSL_PREDICT_FALSE(drop_cache_behind_)) DropCacheBehind();
+  return ok;
+}
+
+bool FdMMapReaderBase::CopyToSlow(BackwardWriter* dest, size_t length) {
+  const bool ok = ChainReader::CopyToSlow(dest, length);
+  if (ABSL_PREDICT_FALSE(drop_cache_behind_)) DropCacheBehind();
+  return ok;
+}
+
 void FdMMapReaderBase::SyncPos(int src) {
   if (sync_pos_) {
     if (ABSL_PREDICT_FALSE(lseek(src, IntCast<off_t>(pos()), SEEK_SET) < 0)) {
@@ -346,9 +605,11 @@ void FdMMapReaderBase::SyncPos(int src) {
 
 template class FdReader<OwnedFd>;
 template class FdReader<int>;
+template class FdReader<SharedFd>;
 template class FdStreamReader<OwnedFd>;
 template class FdStreamReader<int>;
 template class FdMMapReader<OwnedFd>;
 template class FdMMapReader<int>;
+template class FdMMapReader<SharedFd>;
 
 }  // namespace riegeli
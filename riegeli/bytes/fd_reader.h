@@ -24,12 +24,15 @@
 #include "absl/base/attributes.h"
 #include "absl/base/optimization.h"
 #include "absl/strings/string_view.h"
+#include "absl/time/time.h"
 #include "absl/types/optional.h"
 #include "absl/utility/utility.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
 #include "riegeli/base/dependency.h"
 #include "riegeli/base/object.h"
+#include "riegeli/base/parallelism.h"
+#include "riegeli/base/stats_sink.h"
 #include "riegeli/bytes/backward_writer.h"
 #include "riegeli/bytes/buffered_reader.h"
 #include "riegeli/bytes/chain_reader.h"
@@ -55,7 +58,8 @@ class FdReaderCommon : public BufferedReader {
  protected:
   FdReaderCommon() noexcept {}
 
-  explicit FdReaderCommon(size_t buffer_size);
+  explicit FdReaderCommon(size_t buffer_size,
+                          internal::ThreadPool* read_ahead_pool = nullptr);
 
   FdReaderCommon(FdReaderCommon&& that) noexcept;
   FdReaderCommon& operator=(FdReaderCommon&& that) noexcept;
@@ -106,12 +110,132 @@ class FdReaderBase : public internal::FdReaderCommon {
       return std::move(set_buffer_size(buffer_size));
     }
 
+    // If true, the buffer starts small and grows geometrically, up to
+    // set_buffer_size(), as long as reading keeps exhausting it, shrinking
+    // again after seeking. This reduces memory usage when many files are open
+    // and only small pieces of them are read.
+    //
+    // Default: false
+    Options& set_adaptive_buffer_sizing(bool adaptive_buffer_sizing) & {
+      adaptive_buffer_sizing_ = adaptive_buffer_sizing;
+      return *this;
+    }
+    Options&& set_adaptive_buffer_sizing(bool adaptive_buffer_sizing) && {
+      return std::move(set_adaptive_buffer_sizing(adaptive_buffer_sizing));
+    }
+
+    // If true, whenever the buffer needs to be refilled, the following buffer
+    // is filled in advance with pread() by a thread pool thread while the
+    // current buffer is being consumed. This helps sequential reading of data
+    // which are not cached by the operating system, at the cost of reading up
+    // to one buffer of extra data past the last position needed.
+    //
+    // Default: false
+    Options& set_background_read_ahead(bool background_read_ahead) & {
+      background_read_ahead_ = background_read_ahead;
+      return *this;
+    }
+    Options&& set_background_read_ahead(bool background_read_ahead) && {
+      return std::move(set_background_read_ahead(background_read_ahead));
+    }
+
+    // If true, advises the operating system on open that the file will be
+    // read sequentially, which typically increases kernel readahead.
+    //
+    // Ignored where posix_fadvise() is not supported.
+    //
+    // Default: false
+    Options& set_fadvise_sequential(bool fadvise_sequential) & {
+      fadvise_sequential_ = fadvise_sequential;
+      return *this;
+    }
+    Options&& set_fadvise_sequential(bool fadvise_sequential) && {
+      return std::move(set_fadvise_sequential(fadvise_sequential));
+    }
+
+    // If true, advises the operating system on open that the file contents
+    // will be needed soon, which typically starts readahead immediately.
+    //
+    // Ignored where posix_fadvise() is not supported.
+    //
+    // Default: false
+    Options& set_fadvise_willneed(bool fadvise_willneed) & {
+      fadvise_willneed_ = fadvise_willneed;
+      return *this;
+    }
+    Options&& set_fadvise_willneed(bool fadvise_willneed) && {
+      return std::move(set_fadvise_willneed(fadvise_willneed));
+    }
+
+    // If true, advises the operating system that data behind the reading
+    // position are no longer needed, dropping them from the cache as reading
+    // progresses. This keeps one-pass scans over large files from evicting
+    // more useful cached data, at the cost of rereading from the file system
+    // after seeking backwards.
+    //
+    // Ignored where posix_fadvise() is not supported.
+    //
+    // Default: false
+    Options& set_drop_cache_behind(bool drop_cache_behind) & {
+      drop_cache_behind_ = drop_cache_behind;
+      return *this;
+    }
+    Options&& set_drop_cache_behind(bool drop_cache_behind) && {
+      return std::move(set_drop_cache_behind(drop_cache_behind));
+    }
+
+    // Sets the maximum time a single read operation may take. If a read does
+    // not complete before the deadline, the FdReader fails with
+    // kDeadlineExceeded, letting the application fail over quickly, e.g. to a
+    // replica of the file. This guards against file systems like NFS or FUSE
+    // mounts where a single pread() can hang for a long time.
+    //
+    // pread() on a regular file ignores O_NONBLOCK, and poll() reports
+    // regular files as always readable, so the deadline is enforced by
+    // performing the pread() on an I/O thread and waiting for it with a
+    // timeout. A read which exceeded the deadline is abandoned; it continues
+    // on the I/O thread into a private buffer until the operating system
+    // completes it.
+    //
+    // Default: absl::InfiniteDuration() (reads are not bounded).
+    Options& set_deadline(absl::Duration deadline) & {
+      deadline_ = deadline;
+      return *this;
+    }
+    Options&& set_deadline(absl::Duration deadline) && {
+      return std::move(set_deadline(deadline));
+    }
+
+    // If not nullptr, receives instrumentation events: read syscalls with
+    // their byte counts and time spent waiting for the file. With
+    // set_background_read_ahead(true) events can come from a thread pool
+    // thread, hence the StatsSink must be thread-safe.
+    //
+    // The StatsSink is not owned and must not be destroyed until the FdReader
+    // is closed or no longer used.
+    //
+    // Default: nullptr
+    Options& set_stats_sink(StatsSink* stats_sink) & {
+      stats_sink_ = stats_sink;
+      return *this;
+    }
+    Options&& set_stats_sink(StatsSink* stats_sink) && {
+      return std::move(set_stats_sink(stats_sink));
+    }
+
    private:
     template <typename Src>
     friend class FdReader;
 
     absl::optional<Position> initial_pos_;
     size_t buffer_size_ = kDefaultBufferSize;
+    bool adaptive_buffer_sizing_ = false;
+    bool background_read_ahead_ = false;
+    bool fadvise_sequential_ = false;
+    bool fadvise_willneed_ = false;
+    bool drop_cache_behind_ = false;
+    absl::Duration deadline_ = absl::InfiniteDuration();
+    StatsSink* stats_sink_ = nullptr;
   };
 
   bool SupportsRandomAccess() const override { return true; }
@@ -120,18 +244,52 @@ class FdReaderBase : public internal::FdReaderCommon {
  protected:
   FdReaderBase() noexcept {}
 
-  explicit FdReaderBase(size_t buffer_size, bool sync_pos)
-      : FdReaderCommon(buffer_size), sync_pos_(sync_pos) {}
+  explicit FdReaderBase(size_t buffer_size, bool sync_pos,
+                        internal::ThreadPool* read_ahead_pool = nullptr)
+      : FdReaderCommon(buffer_size, read_ahead_pool), sync_pos_(sync_pos) {}
 
   FdReaderBase(FdReaderBase&& that) noexcept;
   FdReaderBase& operator=(FdReaderBase&& that) noexcept;
 
   void Initialize(absl::optional<Position> initial_pos, int src);
+  // Issues the posix_fadvise() advice requested in options. A no-op where
+  // posix_fadvise() is not supported.
+  void InitializeFadvise(int src, bool fadvise_sequential,
+                         bool fadvise_willneed, bool drop_cache_behind);
   void SyncPos(int src);
   bool ReadInternal(char* dest, size_t min_length, size_t max_length) override;
+  size_t ReadAheadInternal(char* dest, size_t max_length,
+                           Position pos) override;
+  // Copies data with copy_file_range() if dest turns out to be an FdWriter,
+  // bypassing buffers of both objects.
+  using BufferedReader::CopyToSlow;
+  bool CopyToSlow(Writer* dest, Position length) override;
   bool SeekSlow(Position new_pos) override;
+  // Advises the operating system that the hinted range will be needed soon.
+  // A no-op where posix_fadvise() is not supported.
+  void ReadHintSlow(size_t length) override;
 
   bool sync_pos_ = false;
+  // See Options::set_deadline().
+  absl::Duration deadline_ = absl::InfiniteDuration();
+  // If not nullptr, receives instrumentation events for read syscalls.
+  StatsSink* stats_sink_ = nullptr;
+
+ private:
+  // Implementation of ReadInternal() if a deadline is set: performs pread()
+  // on an I/O thread and waits for its completion with a timeout.
+  bool ReadInternalWithDeadline(int src, char* dest, size_t min_length,
+                                size_t max_length);
+
+  // Drops data well behind limit_pos_ from the operating system cache, if
+  // enough of them have accumulated since the last call.
+  void DropCacheBehind(int src);
+
+  // True if data behind the reading position are dropped from the operating
+  // system cache as reading progresses.
+  bool drop_cache_behind_ = false;
+  // Position up to which the cache was dropped.
+  Position cache_dropped_pos_ = 0;
 
   // Invariant: limit_pos_ <= numeric_limits<off_t>::max()
 };
@@ -192,6 +350,10 @@ class FdStreamReaderBase : public internal::FdReaderCommon {
   FdStreamReaderBase& operator=(FdStreamReaderBase&& that) noexcept;
 
   bool ReadInternal(char* dest, size_t min_length, size_t max_length) override;
+  // Moves data with splice() if dest turns out to be an FdStreamWriter and
+  // one of the fds is a pipe, bypassing buffers of both objects.
+  using BufferedReader::CopyToSlow;
+  bool CopyToSlow(Writer* dest, Position length) override;
 };
 
 // Template parameter invariant part of FdMMapReader.
@@ -199,6 +361,17 @@ class FdMMapReaderBase : public ChainReader<Chain> {
  public:
   class Options {
    public:
+    // Expected access pattern of the mapped file, passed to madvise().
+    enum class AccessPattern {
+      // No advice (the default).
+      kNormal,
+      // MADV_SEQUENTIAL: typically increases readahead and drops read pages
+      // from memory sooner.
+      kSequential,
+      // MADV_RANDOM: typically disables readahead.
+      kRandom,
+    };
+
     Options() noexcept {}
 
     // If nullopt, FdMMapReader will initially get the current fd position, and
@@ -217,11 +390,74 @@ class FdMMapReaderBase : public ChainReader<Chain> {
       return std::move(set_initial_pos(initial_pos));
     }
 
+    // Advises the operating system about the expected access pattern of the
+    // mapping.
+    //
+    // Ignored where madvise() is not supported.
+    //
+    // Default: AccessPattern::kNormal
+    Options& set_access_pattern(AccessPattern access_pattern) & {
+      access_pattern_ = access_pattern;
+      return *this;
+    }
+    Options&& set_access_pattern(AccessPattern access_pattern) && {
+      return std::move(set_access_pattern(access_pattern));
+    }
+
+    // If true, advises the operating system that the whole mapping will be
+    // needed soon (MADV_WILLNEED), which typically starts readahead
+    // immediately.
+    //
+    // Ignored where madvise() is not supported.
+    //
+    // Default: false
+    Options& set_madvise_willneed(bool madvise_willneed) & {
+      madvise_willneed_ = madvise_willneed;
+      return *this;
+    }
+    Options&& set_madvise_willneed(bool madvise_willneed) && {
+      return std::move(set_madvise_willneed(madvise_willneed));
+    }
+
+    // If true, advises the operating system to back the mapping with
+    // transparent huge pages (MADV_HUGEPAGE) where supported, reducing TLB
+    // misses when scanning large files.
+    //
+    // Default: false
+    Options& set_huge_pages(bool huge_pages) & {
+      huge_pages_ = huge_pages;
+      return *this;
+    }
+    Options&& set_huge_pages(bool huge_pages) && {
+      return std::move(set_huge_pages(huge_pages));
+    }
+
+    // If true, advises the operating system that mapped regions behind the
+    // reading position are no longer needed (MADV_DONTNEED), dropping them
+    // from resident memory as reading progresses. This keeps a linear decode
+    // of a file much larger than memory from thrashing resident memory, at
+    // the cost of rereading from the file system after seeking backwards.
+    //
+    // Ignored where madvise() is not supported.
+    //
+    // Default: false
+    Options& set_drop_cache_behind(bool drop_cache_behind) & {
+      drop_cache_behind_ = drop_cache_behind;
+      return *this;
+    }
+    Options&& set_drop_cache_behind(bool drop_cache_behind) && {
+      return std::move(set_drop_cache_behind(drop_cache_behind));
+    }
+
    private:
     template <typename Src>
     friend class FdMMapReader;
 
     absl::optional<Position> initial_pos_;
+    AccessPattern access_pattern_ = AccessPattern::kNormal;
+    bool madvise_willneed_ = false;
+    bool huge_pages_ = false;
+    bool drop_cache_behind_ = false;
   };
 
   // Returns the fd being read from. If the fd is owned then changed to -1 by
@@ -246,10 +482,34 @@ class FdMMapReaderBase : public ChainReader<Chain> {
   int OpenFd(absl::string_view filename, int flags);
   ABSL_ATTRIBUTE_COLD bool FailOperation(absl::string_view operation);
   void Initialize(absl::optional<Position> initial_pos, int src);
+  // Issues the madvise() advice requested in options for the mapping made by
+  // Initialize(). A no-op where madvise() is not supported.
+  void InitializeMadvise(Options::AccessPattern access_pattern,
+                         bool madvise_willneed, bool huge_pages,
+                         bool drop_cache_behind);
   void SyncPos(int src);
+  using ChainReader::ReadSlow;
+  bool ReadSlow(Chain* dest, size_t length) override;
+  using ChainReader::CopyToSlow;
+  bool CopyToSlow(Writer* dest, Position length) override;
+  bool CopyToSlow(BackwardWriter* dest, size_t length) override;
 
   std::string filename_;
   bool sync_pos_ = false;
+
+ private:
+  // Drops mapped regions well behind pos() from resident memory, if enough of
+  // them have accumulated since the last call.
+  void DropCacheBehind();
+
+  // The mapping made by Initialize(), for madvise().
+  void* mapped_data_ = nullptr;
+  size_t mapped_size_ = 0;
+  // True if mapped regions behind the reading position are dropped from
+  // resident memory as reading progresses.
+  bool drop_cache_behind_ = false;
+  // Position up to which the mapping was dropped.
+  Position cache_dropped_pos_ = 0;
 };
 
 // A Reader which reads from a file descriptor. It supports random access.
@@ -262,7 +522,10 @@ class FdMMapReaderBase : public ChainReader<Chain> {
 //
 // The Src template parameter specifies the type of the object providing and
 // possibly owning the fd being read from. Src must support
-// Dependency<int, Src>, e.g. OwnedFd (owned, default), int (not owned).
+// Dependency<int, Src>, e.g. OwnedFd (owned, default), int (not owned),
+// SharedFd (ownership shared with other readers of the same file; together
+// with Options::set_initial_pos() this lets many FdReaders read concurrently
+// from one file opened once).
 //
 // The fd must not be closed until the FdReader is closed or no longer used.
 template <typename Src = OwnedFd>
@@ -288,6 +551,8 @@ class FdReader : public FdReaderBase {
   FdReader(FdReader&& that) noexcept;
   FdReader& operator=(FdReader&& that) noexcept;
 
+  ~FdReader();
+
   // Returns the object providing and possibly owning the fd being read from. If
   // the fd is owned then changed to -1 by Close(), otherwise unchanged.
   Src& src() { return src_.manager(); }
@@ -369,7 +634,8 @@ class FdStreamReader : public FdStreamReaderBase {
 //
 // The Src template parameter specifies the type of the object providing and
 // possibly owning the fd being read from. Src must support
-// Dependency<int, Src>, e.g. OwnedFd (owned, default), int (not owned).
+// Dependency<int, Src>, e.g. OwnedFd (owned, default), int (not owned),
+// SharedFd (ownership shared with other readers of the same file).
 //
 // The fd must not be closed until the FdMMapReader is closed or no longer used.
 // File contents must not be changed while data read from the file is accessed
@@ -416,8 +682,9 @@ class FdMMapReader : public FdMMapReaderBase {
 
 namespace internal {
 
-inline FdReaderCommon::FdReaderCommon(size_t buffer_size)
-    : BufferedReader(buffer_size) {}
+inline FdReaderCommon::FdReaderCommon(size_t buffer_size,
+                                      internal::ThreadPool* read_ahead_pool)
+    : BufferedReader(buffer_size, 0, read_ahead_pool) {}
 
 inline FdReaderCommon::FdReaderCommon(FdReaderCommon&& that) noexcept
     : BufferedReader(std::move(that)),
@@ -434,11 +701,19 @@ inline FdReaderCommon& FdReaderCommon::operator=(
 
 inline FdReaderBase::FdReaderBase(FdReaderBase&& that) noexcept
     : FdReaderCommon(std::move(that)),
-      sync_pos_(absl::exchange(that.sync_pos_, false)) {}
+      sync_pos_(absl::exchange(that.sync_pos_, false)),
+      deadline_(absl::exchange(that.deadline_, absl::InfiniteDuration())),
+      stats_sink_(absl::exchange(that.stats_sink_, nullptr)),
+      drop_cache_behind_(absl::exchange(that.drop_cache_behind_, false)),
+      cache_dropped_pos_(absl::exchange(that.cache_dropped_pos_, 0)) {}
 
 inline FdReaderBase& FdReaderBase::operator=(FdReaderBase&& that) noexcept {
   FdReaderCommon::operator=(std::move(that));
   sync_pos_ = absl::exchange(that.sync_pos_, false);
+  deadline_ = absl::exchange(that.deadline_, absl::InfiniteDuration());
+  stats_sink_ = absl::exchange(that.stats_sink_, nullptr);
+  drop_cache_behind_ = absl::exchange(that.drop_cache_behind_, false);
+  cache_dropped_pos_ = absl::exchange(that.cache_dropped_pos_, 0);
   return *this;
 }
 
@@ -455,30 +730,49 @@ inline FdStreamReaderBase& FdStreamReaderBase::operator=(
 inline FdMMapReaderBase::FdMMapReaderBase(FdMMapReaderBase&& that) noexcept
     : ChainReader(std::move(that)),
       filename_(absl::exchange(that.filename_, std::string())),
-      sync_pos_(absl::exchange(that.sync_pos_, false)) {}
+      sync_pos_(absl::exchange(that.sync_pos_, false)),
+      mapped_data_(absl::exchange(that.mapped_data_, nullptr)),
+      mapped_size_(absl::exchange(that.mapped_size_, 0)),
+      drop_cache_behind_(absl::exchange(that.drop_cache_behind_, false)),
+      cache_dropped_pos_(absl::exchange(that.cache_dropped_pos_, 0)) {}
 
 inline FdMMapReaderBase& FdMMapReaderBase::operator=(
     FdMMapReaderBase&& that) noexcept {
   ChainReader::operator=(std::move(that));
   filename_ = absl::exchange(that.filename_, std::string());
   sync_pos_ = absl::exchange(that.sync_pos_, false);
+  mapped_data_ = absl::exchange(that.mapped_data_, nullptr);
+  mapped_size_ = absl::exchange(that.mapped_size_, 0);
+  drop_cache_behind_ = absl::exchange(that.drop_cache_behind_, false);
+  cache_dropped_pos_ = absl::exchange(that.cache_dropped_pos_, 0);
   return *this;
 }
 
 template <typename Src>
 FdReader<Src>::FdReader(type_identity_t<Src> src, Options options)
-    : FdReaderBase(options.buffer_size_, !options.initial_pos_.has_value()),
+    : FdReaderBase(options.buffer_size_, !options.initial_pos_.has_value(),
+                   options.background_read_ahead_
+                       ? &internal::ThreadPool::global_io()
+                       : nullptr),
       src_(std::move(src)) {
   RIEGELI_ASSERT_GE(src_.get(), 0)
       << "Failed precondition of FdReader<Src>::FdReader(Src): "
          "negative file descriptor";
   SetFilename(src_.get());
+  set_adaptive_buffer_sizing(options.adaptive_buffer_sizing_);
+  deadline_ = options.deadline_;
+  stats_sink_ = options.stats_sink_;
   Initialize(options.initial_pos_, src_.get());
+  InitializeFadvise(src_.get(), options.fadvise_sequential_,
+                    options.fadvise_willneed_, options.drop_cache_behind_);
 }
 
 template <typename Src>
 FdReader<Src>::FdReader(absl::string_view filename, int flags, Options options)
-    : FdReaderBase(options.buffer_size_, !options.initial_pos_.has_value()) {
+    : FdReaderBase(options.buffer_size_, !options.initial_pos_.has_value(),
+                   options.background_read_ahead_
+                       ? &internal::ThreadPool::global_io()
+                       : nullptr) {
   RIEGELI_ASSERT((flags & O_ACCMODE) == O_RDONLY ||
                  (flags & O_ACCMODE) == O_RDWR)
       << "Failed precondition of FdReader::FdReader(string_view): "
@@ -486,7 +780,12 @@ FdReader<Src>::FdReader(absl::string_view filename, int flags, Options options)
   const int src = OpenFd(filename, flags);
   if (ABSL_PREDICT_FALSE(src < 0)) return;
   src_ = Dependency<int, Src>(Src(src));
+  set_adaptive_buffer_sizing(options.adaptive_buffer_sizing_);
+  deadline_ = options.deadline_;
+  stats_sink_ = options.stats_sink_;
   Initialize(options.initial_pos_, src_.get());
+  InitializeFadvise(src_.get(), options.fadvise_sequential_,
+                    options.fadvise_willneed_, options.drop_cache_behind_);
 }
 
 template <typename Src>
@@ -500,6 +799,14 @@ inline FdReader<Src>& FdReader<Src>::operator=(FdReader&& that) noexcept {
   return *this;
 }
 
+template <typename Src>
+FdReader<Src>::~FdReader() {
+  // A background read-ahead task calls src_fd() which needs src_, hence it
+  // must be stopped before src_ is destroyed, and not only in Done() which
+  // might not have been called.
+  SyncReadAhead();
+}
+
 template <typename Src>
 void FdReader<Src>::Done() {
   if (ABSL_PREDICT_TRUE(healthy())) SyncPos(src_.get());
@@ -574,6 +881,8 @@ FdMMapReader<Src>::FdMMapReader(type_identity_t<Src> src, Options options)
          "negative file descriptor";
   SetFilename(src_.get());
   Initialize(options.initial_pos_, src_.get());
+  InitializeMadvise(options.access_pattern_, options.madvise_willneed_,
+                    options.huge_pages_, options.drop_cache_behind_);
 }
 
 template <typename Src>
@@ -588,6 +897,8 @@ FdMMapReader<Src>::FdMMapReader(absl::string_view filename, int flags,
   if (ABSL_PREDICT_FALSE(src < 0)) return;
   src_ = Dependency<int, Src>(Src(src));
   Initialize(options.initial_pos_, src_.get());
+  InitializeMadvise(options.access_pattern_, options.madvise_willneed_,
+                    options.huge_pages_, options.drop_cache_behind_);
 }
 
 template <typename Src>
@@ -618,10 +929,12 @@ void FdMMapReader<Src>::Done() {
 
 extern template class FdReader<OwnedFd>;
 extern template class FdReader<int>;
+extern template class FdReader<SharedFd>;
 extern template class FdStreamReader<OwnedFd>;
 extern template class FdStreamReader<int>;
 extern template class FdMMapReader<OwnedFd>;
 extern template class FdMMapReader<int>;
+extern template class FdMMapReader<SharedFd>;
 
 }  // namespace riegeli
 
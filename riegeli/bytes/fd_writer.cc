@@ -12,6 +12,11 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+// Make pwritev(), splice(), and syscall() available.
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 // Make pwrite() and ftruncate() available.
 #if !defined(_XOPEN_SOURCE) || _XOPEN_SOURCE < 500
 #undef _XOPEN_SOURCE
@@ -25,25 +30,105 @@
 #include "riegeli/bytes/fd_writer.h"
 
 #include <fcntl.h>
+#include <limits.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include <cerrno>
+#include <functional>
 #include <limits>
+#include <memory>
 #include <string>
+#include <utility>
 
 #include "absl/base/optimization.h"
+#include "absl/memory/memory.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "absl/utility/utility.h"
 #include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
 #include "riegeli/base/errno_mapping.h"
+#include "riegeli/base/object.h"
+#include "riegeli/base/parallelism.h"
+#include "riegeli/base/stats_sink.h"
 #include "riegeli/bytes/buffered_writer.h"
 #include "riegeli/bytes/fd_dependency.h"
 
 namespace riegeli {
 
+namespace {
+
+// Limits the number of iovec entries passed to one writev() call.
+#ifdef IOV_MAX
+constexpr int kMaxIovecs = IOV_MAX < 64 ? IOV_MAX : 64;
+#else
+constexpr int kMaxIovecs = 16;
+#endif
+
+// Fills iov with fragments of blocks from iter, with the first
+// first_fragment_offset bytes of the first block skipped, up to kMaxIovecs
+// entries. Returns the number of entries filled.
+inline int FillIovecs(Chain::BlockIterator iter, Chain::BlockIterator end,
+                      size_t first_fragment_offset, struct iovec* iov) {
+  int num_iovecs = 0;
+  size_t total_length = 0;
+  for (; iter != end && num_iovecs < kMaxIovecs; ++iter) {
+    absl::string_view fragment = *iter;
+    if (num_iovecs == 0) fragment.remove_prefix(first_fragment_offset);
+    size_t fragment_size = fragment.size();
+    if (ABSL_PREDICT_FALSE(fragment_size >
+                           size_t{std::numeric_limits<ssize_t>::max()} -
+                               total_length)) {
+      // Limit the total length of one call to ssize_t range.
+      fragment_size =
+          size_t{std::numeric_limits<ssize_t>::max()} - total_length;
+      if (fragment_size == 0) break;
+    }
+    iov[num_iovecs].iov_base = const_cast<char*>(fragment.data());
+    iov[num_iovecs].iov_len = fragment_size;
+    total_length += fragment_size;
+    ++num_iovecs;
+  }
+  return num_iovecs;
+}
+
+#ifdef O_DIRECT
+// Returns true if a write of src at pos satisfies O_DIRECT alignment.
+inline bool DirectAligned(absl::string_view src, Position pos) {
+  return reinterpret_cast<uintptr_t>(src.data()) %
+                 internal::kDirectBlockSize ==
+             0 &&
+         pos % internal::kDirectBlockSize == 0 &&
+         src.size() % internal::kDirectBlockSize == 0;
+}
+#endif
+
+// Advances iter and first_fragment_offset over length_written bytes.
+inline void AdvanceFragments(size_t length_written, Chain::BlockIterator* iter,
+                             size_t* first_fragment_offset) {
+  while (length_written > 0) {
+    const size_t fragment_remaining = (*iter)->size() - *first_fragment_offset;
+    if (length_written < fragment_remaining) {
+      *first_fragment_offset += length_written;
+      return;
+    }
+    length_written -= fragment_remaining;
+    ++*iter;
+    *first_fragment_offset = 0;
+  }
+}
+
+}  // namespace
+
 namespace internal {
 
 void FdWriterCommon::SetFilename(int dest) {
@@ -140,12 +225,27 @@ bool FdWriterBase::WriteInternal(absl::string_view src) {
                              start_pos_)) {
     return FailOverflow();
   }
+#ifdef O_DIRECT
+  if (ABSL_PREDICT_FALSE(direct_ && !DirectAligned(src, start_pos_))) {
+    return WriteUnaligned(src);
+  }
+#endif
+  if (ABSL_PREDICT_FALSE(preallocate_ > 0)) {
+    PreallocateAhead(dest, start_pos_ + src.size());
+  }
   do {
   again:
+    absl::Time time_before;
+    if (ABSL_PREDICT_FALSE(stats_sink_ != nullptr)) time_before = absl::Now();
     const ssize_t length_written = pwrite(
         dest, src.data(),
         UnsignedMin(src.size(), size_t{std::numeric_limits<ssize_t>::max()}),
         IntCast<off_t>(start_pos_));
+    if (ABSL_PREDICT_FALSE(stats_sink_ != nullptr)) {
+      stats_sink_->OnPushStall(absl::Now() - time_before);
+      stats_sink_->OnWriteSyscall(
+          length_written > 0 ? IntCast<size_t>(length_written) : size_t{0});
+    }
     if (ABSL_PREDICT_FALSE(length_written < 0)) {
       if (errno == EINTR) goto again;
       return FailOperation("pwrite()");
@@ -159,10 +259,255 @@ bool FdWriterBase::WriteInternal(absl::string_view src) {
   return true;
 }
 
+#ifdef O_DIRECT
+bool FdWriterBase::WriteUnaligned(absl::string_view src) {
+  const int dest = dest_fd();
+  const int flags = fcntl(dest, F_GETFL);
+  if (ABSL_PREDICT_FALSE(flags < 0)) return FailOperation("fcntl()");
+  if (ABSL_PREDICT_FALSE(fcntl(dest, F_SETFL, flags & ~O_DIRECT) < 0)) {
+    return FailOperation("fcntl()");
+  }
+  direct_ = false;
+  const bool ok = WriteInternal(src);
+  direct_ = true;
+  if (ABSL_PREDICT_FALSE(fcntl(dest, F_SETFL, flags) < 0)) {
+    return ABSL_PREDICT_TRUE(ok) ? FailOperation("fcntl()") : false;
+  }
+  return ok;
+}
+#endif
+
+bool FdWriterBase::WriteInternal(const Chain& src) {
+#ifndef __linux__
+  // pwritev() is not available everywhere; write the blocks separately.
+  return BufferedWriter::WriteInternal(src);
+#else
+  RIEGELI_ASSERT(!src.empty())
+      << "Failed precondition of BufferedWriter::WriteInternal(Chain): "
+         "nothing to write";
+  RIEGELI_ASSERT(healthy())
+      << "Failed precondition of BufferedWriter::WriteInternal(Chain): "
+      << status();
+  RIEGELI_ASSERT_EQ(written_to_buffer(), 0u)
+      << "Failed precondition of BufferedWriter::WriteInternal(Chain): "
+         "buffer not empty";
+#ifdef O_DIRECT
+  if (ABSL_PREDICT_FALSE(direct_)) {
+    // Blocks of a Chain do not satisfy O_DIRECT alignment; write them
+    // separately so that WriteInternal(string_view) handles alignment.
+    return BufferedWriter::WriteInternal(src);
+  }
+#endif
+  const int dest = dest_fd();
+  if (ABSL_PREDICT_FALSE(src.size() >
+                         Position{std::numeric_limits<off_t>::max()} -
+                             start_pos_)) {
+    return FailOverflow();
+  }
+  if (ABSL_PREDICT_FALSE(preallocate_ > 0)) {
+    PreallocateAhead(dest, start_pos_ + src.size());
+  }
+  const Chain::Blocks blocks = src.blocks();
+  Chain::BlockIterator iter = blocks.cbegin();
+  size_t first_fragment_offset = 0;
+  struct iovec iov[kMaxIovecs];
+  while (iter != blocks.cend()) {
+    const int num_iovecs =
+        FillIovecs(iter, blocks.cend(), first_fragment_offset, iov);
+  again:
+    absl::Time time_before;
+    if (ABSL_PREDICT_FALSE(stats_sink_ != nullptr)) time_before = absl::Now();
+    const ssize_t length_written =
+        pwritev(dest, iov, num_iovecs, IntCast<off_t>(start_pos_));
+    if (ABSL_PREDICT_FALSE(stats_sink_ != nullptr)) {
+      stats_sink_->OnPushStall(absl::Now() - time_before);
+      stats_sink_->OnWriteSyscall(
+          length_written > 0 ? IntCast<size_t>(length_written) : size_t{0});
+    }
+    if (ABSL_PREDICT_FALSE(length_written < 0)) {
+      if (errno == EINTR) goto again;
+      return FailOperation("pwritev()");
+    }
+    RIEGELI_ASSERT_GT(length_written, 0) << "pwritev() returned 0";
+    start_pos_ += IntCast<size_t>(length_written);
+    AdvanceFragments(IntCast<size_t>(length_written), &iter,
+                     &first_fragment_offset);
+  }
+  return true;
+#endif
+}
+
+bool FdWriterBase::WriteZerosSlow(Position length) {
+  RIEGELI_ASSERT_GT(length, available())
+      << "Failed precondition of Writer::WriteZerosSlow(): "
+         "length too small, use WriteZeros() instead";
+#ifdef FALLOC_FL_PUNCH_HOLE
+  // Punching a hole pays off only if the filesystem can deallocate whole
+  // blocks; kDirectBlockSize covers common block sizes.
+  if (ABSL_PREDICT_FALSE(sparse_) && length >= internal::kDirectBlockSize) {
+    if (ABSL_PREDICT_FALSE(!PushInternal())) return false;
+    if (ABSL_PREDICT_FALSE(length >
+                           Position{std::numeric_limits<off_t>::max()} -
+                               start_pos_)) {
+      return FailOverflow();
+    }
+    const int dest = dest_fd();
+    struct stat stat_info;
+    if (ABSL_PREDICT_FALSE(fstat(dest, &stat_info) < 0)) {
+      return FailOperation("fstat()");
+    }
+    const Position new_pos = start_pos_ + length;
+    if (start_pos_ < IntCast<Position>(stat_info.st_size)) {
+      // Deallocate previously written data inside the hole; fallocate()
+      // zeroes partial filesystem blocks at the ends of the hole.
+      const Position hole_end =
+          UnsignedMin(new_pos, IntCast<Position>(stat_info.st_size));
+      while (ABSL_PREDICT_FALSE(
+          fallocate(dest, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                    IntCast<off_t>(start_pos_),
+                    IntCast<off_t>(hole_end - start_pos_)) < 0)) {
+        if (errno == EINTR) continue;
+        if (errno == EOPNOTSUPP) {
+          // The filesystem does not support punching holes; write physical
+          // zero bytes.
+          return BufferedWriter::WriteZerosSlow(length);
+        }
+        return FailOperation("fallocate()");
+      }
+    }
+    if (new_pos > IntCast<Position>(stat_info.st_size)) {
+      // Extending the file size makes the part of the hole past the previous
+      // end of the file read as zeros without storing them.
+      while (ABSL_PREDICT_FALSE(ftruncate(dest, IntCast<off_t>(new_pos)) <
+                                0)) {
+        if (errno == EINTR) continue;
+        return FailOperation("ftruncate()");
+      }
+    }
+    start_pos_ = new_pos;
+    return true;
+  }
+#endif
+  return BufferedWriter::WriteZerosSlow(length);
+}
+
+void FdWriterBase::PreallocateAhead(int dest, Position write_end) {
+  RIEGELI_ASSERT_GT(preallocate_, 0u)
+      << "Failed precondition of FdWriterBase::PreallocateAhead(): "
+         "preallocation disabled";
+#ifdef FALLOC_FL_KEEP_SIZE
+  if (write_end <= preallocated_end_) return;
+  // Extend the preallocation to at least one full increment past the write,
+  // so that fallocate() is called once per preallocate_ bytes written, not
+  // once per buffer. FALLOC_FL_KEEP_SIZE allocates disk space without
+  // extending the file size.
+  const Position begin = UnsignedMax(preallocated_end_, start_pos_);
+  const Position end =
+      UnsignedMin(UnsignedMax(write_end, SaturatingAdd(begin, preallocate_)),
+                  Position{std::numeric_limits<off_t>::max()});
+  if (ABSL_PREDICT_FALSE(end <= begin)) return;
+  while (ABSL_PREDICT_FALSE(fallocate(dest, FALLOC_FL_KEEP_SIZE,
+                                      IntCast<off_t>(begin),
+                                      IntCast<off_t>(end - begin)) < 0)) {
+    if (errno == EINTR) continue;
+    // The filesystem does not support preallocation, or disk space ran out;
+    // continue without preallocation, letting pwrite() report a failure to
+    // actually write.
+    preallocate_ = 0;
+    return;
+  }
+  preallocated_end_ = end;
+#endif
+}
+
+void FdWriterBase::TrimPreallocation(int dest) {
+#ifdef FALLOC_FL_KEEP_SIZE
+  if (ABSL_PREDICT_TRUE(preallocated_end_ == 0)) return;
+  struct stat stat_info;
+  if (ABSL_PREDICT_TRUE(fstat(dest, &stat_info) >= 0) &&
+      preallocated_end_ > IntCast<Position>(stat_info.st_size)) {
+    // ftruncate() to the current size releases disk space allocated past the
+    // end of the file. Trimming is best effort; failures are ignored.
+    int result;
+    do {
+      result = ftruncate(dest, stat_info.st_size);
+    } while (result < 0 && errno == EINTR);
+  }
+  preallocated_end_ = 0;
+#endif
+}
+
+Position FdWriterBase::CopyFromFd(int src, Position src_pos, Position length) {
+  if (ABSL_PREDICT_FALSE(!PushInternal())) return 0;
+  RIEGELI_ASSERT_EQ(written_to_buffer(), 0u)
+      << "BufferedWriter::PushInternal() did not empty the buffer";
+#if !defined(__linux__) || !defined(__NR_copy_file_range)
+  // copy_file_range() is not available; the caller copies data through the
+  // buffer instead.
+  return 0;
+#else
+#ifdef O_DIRECT
+  if (ABSL_PREDICT_FALSE(direct_)) {
+    // copy_file_range() does not handle O_DIRECT alignment of partial blocks;
+    // the caller copies data through the buffer instead, which lets
+    // WriteInternal() handle alignment.
+    return 0;
+  }
+#endif
+  if (ABSL_PREDICT_FALSE(length > Position{std::numeric_limits<off_t>::max()} -
+                                      start_pos_ ||
+                         length > Position{std::numeric_limits<off_t>::max()} -
+                                      src_pos)) {
+    FailOverflow();
+    return 0;
+  }
+  const int dest = dest_fd();
+  if (ABSL_PREDICT_FALSE(preallocate_ > 0)) {
+    PreallocateAhead(dest, start_pos_ + length);
+  }
+  Position copied = 0;
+  while (copied < length) {
+    off_t off_in = IntCast<off_t>(src_pos + copied);
+    off_t off_out = IntCast<off_t>(start_pos_);
+    absl::Time time_before;
+    if (ABSL_PREDICT_FALSE(stats_sink_ != nullptr)) time_before = absl::Now();
+    const ssize_t length_copied =
+        syscall(__NR_copy_file_range, src, &off_in, dest, &off_out,
+                UnsignedMin(length - copied,
+                            Position{std::numeric_limits<ssize_t>::max()}),
+                0u);
+    if (ABSL_PREDICT_FALSE(stats_sink_ != nullptr)) {
+      stats_sink_->OnPushStall(absl::Now() - time_before);
+      stats_sink_->OnWriteSyscall(
+          length_copied > 0 ? IntCast<size_t>(length_copied) : size_t{0});
+    }
+    if (ABSL_PREDICT_FALSE(length_copied < 0)) {
+      if (errno == EINTR) continue;
+      if (errno == ENOSYS || errno == EINVAL || errno == EXDEV ||
+          errno == EBADF || errno == EOPNOTSUPP || errno == EPERM ||
+          errno == ETXTBSY) {
+        // The kernel or the filesystems cannot copy between these fds; the
+        // caller copies the remaining data through the buffer instead.
+        break;
+      }
+      FailOperation("copy_file_range()");
+      break;
+    }
+    if (ABSL_PREDICT_FALSE(length_copied == 0)) break;  // The source file ends.
+    start_pos_ += IntCast<size_t>(length_copied);
+    copied += IntCast<size_t>(length_copied);
+  }
+  return copied;
+#endif
+}
+
+TypeId FdWriterBase::GetTypeId() const { return TypeId::For<FdWriterBase>(); }
+
 bool FdWriterBase::Flush(FlushType flush_type) {
   if (ABSL_PREDICT_FALSE(!PushInternal())) return false;
   const int dest = dest_fd();
   if (ABSL_PREDICT_FALSE(!SyncPos(dest))) return false;
+  if (ABSL_PREDICT_FALSE(!SyncFlush())) return false;
   switch (flush_type) {
     case FlushType::kFromObject:
     case FlushType::kFromProcess:
@@ -177,6 +522,76 @@ bool FdWriterBase::Flush(FlushType flush_type) {
       << "Unknown flush type: " << static_cast<int>(flush_type);
 }
 
+bool FdWriterBase::FlushAsync(std::function<void(bool ok)> done) {
+  if (ABSL_PREDICT_FALSE(!PushInternal())) return false;
+  const int dest = dest_fd();
+  if (ABSL_PREDICT_FALSE(!SyncPos(dest))) return false;
+  // At most one background sync is scheduled at a time; report a failure of
+  // the previous one.
+  if (ABSL_PREDICT_FALSE(!SyncFlush())) return false;
+  if (async_flush_ == nullptr) async_flush_ = absl::make_unique<AsyncFlush>();
+  {
+    absl::MutexLock lock(&async_flush_->mutex);
+    async_flush_->pending = true;
+  }
+  // dest is captured by value so that the task does not depend on the state
+  // of the FdWriterBase, only on the fd staying open, which SyncFlush() in
+  // Done() and in ~FdWriter ensures.
+  AsyncFlush* const async_flush = async_flush_.get();
+  // High priority so that the sync, which the caller may block on, runs
+  // before speculative tasks like read ahead waiting in the I/O pool.
+  internal::ThreadPool::global_io().Schedule(
+      [async_flush, dest, done] {
+        int error_code = 0;
+        if (ABSL_PREDICT_FALSE(fsync(dest) < 0)) error_code = errno;
+        {
+          absl::MutexLock lock(&async_flush->mutex);
+          async_flush->error_code = error_code;
+          async_flush->pending = false;
+        }
+        if (done != nullptr) done(error_code == 0);
+      },
+      internal::ThreadPool::Priority::kHigh);
+  return true;
+}
+
+bool FdWriterBase::SyncFlush() {
+  if (async_flush_ == nullptr) return true;
+  int error_code;
+  {
+    absl::MutexLock lock(&async_flush_->mutex);
+    async_flush_->mutex.Await(absl::Condition(
+        +[](bool* pending) { return !*pending; }, &async_flush_->pending));
+    error_code = absl::exchange(async_flush_->error_code, 0);
+  }
+  if (ABSL_PREDICT_FALSE(error_code != 0)) {
+    if (ABSL_PREDICT_FALSE(!healthy())) return false;
+    // FailOperation() reports the error from errno.
+    errno = error_code;
+    return FailOperation("fsync()");
+  }
+  return true;
+}
+
+std::unique_ptr<FdWriterBase::AsyncFlush> FdWriterBase::ReleaseAsyncFlush() {
+  if (async_flush_ != nullptr) {
+    // Unlike SyncFlush(), keep a failure recorded in error_code for the new
+    // owner instead of failing the moved-from object.
+    absl::MutexLock lock(&async_flush_->mutex);
+    async_flush_->mutex.Await(absl::Condition(
+        +[](bool* pending) { return !*pending; }, &async_flush_->pending));
+  }
+  return std::move(async_flush_);
+}
+
+void FdWriterBase::Done() {
+  SyncFlush();
+  if (ABSL_PREDICT_FALSE(preallocated_end_ > 0)) {
+    TrimPreallocation(dest_fd());
+  }
+  FdWriterCommon::Done();
+}
+
 bool FdWriterBase::SeekSlow(Position new_pos) {
   RIEGELI_ASSERT(new_pos < start_pos_ || new_pos > pos())
       << "Failed precondition of Writer::SeekSlow(): "
@@ -284,6 +699,86 @@ bool FdStreamWriterBase::WriteInternal(absl::string_view src) {
   return true;
 }
 
+bool FdStreamWriterBase::WriteInternal(const Chain& src) {
+  RIEGELI_ASSERT(!src.empty())
+      << "Failed precondition of BufferedWriter::WriteInternal(Chain): "
+         "nothing to write";
+  RIEGELI_ASSERT(healthy())
+      << "Failed precondition of BufferedWriter::WriteInternal(Chain): "
+      << status();
+  RIEGELI_ASSERT_EQ(written_to_buffer(), 0u)
+      << "Failed precondition of BufferedWriter::WriteInternal(Chain): "
+         "buffer not empty";
+  const int dest = dest_fd();
+  if (ABSL_PREDICT_FALSE(src.size() >
+                         std::numeric_limits<Position>::max() - start_pos_)) {
+    return FailOverflow();
+  }
+  const Chain::Blocks blocks = src.blocks();
+  Chain::BlockIterator iter = blocks.cbegin();
+  size_t first_fragment_offset = 0;
+  struct iovec iov[kMaxIovecs];
+  while (iter != blocks.cend()) {
+    const int num_iovecs =
+        FillIovecs(iter, blocks.cend(), first_fragment_offset, iov);
+  again:
+    const ssize_t length_written = writev(dest, iov, num_iovecs);
+    if (ABSL_PREDICT_FALSE(length_written < 0)) {
+      if (errno == EINTR) goto again;
+      return FailOperation("writev()");
+    }
+    RIEGELI_ASSERT_GT(length_written, 0) << "writev() returned 0";
+    start_pos_ += IntCast<size_t>(length_written);
+    AdvanceFragments(IntCast<size_t>(length_written), &iter,
+                     &first_fragment_offset);
+  }
+  return true;
+}
+
+Position FdStreamWriterBase::SpliceFromFd(int src, Position length) {
+  if (ABSL_PREDICT_FALSE(!PushInternal())) return 0;
+  RIEGELI_ASSERT_EQ(written_to_buffer(), 0u)
+      << "BufferedWriter::PushInternal() did not empty the buffer";
+#ifndef __linux__
+  // splice() is not available; the caller copies data through the buffer
+  // instead.
+  return 0;
+#else
+  if (ABSL_PREDICT_FALSE(length >
+                         std::numeric_limits<Position>::max() - start_pos_)) {
+    FailOverflow();
+    return 0;
+  }
+  const int dest = dest_fd();
+  Position spliced = 0;
+  while (spliced < length) {
+    const ssize_t length_spliced =
+        splice(src, nullptr, dest, nullptr,
+               UnsignedMin(length - spliced,
+                           Position{std::numeric_limits<ssize_t>::max()}),
+               SPLICE_F_MOVE);
+    if (ABSL_PREDICT_FALSE(length_spliced < 0)) {
+      if (errno == EINTR) continue;
+      if (errno == EINVAL || errno == ENOSYS) {
+        // Neither fd is a pipe, or the kernel does not support splice(); the
+        // caller copies the remaining data through the buffer instead.
+        break;
+      }
+      FailOperation("splice()");
+      break;
+    }
+    if (ABSL_PREDICT_FALSE(length_spliced == 0)) break;  // The source ends.
+    start_pos_ += IntCast<size_t>(length_spliced);
+    spliced += IntCast<size_t>(length_spliced);
+  }
+  return spliced;
+#endif
+}
+
+TypeId FdStreamWriterBase::GetTypeId() const {
+  return TypeId::For<FdStreamWriterBase>();
+}
+
 bool FdStreamWriterBase::Flush(FlushType flush_type) {
   if (ABSL_PREDICT_FALSE(!PushInternal())) return false;
   const int dest = dest_fd();
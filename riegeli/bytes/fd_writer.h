@@ -19,16 +19,23 @@
 #include <stddef.h>
 #include <sys/types.h>
 
+#include <functional>
+#include <memory>
 #include <string>
 #include <utility>
 
 #include "absl/base/attributes.h"
 #include "absl/base/optimization.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
 #include "absl/types/optional.h"
 #include "absl/utility/utility.h"
 #include "riegeli/base/base.h"
+#include "riegeli/base/buffer.h"
+#include "riegeli/base/chain.h"
 #include "riegeli/base/dependency.h"
+#include "riegeli/base/object.h"
+#include "riegeli/base/stats_sink.h"
 #include "riegeli/bytes/buffered_writer.h"
 #include "riegeli/bytes/fd_dependency.h"
 
@@ -36,6 +43,11 @@ namespace riegeli {
 
 namespace internal {
 
+// O_DIRECT requires the buffer address, the file offset, and the length of
+// each write to be multiples of the block size. 4096 covers common logical
+// block sizes.
+constexpr size_t kDirectBlockSize = 4096;
+
 // Implementation shared between FdWriter and FdStreamWriter.
 class FdWriterCommon : public BufferedWriter {
  public:
@@ -50,7 +62,9 @@ class FdWriterCommon : public BufferedWriter {
  protected:
   FdWriterCommon() noexcept {}
 
-  explicit FdWriterCommon(size_t buffer_size);
+  explicit FdWriterCommon(
+      size_t buffer_size,
+      Buffer::Allocation allocation = Buffer::Allocation::kDefault);
 
   FdWriterCommon(FdWriterCommon&& that) noexcept;
   FdWriterCommon& operator=(FdWriterCommon&& that) noexcept;
@@ -113,6 +127,117 @@ class FdWriterBase : public internal::FdWriterCommon {
       return std::move(set_buffer_size(buffer_size));
     }
 
+    // If true, the buffer starts small and grows geometrically, up to
+    // set_buffer_size(), as long as writing keeps filling it completely. This
+    // reduces memory usage when many files are open and only small amounts of
+    // data are written to them.
+    //
+    // Default: false
+    Options& set_adaptive_buffer_sizing(bool adaptive_buffer_sizing) & {
+      adaptive_buffer_sizing_ = adaptive_buffer_sizing;
+      return *this;
+    }
+    Options&& set_adaptive_buffer_sizing(bool adaptive_buffer_sizing) && {
+      return std::move(set_adaptive_buffer_sizing(adaptive_buffer_sizing));
+    }
+
+    // If true, a large buffer is allocated as hugepage-backed memory where
+    // supported, reducing TLB misses when the buffer is repeatedly scanned.
+    //
+    // Default: false
+    Options& set_huge_pages(bool huge_pages) & {
+      huge_pages_ = huge_pages;
+      return *this;
+    }
+    Options&& set_huge_pages(bool huge_pages) && {
+      return std::move(set_huge_pages(huge_pages));
+    }
+
+    // If true, the file is written with O_DIRECT, bypassing the operating
+    // system page cache. This helps bulk writes which would otherwise evict
+    // more useful cached data, at the cost of not benefiting from write
+    // caching.
+    //
+    // The buffer is page aligned, the buffer size is rounded up to a multiple
+    // of the block size (4096), and takes precedence over set_huge_pages().
+    // Data which do not satisfy O_DIRECT alignment, e.g. the final partial
+    // block or data written around the buffer, are written with O_DIRECT
+    // temporarily cleared; after Flush() of a partial block, subsequent
+    // writes continue at an unaligned position and are written that way too.
+    //
+    // For the constructor from filename, O_DIRECT is added to flags. For the
+    // constructor from fd, the fd should be opened with O_DIRECT.
+    //
+    // Ignored on platforms where O_DIRECT is not defined.
+    //
+    // Default: false
+    Options& set_direct(bool direct) & {
+      direct_ = direct;
+      return *this;
+    }
+    Options&& set_direct(bool direct) && {
+      return std::move(set_direct(direct));
+    }
+
+    // If true, WriteZeros() punches a hole in the file with
+    // fallocate(FALLOC_FL_PUNCH_HOLE) instead of writing physical zero bytes,
+    // when the run of zeros is large enough for the filesystem to deallocate
+    // whole blocks. The file reads back the same, but the zeros take no disk
+    // space. This helps when many padded files are written, e.g. with
+    // RecordWriterBase::Options::set_pad_to_block_boundary(true).
+    //
+    // If the filesystem does not support punching holes, physical zero bytes
+    // are written. Ignored on platforms where fallocate() is not available.
+    //
+    // Default: false
+    Options& set_sparse(bool sparse) & {
+      sparse_ = sparse;
+      return *this;
+    }
+    Options&& set_sparse(bool sparse) && {
+      return std::move(set_sparse(sparse));
+    }
+
+    // If > 0, disk space ahead of the write cursor is preallocated with
+    // fallocate() in increments of at least this many bytes, and unused
+    // preallocated space is trimmed on Close(). Preallocation lets the
+    // filesystem assign large contiguous extents to a file appended in small
+    // writes, reducing extent fragmentation and metadata updates, which
+    // improves write throughput and later sequential read speed.
+    //
+    // The preallocation does not extend the file size: the file appears to
+    // grow only as data are written.
+    //
+    // If the filesystem does not support preallocation, writing proceeds
+    // without it. Ignored on platforms where fallocate() is not available.
+    //
+    // Default: 0 (no preallocation)
+    Options& set_preallocate(Position preallocate) & {
+      preallocate_ = preallocate;
+      return *this;
+    }
+    Options&& set_preallocate(Position preallocate) && {
+      return std::move(set_preallocate(preallocate));
+    }
+
+    // If not nullptr, receives instrumentation events: write syscalls with
+    // their byte counts and time spent waiting for the file. The StatsSink
+    // must be thread-safe if the FdWriter is written from multiple threads,
+    // e.g. as the destination of a RecordWriter with
+    // RecordWriterBase::Options::set_parallelism().
+    //
+    // The StatsSink is not owned and must not be destroyed until the FdWriter
+    // is closed or no longer used.
+    //
+    // Default: nullptr
+    Options& set_stats_sink(StatsSink* stats_sink) & {
+      stats_sink_ = stats_sink;
+      return *this;
+    }
+    Options&& set_stats_sink(StatsSink* stats_sink) && {
+      return std::move(set_stats_sink(stats_sink));
+    }
+
    private:
     template <typename Dest>
     friend class FdWriter;
@@ -120,9 +245,46 @@ class FdWriterBase : public internal::FdWriterCommon {
     mode_t permissions_ = 0666;
     absl::optional<Position> initial_pos_;
     size_t buffer_size_ = kDefaultBufferSize;
+    bool adaptive_buffer_sizing_ = false;
+    bool huge_pages_ = false;
+    bool direct_ = false;
+    bool sparse_ = false;
+    Position preallocate_ = 0;
+    StatsSink* stats_sink_ = nullptr;
   };
 
   bool Flush(FlushType flush_type) override;
+
+  // Like Flush(FlushType::kFromMachine), but hands the fsync() off to a
+  // thread pool thread, so that writing can continue while previously written
+  // data are being synced. Buffered data are written to the file before the
+  // sync is scheduled.
+  //
+  // If done != nullptr, done is called from the background thread with true
+  // if syncing succeeded, or false if it failed. A failure is also reported
+  // by the next Flush(), FlushAsync(), or Close(), each of which waits for a
+  // previously scheduled sync to complete first.
+  //
+  // Returns false if writing buffered data failed; done is not called then.
+  bool FlushAsync(std::function<void(bool ok)> done = nullptr);
+
+  // Writes length bytes to the FdWriter, copied by the kernel with
+  // copy_file_range() from fd src starting at position src_pos, without
+  // moving the data through userspace buffers. Buffered data are written to
+  // the file first.
+  //
+  // Returns the number of bytes copied. This can be less than length if the
+  // source file ends, if the operating system or the filesystems do not
+  // support copy_file_range() between these fds, or if the FdWriterBase
+  // failed; unless the FdWriterBase failed, the caller should write the
+  // remaining data in another way.
+  //
+  // This is used by FdReaderBase::CopyTo(Writer*) when the destination turns
+  // out to be an FdWriter.
+  Position CopyFromFd(int src, Position src_pos, Position length);
+
+  TypeId GetTypeId() const override;
+
   bool SupportsRandomAccess() const override { return true; }
   bool Size(Position* size) override;
   bool SupportsTruncate() const override { return true; }
@@ -131,19 +293,74 @@ class FdWriterBase : public internal::FdWriterCommon {
  protected:
   FdWriterBase() noexcept {}
 
-  explicit FdWriterBase(size_t buffer_size, bool sync_pos)
-      : FdWriterCommon(buffer_size), sync_pos_(sync_pos) {}
+  explicit FdWriterBase(size_t buffer_size, Buffer::Allocation allocation,
+                        bool sync_pos, bool direct = false, bool sparse = false,
+                        Position preallocate = 0)
+      : FdWriterCommon(buffer_size, allocation),
+        sync_pos_(sync_pos),
+        direct_(direct),
+        sparse_(sparse),
+        preallocate_(preallocate) {}
 
   FdWriterBase(FdWriterBase&& that) noexcept;
   FdWriterBase& operator=(FdWriterBase&& that) noexcept;
 
+  void Done() override;
   void Initialize(absl::optional<Position> initial_pos, int dest);
   void Initialize(absl::optional<Position> initial_pos, int flags, int dest);
   bool SyncPos(int dest);
   bool WriteInternal(absl::string_view src) override;
+  bool WriteInternal(const Chain& src) override;
+  bool WriteZerosSlow(Position length) override;
   bool SeekSlow(Position new_pos) override;
 
+  // Waits until no background sync scheduled by FlushAsync() is running.
+  // Returns false, failing the FdWriterBase, if the sync failed.
+  bool SyncFlush();
+
   bool sync_pos_ = false;
+  // True if the file is written with O_DIRECT.
+  bool direct_ = false;
+  // True if WriteZeros() punches holes in the file where possible.
+  bool sparse_ = false;
+  // If not nullptr, receives instrumentation events for write syscalls.
+  StatsSink* stats_sink_ = nullptr;
+
+ private:
+  // State shared with a background sync task scheduled by FlushAsync().
+  struct AsyncFlush {
+    absl::Mutex mutex;
+    // True while a task is scheduled or running.
+    bool pending = false;
+    // errno of a failed fsync(), or 0. Consumed by SyncFlush().
+    int error_code = 0;
+  };
+
+  // Writes src with O_DIRECT temporarily cleared, for data which do not
+  // satisfy O_DIRECT alignment.
+  bool WriteUnaligned(absl::string_view src);
+
+  // Extends the preallocation with fallocate() if write_end is past
+  // preallocated_end_. A no-op where fallocate() is not available.
+  //
+  // Precondition: preallocate_ > 0
+  void PreallocateAhead(int dest, Position write_end);
+
+  // Trims unused preallocated space past the end of the file. A no-op where
+  // fallocate() is not available.
+  void TrimPreallocation(int dest);
+
+  // Waits until no background sync task of that is running, and takes over
+  // its state, for moving.
+  std::unique_ptr<AsyncFlush> ReleaseAsyncFlush();
+
+  // Created when the first background sync task is scheduled.
+  std::unique_ptr<AsyncFlush> async_flush_;
+
+  // If > 0, size of each fallocate() extension ahead of the write cursor.
+  Position preallocate_ = 0;
+  // Position up to which disk space was preallocated.
+  Position preallocated_end_ = 0;
 
   // Invariant: start_pos_ <= numeric_limits<off_t>::max()
 };
@@ -198,6 +415,18 @@ class FdStreamWriterBase : public internal::FdWriterCommon {
       return std::move(set_buffer_size(buffer_size));
     }
 
+    // If true, a large buffer is allocated as hugepage-backed memory where
+    // supported, reducing TLB misses when the buffer is repeatedly scanned.
+    //
+    // Default: false
+    Options& set_huge_pages(bool huge_pages) & {
+      huge_pages_ = huge_pages;
+      return *this;
+    }
+    Options&& set_huge_pages(bool huge_pages) && {
+      return std::move(set_huge_pages(huge_pages));
+    }
+
    private:
     template <typename Dest>
     friend class FdStreamWriter;
@@ -205,21 +434,40 @@ class FdStreamWriterBase : public internal::FdWriterCommon {
     mode_t permissions_ = 0666;
     absl::optional<Position> assumed_pos_;
     size_t buffer_size_ = kDefaultBufferSize;
+    bool huge_pages_ = false;
   };
 
   bool Flush(FlushType flush_type) override;
 
+  // Writes length bytes to the FdStreamWriter, moved by the kernel with
+  // splice() from fd src at its current position, without moving the data
+  // through userspace buffers. At least one of the two fds must be a pipe.
+  // Buffered data are written to the file first.
+  //
+  // Returns the number of bytes spliced. This can be less than length if the
+  // source ends, if the operating system does not support splice() between
+  // these fds, or if the FdStreamWriterBase failed; unless the
+  // FdStreamWriterBase failed, the caller should write the remaining data in
+  // another way.
+  //
+  // This is used by FdStreamReaderBase::CopyTo(Writer*).
+  Position SpliceFromFd(int src, Position length);
+
+  TypeId GetTypeId() const override;
+
  protected:
   FdStreamWriterBase() noexcept {}
 
-  explicit FdStreamWriterBase(size_t buffer_size)
-      : FdWriterCommon(buffer_size) {}
+  explicit FdStreamWriterBase(size_t buffer_size,
+                              Buffer::Allocation allocation)
+      : FdWriterCommon(buffer_size, allocation) {}
 
   FdStreamWriterBase(FdStreamWriterBase&& that) noexcept;
   FdStreamWriterBase& operator=(FdStreamWriterBase&& that) noexcept;
 
   void Initialize(absl::optional<Position> assumed_pos, int flags, int dest);
   bool WriteInternal(absl::string_view src) override;
+  bool WriteInternal(const Chain& src) override;
 };
 
 // A Writer which writes to a file descriptor. It supports random access.
@@ -265,6 +513,8 @@ class FdWriter : public FdWriterBase {
   FdWriter(FdWriter&& that) noexcept;
   FdWriter& operator=(FdWriter&& that) noexcept;
 
+  ~FdWriter();
+
   // Returns the object providing and possibly owning the fd being written to.
   // If the fd is owned then changed to -1 by Close(), otherwise unchanged.
   Dest& dest() { return dest_.manager(); }
@@ -341,8 +591,9 @@ class FdStreamWriter : public FdStreamWriterBase {
 
 namespace internal {
 
-inline FdWriterCommon::FdWriterCommon(size_t buffer_size)
-    : BufferedWriter(buffer_size) {}
+inline FdWriterCommon::FdWriterCommon(size_t buffer_size,
+                                      Buffer::Allocation allocation)
+    : BufferedWriter(buffer_size, 0, allocation) {}
 
 inline FdWriterCommon::FdWriterCommon(FdWriterCommon&& that) noexcept
     : BufferedWriter(std::move(that)),
@@ -359,11 +610,24 @@ inline FdWriterCommon& FdWriterCommon::operator=(
 
 inline FdWriterBase::FdWriterBase(FdWriterBase&& that) noexcept
     : FdWriterCommon(std::move(that)),
-      sync_pos_(absl::exchange(that.sync_pos_, false)) {}
+      sync_pos_(absl::exchange(that.sync_pos_, false)),
+      direct_(absl::exchange(that.direct_, false)),
+      sparse_(absl::exchange(that.sparse_, false)),
+      stats_sink_(absl::exchange(that.stats_sink_, nullptr)),
+      async_flush_(that.ReleaseAsyncFlush()),
+      preallocate_(absl::exchange(that.preallocate_, 0)),
+      preallocated_end_(absl::exchange(that.preallocated_end_, 0)) {}
 
 inline FdWriterBase& FdWriterBase::operator=(FdWriterBase&& that) noexcept {
+  ReleaseAsyncFlush();
   FdWriterCommon::operator=(std::move(that));
   sync_pos_ = absl::exchange(that.sync_pos_, false);
+  direct_ = absl::exchange(that.direct_, false);
+  sparse_ = absl::exchange(that.sparse_, false);
+  stats_sink_ = absl::exchange(that.stats_sink_, nullptr);
+  async_flush_ = that.ReleaseAsyncFlush();
+  preallocate_ = absl::exchange(that.preallocate_, 0);
+  preallocated_end_ = absl::exchange(that.preallocated_end_, 0);
   return *this;
 }
 
@@ -379,25 +643,48 @@ inline FdStreamWriterBase& FdStreamWriterBase::operator=(
 
 template <typename Dest>
 FdWriter<Dest>::FdWriter(type_identity_t<Dest> dest, Options options)
-    : FdWriterBase(options.buffer_size_, !options.initial_pos_.has_value()),
+    : FdWriterBase(
+          options.direct_
+              ? RoundUp<internal::kDirectBlockSize>(options.buffer_size_)
+              : options.buffer_size_,
+          options.direct_ ? Buffer::Allocation::kPageAligned
+                          : options.huge_pages_ ? Buffer::Allocation::kHugePages
+                                                : Buffer::Allocation::kDefault,
+          !options.initial_pos_.has_value(), options.direct_, options.sparse_,
+          options.preallocate_),
       dest_(std::move(dest)) {
   RIEGELI_ASSERT_GE(dest_.get(), 0)
       << "Failed precondition of FdWriter<Dest>::FdWriter(Dest): "
          "negative file descriptor";
   SetFilename(dest_.get());
+  set_adaptive_buffer_sizing(options.adaptive_buffer_sizing_);
+  stats_sink_ = options.stats_sink_;
   Initialize(options.initial_pos_, dest_.get());
 }
 
 template <typename Dest>
 FdWriter<Dest>::FdWriter(absl::string_view filename, int flags, Options options)
-    : FdWriterBase(options.buffer_size_, !options.initial_pos_.has_value()) {
+    : FdWriterBase(
+          options.direct_
+              ? RoundUp<internal::kDirectBlockSize>(options.buffer_size_)
+              : options.buffer_size_,
+          options.direct_ ? Buffer::Allocation::kPageAligned
+                          : options.huge_pages_ ? Buffer::Allocation::kHugePages
+                                                : Buffer::Allocation::kDefault,
+          !options.initial_pos_.has_value(), options.direct_, options.sparse_,
+          options.preallocate_) {
   RIEGELI_ASSERT((flags & O_ACCMODE) == O_WRONLY ||
                  (flags & O_ACCMODE) == O_RDWR)
       << "Failed precondition of FdWriter::FdWriter(string_view): "
          "flags must include O_WRONLY or O_RDWR";
+#ifdef O_DIRECT
+  if (options.direct_) flags |= O_DIRECT;
+#endif
   const int dest = OpenFd(filename, flags, options.permissions_);
   if (ABSL_PREDICT_FALSE(dest < 0)) return;
   dest_ = Dependency<int, Dest>(Dest(dest));
+  set_adaptive_buffer_sizing(options.adaptive_buffer_sizing_);
+  stats_sink_ = options.stats_sink_;
   Initialize(options.initial_pos_, flags, dest_.get());
 }
 
@@ -412,6 +699,14 @@ inline FdWriter<Dest>& FdWriter<Dest>::operator=(FdWriter&& that) noexcept {
   return *this;
 }
 
+template <typename Dest>
+FdWriter<Dest>::~FdWriter() {
+  // A background sync task scheduled by FlushAsync() uses the fd, hence it
+  // must be finished before dest_ is destroyed, and not only in Done() which
+  // might not have been called.
+  SyncFlush();
+}
+
 template <typename Dest>
 void FdWriter<Dest>::Done() {
   if (ABSL_PREDICT_TRUE(PushInternal())) SyncPos(dest_.get());
@@ -428,7 +723,10 @@ void FdWriter<Dest>::Done() {
 template <typename Dest>
 FdStreamWriter<Dest>::FdStreamWriter(type_identity_t<Dest> dest,
                                      Options options)
-    : FdStreamWriterBase(options.buffer_size_), dest_(std::move(dest)) {
+    : FdStreamWriterBase(options.buffer_size_,
+                         options.huge_pages_ ? Buffer::Allocation::kHugePages
+                                             : Buffer::Allocation::kDefault),
+      dest_(std::move(dest)) {
   RIEGELI_ASSERT_GE(dest_.get(), 0)
       << "Failed precondition of FdStreamWriter<Dest>::FdStreamWriter(Dest): "
          "negative file descriptor";
@@ -443,7 +741,9 @@ FdStreamWriter<Dest>::FdStreamWriter(type_identity_t<Dest> dest,
 template <typename Dest>
 FdStreamWriter<Dest>::FdStreamWriter(absl::string_view filename, int flags,
                                      Options options)
-    : FdStreamWriterBase(options.buffer_size_) {
+    : FdStreamWriterBase(options.buffer_size_,
+                         options.huge_pages_ ? Buffer::Allocation::kHugePages
+                                             : Buffer::Allocation::kDefault) {
   RIEGELI_ASSERT((flags & O_ACCMODE) == O_WRONLY ||
                  (flags & O_ACCMODE) == O_RDWR)
       << "Failed precondition of FdStreamWriter::FdStreamWriter(string_view): "
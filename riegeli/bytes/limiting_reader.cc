@@ -57,6 +57,27 @@ bool LimitingReaderBase::PullSlow() {
   return ok;
 }
 
+bool LimitingReaderBase::PullSlow(size_t min_length) {
+  RIEGELI_ASSERT_GT(min_length, available())
+      << "Failed precondition of Reader::PullSlow(size_t): "
+         "enough data available, use Pull(size_t) instead";
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  RIEGELI_ASSERT_LE(pos(), size_limit_)
+      << "Failed invariant of LimitingReader: position exceeds size limit";
+  Reader* const src = src_reader();
+  SyncBuffer(src);
+  bool ok;
+  if (ABSL_PREDICT_FALSE(min_length > size_limit_ - pos())) {
+    // Pull as much as the size limit allows; the result is still false.
+    src->Pull(IntCast<size_t>(size_limit_ - pos()));
+    ok = false;
+  } else {
+    ok = src->Pull(min_length);
+  }
+  MakeBuffer(src);
+  return ok;
+}
+
 bool LimitingReaderBase::ReadSlow(char* dest, size_t length) {
   RIEGELI_ASSERT_GT(length, available())
       << "Failed precondition of Reader::ReadSlow(char*): "
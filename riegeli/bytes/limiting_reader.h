@@ -65,6 +65,7 @@ class LimitingReaderBase : public Reader {
 
   void Done() override;
   bool PullSlow() override;
+  bool PullSlow(size_t min_length) override;
   using Reader::ReadSlow;
   bool ReadSlow(char* dest, size_t length) override;
   bool ReadSlow(Chain* dest, size_t length) override;
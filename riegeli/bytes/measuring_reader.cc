@@ -0,0 +1,136 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/bytes/measuring_reader.h"
+
+#include <stddef.h>
+
+#include <limits>
+#include <memory>
+
+#include "absl/base/optimization.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/object.h"
+#include "riegeli/bytes/backward_writer.h"
+#include "riegeli/bytes/reader.h"
+#include "riegeli/bytes/stream_stats.h"
+#include "riegeli/bytes/writer.h"
+
+namespace riegeli {
+
+void MeasuringReaderBase::Done() {
+  if (ABSL_PREDICT_TRUE(healthy())) {
+    Reader* const src = src_reader();
+    SyncBuffer(src);
+  }
+  Reader::Done();
+}
+
+bool MeasuringReaderBase::PullSlow() {
+  RIEGELI_ASSERT_EQ(available(), 0u)
+      << "Failed precondition of Reader::PullSlow(): "
+         "data available, use Pull() instead";
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  Reader* const src = src_reader();
+  SyncBuffer(src);
+  const absl::Time before = absl::Now();
+  const bool ok = src->Pull();
+  stats()->active_time += absl::Now() - before;
+  ++stats()->operations;
+  MakeBuffer(src);
+  return ok;
+}
+
+bool MeasuringReaderBase::PullSlow(size_t min_length) {
+  RIEGELI_ASSERT_GT(min_length, available())
+      << "Failed precondition of Reader::PullSlow(size_t): "
+         "enough data available, use Pull(size_t) instead";
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  Reader* const src = src_reader();
+  SyncBuffer(src);
+  const absl::Time before = absl::Now();
+  const bool ok = src->Pull(min_length);
+  stats()->active_time += absl::Now() - before;
+  ++stats()->operations;
+  MakeBuffer(src);
+  return ok;
+}
+
+bool MeasuringReaderBase::ReadSlow(char* dest, size_t length) {
+  RIEGELI_ASSERT_GT(length, available())
+      << "Failed precondition of Reader::ReadSlow(char*): "
+         "length too small, use Read(char*) instead";
+  return ReadInternal(dest, length);
+}
+
+bool MeasuringReaderBase::ReadSlow(Chain* dest, size_t length) {
+  RIEGELI_ASSERT_GT(length, UnsignedMin(available(), kMaxBytesToCopy))
+      << "Failed precondition of Reader::ReadSlow(Chain*): "
+         "length too small, use Read(Chain*) instead";
+  RIEGELI_ASSERT_LE(length, std::numeric_limits<size_t>::max() - dest->size())
+      << "Failed precondition of Reader::ReadSlow(Chain*): "
+         "Chain size overflow";
+  return ReadInternal(dest, length);
+}
+
+template <typename Dest>
+inline bool MeasuringReaderBase::ReadInternal(Dest* dest, size_t length) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  Reader* const src = src_reader();
+  SyncBuffer(src);
+  const absl::Time before = absl::Now();
+  const bool ok = src->Read(dest, length);
+  stats()->active_time += absl::Now() - before;
+  ++stats()->operations;
+  MakeBuffer(src);
+  return ok;
+}
+
+bool MeasuringReaderBase::CopyToSlow(Writer* dest, Position length) {
+  RIEGELI_ASSERT_GT(length, UnsignedMin(available(), kMaxBytesToCopy))
+      << "Failed precondition of Reader::CopyToSlow(Writer*): "
+         "length too small, use CopyTo(Writer*) instead";
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  Reader* const src = src_reader();
+  SyncBuffer(src);
+  const absl::Time before = absl::Now();
+  const bool ok = src->CopyTo(dest, length);
+  stats()->active_time += absl::Now() - before;
+  ++stats()->operations;
+  MakeBuffer(src);
+  return ok;
+}
+
+bool MeasuringReaderBase::CopyToSlow(BackwardWriter* dest, size_t length) {
+  RIEGELI_ASSERT_GT(length, UnsignedMin(available(), kMaxBytesToCopy))
+      << "Failed precondition of Reader::CopyToSlow(BackwardWriter*): "
+         "length too small, use CopyTo(BackwardWriter*) instead";
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  Reader* const src = src_reader();
+  SyncBuffer(src);
+  const absl::Time before = absl::Now();
+  const bool ok = src->CopyTo(dest, length);
+  stats()->active_time += absl::Now() - before;
+  ++stats()->operations;
+  MakeBuffer(src);
+  return ok;
+}
+
+template class MeasuringReader<Reader*>;
+template class MeasuringReader<std::unique_ptr<Reader>>;
+
+}  // namespace riegeli
@@ -0,0 +1,235 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BYTES_MEASURING_READER_H_
+#define RIEGELI_BYTES_MEASURING_READER_H_
+
+#include <stddef.h>
+
+#include <memory>
+#include <utility>
+
+#include "absl/base/optimization.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/dependency.h"
+#include "riegeli/base/object.h"
+#include "riegeli/bytes/backward_writer.h"
+#include "riegeli/bytes/reader.h"
+#include "riegeli/bytes/stream_stats.h"
+#include "riegeli/bytes/writer.h"
+
+namespace riegeli {
+
+// Template parameter invariant part of MeasuringReader.
+class MeasuringReaderBase : public Reader {
+ public:
+  // Returns the StreamStats being updated.
+  StreamStats* stats() const { return stats_; }
+
+  // Returns the original Reader. Unchanged by Close().
+  virtual Reader* src_reader() = 0;
+  virtual const Reader* src_reader() const = 0;
+
+ protected:
+  MeasuringReaderBase() noexcept : Reader(State::kClosed) {}
+
+  explicit MeasuringReaderBase(StreamStats* stats)
+      : Reader(State::kOpen), stats_(stats) {}
+
+  MeasuringReaderBase(MeasuringReaderBase&& that) noexcept;
+  MeasuringReaderBase& operator=(MeasuringReaderBase&& that) noexcept;
+
+  void Done() override;
+  bool PullSlow() override;
+  bool PullSlow(size_t min_length) override;
+  using Reader::ReadSlow;
+  bool ReadSlow(char* dest, size_t length) override;
+  bool ReadSlow(Chain* dest, size_t length) override;
+  using Reader::CopyToSlow;
+  bool CopyToSlow(Writer* dest, Position length) override;
+  bool CopyToSlow(BackwardWriter* dest, size_t length) override;
+
+  // Sets cursor of src to cursor of this, and collects bytes read from the
+  // buffer since the last collection.
+  void SyncBuffer(Reader* src);
+
+  // Sets buffer pointers of this to buffer pointers of src, and collects
+  // bytes read by a forwarded operation. Fails this if src failed.
+  void MakeBuffer(Reader* src);
+
+ private:
+  template <typename Dest>
+  bool ReadInternal(Dest* dest, size_t length);
+
+  // Adds bytes read since the last collection to stats_->bytes.
+  void CollectBytes();
+
+  // The StreamStats being updated. Not owned.
+  StreamStats* stats_ = nullptr;
+  // Position up to which bytes have been collected into stats_->bytes.
+  Position collected_pos_ = 0;
+
+  // Invariants if healthy():
+  //   start_ == src_reader()->start_
+  //   limit_ == src_reader()->limit_
+  //   limit_pos_ == src_reader()->limit_pos_
+};
+
+// A Reader which forwards reads to another Reader, collecting StreamStats:
+// bytes read, the number of operations which reached the original Reader, and
+// wall time spent in them. Operations satisfied from the buffer, which is
+// shared with the original Reader, are not slowed down and not counted.
+//
+// Wrapping an FdReader attributes time to I/O; wrapping both sides of a codec
+// Reader additionally yields its compression ratio and time (see
+// stream_stats.h).
+//
+// The Src template parameter specifies the type of the object providing and
+// possibly owning the original Reader. Src must support
+// Dependency<Reader*, Src>, e.g. Reader* (not owned, default),
+// unique_ptr<Reader> (owned), ChainReader<> (owned).
+//
+// The original Reader must not be accessed until the MeasuringReader is
+// closed or no longer used.
+template <typename Src = Reader*>
+class MeasuringReader : public MeasuringReaderBase {
+ public:
+  // Creates a closed MeasuringReader.
+  MeasuringReader() noexcept {}
+
+  // Will read from the original Reader provided by src, updating *stats.
+  //
+  // *stats is not owned and must outlive the MeasuringReader.
+  explicit MeasuringReader(Src src, StreamStats* stats);
+
+  MeasuringReader(MeasuringReader&& that) noexcept;
+  MeasuringReader& operator=(MeasuringReader&& that) noexcept;
+
+  // Returns the object providing and possibly owning the original Reader.
+  // Unchanged by Close().
+  Src& src() { return src_.manager(); }
+  const Src& src() const { return src_.manager(); }
+  Reader* src_reader() override { return src_.get(); }
+  const Reader* src_reader() const override { return src_.get(); }
+
+ protected:
+  void Done() override;
+  void VerifyEnd() override;
+
+ private:
+  void MoveSrc(MeasuringReader&& that);
+
+  // The object providing and possibly owning the original Reader.
+  Dependency<Reader*, Src> src_;
+};
+
+// Implementation details follow.
+
+inline MeasuringReaderBase::MeasuringReaderBase(
+    MeasuringReaderBase&& that) noexcept
+    : Reader(std::move(that)),
+      stats_(that.stats_),
+      collected_pos_(that.collected_pos_) {}
+
+inline MeasuringReaderBase& MeasuringReaderBase::operator=(
+    MeasuringReaderBase&& that) noexcept {
+  Reader::operator=(std::move(that));
+  stats_ = that.stats_;
+  collected_pos_ = that.collected_pos_;
+  return *this;
+}
+
+inline void MeasuringReaderBase::CollectBytes() {
+  stats_->bytes += pos() - collected_pos_;
+  collected_pos_ = pos();
+}
+
+inline void MeasuringReaderBase::SyncBuffer(Reader* src) {
+  CollectBytes();
+  src->set_cursor(cursor_);
+}
+
+inline void MeasuringReaderBase::MakeBuffer(Reader* src) {
+  start_ = src->start();
+  cursor_ = src->cursor();
+  limit_ = src->limit();
+  limit_pos_ = src->pos() + src->available();  // src->limit_pos_
+  CollectBytes();
+  if (ABSL_PREDICT_FALSE(!src->healthy())) Fail(*src);
+}
+
+template <typename Src>
+inline MeasuringReader<Src>::MeasuringReader(Src src, StreamStats* stats)
+    : MeasuringReaderBase(stats), src_(std::move(src)) {
+  RIEGELI_ASSERT(src_.get() != nullptr)
+      << "Failed precondition of "
+         "MeasuringReader<Src>::MeasuringReader(Src): "
+         "null Reader pointer";
+  RIEGELI_ASSERT(stats != nullptr)
+      << "Failed precondition of "
+         "MeasuringReader<Src>::MeasuringReader(Src): "
+         "null StreamStats pointer";
+  MakeBuffer(src_.get());
+}
+
+template <typename Src>
+inline MeasuringReader<Src>::MeasuringReader(MeasuringReader&& that) noexcept
+    : MeasuringReaderBase(std::move(that)) {
+  MoveSrc(std::move(that));
+}
+
+template <typename Src>
+inline MeasuringReader<Src>& MeasuringReader<Src>::operator=(
+    MeasuringReader&& that) noexcept {
+  MeasuringReaderBase::operator=(std::move(that));
+  MoveSrc(std::move(that));
+  return *this;
+}
+
+template <typename Src>
+inline void MeasuringReader<Src>::MoveSrc(MeasuringReader&& that) {
+  if (src_.kIsStable()) {
+    src_ = std::move(that.src_);
+  } else {
+    SyncBuffer(src_.get());
+    src_ = std::move(that.src_);
+    MakeBuffer(src_.get());
+  }
+}
+
+template <typename Src>
+void MeasuringReader<Src>::Done() {
+  MeasuringReaderBase::Done();
+  if (src_.is_owning()) {
+    if (ABSL_PREDICT_FALSE(!src_->Close())) Fail(*src_);
+  }
+}
+
+template <typename Src>
+void MeasuringReader<Src>::VerifyEnd() {
+  MeasuringReaderBase::VerifyEnd();
+  if (src_.is_owning() && ABSL_PREDICT_TRUE(healthy())) {
+    SyncBuffer(src_.get());
+    src_->VerifyEnd();
+    MakeBuffer(src_.get());
+  }
+}
+
+extern template class MeasuringReader<Reader*>;
+extern template class MeasuringReader<std::unique_ptr<Reader>>;
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_BYTES_MEASURING_READER_H_
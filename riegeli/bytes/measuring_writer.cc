@@ -0,0 +1,112 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/bytes/measuring_writer.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "absl/base/optimization.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/object.h"
+#include "riegeli/bytes/stream_stats.h"
+#include "riegeli/bytes/writer.h"
+
+namespace riegeli {
+
+void MeasuringWriterBase::Done() {
+  if (ABSL_PREDICT_TRUE(healthy())) {
+    Writer* const dest = dest_writer();
+    SyncBuffer(dest);
+  }
+  Writer::Done();
+}
+
+bool MeasuringWriterBase::PushSlow() {
+  RIEGELI_ASSERT_EQ(available(), 0u)
+      << "Failed precondition of Writer::PushSlow(): "
+         "space available, use Push() instead";
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  Writer* const dest = dest_writer();
+  SyncBuffer(dest);
+  const absl::Time before = absl::Now();
+  const bool ok = dest->Push();
+  stats()->active_time += absl::Now() - before;
+  ++stats()->operations;
+  MakeBuffer(dest);
+  return ok;
+}
+
+bool MeasuringWriterBase::WriteSlow(absl::string_view src) {
+  RIEGELI_ASSERT_GT(src.size(), available())
+      << "Failed precondition of Writer::WriteSlow(string_view): "
+         "length too small, use Write(string_view) instead";
+  return WriteInternal(src);
+}
+
+bool MeasuringWriterBase::WriteSlow(std::string&& src) {
+  RIEGELI_ASSERT_GT(src.size(), available())
+      << "Failed precondition of Writer::WriteSlow(string&&): "
+         "length too small, use Write(string&&) instead";
+  return WriteInternal(std::move(src));
+}
+
+bool MeasuringWriterBase::WriteSlow(const Chain& src) {
+  RIEGELI_ASSERT_GT(src.size(), UnsignedMin(available(), kMaxBytesToCopy))
+      << "Failed precondition of Writer::WriteSlow(Chain): "
+         "length too small, use Write(Chain) instead";
+  return WriteInternal(src);
+}
+
+bool MeasuringWriterBase::WriteSlow(Chain&& src) {
+  RIEGELI_ASSERT_GT(src.size(), UnsignedMin(available(), kMaxBytesToCopy))
+      << "Failed precondition of Writer::WriteSlow(Chain&&): "
+         "length too small, use Write(Chain&&) instead";
+  return WriteInternal(std::move(src));
+}
+
+template <typename Src>
+inline bool MeasuringWriterBase::WriteInternal(Src&& src) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  Writer* const dest = dest_writer();
+  SyncBuffer(dest);
+  const absl::Time before = absl::Now();
+  const bool ok = dest->Write(std::forward<Src>(src));
+  stats()->active_time += absl::Now() - before;
+  ++stats()->operations;
+  MakeBuffer(dest);
+  return ok;
+}
+
+bool MeasuringWriterBase::Flush(FlushType flush_type) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  Writer* const dest = dest_writer();
+  SyncBuffer(dest);
+  const absl::Time before = absl::Now();
+  const bool ok = dest->Flush(flush_type);
+  stats()->active_time += absl::Now() - before;
+  ++stats()->operations;
+  MakeBuffer(dest);
+  return ok;
+}
+
+template class MeasuringWriter<Writer*>;
+template class MeasuringWriter<std::unique_ptr<Writer>>;
+
+}  // namespace riegeli
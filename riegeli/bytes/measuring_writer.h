@@ -0,0 +1,223 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BYTES_MEASURING_WRITER_H_
+#define RIEGELI_BYTES_MEASURING_WRITER_H_
+
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "absl/base/optimization.h"
+#include "absl/strings/string_view.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/dependency.h"
+#include "riegeli/base/object.h"
+#include "riegeli/bytes/stream_stats.h"
+#include "riegeli/bytes/writer.h"
+
+namespace riegeli {
+
+// Template parameter invariant part of MeasuringWriter.
+class MeasuringWriterBase : public Writer {
+ public:
+  // Returns the StreamStats being updated.
+  StreamStats* stats() const { return stats_; }
+
+  // Returns the original Writer. Unchanged by Close().
+  virtual Writer* dest_writer() = 0;
+  virtual const Writer* dest_writer() const = 0;
+
+  bool Flush(FlushType flush_type) override;
+
+ protected:
+  MeasuringWriterBase() noexcept : Writer(State::kClosed) {}
+
+  explicit MeasuringWriterBase(StreamStats* stats)
+      : Writer(State::kOpen), stats_(stats) {}
+
+  MeasuringWriterBase(MeasuringWriterBase&& that) noexcept;
+  MeasuringWriterBase& operator=(MeasuringWriterBase&& that) noexcept;
+
+  void Done() override;
+  bool PushSlow() override;
+  using Writer::WriteSlow;
+  bool WriteSlow(absl::string_view src) override;
+  bool WriteSlow(std::string&& src) override;
+  bool WriteSlow(const Chain& src) override;
+  bool WriteSlow(Chain&& src) override;
+
+  // Sets cursor of dest to cursor of this, and collects bytes written to the
+  // buffer since the last collection.
+  void SyncBuffer(Writer* dest);
+
+  // Sets buffer pointers of this to buffer pointers of dest, and collects
+  // bytes written by a forwarded operation. Fails this if dest failed.
+  void MakeBuffer(Writer* dest);
+
+ private:
+  template <typename Src>
+  bool WriteInternal(Src&& src);
+
+  // Adds bytes written since the last collection to stats_->bytes.
+  void CollectBytes();
+
+  // The StreamStats being updated. Not owned.
+  StreamStats* stats_ = nullptr;
+  // Position up to which bytes have been collected into stats_->bytes.
+  Position collected_pos_ = 0;
+
+  // Invariants if healthy():
+  //   start_ == dest_writer()->start_
+  //   limit_ == dest_writer()->limit_
+  //   start_pos_ == dest_writer()->start_pos_
+};
+
+// A Writer which forwards data to another Writer, collecting StreamStats:
+// bytes written, the number of operations which reached the original Writer,
+// and wall time spent in them. Operations satisfied from the buffer, which is
+// shared with the original Writer, are not slowed down and not counted.
+//
+// Wrapping an FdWriter attributes time to I/O; wrapping both sides of a codec
+// Writer additionally yields its compression ratio and time (see
+// stream_stats.h).
+//
+// The Dest template parameter specifies the type of the object providing and
+// possibly owning the original Writer. Dest must support
+// Dependency<Writer*, Dest>, e.g. Writer* (not owned, default),
+// unique_ptr<Writer> (owned), ChainWriter<> (owned).
+//
+// The original Writer must not be accessed until the MeasuringWriter is
+// closed or no longer used, except that it is allowed to read the destination
+// of the original Writer immediately after Flush().
+template <typename Dest = Writer*>
+class MeasuringWriter : public MeasuringWriterBase {
+ public:
+  // Creates a closed MeasuringWriter.
+  MeasuringWriter() noexcept {}
+
+  // Will write to the original Writer provided by dest, updating *stats.
+  //
+  // *stats is not owned and must outlive the MeasuringWriter.
+  explicit MeasuringWriter(Dest dest, StreamStats* stats);
+
+  MeasuringWriter(MeasuringWriter&& that) noexcept;
+  MeasuringWriter& operator=(MeasuringWriter&& that) noexcept;
+
+  // Returns the object providing and possibly owning the original Writer.
+  // Unchanged by Close().
+  Dest& dest() { return dest_.manager(); }
+  const Dest& dest() const { return dest_.manager(); }
+  Writer* dest_writer() override { return dest_.get(); }
+  const Writer* dest_writer() const override { return dest_.get(); }
+
+ protected:
+  void Done() override;
+
+ private:
+  void MoveDest(MeasuringWriter&& that);
+
+  // The object providing and possibly owning the original Writer.
+  Dependency<Writer*, Dest> dest_;
+};
+
+// Implementation details follow.
+
+inline MeasuringWriterBase::MeasuringWriterBase(
+    MeasuringWriterBase&& that) noexcept
+    : Writer(std::move(that)),
+      stats_(that.stats_),
+      collected_pos_(that.collected_pos_) {}
+
+inline MeasuringWriterBase& MeasuringWriterBase::operator=(
+    MeasuringWriterBase&& that) noexcept {
+  Writer::operator=(std::move(that));
+  stats_ = that.stats_;
+  collected_pos_ = that.collected_pos_;
+  return *this;
+}
+
+inline void MeasuringWriterBase::CollectBytes() {
+  stats_->bytes += pos() - collected_pos_;
+  collected_pos_ = pos();
+}
+
+inline void MeasuringWriterBase::SyncBuffer(Writer* dest) {
+  CollectBytes();
+  dest->set_cursor(cursor_);
+}
+
+inline void MeasuringWriterBase::MakeBuffer(Writer* dest) {
+  start_ = dest->start();
+  cursor_ = dest->cursor();
+  limit_ = dest->limit();
+  start_pos_ = dest->pos() - dest->written_to_buffer();  // dest->start_pos_
+  CollectBytes();
+  if (ABSL_PREDICT_FALSE(!dest->healthy())) Fail(*dest);
+}
+
+template <typename Dest>
+inline MeasuringWriter<Dest>::MeasuringWriter(Dest dest, StreamStats* stats)
+    : MeasuringWriterBase(stats), dest_(std::move(dest)) {
+  RIEGELI_ASSERT(dest_.get() != nullptr)
+      << "Failed precondition of "
+         "MeasuringWriter<Dest>::MeasuringWriter(Dest): "
+         "null Writer pointer";
+  RIEGELI_ASSERT(stats != nullptr)
+      << "Failed precondition of "
+         "MeasuringWriter<Dest>::MeasuringWriter(Dest): "
+         "null StreamStats pointer";
+  MakeBuffer(dest_.get());
+}
+
+template <typename Dest>
+inline MeasuringWriter<Dest>::MeasuringWriter(MeasuringWriter&& that) noexcept
+    : MeasuringWriterBase(std::move(that)) {
+  MoveDest(std::move(that));
+}
+
+template <typename Dest>
+inline MeasuringWriter<Dest>& MeasuringWriter<Dest>::operator=(
+    MeasuringWriter&& that) noexcept {
+  MeasuringWriterBase::operator=(std::move(that));
+  MoveDest(std::move(that));
+  return *this;
+}
+
+template <typename Dest>
+inline void MeasuringWriter<Dest>::MoveDest(MeasuringWriter&& that) {
+  if (dest_.kIsStable()) {
+    dest_ = std::move(that.dest_);
+  } else {
+    SyncBuffer(dest_.get());
+    dest_ = std::move(that.dest_);
+    MakeBuffer(dest_.get());
+  }
+}
+
+template <typename Dest>
+void MeasuringWriter<Dest>::Done() {
+  MeasuringWriterBase::Done();
+  if (dest_.is_owning()) {
+    if (ABSL_PREDICT_FALSE(!dest_->Close())) Fail(*dest_);
+  }
+}
+
+extern template class MeasuringWriter<Writer*>;
+extern template class MeasuringWriter<std::unique_ptr<Writer>>;
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_BYTES_MEASURING_WRITER_H_
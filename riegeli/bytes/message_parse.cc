@@ -26,7 +26,7 @@
 #include "riegeli/base/canonical_errors.h"
 #include "riegeli/base/chain.h"
 #include "riegeli/base/status.h"
-#include "riegeli/bytes/chain_reader.h"
+#include "riegeli/bytes/chain_streams.h"
 #include "riegeli/bytes/reader.h"
 
 namespace riegeli {
@@ -110,6 +110,16 @@ google::protobuf::int64 ReaderInputStream::ByteCount() const {
   return IntCast<google::protobuf::int64>(relative_pos());
 }
 
+inline Status CheckInitialized(google::protobuf::MessageLite* dest) {
+  if (ABSL_PREDICT_FALSE(!dest->IsInitialized())) {
+    return DataLossError(
+        absl::StrCat("Failed to parse message of type ", dest->GetTypeName(),
+                     " because it is missing required fields: ",
+                     dest->InitializationErrorString()));
+  }
+  return OkStatus();
+}
+
 }  // namespace
 
 namespace internal {
@@ -121,19 +131,19 @@ Status ParseFromReaderImpl(google::protobuf::MessageLite* dest, Reader* src) {
     return DataLossError(
         absl::StrCat("Failed to parse message of type ", dest->GetTypeName()));
   }
-  if (ABSL_PREDICT_FALSE(!dest->IsInitialized())) {
-    return DataLossError(
-        absl::StrCat("Failed to parse message of type ", dest->GetTypeName(),
-                     " because it is missing required fields: ",
-                     dest->InitializationErrorString()));
-  }
-  return OkStatus();
+  return CheckInitialized(dest);
 }
 
 }  // namespace internal
 
 Status ParseFromChain(google::protobuf::MessageLite* dest, const Chain& src) {
-  return ParseFromReader(dest, ChainReader<>(&src));
+  ChainInputStream input_stream(&src);
+  if (ABSL_PREDICT_FALSE(
+          !dest->ParsePartialFromZeroCopyStream(&input_stream))) {
+    return DataLossError(
+        absl::StrCat("Failed to parse message of type ", dest->GetTypeName()));
+  }
+  return CheckInitialized(dest);
 }
 
 }  // namespace riegeli
@@ -18,7 +18,9 @@
 #include <utility>
 
 #include "absl/base/optimization.h"
+#include "google/protobuf/arena.h"
 #include "google/protobuf/message_lite.h"
+#include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
 #include "riegeli/base/dependency.h"
 #include "riegeli/base/status.h"
@@ -40,6 +42,21 @@ namespace riegeli {
 template <typename Src = Reader*>
 Status ParseFromReader(google::protobuf::MessageLite* dest, Src src);
 
+// Reads a message in binary format from the given Reader, into a message of
+// type M allocated on the arena. If successful, the entire input will be
+// consumed. Fails if some required fields are missing.
+//
+// The message is created with google::protobuf::Arena::CreateMessage<M>() and
+// is owned by the arena; it is valid until the arena is reset or destroyed.
+// This lets parse loops reset the arena periodically instead of destructing
+// each message separately.
+//
+// Returns status:
+//  * status.ok()  - success (*dest is filled)
+//  * !status.ok() - failure (*dest is unspecified)
+template <typename M, typename Src = Reader*>
+Status ParseFromReader(M** dest, Src src, google::protobuf::Arena* arena);
+
 // Reads a message in binary format from the given Chain. If successful, the
 // entire input will be consumed. Fails if some required fields are missing.
 //
@@ -48,6 +65,16 @@ Status ParseFromReader(google::protobuf::MessageLite* dest, Src src);
 //  * !status.ok() - failure (*dest is unspecified, *error_message is set)
 Status ParseFromChain(google::protobuf::MessageLite* dest, const Chain& src);
 
+// Reads a message in binary format from the given Chain, into a message of
+// type M allocated on the arena, like ParseFromReader() with an arena.
+//
+// Returns status:
+//  * status.ok()  - success (*dest is filled)
+//  * !status.ok() - failure (*dest is unspecified)
+template <typename M>
+Status ParseFromChain(M** dest, const Chain& src,
+                      google::protobuf::Arena* arena);
+
 // Implementation details follow.
 
 namespace internal {
@@ -66,6 +93,22 @@ inline Status ParseFromReader(google::protobuf::MessageLite* dest, Src src) {
   return status;
 }
 
+template <typename M, typename Src>
+inline Status ParseFromReader(M** dest, Src src,
+                              google::protobuf::Arena* arena) {
+  *dest = google::protobuf::Arena::CreateMessage<M>(
+      RIEGELI_ASSERT_NOTNULL(arena));
+  return ParseFromReader(*dest, std::move(src));
+}
+
+template <typename M>
+inline Status ParseFromChain(M** dest, const Chain& src,
+                             google::protobuf::Arena* arena) {
+  *dest = google::protobuf::Arena::CreateMessage<M>(
+      RIEGELI_ASSERT_NOTNULL(arena));
+  return ParseFromChain(*dest, src);
+}
+
 }  // namespace riegeli
 
 #endif  // RIEGELI_BYTES_MESSAGE_PARSE_H_
@@ -26,7 +26,7 @@
 #include "riegeli/base/canonical_errors.h"
 #include "riegeli/base/chain.h"
 #include "riegeli/base/status.h"
-#include "riegeli/bytes/chain_writer.h"
+#include "riegeli/bytes/chain_streams.h"
 #include "riegeli/bytes/writer.h"
 
 namespace riegeli {
@@ -95,24 +95,46 @@ google::protobuf::int64 WriterOutputStream::ByteCount() const {
   return IntCast<google::protobuf::int64>(relative_pos());
 }
 
-}  // namespace
-
-namespace internal {
-
-Status SerializeToWriterImpl(const google::protobuf::MessageLite& src,
-                             Writer* dest) {
+// Checks that the message can be serialized: that it is initialized and that
+// its size is within the protobuf limit.
+inline Status CheckSerializable(const google::protobuf::MessageLite& src,
+                                size_t size) {
   if (ABSL_PREDICT_FALSE(!src.IsInitialized())) {
     return InvalidArgumentError(
         absl::StrCat("Failed to serialize message of type ", src.GetTypeName(),
                      " because it is missing required fields: ",
                      src.InitializationErrorString()));
   }
-  const size_t size = src.ByteSizeLong();
   if (ABSL_PREDICT_FALSE(size > size_t{std::numeric_limits<int>::max()})) {
     return ResourceExhaustedError(absl::StrCat(
         "Failed to serialize message of type ", src.GetTypeName(),
         " because it exceeds maximum protobuf size of 2GB: ", size));
   }
+  return OkStatus();
+}
+
+}  // namespace
+
+namespace internal {
+
+Status SerializeToWriterImpl(const google::protobuf::MessageLite& src,
+                             Writer* dest) {
+  const size_t size = src.ByteSizeLong();
+  const Status status = CheckSerializable(src, size);
+  if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+  if (ABSL_PREDICT_FALSE(!dest->Push())) return dest->status();
+  if (ABSL_PREDICT_TRUE(dest->available() >= size)) {
+    // The message fits in the Writer's buffer; serialize it directly there,
+    // which is faster than going through a ZeroCopyOutputStream.
+    if (ABSL_PREDICT_FALSE(
+            !src.SerializePartialToArray(dest->cursor(), IntCast<int>(size)))) {
+      RIEGELI_ASSERT_UNREACHABLE()
+          << "Failed to serialize message of type " << src.GetTypeName()
+          << ": SerializePartialToArray() failed for an unknown reason";
+    }
+    dest->set_cursor(dest->cursor() + size);
+    return OkStatus();
+  }
   WriterOutputStream output_stream(dest);
   if (ABSL_PREDICT_FALSE(
           !src.SerializePartialToZeroCopyStream(&output_stream))) {
@@ -128,9 +150,17 @@ Status SerializeToWriterImpl(const google::protobuf::MessageLite& src,
 
 Status SerializeToChain(const google::protobuf::MessageLite& src, Chain* dest) {
   dest->Clear();
-  return SerializeToWriter(
-      src, ChainWriter<>(dest, ChainWriterBase::Options().set_size_hint(
-                                   src.ByteSizeLong())));
+  const size_t size = src.ByteSizeLong();
+  const Status status = CheckSerializable(src, size);
+  if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+  ChainOutputStream output_stream(dest, size);
+  if (ABSL_PREDICT_FALSE(
+          !src.SerializePartialToZeroCopyStream(&output_stream))) {
+    RIEGELI_ASSERT_UNREACHABLE()
+        << "Failed to serialize message of type " << src.GetTypeName()
+        << ": SerializePartialToZeroCopyStream() failed for an unknown reason";
+  }
+  return OkStatus();
 }
 
 }  // namespace riegeli
@@ -0,0 +1,57 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/bytes/mmap_ref.h"
+
+#include <stddef.h>
+#include <sys/mman.h>
+
+#include <cerrno>
+#include <ostream>
+
+#include "absl/utility/utility.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/errno_mapping.h"
+#include "riegeli/base/memory_estimator.h"
+
+namespace riegeli {
+
+MMapRef::MMapRef(MMapRef&& that) noexcept
+    : data_(absl::exchange(that.data_, nullptr)),
+      size_(absl::exchange(that.size_, 0)) {}
+
+MMapRef& MMapRef::operator=(MMapRef&& that) noexcept {
+  // Exchange that.data_ early to support self-assignment.
+  void* const data = absl::exchange(that.data_, nullptr);
+  if (data_ != nullptr) {
+    RIEGELI_CHECK_EQ(munmap(data_, size_), 0)
+        << ErrnoToCanonicalStatus(errno, "munmap() failed").message();
+  }
+  data_ = data;
+  size_ = absl::exchange(that.size_, 0);
+  return *this;
+}
+
+MMapRef::~MMapRef() {
+  if (data_ != nullptr) {
+    RIEGELI_CHECK_EQ(munmap(data_, size_), 0)
+        << ErrnoToCanonicalStatus(errno, "munmap() failed").message();
+  }
+}
+
+void MMapRef::RegisterSubobjects(MemoryEstimator* memory_estimator) const {}
+
+void MMapRef::DumpStructure(std::ostream& out) const { out << "mmap"; }
+
+}  // namespace riegeli
@@ -0,0 +1,59 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BYTES_MMAP_REF_H_
+#define RIEGELI_BYTES_MMAP_REF_H_
+
+#include <stddef.h>
+
+#include <iosfwd>
+
+#include "absl/strings/string_view.h"
+#include "riegeli/base/memory_estimator.h"
+
+namespace riegeli {
+
+// An external object for Chain::FromExternal() and Chain::AppendExternal()
+// which wraps a memory mapped region and unmaps it when the last Chain block
+// referring to it is destroyed.
+//
+// Since Chain blocks are reference counted, Chains and Chain fragments
+// derived from such a Chain, e.g. by Read(Chain*), share the block and keep
+// the mapping alive, which gives zero-copy reading from the page cache all
+// the way to the application. FdMMapReader reads from a Chain of this kind.
+//
+// The region must have been returned by a successful mmap() call.
+class MMapRef {
+ public:
+  MMapRef(void* data, size_t size) : data_(data), size_(size) {}
+
+  MMapRef(MMapRef&& that) noexcept;
+  MMapRef& operator=(MMapRef&& that) noexcept;
+
+  ~MMapRef();
+
+  absl::string_view data() const {
+    return absl::string_view(static_cast<const char*>(data_), size_);
+  }
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const;
+  void DumpStructure(std::ostream& out) const;
+
+ private:
+  void* data_;
+  size_t size_;
+};
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_BYTES_MMAP_REF_H_
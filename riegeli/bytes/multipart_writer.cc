@@ -0,0 +1,139 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/bytes/multipart_writer.h"
+
+#include <stddef.h>
+
+#include <cstring>
+#include <future>
+#include <memory>
+#include <utility>
+
+#include "absl/base/optimization.h"
+#include "absl/strings/string_view.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/parallelism.h"
+#include "riegeli/base/status.h"
+#include "riegeli/bytes/buffered_writer.h"
+
+namespace riegeli {
+
+void MultipartWriterBase::Done() {
+  if (ABSL_PREDICT_TRUE(PushInternal()) && part_filled_ > 0) {
+    // Upload the final part, which may be shorter than part_length_.
+    StartPartUpload();
+  }
+  while (!in_flight_parts_.empty()) HarvestOldestUpload();
+  if (ABSL_PREDICT_TRUE(healthy())) {
+    Status status = dest_part_dest()->Complete(num_parts_);
+    if (ABSL_PREDICT_FALSE(!status.ok())) Fail(std::move(status));
+  }
+  BufferedWriter::Done();
+}
+
+void MultipartWriterBase::SyncUploads() {
+  for (InFlightPart& part : in_flight_parts_) {
+    // Wait for the upload: its task uses the PartDest, which the caller may
+    // be about to destroy.
+    if (part.future.valid()) part.future.wait();
+  }
+  in_flight_parts_.clear();
+}
+
+inline bool MultipartWriterBase::HarvestOldestUpload() {
+  RIEGELI_ASSERT(!in_flight_parts_.empty())
+      << "Failed precondition of MultipartWriterBase::HarvestOldestUpload(): "
+         "no upload in flight";
+  std::future<Status> future = std::move(in_flight_parts_.front().future);
+  in_flight_parts_.pop_front();
+  Status status = future.get();
+  if (ABSL_PREDICT_FALSE(!status.ok())) {
+    if (ABSL_PREDICT_FALSE(!healthy())) return false;
+    return Fail(std::move(status));
+  }
+  return healthy();
+}
+
+inline bool MultipartWriterBase::StartPartUpload() {
+  RIEGELI_ASSERT_GT(part_filled_, 0u)
+      << "Failed precondition of MultipartWriterBase::StartPartUpload(): "
+         "nothing to upload";
+  PartDest* const dest = dest_part_dest();
+  const size_t part_index = num_parts_++;
+  char* const data = part_buffer_.release();
+  const size_t length = part_filled_;
+  part_filled_ = 0;
+  if (max_in_flight_parts_ == 0) {
+    Status status = dest->UploadPart(part_index, absl::string_view(data,
+                                                                   length));
+    delete[] data;
+    if (ABSL_PREDICT_FALSE(!status.ok())) return Fail(std::move(status));
+    return true;
+  }
+  while (in_flight_parts_.size() >= max_in_flight_parts_) {
+    if (ABSL_PREDICT_FALSE(!HarvestOldestUpload())) {
+      delete[] data;
+      return false;
+    }
+  }
+  std::promise<Status>* const done = new std::promise<Status>();
+  in_flight_parts_.emplace_back();
+  in_flight_parts_.back().future = done->get_future();
+  internal::ThreadPool::global_io().Schedule([dest, part_index, data, length,
+                                              done] {
+    done->set_value(
+        dest->UploadPart(part_index, absl::string_view(data, length)));
+    delete[] data;
+    delete done;
+  });
+  return true;
+}
+
+bool MultipartWriterBase::WriteInternal(absl::string_view src) {
+  RIEGELI_ASSERT(!src.empty())
+      << "Failed precondition of BufferedWriter::WriteInternal(): "
+         "nothing to write";
+  RIEGELI_ASSERT(healthy())
+      << "Failed precondition of BufferedWriter::WriteInternal(): " << status();
+  RIEGELI_ASSERT_EQ(written_to_buffer(), 0u)
+      << "Failed precondition of BufferedWriter::WriteInternal(): "
+         "buffer not empty";
+  while (!src.empty()) {
+    if (part_buffer_ == nullptr) {
+      part_buffer_ = std::unique_ptr<char[]>(new char[part_length_]);
+    }
+    const size_t length = UnsignedMin(src.size(), part_length_ - part_filled_);
+    std::memcpy(part_buffer_.get() + part_filled_, src.data(), length);
+    part_filled_ += length;
+    start_pos_ += length;
+    src.remove_prefix(length);
+    if (part_filled_ == part_length_) {
+      if (ABSL_PREDICT_FALSE(!StartPartUpload())) return false;
+    }
+  }
+  return true;
+}
+
+bool MultipartWriterBase::Flush(FlushType flush_type) {
+  if (ABSL_PREDICT_FALSE(!PushInternal())) return false;
+  // The destination provides no durability distinction between flush types:
+  // a completed part upload is durable, the part being assembled is not.
+  while (!in_flight_parts_.empty()) {
+    if (ABSL_PREDICT_FALSE(!HarvestOldestUpload())) return false;
+  }
+  return true;
+}
+
+}  // namespace riegeli
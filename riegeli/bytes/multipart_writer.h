@@ -0,0 +1,285 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BYTES_MULTIPART_WRITER_H_
+#define RIEGELI_BYTES_MULTIPART_WRITER_H_
+
+#include <stddef.h>
+
+#include <deque>
+#include <future>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "absl/strings/string_view.h"
+#include "absl/utility/utility.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/dependency.h"
+#include "riegeli/base/object.h"
+#include "riegeli/base/status.h"
+#include "riegeli/bytes/buffered_writer.h"
+
+namespace riegeli {
+
+// Interface to a destination which accepts data as a sequence of
+// independently uploaded parts, e.g. an object store multipart upload.
+//
+// Implementations must be thread safe: MultipartWriter uploads several
+// parts concurrently.
+class PartDest {
+ public:
+  virtual ~PartDest() {}
+
+  // Uploads one part. Parts are numbered consecutively from 0; each part
+  // except the last has the same length. An upload either stores the whole
+  // part or fails; there are no short uploads.
+  //
+  // Precondition: !data.empty()
+  virtual Status UploadPart(size_t part_index, absl::string_view data) = 0;
+
+  // Completes the upload of num_parts parts. Called once, after all parts
+  // were uploaded successfully; a failed upload is not completed, so that
+  // the application can abort it.
+  virtual Status Complete(size_t num_parts) = 0;
+
+  // Returns a human readable name of the object, for failure messages.
+  virtual std::string Name() const = 0;
+
+ protected:
+  PartDest() {}
+};
+
+// Template parameter invariant part of MultipartWriter.
+class MultipartWriterBase : public BufferedWriter {
+ public:
+  class Options {
+   public:
+    Options() noexcept {}
+
+    // Sets the length of uploaded parts. A larger part length amortizes
+    // per-request latency of the destination; object stores typically also
+    // impose a minimum part length, e.g. 5M.
+    //
+    // Default: 8 << 20
+    static constexpr size_t kDefaultPartLength = size_t{8} << 20;
+    Options& set_part_length(size_t part_length) & {
+      RIEGELI_ASSERT_GT(part_length, 0u)
+          << "Failed precondition of "
+             "MultipartWriterBase::Options::set_part_length(): "
+             "zero part length";
+      part_length_ = part_length;
+      return *this;
+    }
+    Options&& set_part_length(size_t part_length) && {
+      return std::move(set_part_length(part_length));
+    }
+
+    // Sets the number of parts uploaded concurrently, overlapping upload
+    // latency with producing further data, e.g. with RecordWriter encoding
+    // the next chunks. When the limit is reached, writing the next part
+    // waits for the oldest upload. 0 uploads each part synchronously.
+    //
+    // Default: 4
+    Options& set_max_in_flight_parts(size_t max_in_flight_parts) & {
+      max_in_flight_parts_ = max_in_flight_parts;
+      return *this;
+    }
+    Options&& set_max_in_flight_parts(size_t max_in_flight_parts) && {
+      return std::move(set_max_in_flight_parts(max_in_flight_parts));
+    }
+
+    // Sets the buffer size which batches writes before they are appended to
+    // the part being assembled.
+    //
+    // Default: kDefaultBufferSize (64K)
+    Options& set_buffer_size(size_t buffer_size) & {
+      RIEGELI_ASSERT_GT(buffer_size, 0u)
+          << "Failed precondition of "
+             "MultipartWriterBase::Options::set_buffer_size(): "
+             "zero buffer size";
+      buffer_size_ = buffer_size;
+      return *this;
+    }
+    Options&& set_buffer_size(size_t buffer_size) && {
+      return std::move(set_buffer_size(buffer_size));
+    }
+
+   private:
+    template <typename Dest>
+    friend class MultipartWriter;
+
+    size_t part_length_ = kDefaultPartLength;
+    size_t max_in_flight_parts_ = 4;
+    size_t buffer_size_ = kDefaultBufferSize;
+  };
+
+  // Returns the PartDest being written to. Unchanged by Close().
+  virtual PartDest* dest_part_dest() const = 0;
+
+  // Waits until parts uploaded so far are stored. The part being assembled
+  // keeps accumulating, so durability is at the last part boundary; its data
+  // become durable when the part fills up or the MultipartWriter is closed.
+  bool Flush(FlushType flush_type) override;
+
+ protected:
+  // Creates a closed MultipartWriterBase.
+  MultipartWriterBase() noexcept {}
+
+  explicit MultipartWriterBase(size_t part_length, size_t max_in_flight_parts,
+                               size_t buffer_size);
+
+  MultipartWriterBase(MultipartWriterBase&& that) noexcept;
+  MultipartWriterBase& operator=(MultipartWriterBase&& that) noexcept;
+
+  void Done() override;
+
+  bool WriteInternal(absl::string_view src) override;
+
+  // Waits until no background upload is running. Must be called before the
+  // PartDest is destroyed, in particular from the destructor of a derived
+  // class if the Writer might not be closed first.
+  void SyncUploads();
+
+ private:
+  // An upload of one part running on a thread pool thread.
+  struct InFlightPart {
+    std::future<Status> future;
+  };
+
+  // Hands the assembled part over to a background upload. If
+  // max_in_flight_parts_ uploads are already running, waits for the oldest
+  // one first.
+  //
+  // Precondition: part_filled_ > 0
+  bool StartPartUpload();
+
+  // Waits for the oldest upload and fails the Writer if it failed.
+  bool HarvestOldestUpload();
+
+  // See Options::set_part_length().
+  size_t part_length_ = 0;
+  size_t max_in_flight_parts_ = 0;
+  // The part being assembled: the first part_filled_ bytes of part_buffer_.
+  // part_buffer_ is allocated lazily and released to the upload task.
+  //
+  // Invariant: part_filled_ < part_length_ unless closed()
+  std::unique_ptr<char[]> part_buffer_;
+  size_t part_filled_ = 0;
+  // The number of parts handed over to uploads so far, which is also the
+  // index of the next part.
+  size_t num_parts_ = 0;
+  // Uploads running in the background, oldest first.
+  std::deque<InFlightPart> in_flight_parts_;
+};
+
+// A Writer which writes to a PartDest, e.g. a multipart upload to remote
+// storage, splitting output into parts of Options::part_length() bytes.
+//
+// Up to Options::max_in_flight_parts() parts are uploaded concurrently while
+// the caller keeps producing data, overlapping upload latency with encoding.
+// Flush() waits for uploads of complete parts; Close() uploads the final
+// partial part and completes the upload.
+//
+// The Dest template parameter specifies the type of the object providing and
+// possibly owning the PartDest being written to. Dest must support
+// Dependency<PartDest*, Dest>, e.g. PartDest* (not owned, default),
+// std::unique_ptr<PartDest> (owned).
+template <typename Dest = PartDest*>
+class MultipartWriter : public MultipartWriterBase {
+ public:
+  // Creates a closed MultipartWriter.
+  MultipartWriter() noexcept {}
+
+  // Will write to the PartDest provided by dest.
+  explicit MultipartWriter(Dest dest, Options options = Options());
+
+  MultipartWriter(MultipartWriter&& that) noexcept;
+  MultipartWriter& operator=(MultipartWriter&& that) noexcept;
+
+  ~MultipartWriter();
+
+  // Returns the object providing and possibly owning the PartDest being
+  // written to. Unchanged by Close().
+  Dest& dest() { return dest_.manager(); }
+  const Dest& dest() const { return dest_.manager(); }
+  PartDest* dest_part_dest() const override { return dest_.get(); }
+
+ private:
+  // The object providing and possibly owning the PartDest being written to.
+  Dependency<PartDest*, Dest> dest_;
+};
+
+// Implementation details follow.
+
+inline MultipartWriterBase::MultipartWriterBase(size_t part_length,
+                                                size_t max_in_flight_parts,
+                                                size_t buffer_size)
+    : BufferedWriter(buffer_size),
+      part_length_(part_length),
+      max_in_flight_parts_(max_in_flight_parts) {}
+
+inline MultipartWriterBase::MultipartWriterBase(
+    MultipartWriterBase&& that) noexcept
+    : BufferedWriter(std::move(that)),
+      part_length_(absl::exchange(that.part_length_, 0)),
+      max_in_flight_parts_(absl::exchange(that.max_in_flight_parts_, 0)),
+      part_buffer_(std::move(that.part_buffer_)),
+      part_filled_(absl::exchange(that.part_filled_, 0)),
+      num_parts_(absl::exchange(that.num_parts_, 0)),
+      in_flight_parts_(std::move(that.in_flight_parts_)) {}
+
+inline MultipartWriterBase& MultipartWriterBase::operator=(
+    MultipartWriterBase&& that) noexcept {
+  SyncUploads();
+  BufferedWriter::operator=(std::move(that));
+  part_length_ = absl::exchange(that.part_length_, 0);
+  max_in_flight_parts_ = absl::exchange(that.max_in_flight_parts_, 0);
+  part_buffer_ = std::move(that.part_buffer_);
+  part_filled_ = absl::exchange(that.part_filled_, 0);
+  num_parts_ = absl::exchange(that.num_parts_, 0);
+  in_flight_parts_ = std::move(that.in_flight_parts_);
+  return *this;
+}
+
+template <typename Dest>
+MultipartWriter<Dest>::MultipartWriter(Dest dest, Options options)
+    : MultipartWriterBase(options.part_length_, options.max_in_flight_parts_,
+                          options.buffer_size_),
+      dest_(std::move(dest)) {
+  RIEGELI_ASSERT(dest_.get() != nullptr)
+      << "Failed precondition of MultipartWriter<Dest>::MultipartWriter(Dest): "
+         "null PartDest pointer";
+}
+
+template <typename Dest>
+inline MultipartWriter<Dest>::MultipartWriter(MultipartWriter&& that) noexcept
+    : MultipartWriterBase(std::move(that)), dest_(std::move(that.dest_)) {}
+
+template <typename Dest>
+inline MultipartWriter<Dest>& MultipartWriter<Dest>::operator=(
+    MultipartWriter&& that) noexcept {
+  MultipartWriterBase::operator=(std::move(that));
+  dest_ = std::move(that.dest_);
+  return *this;
+}
+
+template <typename Dest>
+MultipartWriter<Dest>::~MultipartWriter() {
+  SyncUploads();
+}
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_BYTES_MULTIPART_WRITER_H_
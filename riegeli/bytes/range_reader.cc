@@ -0,0 +1,152 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/bytes/range_reader.h"
+
+#include <stddef.h>
+
+#include <cstring>
+#include <future>
+#include <memory>
+#include <utility>
+
+#include "absl/base/optimization.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/parallelism.h"
+#include "riegeli/base/status.h"
+#include "riegeli/bytes/buffered_reader.h"
+
+namespace riegeli {
+
+void RangeReaderBase::Done() {
+  SyncFetches();
+  BufferedReader::Done();
+}
+
+void RangeReaderBase::Initialize() { size_ = src_range_source()->Size(); }
+
+bool RangeReaderBase::Size(Position* size) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  *size = size_;
+  return true;
+}
+
+void RangeReaderBase::SyncFetches() {
+  for (InFlightRange& range : in_flight_ranges_) {
+    // Wait for the fetch: its task uses the RangeSource, which the caller
+    // may be about to destroy.
+    if (range.future.valid()) range.future.wait();
+  }
+  in_flight_ranges_.clear();
+}
+
+inline void RangeReaderBase::ScheduleFetches() {
+  if (max_in_flight_ranges_ == 0) return;
+  RangeSource* const src = src_range_source();
+  Position next = in_flight_ranges_.empty()
+                      ? limit_pos_
+                      : in_flight_ranges_.back().begin +
+                            in_flight_ranges_.back().length;
+  while (in_flight_ranges_.size() < max_in_flight_ranges_ && next < size_) {
+    const size_t length = IntCast<size_t>(
+        UnsignedMin(Position{range_length_}, size_ - next));
+    std::promise<FetchResult>* const done = new std::promise<FetchResult>();
+    in_flight_ranges_.emplace_back();
+    InFlightRange& range = in_flight_ranges_.back();
+    range.begin = next;
+    range.length = length;
+    range.future = done->get_future();
+    internal::ThreadPool::global_io().Schedule([src, next, length, done] {
+      FetchResult result;
+      result.data = std::unique_ptr<char[]>(new char[length]);
+      result.status = src->ReadRange(next, length, result.data.get());
+      done->set_value(std::move(result));
+      delete done;
+    });
+    next += length;
+  }
+}
+
+bool RangeReaderBase::ReadInternal(char* dest, size_t min_length,
+                                   size_t max_length) {
+  RIEGELI_ASSERT_GT(min_length, 0u)
+      << "Failed precondition of BufferedReader::ReadInternal(): "
+         "nothing to read";
+  RIEGELI_ASSERT_GE(max_length, min_length)
+      << "Failed precondition of BufferedReader::ReadInternal(): "
+         "max_length < min_length";
+  RIEGELI_ASSERT(healthy())
+      << "Failed precondition of BufferedReader::ReadInternal(): " << status();
+  if (ABSL_PREDICT_FALSE(limit_pos_ >= size_)) return false;  // Object ends.
+  const size_t length =
+      IntCast<size_t>(UnsignedMin(Position{max_length}, size_ - limit_pos_));
+  Position pos = limit_pos_;
+  size_t remaining = length;
+  while (remaining > 0) {
+    if (!in_flight_ranges_.empty() &&
+        in_flight_ranges_.front().begin + in_flight_ranges_.front().consumed ==
+            pos) {
+      InFlightRange& range = in_flight_ranges_.front();
+      if (range.future.valid()) {
+        range.result = range.future.get();
+        if (ABSL_PREDICT_FALSE(!range.result.status.ok())) {
+          Status status = std::move(range.result.status);
+          in_flight_ranges_.pop_front();
+          return Fail(std::move(status));
+        }
+      }
+      const size_t available_length = range.length - range.consumed;
+      const size_t length_to_copy = UnsignedMin(remaining, available_length);
+      std::memcpy(dest, range.result.data.get() + range.consumed,
+                  length_to_copy);
+      range.consumed += length_to_copy;
+      dest += length_to_copy;
+      pos += length_to_copy;
+      remaining -= length_to_copy;
+      if (range.consumed == range.length) in_flight_ranges_.pop_front();
+    } else {
+      // Reading does not continue where prefetched ranges begin, e.g. after
+      // a seek.
+      SyncFetches();
+      // The remaining data are fetched with a single coalesced request.
+      Status status = src_range_source()->ReadRange(pos, remaining, dest);
+      if (ABSL_PREDICT_FALSE(!status.ok())) return Fail(std::move(status));
+      pos += remaining;
+      remaining = 0;
+    }
+  }
+  limit_pos_ = pos;
+  ScheduleFetches();
+  return length >= min_length;
+}
+
+bool RangeReaderBase::SeekSlow(Position new_pos) {
+  RIEGELI_ASSERT(new_pos < start_pos() || new_pos > limit_pos_)
+      << "Failed precondition of Reader::SeekSlow(): "
+         "position in the buffer, use Seek() instead";
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  ClearBuffer();
+  // Prefetched ranges follow the old position; reading from the new position
+  // will schedule new fetches.
+  SyncFetches();
+  if (ABSL_PREDICT_FALSE(new_pos > size_)) {
+    // Object ends.
+    limit_pos_ = size_;
+    return false;
+  }
+  limit_pos_ = new_pos;
+  return true;
+}
+
+}  // namespace riegeli
@@ -0,0 +1,270 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BYTES_RANGE_READER_H_
+#define RIEGELI_BYTES_RANGE_READER_H_
+
+#include <stddef.h>
+
+#include <deque>
+#include <future>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "absl/utility/utility.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/dependency.h"
+#include "riegeli/base/object.h"
+#include "riegeli/base/status.h"
+#include "riegeli/bytes/buffered_reader.h"
+
+namespace riegeli {
+
+// Interface to a source addressable by byte ranges, e.g. an object store
+// behind ranged HTTP GETs.
+//
+// Implementations must be thread safe: RangeReader fetches several ranges
+// concurrently.
+class RangeSource {
+ public:
+  virtual ~RangeSource() {}
+
+  // Returns the size of the object in bytes.
+  virtual Position Size() const = 0;
+
+  // Reads length bytes starting at pos into dest. A ranged request either
+  // returns the whole range or fails; there are no short reads.
+  //
+  // Preconditions:
+  //   length > 0
+  //   pos + length <= Size()
+  virtual Status ReadRange(Position pos, size_t length, char* dest) = 0;
+
+  // Returns a human readable name of the object, for failure messages.
+  virtual std::string Name() const = 0;
+
+ protected:
+  RangeSource() {}
+};
+
+// Template parameter invariant part of RangeReader.
+class RangeReaderBase : public BufferedReader {
+ public:
+  class Options {
+   public:
+    Options() noexcept {}
+
+    // Sets the length of ranges fetched from the source. Reads smaller than
+    // this are coalesced into requests of this length; reads larger than
+    // this are fetched with a single request. A larger range length
+    // amortizes per-request latency of the source; a smaller range length
+    // reduces wasted bytes when access is scattered.
+    //
+    // Default: 1 << 20
+    static constexpr size_t kDefaultRangeLength = size_t{1} << 20;
+    Options& set_range_length(size_t range_length) & {
+      RIEGELI_ASSERT_GT(range_length, 0u)
+          << "Failed precondition of "
+             "RangeReaderBase::Options::set_range_length(): "
+             "zero range length";
+      range_length_ = range_length;
+      return *this;
+    }
+    Options&& set_range_length(size_t range_length) && {
+      return std::move(set_range_length(range_length));
+    }
+
+    // Sets the number of ranges fetched concurrently ahead of the reading
+    // position, overlapping request latency with consuming the current
+    // range. 0 disables prefetching; each range is then fetched when
+    // reading reaches it.
+    //
+    // Prefetched ranges follow the reading position, so sequential access,
+    // e.g. a RecordReader scanning chunks, keeps the pipeline full; a seek
+    // discards prefetched ranges which do not match the new position.
+    //
+    // Default: 4
+    Options& set_max_in_flight_ranges(size_t max_in_flight_ranges) & {
+      max_in_flight_ranges_ = max_in_flight_ranges;
+      return *this;
+    }
+    Options&& set_max_in_flight_ranges(size_t max_in_flight_ranges) && {
+      return std::move(set_max_in_flight_ranges(max_in_flight_ranges));
+    }
+
+   private:
+    template <typename Src>
+    friend class RangeReader;
+
+    size_t range_length_ = kDefaultRangeLength;
+    size_t max_in_flight_ranges_ = 4;
+  };
+
+  // Returns the RangeSource being read from. Unchanged by Close().
+  virtual RangeSource* src_range_source() const = 0;
+
+  bool SupportsRandomAccess() const override { return true; }
+  bool Size(Position* size) override;
+
+ protected:
+  // Creates a closed RangeReaderBase.
+  RangeReaderBase() noexcept {}
+
+  explicit RangeReaderBase(size_t range_length, size_t max_in_flight_ranges);
+
+  RangeReaderBase(RangeReaderBase&& that) noexcept;
+  RangeReaderBase& operator=(RangeReaderBase&& that) noexcept;
+
+  void Done() override;
+
+  // Obtains the object size from the RangeSource.
+  void Initialize();
+
+  bool ReadInternal(char* dest, size_t min_length, size_t max_length) override;
+  bool SeekSlow(Position new_pos) override;
+
+  // Waits until no background fetch is running, and discards prefetched
+  // ranges. Must be called before the RangeSource is destroyed, in
+  // particular from the destructor of a derived class if the Reader might
+  // not be closed first.
+  void SyncFetches();
+
+ private:
+  // Result of fetching one range on a thread pool thread.
+  struct FetchResult {
+    Status status;
+    std::unique_ptr<char[]> data;
+  };
+
+  // A range being fetched, or fetched and partially consumed.
+  struct InFlightRange {
+    Position begin = 0;
+    size_t length = 0;
+    // Valid until the result is first needed, then moved to result.
+    std::future<FetchResult> future;
+    FetchResult result;
+    // Length of the prefix of the range already copied out.
+    //
+    // Invariant: consumed < length
+    size_t consumed = 0;
+  };
+
+  // Schedules fetches following the last in-flight range, or following
+  // limit_pos_ if none are in flight, until max_in_flight_ranges_ are in
+  // flight.
+  void ScheduleFetches();
+
+  // See Options::set_range_length(). Also the BufferedReader buffer size.
+  size_t range_length_ = 0;
+  size_t max_in_flight_ranges_ = 0;
+  // The size of the object, obtained once by Initialize().
+  Position size_ = 0;
+  // Ranges being fetched, at consecutive positions; the front range begins
+  // at the position reading will reach next, unless reading seeked away.
+  std::deque<InFlightRange> in_flight_ranges_;
+};
+
+// A Reader which reads from a RangeSource, e.g. an object in remote storage
+// addressed by ranged requests. It supports random access.
+//
+// Small reads are coalesced into requests of Options::range_length() bytes,
+// and up to Options::max_in_flight_ranges() ranges are fetched concurrently
+// ahead of the reading position, overlapping request latency with decoding.
+//
+// The Src template parameter specifies the type of the object providing and
+// possibly owning the RangeSource being read from. Src must support
+// Dependency<RangeSource*, Src>, e.g. RangeSource* (not owned, default),
+// std::unique_ptr<RangeSource> (owned).
+template <typename Src = RangeSource*>
+class RangeReader : public RangeReaderBase {
+ public:
+  // Creates a closed RangeReader.
+  RangeReader() noexcept {}
+
+  // Will read from the RangeSource provided by src.
+  explicit RangeReader(Src src, Options options = Options());
+
+  RangeReader(RangeReader&& that) noexcept;
+  RangeReader& operator=(RangeReader&& that) noexcept;
+
+  ~RangeReader();
+
+  // Returns the object providing and possibly owning the RangeSource being
+  // read from. Unchanged by Close().
+  Src& src() { return src_.manager(); }
+  const Src& src() const { return src_.manager(); }
+  RangeSource* src_range_source() const override { return src_.get(); }
+
+ private:
+  // The object providing and possibly owning the RangeSource being read from.
+  Dependency<RangeSource*, Src> src_;
+};
+
+// Implementation details follow.
+
+inline RangeReaderBase::RangeReaderBase(size_t range_length,
+                                        size_t max_in_flight_ranges)
+    : BufferedReader(range_length),
+      range_length_(range_length),
+      max_in_flight_ranges_(max_in_flight_ranges) {}
+
+inline RangeReaderBase::RangeReaderBase(RangeReaderBase&& that) noexcept
+    : BufferedReader(std::move(that)),
+      range_length_(absl::exchange(that.range_length_, 0)),
+      max_in_flight_ranges_(absl::exchange(that.max_in_flight_ranges_, 0)),
+      size_(absl::exchange(that.size_, 0)),
+      in_flight_ranges_(std::move(that.in_flight_ranges_)) {}
+
+inline RangeReaderBase& RangeReaderBase::operator=(
+    RangeReaderBase&& that) noexcept {
+  SyncFetches();
+  BufferedReader::operator=(std::move(that));
+  range_length_ = absl::exchange(that.range_length_, 0);
+  max_in_flight_ranges_ = absl::exchange(that.max_in_flight_ranges_, 0);
+  size_ = absl::exchange(that.size_, 0);
+  in_flight_ranges_ = std::move(that.in_flight_ranges_);
+  return *this;
+}
+
+template <typename Src>
+RangeReader<Src>::RangeReader(Src src, Options options)
+    : RangeReaderBase(options.range_length_, options.max_in_flight_ranges_),
+      src_(std::move(src)) {
+  RIEGELI_ASSERT(src_.get() != nullptr)
+      << "Failed precondition of RangeReader<Src>::RangeReader(Src): "
+         "null RangeSource pointer";
+  Initialize();
+}
+
+template <typename Src>
+inline RangeReader<Src>::RangeReader(RangeReader&& that) noexcept
+    : RangeReaderBase(std::move(that)), src_(std::move(that.src_)) {}
+
+template <typename Src>
+inline RangeReader<Src>& RangeReader<Src>::operator=(
+    RangeReader&& that) noexcept {
+  RangeReaderBase::operator=(std::move(that));
+  src_ = std::move(that.src_);
+  return *this;
+}
+
+template <typename Src>
+RangeReader<Src>::~RangeReader() {
+  SyncFetches();
+}
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_BYTES_RANGE_READER_H_
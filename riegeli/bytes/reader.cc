@@ -47,6 +47,20 @@ bool Reader::FailOverflow() {
   return Fail(ResourceExhaustedError("Reader position overflow"));
 }
 
+void Reader::ReadHintSlow(size_t length) {
+  RIEGELI_ASSERT_GT(length, available())
+      << "Failed precondition of Reader::ReadHintSlow(): "
+         "enough data available, use ReadHint() instead";
+}
+
+bool Reader::PullSlow(size_t min_length) {
+  RIEGELI_ASSERT_GT(min_length, available())
+      << "Failed precondition of Reader::PullSlow(size_t): "
+         "enough data available, use Pull(size_t) instead";
+  if (available() == 0 && ABSL_PREDICT_FALSE(!PullSlow())) return false;
+  return available() >= min_length;
+}
+
 bool Reader::ReadSlow(char* dest, size_t length) {
   RIEGELI_ASSERT_GT(length, available())
       << "Failed precondition of Reader::ReadSlow(char*): "
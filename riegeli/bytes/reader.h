@@ -72,6 +72,29 @@ class Reader : public Object {
   //  * false (when !healthy()) - failure (available() == 0)
   bool Pull();
 
+  // Ensures that at least min_length contiguous bytes are available for
+  // reading, so that e.g. a fixed-size header can be parsed directly from
+  // cursor(). If enough data were already buffered, does nothing. This can
+  // move buffered data, which invalidates previous pointers into the buffer.
+  //
+  // Returns false also if the Reader cannot provide min_length bytes
+  // contiguously even though the source does not end there, e.g. because it
+  // exposes data in fixed blocks; the caller should then fall back to Read()
+  // into a local buffer. BufferedReader compacts data across buffer
+  // boundaries, hence for it false means that the source ends or the Reader
+  // failed, like for Pull().
+  //
+  // Return values:
+  //  * true  - success (available() >= min_length)
+  //  * false - the bytes could not be made available contiguously
+  bool Pull(size_t min_length);
+
+  // Hints that about length bytes from the current position will be read
+  // sequentially soon. The Reader may start prefetching them, e.g. by
+  // advising the operating system; the hint has no effect on data read. If
+  // length bytes are already buffered, does nothing.
+  void ReadHint(size_t length);
+
   // Buffer pointers. Data between start() and limit() are available for
   // reading, with cursor() pointing to the current position.
   //
@@ -146,6 +169,29 @@ class Reader : public Object {
   bool CopyTo(Writer* dest, Position length);
   bool CopyTo(BackwardWriter* dest, size_t length);
 
+  // Reads up to max_length bytes in place: points dest to the next available
+  // bytes in the Reader's storage and advances over them, without copying.
+  // The region is non-empty on success; reading a fixed length needs a loop.
+  //
+  // Unless SupportsStableViews() is true, *dest is valid only until the next
+  // operation on the Reader which reads, seeks, closes, or moves it. If
+  // SupportsStableViews() is true, *dest remains valid as long as the
+  // underlying storage: for ChainReader as long as the Chain is alive, for
+  // FdMMapReader until it is closed.
+  //
+  // Precondition: max_length > 0
+  //
+  // Return values:
+  //  * true                    - success (*dest is not empty)
+  //  * false (when healthy())  - source ends
+  //  * false (when !healthy()) - failure
+  bool ReadZeroCopy(absl::string_view* dest, size_t max_length);
+
+  // Returns true if regions returned by ReadZeroCopy() remain valid as long
+  // as the underlying storage, not only until the next operation on the
+  // Reader.
+  virtual bool SupportsStableViews() const { return false; }
+
   // Reads all remaining bytes from the buffer and the source to dest.
   //
   // ReadAll(string*) and ReadAll(Chain*) append to any
@@ -246,6 +292,25 @@ class Reader : public Object {
   // Precondition: available() == 0
   virtual bool PullSlow() = 0;
 
+  // Implementation of the slow part of Pull(size_t).
+  //
+  // The default implementation pulls with PullSlow() if no data are buffered,
+  // and succeeds if the buffer covers min_length. This is sufficient for
+  // sources which buffer all remaining data contiguously; sources which can
+  // provide more contiguous data by extending or compacting the buffer should
+  // override it.
+  //
+  // Precondition: min_length > available()
+  virtual bool PullSlow(size_t min_length);
+
+  // Implementation of the slow part of ReadHint().
+  //
+  // The default implementation does nothing. Sources which can prefetch data
+  // cheaply should override it.
+  //
+  // Precondition: length > available()
+  virtual void ReadHintSlow(size_t length);
+
   // Implementations of the slow part of Read() and CopyTo().
   //
   // By default ReadSlow(char*) and CopyToSlow(Writer*) are implemented in terms
@@ -323,6 +388,16 @@ inline bool Reader::Pull() {
   return PullSlow();
 }
 
+inline bool Reader::Pull(size_t min_length) {
+  if (ABSL_PREDICT_TRUE(available() >= min_length)) return true;
+  return PullSlow(min_length);
+}
+
+inline void Reader::ReadHint(size_t length) {
+  if (ABSL_PREDICT_TRUE(length <= available())) return;
+  ReadHintSlow(length);
+}
+
 inline void Reader::set_cursor(const char* cursor) {
   RIEGELI_ASSERT(cursor >= start())
       << "Failed precondition of Reader::set_cursor(): pointer out of range";
@@ -382,6 +457,16 @@ inline bool Reader::Read(Chain* dest, size_t length) {
   return ReadSlow(dest, length);
 }
 
+inline bool Reader::ReadZeroCopy(absl::string_view* dest, size_t max_length) {
+  RIEGELI_ASSERT_GT(max_length, 0u)
+      << "Failed precondition of Reader::ReadZeroCopy(): nothing to read";
+  if (ABSL_PREDICT_FALSE(!Pull())) return false;
+  const size_t length = UnsignedMin(max_length, available());
+  *dest = absl::string_view(cursor_, length);
+  cursor_ += length;
+  return true;
+}
+
 inline bool Reader::CopyTo(Writer* dest, Position length) {
   if (ABSL_PREDICT_TRUE(length <= available() && length <= kMaxBytesToCopy)) {
     const absl::string_view data(cursor_, IntCast<size_t>(length));
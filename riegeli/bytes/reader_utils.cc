@@ -14,12 +14,214 @@
 
 #include "riegeli/bytes/reader_utils.h"
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include <cstring>
+#include <string>
+
 #include "absl/base/optimization.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/endian.h"
 #include "riegeli/bytes/reader.h"
 
 namespace riegeli {
+
+namespace {
+
+// Returns a pointer to the first '\n' in [src..limit), or nullptr.
+inline const char* FindNewline(const char* src, const char* limit) {
+  return static_cast<const char*>(
+      std::memchr(src, '\n', PtrDistance(src, limit)));
+}
+
+}  // namespace
+
+bool ReadLine(Reader* src, absl::string_view* dest, std::string* scratch) {
+  if (ABSL_PREDICT_FALSE(!src->Pull())) {
+    *dest = absl::string_view();
+    return false;
+  }
+  const char* newline = FindNewline(src->cursor(), src->limit());
+  if (ABSL_PREDICT_TRUE(newline != nullptr)) {
+    // The whole line is in the buffer; no copying needed.
+    *dest = absl::string_view(src->cursor(),
+                              PtrDistance(src->cursor(), newline));
+    src->set_cursor(newline + 1);
+    return true;
+  }
+  // The line continues past the buffer; accumulate it in *scratch.
+  scratch->clear();
+  for (;;) {
+    scratch->append(src->cursor(), src->available());
+    src->set_cursor(src->limit());
+    if (ABSL_PREDICT_FALSE(!src->Pull())) break;  // The line is terminated by
+                                                  // the end of data.
+    newline = FindNewline(src->cursor(), src->limit());
+    if (newline != nullptr) {
+      scratch->append(src->cursor(), PtrDistance(src->cursor(), newline));
+      src->set_cursor(newline + 1);
+      break;
+    }
+  }
+  *dest = *scratch;
+  return true;
+}
+
+bool ReadLine(Reader* src, std::string* dest) {
+  absl::string_view result;
+  if (ABSL_PREDICT_FALSE(!ReadLine(src, &result, dest))) {
+    dest->clear();
+    return false;
+  }
+  if (result.data() != dest->data()) dest->assign(result.data(), result.size());
+  return true;
+}
+
+namespace {
+
+#if RIEGELI_INTERNAL_LITTLE_ENDIAN && defined(__GNUC__)
+
+// Masks of the continuation bits and of the payload bits of 8 varint bytes
+// loaded into a 64-bit word.
+constexpr uint64_t kContinuationBits = 0x8080808080808080;
+constexpr uint64_t kPayloadBits = 0x7f7f7f7f7f7f7f7f;
+
+// Compacts up to eight 7-bit payload groups of word, with continuation bits
+// already cleared, into the low 56 bits.
+inline uint64_t CompactVarintWord(uint64_t word) {
+  word = (word & 0x007f007f007f007f) | ((word & 0x7f007f007f007f00) >> 1);
+  word = (word & 0x00003fff00003fff) | ((word & 0x3fff00003fff0000) >> 2);
+  word = (word & 0x000000000fffffff) | ((word & 0x0fffffff00000000) >> 4);
+  return word;
+}
+
+#endif
+
+// Decodes one varint, assuming at least sizeof(uint64_t) bytes of data at
+// src[] are available. On a Little Endian host a 64-bit word locates the end
+// of the varint and compacts the payload bits in parallel instead of a
+// byte-wise loop; varints longer than 8 bytes are rare and are delegated to
+// ReadVarint64().
+inline bool ReadOneVarint64(const char** src, uint64_t* data) {
+#if RIEGELI_INTERNAL_LITTLE_ENDIAN && defined(__GNUC__)
+  uint64_t word;
+  std::memcpy(&word, *src, sizeof(word));
+  if (ABSL_PREDICT_TRUE((word & 0x80) == 0)) {
+    *data = word & 0x7f;
+    ++*src;
+    return true;
+  }
+  const uint64_t last_bytes = ~word & kContinuationBits;
+  if (ABSL_PREDICT_FALSE(last_bytes == 0)) {
+    // The representation is 9 or 10 bytes, or invalid.
+    return ReadVarint64(src, data);
+  }
+  const size_t length =
+      static_cast<size_t>(__builtin_ctzll(last_bytes) + 1) / 8;
+  word &= ~uint64_t{0} >> (64 - 8 * length);
+  *data = CompactVarintWord(word & kPayloadBits);
+  *src += length;
+  return true;
+#else
+  return ReadVarint64(src, data);
+#endif
+}
+
+// Decodes one varint, assuming at least sizeof(uint64_t) bytes of data at
+// src[] are available, like ReadOneVarint64() but for uint32_t.
+inline bool ReadOneVarint32(const char** src, uint32_t* data) {
+#if RIEGELI_INTERNAL_LITTLE_ENDIAN && defined(__GNUC__)
+  uint64_t word;
+  std::memcpy(&word, *src, sizeof(word));
+  if (ABSL_PREDICT_TRUE((word & 0x80) == 0)) {
+    *data = static_cast<uint32_t>(word & 0x7f);
+    ++*src;
+    return true;
+  }
+  const uint64_t last_bytes = ~word & kContinuationBits;
+  if (ABSL_PREDICT_FALSE(last_bytes == 0)) {
+    // The representation is longer than kMaxLengthVarint32; ReadVarint32()
+    // reports this exactly.
+    return ReadVarint32(src, data);
+  }
+  const size_t length =
+      static_cast<size_t>(__builtin_ctzll(last_bytes) + 1) / 8;
+  if (ABSL_PREDICT_FALSE(length > kMaxLengthVarint32)) {
+    return ReadVarint32(src, data);
+  }
+  word &= ~uint64_t{0} >> (64 - 8 * length);
+  const uint64_t acc = CompactVarintWord(word & kPayloadBits);
+  if (ABSL_PREDICT_FALSE((acc >> 32) != 0)) {
+    // The represented value does not fit in uint32_t; ReadVarint32() reports
+    // this exactly.
+    return ReadVarint32(src, data);
+  }
+  *data = static_cast<uint32_t>(acc);
+  *src += length;
+  return true;
+#else
+  return ReadVarint32(src, data);
+#endif
+}
+
+}  // namespace
+
+bool ReadVarint32s(Reader* src, uint32_t* dest, size_t count) {
+  while (count > 0) {
+    // Decode values which certainly lie within the buffer without checking
+    // bounds for each byte. Each value may load a word of 8 bytes but
+    // consumes at most kMaxLengthVarint32 of them, so dividing by
+    // sizeof(uint64_t) leaves a full word available for each value.
+    size_t safe = UnsignedMin(count, src->available() / sizeof(uint64_t));
+    if (ABSL_PREDICT_FALSE(safe == 0)) {
+      // Near the end of the buffer or of the source.
+      if (ABSL_PREDICT_FALSE(!ReadVarint32(src, dest))) return false;
+      ++dest;
+      --count;
+      continue;
+    }
+    count -= safe;
+    const char* cursor = src->cursor();
+    do {
+      if (ABSL_PREDICT_FALSE(!ReadOneVarint32(&cursor, dest))) {
+        src->set_cursor(cursor);
+        return false;
+      }
+      ++dest;
+    } while (--safe > 0);
+    src->set_cursor(cursor);
+  }
+  return true;
+}
+
+bool ReadVarint64s(Reader* src, uint64_t* dest, size_t count) {
+  while (count > 0) {
+    // Decode values which certainly lie within the buffer without checking
+    // bounds for each byte. Each value consumes at most kMaxLengthVarint64
+    // bytes, which also covers the word of 8 bytes it may load.
+    size_t safe = UnsignedMin(count, src->available() / kMaxLengthVarint64);
+    if (ABSL_PREDICT_FALSE(safe == 0)) {
+      // Near the end of the buffer or of the source.
+      if (ABSL_PREDICT_FALSE(!ReadVarint64(src, dest))) return false;
+      ++dest;
+      --count;
+      continue;
+    }
+    count -= safe;
+    const char* cursor = src->cursor();
+    do {
+      if (ABSL_PREDICT_FALSE(!ReadOneVarint64(&cursor, dest))) {
+        src->set_cursor(cursor);
+        return false;
+      }
+      ++dest;
+    } while (--safe > 0);
+    src->set_cursor(cursor);
+  }
+  return true;
+}
+
 namespace internal {
 
 bool ReadVarint32Slow(Reader* src, uint32_t* data) {
@@ -15,9 +15,13 @@
 #ifndef RIEGELI_BYTES_READER_UTILS_H_
 #define RIEGELI_BYTES_READER_UTILS_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include <string>
+
 #include "absl/base/optimization.h"
+#include "absl/strings/string_view.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/bytes/varint.h"
 
@@ -25,6 +29,23 @@ namespace riegeli {
 
 bool ReadByte(Reader* src, uint8_t* data);
 
+// Reads a line from src. A line is terminated by '\n' or by the end of data;
+// the terminator is consumed but excluded from the result. A '\r' before the
+// '\n' is not treated specially. The delimiter scan uses memchr(), which
+// makes it vectorized on common platforms.
+//
+// ReadLine(string_view*) avoids copying: if the whole line is available in
+// the Reader's buffer then *dest points directly into the buffer and is valid
+// until the next operation on the Reader, otherwise the line is accumulated
+// in *scratch and *dest points to *scratch.
+//
+// Return values:
+//  * true  - success (*dest is set, possibly to an empty line)
+//  * false - end of data before any byte was read, or failure (*dest is
+//            empty)
+bool ReadLine(Reader* src, absl::string_view* dest, std::string* scratch);
+bool ReadLine(Reader* src, std::string* dest);
+
 // {Read,Copy}Varint{32,64}() tolerate representations which are not the
 // shortest. They reject representations longer than kMaxLengthVarint{32,64}
 // bytes or with bits set outside the range of possible values.
@@ -42,6 +63,17 @@ bool ReadVarint64(const char** src, uint64_t* data);
 bool ReadVarint32(Reader* src, uint32_t* data);
 bool ReadVarint64(Reader* src, uint64_t* data);
 
+// Read count varints in a row, e.g. an array of record sizes.
+//
+// Faster than calling ReadVarint{32,64}() per value: bounds checks are
+// amortized over whole buffers, and within a buffer short varints are decoded
+// a word at a time instead of a byte at a time.
+//
+// Return false if reading any value failed; some values may have been stored
+// and the reading position is then unspecified.
+bool ReadVarint32s(Reader* src, uint32_t* dest, size_t count);
+bool ReadVarint64s(Reader* src, uint64_t* dest, size_t count);
+
 // Variants which accept only the canonical representation, i.e. the shortest:
 // rejecting a trailing zero byte, except for 0 itself.
 bool ReadCanonicalVarint32(Reader* src, uint32_t* data);
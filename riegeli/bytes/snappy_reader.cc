@@ -0,0 +1,87 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/bytes/snappy_reader.h"
+
+#include <stdint.h>
+
+#include <memory>
+#include <utility>
+
+#include "absl/base/optimization.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/canonical_errors.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/bytes/chain_reader.h"
+#include "riegeli/bytes/chain_writer.h"
+#include "riegeli/bytes/reader.h"
+#include "riegeli/bytes/reader_utils.h"
+#include "riegeli/bytes/snappy_streams.h"
+#include "snappy.h"
+
+namespace riegeli {
+
+void SnappyReaderBase::Initialize(Reader* src) {
+  RIEGELI_ASSERT(src != nullptr)
+      << "Failed precondition of SnappyReader<Src>::SnappyReader(Src): "
+         "null Reader pointer";
+  if (ABSL_PREDICT_FALSE(!src->healthy())) {
+    Fail(*src);
+    return;
+  }
+  // Read the whole compressed stream ahead. Snappy is not a streaming
+  // compression format, and the whole uncompressed contents are materialized
+  // anyway.
+  Chain compressed;
+  while (src->Pull()) {
+    if (ABSL_PREDICT_FALSE(!src->Read(&compressed, src->available()))) break;
+  }
+  if (ABSL_PREDICT_FALSE(!src->healthy())) {
+    Fail(*src);
+    return;
+  }
+  // The compressed stream begins with the uncompressed size as a varint; use
+  // it as a size hint so that the uncompressed Chain is allocated at once.
+  uint64_t uncompressed_size = 0;
+  {
+    ChainReader<> length_reader(&compressed);
+    if (ABSL_PREDICT_FALSE(!ReadVarint64(&length_reader, &uncompressed_size))) {
+      uncompressed_size = 0;
+    }
+  }
+  Chain uncompressed;
+  ChainReader<> compressed_reader(&compressed);
+  internal::ReaderSnappySource source(&compressed_reader, compressed.size());
+  ChainWriter<> uncompressed_writer(
+      &uncompressed, ChainWriterBase::Options().set_size_hint(
+                         Position{uncompressed_size}));
+  internal::WriterSnappySink sink(&uncompressed_writer);
+  if (ABSL_PREDICT_FALSE(!snappy::Uncompress(&source, &sink))) {
+    Fail(DataLossError("Invalid snappy-compressed stream"));
+    return;
+  }
+  if (ABSL_PREDICT_FALSE(!uncompressed_writer.Close())) {
+    Fail(uncompressed_writer);
+    return;
+  }
+  // SnappyReaderBase derives from ChainReader<Chain> but the Chain to read
+  // from was not known in the constructor. This sets the Chain and updates
+  // ChainReader to read from it.
+  ChainReader::operator=(ChainReader(std::move(uncompressed)));
+}
+
+template class SnappyReader<Reader*>;
+template class SnappyReader<std::unique_ptr<Reader>>;
+
+}  // namespace riegeli
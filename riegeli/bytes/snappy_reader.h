@@ -0,0 +1,150 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BYTES_SNAPPY_READER_H_
+#define RIEGELI_BYTES_SNAPPY_READER_H_
+
+#include <memory>
+#include <utility>
+
+#include "absl/base/optimization.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/dependency.h"
+#include "riegeli/base/object.h"
+#include "riegeli/bytes/chain_reader.h"
+#include "riegeli/bytes/reader.h"
+
+namespace riegeli {
+
+// Template parameter invariant part of SnappyReader.
+class SnappyReaderBase : public ChainReader<Chain> {
+ public:
+  // Returns the compressed Reader. Unchanged by Close().
+  virtual Reader* src_reader() = 0;
+  virtual const Reader* src_reader() const = 0;
+
+ protected:
+  SnappyReaderBase() noexcept {}
+
+  // Opened with the uncompressed data not known yet. Initialize() reads and
+  // decompresses the whole source and updates the ChainReader to read from
+  // the result.
+  explicit SnappyReaderBase(State state);
+
+  SnappyReaderBase(SnappyReaderBase&& that) noexcept;
+  SnappyReaderBase& operator=(SnappyReaderBase&& that) noexcept;
+
+  void Initialize(Reader* src);
+};
+
+// A Reader which decompresses data with Snappy after getting it from another
+// Reader.
+//
+// Snappy is not a streaming compression format; the whole compressed stream
+// is read and decompressed when the SnappyReader is opened, and uncompressed
+// data are then served from memory. This supports random access.
+//
+// The Src template parameter specifies the type of the object providing and
+// possibly owning the compressed Reader. Src must support
+// Dependency<Reader*, Src>, e.g. Reader* (not owned, default),
+// unique_ptr<Reader> (owned), ChainReader<> (owned).
+//
+// The compressed Reader must not be accessed until the SnappyReader is closed
+// or no longer used.
+template <typename Src = Reader*>
+class SnappyReader : public SnappyReaderBase {
+ public:
+  // Creates a closed SnappyReader.
+  SnappyReader() noexcept {}
+
+  // Will read from the compressed Reader provided by src.
+  explicit SnappyReader(Src src);
+
+  SnappyReader(SnappyReader&& that) noexcept;
+  SnappyReader& operator=(SnappyReader&& that) noexcept;
+
+  // Returns the object providing and possibly owning the compressed Reader.
+  // Unchanged by Close().
+  Src& src() { return src_.manager(); }
+  const Src& src() const { return src_.manager(); }
+  Reader* src_reader() override { return src_.get(); }
+  const Reader* src_reader() const override { return src_.get(); }
+
+ protected:
+  void Done() override;
+  void VerifyEnd() override;
+
+ private:
+  // The object providing and possibly owning the compressed Reader.
+  Dependency<Reader*, Src> src_;
+};
+
+// Implementation details follow.
+
+inline SnappyReaderBase::SnappyReaderBase(State state)
+    // Empty Chain here is a placeholder, it will be replaced in Initialize().
+    : ChainReader(Chain()) {
+  RIEGELI_ASSERT(state == State::kOpen)
+      << "Failed precondition of SnappyReaderBase::SnappyReaderBase(State): "
+         "state must be kOpen";
+}
+
+inline SnappyReaderBase::SnappyReaderBase(SnappyReaderBase&& that) noexcept
+    : ChainReader(std::move(that)) {}
+
+inline SnappyReaderBase& SnappyReaderBase::operator=(
+    SnappyReaderBase&& that) noexcept {
+  ChainReader::operator=(std::move(that));
+  return *this;
+}
+
+template <typename Src>
+inline SnappyReader<Src>::SnappyReader(Src src)
+    : SnappyReaderBase(State::kOpen), src_(std::move(src)) {
+  Initialize(src_.get());
+}
+
+template <typename Src>
+inline SnappyReader<Src>::SnappyReader(SnappyReader&& that) noexcept
+    : SnappyReaderBase(std::move(that)), src_(std::move(that.src_)) {}
+
+template <typename Src>
+inline SnappyReader<Src>& SnappyReader<Src>::operator=(
+    SnappyReader&& that) noexcept {
+  SnappyReaderBase::operator=(std::move(that));
+  src_ = std::move(that.src_);
+  return *this;
+}
+
+template <typename Src>
+void SnappyReader<Src>::Done() {
+  SnappyReaderBase::Done();
+  if (src_.is_owning()) {
+    if (ABSL_PREDICT_FALSE(!src_->Close())) Fail(*src_);
+  }
+}
+
+template <typename Src>
+void SnappyReader<Src>::VerifyEnd() {
+  SnappyReaderBase::VerifyEnd();
+  if (src_.is_owning() && ABSL_PREDICT_TRUE(healthy())) src_->VerifyEnd();
+}
+
+extern template class SnappyReader<Reader*>;
+extern template class SnappyReader<std::unique_ptr<Reader>>;
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_BYTES_SNAPPY_READER_H_
@@ -0,0 +1,70 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/bytes/snappy_streams.h"
+
+#include <stddef.h>
+
+#include <limits>
+
+#include "absl/base/optimization.h"
+#include "absl/strings/string_view.h"
+#include "riegeli/base/base.h"
+#include "riegeli/bytes/reader.h"
+#include "riegeli/bytes/writer.h"
+
+namespace riegeli {
+namespace internal {
+
+void WriterSnappySink::Append(const char* src, size_t length) {
+  if (src == dest_->cursor()) {
+    // Appending the result of GetAppendBuffer(): the data are already in
+    // place, it remains to commit them.
+    RIEGELI_ASSERT_LE(length, dest_->available())
+        << "Failed precondition of snappy::Sink::Append(): "
+           "length longer than the buffer returned by GetAppendBuffer()";
+    dest_->set_cursor(dest_->cursor() + length);
+    return;
+  }
+  dest_->Write(absl::string_view(src, length));
+}
+
+char* WriterSnappySink::GetAppendBuffer(size_t length, char* scratch) {
+  if (ABSL_PREDICT_TRUE(dest_->Push()) && dest_->available() >= length) {
+    return dest_->cursor();
+  }
+  return scratch;
+}
+
+size_t ReaderSnappySource::Available() const {
+  return UnsignedMin(remaining_,
+                     Position{std::numeric_limits<size_t>::max()});
+}
+
+const char* ReaderSnappySource::Peek(size_t* length) {
+  if (ABSL_PREDICT_FALSE(remaining_ == 0 || !src_->Pull())) {
+    *length = 0;
+    return nullptr;
+  }
+  *length = UnsignedMin(src_->available(), remaining_);
+  return src_->cursor();
+}
+
+void ReaderSnappySource::Skip(size_t length) {
+  remaining_ -= UnsignedMin(length, remaining_);
+  src_->Skip(length);
+}
+
+}  // namespace internal
+}  // namespace riegeli
@@ -0,0 +1,65 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BYTES_SNAPPY_STREAMS_H_
+#define RIEGELI_BYTES_SNAPPY_STREAMS_H_
+
+#include <stddef.h>
+
+#include "riegeli/base/base.h"
+#include "riegeli/bytes/reader.h"
+#include "riegeli/bytes/writer.h"
+#include "snappy-sinksource.h"
+
+namespace riegeli {
+namespace internal {
+
+// Adapts a Writer to a snappy::Sink.
+//
+// If the Writer fails, the sink silently discards further data; the caller
+// should check the health of the Writer afterwards.
+class WriterSnappySink : public snappy::Sink {
+ public:
+  explicit WriterSnappySink(Writer* dest) : dest_(dest) {}
+
+  void Append(const char* src, size_t length) override;
+  char* GetAppendBuffer(size_t length, char* scratch) override;
+
+ private:
+  Writer* dest_;
+};
+
+// Adapts a Reader to a snappy::Source.
+//
+// The size of the source must be known in advance. If the Reader fails or
+// ends prematurely, the source appears exhausted; the caller should check the
+// health of the Reader afterwards.
+class ReaderSnappySource : public snappy::Source {
+ public:
+  explicit ReaderSnappySource(Reader* src, Position size)
+      : src_(src), remaining_(size) {}
+
+  size_t Available() const override;
+  const char* Peek(size_t* length) override;
+  void Skip(size_t length) override;
+
+ private:
+  Reader* src_;
+  Position remaining_;
+};
+
+}  // namespace internal
+}  // namespace riegeli
+
+#endif  // RIEGELI_BYTES_SNAPPY_STREAMS_H_
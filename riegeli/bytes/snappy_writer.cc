@@ -0,0 +1,162 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/bytes/snappy_writer.h"
+
+#include <stddef.h>
+
+#include <limits>
+#include <string>
+#include <utility>
+
+#include "absl/base/optimization.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/canonical_errors.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/bytes/chain_reader.h"
+#include "riegeli/bytes/snappy_streams.h"
+#include "riegeli/bytes/writer.h"
+#include "snappy.h"
+
+namespace riegeli {
+
+void SnappyWriterBase::Initialize(Writer* dest) {
+  RIEGELI_ASSERT(dest != nullptr)
+      << "Failed precondition of SnappyWriter<Dest>::SnappyWriter(Dest): "
+         "null Writer pointer";
+  if (ABSL_PREDICT_FALSE(!dest->healthy())) Fail(*dest);
+}
+
+void SnappyWriterBase::Done() {
+  if (ABSL_PREDICT_TRUE(healthy())) {
+    SyncBuffer();
+    Writer* const dest = dest_writer();
+    ChainReader<> uncompressed_reader(&uncompressed_);
+    internal::ReaderSnappySource source(&uncompressed_reader,
+                                        uncompressed_.size());
+    internal::WriterSnappySink sink(dest);
+    snappy::Compress(&source, &sink);
+    if (ABSL_PREDICT_FALSE(!dest->healthy())) Fail(*dest);
+  }
+  uncompressed_ = Chain();
+  Writer::Done();
+}
+
+bool SnappyWriterBase::Flush(FlushType flush_type) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  // Snappy is not a streaming compression format; the whole uncompressed
+  // contents are compressed to the destination only on Close().
+  return Fail(UnimplementedError("SnappyWriter does not support Flush()"));
+}
+
+bool SnappyWriterBase::PushSlow() {
+  RIEGELI_ASSERT_EQ(available(), 0u)
+      << "Failed precondition of Writer::PushSlow(): "
+         "space available, use Push() instead";
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  if (ABSL_PREDICT_FALSE(uncompressed_.size() ==
+                         std::numeric_limits<size_t>::max())) {
+    return FailOverflow();
+  }
+  start_pos_ = pos();
+  MakeBuffer(1);
+  return true;
+}
+
+bool SnappyWriterBase::WriteSlow(absl::string_view src) {
+  RIEGELI_ASSERT_GT(src.size(), available())
+      << "Failed precondition of Writer::WriteSlow(string_view): "
+         "length too small, use Write(string_view) instead";
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  if (ABSL_PREDICT_FALSE(src.size() > std::numeric_limits<size_t>::max() -
+                                          IntCast<size_t>(pos()))) {
+    return FailOverflow();
+  }
+  SyncBuffer();
+  start_pos_ += src.size();
+  uncompressed_.Append(src, size_hint_);
+  MakeBuffer();
+  return true;
+}
+
+bool SnappyWriterBase::WriteSlow(std::string&& src) {
+  RIEGELI_ASSERT_GT(src.size(), UnsignedMin(available(), kMaxBytesToCopy))
+      << "Failed precondition of Writer::WriteSlow(string&&): "
+         "length too small, use Write(string&&) instead";
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  if (ABSL_PREDICT_FALSE(src.size() > std::numeric_limits<size_t>::max() -
+                                          IntCast<size_t>(pos()))) {
+    return FailOverflow();
+  }
+  SyncBuffer();
+  start_pos_ += src.size();
+  uncompressed_.Append(std::move(src), size_hint_);
+  MakeBuffer();
+  return true;
+}
+
+bool SnappyWriterBase::WriteSlow(const Chain& src) {
+  RIEGELI_ASSERT_GT(src.size(), UnsignedMin(available(), kMaxBytesToCopy))
+      << "Failed precondition of Writer::WriteSlow(Chain): "
+         "length too small, use Write(Chain) instead";
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  if (ABSL_PREDICT_FALSE(src.size() > std::numeric_limits<size_t>::max() -
+                                          IntCast<size_t>(pos()))) {
+    return FailOverflow();
+  }
+  SyncBuffer();
+  start_pos_ += src.size();
+  uncompressed_.Append(src, size_hint_);
+  MakeBuffer();
+  return true;
+}
+
+bool SnappyWriterBase::WriteSlow(Chain&& src) {
+  RIEGELI_ASSERT_GT(src.size(), UnsignedMin(available(), kMaxBytesToCopy))
+      << "Failed precondition of Writer::WriteSlow(Chain&&): "
+         "length too small, use Write(Chain&&) instead";
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  if (ABSL_PREDICT_FALSE(src.size() > std::numeric_limits<size_t>::max() -
+                                          IntCast<size_t>(pos()))) {
+    return FailOverflow();
+  }
+  SyncBuffer();
+  start_pos_ += src.size();
+  uncompressed_.Append(std::move(src), size_hint_);
+  MakeBuffer();
+  return true;
+}
+
+inline void SnappyWriterBase::SyncBuffer() {
+  start_pos_ = pos();
+  uncompressed_.RemoveSuffix(available());
+  start_ = nullptr;
+  cursor_ = nullptr;
+  limit_ = nullptr;
+}
+
+inline void SnappyWriterBase::MakeBuffer(size_t min_length) {
+  const absl::Span<char> buffer = uncompressed_.AppendBuffer(
+      min_length, min_length, Chain::kAnyLength, size_hint_);
+  start_ = buffer.data();
+  cursor_ = start_;
+  limit_ = start_ + buffer.size();
+}
+
+template class SnappyWriter<Writer*>;
+template class SnappyWriter<std::unique_ptr<Writer>>;
+
+}  // namespace riegeli
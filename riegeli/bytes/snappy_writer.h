@@ -0,0 +1,197 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BYTES_SNAPPY_WRITER_H_
+#define RIEGELI_BYTES_SNAPPY_WRITER_H_
+
+#include <stddef.h>
+
+#include <limits>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "absl/base/optimization.h"
+#include "absl/strings/string_view.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/dependency.h"
+#include "riegeli/bytes/writer.h"
+
+namespace riegeli {
+
+// Template parameter invariant part of SnappyWriter.
+class SnappyWriterBase : public Writer {
+ public:
+  class Options {
+   public:
+    Options() noexcept {}
+
+    // Expected uncompressed size, or 0 if unknown. This may reduce memory
+    // usage and copying while the uncompressed data are buffered.
+    //
+    // If the size hint turns out to not match reality, nothing breaks.
+    Options& set_size_hint(Position size_hint) & {
+      size_hint_ = size_hint;
+      return *this;
+    }
+    Options&& set_size_hint(Position size_hint) && {
+      return std::move(set_size_hint(size_hint));
+    }
+
+   private:
+    template <typename Dest>
+    friend class SnappyWriter;
+
+    Position size_hint_ = 0;
+  };
+
+  // Returns the compressed Writer. Unchanged by Close().
+  virtual Writer* dest_writer() = 0;
+  virtual const Writer* dest_writer() const = 0;
+
+  // Data are compressed to the destination only on Close(), hence Flush()
+  // cannot make them visible there: it fails with UnimplementedError.
+  bool Flush(FlushType flush_type) override;
+
+ protected:
+  SnappyWriterBase() noexcept : Writer(State::kClosed) {}
+
+  explicit SnappyWriterBase(Position size_hint)
+      : Writer(State::kOpen),
+        size_hint_(UnsignedMin(size_hint, std::numeric_limits<size_t>::max())) {
+  }
+
+  SnappyWriterBase(SnappyWriterBase&& that) noexcept;
+  SnappyWriterBase& operator=(SnappyWriterBase&& that) noexcept;
+
+  void Initialize(Writer* dest);
+  void Done() override;
+  bool PushSlow() override;
+  using Writer::WriteSlow;
+  bool WriteSlow(absl::string_view src) override;
+  bool WriteSlow(std::string&& src) override;
+  bool WriteSlow(const Chain& src) override;
+  bool WriteSlow(Chain&& src) override;
+
+ private:
+  // Discards uninitialized space from the end of uncompressed_, so that it
+  // contains only actual data written.
+  void SyncBuffer();
+
+  // Appends some uninitialized space to uncompressed_ if this can be done
+  // without allocation.
+  void MakeBuffer(size_t min_length = 0);
+
+  size_t size_hint_ = 0;
+  // Uncompressed data buffered until Close(), which compresses them to the
+  // destination. Snappy is not a streaming compression format; the whole
+  // uncompressed contents must be available when compression begins.
+  Chain uncompressed_;
+
+  // Invariants if healthy():
+  //   limit_ == nullptr || limit_ == uncompressed_.blocks().back().data() +
+  //                                  uncompressed_.blocks().back().size()
+  //   limit_pos() == uncompressed_.size()
+};
+
+// A Writer which compresses data with Snappy before passing it to another
+// Writer.
+//
+// Snappy compresses much faster than Brotli or Zstd, and decompresses at
+// multiple GB/s, at the cost of a considerably worse compression density.
+//
+// The Dest template parameter specifies the type of the object providing and
+// possibly owning the compressed Writer. Dest must support
+// Dependency<Writer*, Dest>, e.g. Writer* (not owned, default),
+// unique_ptr<Writer> (owned), ChainWriter<> (owned).
+//
+// The uncompressed data are buffered in memory and compressed to the
+// destination only on Close(), hence Flush() is not supported. The compressed
+// Writer must not be accessed until the SnappyWriter is closed or no longer
+// used.
+template <typename Dest = Writer*>
+class SnappyWriter : public SnappyWriterBase {
+ public:
+  // Creates a closed SnappyWriter.
+  SnappyWriter() noexcept {}
+
+  // Will write to the compressed Writer provided by dest.
+  explicit SnappyWriter(Dest dest, Options options = Options());
+
+  SnappyWriter(SnappyWriter&& that) noexcept;
+  SnappyWriter& operator=(SnappyWriter&& that) noexcept;
+
+  // Returns the object providing and possibly owning the compressed Writer.
+  // Unchanged by Close().
+  Dest& dest() { return dest_.manager(); }
+  const Dest& dest() const { return dest_.manager(); }
+  Writer* dest_writer() override { return dest_.get(); }
+  const Writer* dest_writer() const override { return dest_.get(); }
+
+ protected:
+  void Done() override;
+
+ private:
+  // The object providing and possibly owning the compressed Writer.
+  Dependency<Writer*, Dest> dest_;
+};
+
+// Implementation details follow.
+
+inline SnappyWriterBase::SnappyWriterBase(SnappyWriterBase&& that) noexcept
+    : Writer(std::move(that)),
+      size_hint_(that.size_hint_),
+      uncompressed_(std::move(that.uncompressed_)) {}
+
+inline SnappyWriterBase& SnappyWriterBase::operator=(
+    SnappyWriterBase&& that) noexcept {
+  Writer::operator=(std::move(that));
+  size_hint_ = that.size_hint_;
+  uncompressed_ = std::move(that.uncompressed_);
+  return *this;
+}
+
+template <typename Dest>
+inline SnappyWriter<Dest>::SnappyWriter(Dest dest, Options options)
+    : SnappyWriterBase(options.size_hint_), dest_(std::move(dest)) {
+  Initialize(dest_.get());
+}
+
+template <typename Dest>
+inline SnappyWriter<Dest>::SnappyWriter(SnappyWriter&& that) noexcept
+    : SnappyWriterBase(std::move(that)), dest_(std::move(that.dest_)) {}
+
+template <typename Dest>
+inline SnappyWriter<Dest>& SnappyWriter<Dest>::operator=(
+    SnappyWriter&& that) noexcept {
+  SnappyWriterBase::operator=(std::move(that));
+  dest_ = std::move(that.dest_);
+  return *this;
+}
+
+template <typename Dest>
+void SnappyWriter<Dest>::Done() {
+  SnappyWriterBase::Done();
+  if (dest_.is_owning()) {
+    if (ABSL_PREDICT_FALSE(!dest_->Close())) Fail(*dest_);
+  }
+}
+
+extern template class SnappyWriter<Writer*>;
+extern template class SnappyWriter<std::unique_ptr<Writer>>;
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_BYTES_SNAPPY_WRITER_H_
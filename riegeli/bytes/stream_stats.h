@@ -0,0 +1,53 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BYTES_STREAM_STATS_H_
+#define RIEGELI_BYTES_STREAM_STATS_H_
+
+#include "absl/time/time.h"
+#include "riegeli/base/base.h"
+
+namespace riegeli {
+
+// Statistics of data flowing through a MeasuringWriter or MeasuringReader.
+//
+// Statistics are collected per measured object and can be aggregated across
+// objects with Add(). The compression ratio of a codec stream can be obtained
+// by measuring both sides of it, e.g. with one MeasuringWriter in front of a
+// ZstdWriter and another between the ZstdWriter and its destination; the
+// ratio is front.bytes / back.bytes, and back.active_time attributes time to
+// compression plus I/O while front.active_time excludes the caller.
+//
+// A StreamStats is not owned by the measuring object and must outlive it. It
+// is not synchronized; objects sharing a StreamStats must be used serially.
+struct StreamStats {
+  // Aggregates stats of another stream into these stats.
+  void Add(const StreamStats& that) {
+    bytes += that.bytes;
+    operations += that.operations;
+    active_time += that.active_time;
+  }
+
+  // Total number of bytes which flowed through the measured stream.
+  Position bytes = 0;
+  // Number of operations forwarded to the original object, i.e. buffer
+  // misses; operations satisfied from the buffer are not counted.
+  Position operations = 0;
+  // Wall time spent in operations forwarded to the original object.
+  absl::Duration active_time;
+};
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_BYTES_STREAM_STATS_H_
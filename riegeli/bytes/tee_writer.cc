@@ -0,0 +1,100 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/bytes/tee_writer.h"
+
+#include <stddef.h>
+
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/strings/string_view.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/bytes/buffered_writer.h"
+#include "riegeli/bytes/writer.h"
+
+namespace riegeli {
+
+TeeWriter::TeeWriter(std::vector<Writer*> dests, Options options)
+    : BufferedWriter(options.buffer_size_, options.size_hint_),
+      dests_(std::move(dests)) {
+  for (Writer* const dest : dests_) {
+    RIEGELI_ASSERT(dest != nullptr)
+        << "Failed precondition of TeeWriter::TeeWriter(vector<Writer*>): "
+           "null Writer pointer";
+    if (ABSL_PREDICT_FALSE(!dest->healthy())) {
+      Fail(*dest);
+      return;
+    }
+  }
+}
+
+void TeeWriter::Done() {
+  if (ABSL_PREDICT_TRUE(healthy())) PushInternal();
+  BufferedWriter::Done();
+}
+
+bool TeeWriter::WriteInternal(absl::string_view src) {
+  RIEGELI_ASSERT(!src.empty())
+      << "Failed precondition of BufferedWriter::WriteInternal(): "
+         "nothing to write";
+  RIEGELI_ASSERT(healthy())
+      << "Failed precondition of BufferedWriter::WriteInternal(): " << status();
+  RIEGELI_ASSERT_EQ(written_to_buffer(), 0u)
+      << "Failed precondition of BufferedWriter::WriteInternal(): "
+         "buffer not empty";
+  if (ABSL_PREDICT_FALSE(src.size() >
+                         std::numeric_limits<Position>::max() - start_pos_)) {
+    return FailOverflow();
+  }
+  for (Writer* const dest : dests_) {
+    if (ABSL_PREDICT_FALSE(!dest->Write(src))) return Fail(*dest);
+  }
+  start_pos_ += src.size();
+  return true;
+}
+
+bool TeeWriter::WriteInternal(const Chain& src) {
+  RIEGELI_ASSERT(!src.empty())
+      << "Failed precondition of BufferedWriter::WriteInternal(Chain): "
+         "nothing to write";
+  RIEGELI_ASSERT(healthy())
+      << "Failed precondition of BufferedWriter::WriteInternal(Chain): "
+      << status();
+  RIEGELI_ASSERT_EQ(written_to_buffer(), 0u)
+      << "Failed precondition of BufferedWriter::WriteInternal(Chain): "
+         "buffer not empty";
+  if (ABSL_PREDICT_FALSE(src.size() >
+                         std::numeric_limits<Position>::max() - start_pos_)) {
+    return FailOverflow();
+  }
+  for (Writer* const dest : dests_) {
+    if (ABSL_PREDICT_FALSE(!dest->Write(src))) return Fail(*dest);
+  }
+  start_pos_ += src.size();
+  return true;
+}
+
+bool TeeWriter::Flush(FlushType flush_type) {
+  if (ABSL_PREDICT_FALSE(!PushInternal())) return false;
+  for (Writer* const dest : dests_) {
+    if (ABSL_PREDICT_FALSE(!dest->Flush(flush_type))) return Fail(*dest);
+  }
+  return true;
+}
+
+}  // namespace riegeli
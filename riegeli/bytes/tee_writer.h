@@ -0,0 +1,122 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BYTES_TEE_WRITER_H_
+#define RIEGELI_BYTES_TEE_WRITER_H_
+
+#include <stddef.h>
+
+#include <utility>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/object.h"
+#include "riegeli/bytes/buffered_writer.h"
+#include "riegeli/bytes/writer.h"
+
+namespace riegeli {
+
+// A Writer which writes the same data to multiple destination Writers, so
+// that the data are produced once, e.g. by one encoding and compression
+// pipeline, and only the final bytes fan out.
+//
+// The TeeWriter buffers data itself; each full buffer is written to every
+// destination. Writing a Chain shares its blocks with the destinations
+// instead of copying them.
+//
+// The destination Writers are not owned. They must not be accessed until the
+// TeeWriter is closed or no longer used. Closing the TeeWriter pushes all
+// buffered data to the destinations but does not close them.
+class TeeWriter : public BufferedWriter {
+ public:
+  class Options {
+   public:
+    Options() noexcept {}
+
+    // Tunes how much data are buffered before writing to the destinations.
+    //
+    // Precondition: buffer_size > 0
+    Options& set_buffer_size(size_t buffer_size) & {
+      RIEGELI_ASSERT_GT(buffer_size, 0u)
+          << "Failed precondition of "
+             "TeeWriter::Options::set_buffer_size(): "
+             "zero buffer size";
+      buffer_size_ = buffer_size;
+      return *this;
+    }
+    Options&& set_buffer_size(size_t buffer_size) && {
+      return std::move(set_buffer_size(buffer_size));
+    }
+
+    // Expected final size, or 0 if unknown. This avoids allocating a larger
+    // buffer than necessary.
+    //
+    // If the size hint turns out to not match reality, nothing breaks.
+    Options& set_size_hint(Position size_hint) & {
+      size_hint_ = size_hint;
+      return *this;
+    }
+    Options&& set_size_hint(Position size_hint) && {
+      return std::move(set_size_hint(size_hint));
+    }
+
+   private:
+    friend class TeeWriter;
+
+    size_t buffer_size_ = kDefaultBufferSize;
+    Position size_hint_ = 0;
+  };
+
+  // Creates a closed TeeWriter.
+  TeeWriter() noexcept {}
+
+  // Will write to all Writers of dests.
+  //
+  // Precondition: no element of dests is nullptr
+  explicit TeeWriter(std::vector<Writer*> dests, Options options = Options());
+
+  TeeWriter(TeeWriter&& that) noexcept;
+  TeeWriter& operator=(TeeWriter&& that) noexcept;
+
+  // Returns the destination Writers. Unchanged by Close().
+  const std::vector<Writer*>& dest_writers() const { return dests_; }
+
+  bool Flush(FlushType flush_type) override;
+
+ protected:
+  void Done() override;
+  bool WriteInternal(absl::string_view src) override;
+  bool WriteInternal(const Chain& src) override;
+
+ private:
+  // The destination Writers, not owned.
+  std::vector<Writer*> dests_;
+};
+
+// Implementation details follow.
+
+inline TeeWriter::TeeWriter(TeeWriter&& that) noexcept
+    : BufferedWriter(std::move(that)), dests_(std::move(that.dests_)) {}
+
+inline TeeWriter& TeeWriter::operator=(TeeWriter&& that) noexcept {
+  BufferedWriter::operator=(std::move(that));
+  dests_ = std::move(that.dests_);
+  return *this;
+}
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_BYTES_TEE_WRITER_H_
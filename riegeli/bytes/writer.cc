@@ -87,6 +87,26 @@ bool Writer::WriteSlow(Chain&& src) {
   return WriteSlow(src);
 }
 
+bool Writer::WriteZerosSlow(Position length) {
+  RIEGELI_ASSERT_GT(length, available())
+      << "Failed precondition of Writer::WriteZerosSlow(): "
+         "length too small, use WriteZeros() instead";
+  if (available() == 0) goto skip_copy;  // memset(nullptr, _, 0) is undefined.
+  do {
+    {
+      const size_t available_length = available();
+      std::memset(cursor_, 0, available_length);
+      cursor_ = limit_;
+      length -= available_length;
+    }
+  skip_copy:
+    if (ABSL_PREDICT_FALSE(!PushSlow())) return false;
+  } while (length > available());
+  std::memset(cursor_, 0, length);
+  cursor_ += length;
+  return true;
+}
+
 bool Writer::SeekSlow(Position new_pos) {
   return Fail(UnimplementedError("Writer::Seek() not supported"));
 }
@@ -112,6 +112,30 @@ class Writer : public Object {
   bool Write(const Chain& src);
   bool Write(Chain&& src);
 
+  // Writes the given number of zero bytes to the buffer, pushing data to the
+  // destination as needed.
+  //
+  // A Writer whose destination can represent a run of zeros without storing
+  // it, e.g. FdWriter with Options::set_sparse(true), can override the slow
+  // part to store nothing.
+  //
+  // Return values:
+  //  * true  - success (length bytes written)
+  //  * false - failure (less than length bytes written, !healthy())
+  bool WriteZeros(Position length);
+
+  // Gives a hint of the expected final position. This may improve performance
+  // and memory usage: buffers and the destination can be sized once for the
+  // expected data instead of being grown repeatedly.
+  //
+  // The hint is not a guarantee: writing less or more data is still correct.
+  // By default does nothing.
+  //
+  // For Writers which accept a size hint at construction, e.g. ChainWriter
+  // with Options::set_size_hint(), this is an alternative when the size
+  // becomes known only after construction.
+  virtual void SetSizeHint(Position size_hint) {}
+
   // Pushes data written between start() and cursor() to the destination.
   //
   // Additionally, attempts to ensure the following, depending on flush_type
@@ -227,6 +251,13 @@ class Writer : public Object {
   virtual bool WriteSlow(const Chain& src);
   virtual bool WriteSlow(Chain&& src);
 
+  // Implementation of the slow part of WriteZeros().
+  //
+  // By default implemented in terms of Push().
+  //
+  // Precondition: length > available()
+  virtual bool WriteZerosSlow(Position length);
+
   // Implementation of the slow part of Seek().
   //
   // Precondition: new_pos < start_pos_ || new_pos > pos()
@@ -329,6 +360,17 @@ inline bool Writer::Write(Chain&& src) {
   return WriteSlow(std::move(src));
 }
 
+inline bool Writer::WriteZeros(Position length) {
+  if (ABSL_PREDICT_TRUE(length <= available())) {
+    if (ABSL_PREDICT_TRUE(length > 0)) {  // memset(nullptr, _, 0) is undefined.
+      std::memset(cursor_, 0, length);
+      cursor_ += length;
+    }
+    return true;
+  }
+  return WriteZerosSlow(length);
+}
+
 inline Position Writer::pos() const {
   RIEGELI_ASSERT_LE(start_pos_,
                     std::numeric_limits<Position>::max() - buffer_size())
@@ -17,8 +17,6 @@
 #include <stddef.h>
 #include <stdint.h>
 
-#include <cstring>
-
 #include "absl/base/optimization.h"
 #include "absl/strings/string_view.h"
 #include "riegeli/base/base.h"
@@ -39,27 +37,62 @@ bool WriteVarint64Slow(Writer* dest, uint64_t data) {
   return dest->Write(absl::string_view(buffer, PtrDistance(buffer, end)));
 }
 
-bool WriteZerosSlow(Writer* dest, Position length) {
-  RIEGELI_ASSERT_GT(length, dest->available())
-      << "Failed precondition of WriteZerosSlow(): "
-         "length too small, use WriteZeros() instead";
-  if (dest->available() == 0) {  // memset(nullptr, _, 0) is undefined.
-    goto skip_copy;
+}  // namespace internal
+
+bool WriteVarint32s(Writer* dest, const uint32_t* data, size_t length) {
+  while (length > 0) {
+    size_t batch = UnsignedMin(length, dest->available() / kMaxLengthVarint32);
+    if (ABSL_PREDICT_FALSE(batch == 0)) {
+      // Too close to the end of the buffer to guarantee space for a whole
+      // element; write one element through the buffer boundary.
+      if (ABSL_PREDICT_FALSE(!internal::WriteVarint32Slow(dest, *data))) {
+        return false;
+      }
+      ++data;
+      --length;
+      continue;
+    }
+    length -= batch;
+    char* cursor = dest->cursor();
+    do {
+      const uint32_t value = *data++;
+      if (ABSL_PREDICT_TRUE(value < 0x80)) {
+        *cursor++ = static_cast<char>(value);
+      } else {
+        cursor = WriteVarint32(cursor, value);
+      }
+    } while (--batch > 0);
+    dest->set_cursor(cursor);
   }
-  do {
-    {
-      const size_t available_length = dest->available();
-      std::memset(dest->cursor(), 0, available_length);
-      dest->set_cursor(dest->limit());
-      length -= available_length;
+  return true;
+}
+
+bool WriteVarint64s(Writer* dest, const uint64_t* data, size_t length) {
+  while (length > 0) {
+    size_t batch = UnsignedMin(length, dest->available() / kMaxLengthVarint64);
+    if (ABSL_PREDICT_FALSE(batch == 0)) {
+      // Too close to the end of the buffer to guarantee space for a whole
+      // element; write one element through the buffer boundary.
+      if (ABSL_PREDICT_FALSE(!internal::WriteVarint64Slow(dest, *data))) {
+        return false;
+      }
+      ++data;
+      --length;
+      continue;
     }
-  skip_copy:
-    if (ABSL_PREDICT_FALSE(!dest->Push())) return false;
-  } while (length > dest->available());
-  std::memset(dest->cursor(), 0, length);
-  dest->set_cursor(dest->cursor() + length);
+    length -= batch;
+    char* cursor = dest->cursor();
+    do {
+      const uint64_t value = *data++;
+      if (ABSL_PREDICT_TRUE(value < 0x80)) {
+        *cursor++ = static_cast<char>(value);
+      } else {
+        cursor = WriteVarint64(cursor, value);
+      }
+    } while (--batch > 0);
+    dest->set_cursor(cursor);
+  }
   return true;
 }
 
-}  // namespace internal
 }  // namespace riegeli
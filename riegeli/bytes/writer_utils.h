@@ -18,8 +18,7 @@
 #include <stddef.h>
 #include <stdint.h>
 
-#include <cstring>
-
+#include "absl/base/macros.h"
 #include "absl/base/optimization.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/port.h"
@@ -38,10 +37,23 @@ char* WriteVarint32(char* dest, uint32_t data);
 // At least LengthVarint64(data) bytes of space at dest[] must be available.
 char* WriteVarint64(char* dest, uint64_t data);
 
+// Variants for callers which have computed the length already, e.g. to
+// reserve space before the data in a BackwardWriter. The bytes are emitted
+// with independent unrolled stores instead of a loop whose iterations depend
+// on each other.
+//
+// Precondition: length == LengthVarint32(data), resp. LengthVarint64(data)
+void WriteVarint32WithLength(char* dest, uint32_t data, size_t length);
+void WriteVarint64WithLength(char* dest, uint64_t data, size_t length);
+
 bool WriteVarint32(Writer* dest, uint32_t data);
 bool WriteVarint64(Writer* dest, uint64_t data);
 
-bool WriteZeros(Writer* dest, Position length);
+// Writes an array of varints. More efficient than writing the elements
+// separately: the space check is done once per batch of elements instead of
+// once per element, and single byte encodings are special cased.
+bool WriteVarint32s(Writer* dest, const uint32_t* data, size_t length);
+bool WriteVarint64s(Writer* dest, const uint64_t* data, size_t length);
 
 // Implementation details follow.
 
@@ -50,8 +62,6 @@ namespace internal {
 bool WriteVarint32Slow(Writer* dest, uint32_t data);
 bool WriteVarint64Slow(Writer* dest, uint64_t data);
 
-bool WriteZerosSlow(Writer* dest, Position length);
-
 }  // namespace internal
 
 inline bool WriteByte(Writer* dest, uint8_t data) {
@@ -99,21 +109,84 @@ inline size_t LengthVarint64(uint64_t data) {
 }
 
 inline char* WriteVarint32(char* dest, uint32_t data) {
-  while (data >= 0x80) {
-    *dest++ = static_cast<char>(data | 0x80);
-    data >>= 7;
-  }
-  *dest++ = static_cast<char>(data);
-  return dest;
+  const size_t length = LengthVarint32(data);
+  WriteVarint32WithLength(dest, data, length);
+  return dest + length;
 }
 
 inline char* WriteVarint64(char* dest, uint64_t data) {
-  while (data >= 0x80) {
-    *dest++ = static_cast<char>(data | 0x80);
-    data >>= 7;
+  const size_t length = LengthVarint64(data);
+  WriteVarint64WithLength(dest, data, length);
+  return dest + length;
+}
+
+inline void WriteVarint32WithLength(char* dest, uint32_t data, size_t length) {
+  RIEGELI_ASSERT_EQ(length, LengthVarint32(data))
+      << "Failed precondition of WriteVarint32WithLength(): wrong length";
+  // The stores below do not depend on each other, unlike iterations of a loop
+  // shifting data, so they can be issued in parallel. The byte without the
+  // continuation bit is stored last, overwriting the continuation bit of the
+  // last byte stored by the switch.
+  switch (length) {
+    case 5:
+      dest[4] = static_cast<char>((data >> 28) | 0x80);
+      ABSL_FALLTHROUGH_INTENDED;
+    case 4:
+      dest[3] = static_cast<char>((data >> 21) | 0x80);
+      ABSL_FALLTHROUGH_INTENDED;
+    case 3:
+      dest[2] = static_cast<char>((data >> 14) | 0x80);
+      ABSL_FALLTHROUGH_INTENDED;
+    case 2:
+      dest[1] = static_cast<char>((data >> 7) | 0x80);
+      ABSL_FALLTHROUGH_INTENDED;
+    case 1:
+      dest[0] = static_cast<char>(data | 0x80);
+      break;
+    default:
+      RIEGELI_ASSERT_UNREACHABLE() << "Impossible varint length: " << length;
+  }
+  dest[length - 1] = static_cast<char>(data >> (7 * (length - 1)));
+}
+
+inline void WriteVarint64WithLength(char* dest, uint64_t data, size_t length) {
+  RIEGELI_ASSERT_EQ(length, LengthVarint64(data))
+      << "Failed precondition of WriteVarint64WithLength(): wrong length";
+  switch (length) {
+    case 10:
+      dest[9] = static_cast<char>((data >> 63) | 0x80);
+      ABSL_FALLTHROUGH_INTENDED;
+    case 9:
+      dest[8] = static_cast<char>((data >> 56) | 0x80);
+      ABSL_FALLTHROUGH_INTENDED;
+    case 8:
+      dest[7] = static_cast<char>((data >> 49) | 0x80);
+      ABSL_FALLTHROUGH_INTENDED;
+    case 7:
+      dest[6] = static_cast<char>((data >> 42) | 0x80);
+      ABSL_FALLTHROUGH_INTENDED;
+    case 6:
+      dest[5] = static_cast<char>((data >> 35) | 0x80);
+      ABSL_FALLTHROUGH_INTENDED;
+    case 5:
+      dest[4] = static_cast<char>((data >> 28) | 0x80);
+      ABSL_FALLTHROUGH_INTENDED;
+    case 4:
+      dest[3] = static_cast<char>((data >> 21) | 0x80);
+      ABSL_FALLTHROUGH_INTENDED;
+    case 3:
+      dest[2] = static_cast<char>((data >> 14) | 0x80);
+      ABSL_FALLTHROUGH_INTENDED;
+    case 2:
+      dest[1] = static_cast<char>((data >> 7) | 0x80);
+      ABSL_FALLTHROUGH_INTENDED;
+    case 1:
+      dest[0] = static_cast<char>(data | 0x80);
+      break;
+    default:
+      RIEGELI_ASSERT_UNREACHABLE() << "Impossible varint length: " << length;
   }
-  *dest++ = static_cast<char>(data);
-  return dest;
+  dest[length - 1] = static_cast<char>(data >> (7 * (length - 1)));
 }
 
 inline bool WriteVarint32(Writer* dest, uint32_t data) {
@@ -132,17 +205,6 @@ inline bool WriteVarint64(Writer* dest, uint64_t data) {
   return internal::WriteVarint64Slow(dest, data);
 }
 
-inline bool WriteZeros(Writer* dest, Position length) {
-  if (ABSL_PREDICT_TRUE(length <= dest->available())) {
-    if (ABSL_PREDICT_TRUE(length > 0)) {  // memset(nullptr, _, 0) is undefined.
-      std::memset(dest->cursor(), 0, length);
-      dest->set_cursor(dest->cursor() + length);
-    }
-    return true;
-  }
-  return internal::WriteZerosSlow(dest, length);
-}
-
 }  // namespace riegeli
 
 #endif  // RIEGELI_BYTES_WRITER_UTILS_H_
@@ -17,7 +17,9 @@
 #include <stddef.h>
 
 #include <limits>
+#include <memory>
 #include <string>
+#include <utility>
 
 #include "absl/base/macros.h"
 #include "absl/base/optimization.h"
@@ -44,7 +46,8 @@ constexpr int ZlibReaderBase::Options::kDefaultWindowLog;
 constexpr ZlibReaderBase::Header ZlibReaderBase::Options::kDefaultHeader;
 #endif
 
-void ZlibReaderBase::Initialize(Reader* src, int window_bits) {
+void ZlibReaderBase::Initialize(Reader* src, int window_bits,
+                                std::shared_ptr<const std::string> dictionary) {
   RIEGELI_ASSERT(src != nullptr)
       << "Failed precondition of ZlibReader<Src>::ZlibReader(Src): "
          "null Reader pointer";
@@ -52,6 +55,7 @@ void ZlibReaderBase::Initialize(Reader* src, int window_bits) {
     Fail(*src);
     return;
   }
+  dictionary_ = std::move(dictionary);
   decompressor_ = RecyclingPool<z_stream, ZStreamDeleter>::global().Get(
       [&] {
         std::unique_ptr<z_stream, ZStreamDeleter> ptr(new z_stream());
@@ -65,6 +69,19 @@ void ZlibReaderBase::Initialize(Reader* src, int window_bits) {
           FailOperation(StatusCode::kInternal, "inflateReset2()");
         }
       });
+  if (dictionary_ != nullptr && window_bits < 0 &&
+      ABSL_PREDICT_TRUE(healthy())) {
+    // A raw stream does not signal that a dictionary is needed, so it must be
+    // set before decompression begins. A zlib stream signals it by inflate()
+    // returning Z_NEED_DICT, which is handled in ReadInternal().
+    if (ABSL_PREDICT_FALSE(inflateSetDictionary(
+                               decompressor_.get(),
+                               reinterpret_cast<const Bytef*>(
+                                   dictionary_->data()),
+                               IntCast<uInt>(dictionary_->size())) != Z_OK)) {
+      FailOperation(StatusCode::kInternal, "inflateSetDictionary()");
+    }
+  }
 }
 
 void ZlibReaderBase::Done() {
@@ -138,6 +155,24 @@ bool ZlibReaderBase::ReadInternal(char* dest, size_t min_length,
       case Z_STREAM_END:
         decompressor_.reset();
         break;
+      case Z_NEED_DICT:
+        if (ABSL_PREDICT_FALSE(dictionary_ == nullptr)) {
+          Fail(DataLossError(
+              "zlib-compressed stream requires a dictionary which was not "
+              "supplied"));
+          break;
+        }
+        if (ABSL_PREDICT_FALSE(
+                inflateSetDictionary(
+                    decompressor_.get(),
+                    reinterpret_cast<const Bytef*>(dictionary_->data()),
+                    IntCast<uInt>(dictionary_->size())) != Z_OK)) {
+          // Z_DATA_ERROR here means that the dictionary does not match the
+          // Adler-32 checksum stored in the stream.
+          FailOperation(StatusCode::kDataLoss, "inflateSetDictionary()");
+          break;
+        }
+        continue;
       default:
         FailOperation(StatusCode::kDataLoss, "inflate()");
         break;
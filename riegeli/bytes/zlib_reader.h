@@ -18,6 +18,7 @@
 #include <stddef.h>
 
 #include <memory>
+#include <string>
 #include <utility>
 
 #include "absl/base/attributes.h"
@@ -88,6 +89,39 @@ class ZlibReaderBase : public BufferedReader {
       return std::move(set_header(header));
     }
 
+    // Zlib dictionary. The same dictionary must have been used for
+    // compression.
+    //
+    // A zlib stream compressed with a dictionary signals that the dictionary
+    // is needed; decompression fails if it is not supplied. A raw stream
+    // carries no such signal, so for Header::kRaw the dictionary is applied
+    // unconditionally. A gzip stream cannot use a dictionary.
+    //
+    // Default: empty.
+    Options& set_dictionary(absl::string_view dictionary) & {
+      dictionary_ =
+          dictionary.empty()
+              ? nullptr
+              : std::make_shared<const std::string>(dictionary.data(),
+                                                    dictionary.size());
+      return *this;
+    }
+    Options&& set_dictionary(absl::string_view dictionary) && {
+      return std::move(set_dictionary(dictionary));
+    }
+
+    // Like above, but shares the dictionary contents which are already owned
+    // elsewhere, instead of copying them.
+    Options& set_dictionary(std::shared_ptr<const std::string> dictionary) & {
+      dictionary_ = dictionary != nullptr && dictionary->empty()
+                        ? nullptr
+                        : std::move(dictionary);
+      return *this;
+    }
+    Options&& set_dictionary(std::shared_ptr<const std::string> dictionary) && {
+      return std::move(set_dictionary(std::move(dictionary)));
+    }
+
     // Expected uncompressed size, or 0 if unknown. This may improve
     // performance.
     //
@@ -121,6 +155,7 @@ class ZlibReaderBase : public BufferedReader {
 
     int window_log_ = kDefaultWindowLog;
     Header header_ = kDefaultHeader;
+    std::shared_ptr<const std::string> dictionary_;
     Position size_hint_ = 0;
     size_t buffer_size_ = kDefaultBufferSize;
   };
@@ -138,7 +173,8 @@ class ZlibReaderBase : public BufferedReader {
   ZlibReaderBase(ZlibReaderBase&& that) noexcept;
   ZlibReaderBase& operator=(ZlibReaderBase&& that) noexcept;
 
-  void Initialize(Reader* src, int window_bits);
+  void Initialize(Reader* src, int window_bits,
+                  std::shared_ptr<const std::string> dictionary);
   void Done() override;
   bool PullSlow() override;
   bool ReadInternal(char* dest, size_t min_length, size_t max_length) override;
@@ -159,6 +195,9 @@ class ZlibReaderBase : public BufferedReader {
   // stream) at the current position. If the source does not grow, Close() will
   // fail.
   bool truncated_ = false;
+  // Dictionary supplied with Options::set_dictionary(), or nullptr. Needed
+  // when inflate() returns Z_NEED_DICT.
+  std::shared_ptr<const std::string> dictionary_;
   RecyclingPool<z_stream, ZStreamDeleter>::Handle decompressor_;
 };
 
@@ -205,12 +244,14 @@ class ZlibReader : public ZlibReaderBase {
 inline ZlibReaderBase::ZlibReaderBase(ZlibReaderBase&& that) noexcept
     : BufferedReader(std::move(that)),
       truncated_(absl::exchange(that.truncated_, false)),
+      dictionary_(std::move(that.dictionary_)),
       decompressor_(std::move(that.decompressor_)) {}
 
 inline ZlibReaderBase& ZlibReaderBase::operator=(
     ZlibReaderBase&& that) noexcept {
   BufferedReader::operator=(std::move(that));
   truncated_ = absl::exchange(that.truncated_, false);
+  dictionary_ = std::move(that.dictionary_);
   decompressor_ = std::move(that.decompressor_);
   return *this;
 }
@@ -222,7 +263,8 @@ ZlibReader<Src>::ZlibReader(Src src, Options options)
   Initialize(src_.get(),
              options.header_ == Header::kRaw
                  ? -options.window_log_
-                 : options.window_log_ + static_cast<int>(options.header_));
+                 : options.window_log_ + static_cast<int>(options.header_),
+             std::move(options.dictionary_));
 }
 
 template <typename Src>
@@ -16,14 +16,20 @@
 
 #include <stddef.h>
 
+#include <future>
 #include <limits>
+#include <memory>
 #include <string>
+#include <utility>
 
 #include "absl/base/optimization.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
+#include "absl/types/span.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/canonical_errors.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/parallelism.h"
 #include "riegeli/base/recycling_pool.h"
 #include "riegeli/bytes/buffered_writer.h"
 #include "riegeli/bytes/writer.h"
@@ -46,7 +52,8 @@ constexpr ZlibWriterBase::Header ZlibWriterBase::Options::kDefaultHeader;
 #endif
 
 void ZlibWriterBase::Initialize(Writer* dest, int compression_level,
-                                int window_bits) {
+                                int window_bits, int parallelism,
+                                std::shared_ptr<const std::string> dictionary) {
   RIEGELI_ASSERT(dest != nullptr)
       << "Failed precondition of ZlibWriter<Dest>::ZlibWriter(Dest): "
          "null Writer pointer";
@@ -54,6 +61,14 @@ void ZlibWriterBase::Initialize(Writer* dest, int compression_level,
     Fail(*dest);
     return;
   }
+  if (parallelism > 0) {
+    // Each segment is compressed by a background task with its own z_stream;
+    // no z_stream is needed here.
+    parallelism_ = parallelism;
+    compression_level_ = compression_level;
+    window_bits_ = window_bits;
+    return;
+  }
   compressor_ =
       RecyclingPool<z_stream, ZStreamDeleter, ZStreamKey>::global().Get(
           ZStreamKey{compression_level, window_bits},
@@ -71,6 +86,17 @@ void ZlibWriterBase::Initialize(Writer* dest, int compression_level,
               FailOperation("deflateReset()");
             }
           });
+  if (dictionary != nullptr && ABSL_PREDICT_TRUE(healthy())) {
+    // deflateReset() clears any previous dictionary, so the dictionary must be
+    // set for each stream, even if the z_stream comes from the pool.
+    if (ABSL_PREDICT_FALSE(deflateSetDictionary(
+                               compressor_.get(),
+                               reinterpret_cast<const Bytef*>(
+                                   dictionary->data()),
+                               IntCast<uInt>(dictionary->size())) != Z_OK)) {
+      FailOperation("deflateSetDictionary()");
+    }
+  }
 }
 
 void ZlibWriterBase::Done() {
@@ -78,9 +104,19 @@ void ZlibWriterBase::Done() {
     Writer* const dest = dest_writer();
     const size_t buffered_length = written_to_buffer();
     cursor_ = start_;
-    WriteInternal(absl::string_view(start_, buffered_length), dest, Z_FINISH);
+    if (parallelism_ > 0) {
+      // Write the last segment even if it is empty if no segment was written,
+      // so that the output is a valid gzip stream.
+      if (buffered_length > 0 || !wrote_segment_) {
+        ScheduleSegment(absl::string_view(start_, buffered_length));
+      }
+      if (ABSL_PREDICT_TRUE(healthy())) WritePendingSegments(dest);
+    } else {
+      WriteInternal(absl::string_view(start_, buffered_length), dest, Z_FINISH);
+    }
   }
   compressor_.reset();
+  pending_segments_.clear();
   BufferedWriter::Done();
 }
 
@@ -102,6 +138,13 @@ bool ZlibWriterBase::WriteInternal(absl::string_view src) {
       << "Failed precondition of BufferedWriter::WriteInternal(): "
          "buffer not empty";
   Writer* const dest = dest_writer();
+  if (parallelism_ > 0) {
+    if (ABSL_PREDICT_FALSE(!ScheduleSegment(src))) return false;
+    while (pending_segments_.size() > IntCast<size_t>(parallelism_)) {
+      if (ABSL_PREDICT_FALSE(!WriteSegment(dest))) return false;
+    }
+    return true;
+  }
   return WriteInternal(src, dest, Z_NO_FLUSH);
 }
 
@@ -161,13 +204,121 @@ inline bool ZlibWriterBase::WriteInternal(absl::string_view src, Writer* dest,
   }
 }
 
+ZlibWriterBase::CompressedSegment ZlibWriterBase::CompressSegment(
+    std::string src, int compression_level, int window_bits) {
+  CompressedSegment segment;
+  RecyclingPool<z_stream, ZStreamDeleter, ZStreamKey>::Handle compressor =
+      RecyclingPool<z_stream, ZStreamDeleter, ZStreamKey>::global().Get(
+          ZStreamKey{compression_level, window_bits},
+          [&] {
+            std::unique_ptr<z_stream, ZStreamDeleter> ptr(new z_stream());
+            if (ABSL_PREDICT_FALSE(deflateInit2(ptr.get(), compression_level,
+                                                Z_DEFLATED, window_bits, 8,
+                                                Z_DEFAULT_STRATEGY) != Z_OK)) {
+              segment.error_message = "deflateInit2() failed";
+            }
+            return ptr;
+          },
+          [&](z_stream* ptr) {
+            if (ABSL_PREDICT_FALSE(deflateReset(ptr) != Z_OK)) {
+              segment.error_message = "deflateReset() failed";
+            }
+          });
+  if (ABSL_PREDICT_FALSE(!segment.error_message.empty())) return segment;
+  compressor->next_in =
+      const_cast<z_const Bytef*>(reinterpret_cast<const Bytef*>(src.data()));
+  for (;;) {
+    size_t avail_in =
+        PtrDistance(reinterpret_cast<const char*>(compressor->next_in),
+                    src.data() + src.size());
+    int op = Z_FINISH;
+    if (ABSL_PREDICT_FALSE(avail_in > std::numeric_limits<uInt>::max())) {
+      avail_in = size_t{std::numeric_limits<uInt>::max()};
+      op = Z_NO_FLUSH;
+    }
+    compressor->avail_in = IntCast<uInt>(avail_in);
+    const absl::Span<char> buffer = segment.data.AppendBuffer(1);
+    compressor->next_out = reinterpret_cast<Bytef*>(buffer.data());
+    const size_t avail_out =
+        UnsignedMin(buffer.size(), std::numeric_limits<uInt>::max());
+    compressor->avail_out = IntCast<uInt>(avail_out);
+    const int result = deflate(compressor.get(), op);
+    segment.data.RemoveSuffix(buffer.size() -
+                              (avail_out - size_t{compressor->avail_out}));
+    switch (result) {
+      case Z_OK:
+        continue;
+      case Z_STREAM_END:
+        return segment;
+      default:
+        segment.error_message = "deflate() failed";
+        if (compressor->msg != nullptr) {
+          absl::StrAppend(&segment.error_message, ": ", compressor->msg);
+        }
+        segment.data = Chain();
+        return segment;
+    }
+  }
+}
+
+inline bool ZlibWriterBase::ScheduleSegment(absl::string_view src) {
+  if (ABSL_PREDICT_FALSE(src.size() >
+                         std::numeric_limits<Position>::max() - limit_pos())) {
+    return FailOverflow();
+  }
+  std::promise<CompressedSegment>* const promise =
+      new std::promise<CompressedSegment>();
+  pending_segments_.push_back(promise->get_future());
+  std::string* const data = new std::string(src.data(), src.size());
+  const int compression_level = compression_level_;
+  const int window_bits = window_bits_;
+  internal::ThreadPool::global_cpu().Schedule(
+      [promise, data, compression_level, window_bits] {
+        promise->set_value(
+            CompressSegment(std::move(*data), compression_level, window_bits));
+        delete data;
+        delete promise;
+      });
+  wrote_segment_ = true;
+  start_pos_ += src.size();
+  return true;
+}
+
+inline bool ZlibWriterBase::WriteSegment(Writer* dest) {
+  CompressedSegment segment = pending_segments_.front().get();
+  pending_segments_.pop_front();
+  if (ABSL_PREDICT_FALSE(!segment.error_message.empty())) {
+    return Fail(InternalError(segment.error_message));
+  }
+  if (ABSL_PREDICT_FALSE(!dest->Write(std::move(segment.data)))) {
+    return Fail(*dest);
+  }
+  return true;
+}
+
+inline bool ZlibWriterBase::WritePendingSegments(Writer* dest) {
+  while (!pending_segments_.empty()) {
+    if (ABSL_PREDICT_FALSE(!WriteSegment(dest))) return false;
+  }
+  return true;
+}
+
 bool ZlibWriterBase::Flush(FlushType flush_type) {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
   Writer* const dest = dest_writer();
   const size_t buffered_length = written_to_buffer();
   cursor_ = start_;
-  if (ABSL_PREDICT_FALSE(!WriteInternal(
-          absl::string_view(start_, buffered_length), dest, Z_PARTIAL_FLUSH))) {
+  if (parallelism_ > 0) {
+    if (buffered_length > 0) {
+      if (ABSL_PREDICT_FALSE(
+              !ScheduleSegment(absl::string_view(start_, buffered_length)))) {
+        return false;
+      }
+    }
+    if (ABSL_PREDICT_FALSE(!WritePendingSegments(dest))) return false;
+  } else if (ABSL_PREDICT_FALSE(
+                 !WriteInternal(absl::string_view(start_, buffered_length),
+                                dest, Z_PARTIAL_FLUSH))) {
     return false;
   }
   if (ABSL_PREDICT_FALSE(!dest->Flush(flush_type))) return Fail(*dest);
@@ -17,13 +17,17 @@
 
 #include <stddef.h>
 
+#include <deque>
+#include <future>
 #include <memory>
+#include <string>
 #include <utility>
 
 #include "absl/base/attributes.h"
 #include "absl/base/optimization.h"
 #include "absl/strings/string_view.h"
 #include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
 #include "riegeli/base/dependency.h"
 #include "riegeli/base/recycling_pool.h"
 #include "riegeli/bytes/buffered_writer.h"
@@ -107,6 +111,41 @@ class ZlibWriterBase : public BufferedWriter {
       return std::move(set_header(header));
     }
 
+    // Zlib dictionary. The same dictionary must be used for decompression.
+    //
+    // A dictionary improves compression density of small, repetitive data
+    // which shares a vocabulary with the dictionary.
+    //
+    // The dictionary is supported with Header::kZlib and Header::kRaw but not
+    // Header::kGzip, because the gzip format has no way to signal a dictionary
+    // to the decompressor. Consequently the dictionary cannot be combined with
+    // set_parallelism(), which requires Header::kGzip.
+    //
+    // Default: empty.
+    Options& set_dictionary(absl::string_view dictionary) & {
+      dictionary_ =
+          dictionary.empty()
+              ? nullptr
+              : std::make_shared<const std::string>(dictionary.data(),
+                                                    dictionary.size());
+      return *this;
+    }
+    Options&& set_dictionary(absl::string_view dictionary) && {
+      return std::move(set_dictionary(dictionary));
+    }
+
+    // Like above, but shares the dictionary contents which are already owned
+    // elsewhere, instead of copying them.
+    Options& set_dictionary(std::shared_ptr<const std::string> dictionary) & {
+      dictionary_ = dictionary != nullptr && dictionary->empty()
+                        ? nullptr
+                        : std::move(dictionary);
+      return *this;
+    }
+    Options&& set_dictionary(std::shared_ptr<const std::string> dictionary) && {
+      return std::move(set_dictionary(std::move(dictionary)));
+    }
+
     // Expected uncompressed size, or 0 if unknown. This may improve
     // performance.
     //
@@ -134,6 +173,29 @@ class ZlibWriterBase : public BufferedWriter {
       return std::move(set_buffer_size(buffer_size));
     }
 
+    // If not 0, segments of buffer_size uncompressed bytes are compressed as
+    // separate gzip members in background tasks, with up to parallelism
+    // segments in flight. Concatenated gzip members still form a valid gzip
+    // stream, so this scales compression throughput with cores, at a small
+    // cost in compression density because matches do not cross segment
+    // boundaries.
+    //
+    // If not 0, header must be Header::kGzip, because concatenated zlib or
+    // raw streams would not form a valid stream of the respective format.
+    //
+    // Default: 0.
+    Options& set_parallelism(int parallelism) & {
+      RIEGELI_ASSERT_GE(parallelism, 0)
+          << "Failed precondition of "
+             "ZlibWriterBase::Options::set_parallelism(): "
+             "negative parallelism";
+      parallelism_ = parallelism;
+      return *this;
+    }
+    Options&& set_parallelism(int parallelism) && {
+      return std::move(set_parallelism(parallelism));
+    }
+
    private:
     template <typename Dest>
     friend class ZlibWriter;
@@ -141,8 +203,10 @@ class ZlibWriterBase : public BufferedWriter {
     int compression_level_ = kDefaultCompressionLevel;
     int window_log_ = kDefaultWindowLog;
     Header header_ = kDefaultHeader;
+    std::shared_ptr<const std::string> dictionary_;
     Position size_hint_ = 0;
     size_t buffer_size_ = kDefaultBufferSize;
+    int parallelism_ = 0;
   };
 
   // Returns the compressed Writer. Unchanged by Close().
@@ -160,7 +224,9 @@ class ZlibWriterBase : public BufferedWriter {
   ZlibWriterBase(ZlibWriterBase&& that) noexcept;
   ZlibWriterBase& operator=(ZlibWriterBase&& that) noexcept;
 
-  void Initialize(Writer* dest, int compression_level, int window_bits);
+  void Initialize(Writer* dest, int compression_level, int window_bits,
+                  int parallelism,
+                  std::shared_ptr<const std::string> dictionary);
   void Done() override;
   bool WriteInternal(absl::string_view src) override;
 
@@ -192,10 +258,45 @@ class ZlibWriterBase : public BufferedWriter {
     int window_bits;
   };
 
+  // Result of compressing one segment in a background task.
+  struct CompressedSegment {
+    Chain data;
+    // If not empty, compression failed with this message.
+    std::string error_message;
+  };
+
   ABSL_ATTRIBUTE_COLD bool FailOperation(absl::string_view operation);
   bool WriteInternal(absl::string_view src, Writer* dest, int flush);
 
+  // Compresses src as one complete gzip member. Static so that background
+  // tasks do not refer to the ZlibWriterBase, which may be moved meanwhile.
+  static CompressedSegment CompressSegment(std::string src,
+                                           int compression_level,
+                                           int window_bits);
+
+  // Schedules compression of src as one gzip member in a background task.
+  bool ScheduleSegment(absl::string_view src);
+
+  // Waits for the oldest scheduled segment and writes it to dest.
+  bool WriteSegment(Writer* dest);
+
+  // Waits for all scheduled segments and writes them to dest.
+  bool WritePendingSegments(Writer* dest);
+
+  // Used if parallelism_ == 0.
   RecyclingPool<z_stream, ZStreamDeleter, ZStreamKey>::Handle compressor_;
+
+  // Used if parallelism_ > 0. Implementation of
+  // Options::set_parallelism(): each segment is compressed as a separate
+  // gzip member in a background task.
+  int parallelism_ = 0;
+  int compression_level_ = 0;
+  int window_bits_ = 0;
+  // If true, at least one segment was scheduled. If false by Close(), an
+  // empty segment is written so that the output is a valid gzip stream.
+  bool wrote_segment_ = false;
+  // Scheduled segment compressions, oldest first.
+  std::deque<std::future<CompressedSegment>> pending_segments_;
 };
 
 // A Writer which compresses data with Zlib before passing it to another Writer.
@@ -239,12 +340,22 @@ class ZlibWriter : public ZlibWriterBase {
 
 inline ZlibWriterBase::ZlibWriterBase(ZlibWriterBase&& that) noexcept
     : BufferedWriter(std::move(that)),
-      compressor_(std::move(that.compressor_)) {}
+      compressor_(std::move(that.compressor_)),
+      parallelism_(that.parallelism_),
+      compression_level_(that.compression_level_),
+      window_bits_(that.window_bits_),
+      wrote_segment_(that.wrote_segment_),
+      pending_segments_(std::move(that.pending_segments_)) {}
 
 inline ZlibWriterBase& ZlibWriterBase::operator=(
     ZlibWriterBase&& that) noexcept {
   BufferedWriter::operator=(std::move(that));
   compressor_ = std::move(that.compressor_);
+  parallelism_ = that.parallelism_;
+  compression_level_ = that.compression_level_;
+  window_bits_ = that.window_bits_;
+  wrote_segment_ = that.wrote_segment_;
+  pending_segments_ = std::move(that.pending_segments_);
   return *this;
 }
 
@@ -252,10 +363,18 @@ template <typename Dest>
 inline ZlibWriter<Dest>::ZlibWriter(Dest dest, Options options)
     : ZlibWriterBase(options.buffer_size_, options.size_hint_),
       dest_(std::move(dest)) {
+  RIEGELI_ASSERT(options.parallelism_ == 0 || options.header_ == Header::kGzip)
+      << "Failed precondition of ZlibWriter<Dest>::ZlibWriter(Dest): "
+         "parallelism requires Header::kGzip";
+  RIEGELI_ASSERT(options.dictionary_ == nullptr ||
+                 options.header_ != Header::kGzip)
+      << "Failed precondition of ZlibWriter<Dest>::ZlibWriter(Dest): "
+         "dictionary is not supported with Header::kGzip";
   Initialize(dest_.get(), options.compression_level_,
              options.header_ == Header::kRaw
                  ? -options.window_log_
-                 : options.window_log_ + static_cast<int>(options.header_));
+                 : options.window_log_ + static_cast<int>(options.header_),
+             options.parallelism_, std::move(options.dictionary_));
 }
 
 template <typename Dest>
@@ -20,11 +20,20 @@
 #include <stddef.h>
 
 #include <limits>
+#include <list>
+#include <memory>
+#include <string>
+#include <utility>
 
 #include "absl/base/optimization.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
 #include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/canonical_errors.h"
+#include "riegeli/base/memory.h"
 #include "riegeli/base/recycling_pool.h"
 #include "riegeli/bytes/buffered_reader.h"
 #include "riegeli/bytes/reader.h"
@@ -32,7 +41,120 @@
 
 namespace riegeli {
 
-void ZstdReaderBase::Initialize(Reader* src) {
+namespace {
+
+struct ZSTD_DDictDeleter {
+  void operator()(ZSTD_DDict* ptr) const { ZSTD_freeDDict(ptr); }
+};
+
+// Key of a prepared dictionary: its contents.
+struct ZSTD_DDictKey {
+  friend bool operator==(const ZSTD_DDictKey& a, const ZSTD_DDictKey& b) {
+    return *a.dictionary == *b.dictionary;
+  }
+  friend bool operator!=(const ZSTD_DDictKey& a, const ZSTD_DDictKey& b) {
+    return *a.dictionary != *b.dictionary;
+  }
+  template <typename HashState>
+  friend HashState AbslHashValue(HashState hash_state,
+                                 const ZSTD_DDictKey& self) {
+    return HashState::combine(std::move(hash_state), *self.dictionary);
+  }
+
+  // Keys are compared by the dictionary contents, not by the pointer; the
+  // pointer is shared with Options to avoid copying the contents.
+  std::shared_ptr<const std::string> dictionary;
+};
+
+// Cache of prepared dictionaries. ZSTD_createDDict() loads the dictionary
+// contents, which costs more than referencing an already prepared dictionary,
+// hence each dictionary is prepared once per distinct contents and shared
+// among ZstdReaders. A prepared dictionary is immutable, so sharing it among
+// concurrent ZstdReaders is safe. The cache also keeps the most recently used
+// dictionaries alive while no ZstdReader uses them, so that streams
+// decompressed one after another (e.g. chunks of a Riegeli/records file)
+// reuse the prepared form.
+class DDictCache {
+ public:
+  DDictCache() {}
+
+  DDictCache(const DDictCache&) = delete;
+  DDictCache& operator=(const DDictCache&) = delete;
+
+  // Returns a default global cache.
+  static DDictCache& global();
+
+  // Returns the prepared dictionary for the given key, preparing it if
+  // absent, or nullptr if ZSTD_createDDict() failed.
+  std::shared_ptr<const ZSTD_DDict> Get(ZSTD_DDictKey key);
+
+ private:
+  // Number of most recently used dictionaries kept alive while unused.
+  static constexpr size_t kMaxSize = 4;
+
+  // Adding or removing elements in ByFreshness must not invalidate iterators
+  // to other elements.
+  using ByFreshness =
+      std::list<std::pair<ZSTD_DDictKey, std::shared_ptr<const ZSTD_DDict>>>;
+
+  absl::Mutex mutex_;
+  // Prepared dictionaries, ordered by the freshness of their last use (older
+  // to newer).
+  ByFreshness by_freshness_ GUARDED_BY(mutex_);
+  // Prepared dictionaries indexed by their keys, each associated with the
+  // matching by_freshness_ iterator.
+  absl::flat_hash_map<ZSTD_DDictKey, ByFreshness::iterator> by_key_
+      GUARDED_BY(mutex_);
+};
+
+// Before C++17 if a constexpr static data member is ODR-used, its definition
+// at namespace scope is required. Since C++17 these definitions are
+// deprecated: http://en.cppreference.com/w/cpp/language/static
+#if __cplusplus < 201703
+constexpr size_t DDictCache::kMaxSize;
+#endif
+
+DDictCache& DDictCache::global() {
+  static NoDestructor<DDictCache> kStaticCache;
+  return *kStaticCache;
+}
+
+std::shared_ptr<const ZSTD_DDict> DDictCache::Get(ZSTD_DDictKey key) {
+  {
+    absl::MutexLock lock(&mutex_);
+    const auto iter = by_key_.find(key);
+    if (ABSL_PREDICT_TRUE(iter != by_key_.end())) {
+      by_freshness_.splice(by_freshness_.end(), by_freshness_, iter->second);
+      return iter->second->second;
+    }
+  }
+  // Prepare the dictionary without holding mutex_; this can take long for a
+  // large dictionary. Concurrent calls with the same key can prepare it
+  // multiple times; all copies but one are soon freed.
+  std::shared_ptr<const ZSTD_DDict> ddict(
+      ZSTD_createDDict(key.dictionary->data(), key.dictionary->size()),
+      ZSTD_DDictDeleter());
+  if (ABSL_PREDICT_FALSE(ddict == nullptr)) return nullptr;
+  absl::MutexLock lock(&mutex_);
+  const auto insert_result = by_key_.emplace(key, by_freshness_.end());
+  if (ABSL_PREDICT_FALSE(!insert_result.second)) {
+    // Another thread has prepared the same dictionary in the meantime; share
+    // its copy instead.
+    return insert_result.first->second->second;
+  }
+  insert_result.first->second =
+      by_freshness_.emplace(by_freshness_.end(), std::move(key), ddict);
+  if (by_freshness_.size() > kMaxSize) {
+    by_key_.erase(by_freshness_.front().first);
+    by_freshness_.pop_front();
+  }
+  return ddict;
+}
+
+}  // namespace
+
+void ZstdReaderBase::Initialize(Reader* src,
+                                std::shared_ptr<const std::string> dictionary) {
   RIEGELI_ASSERT(src != nullptr)
       << "Failed precondition of ZstdReader<Src>::ZstdReader(Src): "
          "null Reader pointer";
@@ -40,6 +162,11 @@ void ZstdReaderBase::Initialize(Reader* src) {
     Fail(*src);
     return;
   }
+  // Recycling the decompression context avoids paying its allocation and
+  // setup cost for each of many small compressed streams, e.g. chunks of a
+  // Riegeli/records file. The context is returned to the pool as soon as the
+  // compressed stream ends. ZSTD_DStream has no creation parameters which
+  // would need to be part of a pool key; all its state is set below.
   decompressor_ =
       RecyclingPool<ZSTD_DStream, ZSTD_DStreamDeleter>::global().Get([] {
         return std::unique_ptr<ZSTD_DStream, ZSTD_DStreamDeleter>(
@@ -50,9 +177,22 @@ void ZstdReaderBase::Initialize(Reader* src) {
     return;
   }
   {
-    const size_t result = ZSTD_initDStream(decompressor_.get());
+    size_t result;
+    absl::string_view function_name;
+    if (dictionary != nullptr) {
+      ddict_ = DDictCache::global().Get(ZSTD_DDictKey{std::move(dictionary)});
+      if (ABSL_PREDICT_FALSE(ddict_ == nullptr)) {
+        Fail(InternalError("ZSTD_createDDict() failed"));
+        return;
+      }
+      result = ZSTD_initDStream_usingDDict(decompressor_.get(), ddict_.get());
+      function_name = "ZSTD_initDStream_usingDDict()";
+    } else {
+      result = ZSTD_initDStream(decompressor_.get());
+      function_name = "ZSTD_initDStream()";
+    }
     if (ABSL_PREDICT_FALSE(ZSTD_isError(result))) {
-      Fail(InternalError(absl::StrCat("ZSTD_initDStream() failed: ",
+      Fail(InternalError(absl::StrCat(function_name, " failed: ",
                                       ZSTD_getErrorName(result))));
       return;
     }
@@ -86,6 +226,7 @@ void ZstdReaderBase::Done() {
     Fail(DataLossError("Truncated Zstd-compressed stream"));
   }
   decompressor_.reset();
+  ddict_.reset();
   BufferedReader::Done();
 }
 
@@ -18,9 +18,11 @@
 #include <stddef.h>
 
 #include <memory>
+#include <string>
 #include <utility>
 
 #include "absl/base/optimization.h"
+#include "absl/strings/string_view.h"
 #include "absl/utility/utility.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/dependency.h"
@@ -50,6 +52,39 @@ class ZstdReaderBase : public BufferedReader {
       return std::move(set_size_hint(size_hint));
     }
 
+    // Zstd dictionary. The same dictionary as used for compression.
+    //
+    // Loading the dictionary contents is expensive, hence the dictionary is
+    // prepared once per distinct contents and the prepared form is shared
+    // among ZstdReaders, instead of being loaded again for each compressed
+    // stream.
+    //
+    // Default: empty.
+    Options& set_dictionary(absl::string_view dictionary) & {
+      dictionary_ =
+          dictionary.empty()
+              ? nullptr
+              : std::make_shared<const std::string>(dictionary.data(),
+                                                    dictionary.size());
+      return *this;
+    }
+    Options&& set_dictionary(absl::string_view dictionary) && {
+      return std::move(set_dictionary(dictionary));
+    }
+
+    // Like above, but shares the dictionary contents which are already owned
+    // elsewhere, instead of copying them.
+    Options& set_dictionary(
+        std::shared_ptr<const std::string> dictionary) & {
+      dictionary_ = dictionary != nullptr && dictionary->empty()
+                        ? nullptr
+                        : std::move(dictionary);
+      return *this;
+    }
+    Options&& set_dictionary(std::shared_ptr<const std::string> dictionary) && {
+      return std::move(set_dictionary(std::move(dictionary)));
+    }
+
     // Tunes how much data is buffered after calling the decompression engine.
     //
     // Default: ZSTD_DStreamOutSize()
@@ -71,6 +106,7 @@ class ZstdReaderBase : public BufferedReader {
     friend class ZstdReader;
 
     Position size_hint_ = 0;
+    std::shared_ptr<const std::string> dictionary_;
     size_t buffer_size_ = DefaultBufferSize();
   };
 
@@ -87,7 +123,7 @@ class ZstdReaderBase : public BufferedReader {
   ZstdReaderBase(ZstdReaderBase&& that) noexcept;
   ZstdReaderBase& operator=(ZstdReaderBase&& that) noexcept;
 
-  void Initialize(Reader* src);
+  void Initialize(Reader* src, std::shared_ptr<const std::string> dictionary);
   void Done() override;
   bool PullSlow() override;
   bool ReadInternal(char* dest, size_t min_length, size_t max_length) override;
@@ -101,6 +137,10 @@ class ZstdReaderBase : public BufferedReader {
   // stream) at the current position. If the source does not grow, Close() will
   // fail.
   bool truncated_ = false;
+  // If not nullptr, the prepared dictionary, shared with other ZstdReaders
+  // using a dictionary with the same contents. Must outlive usage of
+  // decompressor_ initialized with it.
+  std::shared_ptr<const ZSTD_DDict> ddict_;
   // If healthy() but decompressor_ == nullptr then all data have been
   // decompressed. In this case ZSTD_decompressStream() must not be called
   // again.
@@ -150,12 +190,14 @@ class ZstdReader : public ZstdReaderBase {
 inline ZstdReaderBase::ZstdReaderBase(ZstdReaderBase&& that) noexcept
     : BufferedReader(std::move(that)),
       truncated_(absl::exchange(that.truncated_, false)),
+      ddict_(std::move(that.ddict_)),
       decompressor_(std::move(that.decompressor_)) {}
 
 inline ZstdReaderBase& ZstdReaderBase::operator=(
     ZstdReaderBase&& that) noexcept {
   BufferedReader::operator=(std::move(that));
   truncated_ = absl::exchange(that.truncated_, false);
+  ddict_ = std::move(that.ddict_);
   decompressor_ = std::move(that.decompressor_);
   return *this;
 }
@@ -164,7 +206,7 @@ template <typename Src>
 ZstdReader<Src>::ZstdReader(Src src, Options options)
     : ZstdReaderBase(options.buffer_size_, options.size_hint_),
       src_(std::move(src)) {
-  Initialize(src_.get());
+  Initialize(src_.get(), std::move(options.dictionary_));
 }
 
 template <typename Src>
@@ -12,8 +12,10 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
-// Make ZSTD_WINDOWLOG_MIN, ZSTD_WINDOWLOG_MAX, ZSTD_getParams(), and
-// ZSTD_initCStream_advanced() available.
+// Make ZSTD_WINDOWLOG_MIN, ZSTD_WINDOWLOG_MAX, ZSTD_getParams(),
+// ZSTD_initCStream_advanced(), ZSTD_createCDict_advanced(),
+// ZSTD_initCStream_usingCDict_advanced(), and (on zstd older than 1.4.0)
+// ZSTD_CCtx_setParameter() available.
 #define ZSTD_STATIC_LINKING_ONLY
 
 #include "riegeli/bytes/zstd_writer.h"
@@ -21,13 +23,21 @@
 #include <stddef.h>
 
 #include <limits>
+#include <list>
+#include <memory>
+#include <string>
+#include <utility>
 
 #include "absl/base/optimization.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
 #include "absl/types/optional.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/canonical_errors.h"
+#include "riegeli/base/memory.h"
 #include "riegeli/base/recycling_pool.h"
 #include "riegeli/bytes/buffered_writer.h"
 #include "riegeli/bytes/writer.h"
@@ -61,10 +71,134 @@ int SizeHintClass(Position size_hint) {
          (size_hint <= Position{16} << 10 ? 1 : 0);
 }
 
+struct ZSTD_CDictDeleter {
+  void operator()(ZSTD_CDict* ptr) const { ZSTD_freeCDict(ptr); }
+};
+
+// Key of a prepared dictionary: its contents together with the options which
+// determine the compression parameters baked into the prepared form.
+struct ZSTD_CDictKey {
+  friend bool operator==(const ZSTD_CDictKey& a, const ZSTD_CDictKey& b) {
+    return a.compression_level == b.compression_level &&
+           a.window_log == b.window_log &&
+           a.size_hint_class == b.size_hint_class &&
+           *a.dictionary == *b.dictionary;
+  }
+  friend bool operator!=(const ZSTD_CDictKey& a, const ZSTD_CDictKey& b) {
+    return !(a == b);
+  }
+  template <typename HashState>
+  friend HashState AbslHashValue(HashState hash_state,
+                                 const ZSTD_CDictKey& self) {
+    return HashState::combine(std::move(hash_state), *self.dictionary,
+                              self.compression_level, self.window_log,
+                              self.size_hint_class);
+  }
+
+  // Keys are compared by the dictionary contents, not by the pointer; the
+  // pointer is shared with Options to avoid copying the contents.
+  std::shared_ptr<const std::string> dictionary;
+  int compression_level;
+  int window_log;
+  int size_hint_class;
+};
+
+// Cache of prepared dictionaries. ZSTD_createCDict_advanced() digests the
+// dictionary contents, which costs much more than referencing an already
+// prepared dictionary, hence each dictionary is prepared once per distinct key
+// and shared among ZstdWriters. A prepared dictionary is immutable, so sharing
+// it among concurrent ZstdWriters is safe. The cache also keeps the most
+// recently used dictionaries alive while no ZstdWriter uses them, so that
+// streams compressed one after another (e.g. chunks of a Riegeli/records
+// file) reuse the prepared form.
+class CDictCache {
+ public:
+  CDictCache() {}
+
+  CDictCache(const CDictCache&) = delete;
+  CDictCache& operator=(const CDictCache&) = delete;
+
+  // Returns a default global cache.
+  static CDictCache& global();
+
+  // Returns the prepared dictionary for the given key, preparing it with the
+  // given compression parameters if absent, or nullptr if
+  // ZSTD_createCDict_advanced() failed.
+  std::shared_ptr<const ZSTD_CDict> Get(ZSTD_CDictKey key,
+                                        ZSTD_compressionParameters cparams);
+
+ private:
+  // Number of most recently used dictionaries kept alive while unused.
+  static constexpr size_t kMaxSize = 4;
+
+  // Adding or removing elements in ByFreshness must not invalidate iterators
+  // to other elements.
+  using ByFreshness =
+      std::list<std::pair<ZSTD_CDictKey, std::shared_ptr<const ZSTD_CDict>>>;
+
+  absl::Mutex mutex_;
+  // Prepared dictionaries, ordered by the freshness of their last use (older
+  // to newer).
+  ByFreshness by_freshness_ GUARDED_BY(mutex_);
+  // Prepared dictionaries indexed by their keys, each associated with the
+  // matching by_freshness_ iterator.
+  absl::flat_hash_map<ZSTD_CDictKey, ByFreshness::iterator> by_key_
+      GUARDED_BY(mutex_);
+};
+
+// Before C++17 if a constexpr static data member is ODR-used, its definition
+// at namespace scope is required. Since C++17 these definitions are
+// deprecated: http://en.cppreference.com/w/cpp/language/static
+#if __cplusplus < 201703
+constexpr size_t CDictCache::kMaxSize;
+#endif
+
+CDictCache& CDictCache::global() {
+  static NoDestructor<CDictCache> kStaticCache;
+  return *kStaticCache;
+}
+
+std::shared_ptr<const ZSTD_CDict> CDictCache::Get(
+    ZSTD_CDictKey key, ZSTD_compressionParameters cparams) {
+  {
+    absl::MutexLock lock(&mutex_);
+    const auto iter = by_key_.find(key);
+    if (ABSL_PREDICT_TRUE(iter != by_key_.end())) {
+      by_freshness_.splice(by_freshness_.end(), by_freshness_, iter->second);
+      return iter->second->second;
+    }
+  }
+  // Prepare the dictionary without holding mutex_; this can take long for a
+  // large dictionary. Concurrent calls with the same key can prepare it
+  // multiple times; all copies but one are soon freed.
+  std::shared_ptr<const ZSTD_CDict> cdict(
+      ZSTD_createCDict_advanced(key.dictionary->data(), key.dictionary->size(),
+                                ZSTD_dlm_byCopy, ZSTD_dct_auto, cparams,
+                                ZSTD_defaultCMem),
+      ZSTD_CDictDeleter());
+  if (ABSL_PREDICT_FALSE(cdict == nullptr)) return nullptr;
+  absl::MutexLock lock(&mutex_);
+  const auto insert_result = by_key_.emplace(key, by_freshness_.end());
+  if (ABSL_PREDICT_FALSE(!insert_result.second)) {
+    // Another thread has prepared the same dictionary in the meantime; share
+    // its copy instead.
+    return insert_result.first->second->second;
+  }
+  insert_result.first->second =
+      by_freshness_.emplace(by_freshness_.end(), std::move(key), cdict);
+  if (by_freshness_.size() > kMaxSize) {
+    by_key_.erase(by_freshness_.front().first);
+    by_freshness_.pop_front();
+  }
+  return cdict;
+}
+
 }  // namespace
 
 void ZstdWriterBase::Initialize(Writer* dest, int compression_level,
-                                int window_log,
+                                int window_log, bool long_distance_matching,
+                                std::shared_ptr<const std::string> dictionary,
+                                int parallelism,
                                 absl::optional<Position> final_size,
                                 Position size_hint, bool store_checksum) {
   RIEGELI_ASSERT(dest != nullptr)
@@ -88,19 +222,63 @@ void ZstdWriterBase::Initialize(Writer* dest, int compression_level,
     return;
   }
   ZSTD_parameters params = ZSTD_getParams(
-      compression_level, IntCast<unsigned long long>(size_hint), 0);
+      compression_level, IntCast<unsigned long long>(size_hint),
+      dictionary == nullptr ? size_t{0} : dictionary->size());
   if (window_log >= 0) {
     params.cParams.windowLog = IntCast<unsigned>(window_log);
   }
   params.fParams.checksumFlag = store_checksum ? unsigned{1} : unsigned{0};
-  const size_t result = ZSTD_initCStream_advanced(
-      compressor_.get(), nullptr, 0, params,
+  const unsigned long long pledged_size =
       final_size.has_value() ? IntCast<unsigned long long>(*final_size)
-                             : ZSTD_CONTENTSIZE_UNKNOWN);
+                             : ZSTD_CONTENTSIZE_UNKNOWN;
+  size_t result;
+  absl::string_view function_name;
+  if (dictionary != nullptr) {
+    cdict_ = CDictCache::global().Get(
+        ZSTD_CDictKey{std::move(dictionary), compression_level, window_log,
+                      SizeHintClass(size_hint)},
+        params.cParams);
+    if (ABSL_PREDICT_FALSE(cdict_ == nullptr)) {
+      Fail(InternalError("ZSTD_createCDict_advanced() failed"));
+      return;
+    }
+    result = ZSTD_initCStream_usingCDict_advanced(
+        compressor_.get(), cdict_.get(), params.fParams, pledged_size);
+    function_name = "ZSTD_initCStream_usingCDict_advanced()";
+  } else {
+    result = ZSTD_initCStream_advanced(compressor_.get(), nullptr, 0, params,
+                                       pledged_size);
+    function_name = "ZSTD_initCStream_advanced()";
+  }
   if (ABSL_PREDICT_FALSE(ZSTD_isError(result))) {
-    Fail(InternalError(absl::StrCat("ZSTD_initCStream_advanced() failed: ",
+    Fail(InternalError(absl::StrCat(function_name, " failed: ",
                                     ZSTD_getErrorName(result))));
+    return;
+  }
+  if (long_distance_matching) {
+    // Like the number of workers, this parameter is reset by stream
+    // initialization, hence it is set afterwards, also for a compressor
+    // recycled from the pool. The parameter was introduced in zstd 1.3.2 and
+    // renamed in 1.4.0.
+#if ZSTD_VERSION_NUMBER >= 10400
+    ZSTD_CCtx_setParameter(compressor_.get(), ZSTD_c_enableLongDistanceMatching,
+                           1);
+#elif ZSTD_VERSION_NUMBER >= 10302
+    ZSTD_CCtx_setParameter(compressor_.get(), ZSTD_p_enableLongDistanceMatching,
+                           1);
+#endif
   }
+#if ZSTD_VERSION_NUMBER >= 10400
+  if (parallelism > 0) {
+    // ZSTD_initCStream_advanced() resets the number of workers, hence this is
+    // set afterwards, also for a compressor recycled from the pool. A failure
+    // means that the zstd library was built without multithreading support;
+    // compression then proceeds in the calling thread.
+    ZSTD_CCtx_setParameter(compressor_.get(), ZSTD_c_nbWorkers, parallelism);
+  }
+#else
+  (void)parallelism;
+#endif
 }
 
 void ZstdWriterBase::Done() {
@@ -111,6 +289,7 @@ void ZstdWriterBase::Done() {
     FlushInternal(ZSTD_endStream, "ZSTD_endStream()", dest);
   }
   compressor_.reset();
+  cdict_.reset();
   BufferedWriter::Done();
 }
 
@@ -138,14 +317,16 @@ bool ZstdWriterBase::WriteInternal(absl::string_view src) {
       return Fail(InternalError(absl::StrCat("ZSTD_compressStream() failed: ",
                                              ZSTD_getErrorName(result))));
     }
-    if (output.pos < output.size) {
-      RIEGELI_ASSERT_EQ(input.pos, input.size)
-          << "ZSTD_compressStream() returned but there are still input data "
-             "and output space";
+    if (input.pos == input.size) {
       start_pos_ += input.pos;
       return true;
     }
-    if (ABSL_PREDICT_FALSE(!dest->Push())) return Fail(*dest);
+    // With multiple worker threads ZSTD_compressStream() can return with
+    // input remaining even when output space remains; it still makes
+    // progress by accepting input into a worker buffer.
+    if (output.pos == output.size) {
+      if (ABSL_PREDICT_FALSE(!dest->Push())) return Fail(*dest);
+    }
   }
 }
 
@@ -180,9 +361,12 @@ bool ZstdWriterBase::FlushInternal(Function function,
       return Fail(InternalError(
           absl::StrCat(function_name, " failed: ", ZSTD_getErrorName(result))));
     }
-    RIEGELI_ASSERT_EQ(output.pos, output.size)
-        << function_name << " returned but there is still output space";
-    if (ABSL_PREDICT_FALSE(!dest->Push())) return Fail(*dest);
+    // With multiple worker threads the function can return with output space
+    // remaining while a worker is still compressing; calling it again blocks
+    // until more output is produced.
+    if (output.pos == output.size) {
+      if (ABSL_PREDICT_FALSE(!dest->Push())) return Fail(*dest);
+    }
   }
 }
 
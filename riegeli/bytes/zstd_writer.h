@@ -18,6 +18,7 @@
 #include <stddef.h>
 
 #include <memory>
+#include <string>
 #include <utility>
 
 #include "absl/base/optimization.h"
@@ -96,6 +97,58 @@ class ZstdWriterBase : public BufferedWriter {
       return std::move(set_window_log(window_log));
     }
 
+    // If true, enables long-distance matching
+    // (ZSTD_c_enableLongDistanceMatching): the compressor additionally looks
+    // for matches up to the full window size apart. This improves compression
+    // density when redundancy sits far apart, e.g. between similar records
+    // spread over a large chunk, at a small cost in compression speed and
+    // memory. It is most effective together with a large set_window_log().
+    //
+    // Ignored if the zstd library is older than 1.3.2.
+    //
+    // Default: false.
+    Options& set_long_distance_matching(bool long_distance_matching) & {
+      long_distance_matching_ = long_distance_matching;
+      return *this;
+    }
+    Options&& set_long_distance_matching(bool long_distance_matching) && {
+      return std::move(set_long_distance_matching(long_distance_matching));
+    }
+
+    // Zstd dictionary. The same dictionary must be used for decompression.
+    //
+    // A dictionary improves compression density of small, repetitive data.
+    // Digesting the dictionary contents is expensive, hence the dictionary is
+    // prepared once per distinct contents and compression options, and the
+    // prepared form is shared among ZstdWriters, instead of being digested
+    // again for each compressed stream.
+    //
+    // Default: empty.
+    Options& set_dictionary(absl::string_view dictionary) & {
+      dictionary_ =
+          dictionary.empty()
+              ? nullptr
+              : std::make_shared<const std::string>(dictionary.data(),
+                                                    dictionary.size());
+      return *this;
+    }
+    Options&& set_dictionary(absl::string_view dictionary) && {
+      return std::move(set_dictionary(dictionary));
+    }
+
+    // Like above, but shares the dictionary contents which are already owned
+    // elsewhere, instead of copying them.
+    Options& set_dictionary(
+        std::shared_ptr<const std::string> dictionary) & {
+      dictionary_ = dictionary != nullptr && dictionary->empty()
+                        ? nullptr
+                        : std::move(dictionary);
+      return *this;
+    }
+    Options&& set_dictionary(std::shared_ptr<const std::string> dictionary) && {
+      return std::move(set_dictionary(std::move(dictionary)));
+    }
+
     // Exact uncompressed size. This may improve compression density and
     // performance, and causes the size to be stored in the compressed stream
     // header.
@@ -135,6 +188,28 @@ class ZstdWriterBase : public BufferedWriter {
       return std::move(set_store_checksum(store_checksum));
     }
 
+    // Maximum number of zstd worker threads compressing one stream in
+    // parallel (ZSTD_c_nbWorkers), or 0 to compress in the calling thread.
+    //
+    // Nonzero values let a single large stream use multiple cores without
+    // compressing multiple streams concurrently, at a slight cost in
+    // compression density. Ignored, with compression proceeding in the
+    // calling thread, if the zstd library is older than 1.4.0 or was built
+    // without multithreading support.
+    //
+    // parallelism must be at least 0. Default: 0.
+    Options& set_parallelism(int parallelism) & {
+      RIEGELI_ASSERT_GE(parallelism, 0)
+          << "Failed precondition of "
+             "ZstdWriterBase::Options::set_parallelism(): "
+             "negative parallelism";
+      parallelism_ = parallelism;
+      return *this;
+    }
+    Options&& set_parallelism(int parallelism) && {
+      return std::move(set_parallelism(parallelism));
+    }
+
     // Tunes how much data is buffered before calling the compression engine.
     //
     // Default: ZSTD_CStreamInSize()
@@ -157,6 +232,9 @@ class ZstdWriterBase : public BufferedWriter {
 
     int compression_level_ = kDefaultCompressionLevel;
     int window_log_ = kDefaultWindowLog;
+    bool long_distance_matching_ = false;
+    std::shared_ptr<const std::string> dictionary_;
+    int parallelism_ = 0;
     absl::optional<Position> final_size_;
     Position size_hint_ = 0;
     bool store_checksum_ = false;
@@ -179,8 +257,10 @@ class ZstdWriterBase : public BufferedWriter {
   ZstdWriterBase& operator=(ZstdWriterBase&& that) noexcept;
 
   void Initialize(Writer* dest, int compression_level, int window_log,
-                  absl::optional<Position> final_size, Position size_hint,
-                  bool store_checksum);
+                  bool long_distance_matching,
+                  std::shared_ptr<const std::string> dictionary,
+                  int parallelism, absl::optional<Position> final_size,
+                  Position size_hint, bool store_checksum);
   void Done() override;
   bool WriteInternal(absl::string_view src) override;
 
@@ -214,6 +294,10 @@ class ZstdWriterBase : public BufferedWriter {
   bool FlushInternal(Function function, absl::string_view function_name,
                      Writer* dest);
 
+  // If not nullptr, the prepared dictionary, shared with other ZstdWriters
+  // using a dictionary with the same contents and compression options. Must
+  // outlive usage of compressor_ initialized with it.
+  std::shared_ptr<const ZSTD_CDict> cdict_;
   RecyclingPool<ZSTD_CStream, ZSTD_CStreamDeleter, ZSTD_CStreamKey>::Handle
       compressor_;
 };
@@ -259,11 +343,13 @@ class ZstdWriter : public ZstdWriterBase {
 
 inline ZstdWriterBase::ZstdWriterBase(ZstdWriterBase&& that) noexcept
     : BufferedWriter(std::move(that)),
+      cdict_(std::move(that.cdict_)),
       compressor_(std::move(that.compressor_)) {}
 
 inline ZstdWriterBase& ZstdWriterBase::operator=(
     ZstdWriterBase&& that) noexcept {
   BufferedWriter::operator=(std::move(that));
+  cdict_ = std::move(that.cdict_);
   compressor_ = std::move(that.compressor_);
   return *this;
 }
@@ -274,7 +360,8 @@ inline ZstdWriter<Dest>::ZstdWriter(Dest dest, Options options)
                      options.final_size_.value_or(options.size_hint_)),
       dest_(std::move(dest)) {
   Initialize(dest_.get(), options.compression_level_, options.window_log_,
-             options.final_size_,
+             options.long_distance_matching_, std::move(options.dictionary_),
+             options.parallelism_, options.final_size_,
              options.final_size_.value_or(options.size_hint_),
              options.store_checksum_);
 }
@@ -0,0 +1,148 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/chunk_encoding/aligned_encoder.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/canonical_errors.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/endian.h"
+#include "riegeli/base/memory_estimator.h"
+#include "riegeli/bytes/writer.h"
+#include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/chunk_encoding/constants.h"
+
+namespace riegeli {
+
+AlignedEncoder::AlignedEncoder(uint64_t size_hint)
+    : size_hint_(
+          UnsignedMin(size_hint, std::numeric_limits<size_t>::max())) {}
+
+void AlignedEncoder::Reset() {
+  ChunkEncoder::Reset();
+  values_.Clear();
+  limits_.clear();
+}
+
+bool AlignedEncoder::AddRecord(absl::string_view record) {
+  return AddRecordImpl(record);
+}
+
+bool AlignedEncoder::AddRecord(std::string&& record) {
+  return AddRecordImpl(std::move(record));
+}
+
+bool AlignedEncoder::AddRecord(const Chain& record) {
+  return AddRecordImpl(record);
+}
+
+bool AlignedEncoder::AddRecord(Chain&& record) {
+  return AddRecordImpl(std::move(record));
+}
+
+template <typename Record>
+bool AlignedEncoder::AddRecordImpl(Record&& record) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  if (ABSL_PREDICT_FALSE(num_records_ == kMaxNumRecords)) {
+    return Fail(ResourceExhaustedError("Too many records"));
+  }
+  if (ABSL_PREDICT_FALSE(record.size() > std::numeric_limits<uint64_t>::max() -
+                                             decoded_data_size_)) {
+    return Fail(ResourceExhaustedError("Decoded data size too large"));
+  }
+  ++num_records_;
+  decoded_data_size_ += IntCast<uint64_t>(record.size());
+  values_.Append(std::forward<Record>(record), size_hint_);
+  limits_.push_back(decoded_data_size_);
+  return true;
+}
+
+bool AlignedEncoder::AddRecords(Chain records, std::vector<size_t> limits) {
+  RIEGELI_ASSERT_EQ(limits.empty() ? size_t{0} : limits.back(), records.size())
+      << "Failed precondition of ChunkEncoder::AddRecords(): "
+         "record end positions do not match concatenated record values";
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  if (ABSL_PREDICT_FALSE(limits.size() > kMaxNumRecords - num_records_)) {
+    return Fail(ResourceExhaustedError("Too many records"));
+  }
+  if (ABSL_PREDICT_FALSE(records.size() > std::numeric_limits<uint64_t>::max() -
+                                              decoded_data_size_)) {
+    return Fail(ResourceExhaustedError("Decoded data size too large"));
+  }
+  const uint64_t base = decoded_data_size_;
+  num_records_ += IntCast<uint64_t>(limits.size());
+  decoded_data_size_ += IntCast<uint64_t>(records.size());
+  size_t start = 0;
+  for (const size_t limit : limits) {
+    RIEGELI_ASSERT_GE(limit, start)
+        << "Failed precondition of ChunkEncoder::AddRecords(): "
+           "record end positions not sorted";
+    RIEGELI_ASSERT_LE(limit, records.size())
+        << "Failed precondition of ChunkEncoder::AddRecords(): "
+           "record end positions do not match concatenated record values";
+    limits_.push_back(base + IntCast<uint64_t>(limit));
+    start = limit;
+  }
+  values_.Append(std::move(records), size_hint_);
+  return true;
+}
+
+bool AlignedEncoder::EncodeAndClose(Writer* dest, ChunkType* chunk_type,
+                                    uint64_t* num_records,
+                                    uint64_t* decoded_data_size) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  *chunk_type = ChunkType::kAligned;
+  *num_records = num_records_;
+  *decoded_data_size = decoded_data_size_;
+
+  Chain offsets;
+  const absl::Span<char> offsets_buffer =
+      offsets.AppendFixedBuffer(limits_.size() * sizeof(uint64_t));
+  WriteLittleEndian64s(limits_.data(), offsets_buffer.data(), limits_.size());
+  if (ABSL_PREDICT_FALSE(!dest->Write(std::move(offsets)))) {
+    return Fail(*dest);
+  }
+
+  // Alignment is relative to the beginning of the chunk header.
+  const Position values_begin = ChunkHeader::size() + dest->pos();
+  const Position padding =
+      (kAlignedChunkAlignment - values_begin % kAlignedChunkAlignment) %
+      kAlignedChunkAlignment;
+  if (ABSL_PREDICT_FALSE(!dest->WriteZeros(padding))) return Fail(*dest);
+
+  if (ABSL_PREDICT_FALSE(!dest->Write(std::move(values_)))) {
+    return Fail(*dest);
+  }
+  return Close();
+}
+
+void AlignedEncoder::RegisterUnique(MemoryEstimator* memory_estimator) const {
+  memory_estimator->RegisterDynamicMemory(sizeof(*this));
+  values_.RegisterSubobjects(memory_estimator);
+  memory_estimator->RegisterDynamicMemory(limits_.capacity() *
+                                          sizeof(uint64_t));
+}
+
+}  // namespace riegeli
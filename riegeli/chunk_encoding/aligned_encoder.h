@@ -0,0 +1,85 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_CHUNK_ENCODING_ALIGNED_ENCODER_H_
+#define RIEGELI_CHUNK_ENCODING_ALIGNED_ENCODER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/object.h"
+#include "riegeli/bytes/writer.h"
+#include "riegeli/chunk_encoding/chunk_encoder.h"
+#include "riegeli/chunk_encoding/constants.h"
+
+namespace riegeli {
+
+// Format of an aligned chunk (ChunkType::kAligned):
+//  - Record end offsets: "num_records" 64-bit Little Endian values, sorted,
+//    the last one equal to the decoded data size
+//  - Padding: zero bytes, until the offset in chunk data plus the size of
+//    the chunk header is a multiple of kAlignedChunkAlignment
+//  - Record values: concatenated record data (bytes), never compressed
+//
+// The boundary table is fixed width and stored up front, so a record can be
+// located without decoding anything, and record values are stored verbatim,
+// so a reader backed by a memory mapped file can return records as pointers
+// into the mapping with no decode step. When chunks begin at block
+// boundaries (RecordWriterBase::Options::set_pad_to_block_boundary()),
+// record values additionally begin at a multiple of kAlignedChunkAlignment
+// in the file.
+//
+// Intended for read-mostly datasets where read CPU matters more than
+// storage: the chunk is larger than a compressed one.
+class AlignedEncoder : public ChunkEncoder {
+ public:
+  // Creates an empty AlignedEncoder.
+  explicit AlignedEncoder(uint64_t size_hint);
+
+  void Reset() override;
+
+  using ChunkEncoder::AddRecord;
+  bool AddRecord(absl::string_view record) override;
+  bool AddRecord(std::string&& record) override;
+  bool AddRecord(const Chain& record) override;
+  bool AddRecord(Chain&& record) override;
+
+  bool AddRecords(Chain records, std::vector<size_t> limits) override;
+
+  bool EncodeAndClose(Writer* dest, ChunkType* chunk_type,
+                      uint64_t* num_records,
+                      uint64_t* decoded_data_size) override;
+
+  void RegisterUnique(MemoryEstimator* memory_estimator) const override;
+
+ private:
+  template <typename Record>
+  bool AddRecordImpl(Record&& record);
+
+  size_t size_hint_;
+  // Concatenated record values. Chain records are appended by sharing their
+  // blocks.
+  Chain values_;
+  // Sorted record end offsets in values_.
+  std::vector<uint64_t> limits_;
+};
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_CHUNK_ENCODING_ALIGNED_ENCODER_H_
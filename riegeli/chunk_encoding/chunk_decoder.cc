@@ -17,14 +17,20 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <memory>
+#include <string>
 #include <utility>
+#include <vector>
 
 #include "absl/base/optimization.h"
+#include "absl/memory/memory.h"
 #include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
 #include "google/protobuf/message_lite.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/canonical_errors.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/endian.h"
 #include "riegeli/base/object.h"
 #include "riegeli/base/status.h"
 #include "riegeli/bytes/chain_backward_writer.h"
@@ -46,13 +52,14 @@ void ChunkDecoder::Reset() {
   MarkHealthy();
   limits_.clear();
   values_reader_ = ChainReader<Chain>(Chain());
+  streaming_values_ = nullptr;
   index_ = 0;
+  record_copies_.clear();
   recoverable_ = false;
 }
 
 bool ChunkDecoder::Reset(const Chunk& chunk) {
   Reset();
-  ChainReader<> data_reader(&chunk.data);
   if (ABSL_PREDICT_FALSE(chunk.header.num_records() > limits_.max_size())) {
     return Fail(ResourceExhaustedError("Too many records"));
   }
@@ -60,6 +67,35 @@ bool ChunkDecoder::Reset(const Chunk& chunk) {
                          record_scratch_.max_size())) {
     return Fail(ResourceExhaustedError("Too large chunk"));
   }
+  if (ABSL_PREDICT_FALSE(streaming_) &&
+      chunk.header.chunk_type() == ChunkType::kSimple) {
+    return ResetStreaming(chunk);
+  }
+  // The cache applies only to record chunks whose decoded payload is a
+  // function of the chunk contents alone; a field projection or a Zstd
+  // dictionary makes it depend also on the decoder configuration or on
+  // earlier chunks.
+  const bool cache_applies =
+      decoded_chunk_cache_ != nullptr &&
+      (chunk.header.chunk_type() == ChunkType::kSimple ||
+       chunk.header.chunk_type() == ChunkType::kTransposed) &&
+      field_projection_.includes_all() && zstd_dictionary_ == nullptr;
+  DecodedChunkCache::Key cache_key;
+  if (ABSL_PREDICT_FALSE(cache_applies)) {
+    cache_key.data_hash = chunk.header.data_hash();
+    cache_key.data_size = chunk.header.data_size();
+    cache_key.num_records = chunk.header.num_records();
+    cache_key.decoded_data_size = chunk.header.decoded_data_size();
+    const std::shared_ptr<const DecodedChunkCache::Decoded> decoded =
+        decoded_chunk_cache_->Get(cache_key);
+    if (decoded != nullptr) {
+      limits_ = decoded->limits;
+      // Copying the Chain shares its blocks with the cache entry.
+      values_reader_ = ChainReader<Chain>(Chain(decoded->values));
+      return true;
+    }
+  }
+  ChainReader<> data_reader(&chunk.data);
   Chain values;
   if (ABSL_PREDICT_FALSE(!Parse(chunk.header, &data_reader, &values))) {
     limits_.clear();  // Ensure that index() == num_records().
@@ -78,10 +114,73 @@ bool ChunkDecoder::Reset(const Chunk& chunk) {
     RIEGELI_ASSERT_LE(values.size(), chunk.header.decoded_data_size())
         << "Wrong decoded data size";
   }
+  if (ABSL_PREDICT_FALSE(cache_applies)) {
+    decoded_chunk_cache_->Put(
+        cache_key, std::make_shared<DecodedChunkCache::Decoded>(
+                       limits_, values));
+  }
   values_reader_ = ChainReader<Chain>(std::move(values));
   return true;
 }
 
+inline bool ChunkDecoder::ResetStreaming(const Chunk& chunk) {
+  streaming_values_ = absl::make_unique<StreamingValues>(
+      chunk.data, chunk.header.num_records(),
+      chunk.header.decoded_data_size());
+  if (ABSL_PREDICT_FALSE(!StartStreamingValues())) {
+    streaming_values_ = nullptr;
+    limits_.clear();  // Ensure that index() == num_records().
+    return false;
+  }
+  RIEGELI_ASSERT_EQ(limits_.size(), chunk.header.num_records())
+      << "Wrong number of record end positions";
+  return true;
+}
+
+bool ChunkDecoder::StartStreamingValues() {
+  RIEGELI_ASSERT(streaming_values_ != nullptr)
+      << "Failed precondition of ChunkDecoder::StartStreamingValues(): "
+         "no streaming chunk";
+  StreamingValues& streaming = *streaming_values_;
+  streaming.data_reader = ChainReader<>(&streaming.data);
+  if (ABSL_PREDICT_FALSE(
+          !streaming.decoder.Reset(&streaming.data_reader,
+                                   streaming.num_records,
+                                   streaming.decoded_data_size, &limits_,
+                                   zstd_dictionary_))) {
+    return Fail(streaming.decoder);
+  }
+  return true;
+}
+
+bool ChunkDecoder::FailReadingValues() {
+  if (ABSL_PREDICT_FALSE(streaming_values_ == nullptr)) {
+    RIEGELI_ASSERT_UNREACHABLE()
+        << "Failed reading record from values reader: "
+        << values_reader_.status();
+  }
+  return Fail(*streaming_values_->decoder.reader(),
+              DataLossError("Reading record values failed"));
+}
+
+void ChunkDecoder::SetIndex(uint64_t index) {
+  RIEGELI_ASSERT(healthy())
+      << "Failed precondition of ChunkDecoder::SetIndex(): " << status();
+  index_ = UnsignedMin(index, num_records());
+  const size_t start =
+      index_ == 0 ? size_t{0} : limits_[IntCast<size_t>(index_ - 1)];
+  Reader* values = values_reader();
+  if (ABSL_PREDICT_FALSE(streaming_values_ != nullptr) &&
+      start < values->pos()) {
+    // Seeking backwards: restart decompression of the chunk.
+    if (ABSL_PREDICT_FALSE(!StartStreamingValues())) return;
+    values = values_reader();
+  }
+  if (ABSL_PREDICT_FALSE(!values->Seek(start))) {
+    FailReadingValues();
+  }
+}
+
 bool ChunkDecoder::Parse(const ChunkHeader& header, Reader* src, Chain* dest) {
   switch (header.chunk_type()) {
     case ChunkType::kFileSignature:
@@ -95,11 +194,8 @@ bool ChunkDecoder::Parse(const ChunkHeader& header, Reader* src, Chain* dest) {
             "Invalid file signature chunk: number of records is not zero: ",
             header.num_records())));
       }
-      if (ABSL_PREDICT_FALSE(header.decoded_data_size() != 0)) {
-        return Fail(DataLossError(absl::StrCat(
-            "Invalid file signature chunk: decoded data size is not zero: ",
-            header.decoded_data_size())));
-      }
+      // The decoded data size of a file signature chunk records the block
+      // size if it is not the default; it is validated by the chunk reader.
       return true;
     case ChunkType::kFileMetadata:
       if (ABSL_PREDICT_FALSE(header.num_records() != 0)) {
@@ -120,11 +216,53 @@ bool ChunkDecoder::Parse(const ChunkHeader& header, Reader* src, Chain* dest) {
             header.decoded_data_size())));
       }
       return true;
+    case ChunkType::kDictionary: {
+      if (ABSL_PREDICT_FALSE(header.num_records() != 0)) {
+        return Fail(DataLossError(absl::StrCat(
+            "Invalid dictionary chunk: number of records is not zero: ",
+            header.num_records())));
+      }
+      if (ABSL_PREDICT_FALSE(header.decoded_data_size() != 0)) {
+        return Fail(DataLossError(absl::StrCat(
+            "Invalid dictionary chunk: decoded data size is not zero: ",
+            header.decoded_data_size())));
+      }
+      std::string dictionary;
+      if (ABSL_PREDICT_FALSE(header.data_size() > dictionary.max_size())) {
+        return Fail(ResourceExhaustedError("Too large dictionary"));
+      }
+      if (ABSL_PREDICT_FALSE(
+              !src->Read(&dictionary, IntCast<size_t>(header.data_size())))) {
+        return Fail(*src, DataLossError("Reading dictionary failed"));
+      }
+      if (ABSL_PREDICT_FALSE(!src->VerifyEndAndClose())) return Fail(*src);
+      // The dictionary applies to all subsequent chunks of the file.
+      zstd_dictionary_ =
+          dictionary.empty()
+              ? nullptr
+              : std::make_shared<const std::string>(std::move(dictionary));
+      return true;
+    }
+    case ChunkType::kRecordIndex:
+      if (ABSL_PREDICT_FALSE(header.num_records() != 0)) {
+        return Fail(DataLossError(absl::StrCat(
+            "Invalid record index chunk: number of records is not zero: ",
+            header.num_records())));
+      }
+      if (ABSL_PREDICT_FALSE(header.decoded_data_size() != 0)) {
+        return Fail(DataLossError(absl::StrCat(
+            "Invalid record index chunk: decoded data size is not zero: ",
+            header.decoded_data_size())));
+      }
+      // The index is interpreted by RecordReaderBase::SeekToRecord(), not
+      // here; for sequential reading the chunk encodes no records.
+      return true;
     case ChunkType::kSimple: {
       SimpleDecoder simple_decoder;
       if (ABSL_PREDICT_FALSE(!simple_decoder.Reset(src, header.num_records(),
                                                    header.decoded_data_size(),
-                                                   &limits_))) {
+                                                   &limits_,
+                                                   zstd_dictionary_))) {
         return Fail(simple_decoder);
       }
       dest->Clear();
@@ -139,19 +277,59 @@ bool ChunkDecoder::Parse(const ChunkHeader& header, Reader* src, Chain* dest) {
       if (ABSL_PREDICT_FALSE(!src->VerifyEndAndClose())) return Fail(*src);
       return true;
     }
-    case ChunkType::kTransposed: {
-      TransposeDecoder transpose_decoder;
+    case ChunkType::kAligned: {
+      const size_t num_records = IntCast<size_t>(header.num_records());
+      std::string offsets_bytes;
+      if (ABSL_PREDICT_FALSE(
+              !src->Read(&offsets_bytes, num_records * sizeof(uint64_t)))) {
+        return Fail(*src, DataLossError("Reading record end offsets failed"));
+      }
+      std::vector<uint64_t> offsets(num_records);
+      ReadLittleEndian64s(offsets_bytes.data(), offsets.data(), num_records);
+      limits_.reserve(num_records);
+      uint64_t previous_offset = 0;
+      for (const uint64_t offset : offsets) {
+        if (ABSL_PREDICT_FALSE(offset < previous_offset ||
+                               offset > header.decoded_data_size())) {
+          return Fail(DataLossError("Invalid record end offsets"));
+        }
+        limits_.push_back(IntCast<size_t>(offset));
+        previous_offset = offset;
+      }
+      if (ABSL_PREDICT_FALSE(previous_offset != header.decoded_data_size())) {
+        return Fail(DataLossError(
+            "Record end offsets do not match decoded data size"));
+      }
+      // Alignment is relative to the beginning of the chunk header.
+      const Position values_begin = ChunkHeader::size() + src->pos();
+      const Position padding =
+          (kAlignedChunkAlignment - values_begin % kAlignedChunkAlignment) %
+          kAlignedChunkAlignment;
+      if (ABSL_PREDICT_FALSE(!src->Skip(padding))) {
+        return Fail(*src, DataLossError("Skipping padding failed"));
+      }
+      dest->Clear();
+      if (ABSL_PREDICT_FALSE(
+              !src->Read(dest, IntCast<size_t>(header.decoded_data_size())))) {
+        return Fail(*src, DataLossError("Reading record values failed"));
+      }
+      if (ABSL_PREDICT_FALSE(!src->VerifyEndAndClose())) return Fail(*src);
+      return true;
+    }
+    case ChunkType::kTransposed:
+    case ChunkType::kTransposedColumnar: {
       dest->Clear();
       ChainBackwardWriter<> dest_writer(
           dest,
           ChainBackwardWriterBase::Options().set_size_hint(
               field_projection_.includes_all() ? header.decoded_data_size()
                                                : uint64_t{0}));
-      const bool ok = transpose_decoder.Reset(
+      const bool ok = transpose_decoder_.Reset(
           src, header.num_records(), header.decoded_data_size(),
-          field_projection_, &dest_writer, &limits_);
+          header.chunk_type() == ChunkType::kTransposedColumnar,
+          field_projection_, &dest_writer, &limits_, zstd_dictionary_);
       if (ABSL_PREDICT_FALSE(!dest_writer.Close())) return Fail(dest_writer);
-      if (ABSL_PREDICT_FALSE(!ok)) return Fail(transpose_decoder);
+      if (ABSL_PREDICT_FALSE(!ok)) return Fail(transpose_decoder_);
       if (ABSL_PREDICT_FALSE(!src->VerifyEndAndClose())) return Fail(*src);
       return true;
     }
@@ -166,16 +344,17 @@ bool ChunkDecoder::Parse(const ChunkHeader& header, Reader* src, Chain* dest) {
 
 bool ChunkDecoder::ReadRecord(google::protobuf::MessageLite* record) {
   if (ABSL_PREDICT_FALSE(index() == num_records() || !healthy())) return false;
-  const size_t start = IntCast<size_t>(values_reader_.pos());
+  if (ABSL_PREDICT_FALSE(!SkipRejectedRecords())) return false;
+  Reader* const values = values_reader();
+  const size_t start = IntCast<size_t>(values->pos());
   const size_t limit = limits_[IntCast<size_t>(index_)];
   RIEGELI_ASSERT_LE(start, limit)
       << "Failed invariant of ChunkDecoder: record end positions not sorted";
   Status parse_status =
-      ParseFromReader(record, LimitingReader<>(&values_reader_, limit));
+      ParseFromReader(record, LimitingReader<>(values, limit));
   if (ABSL_PREDICT_FALSE(!parse_status.ok())) {
-    if (!values_reader_.Seek(limit)) {
-      RIEGELI_ASSERT_UNREACHABLE()
-          << "Seeking record values failed: " << values_reader_.status();
+    if (ABSL_PREDICT_FALSE(!values->Seek(limit))) {
+      return FailReadingValues();
     }
     recoverable_ = true;
     return Fail(std::move(parse_status));
@@ -184,6 +363,112 @@ bool ChunkDecoder::ReadRecord(google::protobuf::MessageLite* record) {
   return true;
 }
 
+bool ChunkDecoder::SkipRejectedRecordsSlow() {
+  RIEGELI_ASSERT(record_filter_ != nullptr)
+      << "Failed precondition of ChunkDecoder::SkipRejectedRecordsSlow(): "
+         "no record filter";
+  while (index_ < num_records()) {
+    const size_t start = IntCast<size_t>(values_reader_.pos());
+    const size_t limit = limits_[IntCast<size_t>(index_)];
+    RIEGELI_ASSERT_LE(start, limit)
+        << "Failed invariant of ChunkDecoder: record end positions not sorted";
+    const size_t length = limit - start;
+    if (ABSL_PREDICT_TRUE(length <= values_reader_.available())) {
+      // The record is flat in one block of the decoded chunk; the filter
+      // sees a view into the chunk and nothing is consumed.
+      if (record_filter_(absl::string_view(values_reader_.cursor(), length))) {
+        return true;
+      }
+      values_reader_.set_cursor(values_reader_.cursor() + length);
+    } else {
+      // The record spans block boundaries of the decoded chunk; it is copied
+      // to be evaluated.
+      absl::string_view record;
+      if (ABSL_PREDICT_FALSE(
+              !values_reader_.Read(&record, &record_scratch_, length))) {
+        return FailReadingValues();
+      }
+      if (record_filter_(record)) {
+        // Return to the beginning of the record, to be read again by the
+        // caller.
+        if (ABSL_PREDICT_FALSE(!values_reader_.Seek(start))) {
+          return FailReadingValues();
+        }
+        return true;
+      }
+    }
+    ++index_;
+  }
+  return false;
+}
+
+bool ChunkDecoder::ReadRecordViewSlow(absl::string_view* record,
+                                      size_t length) {
+  // The record spans block boundaries of the decoded chunk, or the chunk is
+  // decoded in the streaming mode. Copy the record to storage which remains
+  // valid until the ChunkDecoder is reset or closed.
+  record_copies_.emplace_back();
+  std::string& copy = record_copies_.back();
+  if (ABSL_PREDICT_FALSE(!values_reader()->Read(&copy, length))) {
+    record_copies_.pop_back();
+    return FailReadingValues();
+  }
+  *record = copy;
+  ++index_;
+  return true;
+}
+
+size_t ChunkDecoder::ReadRecords(std::vector<absl::string_view>* records,
+                                 size_t max_records) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return 0;
+  const size_t num_read = IntCast<size_t>(
+      UnsignedMin(uint64_t{max_records}, num_records() - index_));
+  records->reserve(records->size() + num_read);
+  for (size_t i = 0; i < num_read; ++i) {
+    if (ABSL_PREDICT_FALSE(!SkipRejectedRecords())) return i;
+    const size_t start = IntCast<size_t>(values_reader()->pos());
+    const size_t limit = limits_[IntCast<size_t>(index_)];
+    RIEGELI_ASSERT_LE(start, limit)
+        << "Failed invariant of ChunkDecoder: record end positions not sorted";
+    const size_t length = limit - start;
+    if (ABSL_PREDICT_TRUE(streaming_values_ == nullptr &&
+                          length <= values_reader_.available())) {
+      records->emplace_back(values_reader_.cursor(), length);
+      values_reader_.set_cursor(values_reader_.cursor() + length);
+      ++index_;
+    } else {
+      absl::string_view record;
+      if (ABSL_PREDICT_FALSE(!ReadRecordViewSlow(&record, length))) return i;
+      records->push_back(record);
+    }
+  }
+  return num_read;
+}
+
+size_t ChunkDecoder::ReadRecords(std::vector<Chain>* records,
+                                 size_t max_records) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return 0;
+  const size_t num_read = IntCast<size_t>(
+      UnsignedMin(uint64_t{max_records}, num_records() - index_));
+  records->reserve(records->size() + num_read);
+  for (size_t i = 0; i < num_read; ++i) {
+    if (ABSL_PREDICT_FALSE(!SkipRejectedRecords())) return i;
+    Reader* const values = values_reader();
+    const size_t start = IntCast<size_t>(values->pos());
+    const size_t limit = limits_[IntCast<size_t>(index_)];
+    RIEGELI_ASSERT_LE(start, limit)
+        << "Failed invariant of ChunkDecoder: record end positions not sorted";
+    records->emplace_back();
+    if (ABSL_PREDICT_FALSE(!values->Read(&records->back(), limit - start))) {
+      records->pop_back();
+      FailReadingValues();
+      return i;
+    }
+    ++index_;
+  }
+  return num_read;
+}
+
 bool ChunkDecoder::Recover() {
   if (!recoverable_) return false;
   RIEGELI_ASSERT(!healthy()) << "Failed invariant of ChunkDecoder: "
@@ -18,21 +18,35 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <deque>
+#include <functional>
+#include <limits>
+#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "absl/base/attributes.h"
 #include "absl/base/optimization.h"
+#include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
 #include "absl/utility/utility.h"
 #include "google/protobuf/message_lite.h"
+#include "google/protobuf/repeated_field.h"
 #include "riegeli/base/base.h"
+#include "riegeli/base/canonical_errors.h"
 #include "riegeli/base/chain.h"
 #include "riegeli/base/object.h"
+#include "riegeli/base/status.h"
 #include "riegeli/bytes/chain_reader.h"
+#include "riegeli/bytes/limiting_reader.h"
+#include "riegeli/bytes/message_parse.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/chunk_encoding/decoded_chunk_cache.h"
 #include "riegeli/chunk_encoding/field_projection.h"
+#include "riegeli/chunk_encoding/simple_decoder.h"
+#include "riegeli/chunk_encoding/transpose_decoder.h"
 
 namespace riegeli {
 
@@ -53,10 +67,93 @@ class ChunkDecoder : public Object {
       return std::move(set_field_projection(std::move(field_projection)));
     }
 
+    // If not nullptr, a predicate evaluated inside the decode loop on a view
+    // of each record before the record is returned. Records rejected by the
+    // filter are skipped: reading functions return only accepted records,
+    // and a rejected record which is flat in the decoded chunk is never
+    // materialized or copied. Combined with set_field_projection() this
+    // pushes a filtering scan down to decoding.
+    //
+    // The view passed to the filter is valid only for the duration of the
+    // call. A record which spans block boundaries of the decoded chunk is
+    // copied to an internal buffer to be evaluated.
+    //
+    // Skipped records still advance index(), hence record positions of
+    // accepted records are the same as without the filter.
+    //
+    // The filter is not supported together with set_streaming(true):
+    // evaluating it peeks at the next record and returns to its beginning,
+    // which requires random access within the decoded chunk.
+    //
+    // Default: nullptr.
+    Options& set_record_filter(
+        std::function<bool(absl::string_view record)> record_filter) & {
+      record_filter_ = std::move(record_filter);
+      return *this;
+    }
+    Options&& set_record_filter(
+        std::function<bool(absl::string_view record)> record_filter) && {
+      return std::move(set_record_filter(std::move(record_filter)));
+    }
+
+    // If not nullptr, a cache of decoded chunk payloads consulted by Reset()
+    // before decompressing, and filled after decompressing, so that readers
+    // of the same hot chunks pay for each chunk's decode once. The cache is
+    // not owned and must outlive the ChunkDecoder; one cache is typically
+    // shared by many readers.
+    //
+    // The cache is content addressed through the hash stored in chunk
+    // headers; see DecodedChunkCache. It is not used for chunks decoded with
+    // a field projection or a Zstd dictionary in effect, whose decoded
+    // payload is not a function of the chunk contents alone, nor in the
+    // streaming mode, which avoids holding a decoded chunk in memory.
+    //
+    // Default: nullptr.
+    Options& set_decoded_chunk_cache(DecodedChunkCache* decoded_chunk_cache) & {
+      decoded_chunk_cache_ = decoded_chunk_cache;
+      return *this;
+    }
+    Options&& set_decoded_chunk_cache(
+        DecodedChunkCache* decoded_chunk_cache) && {
+      return std::move(set_decoded_chunk_cache(decoded_chunk_cache));
+    }
+
+    // If true, a simple chunk is decompressed incrementally, just ahead of
+    // the records being read, instead of being decompressed as a whole when
+    // the ChunkDecoder is reset. This bounds decoding memory by the
+    // compressed chunk plus the decompressor state instead of the
+    // decompressed chunk, allowing larger chunks without a larger memory
+    // footprint when records are read strictly forward.
+    //
+    // Differences from the default mode:
+    //  * corrupted record values can surface as a failure of any reading
+    //    function, not only of Reset();
+    //  * views returned by ReadRecordView() and
+    //    ReadRecords(vector<string_view>*) are always copies owned by the
+    //    ChunkDecoder;
+    //  * SetIndex() backwards restarts decompression of the chunk, which is
+    //    expensive.
+    //
+    // Transposed chunks are decompressed as a whole regardless: transposition
+    // interleaves record fields, hence their values cannot be streamed in
+    // record order.
+    //
+    // Default: false.
+    Options& set_streaming(bool streaming) & {
+      streaming_ = streaming;
+      return *this;
+    }
+    Options&& set_streaming(bool streaming) && {
+      return std::move(set_streaming(streaming));
+    }
+
    private:
     friend class ChunkDecoder;
 
     FieldProjection field_projection_ = FieldProjection::All();
+    bool streaming_ = false;
+    std::function<bool(absl::string_view record)> record_filter_;
+    DecodedChunkCache* decoded_chunk_cache_ = nullptr;
   };
 
   // Creates an empty ChunkDecoder.
@@ -78,9 +175,10 @@ class ChunkDecoder : public Object {
   // Reads the next record.
   //
   // ReadRecord(MessageLite*) parses raw bytes to a proto message after reading.
-  // The remaining overloads read raw bytes (they never generate a new failure).
-  // For ReadRecord(string_view*) the string_view is valid until the next
-  // non-const operation on this ChunkDecoder.
+  // The remaining overloads read raw bytes; they generate a new failure only
+  // in the streaming mode, where corrupted record values can surface during
+  // reading. For ReadRecord(string_view*) the string_view is valid until the
+  // next non-const operation on this ChunkDecoder.
   //
   // If key != nullptr, *key is set to the record index on success.
   //
@@ -93,6 +191,51 @@ class ChunkDecoder : public Object {
   bool ReadRecord(std::string* record);
   bool ReadRecord(Chain* record);
 
+  // Reads the next record, returning a view of it.
+  //
+  // Unlike ReadRecord(string_view*), the string_view remains valid until the
+  // ChunkDecoder is reset to another chunk or closed, not only until the next
+  // non-const operation. In the common case the view points directly into the
+  // decoded chunk and the record is not copied; records which span block
+  // boundaries of the decoded chunk, and all records in the streaming mode,
+  // are copied to storage owned by this ChunkDecoder.
+  //
+  // Return values:
+  //  * true                    - success (*record is set, healthy())
+  //  * false (when healthy())  - chunk ends
+  //  * false (when !healthy()) - failure
+  bool ReadRecordView(absl::string_view* record);
+
+  // Reads up to max_records next records in one call, appending them to
+  // *records. This amortizes the per-record call overhead when draining a
+  // chunk.
+  //
+  // ReadRecords(vector<string_view>*) appends views with the validity of
+  // ReadRecordView(): until the ChunkDecoder is reset to another chunk or
+  // closed. Like the raw bytes overloads of ReadRecord(), ReadRecords()
+  // generates a new failure only in the streaming mode.
+  //
+  // Returns the number of records read; less than max_records only if the
+  // chunk ends, 0 also if !healthy().
+  size_t ReadRecords(std::vector<absl::string_view>* records,
+                     size_t max_records);
+  size_t ReadRecords(std::vector<Chain>* records, size_t max_records);
+
+  // Reads up to max_records next records in one call, parsing each of them
+  // to a proto message appended to *records. If *records lives on a proto
+  // arena, the messages are allocated on that arena; this amortizes both the
+  // per-record call overhead and message allocation when draining a chunk.
+  //
+  // Unlike the raw bytes overloads of ReadRecords(), ReadMessages() can
+  // generate a new failure, when a record fails to parse; Recover() then
+  // allows to skip the unparsable record and read on.
+  //
+  // Returns the number of records read and parsed; less than max_records
+  // only if the chunk ends or a record failed to parse (then !healthy()).
+  template <typename Message>
+  size_t ReadMessages(google::protobuf::RepeatedPtrField<Message>* records,
+                      size_t max_records);
+
   // If !healthy() and the failure was caused by an unparsable message, then
   // Recover() allows reading again by skipping the unparsable message.
   //
@@ -111,28 +254,119 @@ class ChunkDecoder : public Object {
   //
   // If index > num_records(), the current index is set to num_records().
   //
+  // In the streaming mode a backward SetIndex() restarts decompression of
+  // the chunk, and SetIndex() can fail the ChunkDecoder on corrupted record
+  // values.
+  //
   // Precondition: healthy()
   void SetIndex(uint64_t index);
 
   // Returns the number of records. Unchanged by Close().
   uint64_t num_records() const { return IntCast<uint64_t>(limits_.size()); }
 
+  // Returns the Zstd dictionary loaded from a ChunkType::kDictionary chunk,
+  // or nullptr. Unchanged by Close().
+  const std::shared_ptr<const std::string>& zstd_dictionary() const {
+    return zstd_dictionary_;
+  }
+
+  // Sets the Zstd dictionary used for decoding subsequent chunks, as if it had
+  // been loaded from a dictionary chunk. This allows chunks of the same file
+  // to be decoded by multiple ChunkDecoders.
+  void set_zstd_dictionary(std::shared_ptr<const std::string> zstd_dictionary) {
+    zstd_dictionary_ = std::move(zstd_dictionary);
+  }
+
  protected:
   void Done() override;
 
  private:
+  // Streaming decompression state of a simple chunk; see
+  // Options::set_streaming().
+  struct StreamingValues {
+    explicit StreamingValues(const Chain& data, uint64_t num_records,
+                             uint64_t decoded_data_size)
+        : data(data),
+          num_records(num_records),
+          decoded_data_size(decoded_data_size) {}
+
+    // Compressed chunk data; blocks are shared with the chunk passed to
+    // Reset(), not copied.
+    Chain data;
+    uint64_t num_records = 0;
+    uint64_t decoded_data_size = 0;
+    ChainReader<> data_reader;
+    SimpleDecoder decoder;
+  };
+
   bool Parse(const ChunkHeader& header, Reader* src, Chain* dest);
 
-  FieldProjection field_projection_;
+  // Begins decoding a simple chunk in the streaming mode.
+  bool ResetStreaming(const Chunk& chunk);
+
+  // Starts or restarts decompression of *streaming_values_ from the
+  // beginning, filling limits_.
+  //
+  // Precondition: streaming_values_ != nullptr
+  bool StartStreamingValues();
+
+  // Returns the reader of concatenated record values: the decompressed chunk
+  // held in memory, or the streaming decompressor.
+  Reader* values_reader() {
+    return ABSL_PREDICT_FALSE(streaming_values_ != nullptr)
+               ? streaming_values_->decoder.reader()
+               : &values_reader_;
+  }
+
+  // Handles a failure of reading record values in the streaming mode, where
+  // corruption can surface during reading; with the decompressed chunk held
+  // in memory reading cannot fail.
+  //
+  // Always returns false.
+  ABSL_ATTRIBUTE_COLD bool FailReadingValues();
+
+  bool ReadRecordViewSlow(absl::string_view* record, size_t length);
+
+  // Skips records rejected by record_filter_, if any, leaving the decoder
+  // before the next accepted record. Returns false if the chunk ends while
+  // skipping.
+  bool SkipRejectedRecords();
+  bool SkipRejectedRecordsSlow();
+
+  // The field projection, compiled once and reused for all chunks.
+  CompiledFieldProjection field_projection_;
+  // See Options::set_record_filter(). Kept across chunks.
+  std::function<bool(absl::string_view record)> record_filter_;
+  // See Options::set_decoded_chunk_cache(). Kept across chunks; not owned.
+  DecodedChunkCache* decoded_chunk_cache_ = nullptr;
+  // Kept across chunks so that its header cache can be reused when
+  // consecutive chunks share the same header.
+  TransposeDecoder transpose_decoder_;
   // Invariants if healthy():
   //   limits_ are sorted
-  //   (limits_.empty() ? 0 : limits_.back()) == size of values_reader_
-  //   (index_ == 0 ? 0 : limits_[index_ - 1]) == values_reader_.pos()
+  //   (limits_.empty() ? 0 : limits_.back()) == total size of record values
+  //   (index_ == 0 ? 0 : limits_[index_ - 1]) == values_reader()->pos()
   std::vector<size_t> limits_;
+  // Holds the decoded chunk, unless the chunk is decoded in the streaming
+  // mode; then record values are read from streaming_values_->decoder and
+  // values_reader_ is empty.
   ChainReader<Chain> values_reader_;
+  // See Options::set_streaming().
+  bool streaming_ = false;
+  // Present while a simple chunk is being decoded in the streaming mode.
+  std::unique_ptr<StreamingValues> streaming_values_;
   // Invariant: index_ <= num_records()
   uint64_t index_ = 0;
   std::string record_scratch_;
+  // Zstd dictionary loaded from a ChunkType::kDictionary chunk, or nullptr.
+  // Kept across chunks: the dictionary applies to all subsequent chunks of
+  // the file.
+  std::shared_ptr<const std::string> zstd_dictionary_;
+  // Copies of records which span block boundaries of the decoded chunk,
+  // returned by ReadRecordView(). A deque so that elements are not moved when
+  // more records are copied; views returned earlier remain valid until the
+  // ChunkDecoder is reset or closed.
+  std::deque<std::string> record_copies_;
   // Whether Recover() is applicable.
   //
   // Invariant: if recoverable_ then !healthy()
@@ -143,40 +377,68 @@ class ChunkDecoder : public Object {
 
 inline ChunkDecoder::ChunkDecoder(Options options)
     : Object(State::kOpen),
-      field_projection_(std::move(options.field_projection_)),
-      values_reader_(Chain()) {}
+      field_projection_(options.field_projection_),
+      record_filter_(std::move(options.record_filter_)),
+      decoded_chunk_cache_(options.decoded_chunk_cache_),
+      values_reader_(Chain()),
+      streaming_(options.streaming_) {
+  RIEGELI_ASSERT(record_filter_ == nullptr || !streaming_)
+      << "Failed precondition of ChunkDecoder::ChunkDecoder(): "
+         "a record filter is not supported in the streaming mode";
+}
 
 inline ChunkDecoder::ChunkDecoder(ChunkDecoder&& that) noexcept
     : Object(std::move(that)),
       field_projection_(std::move(that.field_projection_)),
+      record_filter_(std::move(that.record_filter_)),
+      decoded_chunk_cache_(absl::exchange(that.decoded_chunk_cache_, nullptr)),
+      transpose_decoder_(std::move(that.transpose_decoder_)),
       limits_(std::move(that.limits_)),
       values_reader_(
           absl::exchange(that.values_reader_, ChainReader<Chain>(Chain()))),
+      streaming_(that.streaming_),
+      streaming_values_(std::move(that.streaming_values_)),
       index_(absl::exchange(that.index_, 0)),
       record_scratch_(absl::exchange(that.record_scratch_, std::string())),
+      zstd_dictionary_(std::move(that.zstd_dictionary_)),
+      record_copies_(std::move(that.record_copies_)),
       recoverable_(absl::exchange(that.recoverable_, false)) {}
 
 inline ChunkDecoder& ChunkDecoder::operator=(ChunkDecoder&& that) noexcept {
   Object::operator=(std::move(that));
   field_projection_ = std::move(that.field_projection_);
+  record_filter_ = std::move(that.record_filter_);
+  decoded_chunk_cache_ = absl::exchange(that.decoded_chunk_cache_, nullptr);
+  transpose_decoder_ = std::move(that.transpose_decoder_);
   limits_ = std::move(that.limits_);
   values_reader_ =
       absl::exchange(that.values_reader_, ChainReader<Chain>(Chain()));
+  streaming_ = that.streaming_;
+  streaming_values_ = std::move(that.streaming_values_);
   index_ = absl::exchange(that.index_, 0);
   record_scratch_ = absl::exchange(that.record_scratch_, std::string());
+  zstd_dictionary_ = std::move(that.zstd_dictionary_);
+  record_copies_ = std::move(that.record_copies_);
   recoverable_ = absl::exchange(that.recoverable_, false);
   return *this;
 }
 
+inline bool ChunkDecoder::SkipRejectedRecords() {
+  if (ABSL_PREDICT_TRUE(record_filter_ == nullptr)) return true;
+  return SkipRejectedRecordsSlow();
+}
+
 inline bool ChunkDecoder::ReadRecord(absl::string_view* record) {
   if (ABSL_PREDICT_FALSE(index() == num_records() || !healthy())) return false;
-  const size_t start = IntCast<size_t>(values_reader_.pos());
+  if (ABSL_PREDICT_FALSE(!SkipRejectedRecords())) return false;
+  Reader* const values = values_reader();
+  const size_t start = IntCast<size_t>(values->pos());
   const size_t limit = limits_[IntCast<size_t>(index_)];
   RIEGELI_ASSERT_LE(start, limit)
       << "Failed invariant of ChunkDecoder: record end positions not sorted";
-  if (!values_reader_.Read(record, &record_scratch_, limit - start)) {
-    RIEGELI_ASSERT_UNREACHABLE() << "Failed reading record from values reader: "
-                                 << values_reader_.status();
+  if (ABSL_PREDICT_FALSE(
+          !values->Read(record, &record_scratch_, limit - start))) {
+    return FailReadingValues();
   }
   ++index_;
   return true;
@@ -184,14 +446,15 @@ inline bool ChunkDecoder::ReadRecord(absl::string_view* record) {
 
 inline bool ChunkDecoder::ReadRecord(std::string* record) {
   if (ABSL_PREDICT_FALSE(index() == num_records() || !healthy())) return false;
-  const size_t start = IntCast<size_t>(values_reader_.pos());
+  if (ABSL_PREDICT_FALSE(!SkipRejectedRecords())) return false;
+  Reader* const values = values_reader();
+  const size_t start = IntCast<size_t>(values->pos());
   const size_t limit = limits_[IntCast<size_t>(index_)];
   RIEGELI_ASSERT_LE(start, limit)
       << "Failed invariant of ChunkDecoder: record end positions not sorted";
   record->clear();
-  if (!values_reader_.Read(record, limit - start)) {
-    RIEGELI_ASSERT_UNREACHABLE() << "Failed reading record from values reader: "
-                                 << values_reader_.status();
+  if (ABSL_PREDICT_FALSE(!values->Read(record, limit - start))) {
+    return FailReadingValues();
   }
   ++index_;
   return true;
@@ -199,29 +462,90 @@ inline bool ChunkDecoder::ReadRecord(std::string* record) {
 
 inline bool ChunkDecoder::ReadRecord(Chain* record) {
   if (ABSL_PREDICT_FALSE(index() == num_records() || !healthy())) return false;
-  const size_t start = IntCast<size_t>(values_reader_.pos());
+  if (ABSL_PREDICT_FALSE(!SkipRejectedRecords())) return false;
+  Reader* const values = values_reader();
+  const size_t start = IntCast<size_t>(values->pos());
   const size_t limit = limits_[IntCast<size_t>(index_)];
   RIEGELI_ASSERT_LE(start, limit)
       << "Failed invariant of ChunkDecoder: record end positions not sorted";
   record->Clear();
-  if (!values_reader_.Read(record, limit - start)) {
-    RIEGELI_ASSERT_UNREACHABLE() << "Failed reading record from values reader: "
-                                 << values_reader_.status();
+  if (ABSL_PREDICT_FALSE(!values->Read(record, limit - start))) {
+    return FailReadingValues();
   }
   ++index_;
   return true;
 }
 
-inline void ChunkDecoder::SetIndex(uint64_t index) {
-  RIEGELI_ASSERT(healthy())
-      << "Failed precondition of ChunkDecoder::SetIndex(): " << status();
-  index_ = UnsignedMin(index, num_records());
-  const size_t start =
-      index_ == 0 ? size_t{0} : limits_[IntCast<size_t>(index_ - 1)];
-  if (!values_reader_.Seek(start)) {
-    RIEGELI_ASSERT_UNREACHABLE()
-        << "Failed seeking values reader: " << values_reader_.status();
+inline bool ChunkDecoder::ReadRecordView(absl::string_view* record) {
+  if (ABSL_PREDICT_FALSE(index() == num_records() || !healthy())) return false;
+  if (ABSL_PREDICT_FALSE(!SkipRejectedRecords())) return false;
+  const size_t start = IntCast<size_t>(values_reader()->pos());
+  const size_t limit = limits_[IntCast<size_t>(index_)];
+  RIEGELI_ASSERT_LE(start, limit)
+      << "Failed invariant of ChunkDecoder: record end positions not sorted";
+  const size_t length = limit - start;
+  if (ABSL_PREDICT_TRUE(streaming_values_ == nullptr &&
+                        length <= values_reader_.available())) {
+    // The record is flat in one block of the decoded chunk. The view points
+    // into the Chain owned by values_reader_, which is kept alive until the
+    // ChunkDecoder is reset or closed.
+    *record = absl::string_view(values_reader_.cursor(), length);
+    values_reader_.set_cursor(values_reader_.cursor() + length);
+    ++index_;
+    return true;
+  }
+  return ReadRecordViewSlow(record, length);
+}
+
+template <typename Message>
+size_t ChunkDecoder::ReadMessages(
+    google::protobuf::RepeatedPtrField<Message>* records, size_t max_records) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return 0;
+  const size_t num_to_read = IntCast<size_t>(
+      UnsignedMin(uint64_t{max_records}, num_records() - index_));
+  records->Reserve(records->size() + IntCast<int>(num_to_read));
+  for (size_t i = 0; i < num_to_read; ++i) {
+    if (ABSL_PREDICT_FALSE(!SkipRejectedRecords())) return i;
+    Reader* const values = values_reader();
+    const size_t start = IntCast<size_t>(values->pos());
+    const size_t limit = limits_[IntCast<size_t>(index_)];
+    RIEGELI_ASSERT_LE(start, limit)
+        << "Failed invariant of ChunkDecoder: record end positions not sorted";
+    const size_t length = limit - start;
+    Message* const record = records->Add();
+    if (ABSL_PREDICT_TRUE(
+            length <= values->available() &&
+            length <= size_t{std::numeric_limits<int>::max()})) {
+      // The record is flat in one block of the decoded chunk; parse it
+      // directly from the block, avoiding the virtual dispatch of parsing
+      // from a Reader.
+      if (ABSL_PREDICT_FALSE(!record->ParseFromArray(values->cursor(),
+                                                     IntCast<int>(length)))) {
+        Status parse_status = DataLossError(absl::StrCat(
+            "Failed to parse message of type ", record->GetTypeName()));
+        values->set_cursor(values->cursor() + length);
+        records->RemoveLast();
+        recoverable_ = true;
+        Fail(std::move(parse_status));
+        return i;
+      }
+    } else {
+      Status parse_status =
+          ParseFromReader(record, LimitingReader<>(values, limit));
+      if (ABSL_PREDICT_FALSE(!parse_status.ok())) {
+        records->RemoveLast();
+        if (ABSL_PREDICT_FALSE(!values->Seek(limit))) {
+          FailReadingValues();
+          return i;
+        }
+        recoverable_ = true;
+        Fail(std::move(parse_status));
+        return i;
+      }
+    }
+    ++index_;
   }
+  return num_to_read;
 }
 
 }  // namespace riegeli
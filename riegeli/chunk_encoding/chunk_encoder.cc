@@ -19,6 +19,7 @@
 #include "absl/base/optimization.h"
 #include "google/protobuf/message_lite.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/status.h"
 #include "riegeli/bytes/message_serialize.h"
 
@@ -44,4 +45,8 @@ bool ChunkEncoder::AddRecord(Chain&& record) {
   return AddRecord(record);
 }
 
+void ChunkEncoder::RegisterUnique(MemoryEstimator* memory_estimator) const {
+  memory_estimator->RegisterDynamicMemory(sizeof(*this));
+}
+
 }  // namespace riegeli
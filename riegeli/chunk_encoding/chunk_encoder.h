@@ -32,6 +32,8 @@
 
 namespace riegeli {
 
+class MemoryEstimator;
+
 class ChunkEncoder : public Object {
  public:
   // Creates an empty ChunkEncoder.
@@ -91,6 +93,11 @@ class ChunkEncoder : public Object {
                               uint64_t* num_records,
                               uint64_t* decoded_data_size) = 0;
 
+  // Registers this ChunkEncoder (sizeof(*this)) and its subobjects with
+  // *memory_estimator: buffers holding the records added so far. Sizes of
+  // compression contexts are not included.
+  virtual void RegisterUnique(MemoryEstimator* memory_estimator) const;
+
  protected:
   void Done() override;
 
@@ -14,17 +14,21 @@
 
 #include "riegeli/chunk_encoding/compressor.h"
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include <cmath>
 #include <utility>
 
 #include "absl/base/optimization.h"
+#include "absl/strings/string_view.h"
 #include "absl/types/variant.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/brotli_writer.h"
 #include "riegeli/bytes/chain_writer.h"
+#include "riegeli/bytes/snappy_writer.h"
 #include "riegeli/bytes/writer.h"
 #include "riegeli/bytes/writer_utils.h"
 #include "riegeli/bytes/zstd_writer.h"
@@ -34,6 +38,40 @@
 namespace riegeli {
 namespace internal {
 
+bool IsLikelyIncompressible(const Chain& data) {
+  // Data shorter than this gives a noisy entropy estimate and is cheap to
+  // compress anyway.
+  constexpr size_t kMinDataSize = 1024;
+  // At most this many bytes are sampled, spread evenly over the data.
+  constexpr size_t kMaxSampleSize = 4096;
+  // Entropy of the sample, in bits per byte, from which on the data is
+  // considered incompressible. Kept conservative: only nearly random data
+  // qualifies, so that a false positive cannot cost much density.
+  constexpr double kIncompressibleEntropy = 7.5;
+  if (data.size() < kMinDataSize) return false;
+  const size_t stride = UnsignedMax(data.size() / kMaxSampleSize, size_t{1});
+  size_t counts[256] = {0};
+  size_t num_sampled = 0;
+  size_t next_sample = 0;
+  size_t pos = 0;
+  for (const absl::string_view fragment : data.blocks()) {
+    while (next_sample < pos + fragment.size()) {
+      ++counts[static_cast<unsigned char>(fragment[next_sample - pos])];
+      ++num_sampled;
+      next_sample += stride;
+    }
+    pos += fragment.size();
+  }
+  double entropy = 0.0;
+  for (const size_t count : counts) {
+    if (count == 0) continue;
+    const double probability =
+        static_cast<double>(count) / static_cast<double>(num_sampled);
+    entropy -= probability * std::log2(probability);
+  }
+  return entropy >= kIncompressibleEntropy;
+}
+
 Compressor::Compressor(CompressorOptions compressor_options,
                        TuningOptions tuning_options)
     : Object(State::kOpen),
@@ -75,9 +113,19 @@ void Compressor::Reset() {
           ZstdWriterBase::Options()
               .set_compression_level(compressor_options_.compression_level())
               .set_window_log(compressor_options_.window_log())
+              .set_long_distance_matching(
+                  compressor_options_.long_distance_matching())
+              .set_dictionary(compressor_options_.zstd_dictionary())
               .set_final_size(tuning_options_.final_size_)
               .set_size_hint(tuning_options_.size_hint_));
       return;
+    case CompressionType::kSnappy:
+      writer_ = SnappyWriter<ChainWriter<>>(
+          std::move(compressed_writer),
+          SnappyWriterBase::Options().set_size_hint(
+              tuning_options_.final_size_.value_or(
+                  tuning_options_.size_hint_)));
+      return;
   }
   RIEGELI_ASSERT_UNREACHABLE()
       << "Unknown compression type: "
@@ -100,5 +148,11 @@ bool Compressor::EncodeAndClose(Writer* dest) {
   return Close();
 }
 
+void Compressor::RegisterSubobjects(MemoryEstimator* memory_estimator) const {
+  // Data still buffered inside the compressing writer and the size of the
+  // compression context are not included.
+  compressed_.RegisterSubobjects(memory_estimator);
+}
+
 }  // namespace internal
 }  // namespace riegeli
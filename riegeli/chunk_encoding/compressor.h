@@ -24,13 +24,26 @@
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/brotli_writer.h"
 #include "riegeli/bytes/chain_writer.h"
+#include "riegeli/bytes/snappy_writer.h"
 #include "riegeli/bytes/writer.h"
 #include "riegeli/bytes/zstd_writer.h"
 #include "riegeli/chunk_encoding/compressor_options.h"
 
 namespace riegeli {
+
+class MemoryEstimator;
+
 namespace internal {
 
+// Returns true if data looks incompressible: bytes sampled from data have an
+// empirical entropy close to 8 bits per byte, as is the case for already
+// compressed or encrypted values and random identifiers. The probe reads a
+// bounded sample, so it is much cheaper than a compression attempt.
+//
+// Used to decide per bucket of transposed values whether full compression
+// effort is worthwhile.
+bool IsLikelyIncompressible(const Chain& data);
+
 class Compressor : public Object {
  public:
   class TuningOptions {
@@ -102,6 +115,10 @@ class Compressor : public Object {
   //  * false - failure (!healthy())
   bool EncodeAndClose(Writer* dest);
 
+  // Registers subobjects of this Compressor with *memory_estimator: data
+  // buffered so far. The size of the compression context is not included.
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const;
+
  private:
   CompressorOptions compressor_options_;
   TuningOptions tuning_options_;
@@ -110,7 +127,7 @@ class Compressor : public Object {
   //   options_.compression_type() is consistent with
   //       the active member of writer_
   absl::variant<ChainWriter<>, BrotliWriter<ChainWriter<>>,
-                ZstdWriter<ChainWriter<>>>
+                ZstdWriter<ChainWriter<>>, SnappyWriter<ChainWriter<>>>
       writer_;
 };
 
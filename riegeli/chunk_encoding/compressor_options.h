@@ -15,6 +15,8 @@
 #ifndef RIEGELI_CHUNK_ENCODING_COMPRESSOR_OPTIONS_H_
 #define RIEGELI_CHUNK_ENCODING_COMPRESSOR_OPTIONS_H_
 
+#include <memory>
+#include <string>
 #include <utility>
 
 #include "absl/strings/string_view.h"
@@ -37,7 +39,9 @@ class CompressorOptions {
   //     "uncompressed" |
   //     "brotli" (":" brotli_level)? |
   //     "zstd" (":" zstd_level)? |
-  //     "window_log" ":" window_log
+  //     "snappy" |
+  //     "window_log" ":" window_log |
+  //     "long_distance_matching" (":" ("true" | "false"))?
   //   brotli_level ::= integer 0..11 (default 9)
   //   zstd_level ::= integer -32..22 (default 9)
   //   window_log ::= "auto" or integer 10..31
@@ -111,6 +115,18 @@ class CompressorOptions {
     return std::move(set_zstd(compression_level));
   }
 
+  // Changes compression algorithm to Snappy.
+  //
+  // Snappy compresses much faster than Brotli or Zstd, and decompresses at
+  // multiple GB/s, at the cost of a considerably worse compression density.
+  // There are no Snappy compression levels to tune.
+  CompressorOptions& set_snappy() & {
+    compression_type_ = CompressionType::kSnappy;
+    compression_level_ = 0;
+    return *this;
+  }
+  CompressorOptions&& set_snappy() && { return std::move(set_snappy()); }
+
   CompressionType compression_type() const { return compression_type_; }
 
   int compression_level() const { return compression_level_; }
@@ -122,7 +138,7 @@ class CompressorOptions {
   // Special value kDefaultWindowLog (-1) means to keep the default
   // (brotli: 22, zstd: derived from compression level and chunk size).
   //
-  // For uncompressed, window_log must be kDefaultWindowLog (-1).
+  // For uncompressed and snappy, window_log must be kDefaultWindowLog (-1).
   //
   // For brotli, window_log must be kDefaultWindowLog (-1) or between
   // BrotliWriterBase::Options::kMinWindowLog (10) and
@@ -159,13 +175,60 @@ class CompressorOptions {
 
   // Returns window_log translated for BrotliWriter or ZstdWriter.
   //
-  // Precondition: compression_type_ != CompressionType::kNone
+  // Precondition: compression_type_ == CompressionType::kBrotli ||
+  //               compression_type_ == CompressionType::kZstd
   int window_log() const;
 
+  // If true, enables long-distance matching: the compressor additionally
+  // looks for matches up to the full window size apart, which improves
+  // compression density when redundancy sits far apart, e.g. between similar
+  // records spread over a large chunk. It is most effective together with a
+  // large set_window_log().
+  //
+  // Effective only for zstd; ignored for other compression algorithms.
+  //
+  // Default: false.
+  CompressorOptions& set_long_distance_matching(
+      bool long_distance_matching) & {
+    long_distance_matching_ = long_distance_matching;
+    return *this;
+  }
+  CompressorOptions&& set_long_distance_matching(
+      bool long_distance_matching) && {
+    return std::move(set_long_distance_matching(long_distance_matching));
+  }
+
+  bool long_distance_matching() const { return long_distance_matching_; }
+
+  // Zstd dictionary. The same dictionary must be used for decompression.
+  //
+  // A dictionary improves compression density of small, repetitive data,
+  // e.g. chunks of short similar records. The contents are shared, not
+  // copied, because the same dictionary is typically used for many chunks.
+  //
+  // Effective only for zstd; ignored for other compression algorithms.
+  //
+  // Default: nullptr.
+  CompressorOptions& set_zstd_dictionary(
+      std::shared_ptr<const std::string> zstd_dictionary) & {
+    zstd_dictionary_ = std::move(zstd_dictionary);
+    return *this;
+  }
+  CompressorOptions&& set_zstd_dictionary(
+      std::shared_ptr<const std::string> zstd_dictionary) && {
+    return std::move(set_zstd_dictionary(std::move(zstd_dictionary)));
+  }
+
+  const std::shared_ptr<const std::string>& zstd_dictionary() const {
+    return zstd_dictionary_;
+  }
+
  private:
   CompressionType compression_type_ = CompressionType::kBrotli;
   int compression_level_ = kDefaultBrotli;
   int window_log_ = kDefaultWindowLog;
+  bool long_distance_matching_ = false;
+  std::shared_ptr<const std::string> zstd_dictionary_;
 };
 
 }  // namespace riegeli
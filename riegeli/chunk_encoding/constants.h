@@ -30,6 +30,10 @@ enum class ChunkType : uint8_t {
   kPadding = 'p',
   kSimple = 'r',
   kTransposed = 't',
+  kTransposedColumnar = 'c',
+  kDictionary = 'd',
+  kRecordIndex = 'i',
+  kAligned = 'a',
 };
 
 // These values are frozen in the file format.
@@ -37,11 +41,22 @@ enum class CompressionType : uint8_t {
   kNone = 0,
   kBrotli = 'b',
   kZstd = 'z',
+  kSnappy = 's',
 };
 
 RIEGELI_INLINE_CONSTEXPR(uint64_t, kMaxNumRecords,
                          std::numeric_limits<uint64_t>::max() >> 8);
 
+// Alignment of record values in an aligned chunk, relative to the beginning
+// of the chunk header. This value is frozen in the file format.
+RIEGELI_INLINE_CONSTEXPR(uint64_t, kAlignedChunkAlignment, 64);
+
+// Flags of the record index chunk. These values are frozen in the file format.
+//
+// kRecordIndexHasStatistics means that each index entry carries chunk
+// statistics: decoded data size and the range of record keys.
+RIEGELI_INLINE_CONSTEXPR(uint64_t, kRecordIndexHasStatistics, uint64_t{1} << 0);
+
 }  // namespace riegeli
 
 #endif  // RIEGELI_CHUNK_ENCODING_CONSTANTS_H_
@@ -0,0 +1,70 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/chunk_encoding/decoded_chunk_cache.h"
+
+#include <stddef.h>
+
+#include <memory>
+#include <utility>
+
+#include "absl/synchronization/mutex.h"
+#include "riegeli/base/base.h"
+
+namespace riegeli {
+
+LruDecodedChunkCache::LruDecodedChunkCache(size_t max_size)
+    : max_size_(max_size) {}
+
+size_t LruDecodedChunkCache::EntrySize(const Decoded& decoded) {
+  return decoded.values.size() + decoded.limits.size() * sizeof(size_t);
+}
+
+std::shared_ptr<const DecodedChunkCache::Decoded> LruDecodedChunkCache::Get(
+    const Key& key) {
+  absl::MutexLock lock(&mutex_);
+  const auto iter = entries_.find(key);
+  if (iter == entries_.end()) return nullptr;
+  order_.splice(order_.begin(), order_, iter->second.order_iter);
+  return iter->second.decoded;
+}
+
+void LruDecodedChunkCache::Put(const Key& key,
+                               std::shared_ptr<const Decoded> decoded) {
+  const size_t entry_size = EntrySize(*decoded);
+  if (entry_size > max_size_) return;
+  absl::MutexLock lock(&mutex_);
+  const auto iter = entries_.find(key);
+  if (iter != entries_.end()) {
+    order_.splice(order_.begin(), order_, iter->second.order_iter);
+    return;
+  }
+  while (total_size_ + entry_size > max_size_) {
+    RIEGELI_ASSERT(!order_.empty())
+        << "Failed invariant of LruDecodedChunkCache: "
+           "empty cache over the size limit";
+    const auto last = entries_.find(order_.back());
+    RIEGELI_ASSERT(last != entries_.end())
+        << "Failed invariant of LruDecodedChunkCache: "
+           "key in order_ absent from entries_";
+    total_size_ -= EntrySize(*last->second.decoded);
+    entries_.erase(last);
+    order_.pop_back();
+  }
+  order_.push_front(key);
+  entries_.emplace(key, Entry{std::move(decoded), order_.begin()});
+  total_size_ += entry_size;
+}
+
+}  // namespace riegeli
@@ -0,0 +1,126 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_CHUNK_ENCODING_DECODED_CHUNK_CACHE_H_
+#define RIEGELI_CHUNK_ENCODING_DECODED_CHUNK_CACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <list>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/synchronization/mutex.h"
+#include "riegeli/base/chain.h"
+
+namespace riegeli {
+
+// Cache of decoded chunk payloads, consulted by ChunkDecoder before
+// decompressing, so that readers of the same hot chunks pay for each chunk's
+// decode once.
+//
+// Entries are content addressed: the key is derived from the chunk header,
+// whose hash covers the encoded chunk data, hence identical chunks are shared
+// also between files, and the cache needs no notion of file identity or
+// invalidation.
+//
+// Implementations must be thread safe: one cache is typically shared by many
+// readers. A cache which stores payloads outside of the process, e.g. in
+// memory shared between colocated reader processes, can be plugged in by
+// implementing this interface, with Get() rebuilding the Chain from the
+// stored bytes.
+class DecodedChunkCache {
+ public:
+  // Identifies the contents of a chunk. data_hash is the hash of the encoded
+  // chunk data, stored in the chunk header; the sizes guard against hash
+  // collisions and malformed headers.
+  struct Key {
+    uint64_t data_hash = 0;
+    uint64_t data_size = 0;
+    uint64_t num_records = 0;
+    uint64_t decoded_data_size = 0;
+
+    friend bool operator==(const Key& a, const Key& b) {
+      return a.data_hash == b.data_hash && a.data_size == b.data_size &&
+             a.num_records == b.num_records &&
+             a.decoded_data_size == b.decoded_data_size;
+    }
+    friend bool operator!=(const Key& a, const Key& b) { return !(a == b); }
+    template <typename HashState>
+    friend HashState AbslHashValue(HashState hash_state, const Key& key) {
+      return HashState::combine(std::move(hash_state), key.data_hash,
+                                key.data_size, key.num_records,
+                                key.decoded_data_size);
+    }
+  };
+
+  // A decoded chunk payload: record end positions and concatenated record
+  // values, as produced by ChunkDecoder.
+  struct Decoded {
+    explicit Decoded(std::vector<size_t> limits, Chain values)
+        : limits(std::move(limits)), values(std::move(values)) {}
+
+    std::vector<size_t> limits;
+    Chain values;
+  };
+
+  virtual ~DecodedChunkCache() {}
+
+  // Returns the decoded payload of the chunk with the given key, or nullptr
+  // if not cached.
+  virtual std::shared_ptr<const Decoded> Get(const Key& key) = 0;
+
+  // Offers a decoded payload for caching. The cache may ignore it.
+  virtual void Put(const Key& key, std::shared_ptr<const Decoded> decoded) = 0;
+
+ protected:
+  DecodedChunkCache() {}
+};
+
+// A process-local DecodedChunkCache bounded by the total size of cached
+// payloads, evicting least recently used entries.
+class LruDecodedChunkCache : public DecodedChunkCache {
+ public:
+  // Creates an LruDecodedChunkCache holding at most max_size bytes of
+  // decoded payloads.
+  explicit LruDecodedChunkCache(size_t max_size);
+
+  std::shared_ptr<const Decoded> Get(const Key& key) override;
+  void Put(const Key& key, std::shared_ptr<const Decoded> decoded) override;
+
+ private:
+  struct Entry {
+    std::shared_ptr<const Decoded> decoded;
+    // Position of the key in order_.
+    std::list<Key>::iterator order_iter;
+  };
+
+  static size_t EntrySize(const Decoded& decoded);
+
+  const size_t max_size_;
+  absl::Mutex mutex_;
+  // Keys in order from most recently to least recently used.
+  std::list<Key> order_ GUARDED_BY(mutex_);
+  absl::flat_hash_map<Key, Entry> entries_ GUARDED_BY(mutex_);
+  // Invariant: total_size_ == sum of EntrySize() over entries_
+  size_t total_size_ GUARDED_BY(mutex_) = 0;
+};
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_CHUNK_ENCODING_DECODED_CHUNK_CACHE_H_
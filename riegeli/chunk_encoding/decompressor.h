@@ -18,6 +18,7 @@
 #include <stdint.h>
 
 #include <memory>
+#include <string>
 #include <utility>
 
 #include "absl/base/optimization.h"
@@ -31,6 +32,7 @@
 #include "riegeli/bytes/brotli_reader.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/bytes/reader_utils.h"
+#include "riegeli/bytes/snappy_reader.h"
 #include "riegeli/bytes/zstd_reader.h"
 #include "riegeli/chunk_encoding/constants.h"
 
@@ -60,7 +62,12 @@ class Decompressor : public Object {
   //
   // If compression_type is not kNone, reads uncompressed size as a varint from
   // the beginning of compressed data.
-  explicit Decompressor(Src src, CompressionType compression_type);
+  //
+  // If zstd_dictionary is not nullptr and compression_type is kZstd, the
+  // dictionary is used for decompression.
+  explicit Decompressor(
+      Src src, CompressionType compression_type,
+      std::shared_ptr<const std::string> zstd_dictionary = nullptr);
 
   Decompressor(Decompressor&& that) noexcept;
   Decompressor& operator=(Decompressor&& that) noexcept;
@@ -89,14 +96,17 @@ class Decompressor : public Object {
   void Done() override;
 
  private:
-  absl::variant<Dependency<Reader*, Src>, BrotliReader<Src>, ZstdReader<Src>>
+  absl::variant<Dependency<Reader*, Src>, BrotliReader<Src>, ZstdReader<Src>,
+                SnappyReader<Src>>
       reader_;
 };
 
 // Implementation details follow.
 
 template <typename Src>
-Decompressor<Src>::Decompressor(Src src, CompressionType compression_type)
+Decompressor<Src>::Decompressor(
+    Src src, CompressionType compression_type,
+    std::shared_ptr<const std::string> zstd_dictionary)
     : Object(State::kOpen) {
   Dependency<Reader*, Src> compressed_reader(std::move(src));
   if (compression_type == CompressionType::kNone) {
@@ -118,7 +128,12 @@ Decompressor<Src>::Decompressor(Src src, CompressionType compression_type)
     case CompressionType::kZstd:
       reader_ = ZstdReader<Src>(
           std::move(compressed_reader.manager()),
-          ZstdReaderBase::Options().set_size_hint(decompressed_size));
+          ZstdReaderBase::Options()
+              .set_size_hint(decompressed_size)
+              .set_dictionary(std::move(zstd_dictionary)));
+      return;
+    case CompressionType::kSnappy:
+      reader_ = SnappyReader<Src>(std::move(compressed_reader.manager()));
       return;
   }
   Fail(DataLossError(absl::StrCat("Unknown compression type: ",
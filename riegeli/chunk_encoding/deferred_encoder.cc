@@ -17,6 +17,7 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <future>
 #include <limits>
 #include <string>
 #include <utility>
@@ -28,6 +29,8 @@
 #include "riegeli/base/base.h"
 #include "riegeli/base/canonical_errors.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
+#include "riegeli/base/parallelism.h"
 #include "riegeli/base/status.h"
 #include "riegeli/bytes/chain_writer.h"
 #include "riegeli/bytes/message_serialize.h"
@@ -35,8 +38,16 @@
 
 namespace riegeli {
 
+DeferredEncoder::~DeferredEncoder() {
+  // Let a pending replay finish; it refers to *base_encoder_.
+  if (flush_future_.valid()) flush_future_.get();
+}
+
 void DeferredEncoder::Reset() {
   ChunkEncoder::Reset();
+  // Let a pending replay finish before the base encoder is reset; its result
+  // does not matter because the records are discarded anyway.
+  if (flush_future_.valid()) flush_future_.get();
   base_encoder_->Reset();
   records_writer_ = ChainWriter<Chain>(Chain());
   limits_.clear();
@@ -60,6 +71,10 @@ bool DeferredEncoder::AddRecord(const google::protobuf::MessageLite& record) {
     return Fail(std::move(serialize_status));
   }
   limits_.push_back(IntCast<size_t>(records_writer_.pos()));
+  if (ABSL_PREDICT_FALSE(IntCast<size_t>(records_writer_.pos()) >=
+                         buffer_limit_)) {
+    return FlushBuffered();
+  }
   return true;
 }
 
@@ -97,6 +112,10 @@ bool DeferredEncoder::AddRecordImpl(Record&& record) {
     return Fail(records_writer_);
   }
   limits_.push_back(IntCast<size_t>(records_writer_.pos()));
+  if (ABSL_PREDICT_FALSE(IntCast<size_t>(records_writer_.pos()) >=
+                         buffer_limit_)) {
+    return FlushBuffered();
+  }
   return true;
 }
 
@@ -122,6 +141,43 @@ bool DeferredEncoder::AddRecords(Chain records, std::vector<size_t> limits) {
     for (size_t& limit : limits) limit += base;
     limits_.insert(limits_.cend(), limits.begin(), limits.end());
   }
+  if (ABSL_PREDICT_FALSE(IntCast<size_t>(records_writer_.pos()) >=
+                         buffer_limit_)) {
+    return FlushBuffered();
+  }
+  return true;
+}
+
+bool DeferredEncoder::FlushBuffered() {
+  // Waiting for the previous replay keeps at most one replay in flight, which
+  // bounds buffered memory and stalls the producer only when replaying falls
+  // behind.
+  if (ABSL_PREDICT_FALSE(!WaitForFlush())) return false;
+  if (ABSL_PREDICT_FALSE(!records_writer_.Close())) {
+    return Fail(records_writer_);
+  }
+  std::promise<bool>* const flush_promise = new std::promise<bool>();
+  flush_future_ = flush_promise->get_future();
+  Chain* const records = new Chain(std::move(records_writer_.dest()));
+  std::vector<size_t>* const limits =
+      new std::vector<size_t>(std::move(limits_));
+  ChunkEncoder* const base_encoder = base_encoder_.get();
+  internal::ThreadPool::global_cpu().Schedule(
+      [flush_promise, records, limits, base_encoder] {
+        flush_promise->set_value(
+            base_encoder->AddRecords(std::move(*records), std::move(*limits)));
+        delete limits;
+        delete records;
+        delete flush_promise;
+      });
+  records_writer_ = ChainWriter<Chain>(Chain());
+  limits_.clear();
+  return true;
+}
+
+bool DeferredEncoder::WaitForFlush() {
+  if (!flush_future_.valid()) return true;
+  if (ABSL_PREDICT_FALSE(!flush_future_.get())) return Fail(*base_encoder_);
   return true;
 }
 
@@ -129,6 +185,7 @@ bool DeferredEncoder::EncodeAndClose(Writer* dest, ChunkType* chunk_type,
                                      uint64_t* num_records,
                                      uint64_t* decoded_data_size) {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  if (ABSL_PREDICT_FALSE(!WaitForFlush())) return false;
   if (ABSL_PREDICT_FALSE(!records_writer_.Close())) {
     return Fail(records_writer_);
   }
@@ -141,4 +198,20 @@ bool DeferredEncoder::EncodeAndClose(Writer* dest, ChunkType* chunk_type,
   return Close();
 }
 
+void DeferredEncoder::RegisterUnique(
+    MemoryEstimator* memory_estimator) const {
+  memory_estimator->RegisterDynamicMemory(sizeof(*this));
+  records_writer_.dest().RegisterSubobjects(memory_estimator);
+  memory_estimator->RegisterMemory(limits_.capacity() * sizeof(size_t));
+  if (flush_future_.valid()) {
+    // A background replay into the base encoder may be in progress, hence the
+    // base encoder cannot be traversed safely. Approximate it with the total
+    // size of the records replayed into it so far.
+    memory_estimator->RegisterMemory(
+        IntCast<size_t>(decoded_data_size_ - records_writer_.pos()));
+  } else {
+    base_encoder_->RegisterUnique(memory_estimator);
+  }
+}
+
 }  // namespace riegeli
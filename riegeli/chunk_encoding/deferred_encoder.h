@@ -18,6 +18,8 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <future>
+#include <limits>
 #include <memory>
 #include <string>
 #include <utility>
@@ -36,9 +38,19 @@ namespace riegeli {
 // DeferredEncoder performs a minimal amount of the encoding work in
 // AddRecord(), deferring as much as possible to EncodeAndClose().
 // It does more memory copying than the base encoder though.
+//
+// If buffer_limit is set, whenever buffered records exceed buffer_limit
+// bytes, they are replayed into the base encoder on a background thread while
+// further records are added. At most one replay is in flight at a time, which
+// bounds buffered memory and applies backpressure to the producer when
+// replaying falls behind.
 class DeferredEncoder : public ChunkEncoder {
  public:
-  explicit DeferredEncoder(std::unique_ptr<ChunkEncoder> base_encoder);
+  explicit DeferredEncoder(
+      std::unique_ptr<ChunkEncoder> base_encoder,
+      size_t buffer_limit = std::numeric_limits<size_t>::max());
+
+  ~DeferredEncoder();
 
   void Reset() override;
 
@@ -55,17 +67,29 @@ class DeferredEncoder : public ChunkEncoder {
                       uint64_t* num_records,
                       uint64_t* decoded_data_size) override;
 
+  void RegisterUnique(MemoryEstimator* memory_estimator) const override;
+
  private:
   template <typename Record>
   bool AddRecordImpl(Record&& record);
 
+  // Schedules replaying the buffered records into the base encoder on a
+  // background thread, after waiting for a previous replay to finish.
+  bool FlushBuffered();
+
+  // Waits for a pending replay, if any, and propagates its failure.
+  bool WaitForFlush();
+
   std::unique_ptr<ChunkEncoder> base_encoder_;
-  // Writer of concatenated record values.
+  // Buffered records exceeding this many bytes are replayed into the base
+  // encoder before EncodeAndClose().
+  size_t buffer_limit_;
+  // Writer of concatenated record values buffered since the last replay.
   ChainWriter<Chain> records_writer_;
-  // Sorted record end positions.
-  //
-  // Invariant: limits_.size() == num_records_
+  // Sorted record end positions since the last replay.
   std::vector<size_t> limits_;
+  // Result of a pending background replay into the base encoder, if valid().
+  std::future<bool> flush_future_;
 
   // Invariant: records_writer_.pos() == (limits_.empty() ? 0 : limits_.back())
 };
@@ -73,8 +97,10 @@ class DeferredEncoder : public ChunkEncoder {
 // Implementation details follow.
 
 inline DeferredEncoder::DeferredEncoder(
-    std::unique_ptr<ChunkEncoder> base_encoder)
-    : base_encoder_(std::move(base_encoder)), records_writer_(Chain()) {}
+    std::unique_ptr<ChunkEncoder> base_encoder, size_t buffer_limit)
+    : base_encoder_(std::move(base_encoder)),
+      buffer_limit_(buffer_limit),
+      records_writer_(Chain()) {}
 
 }  // namespace riegeli
 
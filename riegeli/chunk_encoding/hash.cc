@@ -14,8 +14,12 @@
 
 #include "riegeli/chunk_encoding/hash.h"
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include <new>
+
+#include "absl/memory/memory.h"
 #include "absl/strings/string_view.h"
 #include "highwayhash/highwayhash.h"
 #include "riegeli/base/chain.h"
@@ -32,6 +36,17 @@ const highwayhash::HHKey kHashKey HH_ALIGNAS(32) = {
     0x0a7364726f636572,  // 'records\n'
 };
 
+// How many messages ahead of the one being hashed HashBatch() prefetches.
+constexpr size_t kHashBatchPrefetchAhead = 4;
+
+inline void PrefetchForRead(const char* ptr) {
+#if defined(__GNUC__) || defined(__clang__)
+  __builtin_prefetch(ptr, /*rw=*/0, /*locality=*/3);
+#else
+  (void)ptr;
+#endif
+}
+
 }  // namespace
 
 uint64_t Hash(absl::string_view data) {
@@ -51,5 +66,53 @@ uint64_t Hash(const Chain& data) {
   return result;
 }
 
+void HashBatch(const char* const* data, size_t size, size_t num,
+               uint64_t* hashes) {
+  for (size_t i = 0; i < num && i < kHashBatchPrefetchAhead; ++i) {
+    PrefetchForRead(data[i]);
+  }
+  for (size_t i = 0; i < num; ++i) {
+    if (i + kHashBatchPrefetchAhead < num) {
+      PrefetchForRead(data[i + kHashBatchPrefetchAhead]);
+    }
+    highwayhash::HHStateT<HH_TARGET> state(kHashKey);
+    highwayhash::HHResult64 result;
+    highwayhash::HighwayHashT(&state, data[i], size, &result);
+    hashes[i] = result;
+  }
+}
+
+struct Hasher::State {
+  State() : hash_state(kHashKey) {}
+
+  highwayhash::HighwayHashCatT<HH_TARGET> hash_state;
+};
+
+Hasher::Hasher() : state_(absl::make_unique<State>()) {}
+
+Hasher::Hasher(Hasher&& that) noexcept = default;
+
+Hasher& Hasher::operator=(Hasher&& that) noexcept = default;
+
+Hasher::~Hasher() {}
+
+void Hasher::Reset() {
+  // Reconstruct the hash state in place: HighwayHashCatT has no Reset() and
+  // reinitializing it from the key is cheap compared to reallocating State.
+  State* const state = state_.get();
+  state->~State();
+  new (state) State();
+}
+
+void Hasher::Update(absl::string_view data) {
+  state_->hash_state.Append(data.data(), data.size());
+}
+
+uint64_t Hasher::Digest() const {
+  highwayhash::HHResult64 result;
+  state_->hash_state.Finalize(&result);
+  return result;
+}
+
 }  // namespace internal
 }  // namespace riegeli
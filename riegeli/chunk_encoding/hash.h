@@ -15,10 +15,14 @@
 #ifndef RIEGELI_CHUNK_ENCODING_HASH_H_
 #define RIEGELI_CHUNK_ENCODING_HASH_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include <memory>
+
 #include "absl/strings/string_view.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/bytes/digester.h"
 
 namespace riegeli {
 namespace internal {
@@ -26,6 +30,45 @@ namespace internal {
 uint64_t Hash(absl::string_view data);
 uint64_t Hash(const Chain& data);
 
+// Hashes num messages of size bytes each: sets hashes[i] to
+// Hash(absl::string_view(data[i], size)).
+//
+// Hashing many messages per call amortizes per-call overhead, and each message
+// is prefetched while earlier messages are being hashed, which hides memory
+// latency when the messages are scattered, e.g. block headers spread over a
+// large buffer.
+void HashBatch(const char* const* data, size_t size, size_t num,
+               uint64_t* hashes);
+
+// Incrementally computes the hash of a sequence of data fragments. The result
+// is the same as Hash() of their concatenation.
+//
+// As a Digester, a Hasher can be plugged into a DigestingWriter or
+// DigestingReader to fold hashing into an I/O pass over the data.
+class Hasher : public Digester {
+ public:
+  Hasher();
+  Hasher(Hasher&& that) noexcept;
+  Hasher& operator=(Hasher&& that) noexcept;
+  ~Hasher();
+
+  // Prepares the Hasher for hashing a new sequence of fragments, reusing the
+  // allocated hash state instead of allocating a new Hasher.
+  void Reset();
+
+  using Digester::Update;
+  void Update(absl::string_view data) override;
+
+  // Returns the hash of data accumulated so far. Further data can still be
+  // accumulated afterwards.
+  uint64_t Digest() const;
+
+ private:
+  struct State;
+
+  std::unique_ptr<State> state_;
+};
+
 }  // namespace internal
 }  // namespace riegeli
 
@@ -0,0 +1,276 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/chunk_encoding/numeric_columns.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <limits>
+#include <string>
+#include <utility>
+
+#include "absl/base/optimization.h"
+#include "absl/strings/string_view.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/bytes/varint.h"
+#include "riegeli/bytes/writer_utils.h"
+
+namespace riegeli {
+namespace internal {
+
+namespace {
+
+uint64_t LoadLittleEndian(const char* src, size_t num_bytes) {
+  uint64_t value = 0;
+  for (size_t i = 0; i < num_bytes; ++i) {
+    value |= uint64_t{static_cast<uint8_t>(src[i])} << (8 * i);
+  }
+  return value;
+}
+
+void StoreLittleEndian(uint64_t value, size_t num_bytes, std::string* dest) {
+  for (size_t i = 0; i < num_bytes; ++i) {
+    dest->push_back(static_cast<char>(value >> (8 * i)));
+  }
+}
+
+uint64_t ZigZagEncode(uint64_t delta, size_t num_bits) {
+  const uint64_t mask = ~uint64_t{0} >> (64 - num_bits);
+  delta &= mask;
+  return ((delta << 1) ^ (uint64_t{0} - (delta >> (num_bits - 1)))) & mask;
+}
+
+uint64_t ZigZagDecode(uint64_t zigzag, size_t num_bits) {
+  return ((zigzag >> 1) ^ (uint64_t{0} - (zigzag & 1))) &
+         (~uint64_t{0} >> (64 - num_bits));
+}
+
+size_t BitWidth(uint64_t value) {
+  size_t width = 0;
+  while (value != 0) {
+    ++width;
+    value >>= 1;
+  }
+  return width;
+}
+
+// Reads a varint from *src, with bounds checking, unlike ReadVarint64() on
+// arrays which requires kMaxLengthVarint64 bytes of lookahead.
+bool ParseVarint(const char** src, const char* limit, uint64_t* data) {
+  uint64_t value = 0;
+  size_t shift = 0;
+  const char* cursor = *src;
+  do {
+    if (ABSL_PREDICT_FALSE(cursor == limit ||
+                           shift >= 8 * sizeof(uint64_t))) {
+      return false;
+    }
+    value |= uint64_t{static_cast<uint8_t>(*cursor) & 0x7f} << shift;
+    shift += 7;
+  } while (static_cast<uint8_t>(*cursor++) >= 0x80);
+  *src = cursor;
+  *data = value;
+  return true;
+}
+
+// "value_size" is the width of a value in bytes (4 or 8), "max_width" the
+// largest bit width of packed deltas allowed by the format.
+bool DeltaEncodeFixed(absl::string_view src, size_t value_size,
+                      size_t max_width, Chain* dest) {
+  if (ABSL_PREDICT_FALSE(src.size() % value_size != 0)) return false;
+  const size_t num_values = src.size() / value_size;
+  if (num_values == 0) return false;
+  // First pass: find the bit width needed for the largest zigzag encoded
+  // delta.
+  size_t width = 0;
+  uint64_t prev = LoadLittleEndian(src.data(), value_size);
+  for (size_t i = 1; i < num_values; ++i) {
+    const uint64_t value =
+        LoadLittleEndian(src.data() + i * value_size, value_size);
+    width = UnsignedMax(
+        width, BitWidth(ZigZagEncode(value - prev, 8 * value_size)));
+    prev = value;
+  }
+  if (width > max_width) return false;
+  const size_t encoded_size = LengthVarint64(num_values) + value_size + 1 +
+                              ((num_values - 1) * width + 7) / 8;
+  if (encoded_size >= src.size()) return false;
+  std::string encoded;
+  encoded.reserve(encoded_size);
+  {
+    char header[kMaxLengthVarint64];
+    encoded.append(header, PtrDistance(header, WriteVarint64(
+                                                   header, num_values)));
+  }
+  encoded.append(src.data(), value_size);
+  encoded.push_back(static_cast<char>(width));
+  // Second pass: pack zigzag encoded deltas into "width" bits each.
+  uint64_t bit_buffer = 0;
+  size_t bits_in_buffer = 0;
+  prev = LoadLittleEndian(src.data(), value_size);
+  for (size_t i = 1; i < num_values; ++i) {
+    const uint64_t value =
+        LoadLittleEndian(src.data() + i * value_size, value_size);
+    bit_buffer |= ZigZagEncode(value - prev, 8 * value_size) << bits_in_buffer;
+    bits_in_buffer += width;
+    while (bits_in_buffer >= 8) {
+      encoded.push_back(static_cast<char>(bit_buffer));
+      bit_buffer >>= 8;
+      bits_in_buffer -= 8;
+    }
+    prev = value;
+  }
+  if (bits_in_buffer > 0) encoded.push_back(static_cast<char>(bit_buffer));
+  RIEGELI_ASSERT_EQ(encoded.size(), encoded_size)
+      << "Delta encoded column has unexpected size";
+  dest->Append(std::move(encoded));
+  return true;
+}
+
+bool DeltaDecodeFixed(absl::string_view src, size_t value_size,
+                      size_t max_width, Chain* dest) {
+  const char* cursor = src.data();
+  const char* const limit = src.data() + src.size();
+  uint64_t num_values;
+  if (ABSL_PREDICT_FALSE(!ParseVarint(&cursor, limit, &num_values))) {
+    return false;
+  }
+  if (num_values == 0) return cursor == limit;
+  if (ABSL_PREDICT_FALSE(PtrDistance(cursor, limit) < value_size + 1)) {
+    return false;
+  }
+  uint64_t value = LoadLittleEndian(cursor, value_size);
+  cursor += value_size;
+  const size_t width = static_cast<uint8_t>(*cursor++);
+  if (ABSL_PREDICT_FALSE(width > max_width)) return false;
+  if (ABSL_PREDICT_FALSE(
+          num_values - 1 > std::numeric_limits<size_t>::max() / 64 ||
+          PtrDistance(cursor, limit) !=
+              (IntCast<size_t>(num_values - 1) * width + 7) / 8)) {
+    return false;
+  }
+  std::string decoded;
+  if (ABSL_PREDICT_FALSE(num_values > decoded.max_size() / value_size)) {
+    return false;
+  }
+  decoded.reserve(IntCast<size_t>(num_values) * value_size);
+  StoreLittleEndian(value, value_size, &decoded);
+  const uint64_t mask =
+      width == 0 ? uint64_t{0} : ~uint64_t{0} >> (64 - width);
+  uint64_t bit_buffer = 0;
+  size_t bits_in_buffer = 0;
+  for (uint64_t i = 1; i < num_values; ++i) {
+    while (bits_in_buffer < width) {
+      bit_buffer |= uint64_t{static_cast<uint8_t>(*cursor++)}
+                    << bits_in_buffer;
+      bits_in_buffer += 8;
+    }
+    value += ZigZagDecode(bit_buffer & mask, 8 * value_size);
+    value &= ~uint64_t{0} >> (64 - 8 * value_size);
+    bit_buffer >>= width;
+    bits_in_buffer -= width;
+    StoreLittleEndian(value, value_size, &decoded);
+  }
+  dest->Append(std::move(decoded));
+  return true;
+}
+
+}  // namespace
+
+bool DeltaEncodeFixed32(absl::string_view src, Chain* dest) {
+  return DeltaEncodeFixed(src, sizeof(uint32_t), 32, dest);
+}
+
+bool DeltaEncodeFixed64(absl::string_view src, Chain* dest) {
+  return DeltaEncodeFixed(src, sizeof(uint64_t), 56, dest);
+}
+
+bool DeltaEncodeVarint(absl::string_view src, Chain* dest) {
+  const char* cursor = src.data();
+  const char* const limit = src.data() + src.size();
+  uint64_t num_values = 0;
+  uint64_t prev = 0;
+  size_t encoded_size = 0;
+  while (cursor != limit) {
+    uint64_t value;
+    if (ABSL_PREDICT_FALSE(!ParseVarint(&cursor, limit, &value))) return false;
+    encoded_size += LengthVarint64(
+        num_values == 0 ? value : ZigZagEncode(value - prev, 64));
+    prev = value;
+    ++num_values;
+  }
+  if (num_values == 0) return false;
+  encoded_size += LengthVarint64(num_values);
+  if (encoded_size >= src.size()) return false;
+  std::string encoded;
+  encoded.reserve(encoded_size);
+  char scratch[kMaxLengthVarint64];
+  encoded.append(scratch,
+                 PtrDistance(scratch, WriteVarint64(scratch, num_values)));
+  cursor = src.data();
+  prev = 0;
+  for (uint64_t i = 0; i < num_values; ++i) {
+    uint64_t value;
+    if (ABSL_PREDICT_FALSE(!ParseVarint(&cursor, limit, &value))) {
+      RIEGELI_ASSERT_UNREACHABLE()
+          << "Varint column changed between encoding passes";
+    }
+    encoded.append(
+        scratch,
+        PtrDistance(scratch,
+                    WriteVarint64(scratch, i == 0 ? value
+                                                  : ZigZagEncode(value - prev,
+                                                                 64))));
+    prev = value;
+  }
+  RIEGELI_ASSERT_EQ(encoded.size(), encoded_size)
+      << "Delta encoded column has unexpected size";
+  dest->Append(std::move(encoded));
+  return true;
+}
+
+bool DeltaDecodeFixed32(absl::string_view src, Chain* dest) {
+  return DeltaDecodeFixed(src, sizeof(uint32_t), 32, dest);
+}
+
+bool DeltaDecodeFixed64(absl::string_view src, Chain* dest) {
+  return DeltaDecodeFixed(src, sizeof(uint64_t), 56, dest);
+}
+
+bool DeltaDecodeVarint(absl::string_view src, Chain* dest) {
+  const char* cursor = src.data();
+  const char* const limit = src.data() + src.size();
+  uint64_t num_values;
+  if (ABSL_PREDICT_FALSE(!ParseVarint(&cursor, limit, &num_values))) {
+    return false;
+  }
+  std::string decoded;
+  char scratch[kMaxLengthVarint64];
+  uint64_t value = 0;
+  for (uint64_t i = 0; i < num_values; ++i) {
+    uint64_t data;
+    if (ABSL_PREDICT_FALSE(!ParseVarint(&cursor, limit, &data))) return false;
+    value = i == 0 ? data : value + ZigZagDecode(data, 64);
+    decoded.append(scratch,
+                   PtrDistance(scratch, WriteVarint64(scratch, value)));
+  }
+  if (ABSL_PREDICT_FALSE(cursor != limit)) return false;
+  dest->Append(std::move(decoded));
+  return true;
+}
+
+}  // namespace internal
+}  // namespace riegeli
@@ -0,0 +1,90 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_CHUNK_ENCODING_NUMERIC_COLUMNS_H_
+#define RIEGELI_CHUNK_ENCODING_NUMERIC_COLUMNS_H_
+
+#include <stdint.h>
+
+#include "absl/strings/string_view.h"
+#include "riegeli/base/chain.h"
+
+namespace riegeli {
+namespace internal {
+
+// Delta encoding of numeric columns, used by transposed columnar chunks
+// (ChunkType::kTransposedColumnar). In such chunks each non-empty data buffer
+// begins with a ColumnEncoding byte describing how the remaining bytes encode
+// the original buffer.
+//
+// These values are frozen in the file format.
+enum class ColumnEncoding : uint8_t {
+  // Original buffer bytes.
+  kRaw = 0,
+  // Delta encoded and bit-packed array of fixed width 32 bit values.
+  kDeltaFixed32 = 1,
+  // Delta encoded and bit-packed array of fixed width 64 bit values.
+  kDeltaFixed64 = 2,
+  // Delta encoded sequence of varints.
+  kDeltaVarint = 3,
+  // Interned sequence of length-prefixed strings, see string_columns.h.
+  kInternedStrings = 4,
+};
+
+// Encoded form for kDeltaFixed32 and kDeltaFixed64:
+//  - Varint: number of values ("num_values")
+//  - If "num_values" > 0:
+//    - First value (4 or 8 bytes little endian)
+//    - Byte: bit width of zigzag encoded deltas ("width",
+//      0..32 for kDeltaFixed32, 0..56 for kDeltaFixed64)
+//    - ceil((num_values - 1) * width / 8) bytes: zigzag encoded deltas of
+//      consecutive values, packed into "width" bits each, least significant
+//      bits first
+//
+// Deltas are computed with wraparound, hence both increasing and decreasing
+// sequences pack well. Widths above 56 are never produced for kDeltaFixed64;
+// such columns do not benefit from packing and are stored as kRaw.
+//
+// Encoded form for kDeltaVarint:
+//  - Varint: number of values ("num_values")
+//  - If "num_values" > 0:
+//    - Varint: first value
+//    - "num_values" - 1 varints: zigzag encoded deltas of consecutive values
+
+// Appends the encoded form of src, an array of fixed width values, to *dest,
+// and returns true, if the encoded form is smaller than src. Otherwise returns
+// false and leaves *dest unchanged (also if src is not a whole number of
+// values).
+bool DeltaEncodeFixed32(absl::string_view src, Chain* dest);
+bool DeltaEncodeFixed64(absl::string_view src, Chain* dest);
+
+// Appends the encoded form of src, a sequence of varints, to *dest, and
+// returns true, if the encoded form is smaller than src. Otherwise returns
+// false and leaves *dest unchanged (also if src is not a whole number of
+// valid varints).
+bool DeltaEncodeVarint(absl::string_view src, Chain* dest);
+
+// Appends the original buffer bytes decoded from src to *dest.
+//
+// Return values:
+//  * true  - success
+//  * false - src is malformed (*dest is unspecified)
+bool DeltaDecodeFixed32(absl::string_view src, Chain* dest);
+bool DeltaDecodeFixed64(absl::string_view src, Chain* dest);
+bool DeltaDecodeVarint(absl::string_view src, Chain* dest);
+
+}  // namespace internal
+}  // namespace riegeli
+
+#endif  // RIEGELI_CHUNK_ENCODING_NUMERIC_COLUMNS_H_
@@ -18,6 +18,9 @@
 #include <stdint.h>
 
 #include <limits>
+#include <memory>
+#include <string>
+#include <utility>
 
 #include "absl/base/optimization.h"
 #include "riegeli/base/base.h"
@@ -39,7 +42,8 @@ void SimpleDecoder::Done() {
 
 bool SimpleDecoder::Reset(Reader* src, uint64_t num_records,
                           uint64_t decoded_data_size,
-                          std::vector<size_t>* limits) {
+                          std::vector<size_t>* limits,
+                          std::shared_ptr<const std::string> zstd_dictionary) {
   MarkHealthy();
   if (ABSL_PREDICT_FALSE(num_records > limits->max_size())) {
     return Fail(ResourceExhaustedError("Too many records"));
@@ -66,23 +70,40 @@ bool SimpleDecoder::Reset(Reader* src, uint64_t num_records,
     return Fail(ResourceExhaustedError("Size of sizes too large"));
   }
   internal::Decompressor<LimitingReader<>> sizes_decompressor(
-      LimitingReader<>(src, src->pos() + sizes_size), compression_type);
+      LimitingReader<>(src, src->pos() + sizes_size), compression_type,
+      zstd_dictionary);
   if (ABSL_PREDICT_FALSE(!sizes_decompressor.healthy())) {
     return Fail(sizes_decompressor);
   }
-  limits->clear();
-  size_t limit = 0;
-  while (limits->size() != num_records) {
-    uint64_t size;
-    if (ABSL_PREDICT_FALSE(!ReadVarint64(sizes_decompressor.reader(), &size))) {
+  limits->resize(IntCast<size_t>(num_records));
+  size_t* out = limits->data();
+  size_t remaining = IntCast<size_t>(num_records);
+  uint64_t limit = 0;
+  uint64_t sizes[256];
+  while (remaining > 0) {
+    const size_t batch =
+        UnsignedMin(remaining, sizeof(sizes) / sizeof(uint64_t));
+    if (ABSL_PREDICT_FALSE(
+            !ReadVarint64s(sizes_decompressor.reader(), sizes, batch))) {
       return Fail(*sizes_decompressor.reader(),
                   DataLossError("Reading record size failed"));
     }
-    if (ABSL_PREDICT_FALSE(size > decoded_data_size - limit)) {
+    // The running offsets are computed without branching on each element so
+    // that the loop reduces to straight line stores which the compiler can
+    // vectorize. Validity is accumulated in a sticky flag and checked once
+    // per batch: after an oversized element the subtraction below may wrap,
+    // but sizes_ok is already false, so later spurious passes do not matter.
+    bool sizes_ok = true;
+    for (size_t i = 0; i < batch; ++i) {
+      sizes_ok &= sizes[i] <= decoded_data_size - limit;
+      limit += sizes[i];
+      out[i] = static_cast<size_t>(limit);
+    }
+    if (ABSL_PREDICT_FALSE(!sizes_ok)) {
       return Fail(DataLossError("Decoded data size larger than expected"));
     }
-    limit += IntCast<size_t>(size);
-    limits->push_back(limit);
+    out += batch;
+    remaining -= batch;
   }
   if (ABSL_PREDICT_FALSE(!sizes_decompressor.VerifyEndAndClose())) {
     return Fail(sizes_decompressor);
@@ -91,7 +112,8 @@ bool SimpleDecoder::Reset(Reader* src, uint64_t num_records,
     return Fail(DataLossError("Decoded data size smaller than expected"));
   }
 
-  values_decompressor_ = internal::Decompressor<>(src, compression_type);
+  values_decompressor_ = internal::Decompressor<>(src, compression_type,
+                                                  std::move(zstd_dictionary));
   if (ABSL_PREDICT_FALSE(!values_decompressor_.healthy())) {
     return Fail(values_decompressor_);
   }
@@ -18,6 +18,8 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <memory>
+#include <string>
 #include <vector>
 
 #include "riegeli/base/base.h"
@@ -42,11 +44,15 @@ class SimpleDecoder : public Object {
   // src is not owned by this SimpleDecoder and must be kept alive but not
   // accessed until closing the SimpleDecoder.
   //
+  // If zstd_dictionary is not nullptr and the chunk is zstd compressed, the
+  // dictionary is used for decompression.
+  //
   // Return values:
   //  * true  - success (healthy())
   //  * false - failure (!healthy())
   bool Reset(Reader* src, uint64_t num_records, uint64_t decoded_data_size,
-             std::vector<size_t>* limits);
+             std::vector<size_t>* limits,
+             std::shared_ptr<const std::string> zstd_dictionary = nullptr);
 
   // Returns the Reader from which concatenated record values should be read.
   //
@@ -28,6 +28,7 @@
 #include "riegeli/base/base.h"
 #include "riegeli/base/canonical_errors.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
 #include "riegeli/base/status.h"
 #include "riegeli/bytes/chain_writer.h"
@@ -184,4 +185,10 @@ bool SimpleEncoder::EncodeAndClose(Writer* dest, ChunkType* chunk_type,
   return Close();
 }
 
+void SimpleEncoder::RegisterUnique(MemoryEstimator* memory_estimator) const {
+  memory_estimator->RegisterDynamicMemory(sizeof(*this));
+  sizes_compressor_.RegisterSubobjects(memory_estimator);
+  values_compressor_.RegisterSubobjects(memory_estimator);
+}
+
 }  // namespace riegeli
@@ -43,6 +43,11 @@ namespace riegeli {
 //
 // If compression is used, a compressed block is prefixed by its varint-encoded
 // uncompressed size.
+//
+// Chain records passed to AddRecord() and AddRecords() are appended to the
+// record values by sharing their blocks. With CompressionType::kNone record
+// data is thus not copied, except for records short enough that copying is
+// cheaper than sharing.
 class SimpleEncoder : public ChunkEncoder {
  public:
   // Creates an empty SimpleEncoder.
@@ -63,6 +68,8 @@ class SimpleEncoder : public ChunkEncoder {
                       uint64_t* num_records,
                       uint64_t* decoded_data_size) override;
 
+  void RegisterUnique(MemoryEstimator* memory_estimator) const override;
+
  private:
   template <typename Record>
   bool AddRecordImpl(Record&& record);
@@ -0,0 +1,166 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/chunk_encoding/string_columns.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/bytes/varint.h"
+#include "riegeli/bytes/writer_utils.h"
+
+namespace riegeli {
+namespace internal {
+
+namespace {
+
+// Reads a varint from *src, with bounds checking, unlike ReadVarint64() on
+// arrays which requires kMaxLengthVarint64 bytes of lookahead.
+bool ParseVarint(const char** src, const char* limit, uint64_t* data) {
+  uint64_t value = 0;
+  size_t shift = 0;
+  const char* cursor = *src;
+  do {
+    if (ABSL_PREDICT_FALSE(cursor == limit ||
+                           shift >= 8 * sizeof(uint64_t))) {
+      return false;
+    }
+    value |= uint64_t{static_cast<uint8_t>(*cursor) & 0x7f} << shift;
+    shift += 7;
+  } while (static_cast<uint8_t>(*cursor++) >= 0x80);
+  *src = cursor;
+  *data = value;
+  return true;
+}
+
+// Parses the next length-prefixed value of a string data buffer. The length
+// must be canonically encoded so that decoding, which writes canonical
+// varints, reproduces the original bytes exactly.
+bool ParseValue(const char** src, const char* limit, absl::string_view* value) {
+  const char* cursor = *src;
+  uint64_t length;
+  if (ABSL_PREDICT_FALSE(!ParseVarint(&cursor, limit, &length))) return false;
+  if (ABSL_PREDICT_FALSE(PtrDistance(*src, cursor) != LengthVarint64(length) ||
+                         length > PtrDistance(cursor, limit))) {
+    return false;
+  }
+  *value = absl::string_view(cursor, IntCast<size_t>(length));
+  *src = cursor + length;
+  return true;
+}
+
+}  // namespace
+
+bool InternEncodeStrings(absl::string_view src, Chain* dest) {
+  const char* cursor = src.data();
+  const char* const limit = src.data() + src.size();
+  // First pass: intern values and compute the encoded size.
+  absl::flat_hash_map<absl::string_view, uint64_t> interned;
+  uint64_t num_values = 0;
+  size_t encoded_size = 0;
+  while (cursor != limit) {
+    absl::string_view value;
+    if (ABSL_PREDICT_FALSE(!ParseValue(&cursor, limit, &value))) return false;
+    const uint64_t index = interned.size();
+    const auto inserted = interned.emplace(value, index);
+    if (inserted.second) {
+      encoded_size += LengthVarint64(2 * uint64_t{value.size()}) + value.size();
+    } else {
+      encoded_size += LengthVarint64(2 * inserted.first->second + 1);
+    }
+    ++num_values;
+  }
+  if (num_values == 0) return false;
+  encoded_size += LengthVarint64(num_values);
+  if (encoded_size >= src.size()) return false;
+  std::string encoded;
+  encoded.reserve(encoded_size);
+  char scratch[kMaxLengthVarint64];
+  encoded.append(scratch,
+                 PtrDistance(scratch, WriteVarint64(scratch, num_values)));
+  // Second pass: write literals at first occurrences and references
+  // afterwards.
+  interned.clear();
+  cursor = src.data();
+  for (uint64_t i = 0; i < num_values; ++i) {
+    absl::string_view value;
+    if (ABSL_PREDICT_FALSE(!ParseValue(&cursor, limit, &value))) {
+      RIEGELI_ASSERT_UNREACHABLE()
+          << "String column changed between encoding passes";
+    }
+    const uint64_t index = interned.size();
+    const auto inserted = interned.emplace(value, index);
+    const uint64_t token = inserted.second
+                               ? 2 * uint64_t{value.size()}
+                               : 2 * inserted.first->second + 1;
+    encoded.append(scratch,
+                   PtrDistance(scratch, WriteVarint64(scratch, token)));
+    if (inserted.second) encoded.append(value.data(), value.size());
+  }
+  RIEGELI_ASSERT_EQ(encoded.size(), encoded_size)
+      << "Interned string column has unexpected size";
+  dest->Append(std::move(encoded));
+  return true;
+}
+
+bool InternDecodeStrings(absl::string_view src, Chain* dest) {
+  const char* cursor = src.data();
+  const char* const limit = src.data() + src.size();
+  uint64_t num_values;
+  if (ABSL_PREDICT_FALSE(!ParseVarint(&cursor, limit, &num_values))) {
+    return false;
+  }
+  std::string decoded;
+  char scratch[kMaxLengthVarint64];
+  // Distinct values seen so far, in the order of their first occurrence.
+  // Literal bytes stay valid in src.
+  std::vector<absl::string_view> values;
+  for (uint64_t i = 0; i < num_values; ++i) {
+    uint64_t token;
+    if (ABSL_PREDICT_FALSE(!ParseVarint(&cursor, limit, &token))) return false;
+    absl::string_view value;
+    if ((token & 1) == 0) {
+      const uint64_t length = token / 2;
+      if (ABSL_PREDICT_FALSE(length > PtrDistance(cursor, limit))) {
+        return false;
+      }
+      value = absl::string_view(cursor, IntCast<size_t>(length));
+      cursor += length;
+      values.push_back(value);
+    } else {
+      const uint64_t index = token / 2;
+      if (ABSL_PREDICT_FALSE(index >= values.size())) return false;
+      value = values[IntCast<size_t>(index)];
+    }
+    decoded.append(
+        scratch,
+        PtrDistance(scratch, WriteVarint64(scratch, uint64_t{value.size()})));
+    decoded.append(value.data(), value.size());
+  }
+  if (ABSL_PREDICT_FALSE(cursor != limit)) return false;
+  dest->Append(std::move(decoded));
+  return true;
+}
+
+}  // namespace internal
+}  // namespace riegeli
@@ -0,0 +1,55 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_CHUNK_ENCODING_STRING_COLUMNS_H_
+#define RIEGELI_CHUNK_ENCODING_STRING_COLUMNS_H_
+
+#include "absl/strings/string_view.h"
+#include "riegeli/base/chain.h"
+
+namespace riegeli {
+namespace internal {
+
+// Interning of string columns, used by transposed columnar chunks
+// (ChunkType::kTransposedColumnar, ColumnEncoding::kInternedStrings).
+// A string data buffer is a sequence of values, each a varint length followed
+// by that many bytes. Columns of enum-like labels repeat a small set of
+// distinct values, hence storing each distinct value once and references
+// afterwards shrinks the buffer and the data to decompress.
+//
+// Encoded form for kInternedStrings:
+//  - Varint: number of values ("num_values")
+//  - "num_values" times, a varint token:
+//    - Even token: a literal value of token / 2 bytes which follow; the value
+//      joins the table of distinct values
+//    - Odd token: a reference to distinct value number token / 2, counting
+//      literals in the order of their first occurrence from 0
+
+// Appends the encoded form of src, a sequence of length-prefixed values, to
+// *dest, and returns true, if the encoded form is smaller than src. Otherwise
+// returns false and leaves *dest unchanged (also if src is not a whole number
+// of values with canonically encoded lengths).
+bool InternEncodeStrings(absl::string_view src, Chain* dest);
+
+// Appends the original buffer bytes decoded from src to *dest.
+//
+// Return values:
+//  * true  - success
+//  * false - src is malformed (*dest is unspecified)
+bool InternDecodeStrings(absl::string_view src, Chain* dest);
+
+}  // namespace internal
+}  // namespace riegeli
+
+#endif  // RIEGELI_CHUNK_ENCODING_STRING_COLUMNS_H_
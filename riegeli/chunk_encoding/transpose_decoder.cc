@@ -19,6 +19,7 @@
 
 #include <cstring>
 #include <limits>
+#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
@@ -26,6 +27,7 @@
 #include "absl/base/attributes.h"
 #include "absl/base/optimization.h"
 #include "absl/container/flat_hash_map.h"
+#include "absl/memory/memory.h"
 #include "absl/strings/string_view.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/canonical_errors.h"
@@ -42,6 +44,8 @@
 #include "riegeli/bytes/writer_utils.h"
 #include "riegeli/chunk_encoding/constants.h"
 #include "riegeli/chunk_encoding/decompressor.h"
+#include "riegeli/chunk_encoding/numeric_columns.h"
+#include "riegeli/chunk_encoding/string_columns.h"
 #include "riegeli/chunk_encoding/transpose_internal.h"
 
 namespace riegeli {
@@ -70,6 +74,11 @@ struct DataBucket {
   internal::Decompressor<ChainReader<>> decompressor;
   // A prefix of decompressed data buffers, lazily extended.
   std::vector<ChainReader<Chain>> buffers;
+  // Whether the column encoding of the corresponding buffer has been decoded,
+  // valid if the chunk is columnar. Column decoding is deferred to the first
+  // touch of the buffer, so buffers decompressed only because they precede a
+  // needed buffer in the bucket skip it.
+  std::vector<bool> column_decoded;
 };
 
 // Should the data content of the field be decoded?
@@ -79,19 +88,64 @@ enum class FieldIncluded {
   kExistenceOnly,
 };
 
+// Replaces *data, a buffer of a transposed columnar chunk consisting of a
+// ColumnEncoding byte followed by the encoded buffer bytes, with the original
+// buffer bytes. Returns false if *data is malformed.
+bool DecodeColumn(Chain* data) {
+  if (data->empty()) return true;
+  absl::string_view flat;
+  std::string scratch;
+  ChainReader<> data_reader(data);
+  if (!data_reader.ReadAll(&flat, &scratch)) {
+    RIEGELI_ASSERT_UNREACHABLE()
+        << "Reading buffer failed: " << data_reader.status();
+  }
+  const uint8_t encoding = static_cast<uint8_t>(flat.front());
+  flat.remove_prefix(1);
+  switch (static_cast<internal::ColumnEncoding>(encoding)) {
+    case internal::ColumnEncoding::kRaw:
+      data->RemovePrefix(1);
+      return true;
+    case internal::ColumnEncoding::kDeltaFixed32: {
+      Chain decoded;
+      if (ABSL_PREDICT_FALSE(!internal::DeltaDecodeFixed32(flat, &decoded))) {
+        return false;
+      }
+      *data = std::move(decoded);
+      return true;
+    }
+    case internal::ColumnEncoding::kDeltaFixed64: {
+      Chain decoded;
+      if (ABSL_PREDICT_FALSE(!internal::DeltaDecodeFixed64(flat, &decoded))) {
+        return false;
+      }
+      *data = std::move(decoded);
+      return true;
+    }
+    case internal::ColumnEncoding::kDeltaVarint: {
+      Chain decoded;
+      if (ABSL_PREDICT_FALSE(!internal::DeltaDecodeVarint(flat, &decoded))) {
+        return false;
+      }
+      *data = std::move(decoded);
+      return true;
+    }
+    case internal::ColumnEncoding::kInternedStrings: {
+      Chain decoded;
+      if (ABSL_PREDICT_FALSE(!internal::InternDecodeStrings(flat, &decoded))) {
+        return false;
+      }
+      *data = std::move(decoded);
+      return true;
+    }
+  }
+  return false;
+}
+
 // Return true if "tag" is a valid protocol buffer tag.
 bool ValidTag(uint32_t tag) {
-  switch (static_cast<internal::WireType>(tag & 7)) {
-    case internal::WireType::kVarint:
-    case internal::WireType::kFixed32:
-    case internal::WireType::kFixed64:
-    case internal::WireType::kLengthDelimited:
-    case internal::WireType::kStartGroup:
-    case internal::WireType::kEndGroup:
-      return tag >= 8;
-    default:
-      return false;
-  }
+  return tag >= 8 &&
+         (internal::kTagFlags[tag & 7] & internal::kTagWireTypeValid) != 0;
 }
 
 }  // namespace
@@ -360,27 +414,102 @@ struct TransposeDecoder::Context {
   uint32_t first_node = 0;
   // State machine transitions. One byte = one transition.
   internal::Decompressor<> transitions;
+  // Whether data buffers carry ColumnEncoding prefixes
+  // (ChunkType::kTransposedColumnar).
+  bool columnar = false;
+  // Zstd dictionary used for decompression, or nullptr.
+  std::shared_ptr<const std::string> zstd_dictionary;
 
   // --- Fields used in projection. ---
-  // We number used fields with indices into "existence_only" vector below.
-  // Fields form a tree structure stored in "include_fields" map. If "p" is
-  // the index of parent submessage then "include_fields[<p,f>]" is the index
-  // of the child with field number "f". The root index is assumed to be
-  // "kInvalidPos".
-  absl::flat_hash_map<std::pair<uint32_t, uint32_t>, uint32_t> include_fields;
-  // Are we interested in the existence of the field only?
-  std::vector<bool> existence_only;
+  // The compiled projection; not owned. Valid during Reset().
+  const CompiledFieldProjection* projection = nullptr;
   // Data buckets.
   std::vector<DataBucket> buckets;
   // Template that can later be used later to finalize StateMachineNode.
   std::vector<StateMachineNodeTemplate> node_templates;
 };
 
+// Parsed form of a chunk header, cached between chunks. Consecutive chunks of
+// one file usually share the same schema, hence identical header bytes; when
+// they repeat, the state machine is reused instead of being built again.
+struct TransposeDecoder::HeaderCache {
+  // --- The key: raw header bytes which were compiled into this cache. ---
+  CompressionType compression_type = CompressionType::kNone;
+  bool projection_enabled = false;
+  bool columnar = false;
+  // Compared by identity: the dictionary is fixed for the life of a file.
+  std::shared_ptr<const std::string> zstd_dictionary;
+  Chain compressed_header;
+
+  // --- Bucket and buffer layout parsed from the header. ---
+  std::vector<size_t> bucket_lengths;
+  std::vector<size_t> buffer_lengths;
+
+  // --- The pristine state machine as built from the header. ---
+  // next_node, buffer, and node_template pointers in the nodes are stale;
+  // ParseFromCache() rebinds them to the data of the current chunk.
+  std::vector<StateMachineNode> state_machine_nodes;
+  std::vector<StateMachineNodeTemplate> node_templates;
+  // Resolved next node index of each node.
+  std::vector<uint32_t> next_node_ids;
+  // Buffer index bound to each node, or kInvalidPos if none.
+  std::vector<uint32_t> node_buffer_indices;
+  uint32_t first_node = 0;
+  bool has_nonproto_op = false;
+};
+
+TransposeDecoder::TransposeDecoder() noexcept : Object(State::kClosed) {}
+
+TransposeDecoder::TransposeDecoder(TransposeDecoder&& that) noexcept
+    : Object(std::move(that)), header_cache_(std::move(that.header_cache_)) {}
+
+TransposeDecoder& TransposeDecoder::operator=(
+    TransposeDecoder&& that) noexcept {
+  Object::operator=(std::move(that));
+  header_cache_ = std::move(that.header_cache_);
+  return *this;
+}
+
+TransposeDecoder::~TransposeDecoder() {}
+
+CompiledFieldProjection::CompiledFieldProjection(
+    const FieldProjection& field_projection)
+    : includes_all_(field_projection.includes_all()) {
+  if (includes_all_) return;
+  for (const Field& include_field : field_projection.fields()) {
+    uint32_t current_index = kInvalidPos;
+    for (size_t i = 0; i < include_field.path().size(); ++i) {
+      const std::pair<
+          absl::flat_hash_map<std::pair<uint32_t, uint32_t>,
+                              uint32_t>::iterator,
+          bool>
+          insert_result = include_fields_.emplace(
+              std::make_pair(current_index, include_field.path()[i]),
+              IntCast<uint32_t>(existence_only_.size()));
+      if (insert_result.second) existence_only_.push_back(true);
+      current_index = insert_result.first->second;
+    }
+    existence_only_[current_index] = false;
+  }
+}
+
 bool TransposeDecoder::Reset(Reader* src, uint64_t num_records,
-                             uint64_t decoded_data_size,
+                             uint64_t decoded_data_size, bool columnar,
                              const FieldProjection& field_projection,
-                             BackwardWriter* dest,
-                             std::vector<size_t>* limits) {
+                             BackwardWriter* dest, std::vector<size_t>* limits,
+                             std::shared_ptr<const std::string>
+                                 zstd_dictionary) {
+  return Reset(src, num_records, decoded_data_size, columnar,
+               CompiledFieldProjection(field_projection), dest, limits,
+               std::move(zstd_dictionary));
+}
+
+bool TransposeDecoder::Reset(Reader* src, uint64_t num_records,
+                             uint64_t decoded_data_size, bool columnar,
+                             const CompiledFieldProjection& field_projection,
+                             BackwardWriter* dest, std::vector<size_t>* limits,
+                             std::shared_ptr<const std::string>
+                                 zstd_dictionary) {
   RIEGELI_ASSERT_EQ(dest->pos(), 0u)
       << "Failed precondition of TransposeDecoder::Reset(): "
          "non-zero destination position";
@@ -394,6 +523,8 @@ bool TransposeDecoder::Reset(Reader* src, uint64_t num_records,
   }
 
   Context context;
+  context.columnar = columnar;
+  context.zstd_dictionary = std::move(zstd_dictionary);
   if (ABSL_PREDICT_FALSE(!Parse(&context, src, field_projection))) return false;
   LimitingBackwardWriter<> limiting_dest(dest, decoded_data_size);
   if (ABSL_PREDICT_FALSE(
@@ -411,25 +542,11 @@ bool TransposeDecoder::Reset(Reader* src, uint64_t num_records,
   return true;
 }
 
-inline bool TransposeDecoder::Parse(Context* context, Reader* src,
-                                    const FieldProjection& field_projection) {
+inline bool TransposeDecoder::Parse(
+    Context* context, Reader* src,
+    const CompiledFieldProjection& field_projection) {
   const bool projection_enabled = !field_projection.includes_all();
-  if (projection_enabled) {
-    for (const Field& include_field : field_projection.fields()) {
-      uint32_t current_index = kInvalidPos;
-      for (size_t i = 0; i < include_field.path().size(); ++i) {
-        const std::pair<absl::flat_hash_map<std::pair<uint32_t, uint32_t>,
-                                            uint32_t>::iterator,
-                        bool>
-            insert_result = context->include_fields.emplace(
-                std::make_pair(current_index, include_field.path()[i]),
-                IntCast<uint32_t>(context->existence_only.size()));
-        if (insert_result.second) context->existence_only.push_back(true);
-        current_index = insert_result.first->second;
-      }
-      context->existence_only[current_index] = false;
-    }
-  }
+  context->projection = &field_projection;
 
   uint8_t compression_type_byte;
   if (ABSL_PREDICT_FALSE(!ReadByte(src, &compression_type_byte))) {
@@ -446,8 +563,25 @@ inline bool TransposeDecoder::Parse(Context* context, Reader* src,
   if (ABSL_PREDICT_FALSE(!src->Read(&header, header_size))) {
     return Fail(*src, DataLossError("Reading header failed"));
   }
+  if (header_cache_ != nullptr &&
+      header_cache_->compression_type == context->compression_type &&
+      header_cache_->projection_enabled == projection_enabled &&
+      header_cache_->columnar == context->columnar &&
+      header_cache_->zstd_dictionary == context->zstd_dictionary &&
+      header_cache_->compressed_header == header) {
+    return ParseFromCache(context, src);
+  }
+  // The cache is replaced only when parsing succeeds, so that a failed chunk
+  // cannot leave a partially built cache behind.
+  std::unique_ptr<HeaderCache> cache = absl::make_unique<HeaderCache>();
+  cache->compression_type = context->compression_type;
+  cache->projection_enabled = projection_enabled;
+  cache->columnar = context->columnar;
+  cache->zstd_dictionary = context->zstd_dictionary;
+  cache->compressed_header = std::move(header);
   internal::Decompressor<ChainReader<>> header_decompressor(
-      (ChainReader<>(&header)), context->compression_type);
+      (ChainReader<>(&cache->compressed_header)), context->compression_type,
+      context->zstd_dictionary);
   if (ABSL_PREDICT_FALSE(!header_decompressor.healthy())) {
     return Fail(header_decompressor);
   }
@@ -456,15 +590,15 @@ inline bool TransposeDecoder::Parse(Context* context, Reader* src,
   std::vector<uint32_t> first_buffer_indices;
   std::vector<uint32_t> bucket_indices;
   if (projection_enabled) {
-    if (ABSL_PREDICT_FALSE(
-            !ParseBuffersForFitering(context, header_decompressor.reader(), src,
-                                     &first_buffer_indices, &bucket_indices))) {
+    if (ABSL_PREDICT_FALSE(!ParseBuffersForFitering(
+            context, header_decompressor.reader(), src, cache.get(),
+            &first_buffer_indices, &bucket_indices))) {
       return false;
     }
     num_buffers = IntCast<uint32_t>(bucket_indices.size());
   } else {
-    if (ABSL_PREDICT_FALSE(
-            !ParseBuffers(context, header_decompressor.reader(), src))) {
+    if (ABSL_PREDICT_FALSE(!ParseBuffers(context, header_decompressor.reader(),
+                                         src, cache.get()))) {
       return false;
     }
     num_buffers = IntCast<uint32_t>(context->buffers.size());
@@ -482,6 +616,8 @@ inline bool TransposeDecoder::Parse(Context* context, Reader* src,
   if (projection_enabled) context->node_templates.resize(state_machine_size);
   std::vector<StateMachineNode>& state_machine_nodes =
       context->state_machine_nodes;
+  cache->next_node_ids.reserve(state_machine_size);
+  std::vector<uint32_t> node_buffer_indices(state_machine_size, kInvalidPos);
   bool has_nonproto_op = false;
   size_t num_subtypes = 0;
   std::vector<uint32_t> tags;
@@ -532,6 +668,7 @@ inline bool TransposeDecoder::Parse(Context* context, Reader* src,
         if (ABSL_PREDICT_FALSE(buffer_index >= num_buffers)) {
           return Fail(DataLossError("Buffer index too large"));
         }
+        node_buffer_indices[i] = buffer_index;
         if (projection_enabled) {
           const uint32_t bucket = bucket_indices[buffer_index];
           state_machine_node.buffer = GetBuffer(
@@ -618,6 +755,7 @@ inline bool TransposeDecoder::Parse(Context* context, Reader* src,
             if (ABSL_PREDICT_FALSE(buffer_index >= num_buffers)) {
               return Fail(DataLossError("Buffer index too large"));
             }
+            node_buffer_indices[i] = buffer_index;
             state_machine_node.buffer = &context->buffers[buffer_index];
           }
           state_machine_node.callback_type =
@@ -651,6 +789,7 @@ inline bool TransposeDecoder::Parse(Context* context, Reader* src,
       return Fail(DataLossError("Node index too large"));
     }
 
+    cache->next_node_ids.push_back(next_node_id);
     state_machine_node.next_node = &state_machine_nodes[next_node_id];
   }
 
@@ -693,8 +832,94 @@ inline bool TransposeDecoder::Parse(Context* context, Reader* src,
   if (ABSL_PREDICT_FALSE(!header_decompressor.VerifyEndAndClose())) {
     return Fail(header_decompressor);
   }
-  context->transitions =
-      internal::Decompressor<>(src, context->compression_type);
+
+  // Snapshot the pristine state machine before decoding mutates it.
+  cache->state_machine_nodes = context->state_machine_nodes;
+  cache->node_templates = context->node_templates;
+  cache->node_buffer_indices = std::move(node_buffer_indices);
+  cache->first_node = context->first_node;
+  cache->has_nonproto_op = has_nonproto_op;
+  header_cache_ = std::move(cache);
+
+  context->transitions = internal::Decompressor<>(
+      src, context->compression_type, context->zstd_dictionary);
+  if (ABSL_PREDICT_FALSE(!context->transitions.healthy())) {
+    return Fail(context->transitions);
+  }
+  return true;
+}
+
+inline bool TransposeDecoder::ParseFromCache(Context* context, Reader* src) {
+  HeaderCache& cache = *header_cache_;
+  const bool projection_enabled = cache.projection_enabled;
+  std::vector<uint32_t> first_buffer_indices;
+  std::vector<uint32_t> bucket_indices;
+  if (projection_enabled) {
+    if (ABSL_PREDICT_FALSE(!ParseBuffersForFitering(context, nullptr, src,
+                                                    &cache,
+                                                    &first_buffer_indices,
+                                                    &bucket_indices))) {
+      return false;
+    }
+  } else {
+    if (ABSL_PREDICT_FALSE(!ParseBuffers(context, nullptr, src, &cache))) {
+      return false;
+    }
+  }
+
+  // Restore the pristine state machine and rebind its pointers to the data of
+  // this chunk.
+  context->state_machine_nodes = cache.state_machine_nodes;
+  context->node_templates = cache.node_templates;
+  std::vector<StateMachineNode>& state_machine_nodes =
+      context->state_machine_nodes;
+  const size_t state_machine_size = cache.next_node_ids.size();
+  for (size_t i = 0; i < state_machine_size; ++i) {
+    StateMachineNode& state_machine_node = state_machine_nodes[i];
+    state_machine_node.next_node = &state_machine_nodes[cache.next_node_ids[i]];
+    const internal::CallbackType callback_type =
+        static_cast<internal::CallbackType>(
+            static_cast<uint8_t>(state_machine_node.callback_type) &
+            ~static_cast<uint8_t>(internal::CallbackType::kImplicit));
+    if (callback_type == internal::CallbackType::kSelectCallback) {
+      state_machine_node.node_template = &context->node_templates[i];
+    } else if (cache.node_buffer_indices[i] != kInvalidPos) {
+      const uint32_t buffer_index = cache.node_buffer_indices[i];
+      if (projection_enabled) {
+        const uint32_t bucket = bucket_indices[buffer_index];
+        state_machine_node.buffer = GetBuffer(
+            context, bucket, buffer_index - first_buffer_indices[bucket]);
+        if (ABSL_PREDICT_FALSE(state_machine_node.buffer == nullptr)) {
+          return false;
+        }
+      } else {
+        state_machine_node.buffer = &context->buffers[buffer_index];
+      }
+    }
+  }
+
+  if (cache.has_nonproto_op) {
+    const uint32_t num_buffers =
+        projection_enabled ? IntCast<uint32_t>(bucket_indices.size())
+                           : IntCast<uint32_t>(context->buffers.size());
+    if (ABSL_PREDICT_FALSE(num_buffers == 0)) {
+      return Fail(DataLossError("Missing buffer for non-proto records"));
+    }
+    if (projection_enabled) {
+      const uint32_t bucket = bucket_indices[num_buffers - 1];
+      context->nonproto_lengths = GetBuffer(
+          context, bucket, num_buffers - 1 - first_buffer_indices[bucket]);
+      if (ABSL_PREDICT_FALSE(context->nonproto_lengths == nullptr)) {
+        return false;
+      }
+    } else {
+      context->nonproto_lengths = &context->buffers.back();
+    }
+  }
+
+  context->first_node = cache.first_node;
+  context->transitions = internal::Decompressor<>(
+      src, context->compression_type, context->zstd_dictionary);
   if (ABSL_PREDICT_FALSE(!context->transitions.healthy())) {
     return Fail(context->transitions);
   }
@@ -702,19 +927,27 @@ inline bool TransposeDecoder::Parse(Context* context, Reader* src,
 }
 
 inline bool TransposeDecoder::ParseBuffers(Context* context,
-                                           Reader* header_reader, Reader* src) {
+                                           Reader* header_reader, Reader* src,
+                                           HeaderCache* cache) {
   uint32_t num_buckets;
-  if (ABSL_PREDICT_FALSE(!ReadVarint32(header_reader, &num_buckets))) {
-    return Fail(*header_reader,
-                DataLossError("Reading number of buckets failed"));
-  }
   uint32_t num_buffers;
-  if (ABSL_PREDICT_FALSE(!ReadVarint32(header_reader, &num_buffers))) {
-    return Fail(*header_reader,
-                DataLossError("Reading number of buffers failed"));
-  }
-  if (ABSL_PREDICT_FALSE(num_buffers > context->buffers.max_size())) {
-    return Fail(DataLossError("Too many buffers"));
+  if (header_reader != nullptr) {
+    if (ABSL_PREDICT_FALSE(!ReadVarint32(header_reader, &num_buckets))) {
+      return Fail(*header_reader,
+                  DataLossError("Reading number of buckets failed"));
+    }
+    if (ABSL_PREDICT_FALSE(!ReadVarint32(header_reader, &num_buffers))) {
+      return Fail(*header_reader,
+                  DataLossError("Reading number of buffers failed"));
+    }
+    if (ABSL_PREDICT_FALSE(num_buffers > context->buffers.max_size())) {
+      return Fail(DataLossError("Too many buffers"));
+    }
+    cache->bucket_lengths.reserve(num_buckets);
+    cache->buffer_lengths.reserve(num_buffers);
+  } else {
+    num_buckets = IntCast<uint32_t>(cache->bucket_lengths.size());
+    num_buffers = IntCast<uint32_t>(cache->buffer_lengths.size());
   }
   if (num_buckets == 0) {
     if (ABSL_PREDICT_FALSE(num_buffers != 0)) {
@@ -730,13 +963,18 @@ inline bool TransposeDecoder::ParseBuffers(Context* context,
   bucket_decompressors.reserve(num_buckets);
   for (uint32_t bucket_index = 0; bucket_index < num_buckets; ++bucket_index) {
     uint64_t bucket_length;
-    if (ABSL_PREDICT_FALSE(!ReadVarint64(header_reader, &bucket_length))) {
-      return Fail(*header_reader,
-                  DataLossError("Reading bucket length failed"));
-    }
-    if (ABSL_PREDICT_FALSE(bucket_length >
-                           std::numeric_limits<size_t>::max())) {
-      return Fail(ResourceExhaustedError("Bucket too large"));
+    if (header_reader != nullptr) {
+      if (ABSL_PREDICT_FALSE(!ReadVarint64(header_reader, &bucket_length))) {
+        return Fail(*header_reader,
+                    DataLossError("Reading bucket length failed"));
+      }
+      if (ABSL_PREDICT_FALSE(bucket_length >
+                             std::numeric_limits<size_t>::max())) {
+        return Fail(ResourceExhaustedError("Bucket too large"));
+      }
+      cache->bucket_lengths.push_back(IntCast<size_t>(bucket_length));
+    } else {
+      bucket_length = cache->bucket_lengths[bucket_index];
     }
     Chain bucket;
     if (ABSL_PREDICT_FALSE(
@@ -744,7 +982,8 @@ inline bool TransposeDecoder::ParseBuffers(Context* context,
       return Fail(*src, DataLossError("Reading bucket failed"));
     }
     bucket_decompressors.emplace_back(ChainReader<Chain>(std::move(bucket)),
-                                      context->compression_type);
+                                      context->compression_type,
+                                      context->zstd_dictionary);
     if (ABSL_PREDICT_FALSE(!bucket_decompressors.back().healthy())) {
       return Fail(bucket_decompressors.back());
     }
@@ -753,13 +992,18 @@ inline bool TransposeDecoder::ParseBuffers(Context* context,
   uint32_t bucket_index = 0;
   for (size_t buffer_index = 0; buffer_index < num_buffers; ++buffer_index) {
     uint64_t buffer_length;
-    if (ABSL_PREDICT_FALSE(!ReadVarint64(header_reader, &buffer_length))) {
-      return Fail(*header_reader,
-                  DataLossError("Reading buffer length failed"));
-    }
-    if (ABSL_PREDICT_FALSE(buffer_length >
-                           std::numeric_limits<size_t>::max())) {
-      return Fail(ResourceExhaustedError("Buffer too large"));
+    if (header_reader != nullptr) {
+      if (ABSL_PREDICT_FALSE(!ReadVarint64(header_reader, &buffer_length))) {
+        return Fail(*header_reader,
+                    DataLossError("Reading buffer length failed"));
+      }
+      if (ABSL_PREDICT_FALSE(buffer_length >
+                             std::numeric_limits<size_t>::max())) {
+        return Fail(ResourceExhaustedError("Buffer too large"));
+      }
+      cache->buffer_lengths.push_back(IntCast<size_t>(buffer_length));
+    } else {
+      buffer_length = cache->buffer_lengths[buffer_index];
     }
     Chain buffer;
     if (ABSL_PREDICT_FALSE(!bucket_decompressors[bucket_index].reader()->Read(
@@ -767,6 +1011,11 @@ inline bool TransposeDecoder::ParseBuffers(Context* context,
       return Fail(*bucket_decompressors[bucket_index].reader(),
                   DataLossError("Reading buffer failed"));
     }
+    if (context->columnar) {
+      if (ABSL_PREDICT_FALSE(!DecodeColumn(&buffer))) {
+        return Fail(DataLossError("Invalid columnar buffer"));
+      }
+    }
     context->buffers.emplace_back(std::move(buffer));
     while (!bucket_decompressors[bucket_index].reader()->Pull() &&
            bucket_index + 1 < num_buckets) {
@@ -788,24 +1037,31 @@ inline bool TransposeDecoder::ParseBuffers(Context* context,
 }
 
 inline bool TransposeDecoder::ParseBuffersForFitering(
-    Context* context, Reader* header_reader, Reader* src,
+    Context* context, Reader* header_reader, Reader* src, HeaderCache* cache,
     std::vector<uint32_t>* first_buffer_indices,
     std::vector<uint32_t>* bucket_indices) {
   uint32_t num_buckets;
-  if (ABSL_PREDICT_FALSE(!ReadVarint32(header_reader, &num_buckets))) {
-    return Fail(*header_reader,
-                DataLossError("Reading number of buckets failed"));
-  }
-  if (ABSL_PREDICT_FALSE(num_buckets > context->buckets.max_size())) {
-    return Fail(ResourceExhaustedError("Too many buckets"));
-  }
   uint32_t num_buffers;
-  if (ABSL_PREDICT_FALSE(!ReadVarint32(header_reader, &num_buffers))) {
-    return Fail(*header_reader,
-                DataLossError("Reading number of buffers failed"));
-  }
-  if (ABSL_PREDICT_FALSE(num_buffers > bucket_indices->max_size())) {
-    return Fail(ResourceExhaustedError("Too many buffers"));
+  if (header_reader != nullptr) {
+    if (ABSL_PREDICT_FALSE(!ReadVarint32(header_reader, &num_buckets))) {
+      return Fail(*header_reader,
+                  DataLossError("Reading number of buckets failed"));
+    }
+    if (ABSL_PREDICT_FALSE(num_buckets > context->buckets.max_size())) {
+      return Fail(ResourceExhaustedError("Too many buckets"));
+    }
+    if (ABSL_PREDICT_FALSE(!ReadVarint32(header_reader, &num_buffers))) {
+      return Fail(*header_reader,
+                  DataLossError("Reading number of buffers failed"));
+    }
+    if (ABSL_PREDICT_FALSE(num_buffers > bucket_indices->max_size())) {
+      return Fail(ResourceExhaustedError("Too many buffers"));
+    }
+    cache->bucket_lengths.reserve(num_buckets);
+    cache->buffer_lengths.reserve(num_buffers);
+  } else {
+    num_buckets = IntCast<uint32_t>(cache->bucket_lengths.size());
+    num_buffers = IntCast<uint32_t>(cache->buffer_lengths.size());
   }
   if (num_buckets == 0) {
     if (ABSL_PREDICT_FALSE(num_buffers != 0)) {
@@ -818,13 +1074,18 @@ inline bool TransposeDecoder::ParseBuffersForFitering(
   context->buckets.reserve(num_buckets);
   for (uint32_t bucket_index = 0; bucket_index < num_buckets; ++bucket_index) {
     uint64_t bucket_length;
-    if (ABSL_PREDICT_FALSE(!ReadVarint64(header_reader, &bucket_length))) {
-      return Fail(*header_reader,
-                  DataLossError("Reading bucket length failed"));
-    }
-    if (ABSL_PREDICT_FALSE(bucket_length >
-                           std::numeric_limits<size_t>::max())) {
-      return Fail(ResourceExhaustedError("Bucket too large"));
+    if (header_reader != nullptr) {
+      if (ABSL_PREDICT_FALSE(!ReadVarint64(header_reader, &bucket_length))) {
+        return Fail(*header_reader,
+                    DataLossError("Reading bucket length failed"));
+      }
+      if (ABSL_PREDICT_FALSE(bucket_length >
+                             std::numeric_limits<size_t>::max())) {
+        return Fail(ResourceExhaustedError("Bucket too large"));
+      }
+      cache->bucket_lengths.push_back(IntCast<size_t>(bucket_length));
+    } else {
+      bucket_length = cache->bucket_lengths[bucket_index];
     }
     context->buckets.emplace_back();
     if (ABSL_PREDICT_FALSE(!src->Read(&context->buckets.back().compressed_data,
@@ -843,13 +1104,18 @@ inline bool TransposeDecoder::ParseBuffersForFitering(
   }
   for (uint32_t buffer_index = 0; buffer_index < num_buffers; ++buffer_index) {
     uint64_t buffer_length;
-    if (ABSL_PREDICT_FALSE(!ReadVarint64(header_reader, &buffer_length))) {
-      return Fail(*header_reader,
-                  DataLossError("Reading buffer length failed"));
-    }
-    if (ABSL_PREDICT_FALSE(buffer_length >
-                           std::numeric_limits<size_t>::max())) {
-      return Fail(ResourceExhaustedError("Buffer too large"));
+    if (header_reader != nullptr) {
+      if (ABSL_PREDICT_FALSE(!ReadVarint64(header_reader, &buffer_length))) {
+        return Fail(*header_reader,
+                    DataLossError("Reading buffer length failed"));
+      }
+      if (ABSL_PREDICT_FALSE(buffer_length >
+                             std::numeric_limits<size_t>::max())) {
+        return Fail(ResourceExhaustedError("Buffer too large"));
+      }
+      cache->buffer_lengths.push_back(IntCast<size_t>(buffer_length));
+    } else {
+      buffer_length = cache->buffer_lengths[buffer_index];
     }
     context->buckets[bucket_index].buffer_sizes.push_back(
         IntCast<size_t>(buffer_length));
@@ -891,7 +1157,8 @@ inline Reader* TransposeDecoder::GetBuffer(Context* context,
     if (bucket.buffers.empty()) {
       // This is the first buffer to be decompressed from this bucket.
       bucket.decompressor = internal::Decompressor<ChainReader<>>(
-          ChainReader<>(&bucket.compressed_data), context->compression_type);
+          ChainReader<>(&bucket.compressed_data), context->compression_type,
+          context->zstd_dictionary);
       if (ABSL_PREDICT_FALSE(!bucket.decompressor.healthy())) {
         Fail(bucket.decompressor);
         return nullptr;
@@ -906,7 +1173,11 @@ inline Reader* TransposeDecoder::GetBuffer(Context* context,
            DataLossError("Reading buffer failed"));
       return nullptr;
     }
+    // Column decoding is deferred to the first touch of the buffer below:
+    // this buffer may be decompressed only because it precedes the needed
+    // buffer in the bucket, and may never be touched itself.
     bucket.buffers.emplace_back(std::move(buffer));
+    if (context->columnar) bucket.column_decoded.push_back(false);
     if (bucket.buffers.size() == bucket.buffer_sizes.size()) {
       // This was the last decompressed buffer from this bucket.
       if (ABSL_PREDICT_FALSE(!bucket.decompressor.VerifyEndAndClose())) {
@@ -918,6 +1189,18 @@ inline Reader* TransposeDecoder::GetBuffer(Context* context,
       bucket.buffer_sizes = std::vector<size_t>();
     }
   }
+  if (context->columnar && !bucket.column_decoded[index_within_bucket]) {
+    // First touch of this buffer: decode its column encoding. The buffer has
+    // not been read from yet, so replacing its reader is safe; nodes sharing
+    // the buffer see the flag and do not decode again.
+    Chain data(std::move(bucket.buffers[index_within_bucket].src()));
+    if (ABSL_PREDICT_FALSE(!DecodeColumn(&data))) {
+      Fail(DataLossError("Invalid columnar buffer"));
+      return nullptr;
+    }
+    bucket.buffers[index_within_bucket] = ChainReader<Chain>(std::move(data));
+    bucket.column_decoded[index_within_bucket] = true;
+  }
   return &bucket.buffers[index_within_bucket];
 }
 
@@ -1063,7 +1346,14 @@ inline bool TransposeDecoder::Decode(Context* context, uint64_t num_records,
   // was excluded in projection.
   int skipped_submessage_level = 0;
 
+  // Transition bytes are consumed directly from the buffer of
+  // transitions_reader, so that the hot loop does not pay the full ReadByte()
+  // bookkeeping for every state transition. The reader position is synced at
+  // buffer boundaries and before verifying the end.
   Reader* const transitions_reader = context->transitions.reader();
+  const char* transitions_cursor = transitions_reader->cursor();
+  const char* transitions_limit =
+      transitions_cursor + transitions_reader->available();
   // Stack of all open sub-messages.
   std::vector<SubmessageStackElement> submessage_stack;
   submessage_stack.reserve(16);
@@ -1244,10 +1534,18 @@ message_start:
 do_transition:
   node = node->next_node;
   if (num_iters == 0) {
-    uint8_t transition_byte;
-    if (ABSL_PREDICT_FALSE(!ReadByte(transitions_reader, &transition_byte))) {
-      goto done;
+    if (ABSL_PREDICT_FALSE(transitions_cursor == transitions_limit)) {
+      transitions_reader->set_cursor(transitions_cursor);
+      if (ABSL_PREDICT_FALSE(!transitions_reader->Pull())) {
+        transitions_cursor = transitions_reader->cursor();
+        transitions_limit = transitions_cursor;
+        goto done;
+      }
+      transitions_cursor = transitions_reader->cursor();
+      transitions_limit = transitions_cursor + transitions_reader->available();
     }
+    const uint8_t transition_byte =
+        static_cast<uint8_t>(*transitions_cursor++);
     node += (transition_byte >> 2);
     num_iters = transition_byte & 3;
     if (internal::IsImplicit(node->callback_type)) ++num_iters;
@@ -1258,6 +1556,7 @@ do_transition:
   }
 
 done:
+  transitions_reader->set_cursor(transitions_cursor);
   if (ABSL_PREDICT_FALSE(!context->transitions.VerifyEndAndClose())) {
     return Fail(context->transitions);
   }
@@ -1322,13 +1621,14 @@ ABSL_ATTRIBUTE_NOINLINE inline bool TransposeDecoder::SetCallbackType(
         }
         const absl::flat_hash_map<std::pair<uint32_t, uint32_t>,
                                   uint32_t>::const_iterator iter =
-            context->include_fields.find(std::make_pair(index, tag >> 3));
-        if (iter == context->include_fields.end()) {
+            context->projection->include_fields_.find(
+                std::make_pair(index, tag >> 3));
+        if (iter == context->projection->include_fields_.end()) {
           field_included = FieldIncluded::kNo;
           break;
         }
         index = iter->second;
-        if (!context->existence_only[index]) {
+        if (!context->projection->existence_only_[index]) {
           field_included = FieldIncluded::kYes;
           break;
         }
@@ -1352,12 +1652,13 @@ ABSL_ATTRIBUTE_NOINLINE inline bool TransposeDecoder::SetCallbackType(
       }
       const absl::flat_hash_map<std::pair<uint32_t, uint32_t>,
                                 uint32_t>::const_iterator iter =
-          context->include_fields.find(std::make_pair(index, tag >> 3));
-      if (iter == context->include_fields.end()) {
+          context->projection->include_fields_.find(
+              std::make_pair(index, tag >> 3));
+      if (iter == context->projection->include_fields_.end()) {
         field_included = FieldIncluded::kNo;
       } else {
         index = iter->second;
-        if (!context->existence_only[index]) {
+        if (!context->projection->existence_only_[index]) {
           field_included = FieldIncluded::kYes;
         }
       }
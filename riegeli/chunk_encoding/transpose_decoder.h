@@ -18,8 +18,12 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <memory>
+#include <string>
+#include <utility>
 #include <vector>
 
+#include "absl/container/flat_hash_map.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/backward_writer.h"
 #include "riegeli/bytes/chain_reader.h"
@@ -34,18 +38,66 @@ namespace internal {
 enum class CallbackType : uint8_t;
 }  // namespace internal
 
+// Precompiled form of a FieldProjection, usable by TransposeDecoder.
+//
+// Compiling the projection builds the tree of included fields. Doing this once
+// per reader and reusing the result across chunks avoids repeating the work
+// for every chunk.
+class CompiledFieldProjection {
+ public:
+  // Compiles a projection which includes all fields.
+  CompiledFieldProjection() noexcept {}
+
+  // Compiles the given projection.
+  explicit CompiledFieldProjection(const FieldProjection& field_projection);
+
+  // Returns true if all fields are included.
+  bool includes_all() const { return includes_all_; }
+
+ private:
+  friend class TransposeDecoder;
+
+  // We number included fields with indices into "existence_only_" below.
+  // Fields form a tree structure stored in "include_fields_". If "p" is the
+  // index of a parent submessage then "include_fields_[<p, f>]" is the index
+  // of the child with field number "f". The root index is assumed to be
+  // "numeric_limits<uint32_t>::max()".
+  absl::flat_hash_map<std::pair<uint32_t, uint32_t>, uint32_t> include_fields_;
+  // Are we interested in the existence of the field only?
+  std::vector<bool> existence_only_;
+  bool includes_all_ = true;
+};
+
 class TransposeDecoder : public Object {
  public:
-  TransposeDecoder() noexcept : Object(State::kClosed) {}
+  // Defined out of line because HeaderCache is incomplete here.
+  TransposeDecoder() noexcept;
 
   TransposeDecoder(const TransposeDecoder&) = delete;
   TransposeDecoder& operator=(const TransposeDecoder&) = delete;
 
+  TransposeDecoder(TransposeDecoder&& that) noexcept;
+  TransposeDecoder& operator=(TransposeDecoder&& that) noexcept;
+
+  ~TransposeDecoder();
+
   // Resets the TransposeDecoder and parses the chunk.
   //
+  // The parsed form of the chunk header is cached between calls: when
+  // consecutive chunks carry identical header bytes, which is the common case
+  // for chunks of one file, the state machine is reused instead of being built
+  // again.
+  //
   // Writes concatenated record values to *dest. Sets *limits to sorted record
   // end positions.
   //
+  // If "columnar" is true, the chunk was written as
+  // ChunkType::kTransposedColumnar and data buffers carry ColumnEncoding
+  // prefixes (see numeric_columns.h).
+  //
+  // If zstd_dictionary is not nullptr and the chunk is zstd compressed, the
+  // dictionary is used for decompression.
+  //
   // Precondition: dest->pos() == 0
   //
   // Return values:
@@ -53,8 +105,17 @@ class TransposeDecoder : public Object {
   //  * false - failure (!healthy());
   //            if !dest->healthy() then the problem was at dest
   bool Reset(Reader* src, uint64_t num_records, uint64_t decoded_data_size,
-             const FieldProjection& field_projection, BackwardWriter* dest,
-             std::vector<size_t>* limits);
+             bool columnar, const FieldProjection& field_projection,
+             BackwardWriter* dest, std::vector<size_t>* limits,
+             std::shared_ptr<const std::string> zstd_dictionary = nullptr);
+
+  // Like above, but uses a projection compiled up front. This avoids
+  // recompiling the projection when chunks are decoded repeatedly with the
+  // same projection.
+  bool Reset(Reader* src, uint64_t num_records, uint64_t decoded_data_size,
+             bool columnar, const CompiledFieldProjection& field_projection,
+             BackwardWriter* dest, std::vector<size_t>* limits,
+             std::shared_ptr<const std::string> zstd_dictionary = nullptr);
 
  private:
   // Information about one proto tag.
@@ -123,22 +184,34 @@ class TransposeDecoder : public Object {
                 "Unexpected padding in StateMachineNode.");
 
   struct Context;
+  struct HeaderCache;
 
   bool Parse(Context* context, Reader* src,
-             const FieldProjection& field_projection);
+             const CompiledFieldProjection& field_projection);
+
+  // Like Parse(), but reuses the state machine from "header_cache_"; only
+  // data buckets are read from "src".
+  //
+  // Precondition: the raw header bytes match "header_cache_".
+  bool ParseFromCache(Context* context, Reader* src);
 
   // Parse data buffers in "header_reader" and "reader" into
   // "context_->buffers". This method is used when projection is disabled and
-  // all buffers are initially decompressed.
-  bool ParseBuffers(Context* context, Reader* header_reader, Reader* src);
+  // all buffers are initially decompressed. If "header_reader" is nullptr,
+  // bucket and buffer lengths are taken from "*cache" instead of being
+  // parsed, otherwise they are recorded into "*cache".
+  bool ParseBuffers(Context* context, Reader* header_reader, Reader* src,
+                    HeaderCache* cache);
 
   // Parse data buffers in "header_reader" and "reader" into
   // "context_->data_buckets". When projection is enabled, buckets are
   // decompressed on demand. "bucket_indices" contains bucket index for each
   // buffer. "first_buffer_indices" contains the index of first buffer for each
-  // bucket.
+  // bucket. If "header_reader" is nullptr, bucket and buffer lengths are taken
+  // from "*cache" instead of being parsed, otherwise they are recorded into
+  // "*cache".
   bool ParseBuffersForFitering(Context* context, Reader* header_reader,
-                               Reader* src,
+                               Reader* src, HeaderCache* cache,
                                std::vector<uint32_t>* first_buffer_indices,
                                std::vector<uint32_t>* bucket_indices);
 
@@ -158,6 +231,10 @@ class TransposeDecoder : public Object {
       Context* context, int skipped_submessage_level,
       const std::vector<SubmessageStackElement>& submessage_stack,
       StateMachineNode* node);
+
+  // Parsed form of the most recent chunk header, reused when the next chunk
+  // carries identical header bytes.
+  std::unique_ptr<HeaderCache> header_cache_;
 };
 
 }  // namespace riegeli
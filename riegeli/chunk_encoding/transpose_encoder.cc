@@ -18,6 +18,8 @@
 #include <stdint.h>
 
 #include <algorithm>
+#include <deque>
+#include <future>
 #include <limits>
 #include <queue>
 #include <string>
@@ -27,11 +29,14 @@
 #include "absl/base/optimization.h"
 #include "absl/container/flat_hash_map.h"
 #include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
 #include "absl/types/optional.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/canonical_errors.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
+#include "riegeli/base/parallelism.h"
 #include "riegeli/bytes/backward_writer.h"
 #include "riegeli/bytes/backward_writer_utils.h"
 #include "riegeli/bytes/chain_backward_writer.h"
@@ -46,6 +51,8 @@
 #include "riegeli/chunk_encoding/compressor.h"
 #include "riegeli/chunk_encoding/compressor_options.h"
 #include "riegeli/chunk_encoding/constants.h"
+#include "riegeli/chunk_encoding/numeric_columns.h"
+#include "riegeli/chunk_encoding/string_columns.h"
 #include "riegeli/chunk_encoding/transpose_internal.h"
 
 namespace riegeli {
@@ -64,6 +71,71 @@ static_assert(kMaxVarintInline < 0x80,
 // deeper nesting are encoded as strings.
 constexpr int kMaxRecursionDepth = 100;
 
+// Maximum number of bucket compression results pending at a time. When this
+// many buckets are in flight, the encoder waits for the oldest one before
+// scheduling more, which bounds the memory held by uncompressed and compressed
+// buckets independently of the chunk size.
+constexpr size_t kMaxBucketsInFlight = 16;
+
+// Returns true if "projection" covers the field with the given path: one of
+// the paths of the projection is the path of the field or of a submessage
+// containing it. Paths are in the format of Analysis::Buffer::field_path.
+bool ProjectionCovers(
+    const TransposeEncoder::AccessProfile::Projection& projection,
+    absl::string_view field_path) {
+  for (const std::string& path : projection.field_paths) {
+    if (field_path == path ||
+        (field_path.size() > path.size() && field_path[path.size()] == '.' &&
+         field_path.substr(0, path.size()) == path)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Returns the columnar form of a data buffer: a ColumnEncoding byte followed
+// by the transformed or original buffer bytes. "column_encoding" is the
+// encoding to attempt; the buffer is stored raw if it is kRaw or if the
+// transformation would not make the buffer smaller.
+Chain EncodeColumn(internal::ColumnEncoding column_encoding, Chain data) {
+  if (data.empty()) return data;
+  if (column_encoding != internal::ColumnEncoding::kRaw) {
+    absl::string_view flat;
+    std::string scratch;
+    ChainReader<> data_reader(&data);
+    if (!data_reader.ReadAll(&flat, &scratch)) {
+      RIEGELI_ASSERT_UNREACHABLE()
+          << "Reading buffer failed: " << data_reader.status();
+    }
+    Chain encoded;
+    bool transformed = false;
+    switch (column_encoding) {
+      case internal::ColumnEncoding::kDeltaFixed32:
+        transformed = internal::DeltaEncodeFixed32(flat, &encoded);
+        break;
+      case internal::ColumnEncoding::kDeltaFixed64:
+        transformed = internal::DeltaEncodeFixed64(flat, &encoded);
+        break;
+      case internal::ColumnEncoding::kDeltaVarint:
+        transformed = internal::DeltaEncodeVarint(flat, &encoded);
+        break;
+      case internal::ColumnEncoding::kInternedStrings:
+        transformed = internal::InternEncodeStrings(flat, &encoded);
+        break;
+      default:
+        break;
+    }
+    if (transformed) {
+      const char tag = static_cast<char>(column_encoding);
+      encoded.Prepend(absl::string_view(&tag, 1));
+      return encoded;
+    }
+  }
+  const char tag = static_cast<char>(internal::ColumnEncoding::kRaw);
+  data.Prepend(absl::string_view(&tag, 1));
+  return data;
+}
+
 // Returns true if "record" is a valid protocol buffer message in the canonical
 // encoding. The purpose of this method is to distinguish string from a
 // submessage in the proto wire format and to perform validity checks that are
@@ -168,15 +240,17 @@ inline TransposeEncoder::EncodedTagInfo::EncodedTagInfo(
       public_list_noop_pos(kInvalidPos),
       base(kInvalidPos) {}
 
-inline TransposeEncoder::BufferWithMetadata::BufferWithMetadata(NodeId node_id)
-    : buffer(absl::make_unique<Chain>()), node_id(node_id) {}
+inline TransposeEncoder::BufferWithMetadata::BufferWithMetadata(
+    NodeId node_id, std::unique_ptr<Chain> buffer)
+    : buffer(std::move(buffer)), node_id(node_id) {}
 
 TransposeEncoder::TransposeEncoder(CompressorOptions options,
-                                   uint64_t bucket_size)
+                                   uint64_t bucket_size, bool columnar)
     : compressor_options_(std::move(options)),
       bucket_size_(options.compression_type() == CompressionType::kNone
                        ? std::numeric_limits<uint64_t>::max()
                        : bucket_size),
+      columnar_(columnar),
       nonproto_lengths_writer_(Chain()) {}
 
 TransposeEncoder::~TransposeEncoder() {}
@@ -185,9 +259,30 @@ void TransposeEncoder::Reset() {
   ChunkEncoder::Reset();
   tags_list_.clear();
   encoded_tags_.clear();
-  for (std::vector<BufferWithMetadata>& buffers : data_) buffers.clear();
+  // Keep the Chain objects of the buffers for reuse in the next chunk, so
+  // that per-chunk state is cleared rather than freed and reallocated.
+  for (std::vector<BufferWithMetadata>& buffers : data_) {
+    for (BufferWithMetadata& buffer : buffers) {
+      buffer.buffer->Clear();
+      buffer_pool_.push_back(std::move(buffer.buffer));
+    }
+    buffers.clear();
+  }
   group_stack_.clear();
+  // Similarly keep the writers of the buffers for reuse in the next chunk.
+  for (std::pair<const NodeId, MessageNode>& entry : message_nodes_) {
+    if (entry.second.writer != nullptr) {
+      writer_pool_.push_back(std::move(entry.second.writer));
+    }
+  }
+  // Erasing the elements one by one would mark their slots as deleted, which
+  // lengthens probe sequences of the per-field lookups in later chunks.
+  // clear() with reserve() instead makes a tombstone-free table sized from
+  // this chunk's node count, so similarly shaped chunks insert without
+  // rehashing.
+  const size_t num_message_nodes = message_nodes_.size();
   message_nodes_.clear();
+  message_nodes_.reserve(num_message_nodes);
   nonproto_lengths_writer_ = ChainBackwardWriter<Chain>(Chain());
   next_message_id_ = internal::MessageId::kRoot + 1;
 }
@@ -286,9 +381,22 @@ inline BackwardWriter* TransposeEncoder::GetBuffer(Node* node,
   if (!node->second.writer) {
     std::vector<BufferWithMetadata>& buffers =
         data_[static_cast<uint32_t>(type)];
-    buffers.emplace_back(node->first);
-    node->second.writer =
-        absl::make_unique<ChainBackwardWriter<>>(buffers.back().buffer.get());
+    std::unique_ptr<Chain> buffer;
+    if (buffer_pool_.empty()) {
+      buffer = absl::make_unique<Chain>();
+    } else {
+      buffer = std::move(buffer_pool_.back());
+      buffer_pool_.pop_back();
+    }
+    buffers.emplace_back(node->first, std::move(buffer));
+    if (writer_pool_.empty()) {
+      node->second.writer = absl::make_unique<ChainBackwardWriter<>>(
+          buffers.back().buffer.get());
+    } else {
+      node->second.writer = std::move(writer_pool_.back());
+      writer_pool_.pop_back();
+      *node->second.writer = ChainBackwardWriter<>(buffers.back().buffer.get());
+    }
   }
   return node->second.writer.get();
 }
@@ -448,29 +556,101 @@ inline bool TransposeEncoder::AddMessage(LimitingReaderBase* record,
   return true;
 }
 
+TransposeEncoder::CompressedBucket TransposeEncoder::CompressBucket(
+    const CompressorOptions& options, Chain bucket) {
+  CompressedBucket result;
+  CompressorOptions bucket_options = options;
+  if (options.compression_type() != CompressionType::kNone &&
+      internal::IsLikelyIncompressible(bucket)) {
+    // The bucket would not shrink (e.g. already compressed blobs or random
+    // ids); spend as little CPU on it as possible. The compression type is
+    // kept so that the format does not change: at the lowest level the codec
+    // stores such data in nearly raw blocks which are also cheap to decode.
+    switch (options.compression_type()) {
+      case CompressionType::kNone:
+        RIEGELI_ASSERT_UNREACHABLE() << "kNone excluded above";
+      case CompressionType::kBrotli:
+        bucket_options.set_brotli(CompressorOptions::kMinBrotli);
+        break;
+      case CompressionType::kZstd:
+        bucket_options.set_zstd(CompressorOptions::kMinZstd);
+        break;
+      case CompressionType::kSnappy:
+        // Snappy has no compression levels and is cheap already.
+        break;
+    }
+  }
+  internal::Compressor compressor(
+      bucket_options,
+      internal::Compressor::TuningOptions().set_final_size(bucket.size()));
+  if (ABSL_PREDICT_FALSE(!compressor.writer()->Write(std::move(bucket)))) {
+    result.error_message = std::string(compressor.status().message());
+    return result;
+  }
+  ChainWriter<> data_writer(&result.data);
+  if (ABSL_PREDICT_FALSE(!compressor.EncodeAndClose(&data_writer))) {
+    result.error_message = std::string(compressor.status().message());
+    return result;
+  }
+  if (ABSL_PREDICT_FALSE(!data_writer.Close())) {
+    result.error_message = std::string(data_writer.status().message());
+  }
+  return result;
+}
+
+void TransposeEncoder::ScheduleBucket(
+    const CompressorOptions& options, Chain bucket,
+    std::deque<std::future<CompressedBucket>>* bucket_futures) {
+  std::promise<CompressedBucket>* const bucket_promise =
+      new std::promise<CompressedBucket>();
+  bucket_futures->push_back(bucket_promise->get_future());
+  Chain* const bucket_data = new Chain(std::move(bucket));
+  CompressorOptions* const compressor_options = new CompressorOptions(options);
+  internal::ThreadPool::global_cpu().Schedule(
+      [bucket_promise, bucket_data, compressor_options] {
+        bucket_promise->set_value(
+            CompressBucket(*compressor_options, std::move(*bucket_data)));
+        delete compressor_options;
+        delete bucket_data;
+        delete bucket_promise;
+      });
+}
+
 inline bool TransposeEncoder::AddBuffer(
-    absl::optional<size_t> new_uncompressed_bucket_size, const Chain& buffer,
-    internal::Compressor* bucket_compressor, Writer* data_writer,
-    std::vector<size_t>* compressed_bucket_sizes,
-    std::vector<size_t>* buffer_sizes) {
+    bool start_new_bucket, Chain buffer, Chain* current_bucket,
+    std::deque<std::future<CompressedBucket>>* bucket_futures,
+    Writer* data_writer, std::vector<uint64_t>* compressed_bucket_sizes,
+    std::vector<uint64_t>* buffer_sizes) {
   buffer_sizes->push_back(buffer.size());
-  if (new_uncompressed_bucket_size.has_value()) {
-    if (bucket_compressor->writer()->pos() > 0) {
-      const Position pos_before = data_writer->pos();
-      if (ABSL_PREDICT_FALSE(!bucket_compressor->EncodeAndClose(data_writer))) {
-        return Fail(*bucket_compressor);
+  if (start_new_bucket && !current_bucket->empty()) {
+    ScheduleBucket(compressor_options_, std::move(*current_bucket),
+                   bucket_futures);
+    current_bucket->Clear();
+    while (bucket_futures->size() > kMaxBucketsInFlight) {
+      if (ABSL_PREDICT_FALSE(!WriteScheduledBucket(
+              bucket_futures, data_writer, compressed_bucket_sizes))) {
+        return false;
       }
-      RIEGELI_ASSERT_GE(data_writer->pos(), pos_before)
-          << "Data writer position decreased";
-      compressed_bucket_sizes->push_back(
-          IntCast<size_t>(data_writer->pos() - pos_before));
     }
-    bucket_compressor->Reset(
-        internal::Compressor::TuningOptions().set_final_size(
-            *new_uncompressed_bucket_size));
   }
-  if (ABSL_PREDICT_FALSE(!bucket_compressor->writer()->Write(buffer))) {
-    return Fail(*bucket_compressor);
+  current_bucket->Append(std::move(buffer));
+  return true;
+}
+
+inline bool TransposeEncoder::WriteScheduledBucket(
+    std::deque<std::future<CompressedBucket>>* bucket_futures,
+    Writer* data_writer, std::vector<uint64_t>* compressed_bucket_sizes) {
+  RIEGELI_ASSERT(!bucket_futures->empty())
+      << "Failed precondition of TransposeEncoder::WriteScheduledBucket(): "
+         "no buckets scheduled";
+  CompressedBucket bucket = bucket_futures->front().get();
+  bucket_futures->pop_front();
+  if (ABSL_PREDICT_FALSE(!bucket.error_message.empty())) {
+    return Fail(InternalError(bucket.error_message));
+  }
+  compressed_bucket_sizes->push_back(bucket.data.size());
+  if (ABSL_PREDICT_FALSE(!data_writer->Write(std::move(bucket.data)))) {
+    return Fail(*data_writer);
   }
   return true;
 }
@@ -478,6 +658,36 @@ inline bool TransposeEncoder::AddBuffer(
 inline bool TransposeEncoder::WriteBuffers(
     Writer* header_writer, Writer* data_writer,
     absl::flat_hash_map<NodeId, uint32_t>* buffer_pos) {
+  if (columnar_) {
+    // Replace buffer contents with their columnar form before sizes are used
+    // for bucketing, so that buffer lengths in the header refer to the
+    // encoded form.
+    for (size_t type_index = 0; type_index < kNumBufferTypes; ++type_index) {
+      internal::ColumnEncoding column_encoding = internal::ColumnEncoding::kRaw;
+      switch (static_cast<BufferType>(type_index)) {
+        case BufferType::kFixed32:
+          column_encoding = internal::ColumnEncoding::kDeltaFixed32;
+          break;
+        case BufferType::kFixed64:
+          column_encoding = internal::ColumnEncoding::kDeltaFixed64;
+          break;
+        case BufferType::kString:
+          // String buffers repeating a small set of values, e.g. enum-like
+          // labels, shrink considerably by interning.
+          column_encoding = internal::ColumnEncoding::kInternedStrings;
+          break;
+        default:
+          // Varint buffers have continuation bits stripped, with value
+          // boundaries encoded in node subtypes, hence they are not parseable
+          // in isolation and are stored raw.
+          break;
+      }
+      for (BufferWithMetadata& buffer : data_[type_index]) {
+        *buffer.buffer =
+            EncodeColumn(column_encoding, std::move(*buffer.buffer));
+      }
+    }
+  }
   size_t num_buffers = 0;
   for (std::vector<BufferWithMetadata>& buffers : data_) {
     // Sort buffers by length, smallest to largest.
@@ -494,27 +704,107 @@ inline bool TransposeEncoder::WriteBuffers(
         });
     num_buffers += buffers.size();
   }
-  const Chain& nonproto_lengths = nonproto_lengths_writer_.dest();
+  Chain nonproto_lengths = nonproto_lengths_writer_.dest();
+  if (columnar_) {
+    // nonproto_lengths is a sequence of varints, hence it can be delta
+    // encoded.
+    nonproto_lengths = EncodeColumn(internal::ColumnEncoding::kDeltaVarint,
+                                    std::move(nonproto_lengths));
+  }
   if (!nonproto_lengths.empty()) ++num_buffers;
 
-  std::vector<size_t> compressed_bucket_sizes;
-  std::vector<size_t> buffer_sizes;
+  std::vector<uint64_t> compressed_bucket_sizes;
+  std::vector<uint64_t> buffer_sizes;
   buffer_sizes.reserve(num_buffers);
 
-  internal::Compressor bucket_compressor(compressor_options_);
-  for (const std::vector<BufferWithMetadata>& buffers : data_) {
+  const bool use_access_profile =
+      access_profile_ != nullptr && !access_profile_->projections.empty();
+  // Maps the message ID of each node to its NodeId, for FieldPath().
+  absl::flat_hash_map<internal::MessageId, NodeId> submessage_nodes;
+  if (analysis_ != nullptr || use_access_profile) {
+    submessage_nodes.reserve(message_nodes_.size());
+    for (const Node& node : message_nodes_) {
+      submessage_nodes.emplace(node.second.message_id, node.first);
+    }
+  }
+  if (analysis_ != nullptr) {
+    analysis_->buffers.clear();
+    analysis_->buckets.clear();
+    analysis_->buffers.reserve(num_buffers);
+  }
+
+  // Bucket assignment packs consecutive buffers of a section into buckets,
+  // and each section starts a new bucket. By default each buffer type is a
+  // section, which groups similar buffers together hoping that this helps
+  // with compression context modeling. With an access profile the sections
+  // are the projection groups instead, ordered by decreasing weight, so that
+  // buffers which the dominant queries read together share buckets; buffers
+  // not covered by any projection form the last section.
+  std::vector<std::vector<BufferWithMetadata*>> sections;
+  if (use_access_profile) {
+    // The heaviest projection claims a buffer covered by multiple
+    // projections.
+    std::vector<size_t> projection_order(access_profile_->projections.size());
+    for (size_t i = 0; i < projection_order.size(); ++i) {
+      projection_order[i] = i;
+    }
+    std::stable_sort(projection_order.begin(), projection_order.end(),
+                     [this](size_t a, size_t b) {
+                       return access_profile_->projections[a].weight >
+                              access_profile_->projections[b].weight;
+                     });
+    sections.resize(access_profile_->projections.size() + 1);
+    for (std::vector<BufferWithMetadata>& buffers : data_) {
+      for (BufferWithMetadata& buffer : buffers) {
+        const std::string field_path =
+            FieldPath(buffer.node_id, submessage_nodes);
+        size_t section_index = access_profile_->projections.size();
+        for (size_t i = 0; i < projection_order.size(); ++i) {
+          if (ProjectionCovers(
+                  access_profile_->projections[projection_order[i]],
+                  field_path)) {
+            section_index = i;
+            break;
+          }
+        }
+        sections[section_index].push_back(&buffer);
+      }
+    }
+  } else {
+    sections.resize(kNumBufferTypes);
+    for (size_t type_index = 0; type_index < kNumBufferTypes; ++type_index) {
+      sections[type_index].reserve(data_[type_index].size());
+      for (BufferWithMetadata& buffer : data_[type_index]) {
+        sections[type_index].push_back(&buffer);
+      }
+    }
+  }
+  // Index of the bucket the next buffer will be assigned to, tracked in
+  // parallel with AddBuffer(): a new bucket materializes when a buffer with
+  // start_new_bucket is added to a non-empty bucket.
+  size_t analysis_bucket_index = 0;
+  bool analysis_bucket_nonempty = false;
+
+  // Buckets are compressed in background tasks as soon as they are complete,
+  // and written to data_writer in order as their results become available.
+  // Buffer data is moved into buckets, hence it is freed as soon as the bucket
+  // holding it is compressed; together with the bound on buckets in flight
+  // this keeps the memory used during encoding bounded by a few buckets.
+  Chain current_bucket;
+  std::deque<std::future<CompressedBucket>> bucket_futures;
+  for (std::vector<BufferWithMetadata*>& buffers : sections) {
     // Split data into buckets.
     size_t remaining_buffers_size = 0;
-    for (const BufferWithMetadata& buffer : buffers) {
-      remaining_buffers_size += buffer.buffer->size();
+    for (const BufferWithMetadata* buffer : buffers) {
+      remaining_buffers_size += buffer->buffer->size();
     }
 
     std::vector<size_t> uncompressed_bucket_sizes;
     size_t current_bucket_size = 0;
-    for (std::vector<BufferWithMetadata>::const_reverse_iterator iter =
+    for (std::vector<BufferWithMetadata*>::const_reverse_iterator iter =
              buffers.crbegin();
          iter != buffers.crend(); ++iter) {
-      const size_t current_buffer_size = iter->buffer->size();
+      const size_t current_buffer_size = (*iter)->buffer->size();
       if (current_bucket_size > 0 &&
           current_bucket_size + current_buffer_size / 2 >= bucket_size_) {
         uncompressed_bucket_sizes.push_back(current_bucket_size);
@@ -532,30 +822,44 @@ inline bool TransposeEncoder::WriteBuffers(
     }
 
     current_bucket_size = 0;
-    for (const BufferWithMetadata& buffer : buffers) {
-      absl::optional<size_t> new_uncompressed_bucket_size;
+    for (BufferWithMetadata* buffer : buffers) {
+      bool start_new_bucket = false;
       if (current_bucket_size == 0) {
         RIEGELI_ASSERT(!uncompressed_bucket_sizes.empty())
             << "Bucket sizes and buffer sizes do not match";
         current_bucket_size = uncompressed_bucket_sizes.back();
         uncompressed_bucket_sizes.pop_back();
-        new_uncompressed_bucket_size = current_bucket_size;
+        start_new_bucket = true;
       }
-      RIEGELI_ASSERT_GE(current_bucket_size, buffer.buffer->size())
+      RIEGELI_ASSERT_GE(current_bucket_size, buffer->buffer->size())
           << "Bucket sizes and buffer sizes do not match";
-      current_bucket_size -= buffer.buffer->size();
+      current_bucket_size -= buffer->buffer->size();
+      if (analysis_ != nullptr) {
+        if (start_new_bucket && analysis_bucket_nonempty) {
+          ++analysis_bucket_index;
+          analysis_bucket_nonempty = false;
+        }
+        analysis_->buffers.emplace_back();
+        Analysis::Buffer& analysis_buffer = analysis_->buffers.back();
+        analysis_buffer.field_path = FieldPath(buffer->node_id,
+                                               submessage_nodes);
+        analysis_buffer.size = buffer->buffer->size();
+        analysis_buffer.bucket_index = analysis_bucket_index;
+        if (!buffer->buffer->empty()) analysis_bucket_nonempty = true;
+      }
       if (ABSL_PREDICT_FALSE(!AddBuffer(
-              new_uncompressed_bucket_size, *buffer.buffer, &bucket_compressor,
-              data_writer, &compressed_bucket_sizes, &buffer_sizes))) {
+              start_new_bucket, std::move(*buffer->buffer), &current_bucket,
+              &bucket_futures, data_writer, &compressed_bucket_sizes,
+              &buffer_sizes))) {
         return false;
       }
       const std::pair<absl::flat_hash_map<NodeId, uint32_t>::iterator, bool>
           insert_result = buffer_pos->emplace(
-              buffer.node_id, IntCast<uint32_t>(buffer_pos->size()));
+              buffer->node_id, IntCast<uint32_t>(buffer_pos->size()));
       RIEGELI_ASSERT(insert_result.second)
           << "Field already has buffer assigned: "
-          << static_cast<uint32_t>(buffer.node_id.parent_message_id) << "/"
-          << buffer.node_id.tag;
+          << static_cast<uint32_t>(buffer->node_id.parent_message_id) << "/"
+          << buffer->node_id.tag;
     }
     RIEGELI_ASSERT(uncompressed_bucket_sizes.empty())
         << "Bucket sizes and buffer sizes do not match";
@@ -563,25 +867,64 @@ inline bool TransposeEncoder::WriteBuffers(
         << "Bucket sizes and buffer sizes do not match";
   }
   if (!nonproto_lengths.empty()) {
-    // nonproto_lengths is the last buffer if non-empty.
-    if (ABSL_PREDICT_FALSE(!AddBuffer(
-            nonproto_lengths.size(), nonproto_lengths, &bucket_compressor,
-            data_writer, &compressed_bucket_sizes, &buffer_sizes))) {
+    // nonproto_lengths is the last buffer if non-empty. It always starts a
+    // new bucket.
+    if (analysis_ != nullptr) {
+      if (analysis_bucket_nonempty) ++analysis_bucket_index;
+      analysis_->buffers.emplace_back();
+      Analysis::Buffer& analysis_buffer = analysis_->buffers.back();
+      analysis_buffer.field_path = "(non-proto)";
+      analysis_buffer.size = nonproto_lengths.size();
+      analysis_buffer.bucket_index = analysis_bucket_index;
+    }
+    if (ABSL_PREDICT_FALSE(!AddBuffer(true, std::move(nonproto_lengths),
+                                      &current_bucket, &bucket_futures,
+                                      data_writer, &compressed_bucket_sizes,
+                                      &buffer_sizes))) {
       return false;
     }
     // Note: nonproto_lengths needs no buffer_pos.
   }
 
-  if (bucket_compressor.writer()->pos() > 0) {
+  if (!current_bucket.empty()) {
     // Last bucket.
-    const Position pos_before = data_writer->pos();
-    if (ABSL_PREDICT_FALSE(!bucket_compressor.EncodeAndClose(data_writer))) {
-      return Fail(bucket_compressor);
+    ScheduleBucket(compressor_options_, std::move(current_bucket),
+                   &bucket_futures);
+  }
+
+  // Write the remaining compressed buckets to data_writer in order.
+  while (!bucket_futures.empty()) {
+    if (ABSL_PREDICT_FALSE(!WriteScheduledBucket(
+            &bucket_futures, data_writer, &compressed_bucket_sizes))) {
+      return false;
     }
-    RIEGELI_ASSERT_GE(data_writer->pos(), pos_before)
-        << "Data writer position decreased";
-    compressed_bucket_sizes.push_back(
-        IntCast<size_t>(data_writer->pos() - pos_before));
+  }
+
+  if (analysis_ != nullptr) {
+    analysis_->buckets.resize(compressed_bucket_sizes.size());
+    for (size_t i = 0; i < compressed_bucket_sizes.size(); ++i) {
+      analysis_->buckets[i].compressed_size =
+          IntCast<size_t>(compressed_bucket_sizes[i]);
+    }
+    for (const Analysis::Buffer& analysis_buffer : analysis_->buffers) {
+      RIEGELI_ASSERT_LT(analysis_buffer.bucket_index,
+                        analysis_->buckets.size())
+          << "Bucket index out of range in transpose analysis";
+      analysis_->buckets[analysis_buffer.bucket_index].uncompressed_size +=
+          analysis_buffer.size;
+    }
+  }
+
+  if (bucket_feedback_ != nullptr) {
+    uint64_t uncompressed_size = 0;
+    for (const uint64_t buffer_size : buffer_sizes) {
+      uncompressed_size += buffer_size;
+    }
+    uint64_t compressed_size = 0;
+    for (const uint64_t bucket_size : compressed_bucket_sizes) {
+      compressed_size += bucket_size;
+    }
+    bucket_feedback_(uncompressed_size, compressed_size);
   }
 
   if (ABSL_PREDICT_FALSE(!WriteVarint32(
@@ -590,19 +933,76 @@ inline bool TransposeEncoder::WriteBuffers(
           header_writer, IntCast<uint32_t>(buffer_sizes.size())))) {
     return Fail(*header_writer);
   }
-  for (const size_t length : compressed_bucket_sizes) {
-    if (ABSL_PREDICT_FALSE(
-            !WriteVarint64(header_writer, IntCast<uint64_t>(length)))) {
-      return Fail(*header_writer);
+  if (ABSL_PREDICT_FALSE(!WriteVarint64s(header_writer,
+                                         compressed_bucket_sizes.data(),
+                                         compressed_bucket_sizes.size())) ||
+      ABSL_PREDICT_FALSE(!WriteVarint64s(header_writer, buffer_sizes.data(),
+                                         buffer_sizes.size()))) {
+    return Fail(*header_writer);
+  }
+  return true;
+}
+
+void TransposeEncoder::RegisterUnique(
+    MemoryEstimator* memory_estimator) const {
+  memory_estimator->RegisterDynamicMemory(sizeof(*this));
+  // Hash maps inside tags_list_ entries and message_nodes_ are approximated
+  // by their element counts.
+  memory_estimator->RegisterMemory(tags_list_.capacity() *
+                                   sizeof(EncodedTagInfo));
+  for (const EncodedTagInfo& tag_info : tags_list_) {
+    memory_estimator->RegisterMemory(
+        tag_info.dest_info.size() *
+        sizeof(absl::flat_hash_map<uint32_t, DestInfo>::value_type));
+  }
+  memory_estimator->RegisterMemory(encoded_tags_.capacity() *
+                                   sizeof(uint32_t));
+  for (const std::vector<BufferWithMetadata>& buffers : data_) {
+    memory_estimator->RegisterMemory(buffers.capacity() *
+                                     sizeof(BufferWithMetadata));
+    for (const BufferWithMetadata& buffer : buffers) {
+      memory_estimator->RegisterDynamicMemory(sizeof(Chain));
+      buffer.buffer->RegisterSubobjects(memory_estimator);
     }
   }
-  for (const size_t length : buffer_sizes) {
-    if (ABSL_PREDICT_FALSE(
-            !WriteVarint64(header_writer, IntCast<uint64_t>(length)))) {
-      return Fail(*header_writer);
+  for (const std::unique_ptr<Chain>& buffer : buffer_pool_) {
+    memory_estimator->RegisterDynamicMemory(sizeof(Chain));
+    buffer->RegisterSubobjects(memory_estimator);
+  }
+  memory_estimator->RegisterMemory(group_stack_.capacity() *
+                                   sizeof(internal::MessageId));
+  memory_estimator->RegisterMemory(message_nodes_.size() * sizeof(Node));
+  nonproto_lengths_writer_.dest().RegisterSubobjects(memory_estimator);
+}
+
+std::string TransposeEncoder::FieldPath(
+    NodeId node_id,
+    const absl::flat_hash_map<internal::MessageId, NodeId>& submessage_nodes)
+    const {
+  // Collect field numbers from the field towards the root, then reverse.
+  std::vector<uint32_t> field_numbers;
+  for (;;) {
+    field_numbers.push_back(node_id.tag >> 3);
+    if (node_id.parent_message_id == internal::MessageId::kNonProto) {
+      return "(non-proto)";
     }
+    if (node_id.parent_message_id == internal::MessageId::kRoot) break;
+    const absl::flat_hash_map<internal::MessageId, NodeId>::const_iterator
+        iter = submessage_nodes.find(node_id.parent_message_id);
+    RIEGELI_ASSERT(iter != submessage_nodes.end())
+        << "Failed precondition of TransposeEncoder::FieldPath(): "
+           "missing parent node for message ID "
+        << static_cast<uint32_t>(node_id.parent_message_id);
+    node_id = iter->second;
   }
-  return true;
+  std::string field_path;
+  for (std::vector<uint32_t>::const_reverse_iterator iter =
+           field_numbers.crbegin();
+       iter != field_numbers.crend(); ++iter) {
+    if (!field_path.empty()) field_path += '.';
+    absl::StrAppend(&field_path, *iter);
+  }
+  return field_path;
 }
 
 inline bool TransposeEncoder::WriteStatesAndData(
@@ -1281,7 +1681,8 @@ constexpr uint32_t kMinCountForState = 10;
 bool TransposeEncoder::EncodeAndClose(Writer* dest, ChunkType* chunk_type,
                                       uint64_t* num_records,
                                       uint64_t* decoded_data_size) {
-  *chunk_type = ChunkType::kTransposed;
+  *chunk_type =
+      columnar_ ? ChunkType::kTransposedColumnar : ChunkType::kTransposed;
   return EncodeAndCloseInternal(kMaxTransition, kMinCountForState, dest,
                                 num_records, decoded_data_size);
 }
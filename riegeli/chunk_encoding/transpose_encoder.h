@@ -18,6 +18,9 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <deque>
+#include <functional>
+#include <future>
 #include <memory>
 #include <string>
 #include <utility>
@@ -26,14 +29,12 @@
 #include "absl/container/flat_hash_map.h"
 #include "absl/container/inlined_vector.h"
 #include "absl/strings/string_view.h"
-#include "absl/types/optional.h"
 #include "riegeli/base/chain.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/backward_writer.h"
 #include "riegeli/bytes/chain_backward_writer.h"
 #include "riegeli/bytes/writer.h"
 #include "riegeli/chunk_encoding/chunk_encoder.h"
-#include "riegeli/chunk_encoding/compressor.h"
 #include "riegeli/chunk_encoding/compressor_options.h"
 #include "riegeli/chunk_encoding/constants.h"
 #include "riegeli/chunk_encoding/transpose_internal.h"
@@ -41,6 +42,7 @@
 namespace riegeli {
 
 class LimitingReaderBase;
+class MemoryEstimator;
 class Reader;
 
 // Format (values are varint encoded unless indicated otherwise):
@@ -65,10 +67,22 @@ class Reader;
 //      - Concatenated data buffers in this bucket (bytes)
 //  - Transitions (possibly compressed):
 //    - State machine transitions (bytes)
+//
+// In columnar mode the chunk type is ChunkType::kTransposedColumnar and each
+// non-empty data buffer is prefixed with a ColumnEncoding byte; buffers of
+// fixed width numeric fields, and the buffer of lengths of non-proto records,
+// are delta encoded when this makes them smaller (see numeric_columns.h).
+// Buffer lengths in the header refer to the encoded form.
 class TransposeEncoder : public ChunkEncoder {
  public:
   // Creates an empty TransposeEncoder.
-  explicit TransposeEncoder(CompressorOptions options, uint64_t bucket_size);
+  //
+  // If "columnar" is true, numeric field columns are delta encoded before
+  // compression, which helps with chunks dominated by timestamps, counters,
+  // and other slowly varying numeric fields. Such chunks use
+  // ChunkType::kTransposedColumnar.
+  explicit TransposeEncoder(CompressorOptions options, uint64_t bucket_size,
+                            bool columnar = false);
 
   ~TransposeEncoder();
 
@@ -89,6 +103,84 @@ class TransposeEncoder : public ChunkEncoder {
                       uint64_t* num_records,
                       uint64_t* decoded_data_size) override;
 
+  void RegisterUnique(MemoryEstimator* memory_estimator) const override;
+
+  // Report of how EncodeAndClose() laid out field data into buckets. Intended
+  // for offline analysis tools which tune transposition and bucket_size for a
+  // dataset; see set_analysis().
+  struct Analysis {
+    struct Buffer {
+      // Path of proto field numbers from the root message to the field,
+      // e.g. "3.1", or "(non-proto)" for the buffer of lengths of non-proto
+      // records.
+      std::string field_path;
+      // Size of the buffer (uncompressed, after columnar encoding if
+      // applicable), in bytes.
+      size_t size = 0;
+      // Index of the bucket the buffer was assigned to.
+      size_t bucket_index = 0;
+    };
+    struct Bucket {
+      // Total size of the buffers in the bucket, in bytes.
+      size_t uncompressed_size = 0;
+      // Size of the bucket as written to the chunk, in bytes.
+      size_t compressed_size = 0;
+    };
+    // Buffers in the order they were written, i.e. by buffer index.
+    std::vector<Buffer> buffers;
+    // Buckets in the order they were written, i.e. by bucket index.
+    std::vector<Bucket> buckets;
+  };
+
+  // If "analysis" is not nullptr, EncodeAndClose() fills *analysis with the
+  // layout of field data. Collecting the analysis materializes field path
+  // strings, hence it is meant for analysis tools rather than for production
+  // encoding.
+  //
+  // *analysis must be valid until EncodeAndClose() returns. Not owned.
+  void set_analysis(Analysis* analysis) { analysis_ = analysis; }
+
+  // A hint describing which fields the dominant readers of the dataset
+  // project together. See set_access_profile().
+  struct AccessProfile {
+    struct Projection {
+      // Paths of proto field numbers from the root message to the projected
+      // fields, in the format of Analysis::Buffer::field_path, e.g. "3.1".
+      // A path covers the field together with its whole subtree.
+      std::vector<std::string> field_paths;
+      // Relative importance of the projection, e.g. its observed query
+      // frequency.
+      double weight = 1.0;
+    };
+    std::vector<Projection> projections;
+  };
+
+  // If "access_profile" is not nullptr, buffers of fields which a projection
+  // reads together are grouped into the same buckets, ordered by decreasing
+  // projection weight (a buffer covered by multiple projections goes with the
+  // heaviest one), with fields not covered by any projection bucketed last.
+  // Queries matching the profile then decompress fewer buckets. This replaces
+  // the default grouping of buffers by buffer type, which may worsen
+  // compression density. Like collecting an Analysis, matching the profile
+  // materializes field path strings.
+  //
+  // *access_profile must be valid until EncodeAndClose() returns. Not owned.
+  void set_access_profile(const AccessProfile* access_profile) {
+    access_profile_ = access_profile;
+  }
+
+  // If "bucket_feedback" is not nullptr, EncodeAndClose() calls it with the
+  // total uncompressed and compressed sizes of the data buckets of this
+  // chunk. Unlike collecting an Analysis this is cheap enough for production
+  // encoding; it is meant for adapting the bucket size of subsequent chunks
+  // to the achieved compression ratio, see
+  // RecordWriterBase::Options::set_adaptive_bucket_fraction().
+  void set_bucket_feedback(
+      std::function<void(uint64_t uncompressed_size, uint64_t compressed_size)>
+          bucket_feedback) {
+    bucket_feedback_ = std::move(bucket_feedback);
+  }
+
  private:
   bool AddRecordInternal(Reader* record);
 
@@ -124,7 +216,7 @@ class TransposeEncoder : public ChunkEncoder {
     explicit MessageNode(internal::MessageId message_id);
     // Some nodes (such as STARTGROUP) contain no data. Buffer is assigned in
     // the first GetBuffer call when we have data to write.
-    std::unique_ptr<BackwardWriter> writer;
+    std::unique_ptr<ChainBackwardWriter<>> writer;
     // Unique ID for every instance of this class within Encoder.
     internal::MessageId message_id;
     // Position of encoded tag in "tags_list_" per subtype.
@@ -158,11 +250,21 @@ class TransposeEncoder : public ChunkEncoder {
                   internal::MessageId parent_message_id, int depth);
 
   // Write all buffer lengths to "header_writer" and data buffers in "data_" to
-  // "data_writer" (compressed using compressor_). Fill map with the sequential
+  // "data_writer" (split into buckets compressed in background tasks, with a
+  // bounded number of buckets in flight). Fill map with the sequential
   // position of each buffer written.
   bool WriteBuffers(Writer* header_writer, Writer* data_writer,
                     absl::flat_hash_map<NodeId, uint32_t>* buffer_pos);
 
+  // Returns the path of proto field numbers from the root message to the
+  // field identified by "node_id", e.g. "3.1", for Analysis reports.
+  // "submessage_nodes" maps the message ID of each node to its NodeId, to
+  // walk from a field towards the root.
+  std::string FieldPath(
+      NodeId node_id,
+      const absl::flat_hash_map<internal::MessageId, NodeId>& submessage_nodes)
+      const;
+
   // One state of the state machine created in encoder.
   struct StateInfo {
     StateInfo();
@@ -180,14 +282,41 @@ class TransposeEncoder : public ChunkEncoder {
     uint32_t canonical_source;
   };
 
-  // Add `buffer` to `bucket_compressor->writer()`.
-  // If `new_uncompressed_bucket_size` is not `absl::nullopt`, flush the current
-  // bucket to `data_writer` first and create a new bucket of that size.
-  bool AddBuffer(absl::optional<size_t> new_uncompressed_bucket_size,
-                 const Chain& buffer, internal::Compressor* bucket_compressor,
+  // Result of compressing one bucket in a background task.
+  struct CompressedBucket {
+    Chain data;
+    // If compression failed, a human-readable message, otherwise empty.
+    std::string error_message;
+  };
+
+  // Compresses the data of one bucket. Does not refer to the TransposeEncoder
+  // so that it can run in a background task.
+  static CompressedBucket CompressBucket(const CompressorOptions& options,
+                                         Chain bucket);
+
+  // Schedules compression of bucket as a background task, appending the
+  // future result to *bucket_futures.
+  static void ScheduleBucket(
+      const CompressorOptions& options, Chain bucket,
+      std::deque<std::future<CompressedBucket>>* bucket_futures);
+
+  // Add `buffer` to `*current_bucket`, taking over its data.
+  // If `start_new_bucket` is `true`, schedule compression of the current
+  // bucket first and start a new bucket; if too many buckets are in flight,
+  // wait for the oldest one and write it to `data_writer`.
+  bool AddBuffer(bool start_new_bucket, Chain buffer, Chain* current_bucket,
+                 std::deque<std::future<CompressedBucket>>* bucket_futures,
                  Writer* data_writer,
-                 std::vector<size_t>* compressed_bucket_sizes,
-                 std::vector<size_t>* buffer_sizes);
+                 std::vector<uint64_t>* compressed_bucket_sizes,
+                 std::vector<uint64_t>* buffer_sizes);
+
+  // Writes the result of the oldest scheduled bucket to `data_writer`,
+  // recording its compressed size.
+  //
+  // Precondition: !bucket_futures->empty()
+  bool WriteScheduledBucket(
+      std::deque<std::future<CompressedBucket>>* bucket_futures,
+      Writer* data_writer, std::vector<uint64_t>* compressed_bucket_sizes);
 
   // Compute base indices for states in "state_machine" that don't have one yet.
   // "public_list_base" is the index of the start of the public list.
@@ -267,7 +396,7 @@ class TransposeEncoder : public ChunkEncoder {
 
   // Information about the data buffer.
   struct BufferWithMetadata {
-    explicit BufferWithMetadata(NodeId node_id);
+    explicit BufferWithMetadata(NodeId node_id, std::unique_ptr<Chain> buffer);
     // Buffer itself, wrapped in unique_ptr so that its address remains constant
     // when additional buffers are added.
     std::unique_ptr<Chain> buffer;
@@ -280,6 +409,8 @@ class TransposeEncoder : public ChunkEncoder {
   // Finer bucket granularity (i.e. smaller size) worsens compression density
   // but makes field projection more effective.
   uint64_t bucket_size_;
+  // Whether numeric field columns are delta encoded before compression.
+  bool columnar_;
 
   // List of all distinct Encoded tags.
   std::vector<EncodedTagInfo> tags_list_;
@@ -287,6 +418,12 @@ class TransposeEncoder : public ChunkEncoder {
   std::vector<uint32_t> encoded_tags_;
   // Data buffers in separate vectors per buffer type.
   std::vector<BufferWithMetadata> data_[kNumBufferTypes];
+  // Cleared buffers from previous chunks, kept for reuse by GetBuffer() so
+  // that per-chunk state is cleared rather than freed between chunks.
+  std::vector<std::unique_ptr<Chain>> buffer_pool_;
+  // Writers from previous chunks, kept for reuse by GetBuffer() so that a
+  // buffer gets its ChainBackwardWriter without a new allocation.
+  std::vector<std::unique_ptr<ChainBackwardWriter<>>> writer_pool_;
   // Every group creates a new message ID. We keep track of open groups in this
   // vector.
   std::vector<internal::MessageId> group_stack_;
@@ -295,6 +432,13 @@ class TransposeEncoder : public ChunkEncoder {
   ChainBackwardWriter<Chain> nonproto_lengths_writer_;
   // Counter used to assign unique IDs to the message nodes.
   internal::MessageId next_message_id_ = internal::MessageId::kRoot + 1;
+  // See set_analysis(). Survives Reset().
+  Analysis* analysis_ = nullptr;
+  // See set_access_profile(). Survives Reset().
+  const AccessProfile* access_profile_ = nullptr;
+  // See set_bucket_feedback(). Survives Reset().
+  std::function<void(uint64_t uncompressed_size, uint64_t compressed_size)>
+      bucket_feedback_;
 };
 
 }  // namespace riegeli
@@ -17,7 +17,6 @@
 
 #include <stdint.h>
 
-#include "riegeli/base/base.h"
 #include "riegeli/bytes/writer_utils.h"
 
 namespace riegeli {
@@ -89,48 +88,64 @@ inline uint8_t operator-(Subtype a, Subtype b) {
   return static_cast<uint8_t>(a) - static_cast<uint8_t>(b);
 }
 
+// Properties of a tag as a function of its wire type. The wire type occupies
+// the 3 lowest bits of a tag, so the properties are precomputed at compile
+// time into a table indexed by tag & 7, and the decoding loop indexes the
+// table instead of branching on the wire type.
+enum TagFlags : uint8_t {
+  // The wire type is valid in a proto tag.
+  kTagWireTypeValid = 1 << 0,
+  // The tag is followed by a subtype byte (kVarint).
+  //
+  // A kLengthDelimited tag is not followed by subtype, even though
+  // kLengthDelimited nodes have subtypes, because submessage start is encoded
+  // as kReservedIdStartOfSubmessage, and submessage end is encoded with
+  // WireType::kSubmessage that is taken into account before consulting the
+  // table.
+  kTagHasSubtype = 1 << 1,
+  // The value always has a data buffer (kFixed32, kFixed64).
+  kTagAlwaysHasDataBuffer = 1 << 2,
+  // The value has a data buffer unless the subtype inlines it (kVarint).
+  kTagVarintDataBuffer = 1 << 3,
+  // The value has a data buffer if the subtype is a string, as opposed to a
+  // submessage boundary (kLengthDelimited).
+  kTagStringDataBuffer = 1 << 4,
+};
+
+constexpr uint8_t kTagFlags[8] = {
+    // kVarint
+    kTagWireTypeValid | kTagHasSubtype | kTagVarintDataBuffer,
+    // kFixed64
+    kTagWireTypeValid | kTagAlwaysHasDataBuffer,
+    // kLengthDelimited
+    kTagWireTypeValid | kTagStringDataBuffer,
+    // kStartGroup
+    kTagWireTypeValid,
+    // kEndGroup
+    kTagWireTypeValid,
+    // kFixed32
+    kTagWireTypeValid | kTagAlwaysHasDataBuffer,
+    // kSubmessage (never encoded in a tag)
+    0,
+    // 7 (invalid)
+    0,
+};
+
 // Returns whether "tag"/"subtype" pair has a data buffer.
 // Precondition: "tag" is a valid proto tag.
 inline bool HasDataBuffer(uint32_t tag, Subtype subtype) {
-  switch (static_cast<WireType>(tag & 7)) {
-    case WireType::kVarint:
-      // Protocol buffer has buffer if value is not inlined.
-      return subtype < Subtype::kVarintInline0;
-    case WireType::kFixed32:
-    case WireType::kFixed64:
-      return true;
-    case WireType::kLengthDelimited:
-      // If subtype is kLengthDelimitedStartOfSubmessage or
-      // kLengthDelimitedEndOfSubmessage we have no buffer.
-      return subtype == Subtype::kLengthDelimitedString;
-    case WireType::kStartGroup:
-    case WireType::kEndGroup:
-      return false;
-    default:
-      RIEGELI_ASSERT_UNREACHABLE() << "Unknown wire type in " << tag;
-  }
+  const uint8_t flags = kTagFlags[tag & 7];
+  return (flags & kTagAlwaysHasDataBuffer) != 0 ||
+         ((flags & kTagVarintDataBuffer) != 0 &&
+          subtype < Subtype::kVarintInline0) ||
+         ((flags & kTagStringDataBuffer) != 0 &&
+          subtype == Subtype::kLengthDelimitedString);
 }
 
 // Returns true if this tag is followed by subtype.
 // Precondition: "tag" is a valid proto tag.
 inline bool HasSubtype(uint32_t tag) {
-  switch (static_cast<WireType>(tag & 7)) {
-    case WireType::kVarint:
-      return true;
-      // A kLengthDelimited tag is not followed by subtype, even though
-      // kLengthDelimited nodes have subtypes, because submessage start is
-      // encoded as kReservedIdStartOfSubmessage, and submessage end is encoded
-      // with WireType::kSubmessage that is taken into account before calling
-      // this method.
-    case WireType::kFixed32:
-    case WireType::kFixed64:
-    case WireType::kLengthDelimited:
-    case WireType::kStartGroup:
-    case WireType::kEndGroup:
-      return false;
-    default:
-      RIEGELI_ASSERT_UNREACHABLE() << "Unknown wire type in " << tag;
-  }
+  return (kTagFlags[tag & 7] & kTagHasSubtype) != 0;
 }
 
 }  // namespace internal
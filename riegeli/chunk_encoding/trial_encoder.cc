@@ -0,0 +1,212 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/chunk_encoding/trial_encoder.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <future>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "google/protobuf/message_lite.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/canonical_errors.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
+#include "riegeli/base/parallelism.h"
+#include "riegeli/base/status.h"
+#include "riegeli/bytes/chain_writer.h"
+#include "riegeli/bytes/message_serialize.h"
+#include "riegeli/chunk_encoding/constants.h"
+
+namespace riegeli {
+
+void TrialEncoder::Reset() {
+  ChunkEncoder::Reset();
+  candidates_[0]->Reset();
+  candidates_[1]->Reset();
+  records_writer_ = ChainWriter<Chain>(Chain());
+  limits_.clear();
+}
+
+bool TrialEncoder::AddRecord(const google::protobuf::MessageLite& record) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  const size_t size = record.ByteSizeLong();
+  if (ABSL_PREDICT_FALSE(num_records_ ==
+                         UnsignedMin(limits_.max_size(), kMaxNumRecords))) {
+    return Fail(ResourceExhaustedError("Too many records"));
+  }
+  if (ABSL_PREDICT_FALSE(size > std::numeric_limits<uint64_t>::max() -
+                                    decoded_data_size_)) {
+    return Fail(ResourceExhaustedError("Decoded data size too large"));
+  }
+  ++num_records_;
+  decoded_data_size_ += IntCast<uint64_t>(size);
+  Status serialize_status = SerializeToWriter<>(record, &records_writer_);
+  if (ABSL_PREDICT_FALSE(!serialize_status.ok())) {
+    return Fail(std::move(serialize_status));
+  }
+  limits_.push_back(IntCast<size_t>(records_writer_.pos()));
+  return true;
+}
+
+bool TrialEncoder::AddRecord(absl::string_view record) {
+  return AddRecordImpl(record);
+}
+
+bool TrialEncoder::AddRecord(std::string&& record) {
+  return AddRecordImpl(std::move(record));
+}
+
+bool TrialEncoder::AddRecord(const Chain& record) {
+  return AddRecordImpl(record);
+}
+
+bool TrialEncoder::AddRecord(Chain&& record) {
+  return AddRecordImpl(std::move(record));
+}
+
+template <typename Record>
+bool TrialEncoder::AddRecordImpl(Record&& record) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  if (ABSL_PREDICT_FALSE(num_records_ ==
+                         UnsignedMin(limits_.max_size(), kMaxNumRecords))) {
+    return Fail(ResourceExhaustedError("Too many records"));
+  }
+  if (ABSL_PREDICT_FALSE(record.size() > std::numeric_limits<uint64_t>::max() -
+                                             decoded_data_size_)) {
+    return Fail(ResourceExhaustedError("Decoded data size too large"));
+  }
+  ++num_records_;
+  decoded_data_size_ += IntCast<uint64_t>(record.size());
+  if (ABSL_PREDICT_FALSE(
+          !records_writer_.Write(std::forward<Record>(record)))) {
+    return Fail(records_writer_);
+  }
+  limits_.push_back(IntCast<size_t>(records_writer_.pos()));
+  return true;
+}
+
+bool TrialEncoder::AddRecords(Chain records, std::vector<size_t> limits) {
+  RIEGELI_ASSERT_EQ(limits.empty() ? 0u : limits.back(), records.size())
+      << "Failed precondition of ChunkEncoder::AddRecords(): "
+         "record end positions do not match concatenated record values";
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  if (ABSL_PREDICT_FALSE(limits.size() >
+                         UnsignedMin(limits_.max_size(), kMaxNumRecords) -
+                             num_records_)) {
+    return Fail(ResourceExhaustedError("Too many records"));
+  }
+  num_records_ += IntCast<uint64_t>(limits.size());
+  decoded_data_size_ += IntCast<uint64_t>(records.size());
+  if (ABSL_PREDICT_FALSE(!records_writer_.Write(std::move(records)))) {
+    return Fail(records_writer_);
+  }
+  if (limits_.empty()) {
+    limits_ = std::move(limits);
+  } else {
+    const size_t base = limits_.back();
+    for (size_t& limit : limits) limit += base;
+    limits_.insert(limits_.cend(), limits.begin(), limits.end());
+  }
+  return true;
+}
+
+TrialEncoder::Encoded TrialEncoder::EncodeCandidate(
+    ChunkEncoder* candidate, Chain records, std::vector<size_t> limits) {
+  Encoded encoded;
+  const absl::Time before = absl::Now();
+  ChainWriter<> data_writer(&encoded.data);
+  encoded.ok =
+      candidate->AddRecords(std::move(records), std::move(limits)) &&
+      candidate->EncodeAndClose(&data_writer, &encoded.chunk_type,
+                                &encoded.num_records,
+                                &encoded.decoded_data_size) &&
+      data_writer.Close();
+  encoded.encoding_time = absl::Now() - before;
+  return encoded;
+}
+
+bool TrialEncoder::EncodeAndClose(Writer* dest, ChunkType* chunk_type,
+                                  uint64_t* num_records,
+                                  uint64_t* decoded_data_size) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  if (ABSL_PREDICT_FALSE(!records_writer_.Close())) {
+    return Fail(records_writer_);
+  }
+  Chain records = std::move(records_writer_.dest());
+  std::vector<size_t> limits = std::move(limits_);
+  // Encode with candidate 1 in a background task while candidate 0 is encoded
+  // here. Copying the Chain shares its blocks.
+  std::promise<Encoded>* const encoded1_promise = new std::promise<Encoded>();
+  std::future<Encoded> encoded1_future = encoded1_promise->get_future();
+  ChunkEncoder* const candidate1 = candidates_[1].get();
+  Chain* const records1 = new Chain(records);
+  std::vector<size_t>* const limits1 = new std::vector<size_t>(limits);
+  internal::ThreadPool::global_cpu().Schedule(
+      [encoded1_promise, candidate1, records1, limits1] {
+        encoded1_promise->set_value(EncodeCandidate(
+            candidate1, std::move(*records1), std::move(*limits1)));
+        delete limits1;
+        delete records1;
+        delete encoded1_promise;
+      });
+  Encoded encoded0 = EncodeCandidate(candidates_[0].get(), std::move(records),
+                                     std::move(limits));
+  Encoded encoded1 = encoded1_future.get();
+  if (ABSL_PREDICT_FALSE(!encoded0.ok)) {
+    Fail(*candidates_[0]);
+  } else if (ABSL_PREDICT_FALSE(!encoded1.ok)) {
+    Fail(*candidates_[1]);
+  } else {
+    const size_t larger =
+        UnsignedMax(encoded0.data.size(), encoded1.data.size());
+    const size_t smaller =
+        UnsignedMin(encoded0.data.size(), encoded1.data.size());
+    size_t winner;
+    if (larger - smaller >= larger / 16) {
+      winner = encoded0.data.size() <= encoded1.data.size() ? 0 : 1;
+    } else {
+      winner = encoded0.encoding_time <= encoded1.encoding_time ? 0 : 1;
+    }
+    Encoded& encoded = winner == 0 ? encoded0 : encoded1;
+    *chunk_type = encoded.chunk_type;
+    *num_records = encoded.num_records;
+    *decoded_data_size = encoded.decoded_data_size;
+    if (ABSL_PREDICT_FALSE(!dest->Write(std::move(encoded.data)))) {
+      Fail(*dest);
+    } else if (chosen_ != nullptr) {
+      chosen_(winner);
+    }
+  }
+  return Close();
+}
+
+void TrialEncoder::RegisterUnique(MemoryEstimator* memory_estimator) const {
+  memory_estimator->RegisterDynamicMemory(sizeof(*this));
+  records_writer_.dest().RegisterSubobjects(memory_estimator);
+  memory_estimator->RegisterMemory(limits_.capacity() * sizeof(size_t));
+  candidates_[0]->RegisterUnique(memory_estimator);
+  candidates_[1]->RegisterUnique(memory_estimator);
+}
+
+}  // namespace riegeli
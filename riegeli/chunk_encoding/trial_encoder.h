@@ -0,0 +1,116 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_CHUNK_ENCODING_TRIAL_ENCODER_H_
+#define RIEGELI_CHUNK_ENCODING_TRIAL_ENCODER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "google/protobuf/message_lite.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/bytes/chain_writer.h"
+#include "riegeli/bytes/writer.h"
+#include "riegeli/chunk_encoding/chunk_encoder.h"
+#include "riegeli/chunk_encoding/constants.h"
+
+namespace riegeli {
+
+// TrialEncoder buffers records like DeferredEncoder, and in EncodeAndClose()
+// encodes them with two candidate encoders, one of them on a background
+// thread, writing the result of the winning candidate. Record values are
+// shared between the candidates, not copied.
+//
+// The candidate with the smaller encoded chunk wins. If the sizes are within
+// 1/16 of each other, the difference is unlikely to matter, and the candidate
+// which encoded faster wins instead.
+//
+// The caller learns the winner from the chosen callback and can construct the
+// winning encoder directly for subsequent chunks, ending the trial.
+class TrialEncoder : public ChunkEncoder {
+ public:
+  // Will encode records with *candidate0 and *candidate1. If chosen != nullptr,
+  // EncodeAndClose() calls chosen(index of the winning candidate) after the
+  // winning chunk is written.
+  explicit TrialEncoder(std::unique_ptr<ChunkEncoder> candidate0,
+                        std::unique_ptr<ChunkEncoder> candidate1,
+                        std::function<void(size_t)> chosen = nullptr);
+
+  void Reset() override;
+
+  using ChunkEncoder::AddRecord;
+  bool AddRecord(const google::protobuf::MessageLite& record) override;
+  bool AddRecord(absl::string_view record) override;
+  bool AddRecord(std::string&& record) override;
+  bool AddRecord(const Chain& record) override;
+  bool AddRecord(Chain&& record) override;
+
+  bool AddRecords(Chain records, std::vector<size_t> limits) override;
+
+  bool EncodeAndClose(Writer* dest, ChunkType* chunk_type,
+                      uint64_t* num_records,
+                      uint64_t* decoded_data_size) override;
+
+  void RegisterUnique(MemoryEstimator* memory_estimator) const override;
+
+ private:
+  // The encoded chunk of one candidate.
+  struct Encoded {
+    Chain data;
+    ChunkType chunk_type = ChunkType::kSimple;
+    uint64_t num_records = 0;
+    uint64_t decoded_data_size = 0;
+    absl::Duration encoding_time;
+    // If false, the candidate failed.
+    bool ok = false;
+  };
+
+  template <typename Record>
+  bool AddRecordImpl(Record&& record);
+
+  // Encodes the records with *candidate. Static so that a background task does
+  // not refer to the TrialEncoder.
+  static Encoded EncodeCandidate(ChunkEncoder* candidate, Chain records,
+                                 std::vector<size_t> limits);
+
+  std::unique_ptr<ChunkEncoder> candidates_[2];
+  std::function<void(size_t)> chosen_;
+  // Writer of concatenated record values buffered so far.
+  ChainWriter<Chain> records_writer_;
+  // Sorted record end positions.
+  std::vector<size_t> limits_;
+
+  // Invariant: records_writer_.pos() == (limits_.empty() ? 0 : limits_.back())
+};
+
+// Implementation details follow.
+
+inline TrialEncoder::TrialEncoder(std::unique_ptr<ChunkEncoder> candidate0,
+                                  std::unique_ptr<ChunkEncoder> candidate1,
+                                  std::function<void(size_t)> chosen)
+    : candidates_{std::move(candidate0), std::move(candidate1)},
+      chosen_(std::move(chosen)),
+      records_writer_(Chain()) {}
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_CHUNK_ENCODING_TRIAL_ENCODER_H_
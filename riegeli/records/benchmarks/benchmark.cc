@@ -32,6 +32,7 @@
 #include <iostream>
 #include <limits>
 #include <memory>
+#include <random>
 #include <sstream>
 #include <string>
 #include <utility>
@@ -41,6 +42,7 @@
 #include "absl/strings/numbers.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_format.h"
+#include "absl/strings/string_view.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/errno_mapping.h"
 #include "riegeli/base/options_parser.h"
@@ -48,10 +50,12 @@
 #include "riegeli/bytes/fd_reader.h"
 #include "riegeli/bytes/fd_writer.h"
 #include "riegeli/bytes/writer_utils.h"
-#include "riegeli/records/benchmarks/tfrecord_recognizer.h"
+#include "riegeli/chunk_encoding/compressor_options.h"
 #include "riegeli/records/chunk_reader.h"
+#include "riegeli/records/record_position.h"
 #include "riegeli/records/record_reader.h"
 #include "riegeli/records/record_writer.h"
+#include "riegeli/tensorflow/io/tfrecord_recognizer.h"
 #include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/lib/io/compression.h"
@@ -88,6 +92,7 @@ class Stats {
   void Add(double value);
 
   double Median();
+  double Percentile(double fraction);
 
  private:
   std::vector<double> samples_;
@@ -102,13 +107,64 @@ double Stats::Median() {
   return samples_[middle];
 }
 
+double Stats::Percentile(double fraction) {
+  RIEGELI_CHECK(!samples_.empty()) << "No data";
+  const size_t index = riegeli::UnsignedMin(
+      static_cast<size_t>(fraction * static_cast<double>(samples_.size())),
+      samples_.size() - 1);
+  std::nth_element(samples_.begin(), samples_.begin() + index, samples_.end());
+  return samples_[index];
+}
+
+// Samples record indices either uniformly or with a Zipf distribution
+// (exponent 1), which skews accesses towards a hot subset of the records.
+class IndexSampler {
+ public:
+  explicit IndexSampler(size_t size, bool zipfian);
+
+  size_t Next();
+
+ private:
+  // Deterministically seeded so that runs are repeatable.
+  std::mt19937_64 rng_{42};
+  std::uniform_real_distribution<double> uniform_{0.0, 1.0};
+  size_t size_;
+  std::vector<double> cdf_;  // Empty for the uniform distribution.
+};
+
+IndexSampler::IndexSampler(size_t size, bool zipfian) : size_(size) {
+  RIEGELI_CHECK_GT(size, 0u) << "No records to sample";
+  if (zipfian) {
+    cdf_.reserve(size);
+    double sum = 0.0;
+    for (size_t i = 0; i < size; ++i) {
+      sum += 1.0 / static_cast<double>(i + 1);
+      cdf_.push_back(sum);
+    }
+    for (double& value : cdf_) value /= sum;
+  }
+}
+
+size_t IndexSampler::Next() {
+  const double value = uniform_(rng_);
+  if (cdf_.empty()) {
+    return riegeli::UnsignedMin(
+        static_cast<size_t>(value * static_cast<double>(size_)), size_ - 1);
+  }
+  return riegeli::IntCast<size_t>(
+      std::lower_bound(cdf_.begin(), cdf_.end(), value) - cdf_.begin());
+}
+
 class Benchmarks {
  public:
+  enum class OutputFormat { kText, kCsv, kJson };
+
   static bool ReadFile(const std::string& filename,
                        std::vector<std::string>* records, size_t* max_size);
 
   explicit Benchmarks(std::vector<std::string> records, std::string output_dir,
-                      int repetitions);
+                      int repetitions, int warmups, OutputFormat output_format,
+                      int random_access, bool zipfian, bool codec_sweep);
 
   void RegisterTFRecord(std::string tfrecord_options);
   void RegisterRiegeli(std::string riegeli_options);
@@ -141,16 +197,45 @@ class Benchmarks {
       std::function<void(const std::string&, std::vector<std::string>*)>
           read_records);
 
+  void RunAllRandomAccess();
+  void RunOneRandomAccess(
+      const std::string& name,
+      const riegeli::RecordWriterBase::Options& record_writer_options);
+
+  // Result of one codec/level combination in the codec sweep. Lower
+  // compression_ratio and higher speeds are better.
+  struct CodecResult {
+    std::string name;
+    double compression_ratio;   // Percent of the original size.
+    double encoding_cpu_speed;  // MB/s.
+    double decoding_cpu_speed;  // MB/s.
+  };
+
+  // Returns true if a is no worse than b in all three metrics and strictly
+  // better in at least one.
+  static bool ParetoDominates(const CodecResult& a, const CodecResult& b);
+
+  void RunCodecSweep();
+  CodecResult RunOneCodec(
+      const std::string& name,
+      const riegeli::RecordWriterBase::Options& record_writer_options);
+
   static std::string Filename(std::string name);
 
   std::vector<std::string> records_;
   size_t original_size_;
   std::string output_dir_;
   int repetitions_;
+  int warmups_;
+  OutputFormat output_format_;
+  int random_access_;
+  bool zipfian_;
+  bool codec_sweep_;
   std::vector<std::pair<std::string, const char*>> tfrecord_benchmarks_;
   std::vector<std::pair<std::string, riegeli::RecordWriterBase::Options>>
       riegeli_benchmarks_;
   int max_name_width_ = 0;
+  bool first_result_ = true;
 };
 
 bool Benchmarks::ReadFile(const std::string& filename,
@@ -283,11 +368,18 @@ std::string Benchmarks::Filename(std::string name) {
 }
 
 Benchmarks::Benchmarks(std::vector<std::string> records, std::string output_dir,
-                       int repetitions)
+                       int repetitions, int warmups,
+                       OutputFormat output_format, int random_access,
+                       bool zipfian, bool codec_sweep)
     : records_(std::move(records)),
       original_size_(0),
       output_dir_(std::move(output_dir)),
-      repetitions_(repetitions) {
+      repetitions_(repetitions),
+      warmups_(warmups),
+      output_format_(output_format),
+      random_access_(random_access),
+      zipfian_(zipfian),
+      codec_sweep_(codec_sweep) {
   for (const std::string& record : records_) {
     original_size_ += riegeli::LengthVarint64(record.size()) + record.size();
   }
@@ -326,14 +418,34 @@ void Benchmarks::RegisterRiegeli(std::string riegeli_options) {
 }
 
 void Benchmarks::RunAll() {
-  absl::PrintF("Original uncompressed size: %.3f MB\n",
-               static_cast<double>(original_size_) / 1000000.0);
-  absl::PrintF("Creating files %s/record_benchmark_*\n", output_dir_);
-  absl::PrintF("%-*s  Compr.    Write       Read\n", max_name_width_, "");
-  absl::PrintF("%-*s  ratio    CPU Real   CPU Real\n", max_name_width_, "");
-  absl::PrintF("%-*s    %%     MB/s MB/s  MB/s MB/s\n", max_name_width_,
-               "Format");
-  absl::PrintF("%s\n", std::string(max_name_width_ + 30, '-'));
+  if (codec_sweep_) {
+    RunCodecSweep();
+    return;
+  }
+  if (random_access_ > 0) {
+    RunAllRandomAccess();
+    return;
+  }
+  switch (output_format_) {
+    case OutputFormat::kText:
+      absl::PrintF("Original uncompressed size: %.3f MB\n",
+                   static_cast<double>(original_size_) / 1000000.0);
+      absl::PrintF("Creating files %s/record_benchmark_*\n", output_dir_);
+      absl::PrintF("%-*s  Compr.    Write       Read\n", max_name_width_, "");
+      absl::PrintF("%-*s  ratio    CPU Real   CPU Real\n", max_name_width_, "");
+      absl::PrintF("%-*s    %%     MB/s MB/s  MB/s MB/s\n", max_name_width_,
+                   "Format");
+      absl::PrintF("%s\n", std::string(max_name_width_ + 30, '-'));
+      break;
+    case OutputFormat::kCsv:
+      absl::PrintF(
+          "format,compression_ratio_percent,write_cpu_mbps,write_real_mbps,"
+          "read_cpu_mbps,read_real_mbps\n");
+      break;
+    case OutputFormat::kJson:
+      absl::PrintF("[");
+      break;
+  }
 
   for (const std::pair<std::string, const char*>& tfrecord_options :
        tfrecord_benchmarks_) {
@@ -368,6 +480,7 @@ void Benchmarks::RunAll() {
                              records);
         });
   }
+  if (output_format_ == OutputFormat::kJson) absl::PrintF("\n]\n");
 }
 
 void Benchmarks::RunOne(
@@ -384,13 +497,13 @@ void Benchmarks::RunOne(
   Stats writing_real_speed;
   Stats reading_cpu_speed;
   Stats reading_real_speed;
-  for (int i = 0; i < repetitions_ + 1; ++i) {
+  for (int i = 0; i < warmups_ + repetitions_; ++i) {
     const uint64_t cpu_time_before_ns = CpuTimeNow_ns();
     const uint64_t real_time_before_ns = RealTimeNow_ns();
     write_records(filename, records_);
     const uint64_t cpu_time_after_ns = CpuTimeNow_ns();
     const uint64_t real_time_after_ns = RealTimeNow_ns();
-    if (i == 0) {
+    if (i < warmups_) {
       // Warm-up.
     } else {
       compression.Add(static_cast<double>(FileSize(filename)) /
@@ -404,7 +517,7 @@ void Benchmarks::RunOne(
           1000.0);
     }
   }
-  for (int i = 0; i < repetitions_ + 1; ++i) {
+  for (int i = 0; i < warmups_ + repetitions_; ++i) {
     std::vector<std::string> decoded_records;
     const uint64_t cpu_time_before_ns = CpuTimeNow_ns();
     const uint64_t real_time_before_ns = RealTimeNow_ns();
@@ -412,9 +525,12 @@ void Benchmarks::RunOne(
     const uint64_t cpu_time_after_ns = CpuTimeNow_ns();
     const uint64_t real_time_after_ns = RealTimeNow_ns();
     if (i == 0) {
-      // Warm-up and correctness check.
+      // Correctness check, outside of the measured region.
       RIEGELI_CHECK(decoded_records == records_)
           << "Decoded records do not match for " << name;
+    }
+    if (i < warmups_) {
+      // Warm-up.
     } else {
       reading_cpu_speed.Add(
           static_cast<double>(original_size_) /
@@ -426,16 +542,364 @@ void Benchmarks::RunOne(
     }
   }
 
-  absl::PrintF("%-*s %7.3f", max_name_width_, name, compression.Median());
-  for (const std::array<Stats*, 2>& stats_cpu_real :
-       {std::array<Stats*, 2>{{&writing_cpu_speed, &writing_real_speed}},
-        std::array<Stats*, 2>{{&reading_cpu_speed, &reading_real_speed}}}) {
-    absl::PrintF(" ");
-    for (Stats* const stats : stats_cpu_real) {
-      absl::PrintF(" %4.0f", stats->Median());
+  switch (output_format_) {
+    case OutputFormat::kText:
+      absl::PrintF("%-*s %7.3f", max_name_width_, name, compression.Median());
+      for (const std::array<Stats*, 2>& stats_cpu_real :
+           {std::array<Stats*, 2>{{&writing_cpu_speed, &writing_real_speed}},
+            std::array<Stats*, 2>{{&reading_cpu_speed, &reading_real_speed}}}) {
+        absl::PrintF(" ");
+        for (Stats* const stats : stats_cpu_real) {
+          absl::PrintF(" %4.0f", stats->Median());
+        }
+      }
+      std::cout << std::endl;
+      break;
+    case OutputFormat::kCsv:
+      absl::PrintF("\"%s\",%.3f,%.1f,%.1f,%.1f,%.1f\n", name,
+                   compression.Median(), writing_cpu_speed.Median(),
+                   writing_real_speed.Median(), reading_cpu_speed.Median(),
+                   reading_real_speed.Median());
+      break;
+    case OutputFormat::kJson:
+      absl::PrintF(
+          "%s\n"
+          "  {\"format\": \"%s\", \"compression_ratio_percent\": %.3f,\n"
+          "   \"write_cpu_mbps\": %.1f, \"write_real_mbps\": %.1f,\n"
+          "   \"read_cpu_mbps\": %.1f, \"read_real_mbps\": %.1f}",
+          first_result_ ? "" : ",", name, compression.Median(),
+          writing_cpu_speed.Median(), writing_real_speed.Median(),
+          reading_cpu_speed.Median(), reading_real_speed.Median());
+      first_result_ = false;
+      break;
+  }
+}
+
+void Benchmarks::RunAllRandomAccess() {
+  switch (output_format_) {
+    case OutputFormat::kText:
+      absl::PrintF("Original uncompressed size: %.3f MB\n",
+                   static_cast<double>(original_size_) / 1000000.0);
+      absl::PrintF("Creating files %s/record_benchmark_*\n", output_dir_);
+      absl::PrintF("Random access: %d samples per benchmark, %s record "
+                   "indices\n",
+                   random_access_, zipfian_ ? "zipfian" : "uniform");
+      absl::PrintF("%-*s    Seek latency (us)     Search latency (us)\n",
+                   max_name_width_, "");
+      absl::PrintF("%-*s    p50    p90    p99     p50    p90    p99\n",
+                   max_name_width_, "Format");
+      absl::PrintF("%s\n", std::string(max_name_width_ + 46, '-'));
+      break;
+    case OutputFormat::kCsv:
+      absl::PrintF(
+          "format,seek_p50_us,seek_p90_us,seek_p99_us,search_p50_us,"
+          "search_p90_us,search_p99_us\n");
+      break;
+    case OutputFormat::kJson:
+      absl::PrintF("[");
+      break;
+  }
+
+  for (const std::pair<std::string, riegeli::RecordWriterBase::Options>&
+           riegeli_options : riegeli_benchmarks_) {
+    RunOneRandomAccess(absl::StrCat("riegeli ", riegeli_options.first),
+                       riegeli_options.second);
+  }
+  if (output_format_ == OutputFormat::kJson) absl::PrintF("\n]\n");
+}
+
+void Benchmarks::RunOneRandomAccess(
+    const std::string& name,
+    const riegeli::RecordWriterBase::Options& record_writer_options) {
+  const std::string filename =
+      absl::StrCat(output_dir_, "/record_benchmark_", Filename(name));
+  WriteRiegeli(filename, record_writer_options, records_);
+
+  riegeli::RecordReader<riegeli::FdReader<>> record_reader(
+      riegeli::FdReader<>(filename, O_RDONLY));
+  std::vector<riegeli::RecordPosition> positions;
+  positions.reserve(records_.size());
+  std::string record;
+  for (;;) {
+    const riegeli::RecordPosition pos = record_reader.pos();
+    if (!record_reader.ReadRecord(&record)) break;
+    positions.push_back(pos);
+  }
+  RIEGELI_CHECK(record_reader.healthy()) << record_reader.status();
+  RIEGELI_CHECK(!positions.empty()) << "No records to sample";
+  const riegeli::RecordPosition first_pos = positions.front();
+
+  IndexSampler samples(positions.size(), zipfian_);
+  Stats seek_latency;
+  for (int i = 0; i < random_access_; ++i) {
+    const riegeli::RecordPosition target = positions[samples.Next()];
+    const uint64_t real_time_before_ns = RealTimeNow_ns();
+    RIEGELI_CHECK(record_reader.Seek(target)) << record_reader.status();
+    RIEGELI_CHECK(record_reader.ReadRecord(&record)) << record_reader.status();
+    seek_latency.Add(
+        static_cast<double>(RealTimeNow_ns() - real_time_before_ns) / 1000.0);
+  }
+  Stats search_latency;
+  for (int i = 0; i < random_access_; ++i) {
+    const riegeli::RecordPosition target = positions[samples.Next()];
+    // Search() scans from the current position; rewinding is not measured.
+    RIEGELI_CHECK(record_reader.Seek(first_pos)) << record_reader.status();
+    const uint64_t real_time_before_ns = RealTimeNow_ns();
+    bool found;
+    RIEGELI_CHECK(record_reader.Search(
+        [&](int* compare) {
+          const riegeli::RecordPosition pos = record_reader.pos();
+          *compare = pos < target ? -1 : pos > target ? 1 : 0;
+          return true;
+        },
+        &found))
+        << record_reader.status();
+    RIEGELI_CHECK(found) << "Record not found by Search() for " << name;
+    search_latency.Add(
+        static_cast<double>(RealTimeNow_ns() - real_time_before_ns) / 1000.0);
+  }
+  RIEGELI_CHECK(record_reader.Close()) << record_reader.status();
+
+  switch (output_format_) {
+    case OutputFormat::kText:
+      absl::PrintF("%-*s %6.1f %6.1f %6.1f  %6.1f %6.1f %6.1f\n",
+                   max_name_width_, name, seek_latency.Percentile(0.5),
+                   seek_latency.Percentile(0.9), seek_latency.Percentile(0.99),
+                   search_latency.Percentile(0.5),
+                   search_latency.Percentile(0.9),
+                   search_latency.Percentile(0.99));
+      break;
+    case OutputFormat::kCsv:
+      absl::PrintF("\"%s\",%.1f,%.1f,%.1f,%.1f,%.1f,%.1f\n", name,
+                   seek_latency.Percentile(0.5), seek_latency.Percentile(0.9),
+                   seek_latency.Percentile(0.99),
+                   search_latency.Percentile(0.5),
+                   search_latency.Percentile(0.9),
+                   search_latency.Percentile(0.99));
+      break;
+    case OutputFormat::kJson:
+      absl::PrintF(
+          "%s\n"
+          "  {\"format\": \"%s\",\n"
+          "   \"seek_p50_us\": %.1f, \"seek_p90_us\": %.1f, "
+          "\"seek_p99_us\": %.1f,\n"
+          "   \"search_p50_us\": %.1f, \"search_p90_us\": %.1f, "
+          "\"search_p99_us\": %.1f}",
+          first_result_ ? "" : ",", name, seek_latency.Percentile(0.5),
+          seek_latency.Percentile(0.9), seek_latency.Percentile(0.99),
+          search_latency.Percentile(0.5), search_latency.Percentile(0.9),
+          search_latency.Percentile(0.99));
+      first_result_ = false;
+      break;
+  }
+}
+
+bool Benchmarks::ParetoDominates(const CodecResult& a, const CodecResult& b) {
+  return a.compression_ratio <= b.compression_ratio &&
+         a.encoding_cpu_speed >= b.encoding_cpu_speed &&
+         a.decoding_cpu_speed >= b.decoding_cpu_speed &&
+         (a.compression_ratio < b.compression_ratio ||
+          a.encoding_cpu_speed > b.encoding_cpu_speed ||
+          a.decoding_cpu_speed > b.decoding_cpu_speed);
+}
+
+Benchmarks::CodecResult Benchmarks::RunOneCodec(
+    const std::string& name,
+    const riegeli::RecordWriterBase::Options& record_writer_options) {
+  const std::string filename =
+      absl::StrCat(output_dir_, "/record_benchmark_", Filename(name));
+
+  Stats compression;
+  Stats encoding_cpu_speed;
+  Stats decoding_cpu_speed;
+  for (int i = 0; i < warmups_ + repetitions_; ++i) {
+    const uint64_t cpu_time_before_ns = CpuTimeNow_ns();
+    WriteRiegeli(filename, record_writer_options, records_);
+    const uint64_t cpu_time_after_ns = CpuTimeNow_ns();
+    if (i < warmups_) {
+      // Warm-up.
+    } else {
+      compression.Add(static_cast<double>(FileSize(filename)) /
+                      static_cast<double>(original_size_) * 100.0);
+      encoding_cpu_speed.Add(
+          static_cast<double>(original_size_) /
+          static_cast<double>(cpu_time_after_ns - cpu_time_before_ns) * 1000.0);
+    }
+  }
+  for (int i = 0; i < warmups_ + repetitions_; ++i) {
+    std::vector<std::string> decoded_records;
+    const uint64_t cpu_time_before_ns = CpuTimeNow_ns();
+    ReadRiegeli(filename, riegeli::RecordReaderBase::Options(),
+                &decoded_records);
+    const uint64_t cpu_time_after_ns = CpuTimeNow_ns();
+    if (i == 0) {
+      // Correctness check, outside of the measured region.
+      RIEGELI_CHECK(decoded_records == records_)
+          << "Decoded records do not match for " << name;
     }
+    if (i < warmups_) {
+      // Warm-up.
+    } else {
+      decoding_cpu_speed.Add(
+          static_cast<double>(original_size_) /
+          static_cast<double>(cpu_time_after_ns - cpu_time_before_ns) * 1000.0);
+    }
+  }
+  return CodecResult{name, compression.Median(), encoding_cpu_speed.Median(),
+                     decoding_cpu_speed.Median()};
+}
+
+void Benchmarks::RunCodecSweep() {
+  // Negative zstd levels trade compression for speed with diminishing
+  // returns, and snappy already covers that end of the spectrum, hence the
+  // sweep starts at zstd level 1 (level 0 is an alias of the default level).
+  std::vector<std::string> option_strings;
+  option_strings.push_back("uncompressed");
+  option_strings.push_back("snappy");
+  for (int level = riegeli::CompressorOptions::kMinBrotli;
+       level <= riegeli::CompressorOptions::kMaxBrotli; ++level) {
+    option_strings.push_back(absl::StrCat("brotli:", level));
+  }
+  for (int level = 1; level <= riegeli::CompressorOptions::kMaxZstd; ++level) {
+    option_strings.push_back(absl::StrCat("zstd:", level));
+  }
+
+  int name_width = 0;
+  for (const std::string& option_string : option_strings) {
+    name_width =
+        std::max(name_width, riegeli::IntCast<int>(option_string.size()));
+  }
+
+  switch (output_format_) {
+    case OutputFormat::kText:
+      absl::PrintF("Original uncompressed size: %.3f MB\n",
+                   static_cast<double>(original_size_) / 1000000.0);
+      absl::PrintF("Creating files %s/record_benchmark_*\n", output_dir_);
+      absl::PrintF("%-*s  Compr.  Encode  Decode\n", name_width, "");
+      absl::PrintF("%-*s  ratio     CPU     CPU\n", name_width, "");
+      absl::PrintF("%-*s    %%      MB/s    MB/s\n", name_width, "Codec");
+      absl::PrintF("%s\n", std::string(name_width + 32, '-'));
+      break;
+    case OutputFormat::kCsv:
+      absl::PrintF(
+          "codec,compression_ratio_percent,encode_cpu_mbps,decode_cpu_mbps,"
+          "pareto_optimal\n");
+      break;
+    case OutputFormat::kJson:
+      absl::PrintF("[");
+      break;
+  }
+
+  std::vector<CodecResult> results;
+  results.reserve(option_strings.size());
+  for (const std::string& option_string : option_strings) {
+    riegeli::RecordWriterBase::Options record_writer_options;
+    RIEGELI_CHECK_EQ(record_writer_options.FromString(option_string),
+                     riegeli::OkStatus());
+    results.push_back(RunOneCodec(option_string, record_writer_options));
+    const CodecResult& result = results.back();
+    if (output_format_ == OutputFormat::kText) {
+      absl::PrintF("%-*s %7.3f %7.0f %7.0f\n", name_width, result.name,
+                   result.compression_ratio, result.encoding_cpu_speed,
+                   result.decoding_cpu_speed);
+    }
+  }
+
+  std::vector<bool> pareto_optimal(results.size());
+  for (size_t i = 0; i < results.size(); ++i) {
+    pareto_optimal[i] = true;
+    for (size_t j = 0; j < results.size(); ++j) {
+      if (j != i && ParetoDominates(results[j], results[i])) {
+        pareto_optimal[i] = false;
+        break;
+      }
+    }
+  }
+
+  switch (output_format_) {
+    case OutputFormat::kText:
+      break;
+    case OutputFormat::kCsv:
+      for (size_t i = 0; i < results.size(); ++i) {
+        absl::PrintF("\"%s\",%.3f,%.1f,%.1f,%d\n", results[i].name,
+                     results[i].compression_ratio,
+                     results[i].encoding_cpu_speed,
+                     results[i].decoding_cpu_speed,
+                     pareto_optimal[i] ? 1 : 0);
+      }
+      return;
+    case OutputFormat::kJson:
+      for (size_t i = 0; i < results.size(); ++i) {
+        absl::PrintF(
+            "%s\n"
+            "  {\"codec\": \"%s\", \"compression_ratio_percent\": %.3f,\n"
+            "   \"encode_cpu_mbps\": %.1f, \"decode_cpu_mbps\": %.1f,\n"
+            "   \"pareto_optimal\": %s}",
+            i == 0 ? "" : ",", results[i].name, results[i].compression_ratio,
+            results[i].encoding_cpu_speed, results[i].decoding_cpu_speed,
+            pareto_optimal[i] ? "true" : "false");
+      }
+      absl::PrintF("\n]\n");
+      return;
+  }
+
+  // The remaining combinations are not dominated in all three metrics at
+  // once by any other combination.
+  std::cout << std::endl;
+  std::cout << "Pareto-optimal:";
+  for (size_t i = 0; i < results.size(); ++i) {
+    if (pareto_optimal[i]) std::cout << " " << results[i].name;
   }
   std::cout << std::endl;
+
+  double worst_ratio = results.front().compression_ratio;
+  double best_ratio = results.front().compression_ratio;
+  double worst_encode = results.front().encoding_cpu_speed;
+  double best_encode = results.front().encoding_cpu_speed;
+  double worst_decode = results.front().decoding_cpu_speed;
+  double best_decode = results.front().decoding_cpu_speed;
+  for (const CodecResult& result : results) {
+    worst_ratio = std::max(worst_ratio, result.compression_ratio);
+    best_ratio = std::min(best_ratio, result.compression_ratio);
+    worst_encode = std::min(worst_encode, result.encoding_cpu_speed);
+    best_encode = std::max(best_encode, result.encoding_cpu_speed);
+    worst_decode = std::min(worst_decode, result.decoding_cpu_speed);
+    best_decode = std::max(best_decode, result.decoding_cpu_speed);
+  }
+  // Each metric is normalized to [0, 1] with 1 meaning the best observed
+  // value; the balanced recommendation is the Pareto-optimal combination
+  // with the highest sum of normalized scores.
+  const auto normalized = [](double value, double worst, double best) {
+    return best == worst ? 1.0 : (value - worst) / (best - worst);
+  };
+  size_t smallest = results.size();
+  size_t fastest = results.size();
+  size_t balanced = results.size();
+  double balanced_score = -1.0;
+  for (size_t i = 0; i < results.size(); ++i) {
+    if (!pareto_optimal[i]) continue;
+    if (smallest == results.size() ||
+        results[i].compression_ratio < results[smallest].compression_ratio) {
+      smallest = i;
+    }
+    if (fastest == results.size() ||
+        results[i].encoding_cpu_speed > results[fastest].encoding_cpu_speed) {
+      fastest = i;
+    }
+    const double score =
+        normalized(results[i].compression_ratio, worst_ratio, best_ratio) +
+        normalized(results[i].encoding_cpu_speed, worst_encode, best_encode) +
+        normalized(results[i].decoding_cpu_speed, worst_decode, best_decode);
+    if (score > balanced_score) {
+      balanced_score = score;
+      balanced = i;
+    }
+  }
+  std::cout << "Recommended (smallest): " << results[smallest].name
+            << std::endl;
+  std::cout << "Recommended (fastest): " << results[fastest].name << std::endl;
+  std::cout << "Recommended (balanced): " << results[balanced].name
+            << std::endl;
 }
 
 const char kUsage[] =
@@ -448,13 +912,37 @@ const char kUsage[] =
     "      Whitespace-separated TFRecord RecordWriter/RecordReader options\n"
     "  --riegeli_benchmarks=BENCHMARKS\n"
     "      Whitespace-separated Riegeli RecordWriter options\n"
+    "  --riegeli_sweep=SPEC\n"
+    "      Cross product of Riegeli RecordWriter options: dimensions are\n"
+    "      separated by ';', alternatives within a dimension by whitespace,\n"
+    "      and one alternative from each dimension is joined with ','. E.g.\n"
+    "      'uncompressed brotli:6 zstd:9;parallelism:0 parallelism:10;\n"
+    "      chunk_size:64K chunk_size:1M;bucket_fraction:0.3 ...'. Replaces\n"
+    "      the default --riegeli_benchmarks\n"
     "  --max_size=BYTES\n"
     "      Maximum size of records to read, in bytes, default 10000000\n"
     "  --output_dir=DIR\n"
     "      Directory to write files to (files are named record_benchmark_*),\n"
     "      default /tmp\n"
     "  --repetitions=N\n"
-    "      Number of times to repeat each benchmark, default 5";
+    "      Number of measured runs of each benchmark, default 5\n"
+    "  --warmups=N\n"
+    "      Number of unmeasured warm-up runs of each benchmark, default 1\n"
+    "  --output_format=FORMAT\n"
+    "      text, csv, or json, default text\n"
+    "  --random_access=N\n"
+    "      Measure random access latency (N samples of Seek() and Search()\n"
+    "      each) instead of sequential transfer. Riegeli benchmarks only,\n"
+    "      default 0 (sequential transfer)\n"
+    "  --distribution=DISTRIBUTION\n"
+    "      Distribution of record indices for --random_access: uniform or\n"
+    "      zipfian, default uniform\n"
+    "  --codec_sweep\n"
+    "      Re-encode the records through every codec/level combination\n"
+    "      (uncompressed, snappy, all brotli levels, zstd levels from 1 up),\n"
+    "      reporting size and encode/decode CPU speed per combination, the\n"
+    "      Pareto-optimal combinations, and recommendations. Replaces the\n"
+    "      other benchmarks";
 
 const struct option kOptions[] = {
     {"help", no_argument, nullptr, 0},
@@ -463,6 +951,12 @@ const struct option kOptions[] = {
     {"max_size", required_argument, nullptr, 3},
     {"output_dir", required_argument, nullptr, 4},
     {"repetitions", required_argument, nullptr, 5},
+    {"riegeli_sweep", required_argument, nullptr, 6},
+    {"warmups", required_argument, nullptr, 7},
+    {"output_format", required_argument, nullptr, 8},
+    {"random_access", required_argument, nullptr, 9},
+    {"distribution", required_argument, nullptr, 10},
+    {"codec_sweep", no_argument, nullptr, 11},
     {nullptr, 0, nullptr, 0}};
 
 template <typename Function>
@@ -472,6 +966,34 @@ void ForEachWord(const std::string& words, Function f) {
   while (in >> word) f(std::move(word));
 }
 
+// Expands a sweep specification into RecordWriter option strings: the cross
+// product which picks one alternative from each dimension and joins them with
+// commas.
+std::vector<std::string> ExpandSweep(const std::string& sweep_spec) {
+  std::vector<std::string> options(1, std::string());
+  std::stringstream in(sweep_spec);
+  std::string dimension;
+  while (std::getline(in, dimension, ';')) {
+    std::vector<std::string> alternatives;
+    ForEachWord(dimension, [&](std::string word) {
+      alternatives.push_back(std::move(word));
+    });
+    if (alternatives.empty()) continue;
+    std::vector<std::string> expanded;
+    expanded.reserve(options.size() * alternatives.size());
+    for (const std::string& prefix : options) {
+      for (const std::string& alternative : alternatives) {
+        expanded.push_back(prefix.empty()
+                               ? alternative
+                               : absl::StrCat(prefix, ",", alternative));
+      }
+    }
+    options = std::move(expanded);
+  }
+  if (options.size() == 1 && options.front().empty()) options.clear();
+  return options;
+}
+
 }  // namespace
 
 int main(int argc, char** argv) {
@@ -485,9 +1007,16 @@ int main(int argc, char** argv) {
       "transpose,brotli:6 "
       "transpose,brotli:6,parallelism:10 "
       "transpose,zstd:9";
+  bool riegeli_benchmarks_set = false;
+  std::string riegeli_sweep;
   size_t max_size = size_t{100} * 1000 * 1000;
   std::string output_dir = "/tmp";
   int repetitions = 5;
+  int warmups = 1;
+  Benchmarks::OutputFormat output_format = Benchmarks::OutputFormat::kText;
+  int random_access = 0;
+  bool zipfian = false;
+  bool codec_sweep = false;
   for (;;) {
     int option_index;
     const int option =
@@ -502,6 +1031,7 @@ int main(int argc, char** argv) {
         break;
       case 2:  // --riegeli_benchmarks
         riegeli_benchmarks = optarg;
+        riegeli_benchmarks_set = true;
         break;
       case 3:  // --max_size
         if (ABSL_PREDICT_TRUE(absl::SimpleAtoi(optarg, &max_size))) break;
@@ -516,6 +1046,49 @@ int main(int argc, char** argv) {
         std::cerr << argv[0]
                   << ": option '--repetitions' requires an integer argument\n";
         return 1;
+      case 6:  // --riegeli_sweep
+        riegeli_sweep = optarg;
+        break;
+      case 7:  // --warmups
+        if (ABSL_PREDICT_TRUE(absl::SimpleAtoi(optarg, &warmups))) break;
+        std::cerr << argv[0]
+                  << ": option '--warmups' requires an integer argument\n";
+        return 1;
+      case 8:  // --output_format
+        if (absl::string_view(optarg) == "text") {
+          output_format = Benchmarks::OutputFormat::kText;
+        } else if (absl::string_view(optarg) == "csv") {
+          output_format = Benchmarks::OutputFormat::kCsv;
+        } else if (absl::string_view(optarg) == "json") {
+          output_format = Benchmarks::OutputFormat::kJson;
+        } else {
+          std::cerr << argv[0]
+                    << ": option '--output_format' requires text, csv, "
+                       "or json\n";
+          return 1;
+        }
+        break;
+      case 9:  // --random_access
+        if (ABSL_PREDICT_TRUE(absl::SimpleAtoi(optarg, &random_access))) break;
+        std::cerr << argv[0]
+                  << ": option '--random_access' requires an integer "
+                     "argument\n";
+        return 1;
+      case 10:  // --distribution
+        if (absl::string_view(optarg) == "uniform") {
+          zipfian = false;
+        } else if (absl::string_view(optarg) == "zipfian") {
+          zipfian = true;
+        } else {
+          std::cerr << argv[0]
+                    << ": option '--distribution' requires uniform or "
+                       "zipfian\n";
+          return 1;
+        }
+        break;
+      case 11:  // --codec_sweep
+        codec_sweep = true;
+        break;
       case '?':
         return 1;
       default:
@@ -530,16 +1103,24 @@ int main(int argc, char** argv) {
     std::cerr << kUsage << std::endl;
     return 1;
   }
+  if (!riegeli_sweep.empty() && !riegeli_benchmarks_set) {
+    riegeli_benchmarks.clear();
+  }
   std::cout << std::endl;
   for (int i = 1; i < argc; ++i) {
     if (!Benchmarks::ReadFile(argv[i], &records, &max_size)) break;
   }
-  Benchmarks benchmarks(std::move(records), std::move(output_dir), repetitions);
+  Benchmarks benchmarks(std::move(records), std::move(output_dir), repetitions,
+                        warmups, output_format, random_access, zipfian,
+                        codec_sweep);
   ForEachWord(tfrecord_benchmarks, [&](std::string tfrecord_options) {
     benchmarks.RegisterTFRecord(std::move(tfrecord_options));
   });
   ForEachWord(riegeli_benchmarks, [&](std::string riegeli_options) {
     benchmarks.RegisterRiegeli(std::move(riegeli_options));
   });
+  for (std::string& riegeli_options : ExpandSweep(riegeli_sweep)) {
+    benchmarks.RegisterRiegeli(std::move(riegeli_options));
+  }
   benchmarks.RunAll();
 }
@@ -0,0 +1,454 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Make file offsets 64-bit even on 32-bit systems.
+#undef _FILE_OFFSET_BITS
+#define _FILE_OFFSET_BITS 64
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_join.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/options_parser.h"
+#include "riegeli/base/status.h"
+#include "riegeli/bytes/chain_writer.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/bytes/writer_utils.h"
+#include "riegeli/chunk_encoding/compressor_options.h"
+#include "riegeli/chunk_encoding/constants.h"
+#include "riegeli/chunk_encoding/simple_encoder.h"
+#include "riegeli/chunk_encoding/transpose_encoder.h"
+#include "riegeli/records/chunk_reader.h"
+#include "riegeli/records/record_reader.h"
+#include "riegeli/tensorflow/io/tfrecord_recognizer.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/io/record_reader.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/file_system.h"
+
+namespace {
+
+// Per-field totals aggregated over all chunks.
+struct FieldStats {
+  // Total size of the field's buffers (uncompressed), in bytes.
+  size_t size = 0;
+  // Estimated compressed size: each buffer's share of its bucket's compressed
+  // size, proportional to its share of the bucket's uncompressed size.
+  double compressed_size_estimate = 0.0;
+  // Number of buckets the field's buffers were assigned to.
+  size_t num_buckets = 0;
+};
+
+// Returns true if "field_path" is "projected_field" or a subfield of it,
+// e.g. "3.1" matches projected field "3".
+bool MatchesProjection(absl::string_view field_path,
+                       absl::string_view projected_field) {
+  return field_path == projected_field ||
+         (field_path.size() > projected_field.size() &&
+          field_path[projected_field.size()] == '.' &&
+          field_path.substr(0, projected_field.size()) == projected_field);
+}
+
+void ReadTFRecord(
+    const std::string& filename,
+    const tensorflow::io::RecordReaderOptions& record_reader_options,
+    std::vector<std::string>* records) {
+  tensorflow::Env* const env = tensorflow::Env::Default();
+  std::unique_ptr<tensorflow::RandomAccessFile> file_reader;
+  {
+    const tensorflow::Status status =
+        env->NewRandomAccessFile(filename, &file_reader);
+    RIEGELI_CHECK(status.ok()) << status;
+  }
+  tensorflow::io::SequentialRecordReader record_reader(file_reader.get(),
+                                                       record_reader_options);
+  std::string record;
+  for (;;) {
+    const tensorflow::Status status = record_reader.ReadRecord(&record);
+    if (!status.ok()) {
+      RIEGELI_CHECK(tensorflow::errors::IsOutOfRange(status)) << status;
+      break;
+    }
+    records->push_back(std::move(record));
+  }
+}
+
+void ReadRiegeli(const std::string& filename,
+                 std::vector<std::string>* records) {
+  riegeli::RecordReader<riegeli::FdReader<>> record_reader(
+      riegeli::FdReader<>(filename, O_RDONLY));
+  std::string record;
+  while (record_reader.ReadRecord(&record)) {
+    records->push_back(std::move(record));
+  }
+  RIEGELI_CHECK(record_reader.Close()) << record_reader.status();
+}
+
+// Reads all records of a Riegeli/records file or a TFRecord file, detecting
+// the file format.
+void ReadFile(const std::string& filename, std::vector<std::string>* records) {
+  riegeli::FdReader<> file_reader(filename, O_RDONLY);
+  if (ABSL_PREDICT_FALSE(!file_reader.healthy())) {
+    std::cerr << "Could not open file: " << file_reader.status() << std::endl;
+    std::exit(1);
+  }
+  {
+    riegeli::TFRecordRecognizer tfrecord_recognizer(&file_reader);
+    tensorflow::io::RecordReaderOptions record_reader_options;
+    if (tfrecord_recognizer.CheckFileFormat(&record_reader_options)) {
+      RIEGELI_CHECK(tfrecord_recognizer.Close())
+          << tfrecord_recognizer.status();
+      RIEGELI_CHECK(file_reader.Close()) << file_reader.status();
+      ReadTFRecord(filename, record_reader_options, records);
+      return;
+    }
+  }
+  RIEGELI_CHECK(file_reader.Seek(0)) << file_reader.status();
+  {
+    riegeli::DefaultChunkReader<> chunk_reader(&file_reader);
+    if (chunk_reader.CheckFileFormat()) {
+      RIEGELI_CHECK(chunk_reader.Close()) << chunk_reader.status();
+      RIEGELI_CHECK(file_reader.Close()) << file_reader.status();
+      ReadRiegeli(filename, records);
+      return;
+    }
+  }
+  std::cerr << "Unknown file format: " << filename << std::endl;
+  std::exit(1);
+}
+
+// Encodes records [begin, end) with SimpleEncoder, returning the encoded
+// size.
+size_t SimpleEncodedSize(const riegeli::CompressorOptions& compressor_options,
+                         const std::vector<std::string>& records, size_t begin,
+                         size_t end, uint64_t size_hint) {
+  riegeli::SimpleEncoder encoder(compressor_options, size_hint);
+  for (size_t i = begin; i < end; ++i) {
+    RIEGELI_CHECK(encoder.AddRecord(records[i])) << encoder.status();
+  }
+  riegeli::Chain encoded;
+  riegeli::ChainWriter<> writer(&encoded);
+  riegeli::ChunkType chunk_type;
+  uint64_t num_records;
+  uint64_t decoded_data_size;
+  RIEGELI_CHECK(encoder.EncodeAndClose(&writer, &chunk_type, &num_records,
+                                       &decoded_data_size))
+      << encoder.status();
+  RIEGELI_CHECK(writer.Close()) << writer.status();
+  return encoded.size();
+}
+
+const char kUsage[] =
+    "Usage: transpose_analyzer (OPTION|INPUT_FILE)...\n"
+    "\n"
+    "Encodes records of sample files (Riegeli/records or TFRecord, detected\n"
+    "automatically) with TransposeEncoder and reports how field data was\n"
+    "split into buckets and how well each bucket compressed, to help decide\n"
+    "between transpose and simple encoding and to tune bucket_fraction for a\n"
+    "dataset.\n"
+    "\n"
+    "OPTIONs:\n"
+    "  --compressor=OPTIONS\n"
+    "      Compression options, e.g. 'brotli:6' or 'zstd:9' or\n"
+    "      'uncompressed'. Default 'brotli:6'\n"
+    "  --chunk_size=SIZE\n"
+    "      Decoded chunk size records are grouped by, with an optional\n"
+    "      suffix k, M, G, T, P, or E. Default 1M\n"
+    "  --bucket_fraction=FRACTION\n"
+    "      Fraction of chunk_size used as the bucket size, between 0.0 and\n"
+    "      1.0. Default 1.0\n"
+    "  --columnar\n"
+    "      Delta encode numeric field columns before compression\n"
+    "  --fields=PATHS\n"
+    "      Comma-separated paths of proto field numbers, e.g. '1,3.2'.\n"
+    "      If present, additionally reports the cost of reading only these\n"
+    "      fields with field projection: how many bucket bytes must be\n"
+    "      decompressed, and how much of that belongs to other fields";
+
+const struct option kOptions[] = {
+    {"help", no_argument, nullptr, 0},
+    {"compressor", required_argument, nullptr, 1},
+    {"chunk_size", required_argument, nullptr, 2},
+    {"bucket_fraction", required_argument, nullptr, 3},
+    {"columnar", no_argument, nullptr, 4},
+    {"fields", required_argument, nullptr, 5},
+    {nullptr, 0, nullptr, 0}};
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  riegeli::CompressorOptions compressor_options;
+  {
+    const riegeli::Status status = compressor_options.FromString("brotli:6");
+    RIEGELI_CHECK(status.ok()) << status;
+  }
+  uint64_t chunk_size = uint64_t{1} << 20;
+  double bucket_fraction = 1.0;
+  bool columnar = false;
+  std::vector<std::string> projected_fields;
+  for (;;) {
+    int option_index;
+    const int option =
+        getopt_long_only(argc, argv, "", kOptions, &option_index);
+    if (option == -1) break;
+    switch (option) {
+      case 0:  // --help
+        std::cout << kUsage << std::endl;
+        return 0;
+      case 1: {  // --compressor
+        const riegeli::Status status = compressor_options.FromString(optarg);
+        if (ABSL_PREDICT_FALSE(!status.ok())) {
+          std::cerr << argv[0] << ": invalid --compressor: " << status
+                    << std::endl;
+          return 1;
+        }
+      } break;
+      case 2: {  // --chunk_size
+        riegeli::OptionsParser options_parser;
+        options_parser.AddOption(
+            "chunk_size",
+            riegeli::ValueParser::Bytes(
+                &chunk_size, 1, std::numeric_limits<uint64_t>::max()));
+        if (ABSL_PREDICT_FALSE(!options_parser.FromString(
+                absl::StrCat("chunk_size:", optarg)))) {
+          std::cerr << argv[0]
+                    << ": invalid --chunk_size: " << options_parser.status()
+                    << std::endl;
+          return 1;
+        }
+      } break;
+      case 3:  // --bucket_fraction
+        if (ABSL_PREDICT_TRUE(absl::SimpleAtod(optarg, &bucket_fraction) &&
+                              bucket_fraction >= 0.0 &&
+                              bucket_fraction <= 1.0)) {
+          break;
+        }
+        std::cerr << argv[0]
+                  << ": option '--bucket_fraction' requires an argument "
+                     "between 0.0 and 1.0\n";
+        return 1;
+      case 4:  // --columnar
+        columnar = true;
+        break;
+      case 5:  // --fields
+        projected_fields = absl::StrSplit(optarg, ',', absl::SkipEmpty());
+        break;
+      case '?':
+        return 1;
+      default:
+        RIEGELI_ASSERT_UNREACHABLE()
+            << "getopt_long_only() returned " << option;
+    }
+  }
+  argc -= optind - 1;
+  argv += optind - 1;
+  if (argc == 1) {
+    std::cerr << kUsage << std::endl;
+    return 1;
+  }
+
+  std::vector<std::string> records;
+  for (int i = 1; i < argc; ++i) ReadFile(argv[i], &records);
+  if (ABSL_PREDICT_FALSE(records.empty())) {
+    std::cerr << "No records read" << std::endl;
+    return 1;
+  }
+
+  // Mirrors RecordWriterBase::Worker::MakeChunkEncoder().
+  const long double long_double_bucket_size =
+      std::round(static_cast<long double>(chunk_size) *
+                 static_cast<long double>(bucket_fraction));
+  const uint64_t bucket_size =
+      ABSL_PREDICT_FALSE(
+          long_double_bucket_size >=
+          static_cast<long double>(std::numeric_limits<uint64_t>::max()))
+          ? std::numeric_limits<uint64_t>::max()
+          : ABSL_PREDICT_TRUE(long_double_bucket_size >= 1.0L)
+                ? static_cast<uint64_t>(long_double_bucket_size)
+                : uint64_t{1};
+
+  riegeli::TransposeEncoder transpose_encoder(compressor_options, bucket_size,
+                                              columnar);
+  riegeli::TransposeEncoder::Analysis analysis;
+  transpose_encoder.set_analysis(&analysis);
+
+  uint64_t total_decoded_size = 0;
+  size_t transpose_size = 0;
+  size_t simple_size = 0;
+  size_t num_chunks = 0;
+  size_t num_buckets = 0;
+  size_t total_bucket_uncompressed = 0;
+  // Keyed by field path; std::map so that the report is ordered by path.
+  std::map<std::string, FieldStats> field_stats;
+  // Compressed bytes of buckets needed to read only projected_fields, and the
+  // estimated share of projected fields' data within them.
+  size_t projection_compressed = 0;
+  double projection_useful_estimate = 0.0;
+
+  // Group records into chunks of approximately chunk_size decoded bytes, the
+  // same measure RecordWriter uses, and encode each chunk.
+  size_t chunk_begin = 0;
+  while (chunk_begin < records.size()) {
+    size_t chunk_end = chunk_begin;
+    uint64_t chunk_decoded_size = 0;
+    do {
+      chunk_decoded_size +=
+          riegeli::LengthVarint64(records[chunk_end].size()) +
+          records[chunk_end].size();
+      ++chunk_end;
+    } while (chunk_end < records.size() && chunk_decoded_size < chunk_size);
+    transpose_encoder.Reset();
+    for (size_t r = chunk_begin; r < chunk_end; ++r) {
+      RIEGELI_CHECK(transpose_encoder.AddRecord(records[r]))
+          << transpose_encoder.status();
+    }
+    riegeli::Chain encoded;
+    riegeli::ChainWriter<> writer(&encoded);
+    riegeli::ChunkType chunk_type;
+    uint64_t num_records;
+    uint64_t decoded_data_size;
+    RIEGELI_CHECK(transpose_encoder.EncodeAndClose(
+        &writer, &chunk_type, &num_records, &decoded_data_size))
+        << transpose_encoder.status();
+    RIEGELI_CHECK(writer.Close()) << writer.status();
+    transpose_size += encoded.size();
+    total_decoded_size += decoded_data_size;
+    ++num_chunks;
+    num_buckets += analysis.buckets.size();
+    for (const riegeli::TransposeEncoder::Analysis::Bucket& bucket :
+         analysis.buckets) {
+      total_bucket_uncompressed += bucket.uncompressed_size;
+    }
+    // Which buckets of this chunk contain projected fields, and how much of
+    // each bucket's uncompressed data is theirs.
+    std::vector<size_t> projected_in_bucket(analysis.buckets.size(), 0);
+    for (const riegeli::TransposeEncoder::Analysis::Buffer& buffer :
+         analysis.buffers) {
+      FieldStats& stats = field_stats[buffer.field_path];
+      stats.size += buffer.size;
+      ++stats.num_buckets;
+      const riegeli::TransposeEncoder::Analysis::Bucket& bucket =
+          analysis.buckets[buffer.bucket_index];
+      if (bucket.uncompressed_size > 0) {
+        stats.compressed_size_estimate +=
+            static_cast<double>(buffer.size) /
+            static_cast<double>(bucket.uncompressed_size) *
+            static_cast<double>(bucket.compressed_size);
+      }
+      for (const std::string& projected_field : projected_fields) {
+        if (MatchesProjection(buffer.field_path, projected_field)) {
+          projected_in_bucket[buffer.bucket_index] += buffer.size;
+          break;
+        }
+      }
+    }
+    for (size_t b = 0; b < analysis.buckets.size(); ++b) {
+      if (projected_in_bucket[b] == 0) continue;
+      projection_compressed += analysis.buckets[b].compressed_size;
+      if (analysis.buckets[b].uncompressed_size > 0) {
+        projection_useful_estimate +=
+            static_cast<double>(projected_in_bucket[b]) /
+            static_cast<double>(analysis.buckets[b].uncompressed_size) *
+            static_cast<double>(analysis.buckets[b].compressed_size);
+      }
+    }
+    // SimpleEncoder comparison for the same chunk of records.
+    simple_size += SimpleEncodedSize(compressor_options, records, chunk_begin,
+                                     chunk_end, chunk_decoded_size);
+    chunk_begin = chunk_end;
+  }
+
+  std::cout << "Records: " << records.size() << ", decoded size "
+            << total_decoded_size << " bytes" << std::endl;
+  std::cout << "Chunk size " << chunk_size << ", bucket size " << bucket_size
+            << ", " << num_chunks << " chunks, " << num_buckets << " buckets"
+            << (columnar ? ", columnar" : "") << std::endl;
+  std::cout << absl::StrFormat(
+                   "Simple encoding:    %10d bytes (%5.1f%%)", simple_size,
+                   100.0 * static_cast<double>(simple_size) /
+                       static_cast<double>(total_decoded_size))
+            << std::endl;
+  std::cout << absl::StrFormat(
+                   "Transpose encoding: %10d bytes (%5.1f%%)", transpose_size,
+                   100.0 * static_cast<double>(transpose_size) /
+                       static_cast<double>(total_decoded_size))
+            << std::endl;
+  std::cout << std::endl;
+
+  size_t max_path_width = 5;
+  for (const std::pair<const std::string, FieldStats>& entry : field_stats) {
+    max_path_width = std::max(max_path_width, entry.first.size());
+  }
+  std::cout << absl::StrFormat(
+                   "%-*s %12s %6s %12s %8s", max_path_width, "Field", "Size",
+                   "%", "Est.compr.", "Buckets")
+            << std::endl;
+  std::cout << std::string(max_path_width + 42, '-') << std::endl;
+  for (const std::pair<const std::string, FieldStats>& entry : field_stats) {
+    std::cout << absl::StrFormat(
+                     "%-*s %12d %5.1f%% %12.0f %8d", max_path_width,
+                     entry.first, entry.second.size,
+                     100.0 * static_cast<double>(entry.second.size) /
+                         static_cast<double>(total_bucket_uncompressed),
+                     entry.second.compressed_size_estimate,
+                     entry.second.num_buckets)
+              << std::endl;
+  }
+
+  if (!projected_fields.empty()) {
+    std::cout << std::endl;
+    std::cout << "Projection to " << absl::StrJoin(projected_fields, ",")
+              << ":" << std::endl;
+    std::cout << absl::StrFormat(
+                     "  bucket bytes decompressed: %d of %d (%5.1f%%)",
+                     projection_compressed, transpose_size,
+                     100.0 * static_cast<double>(projection_compressed) /
+                         static_cast<double>(transpose_size))
+              << std::endl;
+    std::cout << absl::StrFormat(
+                     "  of which other fields (estimated): %.0f bytes "
+                     "(%5.1f%%)",
+                     static_cast<double>(projection_compressed) -
+                         projection_useful_estimate,
+                     projection_compressed == 0
+                         ? 0.0
+                         : 100.0 *
+                               (static_cast<double>(projection_compressed) -
+                                projection_useful_estimate) /
+                               static_cast<double>(projection_compressed))
+              << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,375 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Make file offsets 64-bit even on 32-bit systems.
+#undef _FILE_OFFSET_BITS
+#define _FILE_OFFSET_BITS 64
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/string_view.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/errno_mapping.h"
+#include "riegeli/base/status.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/bytes/fd_writer.h"
+#include "riegeli/records/record_reader.h"
+#include "riegeli/records/record_writer.h"
+
+namespace {
+
+uint64_t CpuTimeNow_ns() {
+  struct timespec time_info;
+  RIEGELI_CHECK_EQ(clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_info), 0);
+  return riegeli::IntCast<uint64_t>(time_info.tv_sec) * uint64_t{1000000000} +
+         riegeli::IntCast<uint64_t>(time_info.tv_nsec);
+}
+
+uint64_t RealTimeNow_ns() {
+  struct timespec time_info;
+  RIEGELI_CHECK_EQ(clock_gettime(CLOCK_MONOTONIC, &time_info), 0);
+  return riegeli::IntCast<uint64_t>(time_info.tv_sec) * uint64_t{1000000000} +
+         riegeli::IntCast<uint64_t>(time_info.tv_nsec);
+}
+
+class Stats {
+ public:
+  void Add(double value) { samples_.push_back(value); }
+
+  double Percentile(double fraction);
+
+ private:
+  std::vector<double> samples_;
+};
+
+double Stats::Percentile(double fraction) {
+  RIEGELI_CHECK(!samples_.empty()) << "No data";
+  const size_t nth = riegeli::UnsignedMin(
+      static_cast<size_t>(fraction * static_cast<double>(samples_.size())),
+      samples_.size() - 1);
+  std::nth_element(samples_.begin(), samples_.begin() + nth, samples_.end());
+  return samples_[nth];
+}
+
+// One trace entry: the size of a record and the gap since the previous
+// record, as captured from a production workload.
+struct TraceEntry {
+  size_t size = 0;
+  uint64_t interarrival_ns = 0;
+};
+
+// Reads a trace file: one entry per line, the record size in bytes optionally
+// followed by whitespace and the interarrival gap in nanoseconds. Blank lines
+// and lines starting with '#' are skipped.
+bool ReadTrace(const std::string& filename, std::vector<TraceEntry>* trace) {
+  std::ifstream in(filename);
+  if (ABSL_PREDICT_FALSE(!in.is_open())) {
+    std::cerr << "Could not open trace: " << filename << std::endl;
+    return false;
+  }
+  std::string line;
+  int line_number = 0;
+  while (std::getline(in, line)) {
+    ++line_number;
+    std::stringstream fields(line);
+    TraceEntry entry;
+    if (!(fields >> entry.size)) {
+      std::string word;
+      if (!(std::stringstream(line) >> word) || word[0] == '#') continue;
+      std::cerr << "Malformed trace line " << line_number << ": " << line
+                << std::endl;
+      return false;
+    }
+    fields >> entry.interarrival_ns;
+    trace->push_back(entry);
+  }
+  return true;
+}
+
+// Generates a record of the given size. The first entropy fraction of the
+// record is pseudo-random and effectively incompressible; the remainder is
+// zeros. This gives synthetic data whose compression ratio is controlled by
+// --entropy while record sizes follow the trace, without shipping the
+// original data.
+std::string GenerateRecord(size_t size, double entropy,
+                           std::mt19937_64* rng) {
+  std::string record(size, '\0');
+  const size_t random_size = riegeli::UnsignedMin(
+      static_cast<size_t>(entropy * static_cast<double>(size)), size);
+  size_t i = 0;
+  while (i < random_size) {
+    const uint64_t value = (*rng)();
+    for (int shift = 0; shift < 64 && i < random_size; shift += 8, ++i) {
+      record[i] = static_cast<char>(value >> shift);
+    }
+  }
+  return record;
+}
+
+// Writes the synthetic records to filename, as fast as possible. Reports
+// throughput against the uncompressed record sizes.
+void WriteWorkload(const std::string& filename,
+                   riegeli::RecordWriterBase::Options record_writer_options,
+                   const std::vector<std::string>& records,
+                   size_t total_size) {
+  riegeli::RecordWriter<riegeli::FdWriter<>> record_writer(
+      riegeli::FdWriter<>(filename, O_WRONLY | O_CREAT | O_TRUNC),
+      std::move(record_writer_options));
+  const uint64_t cpu_time_before_ns = CpuTimeNow_ns();
+  const uint64_t real_time_before_ns = RealTimeNow_ns();
+  for (const std::string& record : records) {
+    RIEGELI_CHECK(record_writer.WriteRecord(record)) << record_writer.status();
+  }
+  RIEGELI_CHECK(record_writer.Close()) << record_writer.status();
+  const uint64_t cpu_time_after_ns = CpuTimeNow_ns();
+  const uint64_t real_time_after_ns = RealTimeNow_ns();
+  absl::PrintF(
+      "Write: %.1f MB/s CPU, %.1f MB/s real\n",
+      static_cast<double>(total_size) /
+          static_cast<double>(cpu_time_after_ns - cpu_time_before_ns) * 1000.0,
+      static_cast<double>(total_size) /
+          static_cast<double>(real_time_after_ns - real_time_before_ns) *
+          1000.0);
+}
+
+// Writes the synthetic records to filename, pacing WriteRecord() calls by the
+// interarrival gaps from the trace. Reports per-record WriteRecord() latency
+// percentiles, which reflect how buffering and background compression absorb
+// the production arrival pattern.
+void ReplayWorkload(const std::string& filename,
+                    riegeli::RecordWriterBase::Options record_writer_options,
+                    const std::vector<std::string>& records,
+                    const std::vector<TraceEntry>& trace) {
+  riegeli::RecordWriter<riegeli::FdWriter<>> record_writer(
+      riegeli::FdWriter<>(filename, O_WRONLY | O_CREAT | O_TRUNC),
+      std::move(record_writer_options));
+  Stats write_latency;
+  uint64_t deadline_ns = RealTimeNow_ns();
+  for (size_t i = 0; i < records.size(); ++i) {
+    deadline_ns += trace[i].interarrival_ns;
+    const uint64_t now_ns = RealTimeNow_ns();
+    if (now_ns < deadline_ns) {
+      std::this_thread::sleep_for(
+          std::chrono::nanoseconds(deadline_ns - now_ns));
+    }
+    const uint64_t real_time_before_ns = RealTimeNow_ns();
+    RIEGELI_CHECK(record_writer.WriteRecord(records[i]))
+        << record_writer.status();
+    write_latency.Add(
+        static_cast<double>(RealTimeNow_ns() - real_time_before_ns) / 1000.0);
+  }
+  const uint64_t real_time_before_ns = RealTimeNow_ns();
+  RIEGELI_CHECK(record_writer.Close()) << record_writer.status();
+  absl::PrintF(
+      "WriteRecord() latency (us): p50 %.1f, p90 %.1f, p99 %.1f\n",
+      write_latency.Percentile(0.5), write_latency.Percentile(0.9),
+      write_latency.Percentile(0.99));
+  absl::PrintF(
+      "Close() latency (us): %.1f\n",
+      static_cast<double>(RealTimeNow_ns() - real_time_before_ns) / 1000.0);
+}
+
+// Reads the workload back, verifying record count and total size. Reports
+// throughput against the uncompressed record sizes.
+void ReadWorkload(const std::string& filename, size_t num_records,
+                  size_t total_size) {
+  riegeli::RecordReader<riegeli::FdReader<>> record_reader(
+      riegeli::FdReader<>(filename, O_RDONLY));
+  size_t decoded_records = 0;
+  size_t decoded_size = 0;
+  std::string record;
+  const uint64_t cpu_time_before_ns = CpuTimeNow_ns();
+  const uint64_t real_time_before_ns = RealTimeNow_ns();
+  while (record_reader.ReadRecord(&record)) {
+    ++decoded_records;
+    decoded_size += record.size();
+  }
+  RIEGELI_CHECK(record_reader.Close()) << record_reader.status();
+  const uint64_t cpu_time_after_ns = CpuTimeNow_ns();
+  const uint64_t real_time_after_ns = RealTimeNow_ns();
+  RIEGELI_CHECK_EQ(decoded_records, num_records)
+      << "Decoded records do not match the trace";
+  RIEGELI_CHECK_EQ(decoded_size, total_size)
+      << "Decoded sizes do not match the trace";
+  absl::PrintF(
+      "Read: %.1f MB/s CPU, %.1f MB/s real\n",
+      static_cast<double>(total_size) /
+          static_cast<double>(cpu_time_after_ns - cpu_time_before_ns) * 1000.0,
+      static_cast<double>(total_size) /
+          static_cast<double>(real_time_after_ns - real_time_before_ns) *
+          1000.0);
+}
+
+uint64_t FileSize(const std::string& filename) {
+  struct stat stat_info;
+  RIEGELI_CHECK_EQ(stat(filename.c_str(), &stat_info), 0)
+      << riegeli::ErrnoToCanonicalStatus(errno, "stat() failed").message();
+  return riegeli::IntCast<uint64_t>(stat_info.st_size);
+}
+
+const char kUsage[] =
+    "Usage: workload_generator (OPTION)... TRACE_FILE\n"
+    "\n"
+    "Replays a captured record-size/interarrival trace through\n"
+    "RecordWriter/RecordReader with synthetic record contents, so that\n"
+    "option tuning runs against a realistic workload without the original\n"
+    "data.\n"
+    "\n"
+    "The trace is a text file with one record per line: the record size in\n"
+    "bytes, optionally followed by the gap since the previous record in\n"
+    "nanoseconds. Blank lines and lines starting with '#' are skipped.\n"
+    "\n"
+    "OPTIONs:\n"
+    "  --riegeli_options=OPTIONS\n"
+    "      Riegeli RecordWriter options, e.g. brotli:6,parallelism:10,\n"
+    "      default none (RecordWriter defaults)\n"
+    "  --entropy=F\n"
+    "      Fraction of each record filled with incompressible pseudo-random\n"
+    "      bytes, the rest being zeros; controls the compression ratio of\n"
+    "      the synthetic data, between 0.0 and 1.0, default 0.5\n"
+    "  --seed=N\n"
+    "      Seed of the pseudo-random record contents; runs with the same\n"
+    "      trace, entropy, and seed are repeatable, default 42\n"
+    "  --replay\n"
+    "      Pace WriteRecord() calls by the interarrival gaps from the trace\n"
+    "      and report per-record write latency percentiles, instead of\n"
+    "      writing as fast as possible and reporting throughput\n"
+    "  --output=FILE\n"
+    "      File to write the workload to,\n"
+    "      default /tmp/record_benchmark_workload";
+
+const struct option kOptions[] = {
+    {"help", no_argument, nullptr, 0},
+    {"riegeli_options", required_argument, nullptr, 1},
+    {"entropy", required_argument, nullptr, 2},
+    {"seed", required_argument, nullptr, 3},
+    {"replay", no_argument, nullptr, 4},
+    {"output", required_argument, nullptr, 5},
+    {nullptr, 0, nullptr, 0}};
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::string riegeli_options;
+  double entropy = 0.5;
+  uint64_t seed = 42;
+  bool replay = false;
+  std::string output = "/tmp/record_benchmark_workload";
+  for (;;) {
+    int option_index;
+    const int option =
+        getopt_long_only(argc, argv, "", kOptions, &option_index);
+    if (option == -1) break;
+    switch (option) {
+      case 0:  // --help
+        std::cout << kUsage << std::endl;
+        return 0;
+      case 1:  // --riegeli_options
+        riegeli_options = optarg;
+        break;
+      case 2:  // --entropy
+        if (ABSL_PREDICT_TRUE(absl::SimpleAtod(optarg, &entropy) &&
+                              entropy >= 0.0 && entropy <= 1.0)) {
+          break;
+        }
+        std::cerr << argv[0]
+                  << ": option '--entropy' requires an argument between "
+                     "0.0 and 1.0\n";
+        return 1;
+      case 3:  // --seed
+        if (ABSL_PREDICT_TRUE(absl::SimpleAtoi(optarg, &seed))) break;
+        std::cerr << argv[0]
+                  << ": option '--seed' requires an integer argument\n";
+        return 1;
+      case 4:  // --replay
+        replay = true;
+        break;
+      case 5:  // --output
+        output = std::string(optarg);
+        break;
+      case '?':
+        return 1;
+      default:
+        RIEGELI_ASSERT_UNREACHABLE()
+            << "getopt_long_only() returned " << option;
+    }
+  }
+  argc -= optind - 1;
+  argv += optind - 1;
+  if (argc != 2) {
+    std::cerr << kUsage << std::endl;
+    return 1;
+  }
+  riegeli::RecordWriterBase::Options record_writer_options;
+  {
+    const riegeli::Status status =
+        record_writer_options.FromString(riegeli_options);
+    if (ABSL_PREDICT_FALSE(!status.ok())) {
+      std::cerr << argv[0] << ": invalid riegeli options: " << status
+                << std::endl;
+      return 1;
+    }
+  }
+
+  std::vector<TraceEntry> trace;
+  if (ABSL_PREDICT_FALSE(!ReadTrace(argv[1], &trace))) return 1;
+  if (ABSL_PREDICT_FALSE(trace.empty())) {
+    std::cerr << "Empty trace: " << argv[1] << std::endl;
+    return 1;
+  }
+
+  std::mt19937_64 rng(seed);
+  std::vector<std::string> records;
+  records.reserve(trace.size());
+  size_t total_size = 0;
+  for (const TraceEntry& entry : trace) {
+    records.push_back(GenerateRecord(entry.size, entropy, &rng));
+    total_size += entry.size;
+  }
+  absl::PrintF("Trace: %zu records, %.3f MB uncompressed\n", records.size(),
+               static_cast<double>(total_size) / 1000000.0);
+
+  if (replay) {
+    ReplayWorkload(output, std::move(record_writer_options), records, trace);
+  } else {
+    WriteWorkload(output, std::move(record_writer_options), records,
+                  total_size);
+  }
+  absl::PrintF("Compression ratio: %.3f%%\n",
+               static_cast<double>(FileSize(output)) /
+                   static_cast<double>(total_size) * 100.0);
+  ReadWorkload(output, records.size(), total_size);
+  return 0;
+}
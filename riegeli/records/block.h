@@ -76,70 +76,83 @@ class BlockHeader {
   uint64_t words_[3];
 };
 
+// The default block size. A different block size can be set with
+// DefaultChunkWriterBase::Options::set_block_size() and is recorded in the
+// file; functions below take the effective block size as a parameter.
 RIEGELI_INLINE_CONSTEXPR(Position, kBlockSize, Position{1} << 16);
 
-RIEGELI_INLINE_CONSTEXPR(Position, kUsableBlockSize,
-                         kBlockSize - BlockHeader::size());
-
 // Whether pos is a block boundary (immediately before a block header).
-inline bool IsBlockBoundary(Position pos) { return pos % kBlockSize == 0; }
+inline bool IsBlockBoundary(Position pos, Position block_size) {
+  return pos % block_size == 0;
+}
 
 // The nearest block boundary at or before pos.
-inline Position RoundDownToBlockBoundary(Position pos) {
-  return pos - pos % kBlockSize;
+inline Position RoundDownToBlockBoundary(Position pos, Position block_size) {
+  return pos - pos % block_size;
 }
 
 // How many bytes remain until the end of the block (0 at a block boundary).
-inline Position RemainingInBlock(Position pos) { return (-pos) % kBlockSize; }
+inline Position RemainingInBlock(Position pos, Position block_size) {
+  return (-pos) % block_size;
+}
 
 // Whether pos is a possible chunk boundary (not inside nor immediately after
 // a block header).
-inline bool IsPossibleChunkBoundary(Position pos) {
-  return RemainingInBlock(pos) < kUsableBlockSize;
+inline bool IsPossibleChunkBoundary(Position pos, Position block_size) {
+  return RemainingInBlock(pos, block_size) < block_size - BlockHeader::size();
 }
 
 // The nearest possible chunk boundary at or after pos (chunk boundaries are not
 // valid inside or immediately after a block header).
-inline Position RoundUpToPossibleChunkBoundary(Position pos) {
-  return pos + SaturatingSub(RemainingInBlock(pos), kUsableBlockSize - 1);
+inline Position RoundUpToPossibleChunkBoundary(Position pos,
+                                               Position block_size) {
+  return pos + SaturatingSub(RemainingInBlock(pos, block_size),
+                             block_size - BlockHeader::size() - 1);
 }
 
 // If pos is immediately before or inside a block header, how many bytes remain
 // until the end of the block header, otherwise 0.
-inline size_t RemainingInBlockHeader(Position pos) {
-  return SaturatingSub(BlockHeader::size(), IntCast<size_t>(pos % kBlockSize));
+inline size_t RemainingInBlockHeader(Position pos, Position block_size) {
+  return SaturatingSub(BlockHeader::size(), IntCast<size_t>(pos % block_size));
 }
 
 // For a chunk beginning at the given position, the position after the given
 // length, adding intervening block headers.
-inline Position AddWithOverhead(Position chunk_begin, Position length) {
-  RIEGELI_ASSERT_LT(RemainingInBlock(chunk_begin), kUsableBlockSize)
+inline Position AddWithOverhead(Position chunk_begin, Position length,
+                                Position block_size) {
+  const Position usable_block_size = block_size - BlockHeader::size();
+  RIEGELI_ASSERT_LT(RemainingInBlock(chunk_begin, block_size),
+                    usable_block_size)
       << "Failed precondition of AddWithOverhead(): invalid chunk boundary";
   const Position num_overhead_blocks =
-      (length + (chunk_begin + kUsableBlockSize - 1) % kBlockSize) /
-      kUsableBlockSize;
+      (length + (chunk_begin + usable_block_size - 1) % block_size) /
+      usable_block_size;
   return chunk_begin + length + num_overhead_blocks * BlockHeader::size();
 }
 
 // For a chunk beginning at the given position, the length until another
 // position, subtracting intervening block headers.
-inline Position DistanceWithoutOverhead(Position chunk_begin, Position pos) {
+inline Position DistanceWithoutOverhead(Position chunk_begin, Position pos,
+                                        Position block_size) {
   RIEGELI_ASSERT_LE(chunk_begin, pos)
       << "Failed precondition of DistanceWithoutOverhead(): "
          "positions in the wrong order";
   const Position num_overhead_blocks =
-      pos / kBlockSize - chunk_begin / kBlockSize;
-  return (pos - UnsignedMin(pos % kBlockSize, BlockHeader::size())) -
+      pos / block_size - chunk_begin / block_size;
+  return (pos - UnsignedMin(pos % block_size, BlockHeader::size())) -
          (chunk_begin -
-          UnsignedMin(chunk_begin % kBlockSize, BlockHeader::size())) -
+          UnsignedMin(chunk_begin % block_size, BlockHeader::size())) -
          num_overhead_blocks * BlockHeader::size();
 }
 
 // The position after a chunk which begins at the given position.
-inline Position ChunkEnd(const ChunkHeader& header, Position chunk_begin) {
+inline Position ChunkEnd(const ChunkHeader& header, Position chunk_begin,
+                         Position block_size) {
   return UnsignedMax(
-      AddWithOverhead(chunk_begin, header.size() + header.data_size()),
-      RoundUpToPossibleChunkBoundary(chunk_begin + header.num_records()));
+      AddWithOverhead(chunk_begin, header.size() + header.data_size(),
+                      block_size),
+      RoundUpToPossibleChunkBoundary(chunk_begin + header.num_records(),
+                                     block_size));
 }
 
 }  // namespace internal
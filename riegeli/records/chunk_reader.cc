@@ -17,6 +17,7 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <cstring>
 #include <memory>
 #include <string>
 #include <utility>
@@ -25,6 +26,8 @@
 #include "absl/strings/str_cat.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/canonical_errors.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/endian.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/chunk_encoding/chunk.h"
@@ -34,17 +37,34 @@
 
 namespace riegeli {
 
-void DefaultChunkReaderBase::Initialize(Reader* src) {
+namespace {
+
+// How many block headers ahead of the reading position can have their hashes
+// verified in one HashBatch() call. 16 headers cover 1 MB of buffered data.
+constexpr size_t kMaxPrevalidatedBlockHeaders = 16;
+
+// How many validated block header positions are remembered before they are
+// all forgotten. 4096 positions cover 256 MB of file and take 32 KB.
+constexpr size_t kMaxValidatedBlockHeaders = 4096;
+
+}  // namespace
+
+void DefaultChunkReaderBase::Initialize(Reader* src, Options&& options) {
   RIEGELI_ASSERT(src != nullptr)
       << "Failed precondition of "
          "DefaultChunkReader<Src>::DefaultChunkReader(Src): "
          "null Reader pointer";
+  verify_hashes_ = options.verify_hashes_;
+  shard_index_ = options.shard_index_;
+  num_shards_ = options.num_shards_;
+  block_size_ = options.block_size_;
   pos_ = src->pos();
   if (ABSL_PREDICT_FALSE(!src->healthy())) {
     Fail(*src);
     return;
   }
-  if (ABSL_PREDICT_FALSE(!internal::IsPossibleChunkBoundary(pos_))) {
+  if (ABSL_PREDICT_FALSE(
+          !internal::IsPossibleChunkBoundary(pos_, block_size_))) {
     recoverable_ = Recoverable::kFindChunk;
     recoverable_pos_ = pos_;
     Fail(DataLossError(absl::StrCat("Invalid chunk boundary: ", pos_)));
@@ -89,16 +109,21 @@ bool DefaultChunkReaderBase::CheckFileFormat() {
 bool DefaultChunkReaderBase::ReadChunk(Chunk* chunk) {
   if (ABSL_PREDICT_FALSE(!PullChunkHeader(nullptr))) return false;
   Reader* const src = src_reader();
-  const Position chunk_end = internal::ChunkEnd(chunk_.header, pos_);
+  const Position chunk_end =
+      internal::ChunkEnd(chunk_.header, pos_, block_size_);
 
+  // Chunk data are hashed as they are read, while they are still in cache.
+  // Data retained from a previous incomplete attempt are caught up on first.
+  data_hasher_.Reset();
+  if (ABSL_PREDICT_TRUE(verify_hashes_)) data_hasher_.Update(chunk_.data);
   while (chunk_.data.size() < chunk_.header.data_size()) {
-    if (internal::RemainingInBlockHeader(src->pos()) > 0) {
+    if (internal::RemainingInBlockHeader(src->pos(), block_size_) > 0) {
       const Position block_begin =
-          internal::RoundDownToBlockBoundary(src->pos());
+          internal::RoundDownToBlockBoundary(src->pos(), block_size_);
       if (ABSL_PREDICT_FALSE(!ReadBlockHeader())) return false;
       if (ABSL_PREDICT_FALSE(block_header_.previous_chunk() !=
                              block_begin - pos_)) {
-        if (block_header_.next_chunk() <= internal::kBlockSize) {
+        if (block_header_.next_chunk() <= block_size_) {
           // Trust the rest of the block header: skip to the next chunk.
           recoverable_ = Recoverable::kHaveChunk;
           recoverable_pos_ = block_begin + block_header_.next_chunk();
@@ -127,31 +152,65 @@ bool DefaultChunkReaderBase::ReadChunk(Chunk* chunk) {
                          block_begin + block_header_.next_chunk())));
       }
     }
-    if (ABSL_PREDICT_FALSE(!src->Read(
-            &chunk_.data, IntCast<size_t>(UnsignedMin(
-                              chunk_.header.data_size() - chunk_.data.size(),
-                              internal::RemainingInBlock(src->pos())))))) {
-      return ReadingFailed(src);
-    }
+    // Read into a separate Chain so that the newly read data can be hashed
+    // block by block; appending the Chain shares its blocks with chunk_.data.
+    Chain data_read;
+    const bool ok = src->Read(
+        &data_read,
+        IntCast<size_t>(UnsignedMin(
+            chunk_.header.data_size() - chunk_.data.size(),
+            internal::RemainingInBlock(src->pos(), block_size_))));
+    if (ABSL_PREDICT_TRUE(verify_hashes_)) data_hasher_.Update(data_read);
+    chunk_.data.Append(std::move(data_read));
+    if (ABSL_PREDICT_FALSE(!ok)) return ReadingFailed(src);
   }
 
   if (ABSL_PREDICT_FALSE(!src->Seek(chunk_end))) return ReadingFailed(src);
 
-  const uint64_t computed_data_hash = internal::Hash(chunk_.data);
-  if (ABSL_PREDICT_FALSE(computed_data_hash != chunk_.header.data_hash())) {
-    // Recoverable::kHaveChunk, not Recoverable::kFindChunk, because while chunk
-    // data are invalid, chunk header has a correct hash, and thus the next
-    // chunk is believed to be present after this chunk.
-    recoverable_ = Recoverable::kHaveChunk;
-    recoverable_pos_ = chunk_end;
-    return Fail(DataLossError(absl::StrCat(
-        "Corrupted Riegeli/records file: chunk data hash mismatch (computed 0x",
-        absl::Hex(computed_data_hash, absl::PadSpec::kZeroPad16), ", stored 0x",
-        absl::Hex(chunk_.header.data_hash(), absl::PadSpec::kZeroPad16),
-        "), chunk at ", pos_, " with length ", chunk_end - pos_)));
+  if (ABSL_PREDICT_TRUE(verify_hashes_)) {
+    const uint64_t computed_data_hash = data_hasher_.Digest();
+    if (ABSL_PREDICT_FALSE(computed_data_hash != chunk_.header.data_hash())) {
+      // Recoverable::kHaveChunk, not Recoverable::kFindChunk, because while
+      // chunk data are invalid, chunk header has a correct hash, and thus the
+      // next chunk is believed to be present after this chunk.
+      recoverable_ = Recoverable::kHaveChunk;
+      recoverable_pos_ = chunk_end;
+      return Fail(DataLossError(absl::StrCat(
+          "Corrupted Riegeli/records file: chunk data hash mismatch "
+          "(computed 0x",
+          absl::Hex(computed_data_hash, absl::PadSpec::kZeroPad16),
+          ", stored 0x",
+          absl::Hex(chunk_.header.data_hash(), absl::PadSpec::kZeroPad16),
+          "), chunk at ", pos_, " with length ", chunk_end - pos_)));
+    }
   }
 
   *chunk = std::move(chunk_);
+  if (chunk->header.num_records() > 0) ++chunk_ordinal_;
+  pos_ = chunk_end;
+  chunk_.Reset();
+  return true;
+}
+
+inline bool DefaultChunkReaderBase::CurrentChunkOwned() const {
+  if (ABSL_PREDICT_TRUE(num_shards_ <= 1)) return true;
+  // Chunks without records (the file signature, file metadata, padding, the
+  // record index) are visible to every shard.
+  if (chunk_.header.num_records() == 0) return true;
+  return chunk_ordinal_ % num_shards_ == shard_index_;
+}
+
+inline bool DefaultChunkReaderBase::CurrentChunkSkippedMetadata() const {
+  if (ABSL_PREDICT_TRUE(!skip_metadata_)) return false;
+  return chunk_.header.chunk_type() == ChunkType::kFileMetadata;
+}
+
+bool DefaultChunkReaderBase::SkipChunk() {
+  Reader* const src = src_reader();
+  const Position chunk_end =
+      internal::ChunkEnd(chunk_.header, pos_, block_size_);
+  if (ABSL_PREDICT_FALSE(!src->Seek(chunk_end))) return ReadingFailed(src);
+  if (chunk_.header.num_records() > 0) ++chunk_ordinal_;
   pos_ = chunk_end;
   chunk_.Reset();
   return true;
@@ -179,10 +238,17 @@ bool DefaultChunkReaderBase::PullChunkHeader(const ChunkHeader** chunk_header) {
   }
 
   const Position chunk_header_read =
-      internal::DistanceWithoutOverhead(pos_, src->pos());
+      internal::DistanceWithoutOverhead(pos_, src->pos(), block_size_);
   if (chunk_header_read < chunk_.header.size()) {
     if (ABSL_PREDICT_FALSE(!ReadChunkHeader())) return false;
   }
+  while (ABSL_PREDICT_FALSE(!CurrentChunkOwned() ||
+                            CurrentChunkSkippedMetadata())) {
+    // The chunk belongs to another shard or is skipped file metadata: seek
+    // over its data and read the header of the next chunk.
+    if (ABSL_PREDICT_FALSE(!SkipChunk())) return false;
+    if (ABSL_PREDICT_FALSE(!ReadChunkHeader())) return false;
+  }
   if (chunk_header != nullptr) *chunk_header = &chunk_.header;
   return true;
 }
@@ -192,20 +258,21 @@ inline bool DefaultChunkReaderBase::ReadChunkHeader() {
       << "Failed precondition of DefaultChunkReaderBase::ReadChunkHeader(): "
       << status();
   Reader* const src = src_reader();
-  RIEGELI_ASSERT_LT(internal::DistanceWithoutOverhead(pos_, src->pos()),
-                    chunk_.header.size())
+  RIEGELI_ASSERT_LT(
+      internal::DistanceWithoutOverhead(pos_, src->pos(), block_size_),
+      chunk_.header.size())
       << "Failed precondition of DefaultChunkReaderBase::ReadChunkHeader(): "
          "chunk header already read";
   size_t remaining_length;
   size_t length_to_read;
   do {
-    if (internal::RemainingInBlockHeader(src->pos()) > 0) {
+    if (internal::RemainingInBlockHeader(src->pos(), block_size_) > 0) {
       const Position block_begin =
-          internal::RoundDownToBlockBoundary(src->pos());
+          internal::RoundDownToBlockBoundary(src->pos(), block_size_);
       if (ABSL_PREDICT_FALSE(!ReadBlockHeader())) return false;
       if (ABSL_PREDICT_FALSE(block_header_.previous_chunk() !=
                              block_begin - pos_)) {
-        if (block_header_.next_chunk() <= internal::kBlockSize) {
+        if (block_header_.next_chunk() <= block_size_) {
           // Trust the rest of the block header: skip to the next chunk.
           recoverable_ = Recoverable::kHaveChunk;
           recoverable_pos_ = block_begin + block_header_.next_chunk();
@@ -224,36 +291,40 @@ inline bool DefaultChunkReaderBase::ReadChunkHeader() {
                                block_header_.previous_chunk() - block_begin))));
       }
     }
-    const size_t chunk_header_read =
-        IntCast<size_t>(internal::DistanceWithoutOverhead(pos_, src->pos()));
+    const size_t chunk_header_read = IntCast<size_t>(
+        internal::DistanceWithoutOverhead(pos_, src->pos(), block_size_));
     remaining_length = chunk_.header.size() - chunk_header_read;
-    length_to_read =
-        UnsignedMin(remaining_length, internal::RemainingInBlock(src->pos()));
+    length_to_read = UnsignedMin(
+        remaining_length, internal::RemainingInBlock(src->pos(), block_size_));
     if (ABSL_PREDICT_FALSE(!src->Read(chunk_.header.bytes() + chunk_header_read,
                                       length_to_read))) {
       return ReadingFailed(src);
     }
   } while (length_to_read < remaining_length);
 
-  const uint64_t computed_header_hash = chunk_.header.computed_header_hash();
-  if (ABSL_PREDICT_FALSE(computed_header_hash !=
-                         chunk_.header.stored_header_hash())) {
-    recoverable_ = Recoverable::kFindChunk;
-    recoverable_pos_ = src->pos();
-    return Fail(DataLossError(absl::StrCat(
-        "Corrupted Riegeli/records file: chunk header hash mismatch "
-        "(computed 0x",
-        absl::Hex(computed_header_hash, absl::PadSpec::kZeroPad16),
-        ", stored 0x",
-        absl::Hex(chunk_.header.stored_header_hash(),
-                  absl::PadSpec::kZeroPad16),
-        "), chunk at ", pos_)));
+  if (ABSL_PREDICT_TRUE(verify_hashes_)) {
+    const uint64_t computed_header_hash = chunk_.header.computed_header_hash();
+    if (ABSL_PREDICT_FALSE(computed_header_hash !=
+                           chunk_.header.stored_header_hash())) {
+      recoverable_ = Recoverable::kFindChunk;
+      recoverable_pos_ = src->pos();
+      return Fail(DataLossError(absl::StrCat(
+          "Corrupted Riegeli/records file: chunk header hash mismatch "
+          "(computed 0x",
+          absl::Hex(computed_header_hash, absl::PadSpec::kZeroPad16),
+          ", stored 0x",
+          absl::Hex(chunk_.header.stored_header_hash(),
+                    absl::PadSpec::kZeroPad16),
+          "), chunk at ", pos_)));
+    }
   }
-  if (internal::RemainingInBlock(pos_) < chunk_.header.size()) {
+  if (internal::RemainingInBlock(pos_, block_size_) < chunk_.header.size()) {
     // The chunk header was interrupted by a block header. Both headers have
     // been read so verify that they agree.
-    const Position block_begin = pos_ + internal::RemainingInBlock(pos_);
-    const Position chunk_end = internal::ChunkEnd(chunk_.header, pos_);
+    const Position block_begin =
+        pos_ + internal::RemainingInBlock(pos_, block_size_);
+    const Position chunk_end =
+        internal::ChunkEnd(chunk_.header, pos_, block_size_);
     if (ABSL_PREDICT_FALSE(block_header_.next_chunk() !=
                            chunk_end - block_begin)) {
       recoverable_ = Recoverable::kFindChunk;
@@ -266,49 +337,169 @@ inline bool DefaultChunkReaderBase::ReadChunkHeader() {
     }
   }
   if (pos_ == 0) {
-    // Verify file signature.
+    // Verify file signature. Its decoded data size records the block size if
+    // it differs from internal::kBlockSize; see
+    // DefaultChunkWriterBase::WriteChunk().
     if (ABSL_PREDICT_FALSE(chunk_.header.data_size() != 0 ||
                            chunk_.header.chunk_type() !=
                                ChunkType::kFileSignature ||
-                           chunk_.header.num_records() != 0 ||
-                           chunk_.header.decoded_data_size() != 0)) {
+                           chunk_.header.num_records() != 0)) {
       recoverable_ = Recoverable::kFindChunk;
       recoverable_pos_ = src->pos();
       return Fail(DataLossError(
           "Invalid Riegeli/records file: missing file signature"));
     }
+    if (chunk_.header.decoded_data_size() != 0) {
+      if (ABSL_PREDICT_FALSE(chunk_.header.decoded_data_size() <
+                             internal::BlockHeader::size() +
+                                 ChunkHeader::size())) {
+        recoverable_ = Recoverable::kFindChunk;
+        recoverable_pos_ = src->pos();
+        return Fail(DataLossError(absl::StrCat(
+            "Invalid Riegeli/records file: invalid block size in file "
+            "signature: ",
+            chunk_.header.decoded_data_size())));
+      }
+      block_size_ = IntCast<Position>(chunk_.header.decoded_data_size());
+    }
   }
   return true;
 }
 
 inline bool DefaultChunkReaderBase::ReadBlockHeader() {
   Reader* const src = src_reader();
-  const size_t remaining_length = internal::RemainingInBlockHeader(src->pos());
+  const size_t remaining_length =
+      internal::RemainingInBlockHeader(src->pos(), block_size_);
   RIEGELI_ASSERT_GT(remaining_length, 0u)
       << "Failed precondition of DefaultChunkReaderBase::ReadBlockHeader(): "
          "not before nor inside a block header";
+  const Position block_begin =
+      internal::RoundDownToBlockBoundary(src->pos(), block_size_);
   if (ABSL_PREDICT_FALSE(!src->Read(
           block_header_.bytes() + block_header_.size() - remaining_length,
           remaining_length))) {
     return ReadingFailed(src);
   }
-  const uint64_t computed_header_hash = block_header_.computed_header_hash();
-  if (ABSL_PREDICT_FALSE(computed_header_hash !=
-                         block_header_.stored_header_hash())) {
-    recoverable_ = Recoverable::kFindChunk;
-    recoverable_pos_ = src->pos();
-    return Fail(DataLossError(absl::StrCat(
-        "Corrupted Riegeli/records file: block header hash mismatch "
-        "(computed 0x",
-        absl::Hex(computed_header_hash, absl::PadSpec::kZeroPad16),
-        ", stored 0x",
-        absl::Hex(block_header_.stored_header_hash(),
-                  absl::PadSpec::kZeroPad16),
-        "), block at ", internal::RoundDownToBlockBoundary(recoverable_pos_))));
+  if (ABSL_PREDICT_TRUE(verify_hashes_)) {
+    if (!BlockHeaderValidated(block_begin)) {
+      const uint64_t computed_header_hash =
+          block_header_.computed_header_hash();
+      if (ABSL_PREDICT_FALSE(computed_header_hash !=
+                             block_header_.stored_header_hash())) {
+        recoverable_ = Recoverable::kFindChunk;
+        recoverable_pos_ = src->pos();
+        return Fail(DataLossError(absl::StrCat(
+            "Corrupted Riegeli/records file: block header hash mismatch "
+            "(computed 0x",
+            absl::Hex(computed_header_hash, absl::PadSpec::kZeroPad16),
+            ", stored 0x",
+            absl::Hex(block_header_.stored_header_hash(),
+                      absl::PadSpec::kZeroPad16),
+            "), block at ", block_begin)));
+      }
+      MarkBlockHeaderValidated(block_begin);
+    }
+    PrevalidateBlockHeaders(src, block_begin);
   }
   return true;
 }
 
+inline bool DefaultChunkReaderBase::BlockHeaderValidated(
+    Position block_begin) const {
+  return validated_block_headers_.count(block_begin) > 0;
+}
+
+inline void DefaultChunkReaderBase::MarkBlockHeaderValidated(
+    Position block_begin) {
+  if (ABSL_PREDICT_FALSE(validated_block_headers_.size() >=
+                         kMaxValidatedBlockHeaders)) {
+    validated_block_headers_.clear();
+  }
+  validated_block_headers_.insert(block_begin);
+}
+
+inline void DefaultChunkReaderBase::PrevalidateBlockHeaders(
+    Reader* src, Position block_begin) {
+  if (BlockHeaderValidated(block_begin + block_size_)) return;
+  // src->pos() is just after the block header at block_begin. Data up to
+  // src->pos() + src->available() are buffered; block headers fully contained
+  // there can be verified now, hashing them in one batch. The buffered bytes
+  // remain stable until the reading position passes them, hence they are the
+  // same bytes that ReadBlockHeader() will see.
+  const char* headers[kMaxPrevalidatedBlockHeaders];
+  Position positions[kMaxPrevalidatedBlockHeaders];
+  size_t num = 0;
+  Position next_block_begin = block_begin + block_size_;
+  while (num < kMaxPrevalidatedBlockHeaders &&
+         next_block_begin + internal::BlockHeader::size() <=
+             src->pos() + src->available()) {
+    headers[num] =
+        src->cursor() + IntCast<size_t>(next_block_begin - src->pos());
+    positions[num] = next_block_begin;
+    ++num;
+    next_block_begin += block_size_;
+  }
+  if (num == 0) return;
+  const char* hashed[kMaxPrevalidatedBlockHeaders];
+  for (size_t i = 0; i < num; ++i) hashed[i] = headers[i] + sizeof(uint64_t);
+  uint64_t computed_header_hashes[kMaxPrevalidatedBlockHeaders];
+  internal::HashBatch(hashed, internal::BlockHeader::size() - sizeof(uint64_t),
+                      num, computed_header_hashes);
+  for (size_t i = 0; i < num; ++i) {
+    uint64_t stored_header_hash;
+    std::memcpy(&stored_header_hash, headers[i], sizeof(stored_header_hash));
+    if (ABSL_PREDICT_FALSE(computed_header_hashes[i] !=
+                           ReadLittleEndian64(stored_header_hash))) {
+      // The mismatch will be reported when reading reaches this header.
+      // Headers after it are not prevalidated so that recovery rereads them.
+      break;
+    }
+    MarkBlockHeaderValidated(positions[i]);
+  }
+}
+
+inline void DefaultChunkReaderBase::SkipBlocksWithInvalidHeaders(Reader* src) {
+  RIEGELI_ASSERT(internal::IsBlockBoundary(pos_, block_size_))
+      << "Failed precondition of "
+         "DefaultChunkReaderBase::SkipBlocksWithInvalidHeaders(): "
+         "not a block boundary";
+  if (!verify_hashes_) return;
+  for (;;) {
+    if (pos_ < src->pos()) return;
+    const char* headers[kMaxPrevalidatedBlockHeaders];
+    Position positions[kMaxPrevalidatedBlockHeaders];
+    size_t num = 0;
+    Position block_begin = pos_;
+    while (num < kMaxPrevalidatedBlockHeaders &&
+           block_begin + internal::BlockHeader::size() <=
+               src->pos() + src->available()) {
+      headers[num] = src->cursor() + IntCast<size_t>(block_begin - src->pos());
+      positions[num] = block_begin;
+      ++num;
+      block_begin += block_size_;
+    }
+    if (num == 0) return;
+    const char* hashed[kMaxPrevalidatedBlockHeaders];
+    for (size_t i = 0; i < num; ++i) hashed[i] = headers[i] + sizeof(uint64_t);
+    uint64_t computed_header_hashes[kMaxPrevalidatedBlockHeaders];
+    internal::HashBatch(hashed,
+                        internal::BlockHeader::size() - sizeof(uint64_t), num,
+                        computed_header_hashes);
+    for (size_t i = 0; i < num; ++i) {
+      uint64_t stored_header_hash;
+      std::memcpy(&stored_header_hash, headers[i], sizeof(stored_header_hash));
+      if (computed_header_hashes[i] == ReadLittleEndian64(stored_header_hash)) {
+        // ReadBlockHeader() will reread this header from the buffer and
+        // resume recovery from it, skipping hashing it again.
+        MarkBlockHeaderValidated(positions[i]);
+        pos_ = positions[i];
+        return;
+      }
+    }
+    pos_ = positions[num - 1] + block_size_;
+  }
+}
+
 bool DefaultChunkReaderBase::Recover(SkippedRegion* skipped_region) {
   if (recoverable_ == Recoverable::kNo) return false;
   Reader* const src = src_reader();
@@ -335,7 +526,8 @@ again:
         }
         return true;
       }
-      if (ABSL_PREDICT_FALSE(!internal::IsPossibleChunkBoundary(pos_))) {
+      if (ABSL_PREDICT_FALSE(
+              !internal::IsPossibleChunkBoundary(pos_, block_size_))) {
         recoverable_ = Recoverable::kFindChunk;
         recoverable_pos_ = pos_;
         goto again;
@@ -353,7 +545,8 @@ again:
   pos_ = recoverable_pos;
 
 find_chunk:
-  pos_ += internal::RemainingInBlock(pos_);
+  pos_ += internal::RemainingInBlock(pos_, block_size_);
+  SkipBlocksWithInvalidHeaders(src);
   if (ABSL_PREDICT_FALSE(!src->Seek(pos_))) {
     if (ABSL_PREDICT_FALSE(!src->healthy())) return Fail(*src);
     if (skipped_region != nullptr) {
@@ -369,7 +562,8 @@ find_chunk:
     // A chunk boundary coincides with block boundary. Recovery is done.
   } else {
     pos_ += block_header_.next_chunk();
-    if (ABSL_PREDICT_FALSE(!internal::IsPossibleChunkBoundary(pos_))) {
+    if (ABSL_PREDICT_FALSE(
+            !internal::IsPossibleChunkBoundary(pos_, block_size_))) {
       goto find_chunk;
     }
     if (ABSL_PREDICT_FALSE(!src->Seek(pos_))) {
@@ -395,7 +589,8 @@ bool DefaultChunkReaderBase::Seek(Position new_pos) {
   pos_ = new_pos;
   chunk_.Reset();
   if (ABSL_PREDICT_FALSE(!src->Seek(pos_))) return SeekingFailed(src, pos_);
-  if (ABSL_PREDICT_FALSE(!internal::IsPossibleChunkBoundary(pos_))) {
+  if (ABSL_PREDICT_FALSE(
+          !internal::IsPossibleChunkBoundary(pos_, block_size_))) {
     recoverable_ = Recoverable::kFindChunk;
     recoverable_pos_ = pos_;
     return Fail(DataLossError(absl::StrCat("Invalid chunk boundary: ", pos_)));
@@ -433,7 +628,8 @@ bool DefaultChunkReaderBase::SeekToChunk(Position new_pos) {
   Reader* const src = src_reader();
   truncated_ = false;
   chunk_.Reset();
-  const Position block_begin = internal::RoundDownToBlockBoundary(new_pos);
+  const Position block_begin =
+      internal::RoundDownToBlockBoundary(new_pos, block_size_);
   Position chunk_begin;
   if (pos_ <= new_pos) {
     // The current chunk begins at or before new_pos. If it also ends at or
@@ -448,7 +644,8 @@ bool DefaultChunkReaderBase::SeekToChunk(Position new_pos) {
         pos_ + chunk_.header.num_records() > new_pos) {
       return true;
     }
-    const Position chunk_end = internal::ChunkEnd(chunk_.header, pos_);
+    const Position chunk_end =
+        internal::ChunkEnd(chunk_.header, pos_, block_size_);
     if (which_chunk == WhichChunk::kBefore && chunk_end > new_pos) return true;
     if (chunk_end < block_begin) {
       // The current chunk ends too early. Skip to block_begin.
@@ -485,7 +682,8 @@ bool DefaultChunkReaderBase::SeekToChunk(Position new_pos) {
       }
       chunk_begin = block_begin - block_header_.previous_chunk();
     }
-    if (ABSL_PREDICT_FALSE(!internal::IsPossibleChunkBoundary(chunk_begin))) {
+    if (ABSL_PREDICT_FALSE(
+            !internal::IsPossibleChunkBoundary(chunk_begin, block_size_))) {
       recoverable_ = Recoverable::kFindChunk;
       recoverable_pos_ = src->pos();
       return Fail(DataLossError(absl::StrCat(
@@ -509,7 +707,8 @@ bool DefaultChunkReaderBase::SeekToChunk(Position new_pos) {
         pos_ + chunk_.header.num_records() > new_pos) {
       return true;
     }
-    const Position chunk_end = internal::ChunkEnd(chunk_.header, pos_);
+    const Position chunk_end =
+        internal::ChunkEnd(chunk_.header, pos_, block_size_);
     if (which_chunk == WhichChunk::kBefore && chunk_end > new_pos) return true;
     chunk_begin = chunk_end;
   }
@@ -15,16 +15,20 @@
 #ifndef RIEGELI_RECORDS_CHUNK_READER_H_
 #define RIEGELI_RECORDS_CHUNK_READER_H_
 
+#include <stdint.h>
+
 #include <memory>
 #include <utility>
 
 #include "absl/base/optimization.h"
+#include "absl/container/flat_hash_set.h"
 #include "absl/utility/utility.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/dependency.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/chunk_encoding/hash.h"
 #include "riegeli/records/block.h"
 #include "riegeli/records/skipped_region.h"
 
@@ -33,6 +37,129 @@ namespace riegeli {
 // Template parameter invariant part of DefaultChunkReader.
 class DefaultChunkReaderBase : public Object {
  public:
+  class Options {
+   public:
+    Options() noexcept {}
+
+    // If true, chunk header hashes, chunk data hashes, and block header hashes
+    // are verified while reading, detecting data corruption.
+    //
+    // If false, hash verification is skipped, which makes reading faster but
+    // silently accepts corrupted data. This is unsafe for untrusted data; it
+    // is meant for trusted files, e.g. temporary files written and reread
+    // within the same process.
+    //
+    // Default: true.
+    Options& set_verify_hashes(bool verify_hashes) & {
+      verify_hashes_ = verify_hashes;
+      return *this;
+    }
+    Options&& set_verify_hashes(bool verify_hashes) && {
+      return std::move(set_verify_hashes(verify_hashes));
+    }
+
+    // Sets the distance between block headers in the file, as set with
+    // DefaultChunkWriterBase::Options::set_block_size() when the file was
+    // written.
+    //
+    // A reader which starts reading from the beginning of the file adopts the
+    // block size recorded in the file signature, hence this option matters
+    // only when reading begins at a later position.
+    //
+    // Default: internal::kBlockSize (64KB).
+    //
+    // Precondition: block_size >=
+    //               internal::BlockHeader::size() + ChunkHeader::size()
+    Options& set_block_size(Position block_size) & {
+      RIEGELI_ASSERT_GE(block_size,
+                        internal::BlockHeader::size() + ChunkHeader::size())
+          << "Failed precondition of "
+             "DefaultChunkReaderBase::Options::set_block_size(): "
+             "block size too small";
+      block_size_ = block_size;
+      return *this;
+    }
+    Options&& set_block_size(Position block_size) && {
+      return std::move(set_block_size(block_size));
+    }
+
+    // Restricts reading to a shard of the file: of the chunks containing
+    // records, counted from the position where reading starts, only those
+    // with ordinal numbers congruent to shard_index modulo num_shards are
+    // returned by ReadChunk(). The other chunks are skipped by seeking over
+    // their data after reading only their headers, so each of num_shards
+    // readers of the same file reads a disjoint subset of records which
+    // together cover the whole file, and roughly 1/num_shards of the bytes.
+    //
+    // Chunks without records (the file signature, file metadata, padding,
+    // the record index) are not counted and are visible to every shard.
+    //
+    // Sharding is meant for reading the file sequentially; seeking does not
+    // reset the counting of chunks.
+    //
+    // Precondition: shard_index < num_shards
+    //
+    // Default: shard_index 0, num_shards 1 (no sharding).
+    Options& set_shard(uint64_t shard_index, uint64_t num_shards) & {
+      RIEGELI_ASSERT_LT(shard_index, num_shards)
+          << "Failed precondition of "
+             "DefaultChunkReaderBase::Options::set_shard(): "
+             "shard index out of range";
+      shard_index_ = shard_index;
+      num_shards_ = num_shards;
+      return *this;
+    }
+    Options&& set_shard(uint64_t shard_index, uint64_t num_shards) && {
+      return std::move(set_shard(shard_index, num_shards));
+    }
+
+    // If true, file metadata chunks are skipped by seeking over their data
+    // after reading only their headers, so they are never returned by
+    // ReadChunk() nor reported by PullChunkHeader(). This avoids reading and
+    // checksumming the metadata chunk when the caller is not interested in
+    // metadata, which matters when many files are opened just to read a few
+    // records from each.
+    //
+    // Default: false.
+    Options& set_skip_metadata(bool skip_metadata) & {
+      skip_metadata_ = skip_metadata;
+      return *this;
+    }
+    Options&& set_skip_metadata(bool skip_metadata) && {
+      return std::move(set_skip_metadata(skip_metadata));
+    }
+
+   private:
+    friend class DefaultChunkReaderBase;
+
+    bool verify_hashes_ = true;
+    Position block_size_ = internal::kBlockSize;
+    uint64_t shard_index_ = 0;
+    uint64_t num_shards_ = 1;
+    bool skip_metadata_ = false;
+  };
+
+  // Changes whether hashes are verified, as with Options::set_verify_hashes().
+  // Takes effect for data read afterwards.
+  void set_verify_hashes(bool verify_hashes) { verify_hashes_ = verify_hashes; }
+
+  // Restricts reading to a shard of the file, as with Options::set_shard().
+  // Takes effect for chunks read afterwards; chunks read so far are counted
+  // as if sharding had been in effect from the beginning.
+  //
+  // Precondition: shard_index < num_shards
+  void set_shard(uint64_t shard_index, uint64_t num_shards) {
+    RIEGELI_ASSERT_LT(shard_index, num_shards)
+        << "Failed precondition of DefaultChunkReaderBase::set_shard(): "
+           "shard index out of range";
+    shard_index_ = shard_index;
+    num_shards_ = num_shards;
+  }
+
+  // Changes whether file metadata chunks are skipped, as with
+  // Options::set_skip_metadata(). Takes effect for chunks read afterwards.
+  void set_skip_metadata(bool skip_metadata) { skip_metadata_ = skip_metadata; }
+
   // Returns the Riegeli/records file being read from. Unchanged by Close().
   virtual Reader* src_reader() = 0;
   virtual const Reader* src_reader() const = 0;
@@ -54,6 +181,13 @@ class DefaultChunkReaderBase : public Object {
   //  * true                    - success (*chunk is set)
   //  * false (when healthy())  - source ends
   //  * false (when !healthy()) - failure
+  //
+  // When the source ends, truncated() tells whether it ends cleanly at a
+  // chunk boundary or in the middle of a chunk. If the file is still being
+  // written and the source can see data appended later, calling ReadChunk()
+  // again resumes reading from where it stopped, without re-reading or
+  // re-validating previously read blocks; this allows to follow a growing
+  // file by polling ReadChunk() cheaply.
   bool ReadChunk(Chunk* chunk);
 
   // Reads the next chunk header, from same chunk which will be read by an
@@ -68,6 +202,19 @@ class DefaultChunkReaderBase : public Object {
   //  * false (when !healthy()) - failure
   bool PullChunkHeader(const ChunkHeader** chunk_header);
 
+  // Skips the chunk whose header was returned by PullChunkHeader(), by
+  // seeking over its data without reading them, leaving the position at the
+  // next chunk boundary. Together with PullChunkHeader() this allows
+  // scanning the chunk headers of a file without reading record data.
+  //
+  // Precondition: PullChunkHeader() succeeded, with no intervening reading
+  // or seeking
+  //
+  // Return values:
+  //  * true  - success
+  //  * false - failure (!healthy())
+  bool SkipChunk();
+
   // If !healthy() and the failure was caused by invalid file contents, then
   // Recover() tries to recover from the failure and allow reading again by
   // skipping over the invalid region.
@@ -96,6 +243,20 @@ class DefaultChunkReaderBase : public Object {
   // pos() is unchanged by Close().
   Position pos() const { return pos_; }
 
+  // Returns true if the source ended in the middle of a chunk when the last
+  // ReadChunk() or PullChunkHeader() returned false with healthy(). This
+  // distinguishes an incomplete tail of a file which is still being written
+  // from a clean end at a chunk boundary.
+  //
+  // If the source does not grow, Close() will fail in this state; for a file
+  // being followed, retry reading instead of closing.
+  bool truncated() const { return truncated_; }
+
+  // Returns the distance between block headers in the file being read, as set
+  // with Options::set_block_size() or adopted from the file signature.
+  // Unchanged by Close().
+  Position block_size() const { return block_size_; }
+
   // Returns true if this ChunkReader supports Seek(), SeekToChunkContaining(),
   // SeekToChunkAfter(), and Size().
   bool SupportsRandomAccess() const;
@@ -144,7 +305,7 @@ class DefaultChunkReaderBase : public Object {
   DefaultChunkReaderBase(DefaultChunkReaderBase&& that) noexcept;
   DefaultChunkReaderBase& operator=(DefaultChunkReaderBase&& that) noexcept;
 
-  void Initialize(Reader* src);
+  void Initialize(Reader* src, Options&& options);
   void Done() override;
 
  private:
@@ -166,19 +327,72 @@ class DefaultChunkReaderBase : public Object {
   // Always returns false.
   bool SeekingFailed(Reader* src, Position new_pos);
 
+  // Returns true if the chunk whose header is in chunk_.header belongs to
+  // this shard, or if sharding is not in effect.
+  bool CurrentChunkOwned() const;
+
+  // Returns true if the chunk whose header is in chunk_.header is a file
+  // metadata chunk and skipping file metadata is in effect.
+  bool CurrentChunkSkippedMetadata() const;
+
   // Reads or continues reading chunk_.header.
   bool ReadChunkHeader();
 
   // Reads or continues reading block_header_.
   //
-  // Precondition: internal::RemainingInBlockHeader(src_reader()->pos()) > 0
+  // Precondition:
+  //   internal::RemainingInBlockHeader(src_reader()->pos(), block_size_) > 0
   bool ReadBlockHeader();
 
+  // Returns true if the hash of the block header at block_begin was already
+  // verified, either by PrevalidateBlockHeaders() or by a previous read of
+  // the same header.
+  bool BlockHeaderValidated(Position block_begin) const;
+
+  // Remembers that the hash of the block header at block_begin was verified.
+  // If too many positions are remembered, forgets all of them; forgotten
+  // headers are merely verified again when reading reaches them.
+  void MarkBlockHeaderValidated(Position block_begin);
+
+  // Verifies hashes of as many block headers following block_begin as are
+  // already buffered in the source, in one batch, so that ReadBlockHeader()
+  // can skip hashing them when reading reaches them.
+  void PrevalidateBlockHeaders(Reader* src, Position block_begin);
+
+  // Part of Recover(): advances pos_ over consecutive blocks whose headers
+  // are already buffered in the source and have invalid hashes, validating
+  // them in batches instead of rereading them one at a time. pos_ remains at
+  // a block boundary.
+  //
+  // Precondition: internal::IsBlockBoundary(pos_, block_size_)
+  void SkipBlocksWithInvalidHeaders(Reader* src);
+
   // Shared implementation of SeekToChunkContaining(), SeekToChunkBefore(), and
   // SeekToChunkAfter().
   template <WhichChunk which_chunk>
   bool SeekToChunk(Position new_pos);
 
+  // If false, chunk and block header hashes and chunk data hashes are not
+  // verified.
+  bool verify_hashes_ = true;
+
+  // Shard of the file to read, as set with Options::set_shard().
+  //
+  // Invariant: shard_index_ < num_shards_
+  uint64_t shard_index_ = 0;
+  uint64_t num_shards_ = 1;
+
+  // If true, file metadata chunks are skipped by seeking over their data.
+  bool skip_metadata_ = false;
+
+  // The number of chunks containing records read or skipped so far, counted
+  // from the position where reading started.
+  uint64_t chunk_ordinal_ = 0;
+
+  // The distance between block headers in the file, as set with
+  // Options::set_block_size() or adopted from the file signature.
+  Position block_size_ = internal::kBlockSize;
+
   // If true, the source is truncated (in the middle of a chunk) at the current
   // position. If the source does not grow, Close() will fail.
   //
@@ -195,9 +409,21 @@ class DefaultChunkReaderBase : public Object {
   // src_reader()->pos().
   Chunk chunk_;
 
+  // Hash state for verifying chunk data, reused across chunks so that its
+  // allocation is not repeated for each chunk.
+  internal::Hasher data_hasher_;
+
   // Block header, filled to the point derived from src_reader()->pos().
   internal::BlockHeader block_header_;
 
+  // Block boundaries whose block headers already had their hashes verified,
+  // either in a batch by PrevalidateBlockHeaders() or individually by
+  // ReadBlockHeader(). Remembered across Seek(), so that rereading a region
+  // after seeking does not verify its block headers again; this is sound
+  // because Riegeli/records files are never mutated in place. Bounded by
+  // MarkBlockHeaderValidated().
+  absl::flat_hash_set<Position> validated_block_headers_;
+
   // Whether Recover() is applicable, and if so, how it should be performed:
   //
   //  * Recoverable::kNo        - Recover() is not applicable
@@ -247,7 +473,7 @@ class DefaultChunkReader : public DefaultChunkReaderBase {
   DefaultChunkReader() : DefaultChunkReaderBase(State::kClosed) {}
 
   // Will read from the byte Reader provided by src.
-  explicit DefaultChunkReader(Src src);
+  explicit DefaultChunkReader(Src src, Options options = Options());
 
   DefaultChunkReader(DefaultChunkReader&& that) noexcept;
   DefaultChunkReader& operator=(DefaultChunkReader&& that) noexcept;
@@ -273,29 +499,45 @@ class DefaultChunkReader : public DefaultChunkReaderBase {
 inline DefaultChunkReaderBase::DefaultChunkReaderBase(
     DefaultChunkReaderBase&& that) noexcept
     : Object(std::move(that)),
+      verify_hashes_(absl::exchange(that.verify_hashes_, true)),
+      shard_index_(absl::exchange(that.shard_index_, 0)),
+      num_shards_(absl::exchange(that.num_shards_, 1)),
+      skip_metadata_(absl::exchange(that.skip_metadata_, false)),
+      chunk_ordinal_(absl::exchange(that.chunk_ordinal_, 0)),
+      block_size_(absl::exchange(that.block_size_, internal::kBlockSize)),
       truncated_(absl::exchange(that.truncated_, false)),
       pos_(absl::exchange(that.pos_, 0)),
       chunk_(absl::exchange(that.chunk_, Chunk())),
+      data_hasher_(std::move(that.data_hasher_)),
       block_header_(that.block_header_),
+      validated_block_headers_(std::move(that.validated_block_headers_)),
       recoverable_(absl::exchange(that.recoverable_, Recoverable::kNo)),
       recoverable_pos_(absl::exchange(that.recoverable_pos_, 0)) {}
 
 inline DefaultChunkReaderBase& DefaultChunkReaderBase::operator=(
     DefaultChunkReaderBase&& that) noexcept {
   Object::operator=(std::move(that));
+  verify_hashes_ = absl::exchange(that.verify_hashes_, true);
+  shard_index_ = absl::exchange(that.shard_index_, 0);
+  num_shards_ = absl::exchange(that.num_shards_, 1);
+  skip_metadata_ = absl::exchange(that.skip_metadata_, false);
+  chunk_ordinal_ = absl::exchange(that.chunk_ordinal_, 0);
+  block_size_ = absl::exchange(that.block_size_, internal::kBlockSize);
   truncated_ = absl::exchange(that.truncated_, false);
   pos_ = absl::exchange(that.pos_, 0);
   chunk_ = absl::exchange(that.chunk_, Chunk());
+  data_hasher_ = std::move(that.data_hasher_);
   block_header_ = that.block_header_;
+  validated_block_headers_ = std::move(that.validated_block_headers_);
   recoverable_ = absl::exchange(that.recoverable_, Recoverable::kNo);
   recoverable_pos_ = absl::exchange(that.recoverable_pos_, 0);
   return *this;
 }
 
 template <typename Src>
-DefaultChunkReader<Src>::DefaultChunkReader(Src src)
+DefaultChunkReader<Src>::DefaultChunkReader(Src src, Options options)
     : DefaultChunkReaderBase(State::kOpen), src_(std::move(src)) {
-  Initialize(src_.get());
+  Initialize(src_.get(), std::move(options));
 }
 
 template <typename Src>
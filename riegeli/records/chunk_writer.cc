@@ -18,34 +18,38 @@
 
 #include <cstring>
 #include <memory>
+#include <utility>
 
 #include "absl/base/optimization.h"
 #include "absl/strings/string_view.h"
 #include "absl/types/span.h"
 #include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/chain_reader.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/bytes/string_reader.h"
 #include "riegeli/bytes/writer.h"
-#include "riegeli/bytes/writer_utils.h"
 #include "riegeli/chunk_encoding/chunk.h"
 #include "riegeli/chunk_encoding/constants.h"
 #include "riegeli/chunk_encoding/hash.h"
 #include "riegeli/records/block.h"
+#include "riegeli/records/chunk_reader.h"
 
 namespace riegeli {
 
 ChunkWriter::~ChunkWriter() {}
 
-void DefaultChunkWriterBase::Initialize(Writer* dest, Position pos) {
+void DefaultChunkWriterBase::Initialize(Writer* dest, Position pos,
+                                        Position block_size) {
   RIEGELI_ASSERT(dest != nullptr)
       << "Failed precondition of "
          "DefaultChunkWriter<Dest>::DefaultChunkWriter(Dest): "
          "null Writer pointer";
-  if (ABSL_PREDICT_FALSE(!internal::IsPossibleChunkBoundary(pos))) {
-    const Position length = internal::RemainingInBlock(pos);
-    if (ABSL_PREDICT_FALSE(!WriteZeros(dest, length))) Fail(*dest);
+  block_size_ = block_size;
+  if (ABSL_PREDICT_FALSE(!internal::IsPossibleChunkBoundary(pos, block_size))) {
+    const Position length = internal::RemainingInBlock(pos, block_size);
+    if (ABSL_PREDICT_FALSE(!dest->WriteZeros(length))) Fail(*dest);
     pos += length;
   }
   ChunkWriter::Initialize(pos);
@@ -59,19 +63,35 @@ bool DefaultChunkWriterBase::WriteChunk(const Chunk& chunk) {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
   // Matches FutureRecordPosition::FutureChunkBegin::Resolve().
   Writer* const dest = dest_writer();
+  ChunkHeader header = chunk.header;
+  if (ABSL_PREDICT_FALSE(pos_ == 0 &&
+                         header.chunk_type() == ChunkType::kFileSignature &&
+                         block_size_ != internal::kBlockSize)) {
+    // Record the non-default block size in the file signature chunk, in its
+    // decoded data size field which is otherwise 0. A reader starting from
+    // the beginning of the file adopts it from there.
+    header = ChunkHeader(chunk.data, ChunkType::kFileSignature, 0,
+                         IntCast<uint64_t>(block_size_));
+  }
   StringReader<> header_reader(
-      absl::string_view(chunk.header.bytes(), chunk.header.size()));
+      absl::string_view(header.bytes(), header.size()));
   ChainReader<> data_reader(&chunk.data);
   const Position chunk_begin = pos_;
-  const Position chunk_end = internal::ChunkEnd(chunk.header, chunk_begin);
-  if (ABSL_PREDICT_FALSE(
-          !WriteSection(&header_reader, chunk_begin, chunk_end, dest))) {
-    return false;
-  }
-  if (ABSL_PREDICT_FALSE(
-          !WriteSection(&data_reader, chunk_begin, chunk_end, dest))) {
-    return false;
+  const Position chunk_end =
+      internal::ChunkEnd(header, chunk_begin, block_size_);
+  // Assemble the whole chunk, with block headers interleaved at block
+  // boundaries, in a Chain sharing data blocks with chunk.data, and write it
+  // with a single Write(). A destination like FdWriter submits the Chain as
+  // one vectored write instead of a write per section slice.
+  Chain contents;
+  AppendSection(&header_reader, chunk_begin, chunk_end, &contents);
+  AppendSection(&data_reader, chunk_begin, chunk_end, &contents);
+  if (ABSL_PREDICT_FALSE(!dest->Write(std::move(contents)))) {
+    return Fail(*dest);
   }
+  // If the chunk is longer than its header and data, e.g. when it contains
+  // more records than data bytes, the rest is padded with zeros, which a
+  // destination can store sparsely.
   if (ABSL_PREDICT_FALSE(!WritePadding(chunk_begin, chunk_end, dest))) {
     return false;
   }
@@ -80,10 +100,10 @@ bool DefaultChunkWriterBase::WriteChunk(const Chunk& chunk) {
   return true;
 }
 
-inline bool DefaultChunkWriterBase::WriteSection(Reader* src,
-                                                 Position chunk_begin,
-                                                 Position chunk_end,
-                                                 Writer* dest) {
+inline void DefaultChunkWriterBase::AppendSection(Reader* src,
+                                                  Position chunk_begin,
+                                                  Position chunk_end,
+                                                  Chain* dest) {
   Position size;
   if (!src->Size(&size)) {
     RIEGELI_ASSERT_UNREACHABLE()
@@ -91,32 +111,32 @@ inline bool DefaultChunkWriterBase::WriteSection(Reader* src,
   }
   RIEGELI_ASSERT_EQ(src->pos(), 0u) << "Non-zero section reader position";
   while (src->pos() < size) {
-    if (internal::IsBlockBoundary(pos_)) {
+    if (internal::IsBlockBoundary(pos_, block_size_)) {
       internal::BlockHeader block_header(IntCast<uint64_t>(pos_ - chunk_begin),
                                          IntCast<uint64_t>(chunk_end - pos_));
-      if (ABSL_PREDICT_FALSE(!dest->Write(
-              absl::string_view(block_header.bytes(), block_header.size())))) {
-        return Fail(*dest);
-      }
+      dest->Append(
+          absl::string_view(block_header.bytes(), block_header.size()));
       pos_ += block_header.size();
     }
-    const Position length =
-        UnsignedMin(size - src->pos(), internal::RemainingInBlock(pos_));
-    if (ABSL_PREDICT_FALSE(!src->CopyTo(dest, length))) return Fail(*dest);
+    const Position length = UnsignedMin(
+        size - src->pos(), internal::RemainingInBlock(pos_, block_size_));
+    if (!src->Read(dest, IntCast<size_t>(length))) {
+      RIEGELI_ASSERT_UNREACHABLE()
+          << "Reading section failed: " << src->status();
+    }
     pos_ += length;
   }
   if (!src->Close()) {
     RIEGELI_ASSERT_UNREACHABLE()
         << "Closing section reader failed: " << src->status();
   }
-  return true;
 }
 
 inline bool DefaultChunkWriterBase::WritePadding(Position chunk_begin,
                                                  Position chunk_end,
                                                  Writer* dest) {
   while (pos_ < chunk_end) {
-    if (internal::IsBlockBoundary(pos_)) {
+    if (internal::IsBlockBoundary(pos_, block_size_)) {
       internal::BlockHeader block_header(IntCast<uint64_t>(pos_ - chunk_begin),
                                          IntCast<uint64_t>(chunk_end - pos_));
       if (ABSL_PREDICT_FALSE(!dest->Write(
@@ -125,9 +145,9 @@ inline bool DefaultChunkWriterBase::WritePadding(Position chunk_begin,
       }
       pos_ += block_header.size();
     }
-    const Position length =
-        UnsignedMin(chunk_end - pos_, internal::RemainingInBlock(pos_));
-    if (ABSL_PREDICT_FALSE(!WriteZeros(dest, length))) return Fail(*dest);
+    const Position length = UnsignedMin(
+        chunk_end - pos_, internal::RemainingInBlock(pos_, block_size_));
+    if (ABSL_PREDICT_FALSE(!dest->WriteZeros(length))) return Fail(*dest);
     pos_ += length;
   }
   return true;
@@ -136,18 +156,39 @@ inline bool DefaultChunkWriterBase::WritePadding(Position chunk_begin,
 bool DefaultChunkWriterBase::PadToBlockBoundary() {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
   // Matches FutureRecordPosition::FutureChunkBegin::Resolve().
-  size_t length = IntCast<size_t>(internal::RemainingInBlock(pos_));
+  size_t length =
+      IntCast<size_t>(internal::RemainingInBlock(pos_, block_size_));
   if (length == 0) return true;
   if (length < ChunkHeader::size()) {
     // Not enough space for a padding chunk in this block. Write one more block.
-    length += size_t{internal::kUsableBlockSize};
+    length += IntCast<size_t>(block_size_ - internal::BlockHeader::size());
   }
   length -= ChunkHeader::size();
   Chunk chunk;
   const absl::Span<char> buffer = chunk.data.AppendFixedBuffer(length, length);
   std::memset(buffer.data(), '\0', buffer.size());
   chunk.header = ChunkHeader(chunk.data, ChunkType::kPadding, 0, 0);
-  return WriteChunk(chunk);
+  // Write the header section normally, but let WritePadding() write the zero
+  // chunk data: it uses Writer::WriteZeros(), which a destination can store
+  // sparsely, e.g. FdWriter with Options::set_sparse(true). The bytes written
+  // are the same as with WriteChunk().
+  Writer* const dest = dest_writer();
+  StringReader<> header_reader(
+      absl::string_view(chunk.header.bytes(), chunk.header.size()));
+  const Position chunk_begin = pos_;
+  const Position chunk_end =
+      internal::ChunkEnd(chunk.header, chunk_begin, block_size_);
+  Chain contents;
+  AppendSection(&header_reader, chunk_begin, chunk_end, &contents);
+  if (ABSL_PREDICT_FALSE(!dest->Write(std::move(contents)))) {
+    return Fail(*dest);
+  }
+  if (ABSL_PREDICT_FALSE(!WritePadding(chunk_begin, chunk_end, dest))) {
+    return false;
+  }
+  RIEGELI_ASSERT_EQ(pos_, chunk_end)
+      << "Unexpected position after writing padding chunk";
+  return true;
 }
 
 bool DefaultChunkWriterBase::Flush(FlushType flush_type) {
@@ -157,7 +198,36 @@ bool DefaultChunkWriterBase::Flush(FlushType flush_type) {
   return true;
 }
 
+void DefaultChunkWriterBase::SetSizeHint(Position size_hint) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return;
+  dest_writer()->SetSizeHint(size_hint);
+}
+
 template class DefaultChunkWriter<Writer*>;
 template class DefaultChunkWriter<std::unique_ptr<Writer>>;
 
+bool CopyChunks(ChunkReader* src, ChunkWriter* dest) {
+  if (ABSL_PREDICT_FALSE(!src->healthy())) return false;
+  if (ABSL_PREDICT_FALSE(!dest->healthy())) return false;
+  if (dest->pos() == 0) {
+    Chunk signature;
+    signature.header =
+        ChunkHeader(signature.data, ChunkType::kFileSignature, 0, 0);
+    if (ABSL_PREDICT_FALSE(!dest->WriteChunk(signature))) return false;
+  }
+  Chunk chunk;
+  while (src->ReadChunk(&chunk)) {
+    switch (chunk.header.chunk_type()) {
+      case ChunkType::kFileSignature:
+      case ChunkType::kPadding:
+      case ChunkType::kRecordIndex:
+        continue;
+      default:
+        break;
+    }
+    if (ABSL_PREDICT_FALSE(!dest->WriteChunk(chunk))) return false;
+  }
+  return src->healthy();
+}
+
 }  // namespace riegeli
@@ -22,15 +22,22 @@
 #include "absl/types/optional.h"
 #include "absl/utility/utility.h"
 #include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
 #include "riegeli/base/dependency.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/writer.h"
 #include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/records/block.h"
 
 namespace riegeli {
 
+class DefaultChunkReaderBase;
 class Reader;
 
+// Matches the definition in riegeli/records/chunk_reader.h; repeated here so
+// that CopyChunks() can be declared without including that header.
+using ChunkReader = DefaultChunkReaderBase;
+
 // A ChunkWriter writes chunks of a Riegeli/records file (rather than individual
 // records, as RecordWriter does) to a destination.
 //
@@ -53,7 +60,7 @@ class ChunkWriter : public Object {
   //  * false - failure (!healthy())
   virtual bool WriteChunk(const Chunk& chunk) = 0;
 
-  // Writes padding to reach a 64KB block boundary.
+  // Writes padding to reach a block boundary (a multiple of block_size()).
   //
   // Return values:
   //  * true  - success (healthy())
@@ -77,13 +84,25 @@ class ChunkWriter : public Object {
   //  * false - failure (!healthy())
   virtual bool Flush(FlushType flush_type) = 0;
 
+  // Gives a hint of the expected final byte position of the file. A
+  // ChunkWriter writing to a destination which can make use of the hint
+  // forwards it, see Writer::SetSizeHint(). The hint is not a guarantee:
+  // writing less or more data is still correct. By default does nothing.
+  virtual void SetSizeHint(Position size_hint) {}
+
   // Returns the current byte position. Unchanged by Close().
   Position pos() const { return pos_; }
 
+  // Returns the distance between block headers in the file being written,
+  // 64KB unless changed with DefaultChunkWriterBase::Options::
+  // set_block_size(). Unchanged by Close().
+  Position block_size() const { return block_size_; }
+
  protected:
   void Initialize(Position pos) { pos_ = pos; }
 
   Position pos_ = 0;
+  Position block_size_ = internal::kBlockSize;
 };
 
 // Template parameter invariant part of DefaultChunkWriter.
@@ -107,11 +126,42 @@ class DefaultChunkWriterBase : public ChunkWriter {
       return std::move(set_assumed_pos(assumed_pos));
     }
 
+    // Sets the distance between block headers in the file.
+    //
+    // A larger block size reduces the overhead and hash validation of block
+    // headers, and lets readers backed by high latency storage make fewer,
+    // larger reads, at the cost of a coarser granularity of seeking to an
+    // arbitrary byte position. A power of 2 of at least 64KB is recommended.
+    //
+    // The block size is recorded in the file. A file with a non-default block
+    // size cannot be read by readers predating this option, and a reader
+    // which does not start reading from the beginning of the file must be
+    // given the same block size with DefaultChunkReaderBase::Options::
+    // set_block_size().
+    //
+    // Default: internal::kBlockSize (64KB).
+    //
+    // Precondition: block_size >=
+    //               internal::BlockHeader::size() + ChunkHeader::size()
+    Options& set_block_size(Position block_size) & {
+      RIEGELI_ASSERT_GE(block_size,
+                        internal::BlockHeader::size() + ChunkHeader::size())
+          << "Failed precondition of "
+             "DefaultChunkWriterBase::Options::set_block_size(): "
+             "block size too small";
+      block_size_ = block_size;
+      return *this;
+    }
+    Options&& set_block_size(Position block_size) && {
+      return std::move(set_block_size(block_size));
+    }
+
    private:
     template <typename Dest>
     friend class DefaultChunkWriter;
 
     absl::optional<Position> assumed_pos_;
+    Position block_size_ = internal::kBlockSize;
   };
 
   // Returns the Riegeli/records file being written to. Unchanged by Close().
@@ -121,6 +171,7 @@ class DefaultChunkWriterBase : public ChunkWriter {
   bool WriteChunk(const Chunk& chunk) override;
   bool PadToBlockBoundary() override;
   bool Flush(FlushType flush_type) override;
+  void SetSizeHint(Position size_hint) override;
 
  protected:
   explicit DefaultChunkWriterBase(State state) noexcept : ChunkWriter(state) {}
@@ -128,11 +179,14 @@ class DefaultChunkWriterBase : public ChunkWriter {
   DefaultChunkWriterBase(DefaultChunkWriterBase&& that) noexcept;
   DefaultChunkWriterBase& operator=(DefaultChunkWriterBase&& that) noexcept;
 
-  void Initialize(Writer* dest, Position pos);
+  void Initialize(Writer* dest, Position pos, Position block_size);
 
  private:
-  bool WriteSection(Reader* src, Position chunk_begin, Position chunk_end,
-                    Writer* dest);
+  // Appends a section of the chunk, with block headers interleaved at block
+  // boundaries, to *dest. Data blocks are shared with src where possible
+  // instead of being copied.
+  void AppendSection(Reader* src, Position chunk_begin, Position chunk_end,
+                     Chain* dest);
   bool WritePadding(Position chunk_begin, Position chunk_end, Writer* dest);
 };
 
@@ -174,14 +228,40 @@ class DefaultChunkWriter : public DefaultChunkWriterBase {
   Dependency<Writer*, Dest> dest_;
 };
 
+// Copies chunks from src to dest verbatim, without decoding records: chunk
+// data are transferred as stored, and only the interleaving of block headers
+// is recomputed for the destination positions. This allows to concatenate or
+// compact Riegeli/records files at I/O speed, without recompression.
+//
+// Chunks are copied from the current position of src to the end of its file.
+// Chunks which would be wrong or useless in the combined file are skipped:
+// file signature chunks, padding chunks, and record index chunks (a record
+// index would describe positions of the original file). Dictionary chunks are
+// copied, which keeps chunks compressed with them decodable, as long as the
+// order of chunks of each source file is preserved. If dest is at the
+// beginning of its file, a file signature chunk is written first, hence
+// copying whole files yields a valid file.
+//
+// If copying stops because reading failed, e.g. due to data corruption,
+// src->Recover() can skip over the invalid region and CopyChunks() can be
+// called again.
+//
+// Return values:
+//  * true  - success (src->healthy() && dest->healthy())
+//  * false - failure (!src->healthy() || !dest->healthy())
+bool CopyChunks(ChunkReader* src, ChunkWriter* dest);
+
 // Implementation details follow.
 
 inline ChunkWriter::ChunkWriter(ChunkWriter&& that) noexcept
-    : Object(std::move(that)), pos_(absl::exchange(that.pos_, 0)) {}
+    : Object(std::move(that)),
+      pos_(absl::exchange(that.pos_, 0)),
+      block_size_(absl::exchange(that.block_size_, internal::kBlockSize)) {}
 
 inline ChunkWriter& ChunkWriter::operator=(ChunkWriter&& that) noexcept {
   Object::operator=(std::move(that));
   pos_ = absl::exchange(that.pos_, 0);
+  block_size_ = absl::exchange(that.block_size_, internal::kBlockSize);
   return *this;
 }
 
@@ -198,7 +278,8 @@ inline DefaultChunkWriterBase& DefaultChunkWriterBase::operator=(
 template <typename Dest>
 DefaultChunkWriter<Dest>::DefaultChunkWriter(Dest dest, Options options)
     : DefaultChunkWriterBase(State::kOpen), dest_(std::move(dest)) {
-  Initialize(dest_.get(), options.assumed_pos_.value_or(dest_->pos()));
+  Initialize(dest_.get(), options.assumed_pos_.value_or(dest_->pos()),
+             options.block_size_);
 }
 
 template <typename Dest>
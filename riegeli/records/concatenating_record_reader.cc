@@ -0,0 +1,100 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/records/concatenating_record_reader.h"
+
+#include <stddef.h>
+
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "absl/base/optimization.h"
+#include "absl/strings/string_view.h"
+#include "absl/utility/utility.h"
+#include "google/protobuf/message_lite.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/object.h"
+#include "riegeli/bytes/reader.h"
+#include "riegeli/records/chunk_reader.h"
+#include "riegeli/records/record_position.h"
+#include "riegeli/records/record_reader.h"
+
+namespace riegeli {
+
+ConcatenatingRecordReaderBase::ConcatenatingRecordReaderBase(
+    State state) noexcept
+    : Object(state) {}
+
+ConcatenatingRecordReaderBase::ConcatenatingRecordReaderBase(
+    ConcatenatingRecordReaderBase&& that) noexcept
+    : Object(std::move(that)),
+      current_file_index_(absl::exchange(that.current_file_index_, 0)) {}
+
+ConcatenatingRecordReaderBase& ConcatenatingRecordReaderBase::operator=(
+    ConcatenatingRecordReaderBase&& that) noexcept {
+  Object::operator=(std::move(that));
+  current_file_index_ = absl::exchange(that.current_file_index_, 0);
+  return *this;
+}
+
+void ConcatenatingRecordReaderBase::Done() {
+  RecordReaderBase* const file = file_reader();
+  if (file != nullptr) {
+    if (ABSL_PREDICT_FALSE(!file->Close())) Fail(*file);
+  }
+  CloseFilesAhead();
+}
+
+template <typename Record>
+bool ConcatenatingRecordReaderBase::ReadRecordImpl(Record* record,
+                                                   RecordPosition* key) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  for (;;) {
+    RecordReaderBase* const file = file_reader();
+    if (ABSL_PREDICT_FALSE(file == nullptr)) return false;
+    if (ABSL_PREDICT_TRUE(file->ReadRecord(record, key))) return true;
+    if (ABSL_PREDICT_FALSE(!file->healthy())) return Fail(*file);
+    // The current file is drained. Close() verifies that it ends cleanly at
+    // a chunk boundary rather than being truncated.
+    if (ABSL_PREDICT_FALSE(!file->Close())) return Fail(*file);
+    if (!OpenNextFile()) return false;
+  }
+}
+
+bool ConcatenatingRecordReaderBase::ReadRecord(
+    google::protobuf::MessageLite* record, RecordPosition* key) {
+  return ReadRecordImpl(record, key);
+}
+
+bool ConcatenatingRecordReaderBase::ReadRecord(absl::string_view* record,
+                                               RecordPosition* key) {
+  return ReadRecordImpl(record, key);
+}
+
+bool ConcatenatingRecordReaderBase::ReadRecord(std::string* record,
+                                               RecordPosition* key) {
+  return ReadRecordImpl(record, key);
+}
+
+bool ConcatenatingRecordReaderBase::ReadRecord(Chain* record,
+                                               RecordPosition* key) {
+  return ReadRecordImpl(record, key);
+}
+
+template class ConcatenatingRecordReader<std::unique_ptr<Reader>>;
+template class ConcatenatingRecordReader<std::unique_ptr<ChunkReader>>;
+
+}  // namespace riegeli
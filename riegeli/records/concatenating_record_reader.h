@@ -0,0 +1,309 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_RECORDS_CONCATENATING_RECORD_READER_H_
+#define RIEGELI_RECORDS_CONCATENATING_RECORD_READER_H_
+
+#include <stddef.h>
+
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "absl/base/optimization.h"
+#include "absl/strings/string_view.h"
+#include "absl/utility/utility.h"
+#include "google/protobuf/message_lite.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/object.h"
+#include "riegeli/base/parallelism.h"
+#include "riegeli/bytes/reader.h"
+#include "riegeli/records/chunk_reader.h"
+#include "riegeli/records/record_position.h"
+#include "riegeli/records/record_reader.h"
+
+namespace riegeli {
+
+// Template parameter invariant part of ConcatenatingRecordReader.
+class ConcatenatingRecordReaderBase : public Object {
+ public:
+  class Options {
+   public:
+    Options() noexcept {}
+
+    // Sets options of the file RecordReaders.
+    //
+    // If set_parallelism() is used in these options, consecutive files share
+    // the thread pool for background decoding.
+    //
+    // Default: RecordReaderBase::Options().
+    Options& set_record_reader_options(
+        RecordReaderBase::Options record_reader_options) & {
+      record_reader_options_ = std::move(record_reader_options);
+      return *this;
+    }
+    Options&& set_record_reader_options(
+        RecordReaderBase::Options record_reader_options) && {
+      return std::move(
+          set_record_reader_options(std::move(record_reader_options)));
+    }
+
+    // Sets the number of files opened ahead in background while the current
+    // file is being read, so that per-file open latency does not insert a
+    // pause between files. Opening a file ahead reads its header, checking
+    // the file format.
+    //
+    // Default: 1.
+    Options& set_open_ahead(size_t open_ahead) & {
+      RIEGELI_ASSERT_GT(open_ahead, 0u)
+          << "Failed precondition of "
+             "ConcatenatingRecordReaderBase::Options::set_open_ahead(): "
+             "zero open ahead";
+      open_ahead_ = open_ahead;
+      return *this;
+    }
+    Options&& set_open_ahead(size_t open_ahead) && {
+      return std::move(set_open_ahead(open_ahead));
+    }
+
+   private:
+    friend class ConcatenatingRecordReaderBase;
+    template <typename Src>
+    friend class ConcatenatingRecordReader;
+
+    RecordReaderBase::Options record_reader_options_;
+    size_t open_ahead_ = 1;
+  };
+
+  // Returns the number of files.
+  virtual size_t num_srcs() const = 0;
+
+  // Returns the index of the file which the next record will be read from,
+  // or num_srcs() when all files are drained.
+  size_t current_file_index() const { return current_file_index_; }
+
+  // Reads the next record of the concatenated record stream. When the
+  // current file is drained, reading continues transparently with the next
+  // file, which was opened in background.
+  //
+  // If key != nullptr, *key is set to the canonical record position within
+  // the current file on success; current_file_index() identifies the file.
+  //
+  // Return values:
+  //  * true                    - success (*record is set)
+  //  * false (when healthy())  - all files are drained
+  //  * false (when !healthy()) - failure
+  bool ReadRecord(google::protobuf::MessageLite* record,
+                  RecordPosition* key = nullptr);
+  bool ReadRecord(absl::string_view* record, RecordPosition* key = nullptr);
+  bool ReadRecord(std::string* record, RecordPosition* key = nullptr);
+  bool ReadRecord(Chain* record, RecordPosition* key = nullptr);
+
+ protected:
+  explicit ConcatenatingRecordReaderBase(State state) noexcept;
+
+  ConcatenatingRecordReaderBase(ConcatenatingRecordReaderBase&& that) noexcept;
+  ConcatenatingRecordReaderBase& operator=(
+      ConcatenatingRecordReaderBase&& that) noexcept;
+
+  // Closes the current file and the files opened ahead.
+  void Done() override;
+
+  // Returns the RecordReader of the current file, or nullptr when all files
+  // are drained.
+  virtual RecordReaderBase* file_reader() = 0;
+
+  // Replaces the drained current file with the oldest file opened ahead and
+  // schedules opening of a further file. Returns false if there are no more
+  // files, or on failure, with this ConcatenatingRecordReaderBase failed.
+  virtual bool OpenNextFile() = 0;
+
+  // Closes the files opened ahead without reading them, ignoring their
+  // results.
+  virtual void CloseFilesAhead() = 0;
+
+  // Index of the file which the next record will be read from.
+  //
+  // Invariant: current_file_index_ <= num_srcs()
+  size_t current_file_index_ = 0;
+
+ private:
+  template <typename Record>
+  bool ReadRecordImpl(Record* record, RecordPosition* key);
+};
+
+// ConcatenatingRecordReader reads records from a sequence of Riegeli/records
+// files, presenting them as one record stream. While the current file is
+// being read, the next files are opened in background and their headers
+// read, so that per-file open latency does not insert a pause between files.
+//
+// Files are opened on demand by src_factory, which is called with the file
+// index (starting from 0) and returns the object providing and possibly
+// owning the byte Reader or ChunkReader of the file, like the Src template
+// parameter of RecordReader. src_factory is called from background threads,
+// possibly several at a time.
+template <typename Src = Reader*>
+class ConcatenatingRecordReader : public ConcatenatingRecordReaderBase {
+ public:
+  // Creates a closed ConcatenatingRecordReader.
+  ConcatenatingRecordReader() noexcept
+      : ConcatenatingRecordReaderBase(State::kClosed) {}
+
+  // Will read from the num_srcs files provided by src_factory(0) up to
+  // src_factory(num_srcs - 1), in order.
+  explicit ConcatenatingRecordReader(
+      size_t num_srcs, std::function<Src(size_t file_index)> src_factory,
+      Options options = Options());
+
+  ConcatenatingRecordReader(ConcatenatingRecordReader&& that) noexcept;
+  ConcatenatingRecordReader& operator=(
+      ConcatenatingRecordReader&& that) noexcept;
+
+  size_t num_srcs() const override { return num_srcs_; }
+
+ protected:
+  RecordReaderBase* file_reader() override {
+    return current_file_index_ < num_srcs_ ? &reader_ : nullptr;
+  }
+
+  bool OpenNextFile() override;
+  void CloseFilesAhead() override;
+
+ private:
+  // Schedules opening of files in background until open_ahead_ opens are
+  // pending or all files are scheduled.
+  void FillReadersAhead();
+
+  size_t num_srcs_ = 0;
+  std::function<Src(size_t file_index)> src_factory_;
+  RecordReaderBase::Options record_reader_options_;
+  // See Options::set_open_ahead().
+  size_t open_ahead_ = 1;
+  // Index of the next file to schedule opening of.
+  //
+  // Invariant: next_to_open_ <= num_srcs_
+  size_t next_to_open_ = 0;
+  RecordReader<Src> reader_;
+  // Files being opened in background, oldest first.
+  std::deque<std::future<RecordReader<Src>>> readers_ahead_;
+};
+
+// Implementation details follow.
+
+template <typename Src>
+ConcatenatingRecordReader<Src>::ConcatenatingRecordReader(
+    size_t num_srcs, std::function<Src(size_t file_index)> src_factory,
+    Options options)
+    : ConcatenatingRecordReaderBase(State::kOpen),
+      num_srcs_(num_srcs),
+      src_factory_(std::move(src_factory)),
+      record_reader_options_(std::move(options.record_reader_options_)),
+      open_ahead_(options.open_ahead_) {
+  if (num_srcs_ == 0) return;
+  reader_ = RecordReader<Src>(src_factory_(0), record_reader_options_);
+  next_to_open_ = 1;
+  if (ABSL_PREDICT_FALSE(!reader_.healthy())) {
+    Fail(reader_);
+    return;
+  }
+  FillReadersAhead();
+}
+
+template <typename Src>
+inline ConcatenatingRecordReader<Src>::ConcatenatingRecordReader(
+    ConcatenatingRecordReader&& that) noexcept
+    : ConcatenatingRecordReaderBase(std::move(that)),
+      num_srcs_(absl::exchange(that.num_srcs_, 0)),
+      src_factory_(std::move(that.src_factory_)),
+      record_reader_options_(std::move(that.record_reader_options_)),
+      open_ahead_(absl::exchange(that.open_ahead_, 1)),
+      next_to_open_(absl::exchange(that.next_to_open_, 0)),
+      reader_(std::move(that.reader_)),
+      readers_ahead_(std::move(that.readers_ahead_)) {}
+
+template <typename Src>
+inline ConcatenatingRecordReader<Src>&
+ConcatenatingRecordReader<Src>::operator=(
+    ConcatenatingRecordReader&& that) noexcept {
+  ConcatenatingRecordReaderBase::operator=(std::move(that));
+  num_srcs_ = absl::exchange(that.num_srcs_, 0);
+  src_factory_ = std::move(that.src_factory_);
+  record_reader_options_ = std::move(that.record_reader_options_);
+  open_ahead_ = absl::exchange(that.open_ahead_, 1);
+  next_to_open_ = absl::exchange(that.next_to_open_, 0);
+  reader_ = std::move(that.reader_);
+  readers_ahead_ = std::move(that.readers_ahead_);
+  return *this;
+}
+
+template <typename Src>
+void ConcatenatingRecordReader<Src>::FillReadersAhead() {
+  while (readers_ahead_.size() < open_ahead_ && next_to_open_ < num_srcs_) {
+    const size_t file_index = next_to_open_++;
+    std::promise<RecordReader<Src>>* const reader_promise =
+        new std::promise<RecordReader<Src>>();
+    readers_ahead_.push_back(reader_promise->get_future());
+    // The task does not refer to this ConcatenatingRecordReader so that it
+    // remains valid if this ConcatenatingRecordReader is moved.
+    const std::function<Src(size_t)> src_factory = src_factory_;
+    const RecordReaderBase::Options record_reader_options =
+        record_reader_options_;
+    internal::ThreadPool::global_io().Schedule(
+        [file_index, src_factory, record_reader_options, reader_promise] {
+          RecordReader<Src> reader(src_factory(file_index),
+                                   record_reader_options);
+          // Read the file header ahead; failure is reported when the file
+          // becomes current.
+          reader.CheckFileFormat();
+          reader_promise->set_value(std::move(reader));
+          delete reader_promise;
+        });
+  }
+}
+
+template <typename Src>
+bool ConcatenatingRecordReader<Src>::OpenNextFile() {
+  ++current_file_index_;
+  if (readers_ahead_.empty()) {
+    RIEGELI_ASSERT_EQ(current_file_index_, num_srcs_)
+        << "Failed invariant of ConcatenatingRecordReader: "
+           "no file opened ahead before the last file is drained";
+    return false;
+  }
+  reader_ = readers_ahead_.front().get();
+  readers_ahead_.pop_front();
+  FillReadersAhead();
+  if (ABSL_PREDICT_FALSE(!reader_.healthy())) return Fail(reader_);
+  return true;
+}
+
+template <typename Src>
+void ConcatenatingRecordReader<Src>::CloseFilesAhead() {
+  while (!readers_ahead_.empty()) {
+    RecordReader<Src> reader = readers_ahead_.front().get();
+    readers_ahead_.pop_front();
+    reader.Close();
+  }
+}
+
+extern template class ConcatenatingRecordReader<std::unique_ptr<Reader>>;
+extern template class ConcatenatingRecordReader<std::unique_ptr<ChunkReader>>;
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_RECORDS_CONCATENATING_RECORD_READER_H_
@@ -90,26 +90,30 @@ std::ostream& operator<<(std::ostream& out, RecordPosition pos) {
 }
 
 inline FutureRecordPosition::FutureChunkBegin::FutureChunkBegin(
-    Position pos_before_chunks, std::vector<Action> actions)
-    : pos_before_chunks_(pos_before_chunks), actions_(std::move(actions)) {}
+    Position pos_before_chunks, std::vector<Action> actions,
+    Position block_size)
+    : pos_before_chunks_(pos_before_chunks),
+      actions_(std::move(actions)),
+      block_size_(block_size) {}
 
 void FutureRecordPosition::FutureChunkBegin::Resolve() const {
   struct Visitor {
     void operator()(const std::shared_future<ChunkHeader>& chunk_header) {
       // Matches DefaultChunkWriterBase::WriteChunk().
-      pos = internal::ChunkEnd(chunk_header.get(), pos);
+      pos = internal::ChunkEnd(chunk_header.get(), pos, block_size);
     }
     void operator()(const PadToBlockBoundary&) {
       // Matches DefaultChunkWriterBase::PadToBlockBoundary().
-      Position length = internal::RemainingInBlock(pos);
+      Position length = internal::RemainingInBlock(pos, block_size);
       if (length == 0) return;
-      if (length < ChunkHeader::size()) length += internal::kBlockSize;
+      if (length < ChunkHeader::size()) length += block_size;
       pos += length;
     }
 
     Position pos;
+    Position block_size;
   };
-  Visitor visitor{pos_before_chunks_};
+  Visitor visitor{pos_before_chunks_, block_size_};
   for (const Action& action : actions_) {
     absl::visit(visitor, action);
   }
@@ -119,11 +123,13 @@ void FutureRecordPosition::FutureChunkBegin::Resolve() const {
 
 FutureRecordPosition::FutureRecordPosition(Position pos_before_chunks,
                                            std::vector<Action> actions,
+                                           Position block_size,
                                            uint64_t record_index)
-    : future_chunk_begin_(actions.empty()
-                              ? nullptr
-                              : absl::make_unique<FutureChunkBegin>(
-                                    pos_before_chunks, std::move(actions))),
+    : future_chunk_begin_(
+          actions.empty() ? nullptr
+                          : absl::make_unique<FutureChunkBegin>(
+                                pos_before_chunks, std::move(actions),
+                                block_size)),
       chunk_begin_(pos_before_chunks),
       record_index_(record_index) {}
 
@@ -113,7 +113,7 @@ class FutureRecordPosition {
   explicit FutureRecordPosition(RecordPosition pos) noexcept;
 
   FutureRecordPosition(Position pos_before_chunks, std::vector<Action> actions,
-                       uint64_t record_index);
+                       Position block_size, uint64_t record_index);
 
   FutureRecordPosition(const FutureRecordPosition& that);
   FutureRecordPosition& operator=(const FutureRecordPosition& that);
@@ -201,7 +201,7 @@ inline HashState AbslHashValue(HashState hash_state, RecordPosition self) {
 class FutureRecordPosition::FutureChunkBegin {
  public:
   explicit FutureChunkBegin(Position pos_before_chunks,
-                            std::vector<Action> actions);
+                            std::vector<Action> actions, Position block_size);
 
   FutureChunkBegin(const FutureChunkBegin&) = delete;
   FutureChunkBegin& operator=(const FutureChunkBegin&) = delete;
@@ -216,6 +216,8 @@ class FutureRecordPosition::FutureChunkBegin {
   mutable Position pos_before_chunks_ = 0;
   // Headers of chunks to be written after pos_before_chunks_.
   mutable std::vector<Action> actions_;
+  // The distance between block headers in the file, for resolving actions_.
+  Position block_size_ = 0;
 };
 
 inline Position FutureRecordPosition::FutureChunkBegin::get() const {
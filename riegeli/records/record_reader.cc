@@ -17,15 +17,24 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <future>
+#include <limits>
 #include <memory>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include "absl/base/optimization.h"
+#include "absl/container/flat_hash_map.h"
 #include "absl/memory/memory.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
 #include "absl/utility/utility.h"
 #include "google/protobuf/descriptor.h"
 #include "google/protobuf/descriptor.pb.h"
@@ -34,15 +43,21 @@
 #include "riegeli/base/base.h"
 #include "riegeli/base/canonical_errors.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/memory.h"
 #include "riegeli/base/object.h"
+#include "riegeli/base/parallelism.h"
+#include "riegeli/base/stats_sink.h"
 #include "riegeli/base/status.h"
 #include "riegeli/bytes/chain_backward_writer.h"
 #include "riegeli/bytes/chain_reader.h"
+#include "riegeli/bytes/fd_reader.h"
 #include "riegeli/bytes/message_parse.h"
 #include "riegeli/bytes/reader.h"
+#include "riegeli/bytes/reader_utils.h"
 #include "riegeli/chunk_encoding/chunk.h"
 #include "riegeli/chunk_encoding/chunk_decoder.h"
 #include "riegeli/chunk_encoding/constants.h"
+#include "riegeli/chunk_encoding/hash.h"
 #include "riegeli/chunk_encoding/transpose_decoder.h"
 #include "riegeli/records/chunk_reader.h"
 #include "riegeli/records/record_position.h"
@@ -51,6 +66,32 @@
 
 namespace riegeli {
 
+namespace {
+
+// Process-wide cache of descriptor pools compiled from metadata, keyed by a
+// hash of the serialized RecordsMetadata. Datasets sharded over many files
+// typically repeat byte-identical metadata, hence descriptors are compiled
+// once per process instead of once per file. Bounded by clearing, so that
+// pathologically diverse metadata does not accumulate pools; a forgotten
+// pool is merely compiled again.
+constexpr size_t kMaxCachedDescriptorPools = 64;
+
+absl::Mutex* DescriptorPoolCacheMutex() {
+  static NoDestructor<absl::Mutex> kMutex;
+  return &*kMutex;
+}
+
+absl::flat_hash_map<uint64_t,
+                    std::shared_ptr<const google::protobuf::DescriptorPool>>*
+DescriptorPoolCache() {
+  static NoDestructor<absl::flat_hash_map<
+      uint64_t, std::shared_ptr<const google::protobuf::DescriptorPool>>>
+      kCache;
+  return &*kCache;
+}
+
+}  // namespace
+
 class RecordsMetadataDescriptors::ErrorCollector
     : public google::protobuf::DescriptorPool::ErrorCollector {
  public:
@@ -80,15 +121,32 @@ RecordsMetadataDescriptors::RecordsMetadataDescriptors(
     const RecordsMetadata& metadata)
     : Object(State::kOpen), record_type_name_(metadata.record_type_name()) {
   if (record_type_name_.empty() || metadata.file_descriptor().empty()) return;
-  pool_ = absl::make_unique<google::protobuf::DescriptorPool>();
+  const uint64_t cache_key = internal::Hash(metadata.SerializeAsString());
+  {
+    absl::MutexLock lock(DescriptorPoolCacheMutex());
+    const auto iter = DescriptorPoolCache()->find(cache_key);
+    if (iter != DescriptorPoolCache()->end()) {
+      pool_ = iter->second;
+      return;
+    }
+  }
+  std::unique_ptr<google::protobuf::DescriptorPool> pool =
+      absl::make_unique<google::protobuf::DescriptorPool>();
   ErrorCollector error_collector(this);
   for (const google::protobuf::FileDescriptorProto& file_descriptor :
        metadata.file_descriptor()) {
-    if (ABSL_PREDICT_FALSE(pool_->BuildFileCollectingErrors(
+    if (ABSL_PREDICT_FALSE(pool->BuildFileCollectingErrors(
                                file_descriptor, &error_collector) == nullptr)) {
       return;
     }
   }
+  pool_ = std::move(pool);
+  absl::MutexLock lock(DescriptorPoolCacheMutex());
+  if (ABSL_PREDICT_FALSE(DescriptorPoolCache()->size() >=
+                         kMaxCachedDescriptorPools)) {
+    DescriptorPoolCache()->clear();
+  }
+  DescriptorPoolCache()->emplace(cache_key, pool_);
 }
 
 const google::protobuf::Descriptor* RecordsMetadataDescriptors::descriptor()
@@ -104,7 +162,26 @@ RecordReaderBase::RecordReaderBase(RecordReaderBase&& that) noexcept
       chunk_begin_(absl::exchange(that.chunk_begin_, 0)),
       chunk_decoder_(std::move(that.chunk_decoder_)),
       recoverable_(absl::exchange(that.recoverable_, Recoverable::kNo)),
-      recovery_(absl::exchange(that.recovery_, nullptr)) {}
+      recovery_(absl::exchange(that.recovery_, nullptr)),
+      parallelism_(absl::exchange(that.parallelism_, 0)),
+      thread_pool_(absl::exchange(that.thread_pool_, nullptr)),
+      chunk_decoder_options_(std::move(that.chunk_decoder_options_)),
+      zstd_dictionary_(std::move(that.zstd_dictionary_)),
+      decoders_ahead_(std::move(that.decoders_ahead_)),
+      pending_skipped_regions_(std::move(that.pending_skipped_regions_)),
+      chunk_end_(absl::exchange(that.chunk_end_, 0)),
+      decoded_chunk_cache_size_(
+          absl::exchange(that.decoded_chunk_cache_size_, 0)),
+      cached_chunks_(std::move(that.cached_chunks_)),
+      cached_chunk_index_(std::move(that.cached_chunk_index_)),
+      use_record_index_(absl::exchange(that.use_record_index_, false)),
+      speculative_search_(absl::exchange(that.speculative_search_, false)),
+      stats_sink_(absl::exchange(that.stats_sink_, nullptr)),
+      record_index_loaded_(absl::exchange(that.record_index_loaded_, false)),
+      record_index_absent_(absl::exchange(that.record_index_absent_, false)),
+      record_index_has_statistics_(
+          absl::exchange(that.record_index_has_statistics_, false)),
+      record_index_(std::move(that.record_index_)) {}
 
 RecordReaderBase& RecordReaderBase::operator=(
     RecordReaderBase&& that) noexcept {
@@ -113,6 +190,24 @@ RecordReaderBase& RecordReaderBase::operator=(
   chunk_decoder_ = std::move(that.chunk_decoder_);
   recoverable_ = absl::exchange(that.recoverable_, Recoverable::kNo);
   recovery_ = absl::exchange(that.recovery_, nullptr);
+  parallelism_ = absl::exchange(that.parallelism_, 0);
+  thread_pool_ = absl::exchange(that.thread_pool_, nullptr);
+  chunk_decoder_options_ = std::move(that.chunk_decoder_options_);
+  zstd_dictionary_ = std::move(that.zstd_dictionary_);
+  decoders_ahead_ = std::move(that.decoders_ahead_);
+  pending_skipped_regions_ = std::move(that.pending_skipped_regions_);
+  chunk_end_ = absl::exchange(that.chunk_end_, 0);
+  decoded_chunk_cache_size_ = absl::exchange(that.decoded_chunk_cache_size_, 0);
+  cached_chunks_ = std::move(that.cached_chunks_);
+  cached_chunk_index_ = std::move(that.cached_chunk_index_);
+  use_record_index_ = absl::exchange(that.use_record_index_, false);
+  speculative_search_ = absl::exchange(that.speculative_search_, false);
+  stats_sink_ = absl::exchange(that.stats_sink_, nullptr);
+  record_index_loaded_ = absl::exchange(that.record_index_loaded_, false);
+  record_index_absent_ = absl::exchange(that.record_index_absent_, false);
+  record_index_has_statistics_ =
+      absl::exchange(that.record_index_has_statistics_, false);
+  record_index_ = std::move(that.record_index_);
   return *this;
 }
 
@@ -121,10 +216,34 @@ void RecordReaderBase::Initialize(ChunkReader* src, Options&& options) {
       << "Failed precondition of RecordReader<Src>::RecordReader(Src): "
          "null ChunkReader pointer";
   if (ABSL_PREDICT_FALSE(!src->healthy())) Fail(*src);
+  // Only disabling verification is propagated, so that a ChunkReader
+  // constructed with verification already disabled keeps its setting.
+  if (ABSL_PREDICT_FALSE(!options.verify_hashes_)) {
+    src->set_verify_hashes(false);
+  }
+  // Similarly, only enabling sharding is propagated.
+  if (ABSL_PREDICT_FALSE(options.num_shards_ > 1)) {
+    src->set_shard(options.shard_index_, options.num_shards_);
+  }
+  // Similarly, only enabling skipping of metadata is propagated.
+  if (ABSL_PREDICT_FALSE(options.skip_metadata_)) {
+    src->set_skip_metadata(true);
+  }
   chunk_begin_ = src->pos();
-  chunk_decoder_ = ChunkDecoder(ChunkDecoder::Options().set_field_projection(
-      std::move(options.field_projection_)));
+  chunk_decoder_options_ =
+      ChunkDecoder::Options()
+          .set_field_projection(std::move(options.field_projection_))
+          .set_streaming(options.streaming_decoding_)
+          .set_record_filter(std::move(options.record_filter_))
+          .set_decoded_chunk_cache(options.decoded_chunk_cache_);
+  chunk_decoder_ = ChunkDecoder(chunk_decoder_options_);
   recovery_ = std::move(options.recovery_);
+  parallelism_ = options.parallelism_;
+  thread_pool_ = options.thread_pool_;
+  decoded_chunk_cache_size_ = options.decoded_chunk_cache_size_;
+  use_record_index_ = options.use_record_index_;
+  speculative_search_ = options.speculative_search_;
+  stats_sink_ = options.stats_sink_;
 }
 
 void RecordReaderBase::Done() {
@@ -136,6 +255,8 @@ bool RecordReaderBase::CheckFileFormat() {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
   ChunkReader* const src = src_chunk_reader();
   if (chunk_decoder_.index() < chunk_decoder_.num_records()) return true;
+  // Chunks read ahead imply that the file format was already checked.
+  if (ABSL_PREDICT_FALSE(!decoders_ahead_.empty())) return true;
   if (ABSL_PREDICT_FALSE(!src->CheckFileFormat())) {
     chunk_decoder_.Reset();
     if (ABSL_PREDICT_FALSE(!src->healthy())) {
@@ -230,8 +351,8 @@ inline bool RecordReaderBase::ParseMetadata(const Chunk& chunk,
                     chunk.header.decoded_data_size()));
   std::vector<size_t> limits;
   const bool ok = transpose_decoder.Reset(
-      &data_reader, 1, chunk.header.decoded_data_size(), FieldProjection::All(),
-      &serialized_metadata_writer, &limits);
+      &data_reader, 1, chunk.header.decoded_data_size(), false,
+      FieldProjection::All(), &serialized_metadata_writer, &limits);
   if (ABSL_PREDICT_FALSE(!serialized_metadata_writer.Close())) {
     return Fail(serialized_metadata_writer);
   }
@@ -290,6 +411,108 @@ template bool RecordReaderBase::ReadRecordSlow(std::string* record,
 template bool RecordReaderBase::ReadRecordSlow(Chain* record,
                                                RecordPosition* key);
 
+template <typename Record>
+size_t RecordReaderBase::ReadRecordsSlow(std::vector<Record>* records,
+                                         size_t max_records,
+                                         RecordPosition* first_key) {
+  if (ABSL_PREDICT_FALSE(max_records == 0)) return 0;
+  if (chunk_decoder_.healthy()) {
+    RIEGELI_ASSERT_EQ(chunk_decoder_.index(), chunk_decoder_.num_records())
+        << "Failed precondition of RecordReaderBase::ReadRecordsSlow(): "
+           "records available, use ReadRecords() instead";
+  }
+  if (ABSL_PREDICT_FALSE(!healthy())) {
+    if (!TryRecovery()) return 0;
+    goto again;
+  }
+  for (;;) {
+    if (ABSL_PREDICT_FALSE(!chunk_decoder_.healthy())) {
+      recoverable_ = Recoverable::kRecoverChunkDecoder;
+      Fail(chunk_decoder_);
+      if (!TryRecovery()) return 0;
+      goto again;
+    }
+    if (ABSL_PREDICT_FALSE(!ReadChunk())) {
+      if (!TryRecovery()) return 0;
+    }
+    // Retrying from here is equivalent to calling ReadRecords() again
+    // (not ReadRecordsSlow()).
+  again:
+    const uint64_t first_index = chunk_decoder_.index();
+    const size_t num_read = chunk_decoder_.ReadRecords(records, max_records);
+    if (ABSL_PREDICT_TRUE(num_read > 0)) {
+      if (first_key != nullptr) {
+        *first_key = RecordPosition(chunk_begin_, first_index);
+      }
+      return num_read;
+    }
+  }
+}
+
+template size_t RecordReaderBase::ReadRecordsSlow(
+    std::vector<absl::string_view>* records, size_t max_records,
+    RecordPosition* first_key);
+template size_t RecordReaderBase::ReadRecordsSlow(std::vector<Chain>* records,
+                                                  size_t max_records,
+                                                  RecordPosition* first_key);
+
+void RecordReaderBase::ReadAheadHint(uint64_t num_records) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return;
+  ChunkReader* const src = src_chunk_reader();
+  if (ABSL_PREDICT_FALSE(parallelism_ > 0)) {
+    // Start background decoding now instead of at the next read.
+    FillDecodersAhead(src);
+  }
+  // Records still buffered in the current chunk need no further reading.
+  const uint64_t decoded_records =
+      chunk_decoder_.num_records() - chunk_decoder_.index();
+  if (num_records <= decoded_records) return;
+  const uint64_t remaining_records = num_records - decoded_records;
+  Position hint_end;
+  if (record_index_loaded_) {
+    // The index tells exactly where the hinted records end. Find the first
+    // indexed chunk after the current chunk; records past the current chunk
+    // begin there.
+    const std::vector<IndexedChunk>::const_iterator iter = std::upper_bound(
+        record_index_.cbegin(), record_index_.cend(), chunk_begin_,
+        [](Position chunk_begin, const IndexedChunk& entry) {
+          return chunk_begin < entry.chunk_begin;
+        });
+    if (ABSL_PREDICT_FALSE(iter == record_index_.cend())) return;
+    // The first indexed chunk whose records are all past the hinted range
+    // bounds the range; the last entry is the sentinel at the end of records.
+    const uint64_t end_ordinal =
+        SaturatingAdd(iter->first_record_ordinal, remaining_records);
+    const std::vector<IndexedChunk>::const_iterator end_iter =
+        std::lower_bound(iter, record_index_.cend(), end_ordinal,
+                         [](const IndexedChunk& entry, uint64_t end_ordinal) {
+                           return entry.first_record_ordinal < end_ordinal;
+                         });
+    hint_end = end_iter == record_index_.cend()
+                   ? record_index_.back().chunk_begin
+                   : end_iter->chunk_begin;
+  } else if (chunk_decoder_.num_records() > 0 && chunk_end_ > chunk_begin_) {
+    // Without an index, estimate the range from the record density of the
+    // current chunk.
+    const Position bytes_per_record = UnsignedMax(
+        (chunk_end_ - chunk_begin_) / chunk_decoder_.num_records(),
+        Position{1});
+    const Position hint_length =
+        UnsignedMin(remaining_records,
+                    std::numeric_limits<Position>::max() / bytes_per_record) *
+        bytes_per_record;
+    hint_end = SaturatingAdd(src->pos(), hint_length);
+  } else {
+    // Nothing is known about record sizes yet.
+    return;
+  }
+  Reader* const byte_src = src->src_reader();
+  if (hint_end <= byte_src->pos()) return;
+  byte_src->ReadHint(IntCast<size_t>(
+      UnsignedMin(hint_end - byte_src->pos(),
+                  Position{std::numeric_limits<size_t>::max()})));
+}
+
 bool RecordReaderBase::Recover(SkippedRegion* skipped_region) {
   if (recoverable_ == Recoverable::kNo) return false;
   ChunkReader* const src = src_chunk_reader();
@@ -342,14 +565,19 @@ bool RecordReaderBase::Seek(RecordPosition new_pos) {
   if (ABSL_PREDICT_FALSE(!healthy())) return TryRecovery();
   ChunkReader* const src = src_chunk_reader();
   if (new_pos.chunk_begin() == chunk_begin_) {
-    if (new_pos.record_index() == 0 || src->pos() > chunk_begin_) {
+    if (new_pos.record_index() == 0 ||
+        pos_after_current_chunk(src->pos()) > chunk_begin_) {
       // Seeking to the beginning of a chunk does not need reading the chunk,
       // which is important because it may be non-existent at end of file.
       //
-      // If src->pos() > chunk_begin_, the chunk is already read.
+      // If the position after the current chunk is greater than chunk_begin_,
+      // the chunk is already read.
       goto skip_reading_chunk;
     }
   } else {
+    decoders_ahead_.clear();
+    pending_skipped_regions_.clear();
+    CacheCurrentChunk();
     if (ABSL_PREDICT_FALSE(!src->Seek(new_pos.chunk_begin()))) {
       chunk_begin_ = src->pos();
       chunk_decoder_.Reset();
@@ -374,11 +602,26 @@ skip_reading_chunk:
 bool RecordReaderBase::Seek(Position new_pos) {
   if (ABSL_PREDICT_FALSE(!healthy())) return TryRecovery();
   ChunkReader* const src = src_chunk_reader();
-  if (new_pos >= chunk_begin_ && new_pos <= src->pos()) {
+  if (new_pos >= chunk_begin_ &&
+      new_pos <= pos_after_current_chunk(src->pos())) {
     // Seeking inside or just after the current chunk which has been read,
     // or to the beginning of the current chunk which has been located,
     // or to the end of file which has been reached.
   } else {
+    if (ABSL_PREDICT_FALSE(use_record_index_)) {
+      if (!record_index_loaded_ && !record_index_absent_) {
+        if (ABSL_PREDICT_FALSE(
+                !LoadRecordIndex(/*missing_index_ok=*/true))) {
+          return TryRecovery();
+        }
+      }
+      if (ABSL_PREDICT_TRUE(record_index_loaded_)) {
+        return SeekUsingRecordIndex(new_pos);
+      }
+    }
+    decoders_ahead_.clear();
+    pending_skipped_regions_.clear();
+    CacheCurrentChunk();
     if (ABSL_PREDICT_FALSE(!src->SeekToChunkContaining(new_pos))) {
       chunk_begin_ = src->pos();
       chunk_decoder_.Reset();
@@ -403,8 +646,415 @@ bool RecordReaderBase::Seek(Position new_pos) {
   return true;
 }
 
+bool RecordReaderBase::SeekToRecord(uint64_t index) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return TryRecovery();
+  if (ABSL_PREDICT_FALSE(!record_index_loaded_)) {
+    if (ABSL_PREDICT_FALSE(!LoadRecordIndex(/*missing_index_ok=*/false))) {
+      return TryRecovery();
+    }
+  }
+  RIEGELI_ASSERT(!record_index_.empty())
+      << "Failed invariant of RecordReader: record index loaded but empty";
+  const IndexedChunk& last_entry = record_index_.back();
+  if (ABSL_PREDICT_FALSE(index >= last_entry.first_record_ordinal)) {
+    // Past the last indexed record: seek to the end of the indexed records.
+    return Seek(RecordPosition(last_entry.chunk_begin, 0));
+  }
+  const std::vector<IndexedChunk>::const_iterator iter = std::upper_bound(
+      record_index_.cbegin(), record_index_.cend(), index,
+      [](uint64_t index, const IndexedChunk& entry) {
+        return index < entry.first_record_ordinal;
+      });
+  RIEGELI_ASSERT(iter != record_index_.cbegin())
+      << "Failed invariant of RecordReader: "
+         "record index does not start at ordinal 0";
+  const IndexedChunk& entry = *(iter - 1);
+  return Seek(
+      RecordPosition(entry.chunk_begin, index - entry.first_record_ordinal));
+}
+
+inline bool RecordReaderBase::LoadRecordIndex(bool missing_index_ok) {
+  ChunkReader* const src = src_chunk_reader();
+  // Locating the index moves the reading position. The caller seeks to the
+  // target record afterwards; the current chunk will not be resumed.
+  decoders_ahead_.clear();
+  pending_skipped_regions_.clear();
+  CacheCurrentChunk();
+  chunk_decoder_.Reset();
+  chunk_begin_ = src->pos();
+  Position size;
+  if (ABSL_PREDICT_FALSE(!src->Size(&size))) return Fail(*src);
+  // The index chunk is the last chunk of the file, possibly followed by
+  // padding chunks.
+  Position search_pos = size;
+  Chunk chunk;
+  while (search_pos > 0) {
+    if (ABSL_PREDICT_FALSE(!src->SeekToChunkBefore(search_pos - 1))) {
+      chunk_begin_ = src->pos();
+      recoverable_ = Recoverable::kRecoverChunkReader;
+      return Fail(*src);
+    }
+    const Position index_chunk_begin = src->pos();
+    if (ABSL_PREDICT_FALSE(!src->ReadChunk(&chunk))) {
+      chunk_begin_ = src->pos();
+      if (ABSL_PREDICT_FALSE(!src->healthy())) {
+        recoverable_ = Recoverable::kRecoverChunkReader;
+        return Fail(*src);
+      }
+      break;
+    }
+    chunk_begin_ = src->pos();
+    if (chunk.header.chunk_type() == ChunkType::kRecordIndex) {
+      if (ABSL_PREDICT_FALSE(!ParseRecordIndex(chunk, index_chunk_begin))) {
+        record_index_.clear();
+        return false;
+      }
+      record_index_loaded_ = true;
+      return true;
+    }
+    if (chunk.header.chunk_type() != ChunkType::kPadding) break;
+    search_pos = index_chunk_begin;
+  }
+  if (missing_index_ok) {
+    record_index_absent_ = true;
+    return true;
+  }
+  return Fail(FailedPreconditionError(
+      "No record index at the end of the file; a record index is written "
+      "with RecordWriterBase::Options::set_write_record_index()"));
+}
+
+inline bool RecordReaderBase::ParseRecordIndex(const Chunk& chunk,
+                                               Position index_chunk_begin) {
+  RIEGELI_ASSERT(chunk.header.chunk_type() == ChunkType::kRecordIndex)
+      << "Failed precondition of RecordReaderBase::ParseRecordIndex(): "
+         "wrong chunk type";
+  ChainReader<> data_reader(&chunk.data);
+  uint64_t num_entries;
+  if (ABSL_PREDICT_FALSE(!ReadVarint64(&data_reader, &num_entries))) {
+    return Fail(DataLossError(
+        "Invalid record index chunk: reading number of entries failed"));
+  }
+  if (ABSL_PREDICT_FALSE(num_entries > chunk.data.size())) {
+    return Fail(DataLossError(absl::StrCat(
+        "Invalid record index chunk: implausible number of entries: ",
+        num_entries)));
+  }
+  uint64_t flags;
+  if (ABSL_PREDICT_FALSE(!ReadVarint64(&data_reader, &flags))) {
+    return Fail(
+        DataLossError("Invalid record index chunk: reading flags failed"));
+  }
+  if (ABSL_PREDICT_FALSE((flags & ~kRecordIndexHasStatistics) != 0)) {
+    return Fail(DataLossError(
+        absl::StrCat("Invalid record index chunk: unknown flags: ", flags)));
+  }
+  const bool has_statistics = (flags & kRecordIndexHasStatistics) != 0;
+  record_index_.clear();
+  record_index_.reserve(IntCast<size_t>(num_entries) + 1);
+  Position chunk_begin = 0;
+  uint64_t first_record_ordinal = 0;
+  for (uint64_t i = 0; i < num_entries; ++i) {
+    uint64_t chunk_begin_delta;
+    uint64_t num_records;
+    if (ABSL_PREDICT_FALSE(!ReadVarint64(&data_reader, &chunk_begin_delta)) ||
+        ABSL_PREDICT_FALSE(!ReadVarint64(&data_reader, &num_records))) {
+      return Fail(
+          DataLossError("Invalid record index chunk: reading an entry failed"));
+    }
+    chunk_begin += chunk_begin_delta;
+    uint64_t decoded_data_size = 0;
+    std::string min_key;
+    std::string max_key;
+    if (has_statistics) {
+      uint64_t min_key_size;
+      uint64_t max_key_size;
+      if (ABSL_PREDICT_FALSE(
+              !ReadVarint64(&data_reader, &decoded_data_size)) ||
+          ABSL_PREDICT_FALSE(!ReadVarint64(&data_reader, &min_key_size)) ||
+          ABSL_PREDICT_FALSE(min_key_size > chunk.data.size()) ||
+          ABSL_PREDICT_FALSE(
+              !data_reader.Read(&min_key, IntCast<size_t>(min_key_size))) ||
+          ABSL_PREDICT_FALSE(!ReadVarint64(&data_reader, &max_key_size)) ||
+          ABSL_PREDICT_FALSE(max_key_size > chunk.data.size()) ||
+          ABSL_PREDICT_FALSE(
+              !data_reader.Read(&max_key, IntCast<size_t>(max_key_size)))) {
+        return Fail(DataLossError(
+            "Invalid record index chunk: reading chunk statistics failed"));
+      }
+    }
+    record_index_.push_back(IndexedChunk{chunk_begin, first_record_ordinal,
+                                         decoded_data_size, std::move(min_key),
+                                         std::move(max_key)});
+    first_record_ordinal += num_records;
+  }
+  if (ABSL_PREDICT_FALSE(!data_reader.VerifyEndAndClose())) {
+    return Fail(data_reader);
+  }
+  // Sentinel entry: the position of the index chunk marks the end of the
+  // indexed records.
+  record_index_.push_back(IndexedChunk{index_chunk_begin, first_record_ordinal,
+                                       0, std::string(), std::string()});
+  record_index_has_statistics_ = has_statistics;
+  return true;
+}
+
+bool RecordReaderBase::SeekToChunkSatisfying(
+    std::function<bool(const ChunkStatistics& statistics)> filter,
+    bool* found) {
+  if (found != nullptr) *found = false;
+  if (ABSL_PREDICT_FALSE(!healthy())) return TryRecovery();
+  const Position current_pos = pos().numeric();
+  if (ABSL_PREDICT_FALSE(!record_index_loaded_)) {
+    if (ABSL_PREDICT_FALSE(!LoadRecordIndex(/*missing_index_ok=*/false))) {
+      return TryRecovery();
+    }
+  }
+  if (ABSL_PREDICT_FALSE(!record_index_has_statistics_)) {
+    return Fail(FailedPreconditionError(
+        "SeekToChunkSatisfying() requires chunk statistics in the record "
+        "index, written with "
+        "RecordWriterBase::Options::set_chunk_statistics_key()"));
+  }
+  // Find the first indexed chunk whose records do not all lie before
+  // current_pos.
+  std::vector<IndexedChunk>::const_iterator iter = std::upper_bound(
+      record_index_.cbegin(), record_index_.cend(), current_pos,
+      [](Position current_pos, const IndexedChunk& entry) {
+        return current_pos < entry.chunk_begin;
+      });
+  if (iter != record_index_.cbegin()) {
+    const IndexedChunk& prev = *(iter - 1);
+    if (iter != record_index_.cend() &&
+        current_pos - prev.chunk_begin <
+            iter->first_record_ordinal - prev.first_record_ordinal) {
+      // current_pos corresponds to a record of the previous chunk, which is
+      // thus not wholly before current_pos.
+      --iter;
+    }
+  }
+  // The last entry is the sentinel, not a chunk.
+  for (; iter < record_index_.cend() - 1; ++iter) {
+    const IndexedChunk& next = *(iter + 1);
+    const ChunkStatistics statistics{
+        iter->chunk_begin,
+        next.first_record_ordinal - iter->first_record_ordinal,
+        iter->decoded_data_size, iter->min_key, iter->max_key};
+    if (filter(statistics)) {
+      if (found != nullptr) *found = true;
+      return Seek(RecordPosition(iter->chunk_begin, 0));
+    }
+  }
+  // No chunk satisfies the filter: seek to the end of the indexed records.
+  return Seek(RecordPosition(record_index_.back().chunk_begin, 0));
+}
+
+inline bool RecordReaderBase::SeekUsingRecordIndex(Position new_pos) {
+  RIEGELI_ASSERT(record_index_loaded_)
+      << "Failed precondition of RecordReaderBase::SeekUsingRecordIndex(): "
+         "record index not loaded";
+  // Find the last indexed chunk which begins at or before new_pos.
+  const std::vector<IndexedChunk>::const_iterator iter = std::upper_bound(
+      record_index_.cbegin(), record_index_.cend(), new_pos,
+      [](Position new_pos, const IndexedChunk& entry) {
+        return new_pos < entry.chunk_begin;
+      });
+  if (ABSL_PREDICT_FALSE(iter == record_index_.cbegin())) {
+    // Before the first indexed chunk, e.g. inside the file signature or
+    // metadata: the first record is the next record.
+    return Seek(RecordPosition(record_index_.front().chunk_begin, 0));
+  }
+  const IndexedChunk& entry = *(iter - 1);
+  if (iter != record_index_.cend() &&
+      new_pos - entry.chunk_begin <
+          iter->first_record_ordinal - entry.first_record_ordinal) {
+    // new_pos corresponds to a numeric record position in this chunk.
+    return Seek(RecordPosition(entry.chunk_begin,
+                               IntCast<uint64_t>(new_pos - entry.chunk_begin)));
+  }
+  if (iter == record_index_.cend()) {
+    // At or past the end of the indexed records; entry is the sentinel.
+    return Seek(RecordPosition(entry.chunk_begin, 0));
+  }
+  // Between records: the next indexed chunk holds the next record.
+  return Seek(RecordPosition(iter->chunk_begin, 0));
+}
+
+bool RecordReaderBase::Search(std::function<bool(int* compare)> test,
+                              bool* found) {
+  // A chunk read and scheduled for decoding before knowing whether the search
+  // will probe it.
+  struct SpeculativeProbe {
+    Position target;
+    Position chunk_begin;
+    Position chunk_end;
+    std::future<ChunkDecoder> decoder;
+  };
+  if (found != nullptr) *found = false;
+  if (ABSL_PREDICT_FALSE(!healthy())) return TryRecovery();
+  ChunkReader* const src = src_chunk_reader();
+  Position end;
+  if (ABSL_PREDICT_FALSE(!Size(&end))) return false;
+  Position lo = pos().numeric();
+  Position hi = end;
+  // Reading ahead already overlaps decoding with reading, and moves the chunk
+  // reader independently of the current chunk, so speculation does not apply.
+  const bool speculative = speculative_search_ && parallelism_ == 0;
+  std::vector<SpeculativeProbe> speculated;
+  // Reads the chunk containing target, if decoding it would be needed to
+  // probe target, and schedules its decoding on the thread pool. Leaves the
+  // chunk reader moved; failures are left to be reported by the probe itself.
+  const auto speculate = [&](Position target) {
+    if (target >= chunk_begin_ &&
+        target < chunk_begin_ + chunk_decoder_.num_records()) {
+      // The target is in the current chunk.
+      return;
+    }
+    for (const SpeculativeProbe& probe : speculated) {
+      if (target == probe.target) return;
+    }
+    if (ABSL_PREDICT_FALSE(!src->SeekToChunkContaining(target))) return;
+    if (src->pos() >= target || src->pos() == chunk_begin_) {
+      // Seeking to the target will not need decoding this chunk.
+      return;
+    }
+    const Position probe_chunk_begin = src->pos();
+    Chunk chunk;
+    if (ABSL_PREDICT_FALSE(!src->ReadChunk(&chunk))) return;
+    ChunkDecoder decoder(chunk_decoder_options_);
+    decoder.set_zstd_dictionary(chunk_decoder_.zstd_dictionary());
+    struct DecodeChunkTask {
+      Chunk chunk;
+      ChunkDecoder decoder;
+      std::promise<ChunkDecoder> done;
+    };
+    DecodeChunkTask* const task = new DecodeChunkTask{
+        std::move(chunk), std::move(decoder), std::promise<ChunkDecoder>()};
+    speculated.push_back(SpeculativeProbe{target, probe_chunk_begin,
+                                          src->pos(), task->done.get_future()});
+    StatsSink* const stats_sink = stats_sink_;
+    thread_pool().Schedule([task, stats_sink] {
+      absl::Time time_before;
+      if (ABSL_PREDICT_FALSE(stats_sink != nullptr)) time_before = absl::Now();
+      task->decoder.Reset(task->chunk);
+      if (ABSL_PREDICT_FALSE(stats_sink != nullptr)) {
+        stats_sink->OnChunkDecoded(absl::Now() - time_before);
+      }
+      task->done.set_value(std::move(task->decoder));
+      delete task;
+    });
+  };
+  // If the chunk containing target was speculatively decoded, installs it as
+  // the current chunk, replicating the effect of Seek(target), and returns
+  // true. The caller checks healthy() for the result.
+  const auto take_speculated = [&](Position target) {
+    for (std::vector<SpeculativeProbe>::iterator iter = speculated.begin();
+         iter != speculated.end(); ++iter) {
+      if (iter->target != target) continue;
+      CacheCurrentChunk();
+      chunk_decoder_ = iter->decoder.get();
+      chunk_begin_ = iter->chunk_begin;
+      chunk_end_ = iter->chunk_end;
+      speculated.erase(iter);
+      if (ABSL_PREDICT_FALSE(!src->Seek(chunk_end_))) {
+        chunk_decoder_.Reset();
+        recoverable_ = Recoverable::kRecoverChunkReader;
+        Fail(*src);
+        return true;
+      }
+      if (ABSL_PREDICT_FALSE(!chunk_decoder_.healthy())) {
+        recoverable_ = Recoverable::kRecoverChunkDecoder;
+        Fail(chunk_decoder_);
+        return true;
+      }
+      chunk_decoder_.SetIndex(IntCast<uint64_t>(target - chunk_begin_));
+      return true;
+    }
+    return false;
+  };
+  bool aborted = false;
+  while (lo < hi) {
+    const Position mid = lo + (hi - lo) / 2;
+    const bool speculated_hit = take_speculated(mid);
+    speculated.clear();
+    if (speculated_hit) {
+      if (ABSL_PREDICT_FALSE(!healthy())) {
+        if (!TryRecovery()) return false;
+        continue;
+      }
+    } else if (ABSL_PREDICT_FALSE(!Seek(mid))) {
+      return false;
+    }
+    const Position probe_pos = pos().numeric();
+    if (probe_pos >= hi) {
+      // There is no record at or after mid but before hi.
+      hi = mid;
+      continue;
+    }
+    if (speculative) {
+      // Read and schedule decoding of the chunks at both possible next
+      // midpoints while the probe is examined. The next record after the
+      // probe begins at probe_pos + 1 or later.
+      const Position src_pos = src->pos();
+      speculate(lo + (mid - lo) / 2);
+      speculate(probe_pos + 1 + (hi - probe_pos - 1) / 2);
+      if (src->pos() != src_pos) {
+        if (ABSL_PREDICT_FALSE(!src->Seek(src_pos))) {
+          chunk_begin_ = src->pos();
+          chunk_decoder_.Reset();
+          recoverable_ = Recoverable::kRecoverChunkReader;
+          Fail(*src);
+          if (!TryRecovery()) return false;
+          continue;
+        }
+      }
+    }
+    int compare = 0;
+    if (ABSL_PREDICT_FALSE(!test(&compare))) {
+      aborted = true;
+      break;
+    }
+    if (ABSL_PREDICT_FALSE(!healthy())) return false;
+    if (compare < 0) {
+      // UnsignedMax() ensures progress if recovery from corruption moved the
+      // position backwards.
+      lo = UnsignedMax(probe_pos + 1, mid + 1);
+    } else {
+      hi = mid;
+    }
+  }
+  // lo == hi: this is the position of the first record which is not before
+  // the desired records, or the end of the region if there is none.
+  if (ABSL_PREDICT_FALSE(!Seek(hi))) return TryRecovery();
+  if (found != nullptr && !aborted && pos().numeric() < end) {
+    // Verify whether the record at the final position is a desired one; the
+    // search might have narrowed the region without probing it.
+    int compare = 0;
+    if (ABSL_PREDICT_TRUE(test(&compare))) {
+      if (ABSL_PREDICT_FALSE(!healthy())) return false;
+      *found = compare == 0;
+    }
+    if (ABSL_PREDICT_FALSE(!Seek(hi))) return TryRecovery();
+  }
+  return true;
+}
+
 inline bool RecordReaderBase::ReadChunk() {
+  if (ABSL_PREDICT_FALSE(parallelism_ > 0)) return ReadChunkAhead();
   ChunkReader* const src = src_chunk_reader();
+  if (ABSL_PREDICT_FALSE(decoded_chunk_cache_size_ > 0)) {
+    CacheCurrentChunk();
+    const Position chunk_begin = src->pos();
+    if (TakeCachedChunk(chunk_begin)) {
+      chunk_begin_ = chunk_begin;
+      if (ABSL_PREDICT_FALSE(!src->Seek(chunk_end_))) {
+        chunk_decoder_.Reset();
+        recoverable_ = Recoverable::kRecoverChunkReader;
+        return Fail(*src);
+      }
+      return true;
+    }
+  }
   chunk_begin_ = src->pos();
   Chunk chunk;
   if (ABSL_PREDICT_FALSE(!src->ReadChunk(&chunk))) {
@@ -415,15 +1065,182 @@ inline bool RecordReaderBase::ReadChunk() {
     }
     return false;
   }
+  absl::Time time_before;
+  if (ABSL_PREDICT_FALSE(stats_sink_ != nullptr)) time_before = absl::Now();
   if (ABSL_PREDICT_FALSE(!chunk_decoder_.Reset(chunk))) {
     recoverable_ = Recoverable::kRecoverChunkDecoder;
     return Fail(chunk_decoder_);
   }
+  if (ABSL_PREDICT_FALSE(stats_sink_ != nullptr)) {
+    stats_sink_->OnChunkDecoded(absl::Now() - time_before);
+  }
+  chunk_end_ = src->pos();
+  if (ABSL_PREDICT_FALSE(decoded_chunk_cache_size_ > 0)) {
+    // Remember the latest Zstd dictionary so that it survives moving decoders
+    // between chunk_decoder_ and the cache.
+    zstd_dictionary_ = chunk_decoder_.zstd_dictionary();
+  }
+  return true;
+}
+
+inline void RecordReaderBase::CacheCurrentChunk() {
+  if (decoded_chunk_cache_size_ == 0) return;
+  if (!chunk_decoder_.healthy() || chunk_decoder_.num_records() == 0 ||
+      chunk_end_ <= chunk_begin_) {
+    // There is no decoded chunk, or it is not worth caching.
+    return;
+  }
+  if (ABSL_PREDICT_FALSE(cached_chunk_index_.find(chunk_begin_) !=
+                         cached_chunk_index_.end())) {
+    return;
+  }
+  cached_chunks_.push_front(
+      CachedChunk{chunk_begin_, chunk_end_, std::move(chunk_decoder_)});
+  cached_chunk_index_.emplace(chunk_begin_, cached_chunks_.begin());
+  chunk_decoder_.Reset();
+  chunk_decoder_.set_zstd_dictionary(zstd_dictionary_);
+  if (cached_chunks_.size() > decoded_chunk_cache_size_) {
+    cached_chunk_index_.erase(cached_chunks_.back().chunk_begin);
+    cached_chunks_.pop_back();
+  }
+}
+
+inline bool RecordReaderBase::TakeCachedChunk(Position chunk_begin) {
+  const auto iter = cached_chunk_index_.find(chunk_begin);
+  if (ABSL_PREDICT_TRUE(iter == cached_chunk_index_.end())) return false;
+  CachedChunk& entry = *iter->second;
+  chunk_decoder_ = std::move(entry.decoder);
+  chunk_decoder_.SetIndex(0);
+  // The latest dictionary applies to chunks decoded after this one, even if
+  // the cached chunk itself was decoded before the dictionary was seen.
+  chunk_decoder_.set_zstd_dictionary(zstd_dictionary_);
+  chunk_end_ = entry.chunk_end;
+  cached_chunks_.erase(iter->second);
+  cached_chunk_index_.erase(iter);
   return true;
 }
 
+inline bool RecordReaderBase::ReadChunkAhead() {
+  ChunkReader* const src = src_chunk_reader();
+  FillDecodersAhead(src);
+  if (ABSL_PREDICT_FALSE(decoders_ahead_.empty())) {
+    // Reading ahead stopped: the source ended or the chunk reader failed.
+    // Regions skipped by eager recovery with no chunk after them are
+    // reported first.
+    if (ABSL_PREDICT_FALSE(!pending_skipped_regions_.empty())) {
+      if (!ReportSkippedRegions(&pending_skipped_regions_)) return false;
+    }
+    chunk_begin_ = src->pos();
+    chunk_decoder_.Reset();
+    if (ABSL_PREDICT_FALSE(!src->healthy())) {
+      recoverable_ = Recoverable::kRecoverChunkReader;
+      return Fail(*src);
+    }
+    return false;
+  }
+  if (ABSL_PREDICT_FALSE(!decoders_ahead_.front().skipped_regions.empty())) {
+    // Records before the skipped regions have all been read; report the
+    // regions before making the chunk after them current.
+    if (!ReportSkippedRegions(&decoders_ahead_.front().skipped_regions)) {
+      return false;
+    }
+  }
+  chunk_begin_ = decoders_ahead_.front().chunk_begin;
+  chunk_decoder_ = decoders_ahead_.front().decoder.get();
+  decoders_ahead_.pop_front();
+  // Refill the queue before checking the result, so that background decoding
+  // continues while records of this chunk are consumed.
+  FillDecodersAhead(src);
+  if (ABSL_PREDICT_FALSE(!chunk_decoder_.healthy())) {
+    recoverable_ = Recoverable::kRecoverChunkDecoder;
+    return Fail(chunk_decoder_);
+  }
+  return true;
+}
+
+inline void RecordReaderBase::FillDecodersAhead(ChunkReader* src) {
+  // Bundles the state moved into a background chunk decoding task. The task
+  // does not refer to the RecordReader, so pending tasks do not constrain
+  // moving or closing it, and chunks read ahead can simply be dropped.
+  struct DecodeChunkTask {
+    Chunk chunk;
+    ChunkDecoder decoder;
+    std::promise<ChunkDecoder> done;
+  };
+  while (decoders_ahead_.size() < IntCast<size_t>(parallelism_)) {
+    const Position chunk_begin = src->pos();
+    Chunk chunk;
+    if (ABSL_PREDICT_FALSE(!src->ReadChunk(&chunk))) {
+      if (ABSL_PREDICT_FALSE(!src->healthy()) && recovery_ != nullptr) {
+        // Recover right away instead of when the queue is drained: scanning
+        // for the next valid chunk overlaps with background decoding of the
+        // chunks read before the corruption, and reading ahead continues
+        // from the recovered position without restarting the pipeline.
+        SkippedRegion skipped_region;
+        if (src->Recover(&skipped_region)) {
+          pending_skipped_regions_.push_back(std::move(skipped_region));
+          continue;
+        }
+      }
+      return;
+    }
+    std::vector<SkippedRegion> skipped_regions =
+        std::move(pending_skipped_regions_);
+    pending_skipped_regions_.clear();
+    ChunkDecoder decoder(chunk_decoder_options_);
+    if (ABSL_PREDICT_FALSE(chunk.header.chunk_type() ==
+                           ChunkType::kDictionary)) {
+      // Decoded in the foreground so that the dictionary is available to
+      // decoders of subsequent chunks.
+      decoder.Reset(chunk);
+      zstd_dictionary_ = decoder.zstd_dictionary();
+      std::promise<ChunkDecoder> done;
+      done.set_value(std::move(decoder));
+      decoders_ahead_.push_back(DecoderAhead{chunk_begin, done.get_future(),
+                                             std::move(skipped_regions)});
+      continue;
+    }
+    decoder.set_zstd_dictionary(zstd_dictionary_);
+    DecodeChunkTask* const task = new DecodeChunkTask{
+        std::move(chunk), std::move(decoder), std::promise<ChunkDecoder>()};
+    decoders_ahead_.push_back(DecoderAhead{chunk_begin, task->done.get_future(),
+                                           std::move(skipped_regions)});
+    StatsSink* const stats_sink = stats_sink_;
+    thread_pool().Schedule([task, stats_sink] {
+      absl::Time time_before;
+      if (ABSL_PREDICT_FALSE(stats_sink != nullptr)) time_before = absl::Now();
+      task->decoder.Reset(task->chunk);
+      if (ABSL_PREDICT_FALSE(stats_sink != nullptr)) {
+        stats_sink->OnChunkDecoded(absl::Now() - time_before);
+      }
+      task->done.set_value(std::move(task->decoder));
+      delete task;
+    });
+  }
+}
+
+inline bool RecordReaderBase::ReportSkippedRegions(
+    std::vector<SkippedRegion>* skipped_regions) {
+  RIEGELI_ASSERT(recovery_ != nullptr)
+      << "Failed precondition of RecordReaderBase::ReportSkippedRegions(): "
+         "no recovery function";
+  while (!skipped_regions->empty()) {
+    const SkippedRegion skipped_region = std::move(skipped_regions->front());
+    skipped_regions->erase(skipped_regions->begin());
+    if (ABSL_PREDICT_FALSE(!recovery_(skipped_region))) return false;
+  }
+  return true;
+}
+
+inline internal::ThreadPool& RecordReaderBase::thread_pool() const {
+  return thread_pool_ != nullptr ? *thread_pool_
+                                 : internal::ThreadPool::global_cpu();
+}
+
 template class RecordReader<Reader*>;
 template class RecordReader<std::unique_ptr<Reader>>;
+template class RecordReader<FdMMapReader<OwnedFd>>;
+template class RecordReader<FdMMapReader<int>>;
 template class RecordReader<ChunkReader*>;
 template class RecordReader<std::unique_ptr<ChunkReader>>;
 template class RecordReader<DefaultChunkReader<Reader*>>;
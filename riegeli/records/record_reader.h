@@ -15,22 +15,35 @@
 #ifndef RIEGELI_RECORDS_RECORD_READER_H_
 #define RIEGELI_RECORDS_RECORD_READER_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
+#include <deque>
 #include <functional>
+#include <future>
+#include <list>
 #include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "absl/base/optimization.h"
+#include "absl/container/flat_hash_map.h"
 #include "absl/strings/string_view.h"
 #include "absl/utility/utility.h"
 #include "google/protobuf/descriptor.h"
 #include "google/protobuf/message_lite.h"
+#include "google/protobuf/repeated_field.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
 #include "riegeli/base/dependency.h"
 #include "riegeli/base/object.h"
+#include "riegeli/base/parallelism.h"
+#include "riegeli/base/stats_sink.h"
+#include "riegeli/bytes/fd_reader.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/chunk_encoding/chunk_decoder.h"
+#include "riegeli/chunk_encoding/decoded_chunk_cache.h"
 #include "riegeli/chunk_encoding/field_projection.h"
 #include "riegeli/records/chunk_reader.h"
 #include "riegeli/records/chunk_reader_dependency.h"
@@ -43,6 +56,10 @@ namespace riegeli {
 struct Chunk;
 
 // Interprets record_type_name and file_descriptor from metadata.
+//
+// Descriptor pools compiled from byte-identical metadata are shared
+// process-wide, hence opening many shards of the same dataset compiles
+// descriptors once instead of once per file.
 class RecordsMetadataDescriptors : public Object {
  public:
   explicit RecordsMetadataDescriptors(const RecordsMetadata& metadata);
@@ -63,7 +80,9 @@ class RecordsMetadataDescriptors : public Object {
   class ErrorCollector;
 
   std::string record_type_name_;
-  std::unique_ptr<google::protobuf::DescriptorPool> pool_;
+  // Possibly shared with other RecordsMetadataDescriptors built from
+  // byte-identical metadata, via a process-wide cache.
+  std::shared_ptr<const google::protobuf::DescriptorPool> pool_;
 };
 
 // Template parameter invariant part of RecordReader.
@@ -90,6 +109,65 @@ class RecordReaderBase : public Object {
       return std::move(set_field_projection(std::move(field_projection)));
     }
 
+    // If not nullptr, a predicate evaluated on a view of each record inside
+    // the chunk decode loop, before the record is returned. Rejected records
+    // are skipped without being materialized or copied out; see
+    // ChunkDecoder::Options::set_record_filter(). Combined with
+    // set_field_projection() this pushes a filtering scan down to decoding.
+    //
+    // The filter is not supported together with
+    // set_streaming_decoding(true).
+    //
+    // Default: nullptr.
+    Options& set_record_filter(
+        std::function<bool(absl::string_view record)> record_filter) & {
+      record_filter_ = std::move(record_filter);
+      return *this;
+    }
+    Options&& set_record_filter(
+        std::function<bool(absl::string_view record)> record_filter) && {
+      return std::move(set_record_filter(std::move(record_filter)));
+    }
+
+    // If not nullptr, a cache of decoded chunk payloads shared between
+    // readers, so that hot chunks are decompressed once instead of once per
+    // reader; see ChunkDecoder::Options::set_decoded_chunk_cache(). The
+    // cache is not owned and must outlive the RecordReader.
+    //
+    // Unlike set_decoded_chunk_cache_size(), which keeps chunks recently
+    // visited by this reader for seeking back, this cache is shared between
+    // readers and consulted for every chunk.
+    //
+    // Default: nullptr.
+    Options& set_decoded_chunk_cache(DecodedChunkCache* decoded_chunk_cache) & {
+      decoded_chunk_cache_ = decoded_chunk_cache;
+      return *this;
+    }
+    Options&& set_decoded_chunk_cache(
+        DecodedChunkCache* decoded_chunk_cache) && {
+      return std::move(set_decoded_chunk_cache(decoded_chunk_cache));
+    }
+
+    // If true, simple chunks are decompressed incrementally, just ahead of
+    // the records being read, instead of as a whole when a chunk is entered.
+    // This bounds decoding memory by the compressed chunk plus the
+    // decompressor state instead of the decompressed chunk, allowing a
+    // larger chunk_size at writing without a larger reading memory
+    // footprint. See ChunkDecoder::Options::set_streaming().
+    //
+    // Seeking backwards within a chunk restarts its decompression, hence
+    // this option is meant for reading forward. Transposed chunks are
+    // decompressed as a whole regardless.
+    //
+    // Default: false.
+    Options& set_streaming_decoding(bool streaming_decoding) & {
+      streaming_decoding_ = streaming_decoding;
+      return *this;
+    }
+    Options&& set_streaming_decoding(bool streaming_decoding) && {
+      return std::move(set_streaming_decoding(streaming_decoding));
+    }
+
     // Sets the recovery function to be called after skipping over invalid file
     // contents.
     //
@@ -114,6 +192,15 @@ class RecordReaderBase : public Object {
     //                   returns false if the recovery function returns false
     //  * Seek() - returns the result of the recovery function
     //
+    // With set_parallelism() > 0 and a recovery function set, recovery from
+    // file corruption happens as soon as reading ahead detects it, so that
+    // scanning for the next valid chunk overlaps with background decoding of
+    // chunks read before the corruption, and reading ahead continues from the
+    // recovered position without restarting the pipeline. The recovery
+    // function is still called in record order, from the thread using the
+    // RecordReader, after the records preceding the skipped region have been
+    // read.
+    //
     // Default: nullptr
     Options& set_recovery(
         std::function<bool(const SkippedRegion&)> recovery) & {
@@ -125,11 +212,198 @@ class RecordReaderBase : public Object {
       return std::move(set_recovery(std::move(recovery)));
     }
 
+    // If true, chunk and block header hashes and chunk data hashes are
+    // verified while reading, detecting data corruption.
+    //
+    // If false, hash verification is skipped, which makes reading faster but
+    // silently accepts corrupted data. This is unsafe for untrusted data; it
+    // is meant for trusted files, e.g. temporary files written and reread
+    // within the same process.
+    //
+    // Default: true.
+    Options& set_verify_hashes(bool verify_hashes) & {
+      verify_hashes_ = verify_hashes;
+      return *this;
+    }
+    Options&& set_verify_hashes(bool verify_hashes) && {
+      return std::move(set_verify_hashes(verify_hashes));
+    }
+
+    // Restricts reading to a shard of the file: of the chunks containing
+    // records, only those with ordinal numbers congruent to shard_index
+    // modulo num_shards are decoded. ReadRecord() skips the remaining chunks
+    // after reading only their headers, so each of num_shards readers of the
+    // same file reads a disjoint subset of records which together cover the
+    // whole file, and roughly 1/num_shards of the bytes. This is much
+    // cheaper than reading everything and discarding records afterwards.
+    //
+    // Sharding is meant for reading the file sequentially from the
+    // beginning; mixing it with seeking is not supported, because the
+    // assignment of chunks to shards depends on the chunks encountered.
+    //
+    // Precondition: shard_index < num_shards
+    //
+    // Default: shard_index 0, num_shards 1 (no sharding).
+    Options& set_shard(uint64_t shard_index, uint64_t num_shards) & {
+      RIEGELI_ASSERT_LT(shard_index, num_shards)
+          << "Failed precondition of RecordReaderBase::Options::set_shard(): "
+             "shard index out of range";
+      shard_index_ = shard_index;
+      num_shards_ = num_shards;
+      return *this;
+    }
+    Options&& set_shard(uint64_t shard_index, uint64_t num_shards) && {
+      return std::move(set_shard(shard_index, num_shards));
+    }
+
+    // If true, the file metadata chunk is skipped by seeking over its data
+    // after reading only its header, instead of being read and checksummed
+    // on the way to the first records. This reduces the cost of opening a
+    // file when metadata is not needed, e.g. when many files are opened just
+    // to seek to a few records in each.
+    //
+    // With this option ReadMetadata() behaves as if the file had no
+    // metadata; use a separate RecordReader without this option to read
+    // metadata.
+    //
+    // Default: false.
+    Options& set_skip_metadata(bool skip_metadata) & {
+      skip_metadata_ = skip_metadata;
+      return *this;
+    }
+    Options&& set_skip_metadata(bool skip_metadata) && {
+      return std::move(set_skip_metadata(skip_metadata));
+    }
+
+    // Sets the maximum number of chunks being read ahead and decoded in
+    // parallel in background. Larger parallelism can increase throughput of
+    // sequential reading, up to a point where it no longer matters; smaller
+    // parallelism reduces memory usage.
+    //
+    // If parallelism > 0, chunks after the current position are read ahead
+    // and decoded in background, so that decoding overlaps with consuming
+    // records; reporting reading errors is delayed until consumption reaches
+    // the invalid region.
+    //
+    // Default: 0.
+    Options& set_parallelism(int parallelism) & {
+      RIEGELI_ASSERT_GE(parallelism, 0)
+          << "Failed precondition of "
+             "RecordReaderBase::Options::set_parallelism(): "
+             "negative parallelism";
+      parallelism_ = parallelism;
+      return *this;
+    }
+    Options&& set_parallelism(int parallelism) && {
+      return std::move(set_parallelism(parallelism));
+    }
+
+    // Sets the thread pool used for background work if parallelism > 0.
+    //
+    // nullptr means the process-wide default pool. The thread pool must
+    // outlive the RecordReader.
+    //
+    // Default: nullptr
+    Options& set_thread_pool(internal::ThreadPool* thread_pool) & {
+      thread_pool_ = thread_pool;
+      return *this;
+    }
+    Options&& set_thread_pool(internal::ThreadPool* thread_pool) && {
+      return std::move(set_thread_pool(thread_pool));
+    }
+
+    // Sets the maximum number of decoded chunks kept in a cache for random
+    // access. If the cache size is greater than 0, a chunk left by Seek() is
+    // kept decoded, so that seeking back into a recently used chunk costs a
+    // cache lookup instead of decoding the chunk again. This helps when seeks
+    // revisit the same chunks, e.g. point lookups clustered in hot regions of
+    // a file. A larger cache size increases memory usage: up to the cache
+    // size times the chunk size of the writer.
+    //
+    // The cache is not used if parallelism > 0.
+    //
+    // Default: 0.
+    Options& set_decoded_chunk_cache_size(size_t decoded_chunk_cache_size) & {
+      decoded_chunk_cache_size_ = decoded_chunk_cache_size;
+      return *this;
+    }
+    Options&& set_decoded_chunk_cache_size(size_t decoded_chunk_cache_size) && {
+      return std::move(set_decoded_chunk_cache_size(decoded_chunk_cache_size));
+    }
+
+    // If true, the record index written by
+    // RecordWriterBase::Options::set_write_record_index() is loaded on the
+    // first Seek(Position) and used to locate chunks: seeking becomes a
+    // binary search in memory instead of examining block headers in the
+    // file, which matters for cold files. If the file has no index, seeking
+    // falls back to examining the file.
+    //
+    // Default: false.
+    Options& set_use_record_index(bool use_record_index) & {
+      use_record_index_ = use_record_index;
+      return *this;
+    }
+    Options&& set_use_record_index(bool use_record_index) && {
+      return std::move(set_use_record_index(use_record_index));
+    }
+
+    // If true, Search() reads and decodes the chunks at both possible next
+    // probe positions in background while each probe is examined, hiding
+    // decoding latency at the cost of reading roughly three times as much
+    // data. This helps when each probe pays significant I/O latency, e.g. on
+    // remote storage.
+    //
+    // Takes effect only if parallelism is 0; reading ahead already overlaps
+    // decoding with reading.
+    //
+    // Default: false.
+    Options& set_speculative_search(bool speculative_search) & {
+      speculative_search_ = speculative_search;
+      return *this;
+    }
+    Options&& set_speculative_search(bool speculative_search) && {
+      return std::move(set_speculative_search(speculative_search));
+    }
+
+    // If not nullptr, receives the duration of each chunk decoding, which
+    // suits exporting to a monitoring system. With set_parallelism() or
+    // set_speculative_search() events come from thread pool threads, hence
+    // the StatsSink must be thread-safe; a background decoding abandoned by
+    // Close() can still report after the RecordReader is closed, hence the
+    // StatsSink should live as long as the thread pool, e.g. for the whole
+    // process.
+    //
+    // For syscalls and stall times of the source, see
+    // FdReaderBase::Options::set_stats_sink(); the same StatsSink can be
+    // given to both.
+    //
+    // Default: nullptr
+    Options& set_stats_sink(StatsSink* stats_sink) & {
+      stats_sink_ = stats_sink;
+      return *this;
+    }
+    Options&& set_stats_sink(StatsSink* stats_sink) && {
+      return std::move(set_stats_sink(stats_sink));
+    }
+
    private:
     friend class RecordReaderBase;
 
     FieldProjection field_projection_ = FieldProjection::All();
+    bool streaming_decoding_ = false;
+    std::function<bool(absl::string_view record)> record_filter_;
+    DecodedChunkCache* decoded_chunk_cache_ = nullptr;
     std::function<bool(const SkippedRegion&)> recovery_;
+    bool verify_hashes_ = true;
+    uint64_t shard_index_ = 0;
+    uint64_t num_shards_ = 1;
+    bool skip_metadata_ = false;
+    int parallelism_ = 0;
+    internal::ThreadPool* thread_pool_ = nullptr;
+    size_t decoded_chunk_cache_size_ = 0;
+    bool use_record_index_ = false;
+    bool speculative_search_ = false;
+    StatsSink* stats_sink_ = nullptr;
   };
 
   // Returns the Riegeli/records file being read from. Unchanged by Close().
@@ -188,6 +462,60 @@ class RecordReaderBase : public Object {
   bool ReadRecord(std::string* record, RecordPosition* key = nullptr);
   bool ReadRecord(Chain* record, RecordPosition* key = nullptr);
 
+  // Reads up to max_records next records in one call, appending them to
+  // *records. All returned records come from one chunk, hence fewer than
+  // max_records records can be returned even before the end of the file;
+  // call ReadRecords() again for more. This amortizes the per-record call
+  // overhead over a whole chunk.
+  //
+  // ReadRecords(vector<string_view>*) appends views which are valid until
+  // this RecordReader advances past the current chunk, seeks, or is closed.
+  //
+  // If first_key != nullptr, *first_key is set to the canonical position of
+  // the first record appended on success.
+  //
+  // Return values:
+  //  * > 0 - success (that many records were appended)
+  //  * 0 (when healthy())  - source ends
+  //  * 0 (when !healthy()) - failure
+  size_t ReadRecords(std::vector<absl::string_view>* records,
+                     size_t max_records, RecordPosition* first_key = nullptr);
+  size_t ReadRecords(std::vector<Chain>* records, size_t max_records,
+                     RecordPosition* first_key = nullptr);
+
+  // Reads up to max_records next records in one call, parsing each of them
+  // to a proto message appended to *records. Like for ReadRecords(), all
+  // returned records come from one chunk, and the per-record call overhead
+  // is amortized over the batch.
+  //
+  // If *records lives on a proto arena, the messages are allocated on that
+  // arena; reusing an arena across batches amortizes message allocation as
+  // well.
+  //
+  // If a record fails to parse, reading stops there; the records parsed so
+  // far are returned, and the next call returns 0 with !healthy(), from
+  // which Recover() skips the unparsable record.
+  //
+  // If first_key != nullptr, *first_key is set to the canonical position of
+  // the first record appended on success.
+  //
+  // Return values:
+  //  * > 0 - success (that many records were appended)
+  //  * 0 (when healthy())  - source ends
+  //  * 0 (when !healthy()) - failure
+  template <typename Message>
+  size_t ReadMessages(google::protobuf::RepeatedPtrField<Message>* records,
+                      size_t max_records, RecordPosition* first_key = nullptr);
+
+  // Hints that about the next num_records records will be read sequentially.
+  //
+  // The hint drives prefetching of the underlying byte Reader (see
+  // Reader::ReadHint()), and with set_parallelism() > 0 starts background
+  // decoding immediately instead of at the next read. If the record index is
+  // loaded, the hinted byte range is exact; otherwise it is estimated from
+  // the density of the current chunk. The hint has no effect on data read.
+  void ReadAheadHint(uint64_t num_records);
+
   // If !healthy() and the failure was caused by invalid file contents, then
   // Recover() tries to recover from the failure and allow reading again by
   // skipping over the invalid region.
@@ -216,6 +544,19 @@ class RecordReaderBase : public Object {
   //  * false - failure not caused by invalid file contents
   bool Recover(SkippedRegion* skipped_region = nullptr);
 
+  // Returns true if the file ended in the middle of a chunk when the last
+  // ReadRecord() or ReadRecords() returned false with healthy(). This
+  // distinguishes an incomplete tail of a file which is still being written
+  // from a clean end at a chunk boundary.
+  //
+  // In either case, if the file is still being written and the source can
+  // see data appended later, calling ReadRecord() or ReadRecords() again
+  // resumes reading from where it stopped, without re-reading or
+  // re-validating previously read blocks; this allows to follow a growing
+  // file by polling cheaply. If the file does not grow, Close() will fail in
+  // the truncated state.
+  bool truncated() const;
+
   // Returns the current position.
   //
   // pos().numeric() returns the position as an integer of type Position.
@@ -252,21 +593,77 @@ class RecordReaderBase : public Object {
   //  * false - failure (!healthy())
   bool Size(Position* size);
 
-#if 0
-  // Searches the region between the current position and end of file for a
-  // desired record. What is desired is specified by a function, which should
-  // read a record and set the argument pointer to a value < 0, == 0, or > 0,
-  // depending on whether the record read is before, among, or after desired
-  // records. If it returns false, the search is aborted.
+  // Seeks to the record with the given ordinal number, counting from 0 at the
+  // beginning of the file.
   //
-  // If a desired record has been found, the position is left before the first
-  // desired record, otherwise it is left at end of file. If found != nullptr,
-  // then *found is set to true if the desired record has been found, or false
-  // if it has not been found or the search was aborted.
+  // This requires the file to have been written with
+  // RecordWriterBase::Options::set_write_record_index(true): the index stored
+  // at the end of the file is located on the first call and binary searched.
+  // Without an index SeekToRecord() fails; Seek() with byte positions remains
+  // the only form of random access.
   //
-  // TODO: This is not implemented yet.
-  bool Search(std::function<bool(int*)>, bool* found);
-#endif
+  // If index is at least the number of records in the file, seeks to the end
+  // of the indexed records.
+  //
+  // Return values:
+  //  * true  - success (healthy())
+  //  * false - failure (!healthy())
+  bool SeekToRecord(uint64_t index);
+
+  // Searches the region between the current position and the end of file for
+  // a desired record, assuming that records are ordered so that records
+  // before the desired ones precede them and records after the desired ones
+  // follow them. What is desired is specified by a function, which should
+  // read a record and set *compare to a value < 0, == 0, or > 0, depending on
+  // whether the record read is before, among, or after the desired records.
+  // If the function returns false, the search is aborted.
+  //
+  // The position is left before the first desired record if one has been
+  // found, otherwise before the first record after the desired records, or at
+  // the end of file if there is none. If found != nullptr, *found is set to
+  // true if a desired record has been found, or false if it has not been
+  // found or the search was aborted.
+  //
+  // If Options::set_speculative_search(true) was used, the chunks at both
+  // possible next probe positions are read and decoded in background while
+  // each probe is examined, hiding decoding latency.
+  //
+  // Return values:
+  //  * true  - success (healthy())
+  //  * false - failure (!healthy())
+  bool Search(std::function<bool(int* compare)> test, bool* found = nullptr);
+
+  // Statistics of a chunk, from the record index.
+  //
+  // min_key and max_key are the range of record keys computed by the function
+  // given to RecordWriterBase::Options::set_chunk_statistics_key(). They are
+  // views into the index owned by the RecordReader, valid until the
+  // RecordReader is closed or moved.
+  struct ChunkStatistics {
+    Position chunk_begin;
+    uint64_t num_records;
+    uint64_t decoded_data_size;
+    absl::string_view min_key;
+    absl::string_view max_key;
+  };
+
+  // Seeks to the beginning of the nearest chunk at or after the current
+  // position whose statistics satisfy filter, skipping chunks which the
+  // statistics rule out without reading them. If no such chunk exists, seeks
+  // to the end of the indexed records. If found != nullptr, *found is set
+  // accordingly.
+  //
+  // This requires the file to have been written with
+  // RecordWriterBase::Options::set_write_record_index(true) together with
+  // set_chunk_statistics_key(); without chunk statistics in the record index
+  // SeekToChunkSatisfying() fails.
+  //
+  // Return values:
+  //  * true  - success (healthy())
+  //  * false - failure (!healthy())
+  bool SeekToChunkSatisfying(
+      std::function<bool(const ChunkStatistics& statistics)> filter,
+      bool* found = nullptr);
 
  protected:
   enum class Recoverable { kNo, kRecoverChunkReader, kRecoverChunkDecoder };
@@ -311,7 +708,45 @@ class RecordReaderBase : public Object {
 
   std::function<bool(const SkippedRegion&)> recovery_;
 
+  // The position after the current chunk: the beginning of the first chunk
+  // read ahead, or src_pos (the position of the chunk reader) if no chunks
+  // are read ahead.
+  Position pos_after_current_chunk(Position src_pos) const {
+    if (ABSL_PREDICT_FALSE(!decoders_ahead_.empty())) {
+      return decoders_ahead_.front().chunk_begin;
+    }
+    return src_pos;
+  }
+
  private:
+  // A chunk read ahead of the current position, being decoded in background.
+  struct DecoderAhead {
+    Position chunk_begin;
+    std::future<ChunkDecoder> decoder;
+    // Regions skipped by eager recovery between the previously queued chunk
+    // and this one, reported to the recovery function when this chunk becomes
+    // current.
+    std::vector<SkippedRegion> skipped_regions;
+  };
+
+  // A decoded chunk kept in the cache for random access.
+  struct CachedChunk {
+    Position chunk_begin;
+    Position chunk_end;
+    ChunkDecoder decoder;
+  };
+
+  // An entry of the record index: the chunk at chunk_begin contains records
+  // with ordinal numbers starting from first_record_ordinal. The remaining
+  // fields are valid if record_index_has_statistics_.
+  struct IndexedChunk {
+    Position chunk_begin;
+    uint64_t first_record_ordinal;
+    uint64_t decoded_data_size;
+    std::string min_key;
+    std::string max_key;
+  };
+
   bool ParseMetadata(const Chunk& chunk, Chain* metadata);
 
   // Precondition: !chunk_decoder_.healthy() ||
@@ -319,9 +754,149 @@ class RecordReaderBase : public Object {
   template <typename Record>
   bool ReadRecordSlow(Record* record, RecordPosition* key);
 
+  // Precondition: !chunk_decoder_.healthy() ||
+  //               chunk_decoder_.index() == chunk_decoder_.num_records() ||
+  //               max_records == 0
+  template <typename Record>
+  size_t ReadRecordsSlow(std::vector<Record>* records, size_t max_records,
+                         RecordPosition* first_key);
+
+  // Precondition: !chunk_decoder_.healthy() ||
+  //               chunk_decoder_.index() == chunk_decoder_.num_records() ||
+  //               max_records == 0
+  template <typename Message>
+  size_t ReadMessagesSlow(google::protobuf::RepeatedPtrField<Message>* records,
+                          size_t max_records, RecordPosition* first_key);
+
   // Reads the next chunk from chunk_reader_ and decodes it into chunk_decoder_
   // and chunk_begin_. On failure resets chunk_decoder_.
   bool ReadChunk();
+
+  // Implementation of ReadChunk() if parallelism_ > 0: takes the next decoded
+  // chunk from decoders_ahead_, refilling the queue in background.
+  bool ReadChunkAhead();
+
+  // Reads chunks from src and schedules their decoding on the thread pool
+  // until parallelism_ decoders are pending. If reading fails from file
+  // corruption and a recovery function is set, recovers right away and
+  // continues, remembering the skipped region for reporting in record order.
+  // Stops early on other failures; they are reported when decoders_ahead_ is
+  // drained.
+  void FillDecodersAhead(ChunkReader* src);
+
+  // Calls the recovery function for each of *skipped_regions in order,
+  // removing reported entries. Returns false if the recovery function
+  // returned false; the remaining entries stay in *skipped_regions.
+  //
+  // Precondition: recovery_ != nullptr
+  bool ReportSkippedRegions(std::vector<SkippedRegion>* skipped_regions);
+
+  internal::ThreadPool& thread_pool() const;
+
+  // Moves the current chunk, if one has been decoded, into the cache of
+  // decoded chunks, evicting the least recently used entry if the cache is
+  // full. Does nothing if the cache is disabled.
+  void CacheCurrentChunk();
+
+  // If the chunk at chunk_begin is cached, moves its decoder into
+  // chunk_decoder_ with the index reset to 0, sets chunk_end_, removes the
+  // entry from the cache, and returns true.
+  bool TakeCachedChunk(Position chunk_begin);
+
+  // Locates the record index chunk near the end of the file and fills
+  // record_index_ from it. Moves the reading position; the caller is expected
+  // to seek afterwards.
+  //
+  // If missing_index_ok is true, a missing index sets record_index_absent_
+  // and returns true with the RecordReader healthy; otherwise a missing index
+  // causes a failure.
+  bool LoadRecordIndex(bool missing_index_ok);
+
+  // Fills record_index_ from the record index chunk which begins at
+  // index_chunk_begin.
+  bool ParseRecordIndex(const Chunk& chunk, Position index_chunk_begin);
+
+  // Implementation of Seek(Position) if the record index is loaded: locates
+  // the chunk containing new_pos by binary search in record_index_ and
+  // delegates to Seek(RecordPosition).
+  bool SeekUsingRecordIndex(Position new_pos);
+
+  // See Options::set_parallelism().
+  int parallelism_ = 0;
+
+  // See Options::set_thread_pool().
+  internal::ThreadPool* thread_pool_ = nullptr;
+
+  // Options of ChunkDecoders created for chunks read ahead, the same as the
+  // options which chunk_decoder_ was created with.
+  ChunkDecoder::Options chunk_decoder_options_;
+
+  // Zstd dictionary loaded from a dictionary chunk, given to decoders of
+  // chunks read ahead. Used only if parallelism_ > 0; otherwise chunk_decoder_
+  // keeps the dictionary itself.
+  std::shared_ptr<const std::string> zstd_dictionary_;
+
+  // Chunks read ahead of the current position, in order of their positions.
+  //
+  // Invariants:
+  //   if parallelism_ == 0 then decoders_ahead_.empty()
+  //   decoders_ahead_.size() <= IntCast<size_t>(parallelism_)
+  std::deque<DecoderAhead> decoders_ahead_;
+
+  // Regions skipped by eager recovery in FillDecodersAhead() after the last
+  // queued chunk, to be attached to the next queued chunk, or reported when
+  // reading ahead ends.
+  std::vector<SkippedRegion> pending_skipped_regions_;
+
+  // End position of the current chunk if it has been decoded by the serial
+  // reading path, used as the key range when caching the chunk.
+  //
+  // Invariant: if the current chunk has been decoded then
+  //            chunk_end_ > chunk_begin_
+  Position chunk_end_ = 0;
+
+  // See Options::set_decoded_chunk_cache_size().
+  size_t decoded_chunk_cache_size_ = 0;
+
+  // Cache of decoded chunks for random access, most recently used first.
+  //
+  // Invariants:
+  //   cached_chunks_.size() <= decoded_chunk_cache_size_
+  //   cached_chunk_index_ maps the chunk_begin of each entry of
+  //       cached_chunks_ to its iterator, and nothing else
+  std::list<CachedChunk> cached_chunks_;
+  absl::flat_hash_map<Position, std::list<CachedChunk>::iterator>
+      cached_chunk_index_;
+
+  // See Options::set_use_record_index().
+  bool use_record_index_ = false;
+
+  // See Options::set_speculative_search().
+  bool speculative_search_ = false;
+
+  // See Options::set_stats_sink().
+  StatsSink* stats_sink_ = nullptr;
+
+  // Whether record_index_ has been loaded, used by SeekToRecord() and, if
+  // use_record_index_, by Seek(Position).
+  bool record_index_loaded_ = false;
+
+  // Whether the file was found to have no record index, so that loading is
+  // not attempted again.
+  //
+  // Invariant: !(record_index_loaded_ && record_index_absent_)
+  bool record_index_absent_ = false;
+
+  // Whether entries of record_index_ carry chunk statistics, valid if
+  // record_index_loaded_.
+  bool record_index_has_statistics_ = false;
+
+  // Entries of the record index, sorted by first_record_ordinal, with a
+  // sentinel entry at the end whose chunk_begin is the position of the index
+  // chunk and whose first_record_ordinal is the total number of records.
+  //
+  // Invariant: if record_index_loaded_ then !record_index_.empty()
+  std::vector<IndexedChunk> record_index_;
 };
 
 // RecordReader reads records of a Riegeli/records file. A record is
@@ -377,6 +952,11 @@ class RecordReaderBase : public Object {
 // e.g. Reader* (not owned, default), unique_ptr<Reader> (owned),
 // ChainReader<> (owned).
 //
+// Using FdMMapReader<> as Src reads records with zero copies from the page
+// cache as long as chunks are not compressed: chunk data are shared with the
+// memory mapping rather than copied, and ReadRecord(absl::string_view*)
+// returns views into them.
+//
 // Src may also specify a ChunkReader instead of a byte Reader. In this case Src
 // must support Dependency<ChunkReader*, Src>, e.g. ChunkReader* (not owned),
 // unique_ptr<ChunkReader> (owned), DefaultChunkReader<> (owned).
@@ -480,6 +1060,91 @@ inline bool RecordReaderBase::ReadRecord(Chain* record, RecordPosition* key) {
   return ReadRecordSlow(record, key);
 }
 
+inline size_t RecordReaderBase::ReadRecords(
+    std::vector<absl::string_view>* records, size_t max_records,
+    RecordPosition* first_key) {
+  const uint64_t first_index = chunk_decoder_.index();
+  const size_t num_read = chunk_decoder_.ReadRecords(records, max_records);
+  if (ABSL_PREDICT_TRUE(num_read > 0)) {
+    if (first_key != nullptr) {
+      *first_key = RecordPosition(chunk_begin_, first_index);
+    }
+    return num_read;
+  }
+  return ReadRecordsSlow(records, max_records, first_key);
+}
+
+inline size_t RecordReaderBase::ReadRecords(std::vector<Chain>* records,
+                                            size_t max_records,
+                                            RecordPosition* first_key) {
+  const uint64_t first_index = chunk_decoder_.index();
+  const size_t num_read = chunk_decoder_.ReadRecords(records, max_records);
+  if (ABSL_PREDICT_TRUE(num_read > 0)) {
+    if (first_key != nullptr) {
+      *first_key = RecordPosition(chunk_begin_, first_index);
+    }
+    return num_read;
+  }
+  return ReadRecordsSlow(records, max_records, first_key);
+}
+
+template <typename Message>
+inline size_t RecordReaderBase::ReadMessages(
+    google::protobuf::RepeatedPtrField<Message>* records, size_t max_records,
+    RecordPosition* first_key) {
+  const uint64_t first_index = chunk_decoder_.index();
+  const size_t num_read = chunk_decoder_.ReadMessages(records, max_records);
+  if (ABSL_PREDICT_TRUE(num_read > 0)) {
+    if (first_key != nullptr) {
+      *first_key = RecordPosition(chunk_begin_, first_index);
+    }
+    return num_read;
+  }
+  return ReadMessagesSlow(records, max_records, first_key);
+}
+
+template <typename Message>
+size_t RecordReaderBase::ReadMessagesSlow(
+    google::protobuf::RepeatedPtrField<Message>* records, size_t max_records,
+    RecordPosition* first_key) {
+  if (ABSL_PREDICT_FALSE(max_records == 0)) return 0;
+  if (chunk_decoder_.healthy()) {
+    RIEGELI_ASSERT_EQ(chunk_decoder_.index(), chunk_decoder_.num_records())
+        << "Failed precondition of RecordReaderBase::ReadMessagesSlow(): "
+           "records available, use ReadMessages() instead";
+  }
+  if (ABSL_PREDICT_FALSE(!healthy())) {
+    if (!TryRecovery()) return 0;
+    goto again;
+  }
+  for (;;) {
+    if (ABSL_PREDICT_FALSE(!chunk_decoder_.healthy())) {
+      recoverable_ = Recoverable::kRecoverChunkDecoder;
+      Fail(chunk_decoder_);
+      if (!TryRecovery()) return 0;
+      goto again;
+    }
+    if (ABSL_PREDICT_FALSE(!ReadChunk())) {
+      if (!TryRecovery()) return 0;
+    }
+    // Retrying from here is equivalent to calling ReadMessages() again
+    // (not ReadMessagesSlow()).
+  again:
+    const uint64_t first_index = chunk_decoder_.index();
+    const size_t num_read = chunk_decoder_.ReadMessages(records, max_records);
+    if (ABSL_PREDICT_TRUE(num_read > 0)) {
+      if (first_key != nullptr) {
+        *first_key = RecordPosition(chunk_begin_, first_index);
+      }
+      return num_read;
+    }
+  }
+}
+
+inline bool RecordReaderBase::truncated() const {
+  return src_chunk_reader()->truncated();
+}
+
 inline bool RecordReaderBase::TryRecovery() {
   if (recovery_ == nullptr) return false;
   SkippedRegion skipped_region;
@@ -492,7 +1157,7 @@ inline RecordPosition RecordReaderBase::pos() const {
       ABSL_PREDICT_FALSE(recoverable_ == Recoverable::kRecoverChunkDecoder)) {
     return RecordPosition(chunk_begin_, chunk_decoder_.index());
   }
-  return RecordPosition(src_chunk_reader()->pos(), 0);
+  return RecordPosition(pos_after_current_chunk(src_chunk_reader()->pos()), 0);
 }
 
 template <typename Src>
@@ -532,11 +1197,13 @@ inline RecordPosition RecordReader<Src>::pos() const {
       ABSL_PREDICT_FALSE(recoverable_ == Recoverable::kRecoverChunkDecoder)) {
     return RecordPosition(chunk_begin_, chunk_decoder_.index());
   }
-  return RecordPosition(src_->pos(), 0);
+  return RecordPosition(pos_after_current_chunk(src_->pos()), 0);
 }
 
 extern template class RecordReader<Reader*>;
 extern template class RecordReader<std::unique_ptr<Reader>>;
+extern template class RecordReader<FdMMapReader<OwnedFd>>;
+extern template class RecordReader<FdMMapReader<int>>;
 extern template class RecordReader<ChunkReader*>;
 extern template class RecordReader<std::unique_ptr<ChunkReader>>;
 extern template class RecordReader<DefaultChunkReader<Reader*>>;
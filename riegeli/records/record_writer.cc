@@ -17,6 +17,7 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <atomic>
 #include <cmath>
 #include <deque>
 #include <future>
@@ -28,10 +29,14 @@
 
 #include "absl/base/optimization.h"
 #include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
 #include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
 #include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
 #include "absl/types/variant.h"
 #include "absl/utility/utility.h"
 #include "google/protobuf/descriptor.h"
@@ -41,20 +46,30 @@
 #include "riegeli/base/base.h"
 #include "riegeli/base/canonical_errors.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/memory.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
 #include "riegeli/base/options_parser.h"
 #include "riegeli/base/parallelism.h"
+#include "riegeli/base/recycling_pool.h"
+#include "riegeli/base/stats_sink.h"
 #include "riegeli/base/status.h"
 #include "riegeli/bytes/chain_writer.h"
+#include "riegeli/bytes/message_serialize.h"
 #include "riegeli/bytes/writer.h"
+#include "riegeli/bytes/writer_utils.h"
+#include "riegeli/chunk_encoding/aligned_encoder.h"
 #include "riegeli/chunk_encoding/chunk.h"
 #include "riegeli/chunk_encoding/chunk_encoder.h"
+#include "riegeli/chunk_encoding/compressor_options.h"
 #include "riegeli/chunk_encoding/constants.h"
 #include "riegeli/chunk_encoding/deferred_encoder.h"
 #include "riegeli/chunk_encoding/simple_encoder.h"
 #include "riegeli/chunk_encoding/transpose_encoder.h"
+#include "riegeli/chunk_encoding/trial_encoder.h"
 #include "riegeli/records/chunk_writer.h"
 #include "riegeli/records/record_position.h"
+#include "zdict.h"
 
 namespace riegeli {
 
@@ -76,6 +91,21 @@ constexpr uint64_t RecordWriterBase::Options::kDefaultChunkSize;
 
 namespace {
 
+// The number of records after which the record size histogram is considered
+// representative enough for adapting the chunk size.
+constexpr uint64_t kMinRecordsForAdaptiveChunkSize = 16;
+
+// Fixed point scale of the compression ratio observed on encoded chunks,
+// used if Options::set_compressed_chunk_size() is in effect.
+constexpr uint64_t kCompressionRatioScale = uint64_t{1} << 16;
+
+// Pool of idle chunk encoders shared between RecordWriters, used if
+// Options::set_recycle_chunk_encoders(true). Keyed by a string describing the
+// encoder configuration.
+using ChunkEncoderPool =
+    RecyclingPool<ChunkEncoder, std::default_delete<ChunkEncoder>,
+                  std::string>;
+
 class FileDescriptorCollector {
  public:
   explicit FileDescriptorCollector(
@@ -106,6 +136,32 @@ inline size_t RecordSize(const google::protobuf::MessageLite& record) {
   return record.ByteSizeLong();
 }
 
+// Desired size of a trained zstd dictionary. zstd recommends training data
+// roughly 100x larger than the dictionary; 64 kB works well for chunks of
+// small records.
+constexpr size_t kZstdDictionaryCapacity = size_t{64} << 10;
+
+// Upper bound on the amount of sampled record data retained for dictionary
+// training.
+constexpr size_t kMaxZstdDictionaryTrainingBytes = size_t{8} << 20;
+
+// Trains a zstd dictionary from concatenated sample records. Returns an empty
+// string if training failed, e.g. because there were too few samples; the
+// caller continues without a dictionary in that case.
+std::string TrainZstdDictionary(const Chain& samples,
+                                const std::vector<size_t>& sample_sizes) {
+  std::string flat_samples;
+  flat_samples.reserve(samples.size());
+  samples.AppendTo(&flat_samples);
+  std::string dictionary(kZstdDictionaryCapacity, '\0');
+  const size_t result = ZDICT_trainFromBuffer(
+      &dictionary[0], dictionary.size(), flat_samples.data(),
+      sample_sizes.data(), IntCast<unsigned>(sample_sizes.size()));
+  if (ABSL_PREDICT_FALSE(ZDICT_isError(result))) return std::string();
+  dictionary.resize(result);
+  return dictionary;
+}
+
 }  // namespace
 
 void SetRecordType(RecordsMetadata* metadata,
@@ -124,11 +180,30 @@ Status RecordWriterBase::Options::FromString(absl::string_view text) {
       "transpose",
       ValueParser::Enum(&transpose_,
                         {{"", true}, {"true", true}, {"false", false}}));
+  options_parser.AddOption(
+      "auto_transpose",
+      ValueParser::Enum(&auto_transpose_,
+                        {{"", true}, {"true", true}, {"false", false}}));
+  options_parser.AddOption(
+      "columnar",
+      ValueParser::Enum(&columnar_,
+                        {{"", true}, {"true", true}, {"false", false}}));
+  options_parser.AddOption(
+      "aligned",
+      ValueParser::Enum(&aligned_,
+                        {{"", true}, {"true", true}, {"false", false}}));
   options_parser.AddOption("uncompressed",
                            ValueParser::CopyTo(&compressor_text));
   options_parser.AddOption("brotli", ValueParser::CopyTo(&compressor_text));
   options_parser.AddOption("zstd", ValueParser::CopyTo(&compressor_text));
+  options_parser.AddOption("snappy", ValueParser::CopyTo(&compressor_text));
   options_parser.AddOption("window_log", ValueParser::CopyTo(&compressor_text));
+  options_parser.AddOption("long_distance_matching",
+                           ValueParser::CopyTo(&compressor_text));
+  options_parser.AddOption(
+      "train_zstd_dictionary",
+      ValueParser::Enum(&train_zstd_dictionary_,
+                        {{"", true}, {"true", true}, {"false", false}}));
   options_parser.AddOption(
       "chunk_size", ValueParser::Bytes(&chunk_size_, 1,
                                        std::numeric_limits<uint64_t>::max()));
@@ -138,22 +213,78 @@ Status RecordWriterBase::Options::FromString(absl::string_view text) {
       "pad_to_block_boundary",
       ValueParser::Enum(&pad_to_block_boundary_,
                         {{"", true}, {"true", true}, {"false", false}}));
+  options_parser.AddOption(
+      "write_record_index",
+      ValueParser::Enum(&write_record_index_,
+                        {{"", true}, {"true", true}, {"false", false}}));
   options_parser.AddOption(
       "parallelism",
       ValueParser::Int(&parallelism_, 0, std::numeric_limits<int>::max()));
+  options_parser.AddOption(
+      "adaptive_parallelism",
+      ValueParser::Enum(&adaptive_parallelism_,
+                        {{"", true}, {"true", true}, {"false", false}}));
+  options_parser.AddOption(
+      "size_hint", ValueParser::Bytes(&size_hint_, 0,
+                                      std::numeric_limits<uint64_t>::max()));
   if (ABSL_PREDICT_FALSE(!options_parser.FromString(text))) {
     return options_parser.status();
   }
   return compressor_options_.FromString(compressor_text);
 }
 
+Status RecordWriterBase::Options::FromCachedString(absl::string_view text) {
+  // In the intended usage the same few option strings repeat, but the cache
+  // is bounded anyway so that a stream of distinct strings does not grow
+  // memory without limit.
+  constexpr size_t kMaxCacheSize = 100;
+  struct Cache {
+    absl::Mutex mutex;
+    absl::flat_hash_map<std::string, Options> entries GUARDED_BY(mutex);
+  };
+  static NoDestructor<Cache> kCache;
+  {
+    absl::MutexLock lock(&kCache->mutex);
+    const auto iter = kCache->entries.find(text);
+    if (ABSL_PREDICT_TRUE(iter != kCache->entries.end())) {
+      *this = iter->second;
+      return OkStatus();
+    }
+  }
+  // Parse without holding mutex. Several threads may parse the same text
+  // concurrently the first time it is seen; they compute the same result.
+  Options options;
+  {
+    const Status status = options.FromString(text);
+    // Failures are not cached; they are not expected to repeat at a high
+    // rate, and caching them would let malformed strings evict valid ones.
+    if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+  }
+  {
+    absl::MutexLock lock(&kCache->mutex);
+    if (ABSL_PREDICT_FALSE(kCache->entries.size() >= kMaxCacheSize)) {
+      kCache->entries.clear();
+    }
+    kCache->entries.emplace(std::string(text), options);
+  }
+  *this = std::move(options);
+  return OkStatus();
+}
+
 class RecordWriterBase::Worker : public Object {
  public:
   explicit Worker(ChunkWriter* chunk_writer, Options&& options)
       : Object(State::kOpen),
         options_(std::move(options)),
         chunk_writer_(RIEGELI_ASSERT_NOTNULL(chunk_writer)),
-        chunk_encoder_(MakeChunkEncoder()) {
+        chunk_encoder_(MakeChunkEncoder()),
+        collecting_zstd_samples_(
+            options_.train_zstd_dictionary_ &&
+            options_.compressor_options_.compression_type() ==
+                CompressionType::kZstd),
+        collecting_chunk_statistics_(
+            options_.write_record_index_ &&
+            options_.chunk_statistics_key_ != nullptr) {
     if (ABSL_PREDICT_FALSE(!chunk_writer_->healthy())) Fail(*chunk_writer_);
   }
 
@@ -173,32 +304,212 @@ class RecordWriterBase::Worker : public Object {
   // If the result is false then !healthy().
   virtual bool CloseChunk() = 0;
 
+  // Compression ratio observed on encoded chunks, as a fraction scaled by
+  // kCompressionRatioScale, or 0 until the first chunk has been encoded.
+  uint64_t chunk_compression_ratio() const {
+    return chunk_compression_ratio_.load(std::memory_order_relaxed);
+  }
+
   bool MaybePadToBlockBoundary();
 
+  // Precondition: chunk is not open.
+  bool MaybeWriteRecordIndex();
+
+  // Marks the Worker as failed with kCancelled, so that queued encoding
+  // tasks and the chunk writer thread skip remaining work at their next
+  // healthy() check. Does not wait for them; Close() does.
+  void Cancel() { Fail(CancelledError("RecordWriter canceled")); }
+
   // Precondition: chunk is not open.
   virtual bool Flush(FlushType flush_type) = 0;
 
+  // Precondition: chunk is not open.
+  virtual std::future<bool> FutureFlush(FlushType flush_type) = 0;
+
   virtual FutureRecordPosition Pos() const = 0;
 
+  // Returns statistics of the pipeline collected so far.
+  virtual PipelineStats pipeline_stats() const;
+
+  // Registers this Worker (sizeof(*this)) and its subobjects with
+  // *memory_estimator.
+  virtual void RegisterUnique(MemoryEstimator* memory_estimator) const;
+
  protected:
+  // An entry of the record index: the chunk written at chunk_begin contains
+  // num_records records. If chunk statistics are collected, decoded_data_size
+  // and the range of record keys of the chunk are stored as well.
+  struct RecordIndexEntry {
+    Position chunk_begin;
+    uint64_t num_records;
+    uint64_t decoded_data_size;
+    std::string min_key;
+    std::string max_key;
+  };
+
   void Initialize(Position initial_pos);
   virtual bool WriteSignature() = 0;
   virtual bool WriteMetadata() = 0;
   virtual bool PadToBlockBoundary() = 0;
+  // Writes an already encoded dictionary chunk.
+  virtual bool WriteDictionaryChunk(Chunk chunk) = 0;
+  // Writes the record index chunk collected in record_index_.
+  virtual bool WriteRecordIndex() = 0;
+
+  // The number of requests currently queued in the write pipeline, passed to
+  // Options::set_compression_level_policy(). 0 in SerialWorker.
+  virtual size_t PendingChunks() const { return 0; }
 
   std::unique_ptr<ChunkEncoder> MakeChunkEncoder();
+  std::unique_ptr<ChunkEncoder> MakeSimpleEncoder(
+      CompressorOptions compressor_options);
+  std::unique_ptr<ChunkEncoder> MakeTransposeEncoder(
+      CompressorOptions compressor_options);
+  // Returns a chunk encoder to ChunkEncoderPool, for reuse by a later chunk
+  // or by another RecordWriter.
+  //
+  // Precondition: the encoder was obtained by a MakeChunkEncoder() call
+  // which set chunk_encoder_is_recyclable_
+  void RecycleChunkEncoder(std::unique_ptr<ChunkEncoder> chunk_encoder);
   void EncodeSignature(Chunk* chunk);
   bool EncodeMetadata(Chunk* chunk);
   bool EncodeChunk(ChunkEncoder* chunk_encoder, Chunk* chunk);
+  bool EncodeRecordIndex(Chunk* chunk);
+  // Trains the zstd dictionary from the samples collected so far and writes
+  // the dictionary chunk. Clears collecting_zstd_samples_; subsequent chunk
+  // encoders made by MakeChunkEncoder() use the dictionary.
+  bool TrainAndWriteZstdDictionary();
+  // Registers subobjects common to both workers with *memory_estimator,
+  // except record_index_, whose ownership differs between workers.
+  void RegisterCommonSubobjects(MemoryEstimator* memory_estimator) const;
+
+  // Writes a chunk to chunk_writer_, accounting the writing time and written
+  // bytes in stats_.
+  bool WriteChunkInstrumented(const Chunk& chunk);
+  // Accounts an encoded chunk of the given size as waiting to be written.
+  void AddQueuedBytes(uint64_t size);
 
   Options options_;
   // Invariant: chunk_writer_ != nullptr
   ChunkWriter* chunk_writer_;
   // Invariant: if chunk is open then chunk_encoder_ != nullptr
   std::unique_ptr<ChunkEncoder> chunk_encoder_;
+  // Whether record values are still being sampled for dictionary training.
+  bool collecting_zstd_samples_;
+  // Whether chunk statistics are collected for the record index.
+  bool collecting_chunk_statistics_;
+  // Range of record keys of the chunk being written, valid if
+  // chunk_has_keys_. Used only if collecting_chunk_statistics_.
+  bool chunk_has_keys_ = false;
+  std::string chunk_min_key_;
+  std::string chunk_max_key_;
+  // Sampled record values, valid while collecting_zstd_samples_.
+  Chain zstd_samples_;
+  std::vector<size_t> zstd_sample_sizes_;
+  // The trained dictionary used by MakeChunkEncoder(), or nullptr.
+  std::shared_ptr<const std::string> zstd_dictionary_;
+  // Outcome of automatic transpose selection, used if
+  // Options::set_auto_transpose(true): -1 while undecided, otherwise 0
+  // (simple) or 1 (transposed). Set from a chunk encoding task, read by
+  // MakeChunkEncoder().
+  std::atomic<int> transpose_decision_{-1};
+  // Whether the last encoder made by MakeChunkEncoder() is a TrialEncoder,
+  // which must be replaced instead of reset once the decision is made.
+  bool chunk_encoder_is_trial_ = false;
+  // Whether the last encoder made by MakeChunkEncoder() came from
+  // ChunkEncoderPool and should be returned there with
+  // RecycleChunkEncoder(). Encoders whose configuration varies per chunk are
+  // never recycled.
+  bool chunk_encoder_is_recyclable_ = false;
+  // The pool key of recyclable encoders of this Worker. Written at most
+  // once, before any chunk encoding task which reads it is scheduled.
+  std::string chunk_encoder_pool_key_;
+  // Bucket size adapted from compression feedback, used if
+  // Options::set_adaptive_bucket_fraction() is in effect: 0 until the first
+  // feedback arrives, then the bucket size for subsequent transposed chunks.
+  // Set from a chunk encoding task, read by MakeChunkEncoder().
+  std::atomic<uint64_t> adaptive_bucket_size_{0};
+  // See chunk_compression_ratio(). Set from a chunk encoding task, read by
+  // RecordWriterBase::WriteRecordImpl(). Smoothing between concurrent
+  // encoding tasks is racy, which is harmless for a heuristic.
+  std::atomic<uint64_t> chunk_compression_ratio_{0};
+  // Entries of the record index, in order of chunk positions, filled if
+  // Options::set_write_record_index(true). In ParallelWorker accessed only by
+  // the chunk writer thread (and by WriteRecordIndex() via a request to it).
+  std::vector<RecordIndexEntry> record_index_;
+  // Statistics of the pipeline. In ParallelWorker updated from the chunk
+  // encoding tasks and the chunk writer thread.
+  mutable absl::Mutex stats_mutex_;
+  PipelineStats stats_ GUARDED_BY(stats_mutex_);
+
+ private:
+  void AddZstdDictionarySample(const google::protobuf::MessageLite& record);
+  void AddZstdDictionarySample(absl::string_view record);
+  void AddZstdDictionarySample(const Chain& record);
+
+  void UpdateChunkStatistics(const google::protobuf::MessageLite& record);
+  void UpdateChunkStatistics(absl::string_view record);
+  void UpdateChunkStatistics(const Chain& record);
 };
 
-RecordWriterBase::Worker::~Worker() {}
+RecordWriterBase::Worker::~Worker() {
+  if (chunk_encoder_is_recyclable_) {
+    RecycleChunkEncoder(std::move(chunk_encoder_));
+  }
+}
+
+RecordWriterBase::PipelineStats RecordWriterBase::Worker::pipeline_stats()
+    const {
+  absl::MutexLock lock(&stats_mutex_);
+  return stats_;
+}
+
+void RecordWriterBase::Worker::RegisterUnique(
+    MemoryEstimator* memory_estimator) const {
+  memory_estimator->RegisterDynamicMemory(sizeof(*this));
+  RegisterCommonSubobjects(memory_estimator);
+  memory_estimator->RegisterMemory(record_index_.capacity() *
+                                   sizeof(RecordIndexEntry));
+  for (const RecordIndexEntry& entry : record_index_) {
+    memory_estimator->RegisterMemory(entry.min_key.capacity() +
+                                     entry.max_key.capacity());
+  }
+}
+
+void RecordWriterBase::Worker::RegisterCommonSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  if (chunk_encoder_ != nullptr) {
+    chunk_encoder_->RegisterUnique(memory_estimator);
+  }
+  zstd_samples_.RegisterSubobjects(memory_estimator);
+  memory_estimator->RegisterMemory(zstd_sample_sizes_.capacity() *
+                                   sizeof(size_t));
+  if (zstd_dictionary_ != nullptr &&
+      memory_estimator->RegisterNode(zstd_dictionary_.get())) {
+    memory_estimator->RegisterDynamicMemory(sizeof(std::string) +
+                                            zstd_dictionary_->capacity());
+  }
+  memory_estimator->RegisterMemory(chunk_min_key_.capacity() +
+                                   chunk_max_key_.capacity());
+}
+
+inline bool RecordWriterBase::Worker::WriteChunkInstrumented(
+    const Chunk& chunk) {
+  const absl::Time before = absl::Now();
+  const bool ok = chunk_writer_->WriteChunk(chunk);
+  const absl::Duration elapsed = absl::Now() - before;
+  absl::MutexLock lock(&stats_mutex_);
+  stats_.writing_time += elapsed;
+  if (ABSL_PREDICT_TRUE(ok)) {
+    stats_.written_bytes += chunk.header.size() + chunk.data.size();
+  }
+  return ok;
+}
+
+void RecordWriterBase::Worker::AddQueuedBytes(uint64_t size) {
+  absl::MutexLock lock(&stats_mutex_);
+  stats_.queued_bytes += size;
+}
 
 inline void RecordWriterBase::Worker::Initialize(Position initial_pos) {
   if (initial_pos == 0) {
@@ -217,32 +528,172 @@ inline bool RecordWriterBase::Worker::MaybePadToBlockBoundary() {
   }
 }
 
+inline bool RecordWriterBase::Worker::MaybeWriteRecordIndex() {
+  if (options_.write_record_index_) {
+    return WriteRecordIndex();
+  } else {
+    return true;
+  }
+}
+
 inline std::unique_ptr<ChunkEncoder>
 RecordWriterBase::Worker::MakeChunkEncoder() {
-  std::unique_ptr<ChunkEncoder> chunk_encoder;
-  if (options_.transpose_) {
-    const long double long_double_bucket_size =
-        std::round(static_cast<long double>(options_.chunk_size_) *
-                   static_cast<long double>(options_.bucket_fraction_));
-    const uint64_t bucket_size =
-        ABSL_PREDICT_FALSE(
-            long_double_bucket_size >=
-            static_cast<long double>(std::numeric_limits<uint64_t>::max()))
-            ? std::numeric_limits<uint64_t>::max()
-            : ABSL_PREDICT_TRUE(long_double_bucket_size >= 1.0L)
-                  ? static_cast<uint64_t>(long_double_bucket_size)
-                  : uint64_t{1};
-    chunk_encoder = absl::make_unique<TransposeEncoder>(
-        options_.compressor_options_, bucket_size);
-  } else {
-    chunk_encoder = absl::make_unique<SimpleEncoder>(
-        options_.compressor_options_, options_.chunk_size_);
+  CompressorOptions compressor_options = options_.compressor_options_;
+  if (zstd_dictionary_ != nullptr) {
+    compressor_options.set_zstd_dictionary(zstd_dictionary_);
+  }
+  if (ABSL_PREDICT_FALSE(options_.compression_level_policy_ != nullptr)) {
+    switch (compressor_options.compression_type()) {
+      case CompressionType::kNone:
+      case CompressionType::kSnappy:
+        // No compression levels to vary.
+        break;
+      case CompressionType::kBrotli:
+        compressor_options.set_brotli(
+            options_.compression_level_policy_(PendingChunks()));
+        break;
+      case CompressionType::kZstd:
+        compressor_options.set_zstd(
+            options_.compression_level_policy_(PendingChunks()));
+        break;
+    }
   }
-  if (options_.parallelism_ == 0) {
+  chunk_encoder_is_trial_ = false;
+  chunk_encoder_is_recyclable_ = false;
+  bool transpose = false;
+  if (!options_.aligned_) {
+    transpose = options_.transpose_;
+    if (options_.auto_transpose_) {
+      const int decision = transpose_decision_.load(std::memory_order_relaxed);
+      if (decision < 0) {
+        // Undecided yet: encode this chunk both ways and lock in the winner.
+        // TrialEncoder already defers encoding to EncodeAndClose(), hence it
+        // is not wrapped in a DeferredEncoder.
+        std::atomic<int>* const transpose_decision = &transpose_decision_;
+        chunk_encoder_is_trial_ = true;
+        return absl::make_unique<TrialEncoder>(
+            MakeSimpleEncoder(compressor_options),
+            MakeTransposeEncoder(std::move(compressor_options)),
+            [transpose_decision](size_t winner) {
+              int expected = -1;
+              transpose_decision->compare_exchange_strong(
+                  expected, IntCast<int>(winner), std::memory_order_relaxed);
+            });
+      }
+      transpose = decision != 0;
+    }
+  }
+  const auto factory = [&]() {
+    std::unique_ptr<ChunkEncoder> chunk_encoder;
+    if (options_.aligned_) {
+      chunk_encoder = absl::make_unique<AlignedEncoder>(options_.chunk_size_);
+    } else if (transpose) {
+      chunk_encoder = MakeTransposeEncoder(std::move(compressor_options));
+    } else {
+      chunk_encoder = MakeSimpleEncoder(std::move(compressor_options));
+    }
+    if (options_.parallelism_ != 0) {
+      chunk_encoder =
+          absl::make_unique<DeferredEncoder>(std::move(chunk_encoder));
+    }
     return chunk_encoder;
-  } else {
-    return absl::make_unique<DeferredEncoder>(std::move(chunk_encoder));
+  };
+  if (options_.recycle_chunk_encoders_ &&
+      options_.compression_level_policy_ == nullptr &&
+      zstd_dictionary_ == nullptr &&
+      !(transpose && options_.bucket_compression_target_ > 0.0 &&
+        compressor_options.compression_type() != CompressionType::kNone)) {
+    // The encoder configuration is fixed, hence a compatible idle encoder
+    // from an earlier chunk or RecordWriter can be reused.
+    chunk_encoder_is_recyclable_ = true;
+    if (chunk_encoder_pool_key_.empty()) {
+      chunk_encoder_pool_key_ = absl::StrCat(
+          options_.aligned_ ? "aligned"
+                            : transpose ? "transpose" : "simple",
+          ":", options_.chunk_size_, ":", options_.bucket_fraction_, ":",
+          options_.columnar_ ? 1 : 0, ":",
+          options_.parallelism_ == 0 ? 0 : 1, ":",
+          static_cast<int>(compressor_options.compression_type()), ":",
+          compressor_options.compression_level(), ":",
+          compressor_options.window_log());
+    }
+    ChunkEncoderPool::Handle handle = ChunkEncoderPool::global().Get(
+        chunk_encoder_pool_key_, factory,
+        [](ChunkEncoder* chunk_encoder) { chunk_encoder->Reset(); });
+    return std::unique_ptr<ChunkEncoder>(handle.release());
   }
+  return factory();
+}
+
+inline void RecordWriterBase::Worker::RecycleChunkEncoder(
+    std::unique_ptr<ChunkEncoder> chunk_encoder) {
+  if (chunk_encoder == nullptr) return;
+  RIEGELI_ASSERT(!chunk_encoder_pool_key_.empty())
+      << "Failed precondition of "
+         "RecordWriterBase::Worker::RecycleChunkEncoder(): "
+         "no pool key assigned";
+  // The encoder is stored as is; Get() resets it before reuse.
+  ChunkEncoderPool::global().Put(chunk_encoder_pool_key_,
+                                 std::move(chunk_encoder));
+}
+
+inline std::unique_ptr<ChunkEncoder>
+RecordWriterBase::Worker::MakeSimpleEncoder(
+    CompressorOptions compressor_options) {
+  return absl::make_unique<SimpleEncoder>(std::move(compressor_options),
+                                          options_.chunk_size_);
+}
+
+inline std::unique_ptr<ChunkEncoder>
+RecordWriterBase::Worker::MakeTransposeEncoder(
+    CompressorOptions compressor_options) {
+  const long double long_double_bucket_size =
+      std::round(static_cast<long double>(options_.chunk_size_) *
+                 static_cast<long double>(options_.bucket_fraction_));
+  uint64_t bucket_size =
+      ABSL_PREDICT_FALSE(
+          long_double_bucket_size >=
+          static_cast<long double>(std::numeric_limits<uint64_t>::max()))
+          ? std::numeric_limits<uint64_t>::max()
+          : ABSL_PREDICT_TRUE(long_double_bucket_size >= 1.0L)
+                ? static_cast<uint64_t>(long_double_bucket_size)
+                : uint64_t{1};
+  if (options_.bucket_compression_target_ > 0.0 &&
+      compressor_options.compression_type() != CompressionType::kNone) {
+    const uint64_t adapted_bucket_size =
+        adaptive_bucket_size_.load(std::memory_order_relaxed);
+    if (adapted_bucket_size > 0) bucket_size = adapted_bucket_size;
+    std::unique_ptr<TransposeEncoder> transpose_encoder =
+        absl::make_unique<TransposeEncoder>(std::move(compressor_options),
+                                            bucket_size, options_.columnar_);
+    std::atomic<uint64_t>* const adaptive_bucket_size = &adaptive_bucket_size_;
+    const double target = options_.bucket_compression_target_;
+    const uint64_t initial_bucket_size = bucket_size;
+    const uint64_t max_bucket_size = options_.chunk_size_;
+    transpose_encoder->set_bucket_feedback(
+        [adaptive_bucket_size, target, initial_bucket_size, max_bucket_size](
+            uint64_t uncompressed_size, uint64_t compressed_size) {
+          if (uncompressed_size == 0) return;
+          uint64_t bucket_size =
+              adaptive_bucket_size->load(std::memory_order_relaxed);
+          if (bucket_size == 0) bucket_size = initial_bucket_size;
+          // Multiplicative decrease toward finer projection granularity while
+          // the target ratio is met, multiplicative increase toward better
+          // density when it is not.
+          if (static_cast<double>(compressed_size) <=
+              target * static_cast<double>(uncompressed_size)) {
+            bucket_size = UnsignedMax(bucket_size - bucket_size / 4,
+                                      uint64_t{1});
+          } else {
+            bucket_size = UnsignedMin(bucket_size + bucket_size / 4 + 1,
+                                      max_bucket_size);
+          }
+          adaptive_bucket_size->store(bucket_size, std::memory_order_relaxed);
+        });
+    return transpose_encoder;
+  }
+  return absl::make_unique<TransposeEncoder>(std::move(compressor_options),
+                                             bucket_size, options_.columnar_);
 }
 
 inline void RecordWriterBase::Worker::EncodeSignature(Chunk* chunk) {
@@ -275,6 +726,12 @@ inline bool RecordWriterBase::Worker::EncodeMetadata(Chunk* chunk) {
 template <typename Record>
 inline bool RecordWriterBase::Worker::AddRecord(Record&& record) {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  if (ABSL_PREDICT_FALSE(collecting_zstd_samples_)) {
+    AddZstdDictionarySample(record);
+  }
+  if (ABSL_PREDICT_FALSE(collecting_chunk_statistics_)) {
+    UpdateChunkStatistics(record);
+  }
   if (ABSL_PREDICT_FALSE(
           !chunk_encoder_->AddRecord(std::forward<Record>(record)))) {
     return Fail(*chunk_encoder_);
@@ -282,9 +739,124 @@ inline bool RecordWriterBase::Worker::AddRecord(Record&& record) {
   return true;
 }
 
+inline void RecordWriterBase::Worker::AddZstdDictionarySample(
+    const google::protobuf::MessageLite& record) {
+  if (zstd_samples_.size() >= kMaxZstdDictionaryTrainingBytes) return;
+  Chain serialized;
+  // Sampling is best effort; an unserializable record is simply skipped.
+  if (ABSL_PREDICT_FALSE(!SerializeToChain(record, &serialized).ok())) return;
+  if (serialized.empty()) return;
+  zstd_sample_sizes_.push_back(serialized.size());
+  zstd_samples_.Append(std::move(serialized));
+}
+
+inline void RecordWriterBase::Worker::AddZstdDictionarySample(
+    absl::string_view record) {
+  if (zstd_samples_.size() >= kMaxZstdDictionaryTrainingBytes) return;
+  if (record.empty()) return;
+  zstd_sample_sizes_.push_back(record.size());
+  zstd_samples_.Append(record);
+}
+
+inline void RecordWriterBase::Worker::AddZstdDictionarySample(
+    const Chain& record) {
+  if (zstd_samples_.size() >= kMaxZstdDictionaryTrainingBytes) return;
+  if (record.empty()) return;
+  zstd_sample_sizes_.push_back(record.size());
+  zstd_samples_.Append(record);
+}
+
+inline void RecordWriterBase::Worker::UpdateChunkStatistics(
+    const google::protobuf::MessageLite& record) {
+  std::string serialized;
+  // Statistics are best effort; an unserializable record is simply skipped.
+  if (ABSL_PREDICT_FALSE(!record.SerializeToString(&serialized))) return;
+  UpdateChunkStatistics(absl::string_view(serialized));
+}
+
+inline void RecordWriterBase::Worker::UpdateChunkStatistics(
+    absl::string_view record) {
+  std::string key = options_.chunk_statistics_key_(record);
+  if (!chunk_has_keys_) {
+    chunk_has_keys_ = true;
+    chunk_min_key_ = key;
+    chunk_max_key_ = std::move(key);
+    return;
+  }
+  if (key < chunk_min_key_) {
+    chunk_min_key_ = std::move(key);
+  } else if (key > chunk_max_key_) {
+    chunk_max_key_ = std::move(key);
+  }
+}
+
+inline void RecordWriterBase::Worker::UpdateChunkStatistics(
+    const Chain& record) {
+  const std::string flat(record);
+  UpdateChunkStatistics(absl::string_view(flat));
+}
+
+inline bool RecordWriterBase::Worker::EncodeRecordIndex(Chunk* chunk) {
+  ChainWriter<> data_writer(&chunk->data);
+  if (ABSL_PREDICT_FALSE(!WriteVarint64(
+          &data_writer, IntCast<uint64_t>(record_index_.size()))) ||
+      ABSL_PREDICT_FALSE(!WriteVarint64(
+          &data_writer, collecting_chunk_statistics_
+                            ? uint64_t{kRecordIndexHasStatistics}
+                            : uint64_t{0}))) {
+    return Fail(data_writer);
+  }
+  Position prev_chunk_begin = 0;
+  for (const RecordIndexEntry& entry : record_index_) {
+    if (ABSL_PREDICT_FALSE(!WriteVarint64(
+            &data_writer,
+            IntCast<uint64_t>(entry.chunk_begin - prev_chunk_begin))) ||
+        ABSL_PREDICT_FALSE(!WriteVarint64(&data_writer, entry.num_records))) {
+      return Fail(data_writer);
+    }
+    prev_chunk_begin = entry.chunk_begin;
+    if (!collecting_chunk_statistics_) continue;
+    if (ABSL_PREDICT_FALSE(
+            !WriteVarint64(&data_writer, entry.decoded_data_size)) ||
+        ABSL_PREDICT_FALSE(!WriteVarint64(
+            &data_writer, IntCast<uint64_t>(entry.min_key.size()))) ||
+        ABSL_PREDICT_FALSE(!data_writer.Write(entry.min_key)) ||
+        ABSL_PREDICT_FALSE(!WriteVarint64(
+            &data_writer, IntCast<uint64_t>(entry.max_key.size()))) ||
+        ABSL_PREDICT_FALSE(!data_writer.Write(entry.max_key))) {
+      return Fail(data_writer);
+    }
+  }
+  if (ABSL_PREDICT_FALSE(!data_writer.Close())) return Fail(data_writer);
+  chunk->header = ChunkHeader(chunk->data, ChunkType::kRecordIndex, 0, 0);
+  return true;
+}
+
+inline bool RecordWriterBase::Worker::TrainAndWriteZstdDictionary() {
+  RIEGELI_ASSERT(collecting_zstd_samples_)
+      << "Failed precondition of "
+         "RecordWriterBase::Worker::TrainAndWriteZstdDictionary(): "
+         "sample collection already finished";
+  collecting_zstd_samples_ = false;
+  std::string dictionary = TrainZstdDictionary(zstd_samples_,
+                                               zstd_sample_sizes_);
+  zstd_samples_ = Chain();
+  zstd_sample_sizes_ = std::vector<size_t>();
+  // If training failed, e.g. because there were too few samples, continue
+  // without a dictionary.
+  if (dictionary.empty()) return true;
+  zstd_dictionary_ =
+      std::make_shared<const std::string>(std::move(dictionary));
+  Chunk chunk;
+  chunk.data = Chain(absl::string_view(*zstd_dictionary_));
+  chunk.header = ChunkHeader(chunk.data, ChunkType::kDictionary, 0, 0);
+  return WriteDictionaryChunk(std::move(chunk));
+}
+
 inline bool RecordWriterBase::Worker::EncodeChunk(ChunkEncoder* chunk_encoder,
                                                   Chunk* chunk) {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  const absl::Time before = absl::Now();
   ChunkType chunk_type;
   uint64_t num_records;
   uint64_t decoded_data_size;
@@ -297,6 +869,25 @@ inline bool RecordWriterBase::Worker::EncodeChunk(ChunkEncoder* chunk_encoder,
   if (ABSL_PREDICT_FALSE(!data_writer.Close())) return Fail(data_writer);
   chunk->header =
       ChunkHeader(chunk->data, chunk_type, num_records, decoded_data_size);
+  if (options_.compressed_chunk_size_ > 0 && decoded_data_size > 0) {
+    const uint64_t ratio = UnsignedMax(
+        uint64_t{chunk->data.size()} * kCompressionRatioScale /
+            decoded_data_size,
+        uint64_t{1});
+    const uint64_t previous =
+        chunk_compression_ratio_.load(std::memory_order_relaxed);
+    chunk_compression_ratio_.store(
+        previous == 0 ? ratio : (previous * 3 + ratio) / 4,
+        std::memory_order_relaxed);
+  }
+  const absl::Duration elapsed = absl::Now() - before;
+  if (ABSL_PREDICT_FALSE(options_.stats_sink_ != nullptr)) {
+    options_.stats_sink_->OnChunkEncoded(elapsed);
+  }
+  absl::MutexLock lock(&stats_mutex_);
+  ++stats_.chunks_encoded;
+  stats_.encoded_bytes += chunk->header.size() + chunk->data.size();
+  stats_.encoding_time += elapsed;
   return true;
 }
 
@@ -304,15 +895,29 @@ class RecordWriterBase::SerialWorker : public Worker {
  public:
   explicit SerialWorker(ChunkWriter* chunk_writer, Options&& options);
 
-  void OpenChunk() override { chunk_encoder_->Reset(); }
+  void OpenChunk() override {
+    if (ABSL_PREDICT_FALSE(
+            options_.compression_level_policy_ != nullptr ||
+            (chunk_encoder_is_trial_ &&
+             transpose_decision_.load(std::memory_order_relaxed) >= 0))) {
+      // The policy may choose a different level for the new chunk, or the
+      // automatic transpose choice was just made and the trial is over.
+      chunk_encoder_ = MakeChunkEncoder();
+    } else {
+      chunk_encoder_->Reset();
+    }
+  }
   bool CloseChunk() override;
   bool Flush(FlushType flush_type) override;
+  std::future<bool> FutureFlush(FlushType flush_type) override;
   FutureRecordPosition Pos() const override;
 
  protected:
   bool WriteSignature() override;
   bool WriteMetadata() override;
   bool PadToBlockBoundary() override;
+  bool WriteDictionaryChunk(Chunk chunk) override;
+  bool WriteRecordIndex() override;
 };
 
 inline RecordWriterBase::SerialWorker::SerialWorker(ChunkWriter* chunk_writer,
@@ -325,7 +930,7 @@ bool RecordWriterBase::SerialWorker::WriteSignature() {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
   Chunk chunk;
   EncodeSignature(&chunk);
-  if (ABSL_PREDICT_FALSE(!chunk_writer_->WriteChunk(chunk))) {
+  if (ABSL_PREDICT_FALSE(!WriteChunkInstrumented(chunk))) {
     return Fail(*chunk_writer_);
   }
   return true;
@@ -339,7 +944,15 @@ bool RecordWriterBase::SerialWorker::WriteMetadata() {
   }
   Chunk chunk;
   if (ABSL_PREDICT_FALSE(!EncodeMetadata(&chunk))) return false;
-  if (ABSL_PREDICT_FALSE(!chunk_writer_->WriteChunk(chunk))) {
+  if (ABSL_PREDICT_FALSE(!WriteChunkInstrumented(chunk))) {
+    return Fail(*chunk_writer_);
+  }
+  return true;
+}
+
+bool RecordWriterBase::SerialWorker::WriteDictionaryChunk(Chunk chunk) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  if (ABSL_PREDICT_FALSE(!WriteChunkInstrumented(chunk))) {
     return Fail(*chunk_writer_);
   }
   return true;
@@ -347,11 +960,49 @@ bool RecordWriterBase::SerialWorker::WriteMetadata() {
 
 bool RecordWriterBase::SerialWorker::CloseChunk() {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  const bool train_zstd_dictionary = collecting_zstd_samples_;
+  if (ABSL_PREDICT_FALSE(train_zstd_dictionary)) {
+    // The dictionary chunk is written ahead of this data chunk. This chunk
+    // itself is still compressed without the dictionary: its records were
+    // already added to the chunk encoder.
+    if (ABSL_PREDICT_FALSE(!TrainAndWriteZstdDictionary())) return false;
+  }
   Chunk chunk;
   if (ABSL_PREDICT_FALSE(!EncodeChunk(chunk_encoder_.get(), &chunk))) {
     return false;
   }
-  if (ABSL_PREDICT_FALSE(!chunk_writer_->WriteChunk(chunk))) {
+  if (ABSL_PREDICT_FALSE(options_.write_record_index_) &&
+      chunk.header.num_records() > 0) {
+    record_index_.push_back(RecordIndexEntry{
+        chunk_writer_->pos(), chunk.header.num_records(),
+        chunk.header.decoded_data_size(), std::move(chunk_min_key_),
+        std::move(chunk_max_key_)});
+  }
+  if (ABSL_PREDICT_FALSE(collecting_chunk_statistics_)) {
+    chunk_min_key_.clear();
+    chunk_max_key_.clear();
+    chunk_has_keys_ = false;
+  }
+  if (ABSL_PREDICT_FALSE(!WriteChunkInstrumented(chunk))) {
+    return Fail(*chunk_writer_);
+  }
+  if (ABSL_PREDICT_FALSE(train_zstd_dictionary &&
+                         zstd_dictionary_ != nullptr)) {
+    // The chunk encoder is reused by OpenChunk(); replace it so that
+    // subsequent chunks are compressed with the dictionary.
+    if (chunk_encoder_is_recyclable_) {
+      RecycleChunkEncoder(std::move(chunk_encoder_));
+    }
+    chunk_encoder_ = MakeChunkEncoder();
+  }
+  return true;
+}
+
+bool RecordWriterBase::SerialWorker::WriteRecordIndex() {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  Chunk chunk;
+  if (ABSL_PREDICT_FALSE(!EncodeRecordIndex(&chunk))) return false;
+  if (ABSL_PREDICT_FALSE(!WriteChunkInstrumented(chunk))) {
     return Fail(*chunk_writer_);
   }
   return true;
@@ -367,12 +1018,23 @@ bool RecordWriterBase::SerialWorker::PadToBlockBoundary() {
 
 bool RecordWriterBase::SerialWorker::Flush(FlushType flush_type) {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
-  if (ABSL_PREDICT_FALSE(!chunk_writer_->Flush(flush_type))) {
-    return Fail(*chunk_writer_);
+  const absl::Time before = absl::Now();
+  const bool ok = chunk_writer_->Flush(flush_type);
+  {
+    absl::MutexLock lock(&stats_mutex_);
+    stats_.writing_time += absl::Now() - before;
   }
+  if (ABSL_PREDICT_FALSE(!ok)) return Fail(*chunk_writer_);
   return true;
 }
 
+std::future<bool> RecordWriterBase::SerialWorker::FutureFlush(
+    FlushType flush_type) {
+  std::promise<bool> done;
+  done.set_value(Flush(flush_type));
+  return done.get_future();
+}
+
 FutureRecordPosition RecordWriterBase::SerialWorker::Pos() const {
   return FutureRecordPosition(
       RecordPosition(chunk_writer_->pos(), chunk_encoder_->num_records()));
@@ -389,13 +1051,22 @@ class RecordWriterBase::ParallelWorker : public Worker {
   void OpenChunk() override { chunk_encoder_ = MakeChunkEncoder(); }
   bool CloseChunk() override;
   bool Flush(FlushType flush_type) override;
+  std::future<bool> FutureFlush(FlushType flush_type) override;
   FutureRecordPosition Pos() const override;
+  PipelineStats pipeline_stats() const override;
+  void RegisterUnique(MemoryEstimator* memory_estimator) const override;
 
  protected:
   void Done() override;
   bool WriteSignature() override;
   bool WriteMetadata() override;
   bool PadToBlockBoundary() override;
+  bool WriteDictionaryChunk(Chunk chunk) override;
+  bool WriteRecordIndex() override;
+  size_t PendingChunks() const override {
+    absl::MutexLock lock(&mutex_);
+    return chunk_writer_requests_.size();
+  }
 
  private:
   struct ChunkPromises {
@@ -410,29 +1081,58 @@ class RecordWriterBase::ParallelWorker : public Worker {
   struct WriteChunkRequest {
     std::shared_future<ChunkHeader> chunk_header;
     std::future<Chunk> chunk;
+    // Range of record keys of the chunk if chunk statistics are collected.
+    std::string min_key;
+    std::string max_key;
+    // When the request was enqueued, for queue time statistics.
+    absl::Time enqueue_time;
   };
   struct PadToBlockBoundaryRequest {};
+  // The index is encoded by the chunk writer thread, which knows the
+  // positions of all chunks written before this request.
+  struct WriteRecordIndexRequest {};
   struct FlushRequest {
     FlushType flush_type;
     std::promise<bool> done;
+    // True if an earlier flush request already completed this one by group
+    // commit; the request is then skipped when it reaches the queue front.
+    bool coalesced;
   };
   using ChunkWriterRequest =
       absl::variant<DoneRequest, WriteChunkRequest, PadToBlockBoundaryRequest,
-                    FlushRequest>;
+                    WriteRecordIndexRequest, FlushRequest>;
 
   bool HasCapacityForRequest() const;
+  // Locks mutex_ when the queue has capacity for a request. In adaptive mode
+  // a full queue grows the effective parallelism instead of blocking, as long
+  // as the bound allows.
+  void LockWhenHasCapacityForRequest() EXCLUSIVE_LOCK_FUNCTION(mutex_);
+  internal::ThreadPool& thread_pool() const {
+    return options_.thread_pool_ != nullptr
+               ? *options_.thread_pool_
+               : internal::ThreadPool::global_cpu();
+  }
 
   mutable absl::Mutex mutex_;
   std::deque<ChunkWriterRequest> chunk_writer_requests_ GUARDED_BY(mutex_);
   // Position before handling chunk_writer_requests_.
   Position pos_before_chunks_ GUARDED_BY(mutex_);
+  // Bound on the number of queued requests. Equal to options_.parallelism_,
+  // except in adaptive mode, where it grows when enqueueing a request would
+  // block and shrinks when the queue drains before the next request arrives.
+  //
+  // Invariant: 1 <= effective_parallelism_ <= options_.parallelism_
+  size_t effective_parallelism_ GUARDED_BY(mutex_);
 };
 
 inline RecordWriterBase::ParallelWorker::ParallelWorker(
     ChunkWriter* chunk_writer, Options&& options)
     : Worker(chunk_writer, std::move(options)),
-      pos_before_chunks_(chunk_writer_->pos()) {
-  internal::ThreadPool::global().Schedule([this] {
+      pos_before_chunks_(chunk_writer_->pos()),
+      effective_parallelism_(options_.adaptive_parallelism_
+                                 ? size_t{1}
+                                 : IntCast<size_t>(options_.parallelism_)) {
+  thread_pool().Schedule([this] {
     struct Visitor {
       bool operator()(DoneRequest& request) const {
         request.done.set_value();
@@ -444,8 +1144,20 @@ inline RecordWriterBase::ParallelWorker::ParallelWorker(
         // the chunk encoder thread exits before the chunk writer thread
         // responds to DoneRequest.
         const Chunk chunk = request.chunk.get();
+        {
+          absl::MutexLock lock(&self->stats_mutex_);
+          self->stats_.queue_time += absl::Now() - request.enqueue_time;
+          self->stats_.queued_bytes -= chunk.header.size() + chunk.data.size();
+        }
         if (ABSL_PREDICT_FALSE(!self->healthy())) return true;
-        if (ABSL_PREDICT_FALSE(!self->chunk_writer_->WriteChunk(chunk))) {
+        if (ABSL_PREDICT_FALSE(self->options_.write_record_index_) &&
+            chunk.header.num_records() > 0) {
+          self->record_index_.push_back(RecordIndexEntry{
+              self->chunk_writer_->pos(), chunk.header.num_records(),
+              chunk.header.decoded_data_size(), std::move(request.min_key),
+              std::move(request.max_key)});
+        }
+        if (ABSL_PREDICT_FALSE(!self->WriteChunkInstrumented(chunk))) {
           self->Fail(*self->chunk_writer_);
         }
         return true;
@@ -459,18 +1171,54 @@ inline RecordWriterBase::ParallelWorker::ParallelWorker(
         return true;
       }
 
+      bool operator()(WriteRecordIndexRequest& request) const {
+        if (ABSL_PREDICT_FALSE(!self->healthy())) return true;
+        Chunk chunk;
+        if (ABSL_PREDICT_FALSE(!self->EncodeRecordIndex(&chunk))) return true;
+        if (ABSL_PREDICT_FALSE(!self->WriteChunkInstrumented(chunk))) {
+          self->Fail(*self->chunk_writer_);
+        }
+        return true;
+      }
+
       bool operator()(FlushRequest& request) const {
-        if (ABSL_PREDICT_FALSE(!self->healthy())) {
-          request.done.set_value(false);
-          return true;
+        if (request.coalesced) return true;
+        // Group commit: all flush requests immediately following this one in
+        // the queue are waiting for the same data, hence they are completed
+        // together by one flush of the strongest requested type.
+        FlushType flush_type = request.flush_type;
+        std::vector<std::promise<bool>> coalesced;
+        {
+          absl::MutexLock lock(&self->mutex_);
+          // This request remains at the front of the queue while it is being
+          // handled; coalescing starts behind it.
+          for (size_t i = 1; i < self->chunk_writer_requests_.size(); ++i) {
+            if (!absl::holds_alternative<FlushRequest>(
+                    self->chunk_writer_requests_[i])) {
+              break;
+            }
+            FlushRequest& next =
+                absl::get<FlushRequest>(self->chunk_writer_requests_[i]);
+            if (next.flush_type > flush_type) flush_type = next.flush_type;
+            coalesced.push_back(std::move(next.done));
+            next.coalesced = true;
+          }
         }
-        if (ABSL_PREDICT_FALSE(
-                !self->chunk_writer_->Flush(request.flush_type))) {
-          self->Fail(*self->chunk_writer_);
-          request.done.set_value(false);
-          return true;
+        bool flush_ok = self->healthy();
+        if (flush_ok) {
+          const absl::Time before = absl::Now();
+          const bool ok = self->chunk_writer_->Flush(flush_type);
+          {
+            absl::MutexLock lock(&self->stats_mutex_);
+            self->stats_.writing_time += absl::Now() - before;
+          }
+          if (ABSL_PREDICT_FALSE(!ok)) {
+            self->Fail(*self->chunk_writer_);
+            flush_ok = false;
+          }
         }
-        request.done.set_value(true);
+        request.done.set_value(flush_ok);
+        for (std::promise<bool>& done : coalesced) done.set_value(flush_ok);
         return true;
       }
 
@@ -490,6 +1238,12 @@ inline RecordWriterBase::ParallelWorker::ParallelWorker(
       mutex_.Lock();
       chunk_writer_requests_.pop_front();
       pos_before_chunks_ = chunk_writer_->pos();
+      if (ABSL_PREDICT_FALSE(options_.adaptive_parallelism_) &&
+          chunk_writer_requests_.empty() && effective_parallelism_ > 1) {
+        // The pipeline drained before the writer enqueued more work: shrink
+        // the window so that idle in-flight chunks do not hold memory.
+        --effective_parallelism_;
+      }
     }
   });
   Initialize(pos_before_chunks_);
@@ -515,7 +1269,26 @@ void RecordWriterBase::ParallelWorker::Done() {
 
 bool RecordWriterBase::ParallelWorker::HasCapacityForRequest() const
     EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
-  return chunk_writer_requests_.size() < IntCast<size_t>(options_.parallelism_);
+  return chunk_writer_requests_.size() < effective_parallelism_;
+}
+
+void RecordWriterBase::ParallelWorker::LockWhenHasCapacityForRequest() {
+  if (ABSL_PREDICT_FALSE(options_.adaptive_parallelism_)) {
+    mutex_.Lock();
+    if (!HasCapacityForRequest()) {
+      if (effective_parallelism_ < IntCast<size_t>(options_.parallelism_)) {
+        // Enqueueing would block on a full pipeline: the pipeline is the
+        // bottleneck, so allow one more request in flight.
+        ++effective_parallelism_;
+        return;
+      }
+      mutex_.Await(
+          absl::Condition(this, &ParallelWorker::HasCapacityForRequest));
+    }
+    return;
+  }
+  mutex_.LockWhen(
+      absl::Condition(this, &ParallelWorker::HasCapacityForRequest));
 }
 
 bool RecordWriterBase::ParallelWorker::WriteSignature() {
@@ -524,12 +1297,13 @@ bool RecordWriterBase::ParallelWorker::WriteSignature() {
   EncodeSignature(&chunk);
   ChunkPromises chunk_promises;
   chunk_promises.chunk_header.set_value(chunk.header);
+  AddQueuedBytes(chunk.header.size() + chunk.data.size());
   chunk_promises.chunk.set_value(std::move(chunk));
-  mutex_.LockWhen(
-      absl::Condition(this, &ParallelWorker::HasCapacityForRequest));
+  LockWhenHasCapacityForRequest();
   chunk_writer_requests_.emplace_back(
       WriteChunkRequest{chunk_promises.chunk_header.get_future(),
-                        chunk_promises.chunk.get_future()});
+                        chunk_promises.chunk.get_future(), std::string(),
+                        std::string(), absl::Now()});
   mutex_.Unlock();
   return true;
 }
@@ -541,62 +1315,108 @@ bool RecordWriterBase::ParallelWorker::WriteMetadata() {
     return true;
   }
   ChunkPromises* const chunk_promises = new ChunkPromises();
-  mutex_.LockWhen(
-      absl::Condition(this, &ParallelWorker::HasCapacityForRequest));
+  LockWhenHasCapacityForRequest();
   chunk_writer_requests_.emplace_back(
       WriteChunkRequest{chunk_promises->chunk_header.get_future(),
-                        chunk_promises->chunk.get_future()});
+                        chunk_promises->chunk.get_future(), std::string(),
+                        std::string(), absl::Now()});
   mutex_.Unlock();
-  internal::ThreadPool::global().Schedule([this, chunk_promises] {
+  thread_pool().Schedule([this, chunk_promises] {
     Chunk chunk;
     EncodeMetadata(&chunk);
     chunk_promises->chunk_header.set_value(chunk.header);
+    AddQueuedBytes(chunk.header.size() + chunk.data.size());
     chunk_promises->chunk.set_value(std::move(chunk));
     delete chunk_promises;
   });
   return true;
 }
 
+bool RecordWriterBase::ParallelWorker::WriteDictionaryChunk(Chunk chunk) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  ChunkPromises chunk_promises;
+  chunk_promises.chunk_header.set_value(chunk.header);
+  AddQueuedBytes(chunk.header.size() + chunk.data.size());
+  chunk_promises.chunk.set_value(std::move(chunk));
+  LockWhenHasCapacityForRequest();
+  chunk_writer_requests_.emplace_back(
+      WriteChunkRequest{chunk_promises.chunk_header.get_future(),
+                        chunk_promises.chunk.get_future(), std::string(),
+                        std::string(), absl::Now()});
+  mutex_.Unlock();
+  return true;
+}
+
 bool RecordWriterBase::ParallelWorker::CloseChunk() {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  if (ABSL_PREDICT_FALSE(collecting_zstd_samples_)) {
+    // The dictionary chunk is enqueued ahead of this data chunk. This chunk
+    // itself is still compressed without the dictionary: its chunk encoder
+    // was made before the dictionary was trained. OpenChunk() makes a fresh
+    // chunk encoder which picks the dictionary up.
+    if (ABSL_PREDICT_FALSE(!TrainAndWriteZstdDictionary())) return false;
+  }
   ChunkEncoder* const chunk_encoder = chunk_encoder_.release();
+  const bool recycle_chunk_encoder = chunk_encoder_is_recyclable_;
   ChunkPromises* const chunk_promises = new ChunkPromises();
-  mutex_.LockWhen(
-      absl::Condition(this, &ParallelWorker::HasCapacityForRequest));
+  LockWhenHasCapacityForRequest();
   chunk_writer_requests_.emplace_back(
       WriteChunkRequest{chunk_promises->chunk_header.get_future(),
-                        chunk_promises->chunk.get_future()});
+                        chunk_promises->chunk.get_future(),
+                        std::move(chunk_min_key_), std::move(chunk_max_key_),
+                        absl::Now()});
   mutex_.Unlock();
-  internal::ThreadPool::global().Schedule(
-      [this, chunk_encoder, chunk_promises] {
+  if (ABSL_PREDICT_FALSE(collecting_chunk_statistics_)) {
+    chunk_min_key_.clear();
+    chunk_max_key_.clear();
+    chunk_has_keys_ = false;
+  }
+  thread_pool().Schedule(
+      [this, chunk_encoder, recycle_chunk_encoder, chunk_promises] {
         Chunk chunk;
         EncodeChunk(chunk_encoder, &chunk);
-        delete chunk_encoder;
+        if (recycle_chunk_encoder) {
+          RecycleChunkEncoder(std::unique_ptr<ChunkEncoder>(chunk_encoder));
+        } else {
+          delete chunk_encoder;
+        }
         chunk_promises->chunk_header.set_value(chunk.header);
+        AddQueuedBytes(chunk.header.size() + chunk.data.size());
         chunk_promises->chunk.set_value(std::move(chunk));
         delete chunk_promises;
       });
   return true;
 }
 
+bool RecordWriterBase::ParallelWorker::WriteRecordIndex() {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  LockWhenHasCapacityForRequest();
+  chunk_writer_requests_.emplace_back(WriteRecordIndexRequest());
+  mutex_.Unlock();
+  return true;
+}
+
 bool RecordWriterBase::ParallelWorker::PadToBlockBoundary() {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
-  mutex_.LockWhen(
-      absl::Condition(this, &ParallelWorker::HasCapacityForRequest));
+  LockWhenHasCapacityForRequest();
   chunk_writer_requests_.emplace_back(PadToBlockBoundaryRequest());
   mutex_.Unlock();
   return true;
 }
 
 bool RecordWriterBase::ParallelWorker::Flush(FlushType flush_type) {
+  return FutureFlush(flush_type).get();
+}
+
+std::future<bool> RecordWriterBase::ParallelWorker::FutureFlush(
+    FlushType flush_type) {
   std::promise<bool> done_promise;
   std::future<bool> done_future = done_promise.get_future();
-  mutex_.LockWhen(
-      absl::Condition(this, &ParallelWorker::HasCapacityForRequest));
+  LockWhenHasCapacityForRequest();
   chunk_writer_requests_.emplace_back(
-      FlushRequest{flush_type, std::move(done_promise)});
+      FlushRequest{flush_type, std::move(done_promise), false});
   mutex_.Unlock();
-  return done_future.get();
+  return done_future;
 }
 
 FutureRecordPosition RecordWriterBase::ParallelWorker::Pos() const {
@@ -608,6 +1428,10 @@ FutureRecordPosition RecordWriterBase::ParallelWorker::Pos() const {
     void operator()(const PadToBlockBoundaryRequest&) {
       actions.emplace_back(FutureRecordPosition::PadToBlockBoundary());
     }
+    // The record index is requested only during Close(), after which no
+    // record positions are queried; its size does not need to be accounted
+    // for.
+    void operator()(const WriteRecordIndexRequest&) {}
     void operator()(const FlushRequest&) {}
 
     std::vector<FutureRecordPosition::Action> actions;
@@ -622,15 +1446,80 @@ FutureRecordPosition RecordWriterBase::ParallelWorker::Pos() const {
   // RecordWriter is closed or if RecordWriter::Flush() failed.
   return FutureRecordPosition(
       pos_before_chunks_, std::move(visitor.actions),
+      chunk_writer_->block_size(),
       chunk_encoder_ == nullptr ? uint64_t{0} : chunk_encoder_->num_records());
 }
 
+RecordWriterBase::PipelineStats
+RecordWriterBase::ParallelWorker::pipeline_stats() const {
+  PipelineStats stats = Worker::pipeline_stats();
+  absl::MutexLock lock(&mutex_);
+  stats.queued_requests = chunk_writer_requests_.size();
+  return stats;
+}
+
+void RecordWriterBase::ParallelWorker::RegisterUnique(
+    MemoryEstimator* memory_estimator) const {
+  memory_estimator->RegisterDynamicMemory(sizeof(*this));
+  RegisterCommonSubobjects(memory_estimator);
+  {
+    absl::MutexLock lock(&mutex_);
+    memory_estimator->RegisterMemory(chunk_writer_requests_.size() *
+                                     sizeof(ChunkWriterRequest));
+  }
+  {
+    absl::MutexLock lock(&stats_mutex_);
+    // Encoded chunks held by in-flight futures.
+    memory_estimator->RegisterMemory(IntCast<size_t>(stats_.queued_bytes));
+    // record_index_ is owned by the chunk writer thread, hence it is not
+    // traversed; its entries are approximated from the number of chunks
+    // encoded. Record keys are not included.
+    if (options_.write_record_index_) {
+      memory_estimator->RegisterMemory(
+          IntCast<size_t>(stats_.chunks_encoded) * sizeof(RecordIndexEntry));
+    }
+  }
+}
+
+void RecordWriterBase::RecordSizeHistogram::Add(uint64_t size) {
+  ++num_records_;
+  size_t bucket = 0;
+  while (size > 0) {
+    ++bucket;
+    size >>= 1;
+  }
+  ++counts_[bucket];
+}
+
+uint64_t RecordWriterBase::RecordSizeHistogram::Median() const {
+  RIEGELI_ASSERT_GT(num_records_, 0u)
+      << "Failed precondition of "
+         "RecordWriterBase::RecordSizeHistogram::Median(): no records";
+  uint64_t cumulative = 0;
+  size_t bucket = 0;
+  for (;;) {
+    cumulative += counts_[bucket];
+    if (cumulative > (num_records_ - 1) / 2) break;
+    ++bucket;
+  }
+  if (bucket == 0) return 0;
+  // Midpoint of [2^(bucket-1), 2^bucket).
+  return (uint64_t{1} << (bucket - 1)) + (uint64_t{1} << (bucket - 1)) / 2;
+}
+
 RecordWriterBase::RecordWriterBase(State state) noexcept : Object(state) {}
 
 RecordWriterBase::RecordWriterBase(RecordWriterBase&& that) noexcept
     : Object(std::move(that)),
       desired_chunk_size_(absl::exchange(that.desired_chunk_size_, 0)),
       chunk_size_so_far_(absl::exchange(that.chunk_size_so_far_, 0)),
+      target_chunk_records_(absl::exchange(that.target_chunk_records_, 0)),
+      max_desired_chunk_size_(
+          absl::exchange(that.max_desired_chunk_size_, 0)),
+      record_size_histogram_(absl::exchange(that.record_size_histogram_,
+                                            RecordSizeHistogram())),
+      target_compressed_chunk_size_(
+          absl::exchange(that.target_compressed_chunk_size_, 0)),
       worker_(std::move(that.worker_)) {}
 
 RecordWriterBase& RecordWriterBase::operator=(
@@ -638,6 +1527,12 @@ RecordWriterBase& RecordWriterBase::operator=(
   Object::operator=(std::move(that));
   desired_chunk_size_ = absl::exchange(that.desired_chunk_size_, 0);
   chunk_size_so_far_ = absl::exchange(that.chunk_size_so_far_, 0);
+  target_chunk_records_ = absl::exchange(that.target_chunk_records_, 0);
+  max_desired_chunk_size_ = absl::exchange(that.max_desired_chunk_size_, 0);
+  record_size_histogram_ =
+      absl::exchange(that.record_size_histogram_, RecordSizeHistogram());
+  target_compressed_chunk_size_ =
+      absl::exchange(that.target_compressed_chunk_size_, 0);
   worker_ = std::move(that.worker_);
   return *this;
 }
@@ -652,6 +1547,13 @@ void RecordWriterBase::Initialize(ChunkWriter* dest, Options&& options) {
   // num_records * sizeof(uint64_t) under desired_chunk_size_.
   desired_chunk_size_ =
       UnsignedMin(options.chunk_size_, kMaxNumRecords * sizeof(uint64_t));
+  if (options.target_chunk_records_ > 0) {
+    target_chunk_records_ = options.target_chunk_records_;
+    max_desired_chunk_size_ = UnsignedMin(options.max_chunk_size_,
+                                          kMaxNumRecords * sizeof(uint64_t));
+  }
+  target_compressed_chunk_size_ = options.compressed_chunk_size_;
+  if (options.size_hint_ != 0) dest->SetSizeHint(options.size_hint_);
   if (options.parallelism_ == 0) {
     worker_ = absl::make_unique<SerialWorker>(dest, std::move(options));
   } else {
@@ -665,6 +1567,7 @@ void RecordWriterBase::Done() {
     if (ABSL_PREDICT_FALSE(!worker_->CloseChunk())) Fail(*worker_);
     chunk_size_so_far_ = 0;
   }
+  if (ABSL_PREDICT_FALSE(!worker_->MaybeWriteRecordIndex())) Fail(*worker_);
   if (ABSL_PREDICT_FALSE(!worker_->MaybePadToBlockBoundary())) Fail(*worker_);
   if (ABSL_PREDICT_FALSE(!worker_->Close())) Fail(*worker_);
 }
@@ -678,8 +1581,12 @@ bool RecordWriterBase::WriteRecordImpl(Record&& record,
   // Decoding a chunk writes records to one array, and their positions to
   // another array. We limit the size of both arrays together, to include
   // attempts to accumulate an unbounded number of empty records.
-  const uint64_t added_size = SaturatingAdd(
-      IntCast<uint64_t>(RecordSize(record)), uint64_t{sizeof(uint64_t)});
+  const uint64_t record_size = IntCast<uint64_t>(RecordSize(record));
+  const uint64_t added_size =
+      SaturatingAdd(record_size, uint64_t{sizeof(uint64_t)});
+  if (ABSL_PREDICT_FALSE(target_chunk_records_ > 0)) {
+    record_size_histogram_.Add(record_size);
+  }
   if (ABSL_PREDICT_FALSE(chunk_size_so_far_ > desired_chunk_size_ ||
                          added_size >
                              desired_chunk_size_ - chunk_size_so_far_) &&
@@ -687,6 +1594,37 @@ bool RecordWriterBase::WriteRecordImpl(Record&& record,
     if (ABSL_PREDICT_FALSE(!worker_->CloseChunk())) return Fail(*worker_);
     worker_->OpenChunk();
     chunk_size_so_far_ = 0;
+    if (target_chunk_records_ > 0 &&
+        record_size_histogram_.num_records() >=
+            kMinRecordsForAdaptiveChunkSize) {
+      // Aim at chunks of target_chunk_records_ records of the median size.
+      // sizeof(uint64_t) per record accounts for the array of record
+      // positions, like in added_size.
+      const uint64_t median_record_size =
+          record_size_histogram_.Median() + sizeof(uint64_t);
+      desired_chunk_size_ =
+          median_record_size <=
+                  max_desired_chunk_size_ / target_chunk_records_
+              ? median_record_size * target_chunk_records_
+              : max_desired_chunk_size_;
+    }
+    if (target_compressed_chunk_size_ > 0) {
+      const uint64_t ratio = worker_->chunk_compression_ratio();
+      if (ratio > 0) {
+        // The uncompressed size which is expected to compress to
+        // target_compressed_chunk_size_.
+        const uint64_t estimated_size =
+            target_compressed_chunk_size_ <=
+                    std::numeric_limits<uint64_t>::max() /
+                        kCompressionRatioScale
+                ? target_compressed_chunk_size_ * kCompressionRatioScale /
+                      ratio
+                : std::numeric_limits<uint64_t>::max();
+        desired_chunk_size_ = UnsignedMin(UnsignedMax(estimated_size,
+                                                      uint64_t{1}),
+                                          kMaxNumRecords * sizeof(uint64_t));
+      }
+    }
   }
   chunk_size_so_far_ += added_size;
   if (key != nullptr) *key = worker_->Pos();
@@ -723,11 +1661,58 @@ bool RecordWriterBase::Flush(FlushType flush_type) {
   return true;
 }
 
+std::future<bool> RecordWriterBase::FutureFlush(FlushType flush_type) {
+  const auto ready_future = [](bool value) {
+    std::promise<bool> done;
+    done.set_value(value);
+    return done.get_future();
+  };
+  if (ABSL_PREDICT_FALSE(!healthy())) return ready_future(false);
+  if (chunk_size_so_far_ != 0) {
+    if (ABSL_PREDICT_FALSE(!worker_->CloseChunk())) {
+      Fail(*worker_);
+      return ready_future(false);
+    }
+  }
+  if (ABSL_PREDICT_FALSE(!worker_->MaybePadToBlockBoundary())) {
+    Fail(*worker_);
+    return ready_future(false);
+  }
+  std::future<bool> done = worker_->FutureFlush(flush_type);
+  if (chunk_size_so_far_ != 0) {
+    worker_->OpenChunk();
+    chunk_size_so_far_ = 0;
+  }
+  return done;
+}
+
+void RecordWriterBase::Cancel() {
+  if (ABSL_PREDICT_FALSE(!healthy())) return;
+  worker_->Cancel();
+  // Skip enqueueing the open chunk in Done().
+  chunk_size_so_far_ = 0;
+  Fail(CancelledError("RecordWriter::Cancel() called"));
+}
+
 FutureRecordPosition RecordWriterBase::Pos() const {
   if (ABSL_PREDICT_FALSE(worker_ == nullptr)) return FutureRecordPosition();
   return worker_->Pos();
 }
 
+RecordWriterBase::PipelineStats RecordWriterBase::pipeline_stats() const {
+  if (ABSL_PREDICT_FALSE(worker_ == nullptr)) return PipelineStats();
+  return worker_->pipeline_stats();
+}
+
+size_t RecordWriterBase::EstimateMemory() const {
+  MemoryEstimator memory_estimator;
+  memory_estimator.RegisterMemory(sizeof(*this));
+  if (ABSL_PREDICT_TRUE(worker_ != nullptr)) {
+    worker_->RegisterUnique(&memory_estimator);
+  }
+  return memory_estimator.TotalMemory();
+}
+
 template class RecordWriter<Writer*>;
 template class RecordWriter<std::unique_ptr<Writer>>;
 template class RecordWriter<ChunkWriter*>;
@@ -15,8 +15,11 @@
 #ifndef RIEGELI_RECORDS_RECORD_WRITER_H_
 #define RIEGELI_RECORDS_RECORD_WRITER_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include <functional>
+#include <future>
 #include <memory>
 #include <string>
 #include <type_traits>
@@ -25,12 +28,15 @@
 #include "absl/base/optimization.h"
 #include "absl/meta/type_traits.h"
 #include "absl/strings/string_view.h"
+#include "absl/time/time.h"
 #include "google/protobuf/descriptor.h"
 #include "google/protobuf/message_lite.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
 #include "riegeli/base/object.h"
+#include "riegeli/base/parallelism.h"
 #include "riegeli/base/stable_dependency.h"
+#include "riegeli/base/stats_sink.h"
 #include "riegeli/base/status.h"
 #include "riegeli/bytes/writer.h"
 #include "riegeli/chunk_encoding/compressor_options.h"
@@ -62,14 +68,23 @@ class RecordWriterBase : public Object {
     //   option ::=
     //     "default" |
     //     "transpose" (":" ("true" | "false"))? |
+    //     "auto_transpose" (":" ("true" | "false"))? |
+    //     "columnar" (":" ("true" | "false"))? |
+    //     "aligned" (":" ("true" | "false"))? |
     //     "uncompressed" |
     //     "brotli" (":" brotli_level)? |
     //     "zstd" (":" zstd_level)? |
+    //     "snappy" |
     //     "window_log" ":" window_log |
+    //     "long_distance_matching" (":" ("true" | "false"))? |
+    //     "train_zstd_dictionary" (":" ("true" | "false"))? |
     //     "chunk_size" ":" chunk_size |
     //     "bucket_fraction" ":" bucket_fraction |
     //     "pad_to_block_boundary" (":" ("true" | "false"))? |
-    //     "parallelism" ":" parallelism
+    //     "write_record_index" (":" ("true" | "false"))? |
+    //     "parallelism" ":" parallelism |
+    //     "adaptive_parallelism" (":" ("true" | "false"))? |
+    //     "size_hint" ":" size_hint
     //   brotli_level ::= integer 0..11 (default 9)
     //   zstd_level ::= integer -32..22 (default 9)
     //   window_log ::= "auto" or integer 10..31
@@ -77,6 +92,8 @@ class RecordWriterBase : public Object {
     //     integer expressed as real with optional suffix [BkKMGTPE], 1..
     //   bucket_fraction ::= real 0..1
     //   parallelism ::= integer 0..
+    //   size_hint ::=
+    //     integer expressed as real with optional suffix [BkKMGTPE], 0..
     //
     // An empty string is the same as "default".
     //
@@ -88,6 +105,16 @@ class RecordWriterBase : public Object {
     //  * !status.ok() - failure
     Status FromString(absl::string_view text);
 
+    // Like FromString(), but memoizes the parse result in a process-wide
+    // cache keyed by text, so that opening many writers with identical
+    // option strings costs a hash lookup instead of a full parse.
+    //
+    // Unlike FromString(), which applies options from text on top of the
+    // current state of *this, FromCachedString() replaces *this with the
+    // result of parsing text into default-constructed Options; setters can
+    // still be applied afterwards.
+    Status FromCachedString(absl::string_view text);
+
     // If true, records should be serialized proto messages (but nothing will
     // break if they are not). A chunk of records will be processed in a way
     // which allows for better compression.
@@ -104,6 +131,78 @@ class RecordWriterBase : public Object {
       return std::move(set_transpose(transpose));
     }
 
+    // If true, whether chunks are transposed is chosen automatically,
+    // overriding set_transpose(): until the choice is made, each chunk is
+    // encoded both ways in parallel and the winner is written — the chunk
+    // which is smaller, or which encoded faster if the sizes are close. The
+    // first finished comparison locks in the winner for the rest of the file.
+    //
+    // Ignored if aligned is true.
+    //
+    // Default: false.
+    Options& set_auto_transpose(bool auto_transpose) & {
+      auto_transpose_ = auto_transpose;
+      return *this;
+    }
+    Options&& set_auto_transpose(bool auto_transpose) && {
+      return std::move(set_auto_transpose(auto_transpose));
+    }
+
+    // If true, and transpose is also true, numeric field columns are delta
+    // encoded and repeated string field values are interned within a bucket
+    // before compression. This helps with records dominated by timestamps,
+    // counters, and other slowly varying numeric fields, and with enum-like
+    // string labels repeated across records.
+    //
+    // Ignored if transpose is false.
+    //
+    // Default: false.
+    Options& set_columnar(bool columnar) & {
+      columnar_ = columnar;
+      return *this;
+    }
+    Options&& set_columnar(bool columnar) && {
+      return std::move(set_columnar(columnar));
+    }
+
+    // If true, a chunk of records will be stored uncompressed, with a fixed
+    // width record boundary table up front and record values aligned within
+    // the chunk. Together with set_pad_to_block_boundary(true) this lets a
+    // RecordReader over a memory mapped file return records as pointers into
+    // the mapping, with no decompression and no copying.
+    //
+    // The file is larger than with compression. Compression options and
+    // transpose are ignored if this is true.
+    //
+    // Default: false.
+    Options& set_aligned(bool aligned) & {
+      aligned_ = aligned;
+      return *this;
+    }
+    Options&& set_aligned(bool aligned) && {
+      return std::move(set_aligned(aligned));
+    }
+
+    // If true, chunk encoders, together with their compression contexts and
+    // buffers, are recycled through a process wide pool keyed by encoding
+    // options instead of being constructed from scratch. This amortizes
+    // construction when many short lived RecordWriters with the same options
+    // are created, e.g. a file per request, reducing the latency of writing
+    // the first record.
+    //
+    // Encoders whose configuration varies per chunk, e.g. with
+    // set_compression_level_policy() or with a trained Zstd dictionary, are
+    // not recycled.
+    //
+    // Default: false.
+    Options& set_recycle_chunk_encoders(bool recycle_chunk_encoders) & {
+      recycle_chunk_encoders_ = recycle_chunk_encoders;
+      return *this;
+    }
+    Options&& set_recycle_chunk_encoders(bool recycle_chunk_encoders) && {
+      return std::move(set_recycle_chunk_encoders(recycle_chunk_encoders));
+    }
+
     // Changes compression algorithm to none.
     Options& set_uncompressed() & {
       compressor_options_.set_uncompressed();
@@ -147,6 +246,17 @@ class RecordWriterBase : public Object {
       return std::move(set_zstd(compression_level));
     }
 
+    // Changes compression algorithm to Snappy.
+    //
+    // Snappy compresses much faster than Brotli or Zstd, and decompresses at
+    // multiple GB/s, at the cost of a considerably worse compression density.
+    // There are no Snappy compression levels to tune.
+    Options& set_snappy() & {
+      compressor_options_.set_snappy();
+      return *this;
+    }
+    Options&& set_snappy() && { return std::move(set_snappy()); }
+
     // Logarithm of the LZ77 sliding window size. This tunes the tradeoff
     // between compression density and memory usage (higher = better density but
     // more memory).
@@ -154,7 +264,7 @@ class RecordWriterBase : public Object {
     // Special value kDefaultWindowLog (-1) means to keep the default
     // (brotli: 22, zstd: derived from compression level and chunk size).
     //
-    // For uncompressed, window_log must be kDefaultWindowLog (-1).
+    // For uncompressed and snappy, window_log must be kDefaultWindowLog (-1).
     //
     // For brotli, window_log must be kDefaultWindowLog (-1) or between
     // BrotliWriterBase::Options::kMinWindowLog (10) and
@@ -178,6 +288,107 @@ class RecordWriterBase : public Object {
       return std::move(set_window_log(window_log));
     }
 
+    // If true, enables long-distance matching: the compressor additionally
+    // looks for matches up to the full window size apart, which improves
+    // compression density when redundancy sits far apart, e.g. between
+    // similar records spread over a large chunk. It is most effective
+    // together with a large set_window_log().
+    //
+    // Effective only for zstd; ignored for other compression algorithms.
+    //
+    // Default: false.
+    Options& set_long_distance_matching(bool long_distance_matching) & {
+      compressor_options_.set_long_distance_matching(long_distance_matching);
+      return *this;
+    }
+    Options&& set_long_distance_matching(bool long_distance_matching) && {
+      return std::move(set_long_distance_matching(long_distance_matching));
+    }
+
+    // Sets a policy which chooses the compression level separately for each
+    // chunk, overriding the level set by set_brotli() or set_zstd(). The
+    // policy is called when a chunk is opened, with the number of requests
+    // currently queued in the write pipeline (0 if parallelism is 0 or the
+    // pipeline is idle). This allows e.g. cheap levels while the writer is
+    // backlogged and better ratios when it is not, or levels varying by time
+    // of day, without closing and reopening the writer.
+    //
+    // The returned level must be valid for the compression algorithm in use.
+    // Ignored for uncompressed and snappy. The policy is called from the
+    // thread using the RecordWriter.
+    //
+    // nullptr means that the configured level is used for every chunk.
+    //
+    // Default: nullptr.
+    Options& set_compression_level_policy(
+        std::function<int(size_t num_pending_chunks)>
+            compression_level_policy) & {
+      compression_level_policy_ = std::move(compression_level_policy);
+      return *this;
+    }
+    Options&& set_compression_level_policy(
+        std::function<int(size_t num_pending_chunks)>
+            compression_level_policy) && {
+      return std::move(
+          set_compression_level_policy(std::move(compression_level_policy)));
+    }
+
+    // Chooses the compression level adaptively from the given range,
+    // depending on pipeline pressure: max_level when the write pipeline is
+    // idle, one level lower for each chunk queued behind the chunk being
+    // opened, but never lower than min_level. A single static level either
+    // wastes CPU when the pipeline is backed up or wastes storage when it is
+    // idle; adapting spends spare CPU on compression density.
+    //
+    // This is a shorthand for set_compression_level_policy() with a policy
+    // implementing the above. Chunks are queued only if set_parallelism() is
+    // greater than 0; otherwise max_level is used for every chunk.
+    //
+    // The levels must be valid for the compression algorithm in use. Ignored
+    // for uncompressed and snappy.
+    //
+    // Precondition: min_level <= max_level
+    Options& set_adaptive_compression_level(int min_level, int max_level) & {
+      RIEGELI_ASSERT_LE(min_level, max_level)
+          << "Failed precondition of RecordWriterBase::Options::"
+             "set_adaptive_compression_level(): level range is empty";
+      compression_level_policy_ = [min_level,
+                                   max_level](size_t num_pending_chunks) {
+        return max_level -
+               IntCast<int>(UnsignedMin(
+                   num_pending_chunks, IntCast<size_t>(max_level - min_level)));
+      };
+      return *this;
+    }
+    Options&& set_adaptive_compression_level(int min_level,
+                                             int max_level) && {
+      return std::move(set_adaptive_compression_level(min_level, max_level));
+    }
+
+    // If true, a zstd dictionary is trained from sampled early records and
+    // stored in a dedicated chunk; subsequent chunks are compressed with the
+    // dictionary. This improves compression density of small records which
+    // compress poorly on their own, because each chunk otherwise starts with
+    // an empty compression context.
+    //
+    // The chunks written before the dictionary is trained (normally the first
+    // chunk) are compressed without the dictionary. RecordReader picks the
+    // dictionary up when it encounters the dictionary chunk, hence reading
+    // must start from the beginning of the file; dictionary compressed chunks
+    // cannot be decoded by a reader which seeks past the dictionary chunk
+    // without reading it, nor by readers predating the dictionary chunk type.
+    //
+    // Effective only for zstd; ignored for other compression algorithms.
+    //
+    // Default: false.
+    Options& set_train_zstd_dictionary(bool train_zstd_dictionary) & {
+      train_zstd_dictionary_ = train_zstd_dictionary;
+      return *this;
+    }
+    Options&& set_train_zstd_dictionary(bool train_zstd_dictionary) && {
+      return std::move(set_train_zstd_dictionary(train_zstd_dictionary));
+    }
+
     // Sets the desired uncompressed size of a chunk which groups messages to be
     // transposed, compressed, and written together.
     //
@@ -199,6 +410,63 @@ class RecordWriterBase : public Object {
       return std::move(set_chunk_size(size));
     }
 
+    // If target_num_records > 0, adapts the size at which chunks are closed
+    // to the observed distribution of record sizes, instead of closing them
+    // at set_chunk_size() alone. The writer maintains a histogram of record
+    // sizes and aims at chunks of target_num_records records, estimating the
+    // needed chunk size from the median record size. The estimate is bounded
+    // by max_chunk_size, which in turn bounds the memory needed to decode one
+    // chunk when reading.
+    //
+    // No single fixed chunk size suits datasets whose record sizes vary
+    // widely between files: when records are large relative to the chunk
+    // size, chunks contain too few records for compression to be effective,
+    // and raising the fixed size instead lets files of small records decode
+    // with needlessly large chunks. set_chunk_size() is used until enough
+    // records have been seen for the estimate.
+    //
+    // Precondition: max_chunk_size > 0
+    //
+    // Default: 0 (chunk size is not adapted)
+    Options& set_adaptive_chunk_size(uint64_t target_num_records,
+                                     uint64_t max_chunk_size) & {
+      RIEGELI_ASSERT_GT(max_chunk_size, 0u)
+          << "Failed precondition of "
+             "RecordWriterBase::Options::set_adaptive_chunk_size(): "
+             "zero maximum chunk size";
+      target_chunk_records_ = target_num_records;
+      max_chunk_size_ = max_chunk_size;
+      return *this;
+    }
+    Options&& set_adaptive_chunk_size(uint64_t target_num_records,
+                                      uint64_t max_chunk_size) && {
+      return std::move(
+          set_adaptive_chunk_size(target_num_records, max_chunk_size));
+    }
+
+    // If compressed_chunk_size > 0, adapts the size at which chunks are
+    // closed so that the compressed size of a chunk approaches
+    // compressed_chunk_size, instead of bounding the uncompressed size with
+    // set_chunk_size() alone. The uncompressed size limit is scaled by the
+    // compression ratio observed on chunks encoded so far.
+    //
+    // This aligns chunk extents with the granularity of storage range
+    // requests: a reader which fetches a chunk with a ranged read transfers
+    // approximately compressed_chunk_size bytes, instead of a compressed
+    // size which varies with how well the records compress.
+    // set_chunk_size() is used until the first chunk has been encoded. Takes
+    // precedence over set_adaptive_chunk_size() once the compression ratio
+    // is known.
+    //
+    // Default: 0 (the compressed chunk size is not targeted)
+    Options& set_compressed_chunk_size(uint64_t compressed_chunk_size) & {
+      compressed_chunk_size_ = compressed_chunk_size;
+      return *this;
+    }
+    Options&& set_compressed_chunk_size(uint64_t compressed_chunk_size) && {
+      return std::move(set_compressed_chunk_size(compressed_chunk_size));
+    }
+
     // Sets the desired uncompressed size of a bucket which groups values of
     // several fields of the given wire type to be compressed together,
     // relative to the desired chunk size, on the scale between 0.0 (compress
@@ -227,6 +495,36 @@ class RecordWriterBase : public Object {
       return std::move(set_bucket_fraction(fraction));
     }
 
+    // If target_compression_ratio > 0, adapts the bucket size of transposed
+    // chunks from compression feedback instead of using set_bucket_fraction()
+    // alone. After each chunk the achieved ratio, i.e. the compressed size of
+    // bucket data divided by its uncompressed size, is compared with the
+    // target: if buckets compressed better than the target, the bucket size
+    // of subsequent chunks is decreased, so that reading with projection
+    // decompresses less unrelated data; if worse, it is increased toward the
+    // target. The starting bucket size comes from set_bucket_fraction().
+    //
+    // The right trade-off between compression density and projection
+    // granularity differs per schema; feedback converges toward the target
+    // without per-dataset tuning.
+    //
+    // Effective only if transpose and compression are enabled.
+    //
+    // Precondition: target_compression_ratio >= 0
+    //
+    // Default: 0 (bucket size is not adapted)
+    Options& set_adaptive_bucket_fraction(double target_compression_ratio) & {
+      RIEGELI_ASSERT_GE(target_compression_ratio, 0.0)
+          << "Failed precondition of "
+             "RecordWriterBase::Options::set_adaptive_bucket_fraction(): "
+             "negative target compression ratio";
+      bucket_compression_target_ = target_compression_ratio;
+      return *this;
+    }
+    Options&& set_adaptive_bucket_fraction(double target_compression_ratio) && {
+      return std::move(set_adaptive_bucket_fraction(target_compression_ratio));
+    }
+
     // Sets file metadata to be written at the beginning (if metadata has any
     // fields set).
     //
@@ -279,6 +577,54 @@ class RecordWriterBase : public Object {
       return std::move(set_pad_to_block_boundary(pad_to_block_boundary));
     }
 
+    // If true, an index of record numbers is written before Close(): chunk
+    // positions paired with their record counts, stored in a dedicated chunk
+    // at the end of the file. The index allows RecordReaderBase::
+    // SeekToRecord() to seek to the record with a given ordinal number
+    // without scanning the file.
+    //
+    // The index covers the records written by this RecordWriter; if the file
+    // is written in several sessions, only the index written last is used,
+    // hence record ordinals seen by the reader are meaningful only if the
+    // whole file was written in one session. Readers predating the record
+    // index chunk type skip the index chunk when reading sequentially.
+    //
+    // Default: false.
+    Options& set_write_record_index(bool write_record_index) & {
+      write_record_index_ = write_record_index;
+      return *this;
+    }
+    Options&& set_write_record_index(bool write_record_index) && {
+      return std::move(set_write_record_index(write_record_index));
+    }
+
+    // If not nullptr, per-chunk statistics are collected and stored in the
+    // record index: chunk_statistics_key is applied to each record, and the
+    // minimum and maximum key among the records of each chunk, together with
+    // the decoded data size of the chunk, are stored in its index entry.
+    // RecordReaderBase::SeekToChunkSatisfying() can then skip chunks whose
+    // statistics rule them out, turning a full scan into a partial scan.
+    //
+    // The function receives the record as a byte sequence; for a record
+    // written as a proto message this is the serialized message. Keys are
+    // compared lexicographically as byte sequences.
+    //
+    // Effective only together with set_write_record_index(true).
+    //
+    // Default: nullptr.
+    Options& set_chunk_statistics_key(
+        std::function<std::string(absl::string_view record)>
+            chunk_statistics_key) & {
+      chunk_statistics_key_ = std::move(chunk_statistics_key);
+      return *this;
+    }
+    Options&& set_chunk_statistics_key(
+        std::function<std::string(absl::string_view record)>
+            chunk_statistics_key) && {
+      return std::move(
+          set_chunk_statistics_key(std::move(chunk_statistics_key)));
+    }
+
     // Sets the maximum number of chunks being encoded in parallel in
     // background. Larger parallelism can increase throughput, up to a point
     // where it no longer matters; smaller parallelism reduces memory usage.
@@ -299,17 +645,107 @@ class RecordWriterBase : public Object {
       return std::move(set_parallelism(parallelism));
     }
 
+    // If true, the number of chunks being encoded in parallel adapts to the
+    // observed throughput instead of staying at the maximum: it grows when
+    // closing a chunk would block on a full pipeline, and shrinks when the
+    // pipeline drains before the next chunk is ready. set_parallelism()
+    // becomes an upper bound. This keeps the memory holding in-flight chunks
+    // proportional to the actual throughput rather than the peak provision.
+    //
+    // Takes effect only if parallelism > 0.
+    //
+    // Default: false
+    Options& set_adaptive_parallelism(bool adaptive_parallelism) & {
+      adaptive_parallelism_ = adaptive_parallelism;
+      return *this;
+    }
+    Options&& set_adaptive_parallelism(bool adaptive_parallelism) && {
+      return std::move(set_adaptive_parallelism(adaptive_parallelism));
+    }
+
+    // Sets the thread pool used for background work if parallelism > 0.
+    //
+    // nullptr means the process-wide default pool. The thread pool must
+    // outlive the RecordWriter. If the thread pool is bounded, its bound must
+    // exceed the number of RecordWriters using it in parallel, otherwise
+    // writing can deadlock.
+    //
+    // Default: nullptr
+    Options& set_thread_pool(internal::ThreadPool* thread_pool) & {
+      thread_pool_ = thread_pool;
+      return *this;
+    }
+    Options&& set_thread_pool(internal::ThreadPool* thread_pool) && {
+      return std::move(set_thread_pool(thread_pool));
+    }
+
+    // If not nullptr, receives the duration of each chunk encoding. Unlike
+    // pipeline_stats(), which is polled, the StatsSink is pushed each event,
+    // which suits exporting to a monitoring system. With set_parallelism()
+    // events come from thread pool threads, hence the StatsSink must be
+    // thread-safe.
+    //
+    // For syscalls and stall times of the destination, see
+    // FdWriterBase::Options::set_stats_sink(); the same StatsSink can be
+    // given to both.
+    //
+    // The StatsSink is not owned and must not be destroyed until the
+    // RecordWriter is closed or no longer used.
+    //
+    // Default: nullptr
+    Options& set_stats_sink(StatsSink* stats_sink) & {
+      stats_sink_ = stats_sink;
+      return *this;
+    }
+    Options&& set_stats_sink(StatsSink* stats_sink) && {
+      return std::move(set_stats_sink(stats_sink));
+    }
+
+    // Expected final size of the file, in bytes of encoded output, or 0 if
+    // unknown.
+    //
+    // The hint is forwarded through the ChunkWriter to the destination
+    // Writer's SetSizeHint(), so that buffers and the destination can be
+    // sized once for the expected data instead of being grown repeatedly.
+    // The hint is not a guarantee: writing less or more data is still
+    // correct.
+    //
+    // Default: 0.
+    Options& set_size_hint(Position size_hint) & {
+      size_hint_ = size_hint;
+      return *this;
+    }
+    Options&& set_size_hint(Position size_hint) && {
+      return std::move(set_size_hint(size_hint));
+    }
+
    private:
     friend class RecordWriterBase;
 
     bool transpose_ = false;
+    bool auto_transpose_ = false;
+    bool columnar_ = false;
+    bool aligned_ = false;
+    bool recycle_chunk_encoders_ = false;
     CompressorOptions compressor_options_;
+    std::function<int(size_t num_pending_chunks)> compression_level_policy_;
+    bool train_zstd_dictionary_ = false;
     uint64_t chunk_size_ = kDefaultChunkSize;
+    uint64_t target_chunk_records_ = 0;
+    uint64_t max_chunk_size_ = 0;
+    uint64_t compressed_chunk_size_ = 0;
     double bucket_fraction_ = 1.0;
+    double bucket_compression_target_ = 0.0;
     RecordsMetadata metadata_;
     Chain serialized_metadata_;
     bool pad_to_block_boundary_ = false;
+    bool write_record_index_ = false;
+    std::function<std::string(absl::string_view record)> chunk_statistics_key_;
     int parallelism_ = 0;
+    bool adaptive_parallelism_ = false;
+    internal::ThreadPool* thread_pool_ = nullptr;
+    StatsSink* stats_sink_ = nullptr;
+    Position size_hint_ = 0;
   };
 
   ~RecordWriterBase();
@@ -357,6 +793,85 @@ class RecordWriterBase : public Object {
   //  * false - failure (!healthy())
   bool Flush(FlushType flush_type);
 
+  // Like Flush(), but does not block until the data are written.
+  //
+  // Returns a future which becomes ready when all records written before
+  // this call are pushed to the Writer as requested by flush_type, yielding
+  // true on success. If the future yields false, flushing failed and the
+  // RecordWriter fails with the next operation.
+  //
+  // If Options::set_parallelism() was used, concurrent flushes are
+  // coalesced: flush requests waiting in the queue behind the same data are
+  // completed by one flush of the destination, with the strongest requested
+  // flush_type. This gives bounded-latency durability without stalling the
+  // write loop. Without parallelism the flush happens before returning and
+  // the future is immediately ready.
+  //
+  // Like Flush(), this degrades compression density if used too often.
+  std::future<bool> FutureFlush(FlushType flush_type);
+
+  // Cancels writing: the RecordWriter fails with a kCancelled status,
+  // encoding tasks queued behind chunks being compressed are discarded, and
+  // the chunk writer thread skips remaining writes. A chunk whose
+  // compression already started finishes, but its output is discarded.
+  // Close() afterwards completes quickly without flushing remaining data.
+  //
+  // The destination is left in an unspecified state: chunks already written
+  // remain readable, later records are lost.
+  //
+  // Useful when aborting a process with many writers using parallelism,
+  // where compressing all queued chunks merely to discard the file would
+  // keep cores busy long after the abort.
+  void Cancel();
+
+  // Statistics of the chunk pipeline, as of the time of the
+  // pipeline_stats() call.
+  //
+  // Cumulative fields cover the lifetime of the RecordWriter; queued_requests
+  // and queued_bytes describe the current state of the pipeline. Together
+  // they identify the bottleneck when writing stalls: a full queue with
+  // dominant encoding_time points at encoding and compression, dominant
+  // writing_time points at the destination, and an empty queue points at the
+  // caller.
+  struct PipelineStats {
+    // Data chunks encoded so far.
+    uint64_t chunks_encoded = 0;
+    // Total size of encoded data chunks (headers and data).
+    uint64_t encoded_bytes = 0;
+    // Total size of chunks of all kinds written to the destination.
+    uint64_t written_bytes = 0;
+    // Wall time spent encoding data chunks, including compression. With
+    // parallelism, times of concurrent encoding tasks add up.
+    absl::Duration encoding_time;
+    // Wall time spent writing chunks to the destination and flushing it.
+    absl::Duration writing_time;
+    // Total time which chunk requests spent waiting for the chunk writer
+    // thread. Zero if parallelism is 0.
+    absl::Duration queue_time;
+    // Requests currently waiting for the chunk writer thread, including the
+    // one being handled. 0 if parallelism is 0.
+    size_t queued_requests = 0;
+    // Total size of encoded chunks waiting to be written. 0 if parallelism
+    // is 0.
+    uint64_t queued_bytes = 0;
+  };
+
+  // Returns statistics of the chunk pipeline.
+  //
+  // Unlike other functions, pipeline_stats() can be called concurrently with
+  // writing; statistics are collected from all pipeline threads.
+  PipelineStats pipeline_stats() const;
+
+  // Returns an estimate of the amount of memory currently used by this
+  // RecordWriter: the chunk being encoded, encoded chunks queued for writing
+  // when parallelism is used, dictionary training samples, and the record
+  // index. Sizes of compression contexts, and of chunks still being encoded
+  // by background tasks, are approximated. The destination is not included.
+  //
+  // Useful for budgeting the number of concurrently open writers in a
+  // process.
+  size_t EstimateMemory() const;
+
   // Returns the current position.
   //
   // Pos().get().numeric() returns the position as an integer of type Position.
@@ -387,11 +902,42 @@ class RecordWriterBase : public Object {
   class SerialWorker;
   class ParallelWorker;
 
+  // Accumulates sizes of written records in power of 2 buckets, to adapt
+  // desired_chunk_size_; see Options::set_adaptive_chunk_size().
+  class RecordSizeHistogram {
+   public:
+    void Add(uint64_t size);
+
+    uint64_t num_records() const { return num_records_; }
+
+    // An estimate of the median record size, as the midpoint of the bucket
+    // containing the median.
+    //
+    // Precondition: num_records() > 0
+    uint64_t Median() const;
+
+   private:
+    uint64_t num_records_ = 0;
+    // counts_[0] counts empty records; counts_[bucket] counts records of size
+    // in [2^(bucket-1), 2^bucket).
+    uint64_t counts_[65] = {};
+  };
+
   template <typename Record>
   bool WriteRecordImpl(Record&& record, FutureRecordPosition* key);
 
   uint64_t desired_chunk_size_ = 0;
   uint64_t chunk_size_so_far_ = 0;
+  // If > 0, desired_chunk_size_ is adapted toward chunks of this many
+  // records; see Options::set_adaptive_chunk_size().
+  uint64_t target_chunk_records_ = 0;
+  // Upper bound of the adapted desired_chunk_size_.
+  uint64_t max_desired_chunk_size_ = 0;
+  RecordSizeHistogram record_size_histogram_;
+  // If > 0, desired_chunk_size_ is scaled by the observed compression ratio
+  // so that compressed chunks approach this size; see
+  // Options::set_compressed_chunk_size().
+  uint64_t target_compressed_chunk_size_ = 0;
   // Invariant: if !closed() then worker_ != nullptr.
   std::unique_ptr<Worker> worker_;
 };
@@ -0,0 +1,177 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/records/rotating_record_writer.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <chrono>
+#include <future>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "absl/base/optimization.h"
+#include "absl/strings/string_view.h"
+#include "absl/utility/utility.h"
+#include "google/protobuf/message_lite.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/object.h"
+#include "riegeli/base/status.h"
+#include "riegeli/bytes/writer.h"
+#include "riegeli/records/chunk_writer.h"
+#include "riegeli/records/record_position.h"
+#include "riegeli/records/record_writer.h"
+
+namespace riegeli {
+
+namespace {
+
+// Maximum number of files being sealed in background at a time. When this
+// many seals are pending, Rotate() waits for the oldest one, which bounds
+// the number of open files and the memory of their encode pipelines.
+constexpr size_t kMaxSealsInFlight = 4;
+
+template <typename Record>
+inline size_t RecordSize(const Record& record) {
+  return record.size();
+}
+
+inline size_t RecordSize(const google::protobuf::MessageLite& record) {
+  return record.ByteSizeLong();
+}
+
+}  // namespace
+
+RotatingRecordWriterBase::RotatingRecordWriterBase(State state) noexcept
+    : Object(state) {}
+
+RotatingRecordWriterBase::RotatingRecordWriterBase(
+    RotatingRecordWriterBase&& that) noexcept
+    : Object(std::move(that)),
+      seal_results_(std::move(that.seal_results_)),
+      rotate_size_(absl::exchange(that.rotate_size_, 0)),
+      current_file_size_(absl::exchange(that.current_file_size_, 0)),
+      current_file_index_(absl::exchange(that.current_file_index_, 0)) {}
+
+RotatingRecordWriterBase& RotatingRecordWriterBase::operator=(
+    RotatingRecordWriterBase&& that) noexcept {
+  Object::operator=(std::move(that));
+  seal_results_ = std::move(that.seal_results_);
+  rotate_size_ = absl::exchange(that.rotate_size_, 0);
+  current_file_size_ = absl::exchange(that.current_file_size_, 0);
+  current_file_index_ = absl::exchange(that.current_file_index_, 0);
+  return *this;
+}
+
+void RotatingRecordWriterBase::Done() {
+  RecordWriterBase* const file = file_writer();
+  if (ABSL_PREDICT_FALSE(!file->Close())) Fail(*file);
+  while (!seal_results_.empty()) {
+    Status seal_status = seal_results_.front().get();
+    seal_results_.pop_front();
+    if (ABSL_PREDICT_FALSE(!seal_status.ok())) Fail(std::move(seal_status));
+  }
+}
+
+template <typename Record>
+bool RotatingRecordWriterBase::WriteRecordImpl(Record&& record,
+                                               FutureRecordPosition* key) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  const size_t size = RecordSize(record);
+  RecordWriterBase* const file = file_writer();
+  if (ABSL_PREDICT_FALSE(
+          !file->WriteRecord(std::forward<Record>(record), key))) {
+    return Fail(*file);
+  }
+  current_file_size_ += IntCast<uint64_t>(size);
+  if (current_file_size_ >= rotate_size_) return Rotate();
+  return true;
+}
+
+bool RotatingRecordWriterBase::WriteRecord(
+    const google::protobuf::MessageLite& record, FutureRecordPosition* key) {
+  return WriteRecordImpl(record, key);
+}
+
+bool RotatingRecordWriterBase::WriteRecord(absl::string_view record,
+                                           FutureRecordPosition* key) {
+  return WriteRecordImpl(record, key);
+}
+
+bool RotatingRecordWriterBase::WriteRecord(std::string&& record,
+                                           FutureRecordPosition* key) {
+  return WriteRecordImpl(std::move(record), key);
+}
+
+bool RotatingRecordWriterBase::WriteRecord(const Chain& record,
+                                           FutureRecordPosition* key) {
+  return WriteRecordImpl(record, key);
+}
+
+bool RotatingRecordWriterBase::WriteRecord(Chain&& record,
+                                           FutureRecordPosition* key) {
+  return WriteRecordImpl(std::move(record), key);
+}
+
+bool RotatingRecordWriterBase::Rotate() {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  while (seal_results_.size() >= kMaxSealsInFlight) {
+    if (ABSL_PREDICT_FALSE(!WaitForOldestSeal())) return false;
+  }
+  current_file_size_ = 0;
+  if (ABSL_PREDICT_FALSE(!SealAndOpenNext())) return false;
+  ++current_file_index_;
+  return CheckSealResults();
+}
+
+bool RotatingRecordWriterBase::Flush(FlushType flush_type) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  if (ABSL_PREDICT_FALSE(!CheckSealResults())) return false;
+  RecordWriterBase* const file = file_writer();
+  if (ABSL_PREDICT_FALSE(!file->Flush(flush_type))) return Fail(*file);
+  return true;
+}
+
+FutureRecordPosition RotatingRecordWriterBase::Pos() const {
+  return file_writer()->Pos();
+}
+
+bool RotatingRecordWriterBase::CheckSealResults() {
+  while (!seal_results_.empty() &&
+         seal_results_.front().wait_for(std::chrono::seconds(0)) ==
+             std::future_status::ready) {
+    if (ABSL_PREDICT_FALSE(!WaitForOldestSeal())) return false;
+  }
+  return true;
+}
+
+bool RotatingRecordWriterBase::WaitForOldestSeal() {
+  RIEGELI_ASSERT(!seal_results_.empty())
+      << "Failed precondition of RotatingRecordWriterBase::"
+         "WaitForOldestSeal(): no seals pending";
+  Status seal_status = seal_results_.front().get();
+  seal_results_.pop_front();
+  if (ABSL_PREDICT_FALSE(!seal_status.ok())) {
+    return Fail(std::move(seal_status));
+  }
+  return true;
+}
+
+template class RotatingRecordWriter<std::unique_ptr<Writer>>;
+template class RotatingRecordWriter<std::unique_ptr<ChunkWriter>>;
+
+}  // namespace riegeli
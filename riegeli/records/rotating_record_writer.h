@@ -0,0 +1,286 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_RECORDS_ROTATING_RECORD_WRITER_H_
+#define RIEGELI_RECORDS_ROTATING_RECORD_WRITER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include "absl/base/optimization.h"
+#include "absl/meta/type_traits.h"
+#include "absl/strings/string_view.h"
+#include "google/protobuf/message_lite.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/object.h"
+#include "riegeli/base/parallelism.h"
+#include "riegeli/base/status.h"
+#include "riegeli/bytes/writer.h"
+#include "riegeli/records/chunk_writer.h"
+#include "riegeli/records/record_position.h"
+#include "riegeli/records/record_writer.h"
+
+namespace riegeli {
+
+// Template parameter invariant part of RotatingRecordWriter.
+class RotatingRecordWriterBase : public Object {
+ public:
+  class Options {
+   public:
+    Options() noexcept {}
+
+    // Sets options of the file RecordWriters.
+    //
+    // If set_parallelism() is used in these options, consecutive files share
+    // the thread pool for background encoding.
+    //
+    // Default: RecordWriterBase::Options().
+    Options& set_record_writer_options(
+        RecordWriterBase::Options record_writer_options) & {
+      record_writer_options_ = std::move(record_writer_options);
+      return *this;
+    }
+    Options&& set_record_writer_options(
+        RecordWriterBase::Options record_writer_options) && {
+      return std::move(
+          set_record_writer_options(std::move(record_writer_options)));
+    }
+
+    // Sets the desired number of record bytes written to a file before
+    // writing moves to the next file. The actual file size also includes
+    // chunk and block overhead, and depends on compression.
+    //
+    // Default: 1G.
+    Options& set_rotate_size(uint64_t rotate_size) & {
+      RIEGELI_ASSERT_GT(rotate_size, 0u)
+          << "Failed precondition of "
+             "RotatingRecordWriterBase::Options::set_rotate_size(): "
+             "zero rotate size";
+      rotate_size_ = rotate_size;
+      return *this;
+    }
+    Options&& set_rotate_size(uint64_t rotate_size) && {
+      return std::move(set_rotate_size(rotate_size));
+    }
+
+   private:
+    friend class RotatingRecordWriterBase;
+    template <typename Dest>
+    friend class RotatingRecordWriter;
+
+    RecordWriterBase::Options record_writer_options_;
+    uint64_t rotate_size_ = uint64_t{1} << 30;
+  };
+
+  // Returns the index of the file which the next record will be written to,
+  // i.e. the number of files sealed or being sealed.
+  size_t current_file_index() const { return current_file_index_; }
+
+  // Writes the next record to the current file. After about rotate_size
+  // bytes of record values, Rotate() is called implicitly.
+  //
+  // If key != nullptr, *key is set to the canonical record position within
+  // the current file on success; current_file_index() identifies the file.
+  //
+  // Return values:
+  //  * true  - success (healthy())
+  //  * false - failure (!healthy())
+  bool WriteRecord(const google::protobuf::MessageLite& record,
+                   FutureRecordPosition* key = nullptr);
+  bool WriteRecord(absl::string_view record,
+                   FutureRecordPosition* key = nullptr);
+  bool WriteRecord(std::string&& record, FutureRecordPosition* key = nullptr);
+  template <typename Record>
+  absl::enable_if_t<std::is_convertible<Record, absl::string_view>::value, bool>
+  WriteRecord(const Record& record, FutureRecordPosition* key = nullptr) {
+    return WriteRecord(absl::string_view(record), key);
+  }
+  bool WriteRecord(const Chain& record, FutureRecordPosition* key = nullptr);
+  bool WriteRecord(Chain&& record, FutureRecordPosition* key = nullptr);
+
+  // Seals the current file and starts the next one. Sealing — finalizing the
+  // last chunk, draining the encode pipeline, and closing the file — happens
+  // in the background; new records immediately flow to the next file, so the
+  // encode pipeline stays warm across file boundaries. A failure to seal a
+  // file is reported by a later operation.
+  //
+  // Return values:
+  //  * true  - success (healthy())
+  //  * false - failure (!healthy())
+  bool Rotate();
+
+  // Finalizes any open chunk and pushes buffered data of the current file,
+  // like RecordWriterBase::Flush(). Files already being sealed are not
+  // waited for, but their failures reported so far are checked.
+  //
+  // Return values:
+  //  * true  - success (healthy())
+  //  * false - failure (!healthy())
+  bool Flush(FlushType flush_type);
+
+  // Returns the current position of the current file.
+  FutureRecordPosition Pos() const;
+
+ protected:
+  explicit RotatingRecordWriterBase(State state) noexcept;
+
+  RotatingRecordWriterBase(RotatingRecordWriterBase&& that) noexcept;
+  RotatingRecordWriterBase& operator=(RotatingRecordWriterBase&& that) noexcept;
+
+  void Initialize(uint64_t rotate_size);
+
+  // Closes the current file synchronously and waits for all files being
+  // sealed in background.
+  void Done() override;
+
+  // Returns the RecordWriter of the current file.
+  virtual RecordWriterBase* file_writer() = 0;
+  virtual const RecordWriterBase* file_writer() const = 0;
+
+  // Moves the current file writer out for background sealing, appending the
+  // future result of its Close() to seal_results_, and opens the file with
+  // index current_file_index() + 1. Returns false if opening failed, with
+  // this RotatingRecordWriterBase failed.
+  virtual bool SealAndOpenNext() = 0;
+
+  // Results of Close() of files being sealed in background, oldest first.
+  std::deque<std::future<Status>> seal_results_;
+
+ private:
+  template <typename Record>
+  bool WriteRecordImpl(Record&& record, FutureRecordPosition* key);
+
+  // Consumes results of background seals which have completed, failing if
+  // any failed. Does not block.
+  bool CheckSealResults();
+
+  // Waits for the oldest background seal, failing if it failed.
+  //
+  // Precondition: !seal_results_.empty()
+  bool WaitForOldestSeal();
+
+  // See Options::set_rotate_size().
+  uint64_t rotate_size_ = 0;
+  // Number of record bytes written to the current file.
+  uint64_t current_file_size_ = 0;
+  // Index of the file which the next record will be written to.
+  size_t current_file_index_ = 0;
+};
+
+// RotatingRecordWriter writes records to a sequence of Riegeli/records
+// files, moving to the next file after about rotate_size bytes of record
+// values. The current file is sealed in the background while new records
+// immediately flow to the next file, avoiding the write stall of draining
+// the encode pipeline at each file boundary.
+//
+// Files are created on demand by dest_factory, which is called with the file
+// index (starting from 0) and returns the object providing and possibly
+// owning the byte Writer or ChunkWriter of the file, like the Dest template
+// parameter of RecordWriter.
+template <typename Dest = Writer*>
+class RotatingRecordWriter : public RotatingRecordWriterBase {
+ public:
+  // Creates a closed RotatingRecordWriter.
+  RotatingRecordWriter() noexcept : RotatingRecordWriterBase(State::kClosed) {}
+
+  // Will write to the files provided by dest_factory(0), dest_factory(1),
+  // and so on.
+  explicit RotatingRecordWriter(
+      std::function<Dest(size_t file_index)> dest_factory,
+      Options options = Options());
+
+  RotatingRecordWriter(RotatingRecordWriter&& that) noexcept;
+  RotatingRecordWriter& operator=(RotatingRecordWriter&& that) noexcept;
+
+ protected:
+  RecordWriterBase* file_writer() override { return &writer_; }
+  const RecordWriterBase* file_writer() const override { return &writer_; }
+
+  bool SealAndOpenNext() override;
+
+ private:
+  std::function<Dest(size_t file_index)> dest_factory_;
+  RecordWriterBase::Options record_writer_options_;
+  RecordWriter<Dest> writer_;
+};
+
+// Implementation details follow.
+
+inline void RotatingRecordWriterBase::Initialize(uint64_t rotate_size) {
+  rotate_size_ = rotate_size;
+}
+
+template <typename Dest>
+RotatingRecordWriter<Dest>::RotatingRecordWriter(
+    std::function<Dest(size_t file_index)> dest_factory, Options options)
+    : RotatingRecordWriterBase(State::kOpen),
+      dest_factory_(std::move(dest_factory)),
+      record_writer_options_(std::move(options.record_writer_options_)),
+      writer_(dest_factory_(0), record_writer_options_) {
+  Initialize(options.rotate_size_);
+  if (ABSL_PREDICT_FALSE(!writer_.healthy())) Fail(writer_);
+}
+
+template <typename Dest>
+inline RotatingRecordWriter<Dest>::RotatingRecordWriter(
+    RotatingRecordWriter&& that) noexcept
+    : RotatingRecordWriterBase(std::move(that)),
+      dest_factory_(std::move(that.dest_factory_)),
+      record_writer_options_(std::move(that.record_writer_options_)),
+      writer_(std::move(that.writer_)) {}
+
+template <typename Dest>
+inline RotatingRecordWriter<Dest>& RotatingRecordWriter<Dest>::operator=(
+    RotatingRecordWriter&& that) noexcept {
+  RotatingRecordWriterBase::operator=(std::move(that));
+  dest_factory_ = std::move(that.dest_factory_);
+  record_writer_options_ = std::move(that.record_writer_options_);
+  writer_ = std::move(that.writer_);
+  return *this;
+}
+
+template <typename Dest>
+bool RotatingRecordWriter<Dest>::SealAndOpenNext() {
+  // The sealed writer is owned by the background task; sealing can outlive
+  // this RotatingRecordWriter being closed, Done() waits for the results.
+  RecordWriter<Dest>* const sealed =
+      new RecordWriter<Dest>(std::move(writer_));
+  std::promise<Status>* const seal_promise = new std::promise<Status>();
+  seal_results_.push_back(seal_promise->get_future());
+  internal::ThreadPool::global_io().Schedule([sealed, seal_promise] {
+    seal_promise->set_value(sealed->Close() ? OkStatus() : sealed->status());
+    delete sealed;
+    delete seal_promise;
+  });
+  writer_ = RecordWriter<Dest>(dest_factory_(current_file_index() + 1),
+                               record_writer_options_);
+  if (ABSL_PREDICT_FALSE(!writer_.healthy())) return Fail(writer_);
+  return true;
+}
+
+extern template class RotatingRecordWriter<std::unique_ptr<Writer>>;
+extern template class RotatingRecordWriter<std::unique_ptr<ChunkWriter>>;
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_RECORDS_ROTATING_RECORD_WRITER_H_
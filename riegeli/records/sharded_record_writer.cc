@@ -0,0 +1,141 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/records/sharded_record_writer.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "absl/base/optimization.h"
+#include "absl/strings/string_view.h"
+#include "absl/utility/utility.h"
+#include "google/protobuf/message_lite.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/object.h"
+#include "riegeli/bytes/writer.h"
+#include "riegeli/records/chunk_writer.h"
+#include "riegeli/records/record_position.h"
+#include "riegeli/records/record_writer.h"
+
+namespace riegeli {
+
+namespace {
+
+template <typename Record>
+inline size_t RecordSize(const Record& record) {
+  return record.size();
+}
+
+inline size_t RecordSize(const google::protobuf::MessageLite& record) {
+  return record.ByteSizeLong();
+}
+
+}  // namespace
+
+ShardedRecordWriterBase::ShardedRecordWriterBase(State state) noexcept
+    : Object(state) {}
+
+ShardedRecordWriterBase::ShardedRecordWriterBase(
+    ShardedRecordWriterBase&& that) noexcept
+    : Object(std::move(that)),
+      shard_size_(absl::exchange(that.shard_size_, 0)),
+      current_shard_size_(absl::exchange(that.current_shard_size_, 0)),
+      current_shard_(absl::exchange(that.current_shard_, 0)) {}
+
+ShardedRecordWriterBase& ShardedRecordWriterBase::operator=(
+    ShardedRecordWriterBase&& that) noexcept {
+  Object::operator=(std::move(that));
+  shard_size_ = absl::exchange(that.shard_size_, 0);
+  current_shard_size_ = absl::exchange(that.current_shard_size_, 0);
+  current_shard_ = absl::exchange(that.current_shard_, 0);
+  return *this;
+}
+
+void ShardedRecordWriterBase::Done() {
+  for (size_t index = 0; index < num_shards(); ++index) {
+    RecordWriterBase* const shard = shard_writer(index);
+    if (ABSL_PREDICT_FALSE(!shard->Close())) Fail(*shard);
+  }
+}
+
+template <typename Record>
+bool ShardedRecordWriterBase::WriteRecordImpl(Record&& record,
+                                              FutureRecordPosition* key) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  const size_t size = RecordSize(record);
+  RecordWriterBase* const shard = shard_writer(current_shard_);
+  if (ABSL_PREDICT_FALSE(
+          !shard->WriteRecord(std::forward<Record>(record), key))) {
+    return Fail(*shard);
+  }
+  current_shard_size_ += IntCast<uint64_t>(size);
+  if (current_shard_size_ >= shard_size_) {
+    current_shard_size_ = 0;
+    ++current_shard_;
+    if (current_shard_ == num_shards()) current_shard_ = 0;
+  }
+  return true;
+}
+
+bool ShardedRecordWriterBase::WriteRecord(
+    const google::protobuf::MessageLite& record, FutureRecordPosition* key) {
+  return WriteRecordImpl(record, key);
+}
+
+bool ShardedRecordWriterBase::WriteRecord(absl::string_view record,
+                                          FutureRecordPosition* key) {
+  return WriteRecordImpl(record, key);
+}
+
+bool ShardedRecordWriterBase::WriteRecord(std::string&& record,
+                                          FutureRecordPosition* key) {
+  return WriteRecordImpl(std::move(record), key);
+}
+
+bool ShardedRecordWriterBase::WriteRecord(const Chain& record,
+                                          FutureRecordPosition* key) {
+  return WriteRecordImpl(record, key);
+}
+
+bool ShardedRecordWriterBase::WriteRecord(Chain&& record,
+                                          FutureRecordPosition* key) {
+  return WriteRecordImpl(std::move(record), key);
+}
+
+bool ShardedRecordWriterBase::Flush(FlushType flush_type) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  for (size_t index = 0; index < num_shards(); ++index) {
+    RecordWriterBase* const shard = shard_writer(index);
+    if (ABSL_PREDICT_FALSE(!shard->Flush(flush_type))) return Fail(*shard);
+  }
+  return true;
+}
+
+FutureRecordPosition ShardedRecordWriterBase::Pos() const {
+  RIEGELI_ASSERT_GT(num_shards(), 0u)
+      << "Failed precondition of ShardedRecordWriterBase::Pos(): no shards";
+  return shard_writer(current_shard_)->Pos();
+}
+
+template class ShardedRecordWriter<Writer*>;
+template class ShardedRecordWriter<std::unique_ptr<Writer>>;
+template class ShardedRecordWriter<ChunkWriter*>;
+template class ShardedRecordWriter<std::unique_ptr<ChunkWriter>>;
+
+}  // namespace riegeli
@@ -0,0 +1,291 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_RECORDS_SHARDED_RECORD_WRITER_H_
+#define RIEGELI_RECORDS_SHARDED_RECORD_WRITER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/meta/type_traits.h"
+#include "absl/strings/string_view.h"
+#include "google/protobuf/message_lite.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/object.h"
+#include "riegeli/bytes/writer.h"
+#include "riegeli/records/chunk_writer.h"
+#include "riegeli/records/record_position.h"
+#include "riegeli/records/record_writer.h"
+
+namespace riegeli {
+
+// Template parameter invariant part of ShardedRecordWriter.
+class ShardedRecordWriterBase : public Object {
+ public:
+  class Options {
+   public:
+    Options() noexcept {}
+
+    // Sets options of the shard RecordWriters.
+    //
+    // If set_parallelism() is used in these options, the shards share the
+    // thread pool for background encoding.
+    //
+    // Default: RecordWriterBase::Options().
+    Options& set_record_writer_options(
+        RecordWriterBase::Options record_writer_options) & {
+      record_writer_options_ = std::move(record_writer_options);
+      return *this;
+    }
+    Options&& set_record_writer_options(
+        RecordWriterBase::Options record_writer_options) && {
+      return std::move(
+          set_record_writer_options(std::move(record_writer_options)));
+    }
+
+    // Sets the desired number of record bytes written to a shard before
+    // writing moves to the next shard.
+    //
+    // When the shard size matches the chunk size of the shard RecordWriters
+    // (the default), whole chunks land in one shard.
+    //
+    // Default: RecordWriterBase::Options::kDefaultChunkSize (1M).
+    Options& set_shard_size(uint64_t shard_size) & {
+      RIEGELI_ASSERT_GT(shard_size, 0u)
+          << "Failed precondition of "
+             "ShardedRecordWriterBase::Options::set_shard_size(): "
+             "zero shard size";
+      shard_size_ = shard_size;
+      return *this;
+    }
+    Options&& set_shard_size(uint64_t shard_size) && {
+      return std::move(set_shard_size(shard_size));
+    }
+
+   private:
+    friend class ShardedRecordWriterBase;
+    template <typename Dest>
+    friend class ShardedRecordWriter;
+
+    RecordWriterBase::Options record_writer_options_;
+    uint64_t shard_size_ = RecordWriterBase::Options::kDefaultChunkSize;
+  };
+
+  // Returns the number of shards.
+  virtual size_t num_shards() const = 0;
+
+  // Returns the index of the shard which the next record will be written to.
+  size_t current_shard() const { return current_shard_; }
+
+  // Writes the next record to the current shard. After about shard_size
+  // bytes of record values, writing moves to the next shard round-robin.
+  //
+  // The order of records is preserved within each shard but not between
+  // shards.
+  //
+  // If key != nullptr, *key is set to the canonical record position within
+  // the current shard on success; current_shard() identifies the shard.
+  //
+  // Return values:
+  //  * true  - success (healthy())
+  //  * false - failure (!healthy())
+  bool WriteRecord(const google::protobuf::MessageLite& record,
+                   FutureRecordPosition* key = nullptr);
+  bool WriteRecord(absl::string_view record,
+                   FutureRecordPosition* key = nullptr);
+  bool WriteRecord(std::string&& record, FutureRecordPosition* key = nullptr);
+  template <typename Record>
+  absl::enable_if_t<std::is_convertible<Record, absl::string_view>::value, bool>
+  WriteRecord(const Record& record, FutureRecordPosition* key = nullptr) {
+    return WriteRecord(absl::string_view(record), key);
+  }
+  bool WriteRecord(const Chain& record, FutureRecordPosition* key = nullptr);
+  bool WriteRecord(Chain&& record, FutureRecordPosition* key = nullptr);
+
+  // Finalizes any open chunks and pushes buffered data in all shards, like
+  // RecordWriterBase::Flush() for each shard.
+  //
+  // Return values:
+  //  * true  - success (healthy())
+  //  * false - failure (!healthy())
+  bool Flush(FlushType flush_type);
+
+  // Returns the current position of the current shard.
+  //
+  // Precondition: num_shards() > 0
+  FutureRecordPosition Pos() const;
+
+ protected:
+  explicit ShardedRecordWriterBase(State state) noexcept;
+
+  ShardedRecordWriterBase(ShardedRecordWriterBase&& that) noexcept;
+  ShardedRecordWriterBase& operator=(ShardedRecordWriterBase&& that) noexcept;
+
+  void Initialize(uint64_t shard_size);
+
+  void Done() override;
+
+  // Returns the shard RecordWriter at index.
+  //
+  // Precondition: index < num_shards()
+  virtual RecordWriterBase* shard_writer(size_t index) = 0;
+  virtual const RecordWriterBase* shard_writer(size_t index) const = 0;
+
+ private:
+  template <typename Record>
+  bool WriteRecordImpl(Record&& record, FutureRecordPosition* key);
+
+  // See Options::set_shard_size().
+  uint64_t shard_size_ = 0;
+  // Number of record bytes written to the current shard.
+  uint64_t current_shard_size_ = 0;
+  // Index of the shard which the next record will be written to.
+  //
+  // Invariant: if !closed() then current_shard_ < num_shards()
+  size_t current_shard_ = 0;
+};
+
+// ShardedRecordWriter writes records to several Riegeli/records files,
+// distributing them between the files so that writing is not limited by the
+// I/O bandwidth of one file.
+//
+// Records are written to one shard until it received about shard_size bytes
+// of record values, then writing moves to the next shard round-robin. The
+// order of records is preserved within each shard but not between shards.
+//
+// The Dest template parameter specifies the type of the objects providing and
+// possibly owning the byte Writers or ChunkWriters of the shards, like the
+// Dest template parameter of RecordWriter.
+template <typename Dest = Writer*>
+class ShardedRecordWriter : public ShardedRecordWriterBase {
+ public:
+  // Creates a closed ShardedRecordWriter.
+  ShardedRecordWriter() noexcept : ShardedRecordWriterBase(State::kClosed) {}
+
+  // Will write to the files provided by dests, one shard per element.
+  //
+  // Precondition: !dests.empty()
+  explicit ShardedRecordWriter(std::vector<Dest> dests,
+                               Options options = Options());
+
+  ShardedRecordWriter(ShardedRecordWriter&& that) noexcept;
+  ShardedRecordWriter& operator=(ShardedRecordWriter&& that) noexcept;
+
+  // Returns the shard RecordWriter at index. Unchanged by Close().
+  //
+  // Precondition: index < num_shards()
+  RecordWriter<Dest>& shard(size_t index);
+  const RecordWriter<Dest>& shard(size_t index) const;
+
+  size_t num_shards() const override { return shards_.size(); }
+
+ protected:
+  RecordWriterBase* shard_writer(size_t index) override;
+  const RecordWriterBase* shard_writer(size_t index) const override;
+
+ private:
+  std::vector<RecordWriter<Dest>> shards_;
+};
+
+// Implementation details follow.
+
+inline void ShardedRecordWriterBase::Initialize(uint64_t shard_size) {
+  shard_size_ = shard_size;
+}
+
+template <typename Dest>
+ShardedRecordWriter<Dest>::ShardedRecordWriter(std::vector<Dest> dests,
+                                               Options options)
+    : ShardedRecordWriterBase(State::kOpen) {
+  RIEGELI_ASSERT(!dests.empty())
+      << "Failed precondition of "
+         "ShardedRecordWriter<Dest>::ShardedRecordWriter(vector<Dest>): "
+         "no shards";
+  shards_.reserve(dests.size());
+  for (Dest& dest : dests) {
+    shards_.emplace_back(std::move(dest), options.record_writer_options_);
+  }
+  Initialize(options.shard_size_);
+  for (RecordWriter<Dest>& shard : shards_) {
+    if (ABSL_PREDICT_FALSE(!shard.healthy())) {
+      Fail(shard);
+      return;
+    }
+  }
+}
+
+template <typename Dest>
+inline ShardedRecordWriter<Dest>::ShardedRecordWriter(
+    ShardedRecordWriter&& that) noexcept
+    : ShardedRecordWriterBase(std::move(that)),
+      shards_(std::move(that.shards_)) {}
+
+template <typename Dest>
+inline ShardedRecordWriter<Dest>& ShardedRecordWriter<Dest>::operator=(
+    ShardedRecordWriter&& that) noexcept {
+  ShardedRecordWriterBase::operator=(std::move(that));
+  shards_ = std::move(that.shards_);
+  return *this;
+}
+
+template <typename Dest>
+inline RecordWriter<Dest>& ShardedRecordWriter<Dest>::shard(size_t index) {
+  RIEGELI_ASSERT_LT(index, shards_.size())
+      << "Failed precondition of ShardedRecordWriter<Dest>::shard(): "
+         "shard index out of range";
+  return shards_[index];
+}
+
+template <typename Dest>
+inline const RecordWriter<Dest>& ShardedRecordWriter<Dest>::shard(
+    size_t index) const {
+  RIEGELI_ASSERT_LT(index, shards_.size())
+      << "Failed precondition of ShardedRecordWriter<Dest>::shard(): "
+         "shard index out of range";
+  return shards_[index];
+}
+
+template <typename Dest>
+RecordWriterBase* ShardedRecordWriter<Dest>::shard_writer(size_t index) {
+  RIEGELI_ASSERT_LT(index, shards_.size())
+      << "Failed precondition of ShardedRecordWriter<Dest>::shard_writer(): "
+         "shard index out of range";
+  return &shards_[index];
+}
+
+template <typename Dest>
+const RecordWriterBase* ShardedRecordWriter<Dest>::shard_writer(
+    size_t index) const {
+  RIEGELI_ASSERT_LT(index, shards_.size())
+      << "Failed precondition of ShardedRecordWriter<Dest>::shard_writer(): "
+         "shard index out of range";
+  return &shards_[index];
+}
+
+extern template class ShardedRecordWriter<Writer*>;
+extern template class ShardedRecordWriter<std::unique_ptr<Writer>>;
+extern template class ShardedRecordWriter<ChunkWriter*>;
+extern template class ShardedRecordWriter<std::unique_ptr<ChunkWriter>>;
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_RECORDS_SHARDED_RECORD_WRITER_H_
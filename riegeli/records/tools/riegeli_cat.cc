@@ -0,0 +1,207 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Make file offsets 64-bit even on 32-bit systems.
+#undef _FILE_OFFSET_BITS
+#define _FILE_OFFSET_BITS 64
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <iostream>
+#include <limits>
+#include <string>
+#include <utility>
+
+#include "absl/base/optimization.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/bytes/fd_writer.h"
+#include "riegeli/bytes/writer.h"
+#include "riegeli/bytes/writer_utils.h"
+#include "riegeli/chunk_encoding/field_projection.h"
+#include "riegeli/records/record_reader.h"
+
+namespace {
+
+// Parses "N:M" as a half open range of record ordinals.
+bool ParseRange(absl::string_view arg, uint64_t* begin, uint64_t* end) {
+  const size_t colon = arg.find(':');
+  if (colon == absl::string_view::npos) return false;
+  if (!absl::SimpleAtoi(arg.substr(0, colon), begin)) return false;
+  const absl::string_view end_string = arg.substr(colon + 1);
+  if (end_string.empty()) {
+    *end = std::numeric_limits<uint64_t>::max();
+    return true;
+  }
+  if (!absl::SimpleAtoi(end_string, end)) return false;
+  return *begin <= *end;
+}
+
+// Parses a comma separated list of dot separated proto field tag paths, e.g.
+// "3.1,5".
+bool ParseFieldProjection(absl::string_view arg,
+                          riegeli::FieldProjection* field_projection) {
+  for (const absl::string_view path : absl::StrSplit(arg, ',')) {
+    riegeli::Field field;
+    for (const absl::string_view tag_string : absl::StrSplit(path, '.')) {
+      uint32_t tag;
+      if (!absl::SimpleAtoi(tag_string, &tag) || tag == 0) return false;
+      field.AddTag(tag);
+    }
+    field_projection->AddField(std::move(field));
+  }
+  return true;
+}
+
+// Streams records of one file to dest. Records are read as Chains, whose
+// blocks share the decoded chunk, and written with vectored writes, without
+// copying record data. Returns false if the file could not be read, after
+// reporting it.
+bool CatFile(const std::string& filename, uint64_t begin, uint64_t end,
+             const riegeli::FieldProjection& field_projection,
+             bool length_prefixed, riegeli::Writer* dest) {
+  riegeli::RecordReader<riegeli::FdReader<>> record_reader(
+      riegeli::FdReader<>(filename, O_RDONLY),
+      riegeli::RecordReaderBase::Options().set_field_projection(
+          field_projection));
+  if (begin > 0) {
+    if (ABSL_PREDICT_FALSE(!record_reader.SeekToRecord(begin))) {
+      std::cerr << "Could not seek in " << filename << ": "
+                << record_reader.status() << std::endl;
+      return false;
+    }
+  }
+  uint64_t remaining = end - begin;
+  riegeli::Chain record;
+  while (remaining > 0) {
+    if (ABSL_PREDICT_FALSE(!record_reader.ReadRecord(&record))) break;
+    --remaining;
+    if (length_prefixed) {
+      if (ABSL_PREDICT_FALSE(
+              !riegeli::WriteVarint64(dest, record.size()))) {
+        break;
+      }
+    }
+    if (ABSL_PREDICT_FALSE(!dest->Write(std::move(record)))) break;
+  }
+  if (ABSL_PREDICT_FALSE(!dest->healthy())) {
+    std::cerr << "Could not write: " << dest->status() << std::endl;
+    return false;
+  }
+  if (ABSL_PREDICT_FALSE(!record_reader.Close())) {
+    std::cerr << "Could not read " << filename << ": "
+              << record_reader.status() << std::endl;
+    return false;
+  }
+  return true;
+}
+
+const char kUsage[] =
+    "Usage: riegeli_cat (OPTION|INPUT_FILE)...\n"
+    "\n"
+    "Streams records of Riegeli/records files to stdout. Records are\n"
+    "written back to back by default; the output is not a Riegeli file.\n"
+    "\n"
+    "OPTIONs:\n"
+    "  --length_prefixed\n"
+    "      Precede each record with its length as a varint, making record\n"
+    "      boundaries recoverable from the output\n"
+    "  --records=N:M\n"
+    "      Output only records with ordinal numbers in the half open range\n"
+    "      N:M, counting from 0. M can be empty for all records from N. The\n"
+    "      start of the range is located through the record index, written\n"
+    "      with RecordWriterBase::Options::set_write_record_index(), without\n"
+    "      scanning preceding records\n"
+    "  --fields=PATH,...\n"
+    "      Decode only the given proto field paths, e.g. --fields=3.1,5,\n"
+    "      where each path is a dot separated list of field tags descending\n"
+    "      from the root message. Applies to transposed files";
+
+const struct option kOptions[] = {
+    {"help", no_argument, nullptr, 0},
+    {"length_prefixed", no_argument, nullptr, 1},
+    {"records", required_argument, nullptr, 2},
+    {"fields", required_argument, nullptr, 3},
+    {nullptr, 0, nullptr, 0}};
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  bool length_prefixed = false;
+  uint64_t begin = 0;
+  uint64_t end = std::numeric_limits<uint64_t>::max();
+  riegeli::FieldProjection field_projection = riegeli::FieldProjection::All();
+  for (;;) {
+    int option_index;
+    const int option =
+        getopt_long_only(argc, argv, "", kOptions, &option_index);
+    if (option == -1) break;
+    switch (option) {
+      case 0:  // --help
+        std::cout << kUsage << std::endl;
+        return 0;
+      case 1:  // --length_prefixed
+        length_prefixed = true;
+        break;
+      case 2:  // --records
+        if (ABSL_PREDICT_TRUE(ParseRange(optarg, &begin, &end))) break;
+        std::cerr << argv[0]
+                  << ": option '--records' requires an argument in the "
+                     "format N:M\n";
+        return 1;
+      case 3:  // --fields
+        field_projection = riegeli::FieldProjection();
+        if (ABSL_PREDICT_TRUE(
+                ParseFieldProjection(optarg, &field_projection))) {
+          break;
+        }
+        std::cerr << argv[0]
+                  << ": option '--fields' requires comma separated dot\n"
+                     "separated field tag paths\n";
+        return 1;
+      case '?':
+        return 1;
+      default:
+        RIEGELI_ASSERT_UNREACHABLE()
+            << "getopt_long_only() returned " << option;
+    }
+  }
+  argc -= optind - 1;
+  argv += optind - 1;
+  if (argc == 1) {
+    std::cerr << kUsage << std::endl;
+    return 1;
+  }
+  riegeli::FdStreamWriter<int> dest(
+      1, riegeli::FdStreamWriterBase::Options().set_assumed_pos(0));
+  bool all_ok = true;
+  for (int i = 1; i < argc; ++i) {
+    if (!CatFile(argv[i], begin, end, field_projection, length_prefixed,
+                 &dest)) {
+      all_ok = false;
+    }
+  }
+  if (ABSL_PREDICT_FALSE(!dest.Close())) {
+    std::cerr << "Could not write: " << dest.status() << std::endl;
+    all_ok = false;
+  }
+  return all_ok ? 0 : 1;
+}
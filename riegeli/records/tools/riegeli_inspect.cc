@@ -0,0 +1,347 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Make file offsets 64-bit even on 32-bit systems.
+#undef _FILE_OFFSET_BITS
+#define _FILE_OFFSET_BITS 64
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "riegeli/base/base.h"
+#include "riegeli/bytes/chain_reader.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/bytes/reader_utils.h"
+#include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/chunk_encoding/constants.h"
+#include "riegeli/records/chunk_reader.h"
+#include "riegeli/records/skipped_region.h"
+
+namespace {
+
+const char* ChunkTypeName(riegeli::ChunkType chunk_type) {
+  switch (chunk_type) {
+    case riegeli::ChunkType::kFileSignature:
+      return "file signature";
+    case riegeli::ChunkType::kFileMetadata:
+      return "file metadata";
+    case riegeli::ChunkType::kPadding:
+      return "padding";
+    case riegeli::ChunkType::kSimple:
+      return "simple";
+    case riegeli::ChunkType::kTransposed:
+      return "transposed";
+    case riegeli::ChunkType::kTransposedColumnar:
+      return "transposed columnar";
+    case riegeli::ChunkType::kRecordIndex:
+      return "record index";
+    case riegeli::ChunkType::kAligned:
+      return "aligned";
+  }
+  return "unknown";
+}
+
+// Statistics of the chunks of one type.
+struct ChunkTypeStats {
+  uint64_t num_chunks = 0;
+  uint64_t num_records = 0;
+  uint64_t data_size = 0;
+  uint64_t decoded_data_size = 0;
+};
+
+std::string Ratio(uint64_t data_size, uint64_t decoded_data_size) {
+  if (data_size == 0) return "-";
+  std::ostringstream message;
+  message << std::fixed << std::setprecision(2)
+          << static_cast<double>(decoded_data_size) /
+                 static_cast<double>(data_size);
+  return message.str();
+}
+
+// Prints record and chunk counts from the record index at the end of the
+// file, reading only the index chunk and the chunk headers near it. Returns
+// false if the file has no record index or could not be read; only the
+// latter is reported.
+bool InspectFromRecordIndex(const std::string& filename) {
+  riegeli::DefaultChunkReader<riegeli::FdReader<>> chunk_reader(
+      riegeli::FdReader<>(filename, O_RDONLY));
+  riegeli::Position size;
+  if (ABSL_PREDICT_FALSE(!chunk_reader.Size(&size))) {
+    std::cerr << "Could not read " << filename << ": " << chunk_reader.status()
+              << std::endl;
+    return false;
+  }
+  // The index chunk is the last chunk of the file, possibly followed by
+  // padding chunks.
+  riegeli::Position search_pos = size;
+  riegeli::Chunk chunk;
+  bool found = false;
+  while (search_pos > 0) {
+    if (ABSL_PREDICT_FALSE(!chunk_reader.SeekToChunkBefore(search_pos - 1))) {
+      std::cerr << "Could not read " << filename << ": "
+                << chunk_reader.status() << std::endl;
+      return false;
+    }
+    const riegeli::Position index_chunk_begin = chunk_reader.pos();
+    if (ABSL_PREDICT_FALSE(!chunk_reader.ReadChunk(&chunk))) {
+      if (!chunk_reader.healthy()) {
+        std::cerr << "Could not read " << filename << ": "
+                  << chunk_reader.status() << std::endl;
+      }
+      return false;
+    }
+    if (chunk.header.chunk_type() == riegeli::ChunkType::kRecordIndex) {
+      found = true;
+      break;
+    }
+    if (chunk.header.chunk_type() != riegeli::ChunkType::kPadding) break;
+    search_pos = index_chunk_begin;
+  }
+  if (!found) {
+    std::cerr << filename
+              << ": no record index at the end of the file; inspect without "
+                 "--index_only\n";
+    return false;
+  }
+  riegeli::ChainReader<> data_reader(&chunk.data);
+  uint64_t num_entries;
+  uint64_t flags;
+  if (ABSL_PREDICT_FALSE(!riegeli::ReadVarint64(&data_reader, &num_entries)) ||
+      ABSL_PREDICT_FALSE(!riegeli::ReadVarint64(&data_reader, &flags)) ||
+      ABSL_PREDICT_FALSE((flags & ~riegeli::kRecordIndexHasStatistics) != 0)) {
+    std::cerr << filename << ": invalid record index chunk" << std::endl;
+    return false;
+  }
+  const bool has_statistics =
+      (flags & riegeli::kRecordIndexHasStatistics) != 0;
+  uint64_t total_records = 0;
+  uint64_t total_decoded_data_size = 0;
+  for (uint64_t i = 0; i < num_entries; ++i) {
+    uint64_t chunk_begin_delta;
+    uint64_t num_records;
+    if (ABSL_PREDICT_FALSE(
+            !riegeli::ReadVarint64(&data_reader, &chunk_begin_delta)) ||
+        ABSL_PREDICT_FALSE(!riegeli::ReadVarint64(&data_reader,
+                                                  &num_records))) {
+      std::cerr << filename << ": invalid record index chunk" << std::endl;
+      return false;
+    }
+    total_records += num_records;
+    if (has_statistics) {
+      uint64_t decoded_data_size;
+      uint64_t min_key_size;
+      uint64_t max_key_size;
+      if (ABSL_PREDICT_FALSE(
+              !riegeli::ReadVarint64(&data_reader, &decoded_data_size)) ||
+          ABSL_PREDICT_FALSE(
+              !riegeli::ReadVarint64(&data_reader, &min_key_size)) ||
+          ABSL_PREDICT_FALSE(!data_reader.Skip(min_key_size)) ||
+          ABSL_PREDICT_FALSE(
+              !riegeli::ReadVarint64(&data_reader, &max_key_size)) ||
+          ABSL_PREDICT_FALSE(!data_reader.Skip(max_key_size))) {
+        std::cerr << filename << ": invalid record index chunk" << std::endl;
+        return false;
+      }
+      total_decoded_data_size += decoded_data_size;
+    }
+  }
+  std::cout << filename << ": " << size << " bytes, " << num_entries
+            << " record chunks, " << total_records << " records";
+  if (has_statistics) {
+    std::cout << ", " << total_decoded_data_size << " decoded bytes (ratio "
+              << Ratio(size, total_decoded_data_size) << ")";
+  }
+  std::cout << " (from record index)" << std::endl;
+  return true;
+}
+
+// Prints the layout and statistics of a file by scanning its chunk headers,
+// seeking over chunk data without reading them. Returns false if the file
+// could not be read, after reporting it.
+bool InspectFromChunkHeaders(const std::string& filename, bool print_chunks) {
+  riegeli::DefaultChunkReader<riegeli::FdReader<>> chunk_reader(
+      riegeli::FdReader<>(filename, O_RDONLY));
+  riegeli::Position size;
+  if (ABSL_PREDICT_FALSE(!chunk_reader.Size(&size))) {
+    std::cerr << "Could not read " << filename << ": " << chunk_reader.status()
+              << std::endl;
+    return false;
+  }
+  std::vector<std::pair<riegeli::ChunkType, ChunkTypeStats>> stats;
+  uint64_t num_chunks = 0;
+  uint64_t num_skipped = 0;
+  for (;;) {
+    const riegeli::Position chunk_begin = chunk_reader.pos();
+    const riegeli::ChunkHeader* chunk_header;
+    if (!chunk_reader.PullChunkHeader(&chunk_header)) {
+      if (ABSL_PREDICT_TRUE(chunk_reader.healthy())) break;
+      riegeli::SkippedRegion skipped_region;
+      if (ABSL_PREDICT_FALSE(!chunk_reader.Recover(&skipped_region))) {
+        std::cerr << "Could not read " << filename << ": "
+                  << chunk_reader.status() << std::endl;
+        return false;
+      }
+      ++num_skipped;
+      std::cout << filename << ": skipped " << skipped_region << std::endl;
+      continue;
+    }
+    ++num_chunks;
+    const riegeli::ChunkType chunk_type = chunk_header->chunk_type();
+    ChunkTypeStats* chunk_type_stats = nullptr;
+    for (std::pair<riegeli::ChunkType, ChunkTypeStats>& entry : stats) {
+      if (entry.first == chunk_type) {
+        chunk_type_stats = &entry.second;
+        break;
+      }
+    }
+    if (chunk_type_stats == nullptr) {
+      stats.emplace_back(chunk_type, ChunkTypeStats());
+      chunk_type_stats = &stats.back().second;
+    }
+    ++chunk_type_stats->num_chunks;
+    chunk_type_stats->num_records += chunk_header->num_records();
+    chunk_type_stats->data_size += chunk_header->data_size();
+    chunk_type_stats->decoded_data_size += chunk_header->decoded_data_size();
+    if (print_chunks) {
+      std::cout << filename << ": " << std::setw(12) << chunk_begin << " "
+                << std::setw(19) << std::left << ChunkTypeName(chunk_type)
+                << std::right << " " << chunk_header->data_size()
+                << " data bytes, " << chunk_header->num_records()
+                << " records, " << chunk_header->decoded_data_size()
+                << " decoded bytes" << std::endl;
+    }
+    if (ABSL_PREDICT_FALSE(!chunk_reader.SkipChunk())) {
+      riegeli::SkippedRegion skipped_region;
+      if (ABSL_PREDICT_FALSE(!chunk_reader.Recover(&skipped_region))) {
+        std::cerr << "Could not read " << filename << ": "
+                  << chunk_reader.status() << std::endl;
+        return false;
+      }
+      ++num_skipped;
+      std::cout << filename << ": skipped " << skipped_region << std::endl;
+    }
+  }
+  if (ABSL_PREDICT_FALSE(!chunk_reader.Close())) {
+    // The file ends in the middle of a chunk.
+    riegeli::SkippedRegion skipped_region;
+    if (ABSL_PREDICT_FALSE(!chunk_reader.Recover(&skipped_region))) {
+      std::cerr << "Could not read " << filename << ": "
+                << chunk_reader.status() << std::endl;
+      return false;
+    }
+    ++num_skipped;
+    std::cout << filename << ": skipped " << skipped_region << std::endl;
+  }
+  uint64_t total_records = 0;
+  uint64_t total_data_size = 0;
+  uint64_t total_decoded_data_size = 0;
+  for (const std::pair<riegeli::ChunkType, ChunkTypeStats>& entry : stats) {
+    total_records += entry.second.num_records;
+    total_data_size += entry.second.data_size;
+    total_decoded_data_size += entry.second.decoded_data_size;
+  }
+  std::cout << filename << ": " << size << " bytes, " << num_chunks
+            << " chunks, " << total_records << " records, "
+            << total_decoded_data_size << " decoded bytes (ratio "
+            << Ratio(total_data_size, total_decoded_data_size) << ")";
+  if (num_skipped > 0) std::cout << ", " << num_skipped << " skipped regions";
+  std::cout << std::endl;
+  for (const std::pair<riegeli::ChunkType, ChunkTypeStats>& entry : stats) {
+    std::cout << filename << ":   " << ChunkTypeName(entry.first) << ": "
+              << entry.second.num_chunks << " chunks, "
+              << entry.second.num_records << " records, "
+              << entry.second.data_size << " data bytes, "
+              << entry.second.decoded_data_size << " decoded bytes (ratio "
+              << Ratio(entry.second.data_size, entry.second.decoded_data_size)
+              << ")" << std::endl;
+  }
+  return true;
+}
+
+const char kUsage[] =
+    "Usage: riegeli_inspect (OPTION|INPUT_FILE)...\n"
+    "\n"
+    "Prints the chunk layout, record counts, chunk type mix, and compression\n"
+    "ratios of Riegeli/records files, reading only chunk headers and seeking\n"
+    "over record data, hence inspecting a large file does not decode it.\n"
+    "\n"
+    "OPTIONs:\n"
+    "  --chunks\n"
+    "      Print one line per chunk with its position, type, and sizes, in\n"
+    "      addition to the summary\n"
+    "  --index_only\n"
+    "      Read only the record index at the end of the file, written with\n"
+    "      RecordWriterBase::Options::set_write_record_index(). This answers\n"
+    "      record and chunk counts in a few reads regardless of file size,\n"
+    "      but does not report the chunk type mix";
+
+const struct option kOptions[] = {
+    {"help", no_argument, nullptr, 0},
+    {"chunks", no_argument, nullptr, 1},
+    {"index_only", no_argument, nullptr, 2},
+    {nullptr, 0, nullptr, 0}};
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  bool print_chunks = false;
+  bool index_only = false;
+  for (;;) {
+    int option_index;
+    const int option =
+        getopt_long_only(argc, argv, "", kOptions, &option_index);
+    if (option == -1) break;
+    switch (option) {
+      case 0:  // --help
+        std::cout << kUsage << std::endl;
+        return 0;
+      case 1:  // --chunks
+        print_chunks = true;
+        break;
+      case 2:  // --index_only
+        index_only = true;
+        break;
+      case '?':
+        return 1;
+      default:
+        RIEGELI_ASSERT_UNREACHABLE()
+            << "getopt_long_only() returned " << option;
+    }
+  }
+  argc -= optind - 1;
+  argv += optind - 1;
+  if (argc == 1) {
+    std::cerr << kUsage << std::endl;
+    return 1;
+  }
+  bool all_ok = true;
+  for (int i = 1; i < argc; ++i) {
+    if (index_only) {
+      if (!InspectFromRecordIndex(argv[i])) all_ok = false;
+    } else if (!InspectFromChunkHeaders(argv[i], print_chunks)) {
+      all_ok = false;
+    }
+  }
+  return all_ok ? 0 : 1;
+}
@@ -0,0 +1,202 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Make file offsets 64-bit even on 32-bit systems.
+#undef _FILE_OFFSET_BITS
+#define _FILE_OFFSET_BITS 64
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/status.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/bytes/fd_writer.h"
+#include "riegeli/records/record_reader.h"
+#include "riegeli/records/record_writer.h"
+
+namespace {
+
+// Serializes progress and error messages from repacking threads.
+std::mutex output_mutex;
+
+std::string OutputFilename(const std::string& input_filename,
+                           const std::string& output_dir) {
+  const size_t slash = input_filename.find_last_of('/');
+  const std::string basename = slash == std::string::npos
+                                   ? input_filename
+                                   : input_filename.substr(slash + 1);
+  return absl::StrCat(output_dir, "/", basename);
+}
+
+// Rewrites one Riegeli/records file with the given options, preserving the
+// order of its records. Returns false on failure, after reporting it.
+bool RepackFile(const std::string& input_filename,
+                const std::string& output_filename,
+                const riegeli::RecordWriterBase::Options& options) {
+  riegeli::RecordReader<riegeli::FdReader<>> record_reader(
+      riegeli::FdReader<>(input_filename, O_RDONLY));
+  riegeli::RecordWriter<riegeli::FdWriter<>> record_writer(
+      riegeli::FdWriter<>(output_filename, O_WRONLY | O_CREAT | O_TRUNC),
+      options);
+  uint64_t num_records = 0;
+  riegeli::Chain record;
+  while (record_reader.ReadRecord(&record)) {
+    if (ABSL_PREDICT_FALSE(!record_writer.WriteRecord(record))) {
+      std::lock_guard<std::mutex> lock(output_mutex);
+      std::cerr << "Could not write " << output_filename << ": "
+                << record_writer.status() << std::endl;
+      return false;
+    }
+    ++num_records;
+  }
+  if (ABSL_PREDICT_FALSE(!record_reader.Close())) {
+    std::lock_guard<std::mutex> lock(output_mutex);
+    std::cerr << "Could not read " << input_filename << ": "
+              << record_reader.status() << std::endl;
+    return false;
+  }
+  if (ABSL_PREDICT_FALSE(!record_writer.Close())) {
+    std::lock_guard<std::mutex> lock(output_mutex);
+    std::cerr << "Could not write " << output_filename << ": "
+              << record_writer.status() << std::endl;
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(output_mutex);
+  std::cout << input_filename << " -> " << output_filename << ": "
+            << num_records << " records" << std::endl;
+  return true;
+}
+
+const char kUsage[] =
+    "Usage: riegeli_repack (OPTION|INPUT_FILE)...\n"
+    "\n"
+    "Rewrites Riegeli/records files with different options: chunk size,\n"
+    "transposition, compression algorithm and level, record index, block\n"
+    "alignment. Each INPUT_FILE becomes a separate output file with the\n"
+    "order of its records preserved. Memory usage is bounded: records are\n"
+    "streamed from the input to the output, and chunks in flight are\n"
+    "limited by the RecordWriter pipeline.\n"
+    "\n"
+    "OPTIONs:\n"
+    "  --output_dir=DIR\n"
+    "      Directory to write repacked files to; each output file is named\n"
+    "      after the basename of its input file, hence the output directory\n"
+    "      must differ from the directory of the input file. Default '.'\n"
+    "  --riegeli_options=OPTIONS\n"
+    "      Riegeli RecordWriter options for the output, e.g.\n"
+    "      'transpose,zstd:12,chunk_size:4M,write_record_index,\n"
+    "      parallelism:10'; parallelism applies to chunk encoding within\n"
+    "      each file. Default 'brotli:6'\n"
+    "  --shards_in_flight=N\n"
+    "      Number of input files repacked concurrently, default 1";
+
+const struct option kOptions[] = {
+    {"help", no_argument, nullptr, 0},
+    {"output_dir", required_argument, nullptr, 1},
+    {"riegeli_options", required_argument, nullptr, 2},
+    {"shards_in_flight", required_argument, nullptr, 3},
+    {nullptr, 0, nullptr, 0}};
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::string output_dir = ".";
+  std::string riegeli_options = "brotli:6";
+  int shards_in_flight = 1;
+  for (;;) {
+    int option_index;
+    const int option =
+        getopt_long_only(argc, argv, "", kOptions, &option_index);
+    if (option == -1) break;
+    switch (option) {
+      case 0:  // --help
+        std::cout << kUsage << std::endl;
+        return 0;
+      case 1:  // --output_dir
+        output_dir = std::string(optarg);
+        break;
+      case 2:  // --riegeli_options
+        riegeli_options = optarg;
+        break;
+      case 3:  // --shards_in_flight
+        if (ABSL_PREDICT_TRUE(absl::SimpleAtoi(optarg, &shards_in_flight) &&
+                              shards_in_flight > 0)) {
+          break;
+        }
+        std::cerr << argv[0]
+                  << ": option '--shards_in_flight' requires a positive "
+                     "integer argument\n";
+        return 1;
+      case '?':
+        return 1;
+      default:
+        RIEGELI_ASSERT_UNREACHABLE()
+            << "getopt_long_only() returned " << option;
+    }
+  }
+  argc -= optind - 1;
+  argv += optind - 1;
+  if (argc == 1) {
+    std::cerr << kUsage << std::endl;
+    return 1;
+  }
+  riegeli::RecordWriterBase::Options options;
+  {
+    const riegeli::Status status = options.FromString(riegeli_options);
+    if (ABSL_PREDICT_FALSE(!status.ok())) {
+      std::cerr << argv[0] << ": invalid --riegeli_options: " << status
+                << std::endl;
+      return 1;
+    }
+  }
+  std::vector<std::string> input_filenames;
+  for (int i = 1; i < argc; ++i) input_filenames.emplace_back(argv[i]);
+  std::atomic<size_t> next_input{0};
+  std::atomic<bool> all_ok{true};
+  const size_t num_threads =
+      riegeli::UnsignedMin(riegeli::IntCast<size_t>(shards_in_flight),
+                           input_filenames.size());
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads);
+  for (size_t i = 0; i < num_threads; ++i) {
+    threads.emplace_back([&] {
+      for (;;) {
+        const size_t index = next_input.fetch_add(1);
+        if (index >= input_filenames.size()) break;
+        const std::string& input_filename = input_filenames[index];
+        if (!RepackFile(input_filename,
+                        OutputFilename(input_filename, output_dir),
+                        options)) {
+          all_ok.store(false);
+        }
+      }
+    });
+  }
+  for (std::thread& thread : threads) thread.join();
+  return all_ok.load() ? 0 : 1;
+}
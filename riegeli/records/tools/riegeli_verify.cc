@@ -0,0 +1,230 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Make file offsets 64-bit even on 32-bit systems.
+#undef _FILE_OFFSET_BITS
+#define _FILE_OFFSET_BITS 64
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/strings/numbers.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/status.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/chunk_encoding/chunk_decoder.h"
+#include "riegeli/records/chunk_reader.h"
+#include "riegeli/records/skipped_region.h"
+
+namespace {
+
+// Serializes error messages from verification threads.
+std::mutex output_mutex;
+
+// Verifies one shard of the chunks of a Riegeli/records file: block headers,
+// chunk hashes, and a full decode of each chunk of the shard. Invalid regions
+// are appended to *skipped_regions. Returns false on a failure other than
+// invalid file contents, e.g. an I/O error, after reporting it.
+bool VerifyShard(const std::string& filename, size_t shard_index,
+                 size_t num_shards,
+                 std::vector<riegeli::SkippedRegion>* skipped_regions,
+                 uint64_t* num_chunks, uint64_t* num_records) {
+  riegeli::DefaultChunkReader<riegeli::FdReader<>> chunk_reader(
+      riegeli::FdReader<>(filename, O_RDONLY),
+      riegeli::DefaultChunkReaderBase::Options().set_shard(shard_index,
+                                                           num_shards));
+  riegeli::Chunk chunk;
+  riegeli::ChunkDecoder chunk_decoder;
+  for (;;) {
+    const riegeli::Position chunk_begin = chunk_reader.pos();
+    if (!chunk_reader.ReadChunk(&chunk)) {
+      if (ABSL_PREDICT_TRUE(chunk_reader.healthy())) break;
+      riegeli::SkippedRegion skipped_region;
+      if (ABSL_PREDICT_FALSE(!chunk_reader.Recover(&skipped_region))) {
+        std::lock_guard<std::mutex> lock(output_mutex);
+        std::cerr << "Could not read " << filename << ": "
+                  << chunk_reader.status() << std::endl;
+        return false;
+      }
+      skipped_regions->push_back(std::move(skipped_region));
+      continue;
+    }
+    ++*num_chunks;
+    if (ABSL_PREDICT_FALSE(!chunk_decoder.Reset(chunk))) {
+      skipped_regions->emplace_back(
+          chunk_begin, chunk_reader.pos(),
+          std::string(chunk_decoder.status().message()));
+      chunk_decoder.Reset();
+      continue;
+    }
+    *num_records += chunk_decoder.num_records();
+  }
+  if (ABSL_PREDICT_FALSE(!chunk_reader.Close())) {
+    // The file ends in the middle of a chunk.
+    riegeli::SkippedRegion skipped_region;
+    if (ABSL_PREDICT_FALSE(!chunk_reader.Recover(&skipped_region))) {
+      std::lock_guard<std::mutex> lock(output_mutex);
+      std::cerr << "Could not read " << filename << ": "
+                << chunk_reader.status() << std::endl;
+      return false;
+    }
+    skipped_regions->push_back(std::move(skipped_region));
+  }
+  return true;
+}
+
+// Verifies one file using "parallelism" threads, each reading a disjoint
+// shard of its chunks. Returns false if the file is invalid or could not be
+// read, after reporting the reason.
+bool VerifyFile(const std::string& filename, size_t parallelism) {
+  std::vector<std::vector<riegeli::SkippedRegion>> skipped_regions(
+      parallelism);
+  std::vector<uint64_t> num_chunks(parallelism, 0);
+  std::vector<uint64_t> num_records(parallelism, 0);
+  std::vector<char> shard_ok(parallelism, 1);
+  std::vector<std::thread> threads;
+  threads.reserve(parallelism);
+  for (size_t i = 0; i < parallelism; ++i) {
+    threads.emplace_back([&, i] {
+      if (!VerifyShard(filename, i, parallelism, &skipped_regions[i],
+                       &num_chunks[i], &num_records[i])) {
+        shard_ok[i] = 0;
+      }
+    });
+  }
+  for (std::thread& thread : threads) thread.join();
+  for (size_t i = 0; i < parallelism; ++i) {
+    if (ABSL_PREDICT_FALSE(!shard_ok[i])) return false;
+  }
+  // Merge the skipped regions of the shards. Chunks without records are
+  // visible to every shard, hence the same invalid region can be reported by
+  // several shards; overlapping regions are merged.
+  std::vector<riegeli::SkippedRegion> merged;
+  for (std::vector<riegeli::SkippedRegion>& regions : skipped_regions) {
+    for (riegeli::SkippedRegion& skipped_region : regions) {
+      merged.push_back(std::move(skipped_region));
+    }
+  }
+  std::sort(merged.begin(), merged.end(),
+            [](const riegeli::SkippedRegion& a,
+               const riegeli::SkippedRegion& b) {
+              if (a.begin() != b.begin()) return a.begin() < b.begin();
+              return a.end() < b.end();
+            });
+  uint64_t total_chunks = 0;
+  uint64_t total_records = 0;
+  for (size_t i = 0; i < parallelism; ++i) {
+    total_chunks += num_chunks[i];
+    total_records += num_records[i];
+  }
+  std::lock_guard<std::mutex> lock(output_mutex);
+  size_t num_skipped = 0;
+  riegeli::Position merged_end = 0;
+  for (const riegeli::SkippedRegion& skipped_region : merged) {
+    if (num_skipped > 0 && skipped_region.begin() < merged_end) {
+      merged_end = riegeli::UnsignedMax(merged_end, skipped_region.end());
+      continue;
+    }
+    merged_end = skipped_region.end();
+    ++num_skipped;
+    std::cout << filename << ": skipped " << skipped_region << std::endl;
+  }
+  if (num_skipped > 0) {
+    std::cout << filename << ": CORRUPT: " << num_skipped
+              << " skipped regions; " << total_chunks << " chunks and "
+              << total_records << " records verified" << std::endl;
+    return false;
+  }
+  std::cout << filename << ": OK: " << total_chunks << " chunks, "
+            << total_records << " records" << std::endl;
+  return true;
+}
+
+const char kUsage[] =
+    "Usage: riegeli_verify (OPTION|INPUT_FILE)...\n"
+    "\n"
+    "Verifies the integrity of Riegeli/records files: block headers, chunk\n"
+    "hashes, and a full decode of every chunk. Invalid regions are reported\n"
+    "as skipped regions, in the format of recovery during reading. Exits\n"
+    "with status 0 if all files are valid.\n"
+    "\n"
+    "OPTIONs:\n"
+    "  --parallelism=N\n"
+    "      Number of threads verifying each file, each reading a disjoint\n"
+    "      shard of its chunks. Default: the number of CPUs";
+
+const struct option kOptions[] = {
+    {"help", no_argument, nullptr, 0},
+    {"parallelism", required_argument, nullptr, 1},
+    {nullptr, 0, nullptr, 0}};
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  int parallelism = 0;
+  for (;;) {
+    int option_index;
+    const int option =
+        getopt_long_only(argc, argv, "", kOptions, &option_index);
+    if (option == -1) break;
+    switch (option) {
+      case 0:  // --help
+        std::cout << kUsage << std::endl;
+        return 0;
+      case 1:  // --parallelism
+        if (ABSL_PREDICT_TRUE(absl::SimpleAtoi(optarg, &parallelism) &&
+                              parallelism > 0)) {
+          break;
+        }
+        std::cerr << argv[0]
+                  << ": option '--parallelism' requires a positive integer "
+                     "argument\n";
+        return 1;
+      case '?':
+        return 1;
+      default:
+        RIEGELI_ASSERT_UNREACHABLE()
+            << "getopt_long_only() returned " << option;
+    }
+  }
+  argc -= optind - 1;
+  argv += optind - 1;
+  if (argc == 1) {
+    std::cerr << kUsage << std::endl;
+    return 1;
+  }
+  if (parallelism == 0) {
+    parallelism = riegeli::UnsignedMax(std::thread::hardware_concurrency(),
+                                       1u);
+  }
+  bool all_ok = true;
+  for (int i = 1; i < argc; ++i) {
+    if (!VerifyFile(argv[i], riegeli::IntCast<size_t>(parallelism))) {
+      all_ok = false;
+    }
+  }
+  return all_ok ? 0 : 1;
+}
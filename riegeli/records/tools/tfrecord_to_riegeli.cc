@@ -0,0 +1,241 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Make file offsets 64-bit even on 32-bit systems.
+#undef _FILE_OFFSET_BITS
+#define _FILE_OFFSET_BITS 64
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/status.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/bytes/fd_writer.h"
+#include "riegeli/records/record_writer.h"
+#include "riegeli/tensorflow/io/tfrecord_recognizer.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/io/record_reader.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/file_system.h"
+
+namespace {
+
+// Serializes progress and error messages from conversion threads.
+std::mutex output_mutex;
+
+std::string OutputFilename(const std::string& input_filename,
+                           const std::string& output_dir) {
+  const size_t slash = input_filename.find_last_of('/');
+  const std::string basename = slash == std::string::npos
+                                   ? input_filename
+                                   : input_filename.substr(slash + 1);
+  return absl::StrCat(output_dir, "/", basename, ".riegeli");
+}
+
+// Converts one TFRecord file to a Riegeli/records file, preserving the order
+// of its records. Returns false on failure, after reporting it.
+bool ConvertFile(const std::string& input_filename,
+                 const std::string& output_filename,
+                 const riegeli::RecordWriterBase::Options& options) {
+  tensorflow::io::RecordReaderOptions record_reader_options;
+  {
+    riegeli::FdReader<> byte_reader(input_filename, O_RDONLY);
+    if (ABSL_PREDICT_FALSE(!byte_reader.healthy())) {
+      std::lock_guard<std::mutex> lock(output_mutex);
+      std::cerr << "Could not open " << input_filename << ": "
+                << byte_reader.status() << std::endl;
+      return false;
+    }
+    riegeli::TFRecordRecognizer tfrecord_recognizer(&byte_reader);
+    if (ABSL_PREDICT_FALSE(
+            !tfrecord_recognizer.CheckFileFormat(&record_reader_options))) {
+      std::lock_guard<std::mutex> lock(output_mutex);
+      if (!tfrecord_recognizer.healthy()) {
+        std::cerr << "Not a TFRecord file: " << input_filename << ": "
+                  << tfrecord_recognizer.status() << std::endl;
+      } else {
+        std::cerr << "Empty input file: " << input_filename << std::endl;
+      }
+      return false;
+    }
+  }
+  tensorflow::Env* const env = tensorflow::Env::Default();
+  std::unique_ptr<tensorflow::RandomAccessFile> file_reader;
+  {
+    const tensorflow::Status status =
+        env->NewRandomAccessFile(input_filename, &file_reader);
+    if (ABSL_PREDICT_FALSE(!status.ok())) {
+      std::lock_guard<std::mutex> lock(output_mutex);
+      std::cerr << "Could not open " << input_filename << ": " << status
+                << std::endl;
+      return false;
+    }
+  }
+  tensorflow::io::SequentialRecordReader record_reader(file_reader.get(),
+                                                       record_reader_options);
+  riegeli::RecordWriter<riegeli::FdWriter<>> record_writer(
+      riegeli::FdWriter<>(output_filename, O_WRONLY | O_CREAT | O_TRUNC),
+      options);
+  uint64_t num_records = 0;
+  std::string record;
+  for (;;) {
+    {
+      const tensorflow::Status status = record_reader.ReadRecord(&record);
+      if (ABSL_PREDICT_FALSE(!status.ok())) {
+        if (ABSL_PREDICT_TRUE(tensorflow::errors::IsOutOfRange(status))) break;
+        std::lock_guard<std::mutex> lock(output_mutex);
+        std::cerr << "Could not read " << input_filename << ": " << status
+                  << std::endl;
+        return false;
+      }
+    }
+    if (ABSL_PREDICT_FALSE(!record_writer.WriteRecord(record))) {
+      std::lock_guard<std::mutex> lock(output_mutex);
+      std::cerr << "Could not write " << output_filename << ": "
+                << record_writer.status() << std::endl;
+      return false;
+    }
+    ++num_records;
+  }
+  if (ABSL_PREDICT_FALSE(!record_writer.Close())) {
+    std::lock_guard<std::mutex> lock(output_mutex);
+    std::cerr << "Could not close " << output_filename << ": "
+              << record_writer.status() << std::endl;
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(output_mutex);
+  std::cout << input_filename << " -> " << output_filename << ": "
+            << num_records << " records" << std::endl;
+  return true;
+}
+
+const char kUsage[] =
+    "Usage: tfrecord_to_riegeli (OPTION|INPUT_FILE)...\n"
+    "\n"
+    "Converts TFRecord files to Riegeli/records files. Each INPUT_FILE\n"
+    "becomes a separate output file with the order of its records preserved.\n"
+    "TFRecord compression is detected automatically.\n"
+    "\n"
+    "OPTIONs:\n"
+    "  --output_dir=DIR\n"
+    "      Directory to write converted files to; each output file is named\n"
+    "      after its input file with '.riegeli' appended. Default '.'\n"
+    "  --riegeli_options=OPTIONS\n"
+    "      Riegeli RecordWriter options, e.g.\n"
+    "      'brotli:6,chunk_size:1M,parallelism:10'; parallelism applies to\n"
+    "      chunk encoding within each file. Default 'brotli:6'\n"
+    "  --shards_in_flight=N\n"
+    "      Number of input files converted concurrently, default 1";
+
+const struct option kOptions[] = {
+    {"help", no_argument, nullptr, 0},
+    {"output_dir", required_argument, nullptr, 1},
+    {"riegeli_options", required_argument, nullptr, 2},
+    {"shards_in_flight", required_argument, nullptr, 3},
+    {nullptr, 0, nullptr, 0}};
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::string output_dir = ".";
+  std::string riegeli_options = "brotli:6";
+  int shards_in_flight = 1;
+  for (;;) {
+    int option_index;
+    const int option =
+        getopt_long_only(argc, argv, "", kOptions, &option_index);
+    if (option == -1) break;
+    switch (option) {
+      case 0:  // --help
+        std::cout << kUsage << std::endl;
+        return 0;
+      case 1:  // --output_dir
+        output_dir = std::string(optarg);
+        break;
+      case 2:  // --riegeli_options
+        riegeli_options = optarg;
+        break;
+      case 3:  // --shards_in_flight
+        if (ABSL_PREDICT_TRUE(absl::SimpleAtoi(optarg, &shards_in_flight) &&
+                              shards_in_flight > 0)) {
+          break;
+        }
+        std::cerr << argv[0]
+                  << ": option '--shards_in_flight' requires a positive "
+                     "integer argument\n";
+        return 1;
+      case '?':
+        return 1;
+      default:
+        RIEGELI_ASSERT_UNREACHABLE()
+            << "getopt_long_only() returned " << option;
+    }
+  }
+  argc -= optind - 1;
+  argv += optind - 1;
+  if (argc == 1) {
+    std::cerr << kUsage << std::endl;
+    return 1;
+  }
+  riegeli::RecordWriterBase::Options options;
+  {
+    const riegeli::Status status = options.FromString(riegeli_options);
+    if (ABSL_PREDICT_FALSE(!status.ok())) {
+      std::cerr << argv[0] << ": invalid --riegeli_options: " << status
+                << std::endl;
+      return 1;
+    }
+  }
+  std::vector<std::string> input_filenames;
+  for (int i = 1; i < argc; ++i) input_filenames.emplace_back(argv[i]);
+  std::atomic<size_t> next_input{0};
+  std::atomic<bool> all_ok{true};
+  const size_t num_threads =
+      riegeli::UnsignedMin(riegeli::IntCast<size_t>(shards_in_flight),
+                           input_filenames.size());
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads);
+  for (size_t i = 0; i < num_threads; ++i) {
+    threads.emplace_back([&] {
+      for (;;) {
+        const size_t index = next_input.fetch_add(1);
+        if (index >= input_filenames.size()) break;
+        const std::string& input_filename = input_filenames[index];
+        if (!ConvertFile(input_filename,
+                         OutputFilename(input_filename, output_dir),
+                         options)) {
+          all_ok.store(false);
+        }
+      }
+    });
+  }
+  for (std::thread& thread : threads) thread.join();
+  return all_ok.load() ? 0 : 1;
+}
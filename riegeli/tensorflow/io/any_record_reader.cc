@@ -0,0 +1,168 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/tensorflow/io/any_record_reader.h"
+
+#include <stddef.h>
+
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include "absl/base/optimization.h"
+#include "absl/memory/memory.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/canonical_errors.h"
+#include "riegeli/bytes/reader.h"
+#include "riegeli/records/record_reader.h"
+#include "riegeli/tensorflow/io/tfrecord_recognizer.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/core/stringpiece.h"
+#include "tensorflow/core/lib/io/record_reader.h"
+#include "tensorflow/core/platform/file_system.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace riegeli {
+
+namespace {
+
+// Presents a riegeli::Reader as a tensorflow::RandomAccessFile, so that a
+// tensorflow::io::SequentialRecordReader reads through the already open byte
+// Reader instead of reopening the file. Offsets are relative to the position
+// of the byte Reader at format detection time.
+class ReaderRandomAccessFile : public tensorflow::RandomAccessFile {
+ public:
+  explicit ReaderRandomAccessFile(Reader* src, Position base_pos)
+      : src_(src), base_pos_(base_pos) {}
+
+  tensorflow::Status Read(tensorflow::uint64 offset, size_t n,
+                          tensorflow::StringPiece* result,
+                          char* scratch) const override;
+
+ private:
+  Reader* src_;
+  Position base_pos_;
+};
+
+tensorflow::Status ReaderRandomAccessFile::Read(
+    tensorflow::uint64 offset, size_t n, tensorflow::StringPiece* result,
+    char* scratch) const {
+  size_t length_read = 0;
+  if (ABSL_PREDICT_TRUE(src_->Seek(base_pos_ + offset))) {
+    while (length_read < n && src_->Pull()) {
+      const size_t length =
+          UnsignedMin(src_->available(), n - length_read);
+      std::memcpy(scratch + length_read, src_->cursor(), length);
+      src_->set_cursor(src_->cursor() + length);
+      length_read += length;
+    }
+  }
+  *result = tensorflow::StringPiece(scratch, length_read);
+  if (ABSL_PREDICT_FALSE(!src_->healthy())) {
+    return tensorflow::errors::DataLoss(
+        std::string(src_->status().message()));
+  }
+  if (ABSL_PREDICT_FALSE(length_read < n)) {
+    return tensorflow::errors::OutOfRange("Read fewer bytes than requested");
+  }
+  return tensorflow::Status::OK();
+}
+
+}  // namespace
+
+void AnyRecordReaderBase::Initialize(Reader* src) {
+  RIEGELI_ASSERT_NOTNULL(src);
+  if (ABSL_PREDICT_FALSE(!src->Pull())) {
+    // Empty source: leave format() as Format::kUnknown; ReadRecord() will
+    // return false. This mimics the behavior of reading functions at end of
+    // file.
+    if (ABSL_PREDICT_FALSE(!src->healthy())) Fail(*src);
+    return;
+  }
+  const Position initial_pos = src->pos();
+  {
+    TFRecordRecognizer tfrecord_recognizer(src);
+    tensorflow::io::RecordReaderOptions record_reader_options;
+    if (tfrecord_recognizer.CheckFileFormat(&record_reader_options)) {
+      format_ = Format::kTFRecord;
+      tfrecord_file_ =
+          absl::make_unique<ReaderRandomAccessFile>(src, initial_pos);
+      tfrecord_reader_ =
+          absl::make_unique<tensorflow::io::SequentialRecordReader>(
+              tfrecord_file_.get(), record_reader_options);
+      return;
+    }
+    // Not a TFRecord file, which is not a failure yet: the recognizer probed
+    // within the first buffered block, so seeking back is cheap. A failure of
+    // the byte Reader itself is fatal though.
+    if (ABSL_PREDICT_FALSE(!src->healthy())) {
+      Fail(*src);
+      return;
+    }
+  }
+  if (ABSL_PREDICT_FALSE(!src->Seek(initial_pos))) {
+    Fail(*src, InternalError("Seeking failed"));
+    return;
+  }
+  riegeli_reader_ = absl::make_unique<RecordReader<Reader*>>(src);
+  if (riegeli_reader_->CheckFileFormat()) {
+    format_ = Format::kRiegeli;
+    return;
+  }
+  if (ABSL_PREDICT_FALSE(!riegeli_reader_->healthy())) {
+    Fail(*riegeli_reader_);
+    return;
+  }
+  Fail(DataLossError("Unknown file format"));
+}
+
+void AnyRecordReaderBase::Done() {
+  if (riegeli_reader_ != nullptr) {
+    if (ABSL_PREDICT_FALSE(!riegeli_reader_->Close())) Fail(*riegeli_reader_);
+  }
+}
+
+bool AnyRecordReaderBase::ReadRecord(std::string* record) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  switch (format_) {
+    case Format::kUnknown:
+      return false;
+    case Format::kRiegeli:
+      if (ABSL_PREDICT_FALSE(!riegeli_reader_->ReadRecord(record))) {
+        if (ABSL_PREDICT_FALSE(!riegeli_reader_->healthy())) {
+          return Fail(*riegeli_reader_);
+        }
+        return false;
+      }
+      return true;
+    case Format::kTFRecord: {
+      const tensorflow::Status status = tfrecord_reader_->ReadRecord(record);
+      if (ABSL_PREDICT_FALSE(!status.ok())) {
+        if (ABSL_PREDICT_FALSE(!tensorflow::errors::IsOutOfRange(status))) {
+          return Fail(DataLossError(status.ToString()));
+        }
+        return false;
+      }
+      return true;
+    }
+  }
+  RIEGELI_ASSERT_UNREACHABLE()
+      << "Unknown format: " << static_cast<int>(format_);
+}
+
+template class AnyRecordReader<Reader*>;
+template class AnyRecordReader<std::unique_ptr<Reader>>;
+
+}  // namespace riegeli
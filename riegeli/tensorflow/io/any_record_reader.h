@@ -0,0 +1,176 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_TENSORFLOW_IO_ANY_RECORD_READER_H_
+#define RIEGELI_TENSORFLOW_IO_ANY_RECORD_READER_H_
+
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "absl/base/optimization.h"
+#include "absl/utility/utility.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/dependency.h"
+#include "riegeli/base/object.h"
+#include "riegeli/bytes/reader.h"
+#include "riegeli/records/record_reader.h"
+#include "tensorflow/core/lib/io/record_reader.h"
+#include "tensorflow/core/platform/file_system.h"
+
+namespace riegeli {
+
+// Template parameter invariant part of AnyRecordReader.
+class AnyRecordReaderBase : public Object {
+ public:
+  // Format of the file being read.
+  enum class Format {
+    kUnknown,   // Empty file, or format detection failed.
+    kRiegeli,   // Riegeli/records file.
+    kTFRecord,  // TFRecord file, possibly compressed.
+  };
+
+  // Returns the byte Reader the file is being read from. Unchanged by
+  // Close().
+  virtual Reader* src_reader() = 0;
+  virtual const Reader* src_reader() const = 0;
+
+  // Returns the format detected during construction, or Format::kUnknown for
+  // an empty file.
+  Format format() const { return format_; }
+
+  // Reads the next record, in either format.
+  //
+  // Return values:
+  //  * true                    - success (*record is set)
+  //  * false (when healthy())  - source ends
+  //  * false (when !healthy()) - failure
+  bool ReadRecord(std::string* record);
+
+ protected:
+  explicit AnyRecordReaderBase(State state) noexcept : Object(state) {}
+
+  AnyRecordReaderBase(AnyRecordReaderBase&& that) noexcept;
+  AnyRecordReaderBase& operator=(AnyRecordReaderBase&& that) noexcept;
+
+  void Initialize(Reader* src);
+  void Done() override;
+
+ private:
+  Format format_ = Format::kUnknown;
+  // if format_ == Format::kRiegeli: reads from the byte Reader directly.
+  std::unique_ptr<RecordReader<Reader*>> riegeli_reader_;
+  // if format_ == Format::kTFRecord: tfrecord_file_ presents the byte Reader
+  // as a tensorflow::RandomAccessFile, so that tfrecord_reader_ reads through
+  // the already open byte Reader instead of reopening the file.
+  std::unique_ptr<tensorflow::RandomAccessFile> tfrecord_file_;
+  std::unique_ptr<tensorflow::io::SequentialRecordReader> tfrecord_reader_;
+};
+
+// AnyRecordReader reads records from a file which may be in TFRecord format
+// (possibly compressed) or Riegeli/records format. The format is identified
+// from the first buffered block of the byte Reader, and reading is dispatched
+// to the matching implementation over the same byte Reader, so detection does
+// not reopen or reread the file.
+//
+// The byte Reader should support random access, e.g. FdReader; reading a
+// TFRecord file seeks within it.
+//
+// The Src template parameter specifies the type of the object providing and
+// possibly owning the byte Reader. Src must support Dependency<Reader*, Src>,
+// e.g. Reader* (not owned, default), unique_ptr<Reader> (owned).
+//
+// AnyRecordReader exposes the lowest common denominator of the two formats:
+// sequential reading of whole records as strings. If the format is known to
+// be Riegeli/records, use RecordReader instead.
+template <typename Src = Reader*>
+class AnyRecordReader : public AnyRecordReaderBase {
+ public:
+  // Creates a closed AnyRecordReader.
+  AnyRecordReader() noexcept : AnyRecordReaderBase(State::kClosed) {}
+
+  // Will read from the byte Reader provided by src, starting at its current
+  // position.
+  explicit AnyRecordReader(Src src);
+
+  AnyRecordReader(AnyRecordReader&& that) noexcept;
+  AnyRecordReader& operator=(AnyRecordReader&& that) noexcept;
+
+  // Returns the object providing and possibly owning the byte Reader.
+  // Unchanged by Close().
+  Src& src() { return src_.manager(); }
+  const Src& src() const { return src_.manager(); }
+  Reader* src_reader() override { return src_.get(); }
+  const Reader* src_reader() const override { return src_.get(); }
+
+ protected:
+  void Done() override;
+
+ private:
+  // The object providing and possibly owning the byte Reader.
+  Dependency<Reader*, Src> src_;
+};
+
+// Implementation details follow.
+
+inline AnyRecordReaderBase::AnyRecordReaderBase(
+    AnyRecordReaderBase&& that) noexcept
+    : Object(std::move(that)),
+      format_(absl::exchange(that.format_, Format::kUnknown)),
+      riegeli_reader_(std::move(that.riegeli_reader_)),
+      tfrecord_file_(std::move(that.tfrecord_file_)),
+      tfrecord_reader_(std::move(that.tfrecord_reader_)) {}
+
+inline AnyRecordReaderBase& AnyRecordReaderBase::operator=(
+    AnyRecordReaderBase&& that) noexcept {
+  Object::operator=(std::move(that));
+  format_ = absl::exchange(that.format_, Format::kUnknown);
+  riegeli_reader_ = std::move(that.riegeli_reader_);
+  tfrecord_file_ = std::move(that.tfrecord_file_);
+  tfrecord_reader_ = std::move(that.tfrecord_reader_);
+  return *this;
+}
+
+template <typename Src>
+inline AnyRecordReader<Src>::AnyRecordReader(Src src)
+    : AnyRecordReaderBase(State::kOpen), src_(std::move(src)) {
+  Initialize(src_.get());
+}
+
+template <typename Src>
+inline AnyRecordReader<Src>::AnyRecordReader(AnyRecordReader&& that) noexcept
+    : AnyRecordReaderBase(std::move(that)), src_(std::move(that.src_)) {}
+
+template <typename Src>
+inline AnyRecordReader<Src>& AnyRecordReader<Src>::operator=(
+    AnyRecordReader&& that) noexcept {
+  AnyRecordReaderBase::operator=(std::move(that));
+  src_ = std::move(that.src_);
+  return *this;
+}
+
+template <typename Src>
+void AnyRecordReader<Src>::Done() {
+  AnyRecordReaderBase::Done();
+  if (src_.is_owning()) {
+    if (ABSL_PREDICT_FALSE(!src_->Close())) Fail(*src_);
+  }
+}
+
+extern template class AnyRecordReader<Reader*>;
+extern template class AnyRecordReader<std::unique_ptr<Reader>>;
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_TENSORFLOW_IO_ANY_RECORD_READER_H_
@@ -17,14 +17,20 @@
 #include <stddef.h>
 
 #include <cstring>
+#include <future>
 #include <limits>
 #include <memory>
 #include <string>
+#include <utility>
 
 #include "absl/base/optimization.h"
+#include "absl/memory/memory.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
 #include "riegeli/base/base.h"
+#include "riegeli/base/buffer.h"
+#include "riegeli/base/parallelism.h"
+#include "riegeli/base/recycling_pool.h"
 #include "riegeli/base/status.h"
 #include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/core/status.h"
@@ -35,6 +41,13 @@
 namespace riegeli {
 namespace tensorflow {
 
+void FileReaderBase::Done() {
+  AbandonReadAhead();
+  // Return the buffer to the pool so that other FileReaders can reuse it.
+  buffer_.reset();
+  Reader::Done();
+}
+
 bool FileReaderBase::InitializeFilename(::tensorflow::Env* env,
                                         ::tensorflow::RandomAccessFile* src) {
   absl::string_view filename;
@@ -95,25 +108,56 @@ bool FileReaderBase::FailOperation(const ::tensorflow::Status& status,
 inline size_t FileReaderBase::LengthToReadDirectly() const {
   // Read directly if reading through buffer_ would need more than one read,
   // or if buffer_ would be full.
-  return SaturatingAdd(available(), buffer_.size());
+  return SaturatingAdd(available(), buffer_size_);
 }
 
-bool FileReaderBase::PullSlow() {
-  RIEGELI_ASSERT_EQ(available(), 0u)
-      << "Failed precondition of Reader::PullSlow(): "
-         "data available, use Pull() instead";
-  if (ABSL_PREDICT_FALSE(!healthy())) return false;
-  ::tensorflow::RandomAccessFile* const src = src_file();
-  char* const ptr = buffer_.GetData();
-  if (ABSL_PREDICT_FALSE(buffer_.size() >
+inline FileReaderBase::BufferPool::Handle FileReaderBase::NewBuffer() {
+  const size_t buffer_size = buffer_size_;
+  return BufferPool::global().Get(buffer_size, [buffer_size] {
+    return absl::make_unique<Buffer>(buffer_size);
+  });
+}
+
+inline void FileReaderBase::ScheduleReadAhead() {
+  RIEGELI_ASSERT(read_ahead_request_ == nullptr)
+      << "Failed precondition of FileReaderBase::ScheduleReadAhead(): "
+         "a background read is already scheduled";
+  if (ABSL_PREDICT_FALSE(buffer_size_ >
                          std::numeric_limits<::tensorflow::uint64>::max() -
                              limit_pos_)) {
-    return FailOverflow();
+    return;
   }
-  absl::string_view result;
-  const ::tensorflow::Status read_status = src->Read(
-      IntCast<::tensorflow::uint64>(limit_pos_), buffer_.size(), &result, ptr);
-  RIEGELI_ASSERT_LE(result.size(), buffer_.size())
+  read_ahead_request_ = absl::make_unique<ReadAheadRequest>();
+  read_ahead_request_->buffer = NewBuffer();
+  read_ahead_request_->pos = limit_pos_;
+  std::promise<void>* const done = new std::promise<void>();
+  read_ahead_done_ = done->get_future();
+  ::tensorflow::RandomAccessFile* const src = src_file();
+  ReadAheadRequest* const request = read_ahead_request_.get();
+  const size_t length = buffer_size_;
+  // RandomAccessFile::Read() is thread safe, hence the background read can
+  // proceed concurrently with reads issued by ReadSlow() and with operations
+  // not using the file.
+  internal::ThreadPool::global_io().Schedule([src, request, length, done] {
+    request->status =
+        src->Read(IntCast<::tensorflow::uint64>(request->pos), length,
+                  &request->result, request->buffer->GetData());
+    done->set_value();
+    delete done;
+  });
+}
+
+void FileReaderBase::AbandonReadAhead() {
+  if (read_ahead_request_ == nullptr) return;
+  // Wait until the background read completes, so that it no longer uses the
+  // RandomAccessFile nor the request. The buffer returns to the pool.
+  read_ahead_done_.get();
+  read_ahead_request_.reset();
+}
+
+inline bool FileReaderBase::BufferFilled(
+    absl::string_view result, const ::tensorflow::Status& read_status) {
+  RIEGELI_ASSERT_LE(result.size(), buffer_size_)
       << "RandomAccessFile::Read() read more than requested";
   start_ = result.data();
   cursor_ = start_;
@@ -125,9 +169,42 @@ bool FileReaderBase::PullSlow() {
     }
     return !result.empty();
   }
+  if (read_ahead_ && result.size() == buffer_size_) ScheduleReadAhead();
   return true;
 }
 
+bool FileReaderBase::PullSlow() {
+  RIEGELI_ASSERT_EQ(available(), 0u)
+      << "Failed precondition of Reader::PullSlow(): "
+         "data available, use Pull() instead";
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  if (read_ahead_request_ != nullptr) {
+    if (ABSL_PREDICT_TRUE(read_ahead_request_->pos == limit_pos_)) {
+      // The background read starts where reading continues: use its result.
+      read_ahead_done_.get();
+      const std::unique_ptr<ReadAheadRequest> request =
+          std::move(read_ahead_request_);
+      buffer_ = std::move(request->buffer);
+      return BufferFilled(request->result, request->status);
+    }
+    // The position has changed since the background read was scheduled, e.g.
+    // by Seek(): its result is not usable.
+    AbandonReadAhead();
+  }
+  ::tensorflow::RandomAccessFile* const src = src_file();
+  if (ABSL_PREDICT_FALSE(buffer_size_ >
+                         std::numeric_limits<::tensorflow::uint64>::max() -
+                             limit_pos_)) {
+    return FailOverflow();
+  }
+  if (buffer_ == nullptr) buffer_ = NewBuffer();
+  absl::string_view result;
+  const ::tensorflow::Status read_status =
+      src->Read(IntCast<::tensorflow::uint64>(limit_pos_), buffer_size_,
+                &result, buffer_->GetData());
+  return BufferFilled(result, read_status);
+}
+
 bool FileReaderBase::ReadSlow(char* dest, size_t length) {
   RIEGELI_ASSERT_GT(length, available())
       << "Failed precondition of Reader::ReadSlow(char*): "
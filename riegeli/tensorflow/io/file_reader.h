@@ -17,6 +17,7 @@
 
 #include <stddef.h>
 
+#include <future>
 #include <memory>
 #include <string>
 #include <utility>
@@ -29,6 +30,7 @@
 #include "riegeli/base/buffer.h"
 #include "riegeli/base/dependency.h"
 #include "riegeli/base/object.h"
+#include "riegeli/base/recycling_pool.h"
 #include "riegeli/bytes/reader.h"
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/platform/env.h"
@@ -83,6 +85,23 @@ class FileReaderBase : public Reader {
       return std::move(set_buffer_size(buffer_size));
     }
 
+    // If true, a read of the next buffer is started in the background as soon
+    // as the current buffer is refilled, so that file reading latency is
+    // hidden behind processing of the data already read.
+    //
+    // This helps when reading sequentially from a file system with a high
+    // latency (e.g. GCS), at the cost of reading up to buffer_size beyond the
+    // data actually needed.
+    //
+    // Default: false
+    Options& set_read_ahead(bool read_ahead) & {
+      read_ahead_ = read_ahead;
+      return *this;
+    }
+    Options&& set_read_ahead(bool read_ahead) && {
+      return std::move(set_read_ahead(read_ahead));
+    }
+
    private:
     template <typename Src>
     friend class FileReader;
@@ -90,6 +109,7 @@ class FileReaderBase : public Reader {
     ::tensorflow::Env* env_ = nullptr;
     Position initial_pos_ = 0;
     size_t buffer_size_ = kDefaultBufferSize;
+    bool read_ahead_ = false;
   };
 
   // Returns the RandomAccessFile being read from. If the RandomAccessFile is
@@ -106,11 +126,14 @@ class FileReaderBase : public Reader {
  protected:
   FileReaderBase() noexcept : Reader(State::kClosed) {}
 
-  explicit FileReaderBase(size_t buffer_size);
+  explicit FileReaderBase(size_t buffer_size, bool read_ahead);
 
   FileReaderBase(FileReaderBase&& that) noexcept;
   FileReaderBase& operator=(FileReaderBase&& that) noexcept;
 
+  ~FileReaderBase();
+
+  void Done() override;
   bool InitializeFilename(::tensorflow::Env* env,
                           ::tensorflow::RandomAccessFile* src);
   bool InitializeFilename(::tensorflow::Env* env, absl::string_view filename);
@@ -123,15 +146,60 @@ class FileReaderBase : public Reader {
   bool ReadSlow(char* dest, size_t length) override;
   bool SeekSlow(Position new_pos) override;
 
+  // If a background read is scheduled, waits until it completes and discards
+  // its result, so that it no longer uses the RandomAccessFile. Must be called
+  // before the RandomAccessFile can be destroyed.
+  void AbandonReadAhead();
+
  private:
+  // A pool of reusable file reading buffers of the same size, shared between
+  // FileReaders (in particular across dataset iterators).
+  using BufferPool = RecyclingPool<Buffer, std::default_delete<Buffer>, size_t>;
+
+  // State of a background read of the data following the current buffer.
+  // Heap-allocated so that its address is stable while the background read
+  // fills it.
+  struct ReadAheadRequest {
+    // The buffer being filled by the background read.
+    BufferPool::Handle buffer;
+    // Position where the background read starts.
+    Position pos = 0;
+    // Filled by the background read.
+    absl::string_view result;
+    ::tensorflow::Status status;
+  };
+
   // Minimum length for which it is better to append current contents of buffer_
   // and read the remaining data directly than to read the data through buffer_.
   size_t LengthToReadDirectly() const;
 
+  // Returns a buffer of at least buffer_size_, reusing a pooled buffer if
+  // possible.
+  BufferPool::Handle NewBuffer();
+
+  // Starts a background read of buffer_size_ bytes at limit_pos_.
+  //
+  // Precondition: read_ahead_request_ == nullptr
+  void ScheduleReadAhead();
+
+  // Updates the buffer pointers after buffer_ has been filled with result,
+  // schedules the next background read if applicable, and converts read_status
+  // to the result of PullSlow().
+  bool BufferFilled(absl::string_view result,
+                    const ::tensorflow::Status& read_status);
+
   std::string filename_;
   // Invariant: if healthy() && !filename_.empty() then file_system_ != nullptr
   ::tensorflow::FileSystem* file_system_ = nullptr;
-  Buffer buffer_;
+  size_t buffer_size_ = 0;
+  bool read_ahead_ = false;
+  // The current buffer; nullptr if not obtained from the pool yet.
+  BufferPool::Handle buffer_;
+  // Non-nullptr if a background read has been scheduled and not consumed.
+  std::unique_ptr<ReadAheadRequest> read_ahead_request_;
+  // Becomes ready when the scheduled background read completes.
+  // Invariant: read_ahead_done_.valid() == (read_ahead_request_ != nullptr)
+  std::future<void> read_ahead_done_;
 };
 
 // A Reader which reads from a RandomAccessFile. It supports random access
@@ -160,6 +228,8 @@ class FileReader : public FileReaderBase {
   FileReader(FileReader&& that) noexcept;
   FileReader& operator=(FileReader&& that) noexcept;
 
+  ~FileReader();
+
   // Returns the object providing and possibly owning the RandomAccessFile being
   // read from. If the RandomAccessFile is owned then changed to nullptr by
   // Close(), otherwise unchanged.
@@ -180,27 +250,43 @@ class FileReader : public FileReaderBase {
 
 // Implementation details follow.
 
-inline FileReaderBase::FileReaderBase(size_t buffer_size)
-    : Reader(State::kOpen), buffer_(buffer_size) {}
+inline FileReaderBase::FileReaderBase(size_t buffer_size, bool read_ahead)
+    : Reader(State::kOpen),
+      buffer_size_(buffer_size),
+      read_ahead_(read_ahead) {}
 
 inline FileReaderBase::FileReaderBase(FileReaderBase&& that) noexcept
     : Reader(std::move(that)),
       filename_(absl::exchange(that.filename_, std::string())),
       file_system_(absl::exchange(that.file_system_, nullptr)),
-      buffer_(std::move(that.buffer_)) {}
+      buffer_size_(absl::exchange(that.buffer_size_, 0u)),
+      read_ahead_(absl::exchange(that.read_ahead_, false)),
+      buffer_(std::move(that.buffer_)),
+      read_ahead_request_(std::move(that.read_ahead_request_)),
+      read_ahead_done_(std::move(that.read_ahead_done_)) {}
 
 inline FileReaderBase& FileReaderBase::operator=(
     FileReaderBase&& that) noexcept {
+  // The background read of this FileReaderBase, if any, writes to state which
+  // is about to be replaced.
+  AbandonReadAhead();
   Reader::operator=(std::move(that));
   filename_ = absl::exchange(that.filename_, std::string());
   file_system_ = absl::exchange(that.file_system_, nullptr);
+  buffer_size_ = absl::exchange(that.buffer_size_, 0u);
+  read_ahead_ = absl::exchange(that.read_ahead_, false);
   buffer_ = std::move(that.buffer_);
+  read_ahead_request_ = std::move(that.read_ahead_request_);
+  read_ahead_done_ = std::move(that.read_ahead_done_);
   return *this;
 }
 
+inline FileReaderBase::~FileReaderBase() { AbandonReadAhead(); }
+
 template <typename Src>
 FileReader<Src>::FileReader(Src src, Options options)
-    : FileReaderBase(options.buffer_size_), src_(std::move(src)) {
+    : FileReaderBase(options.buffer_size_, options.read_ahead_),
+      src_(std::move(src)) {
   RIEGELI_ASSERT(src_.get() != nullptr)
       << "Failed precondition of FileReader<Src>::FileReader(Src): "
          "null RandomAccessFile pointer";
@@ -212,7 +298,7 @@ FileReader<Src>::FileReader(Src src, Options options)
 
 template <typename Src>
 FileReader<Src>::FileReader(absl::string_view filename, Options options)
-    : FileReaderBase(options.buffer_size_) {
+    : FileReaderBase(options.buffer_size_, options.read_ahead_) {
   if (ABSL_PREDICT_FALSE(!InitializeFilename(options.env_, filename))) {
     return;
   }
@@ -233,6 +319,13 @@ inline FileReader<Src>& FileReader<Src>::operator=(FileReader&& that) noexcept {
   return *this;
 }
 
+template <typename Src>
+inline FileReader<Src>::~FileReader() {
+  // Wait for a pending background read before the RandomAccessFile can be
+  // destroyed together with src_.
+  AbandonReadAhead();
+}
+
 template <typename Src>
 void FileReader<Src>::Done() {
   FileReaderBase::Done();
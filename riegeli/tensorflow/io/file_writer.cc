@@ -16,17 +16,22 @@
 
 #include <stddef.h>
 
+#include <deque>
 #include <limits>
 #include <memory>
 #include <string>
 #include <utility>
 
 #include "absl/base/optimization.h"
+#include "absl/memory/memory.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/buffer.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/parallelism.h"
+#include "riegeli/base/recycling_pool.h"
 #include "riegeli/base/status.h"
 #include "riegeli/bytes/writer.h"
 #include "tensorflow/core/lib/core/errors.h"
@@ -38,6 +43,14 @@
 namespace riegeli {
 namespace tensorflow {
 
+void FileWriterBase::Done() {
+  PushInternal();
+  if (async_appends_ != nullptr) SyncAsyncAppends();
+  // Return the buffer to the pool.
+  buffer_.reset();
+  Writer::Done();
+}
+
 void FileWriterBase::InitializeFilename(::tensorflow::WritableFile* dest) {
   absl::string_view filename;
   const ::tensorflow::Status name_status = dest->Name(&filename);
@@ -90,7 +103,7 @@ bool FileWriterBase::FailOperation(const ::tensorflow::Status& status,
 }
 
 inline size_t FileWriterBase::LengthToWriteDirectly() const {
-  size_t length = buffer_.size();
+  size_t length = buffer_size_;
   if (written_to_buffer() > 0) {
     // Two writes are needed because current contents of buffer_ must be pushed.
     // Write directly if writing through buffer_ would need more than two
@@ -111,22 +124,124 @@ bool FileWriterBase::PushSlow() {
   if (ABSL_PREDICT_FALSE(start_pos_ == std::numeric_limits<Position>::max())) {
     return FailOverflow();
   }
-  start_ = buffer_.GetData();
+  if (buffer_ == nullptr) buffer_ = NewBuffer();
+  start_ = buffer_->GetData();
   cursor_ = start_;
   limit_ =
-      start_ + UnsignedMin(buffer_.size(),
+      start_ + UnsignedMin(buffer_->size(),
                            std::numeric_limits<Position>::max() - start_pos_);
   return true;
 }
 
+inline FileWriterBase::BufferPool::Handle FileWriterBase::NewBuffer() {
+  const size_t buffer_size = buffer_size_;
+  return BufferPool::global().Get(buffer_size, [buffer_size] {
+    return absl::make_unique<Buffer>(buffer_size);
+  });
+}
+
 bool FileWriterBase::PushInternal() {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
   const size_t buffered_length = written_to_buffer();
   if (buffered_length == 0) return true;
   cursor_ = start_;
+  if (async_appends_ != nullptr) return AppendBufferAsync(buffered_length);
   return WriteInternal(absl::string_view(start_, buffered_length));
 }
 
+inline bool FileWriterBase::AppendBufferAsync(size_t length) {
+  RIEGELI_ASSERT(async_appends_ != nullptr)
+      << "Failed precondition of FileWriterBase::AppendBufferAsync(): "
+         "async appends disabled";
+  RIEGELI_ASSERT_GT(length, 0u)
+      << "Failed precondition of FileWriterBase::AppendBufferAsync(): "
+         "nothing to write";
+  RIEGELI_ASSERT(healthy())
+      << "Failed precondition of FileWriterBase::AppendBufferAsync(): "
+      << status();
+  if (ABSL_PREDICT_FALSE(length >
+                         std::numeric_limits<Position>::max() - start_pos_)) {
+    return FailOverflow();
+  }
+  AsyncAppendQueue* const queue = async_appends_.get();
+  ::tensorflow::WritableFile* const dest = dest_file();
+  ::tensorflow::Status append_status;
+  bool start_worker = false;
+  {
+    absl::MutexLock lock(&queue->mutex);
+    queue->mutex.Await(absl::Condition(queue, &AsyncAppendQueue::HasSpace));
+    append_status = queue->status;
+    if (ABSL_PREDICT_TRUE(append_status.ok())) {
+      queue->pending.emplace_back();
+      queue->pending.back().buffer = std::move(buffer_);
+      queue->pending.back().length = length;
+      if (!queue->worker_running) {
+        queue->worker_running = true;
+        start_worker = true;
+      }
+    } else {
+      queue->status = ::tensorflow::Status::OK();
+    }
+  }
+  if (ABSL_PREDICT_FALSE(!append_status.ok())) {
+    return FailOperation(append_status, "WritableFile::Append(string_view)");
+  }
+  start_ = nullptr;
+  cursor_ = nullptr;
+  limit_ = nullptr;
+  start_pos_ += length;
+  if (start_worker) {
+    internal::ThreadPool::global_io().Schedule([dest, queue] {
+      for (;;) {
+        AsyncAppendQueue::PendingAppend pending;
+        {
+          absl::MutexLock lock(&queue->mutex);
+          if (queue->pending.empty()) {
+            queue->worker_running = false;
+            return;
+          }
+          pending = std::move(queue->pending.front());
+          queue->pending.pop_front();
+        }
+        const ::tensorflow::Status append_status = dest->Append(
+            absl::string_view(pending.buffer->GetData(), pending.length));
+        if (ABSL_PREDICT_FALSE(!append_status.ok())) {
+          absl::MutexLock lock(&queue->mutex);
+          queue->status = append_status;
+          // Data of the remaining appends are lost anyway.
+          queue->pending.clear();
+          queue->worker_running = false;
+          return;
+        }
+      }
+    });
+  }
+  return true;
+}
+
+inline bool FileWriterBase::SyncAsyncAppends() {
+  RIEGELI_ASSERT(async_appends_ != nullptr)
+      << "Failed precondition of FileWriterBase::SyncAsyncAppends(): "
+         "async appends disabled";
+  AsyncAppendQueue* const queue = async_appends_.get();
+  ::tensorflow::Status append_status;
+  {
+    absl::MutexLock lock(&queue->mutex);
+    queue->mutex.Await(absl::Condition(queue, &AsyncAppendQueue::Idle));
+    if (ABSL_PREDICT_TRUE(queue->status.ok())) return true;
+    append_status = queue->status;
+    queue->status = ::tensorflow::Status::OK();
+  }
+  return FailOperation(append_status, "WritableFile::Append(string_view)");
+}
+
+void FileWriterBase::JoinAsyncAppends() {
+  if (async_appends_ == nullptr) return;
+  AsyncAppendQueue* const queue = async_appends_.get();
+  absl::MutexLock lock(&queue->mutex);
+  queue->mutex.Await(absl::Condition(queue, &AsyncAppendQueue::Idle));
+}
+
 bool FileWriterBase::WriteSlow(absl::string_view src) {
   RIEGELI_ASSERT_GT(src.size(), available())
       << "Failed precondition of Writer::WriteSlow(string_view): "
@@ -147,6 +262,11 @@ bool FileWriterBase::WriteInternal(absl::string_view src) {
   RIEGELI_ASSERT_EQ(written_to_buffer(), 0u)
       << "Failed precondition of FileWriterBase::WriteInternal(): "
          "buffer not empty";
+  if (async_appends_ != nullptr) {
+    // Appends scheduled in the background must complete first so that data
+    // are appended in order.
+    if (ABSL_PREDICT_FALSE(!SyncAsyncAppends())) return false;
+  }
   ::tensorflow::WritableFile* const dest = dest_file();
   if (ABSL_PREDICT_FALSE(src.size() >
                          std::numeric_limits<Position>::max() - start_pos_)) {
@@ -162,6 +282,9 @@ bool FileWriterBase::WriteInternal(absl::string_view src) {
 
 bool FileWriterBase::Flush(FlushType flush_type) {
   if (ABSL_PREDICT_FALSE(!PushInternal())) return false;
+  if (async_appends_ != nullptr) {
+    if (ABSL_PREDICT_FALSE(!SyncAsyncAppends())) return false;
+  }
   ::tensorflow::WritableFile* const dest = dest_file();
   switch (flush_type) {
     case FlushType::kFromObject:
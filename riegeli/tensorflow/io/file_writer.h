@@ -17,19 +17,23 @@
 
 #include <stddef.h>
 
+#include <deque>
 #include <memory>
 #include <string>
 #include <utility>
 
 #include "absl/base/attributes.h"
 #include "absl/base/optimization.h"
+#include "absl/base/thread_annotations.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
 #include "absl/utility/utility.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/buffer.h"
 #include "riegeli/base/chain.h"
 #include "riegeli/base/dependency.h"
 #include "riegeli/base/object.h"
+#include "riegeli/base/recycling_pool.h"
 #include "riegeli/bytes/writer.h"
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/platform/env.h"
@@ -89,6 +93,26 @@ class FileWriterBase : public Writer {
       return std::move(set_buffer_size(buffer_size));
     }
 
+    // If true, filled buffers are appended to the file by a background
+    // thread, with a bounded number of them waiting in a queue. Writing can
+    // proceed while the file is busy appending, which hides the latency of
+    // appending. This helps if the file system has high latency, e.g. for
+    // network file systems.
+    //
+    // A failure of a background append is reported by a later write,
+    // Flush(), or Close().
+    //
+    // Uses memory for the queued buffers, of buffer_size() each.
+    //
+    // Default: false.
+    Options& set_async_append(bool async_append) & {
+      async_append_ = async_append;
+      return *this;
+    }
+    Options&& set_async_append(bool async_append) && {
+      return std::move(set_async_append(async_append));
+    }
+
    private:
     template <typename Dest>
     friend class FileWriter;
@@ -96,6 +120,7 @@ class FileWriterBase : public Writer {
     ::tensorflow::Env* env_ = nullptr;
     bool append_ = false;
     size_t buffer_size_ = kDefaultBufferSize;
+    bool async_append_ = false;
   };
 
   // Returns the WritableFile being written to. Unchanged by Close().
@@ -110,11 +135,19 @@ class FileWriterBase : public Writer {
  protected:
   FileWriterBase() noexcept : Writer(State::kClosed) {}
 
-  explicit FileWriterBase(size_t buffer_size);
+  explicit FileWriterBase(size_t buffer_size, bool async_append);
 
   FileWriterBase(FileWriterBase&& that) noexcept;
   FileWriterBase& operator=(FileWriterBase&& that) noexcept;
 
+  ~FileWriterBase() { JoinAsyncAppends(); }
+
+  void Done() override;
+
+  // Waits until appends scheduled in the background are done, without
+  // checking whether they succeeded.
+  void JoinAsyncAppends();
+
   void InitializeFilename(::tensorflow::WritableFile* dest);
   std::unique_ptr<::tensorflow::WritableFile> OpenFile(
       ::tensorflow::Env* env, absl::string_view filename, bool append);
@@ -140,15 +173,72 @@ class FileWriterBase : public Writer {
   bool WriteInternal(absl::string_view src);
 
  private:
+  // Pool of buffers shared between FileWriters with the same buffer size.
+  using BufferPool = RecyclingPool<Buffer, std::default_delete<Buffer>, size_t>;
+
+  // State shared with the background thread performing appends.
+  // Heap-allocated so that its address is stable.
+  struct AsyncAppendQueue {
+    // A filled buffer waiting to be appended.
+    struct PendingAppend {
+      BufferPool::Handle buffer;
+      size_t length = 0;
+    };
+
+    bool HasSpace() const EXCLUSIVE_LOCKS_REQUIRED(mutex) {
+      return pending.size() < kMaxPendingAppends;
+    }
+    bool Idle() const EXCLUSIVE_LOCKS_REQUIRED(mutex) {
+      return !worker_running;
+    }
+
+    absl::Mutex mutex;
+    std::deque<PendingAppend> pending GUARDED_BY(mutex);
+    // True while a background thread is consuming the queue.
+    bool worker_running GUARDED_BY(mutex) = false;
+    // The first failure of a background append, if any.
+    ::tensorflow::Status status GUARDED_BY(mutex);
+  };
+
+  // Number of filled buffers which may wait for being appended before
+  // writing blocks. Appending a whole queue of buffers at once also lets the
+  // file system see larger writes.
+  static constexpr size_t kMaxPendingAppends = 4;
+
   // Minimum length for which it is better to push current contents of buffer_
   // and write the data directly than to write the data through buffer_.
   size_t LengthToWriteDirectly() const;
 
+  // Returns a buffer of size buffer_size_ from the pool.
+  BufferPool::Handle NewBuffer();
+
+  // Hands buffer_ with length bytes of data over to the background thread,
+  // blocking if the queue is full.
+  //
+  // Increments start_pos_ by length, assuming that the append will succeed;
+  // a failure is reported by a later operation.
+  //
+  // Preconditions:
+  //   async_appends_ != nullptr
+  //   length > 0
+  //   healthy()
+  bool AppendBufferAsync(size_t length);
+
+  // Waits until appends scheduled in the background are done. Returns false
+  // if one of them failed.
+  bool SyncAsyncAppends();
+
   std::string filename_;
-  // Buffered data to be written.
+  // Size of buffers, and the key of the buffer pool.
   //
-  // Invariant: if healthy() then buffer_.size() > 0
-  Buffer buffer_;
+  // Invariant: if healthy() then buffer_size_ > 0
+  size_t buffer_size_ = 0;
+  // Buffered data to be written, or nullptr (not allocated yet, or handed
+  // over to async_appends_).
+  BufferPool::Handle buffer_;
+  // Queue of appends to be performed in the background, or nullptr when
+  // async appends are disabled.
+  std::unique_ptr<AsyncAppendQueue> async_appends_;
 };
 
 // A Writer which writes to a WritableFile.
@@ -182,6 +272,8 @@ class FileWriter : public FileWriterBase {
   FileWriter(FileWriter&& that) noexcept;
   FileWriter& operator=(FileWriter&& that) noexcept;
 
+  ~FileWriter();
+
   // Returns the object providing and possibly owning the WritableFile being
   // written to. Unchanged by Close().
   Dest& dest() { return dest_.manager(); }
@@ -198,25 +290,38 @@ class FileWriter : public FileWriterBase {
 
 // Implementation details follow.
 
-inline FileWriterBase::FileWriterBase(size_t buffer_size)
-    : Writer(State::kOpen), buffer_(buffer_size) {}
+inline FileWriterBase::FileWriterBase(size_t buffer_size, bool async_append)
+    : Writer(State::kOpen), buffer_size_(buffer_size) {
+  if (async_append) {
+    async_appends_ =
+        std::unique_ptr<AsyncAppendQueue>(new AsyncAppendQueue());
+  }
+}
 
 inline FileWriterBase::FileWriterBase(FileWriterBase&& that) noexcept
     : Writer(std::move(that)),
       filename_(absl::exchange(that.filename_, std::string())),
-      buffer_(std::move(that.buffer_)) {}
+      buffer_size_(absl::exchange(that.buffer_size_, 0u)),
+      buffer_(std::move(that.buffer_)),
+      async_appends_(std::move(that.async_appends_)) {}
 
 inline FileWriterBase& FileWriterBase::operator=(
     FileWriterBase&& that) noexcept {
+  // Join the background thread writing to state which is about to be
+  // replaced.
+  JoinAsyncAppends();
   Writer::operator=(std::move(that));
   filename_ = absl::exchange(that.filename_, std::string());
+  buffer_size_ = absl::exchange(that.buffer_size_, 0u);
   buffer_ = std::move(that.buffer_);
+  async_appends_ = std::move(that.async_appends_);
   return *this;
 }
 
 template <typename Dest>
 FileWriter<Dest>::FileWriter(Dest dest, Options options)
-    : FileWriterBase(options.buffer_size_), dest_(std::move(dest)) {
+    : FileWriterBase(options.buffer_size_, options.async_append_),
+      dest_(std::move(dest)) {
   RIEGELI_ASSERT(dest_.get() != nullptr)
       << "Failed precondition of FileWriter<Dest>::FileWriter(Dest): "
          "null WritableFile pointer";
@@ -226,7 +331,7 @@ FileWriter<Dest>::FileWriter(Dest dest, Options options)
 
 template <typename Dest>
 FileWriter<Dest>::FileWriter(absl::string_view filename, Options options)
-    : FileWriterBase(options.buffer_size_) {
+    : FileWriterBase(options.buffer_size_, options.async_append_) {
   std::unique_ptr<::tensorflow::WritableFile> dest =
       OpenFile(options.env_, filename, options.append_);
   if (ABSL_PREDICT_FALSE(dest == nullptr)) return;
@@ -246,9 +351,15 @@ inline FileWriter<Dest>& FileWriter<Dest>::operator=(
   return *this;
 }
 
+template <typename Dest>
+inline FileWriter<Dest>::~FileWriter() {
+  // Join the background thread before the WritableFile can be destroyed
+  // together with dest_.
+  JoinAsyncAppends();
+}
+
 template <typename Dest>
 void FileWriter<Dest>::Done() {
-  PushInternal();
   FileWriterBase::Done();
   if (dest_.is_owning() && dest_.get() != nullptr) {
     const ::tensorflow::Status close_status = dest_->Close();
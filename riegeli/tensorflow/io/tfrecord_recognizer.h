@@ -12,8 +12,8 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
-#ifndef RIEGELI_RECORDS_BENCHMARKS_TFRECORD_DETECTOR_H_
-#define RIEGELI_RECORDS_BENCHMARKS_TFRECORD_DETECTOR_H_
+#ifndef RIEGELI_TENSORFLOW_IO_TFRECORD_RECOGNIZER_H_
+#define RIEGELI_TENSORFLOW_IO_TFRECORD_RECOGNIZER_H_
 
 #include "riegeli/base/base.h"
 #include "riegeli/base/object.h"
@@ -48,4 +48,4 @@ inline TFRecordRecognizer::TFRecordRecognizer(Reader* byte_reader)
 
 }  // namespace riegeli
 
-#endif  // RIEGELI_RECORDS_BENCHMARKS_TFRECORD_DETECTOR_H_
+#endif  // RIEGELI_TENSORFLOW_IO_TFRECORD_RECOGNIZER_H_
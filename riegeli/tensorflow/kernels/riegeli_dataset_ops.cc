@@ -13,23 +13,35 @@
 // limitations under the License.
 
 #include <stddef.h>
+#include <stdint.h>
 
+#include <deque>
 #include <memory>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include "absl/base/thread_annotations.h"
+#include "absl/memory/memory.h"
+#include "absl/strings/numbers.h"
 #include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
 #include "absl/synchronization/mutex.h"
-#include "absl/types/optional.h"
 #include "riegeli/base/base.h"
+#include "riegeli/base/memory.h"
+#include "riegeli/base/recycling_pool.h"
 #include "riegeli/base/status.h"
+#include "riegeli/chunk_encoding/field_projection.h"
 #include "riegeli/records/record_position.h"
 #include "riegeli/records/record_reader.h"
 #include "riegeli/records/skipped_region.h"
 #include "riegeli/tensorflow/io/file_reader.h"
+#include "tensorflow/core/example/example.pb.h"
+#include "tensorflow/core/example/feature.pb.h"
 #include "tensorflow/core/framework/allocator.h"
+#include "tensorflow/core/framework/attr_value.pb.h"
 #include "tensorflow/core/framework/dataset.h"
 #include "tensorflow/core/framework/op_kernel.h"
 #include "tensorflow/core/framework/tensor.h"
@@ -40,6 +52,7 @@
 #include "tensorflow/core/lib/core/error_codes.pb.h"
 #include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/env.h"
 #include "tensorflow/core/platform/macros.h"
 #include "tensorflow/core/platform/types.h"
 
@@ -47,9 +60,98 @@ namespace riegeli {
 namespace tensorflow {
 namespace {
 
+// A reader of one Riegeli/records file of a dataset.
+using FileRecordReader = RecordReader<tensorflow::FileReader<>>;
+
+// Pool of idle readers, reused when the same file is read again, e.g. by the
+// next epoch, to avoid reopening the file and rebuilding reader state. Keys
+// are filenames together with the reader options baked into the readers, so
+// that only compatible readers are reused.
+using ReaderPool =
+    RecyclingPool<FileRecordReader, std::default_delete<FileRecordReader>,
+                  std::string>;
+
+// Maximal number of idle readers kept. Each of them keeps its file open, so
+// this also bounds the file handles spent on the cache.
+constexpr size_t kMaxIdleReaders = 256;
+
+ReaderPool& GlobalReaderPool() {
+  static NoDestructor<ReaderPool> kPool(kMaxIdleReaders);
+  return *kPool;
+}
+
+// Returns a reader of the file, reusing a compatible idle reader from the
+// pool if possible. options_key must identify options, which are baked into
+// the readers, so that only compatible readers are reused.
+ReaderPool::Handle GetPooledReader(::tensorflow::Env* env,
+                                   const std::string& filename,
+                                   const std::string& options_key,
+                                   RecordReaderBase::Options options) {
+  return GlobalReaderPool().Get(
+      absl::StrCat(filename, "\n", options_key),
+      [env, &filename, &options] {
+        return absl::make_unique<FileRecordReader>(
+            tensorflow::FileReader<>(
+                filename,
+                tensorflow::FileReaderBase::Options()
+                    .set_env(env)
+                    .set_read_ahead(true)),
+            std::move(options));
+      },
+      [](FileRecordReader* reader) {
+        // A reader from the pool is positioned wherever previous reading
+        // left it, with the file still open; rewind it.
+        reader->Seek(0);
+      });
+}
+
+// Parses a sequence of proto field numbers separated by dots.
+bool ParseFieldPath(absl::string_view text, Field* field) {
+  for (const absl::string_view tag_text : absl::StrSplit(text, '.')) {
+    uint32_t tag;
+    if (TF_PREDICT_FALSE(!absl::SimpleAtoi(tag_text, &tag) || tag < 1 ||
+                         tag > (uint32_t{1} << 29) - 1)) {
+      return false;
+    }
+    field->AddTag(tag);
+  }
+  return true;
+}
+
 class RiegeliDatasetOp : public ::tensorflow::data::DatasetOpKernel {
  public:
-  using DatasetOpKernel::DatasetOpKernel;
+  explicit RiegeliDatasetOp(::tensorflow::OpKernelConstruction* ctx)
+      : DatasetOpKernel(ctx) {
+    OP_REQUIRES_OK(ctx,
+                   ctx->GetAttr("num_parallel_reads", &num_parallel_reads_));
+    OP_REQUIRES(ctx, num_parallel_reads_ >= 1,
+                ::tensorflow::errors::InvalidArgument(
+                    "`num_parallel_reads` must be at least 1"));
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("num_shards", &num_shards_));
+    OP_REQUIRES(ctx, num_shards_ >= 1,
+                ::tensorflow::errors::InvalidArgument(
+                    "`num_shards` must be at least 1"));
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("shard_index", &shard_index_));
+    OP_REQUIRES(ctx, shard_index_ >= 0 && shard_index_ < num_shards_,
+                ::tensorflow::errors::InvalidArgument(
+                    "`shard_index` must be in the range [0, `num_shards`)"));
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("batch_size", &batch_size_));
+    OP_REQUIRES(ctx, batch_size_ >= 0,
+                ::tensorflow::errors::InvalidArgument(
+                    "`batch_size` must be non-negative"));
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("fields", &fields_));
+    if (fields_.empty()) {
+      field_projection_ = FieldProjection::All();
+    } else {
+      for (const std::string& field_path : fields_) {
+        Field field;
+        OP_REQUIRES(ctx, ParseFieldPath(field_path, &field),
+                    ::tensorflow::errors::InvalidArgument(
+                        "Invalid proto field path in `fields`: ", field_path));
+        field_projection_.AddField(std::move(field));
+      }
+    }
+  }
 
   void MakeDataset(::tensorflow::OpKernelContext* ctx,
                    ::tensorflow::data::DatasetBase** output) override {
@@ -65,19 +167,37 @@ class RiegeliDatasetOp : public ::tensorflow::data::DatasetOpKernel {
       filenames.push_back(filenames_tensor->flat<std::string>()(i));
     }
 
-    *output = new Dataset(ctx, std::move(filenames));
+    *output = new Dataset(ctx, std::move(filenames), num_parallel_reads_,
+                          num_shards_, shard_index_, batch_size_, fields_,
+                          field_projection_);
   }
 
  private:
   class Dataset : public ::tensorflow::data::DatasetBase {
    public:
     explicit Dataset(::tensorflow::OpKernelContext* ctx,
-                     std::vector<std::string> filenames)
+                     std::vector<std::string> filenames,
+                     ::tensorflow::int64 num_parallel_reads,
+                     ::tensorflow::int64 num_shards,
+                     ::tensorflow::int64 shard_index,
+                     ::tensorflow::int64 batch_size,
+                     std::vector<std::string> fields,
+                     FieldProjection field_projection)
         : DatasetBase(::tensorflow::data::DatasetContext(ctx)),
-          filenames_(std::move(filenames)) {}
+          filenames_(std::move(filenames)),
+          num_parallel_reads_(num_parallel_reads),
+          num_shards_(num_shards),
+          shard_index_(shard_index),
+          batch_size_(batch_size),
+          fields_(std::move(fields)),
+          field_projection_(std::move(field_projection)) {}
 
     std::unique_ptr<::tensorflow::data::IteratorBase> MakeIteratorInternal(
         const std::string& prefix) const override {
+      if (num_parallel_reads_ > 1) {
+        return std::unique_ptr<::tensorflow::data::IteratorBase>(
+            new ParallelIterator({this, absl::StrCat(prefix, "::Riegeli")}));
+      }
       return std::unique_ptr<::tensorflow::data::IteratorBase>(
           new Iterator({this, absl::StrCat(prefix, "::Riegeli")}));
     }
@@ -90,6 +210,13 @@ class RiegeliDatasetOp : public ::tensorflow::data::DatasetOpKernel {
 
     const std::vector<::tensorflow::PartialTensorShape>& output_shapes()
         const override {
+      if (batch_size_ > 0) {
+        // A 1-D tensor of up to batch_size_ records.
+        static const std::vector<::tensorflow::PartialTensorShape>* const
+            batched_shapes =
+                new std::vector<::tensorflow::PartialTensorShape>({{-1}});
+        return *batched_shapes;
+      }
       static const std::vector<::tensorflow::PartialTensorShape>* const shapes =
           new std::vector<::tensorflow::PartialTensorShape>({{}});
       return *shapes;
@@ -105,32 +232,104 @@ class RiegeliDatasetOp : public ::tensorflow::data::DatasetOpKernel {
         DatasetGraphDefBuilder* b, ::tensorflow::Node** output) const override {
       ::tensorflow::Node* filenames = nullptr;
       TF_RETURN_IF_ERROR(b->AddVector(filenames_, &filenames));
-      TF_RETURN_IF_ERROR(b->AddDataset(this, {filenames}, output));
+      ::tensorflow::AttrValue num_parallel_reads;
+      b->BuildAttrValue(num_parallel_reads_, &num_parallel_reads);
+      ::tensorflow::AttrValue num_shards;
+      b->BuildAttrValue(num_shards_, &num_shards);
+      ::tensorflow::AttrValue shard_index;
+      b->BuildAttrValue(shard_index_, &shard_index);
+      ::tensorflow::AttrValue batch_size;
+      b->BuildAttrValue(batch_size_, &batch_size);
+      ::tensorflow::AttrValue fields;
+      b->BuildAttrValue(fields_, &fields);
+      TF_RETURN_IF_ERROR(b->AddDataset(this, {filenames},
+                                       {{"num_parallel_reads",
+                                         num_parallel_reads},
+                                        {"num_shards", num_shards},
+                                        {"shard_index", shard_index},
+                                        {"batch_size", batch_size},
+                                        {"fields", fields}},
+                                       output));
       return ::tensorflow::Status::OK();
     }
 
    private:
+    // Options for the RecordReader of each file.
+    RecordReaderBase::Options reader_options() const {
+      RecordReaderBase::Options options;
+      if (num_shards_ > 1) {
+        options.set_shard(IntCast<uint64_t>(shard_index_),
+                          IntCast<uint64_t>(num_shards_));
+      }
+      if (!field_projection_.includes_all()) {
+        options.set_field_projection(field_projection_);
+      }
+      return options;
+    }
+
+    // Returns a reader of the file, reusing a compatible idle reader from
+    // the pool if possible.
+    ReaderPool::Handle GetReader(::tensorflow::Env* env,
+                                 const std::string& filename) const {
+      return GetPooledReader(
+          env, filename,
+          absl::StrCat(absl::StrJoin(fields_, ","), "\n", num_shards_, ",",
+                       shard_index_),
+          reader_options());
+    }
+
     class Iterator : public ::tensorflow::data::DatasetIterator<Dataset> {
      public:
       explicit Iterator(const Params& params)
           : DatasetIterator<Dataset>(params) {}
 
+      ~Iterator() override {
+        absl::MutexLock l(&mu_);
+        DropReader();
+      }
+
       ::tensorflow::Status GetNextInternal(
           ::tensorflow::data::IteratorContext* ctx,
           std::vector<::tensorflow::Tensor>* out_tensors,
           bool* end_of_sequence) override LOCKS_EXCLUDED(mu_) {
         absl::MutexLock l(&mu_);
         for (;;) {
-          if (reader_.has_value()) {
+          if (reader_ != nullptr) {
             // We are currently processing a file, so try to read the next
-            // record.
-            ::tensorflow::Tensor result_tensor(::tensorflow::cpu_allocator(),
-                                               ::tensorflow::DT_STRING, {});
-            std::string* const value = &result_tensor.scalar<std::string>()();
-            if (TF_PREDICT_TRUE(reader_->ReadRecord(value))) {
-              out_tensors->push_back(std::move(result_tensor));
-              *end_of_sequence = false;
-              return ::tensorflow::Status::OK();
+            // record or batch of records.
+            // Records are read as views into the decoded chunk, valid until
+            // the RecordReader advances; they are copied to the tensor's
+            // string storage before that. This is the only copy of the
+            // record data after decoding.
+            if (dataset()->batch_size_ > 0) {
+              std::vector<absl::string_view> records;
+              const size_t num_read = reader_->ReadRecords(
+                  &records, IntCast<size_t>(dataset()->batch_size_));
+              if (TF_PREDICT_TRUE(num_read > 0)) {
+                ::tensorflow::Tensor result_tensor(
+                    ::tensorflow::cpu_allocator(), ::tensorflow::DT_STRING,
+                    {IntCast<::tensorflow::int64>(num_read)});
+                for (size_t i = 0; i < num_read; ++i) {
+                  result_tensor.vec<std::string>()(
+                      IntCast<::tensorflow::int64>(i))
+                      .assign(records[i].data(), records[i].size());
+                }
+                out_tensors->push_back(std::move(result_tensor));
+                *end_of_sequence = false;
+                return ::tensorflow::Status::OK();
+              }
+            } else {
+              absl::string_view record;
+              if (TF_PREDICT_TRUE(reader_->ReadRecord(&record))) {
+                ::tensorflow::Tensor result_tensor(
+                    ::tensorflow::cpu_allocator(), ::tensorflow::DT_STRING,
+                    {});
+                result_tensor.scalar<std::string>()().assign(record.data(),
+                                                             record.size());
+                out_tensors->push_back(std::move(result_tensor));
+                *end_of_sequence = false;
+                return ::tensorflow::Status::OK();
+              }
             }
             SkippedRegion skipped_region;
             if (reader_->Recover(&skipped_region)) {
@@ -142,22 +341,30 @@ class RiegeliDatasetOp : public ::tensorflow::data::DatasetOpKernel {
                   "Skipping invalid region of a Riegeli/records file: ",
                   skipped_region.ToString());
             }
-            if (TF_PREDICT_FALSE(!reader_->Close())) {
-              // Failed to read the file: return an error.
-              const Status status = reader_->status();
-              // Further iteration will move on to the next file, if any.
+            if (TF_PREDICT_TRUE(CanRecycleReader())) {
+              // Clean end of the file: return the reader to the pool with
+              // the file still open, to be reused when the same file is
+              // read again, e.g. by the next epoch. Further iteration will
+              // move on to the next file, if any.
               reader_.reset();
               ++current_file_index_;
-              *end_of_sequence =
-                  current_file_index_ == dataset()->filenames_.size();
-              return ::tensorflow::Status(
-                  static_cast<::tensorflow::error::Code>(status.code()),
-                  status.message());
+            } else {
+              const bool close_ok = reader_->Close();
+              const Status status = reader_->status();
+              delete reader_.release();
+              ++current_file_index_;
+              if (TF_PREDICT_FALSE(!close_ok)) {
+                // Failed to read the file: return an error. Further
+                // iteration will move on to the next file, if any.
+                *end_of_sequence =
+                    current_file_index_ == dataset()->filenames_.size();
+                return ::tensorflow::Status(
+                    static_cast<::tensorflow::error::Code>(status.code()),
+                    status.message());
+              }
+              // We have reached the end of the current file, so move on to
+              // the next file, if any.
             }
-            // We have reached the end of the current file, so move on to the
-            // next file, if any.
-            reader_.reset();
-            ++current_file_index_;
           }
 
           // Iteration ends when there are no more files to process.
@@ -175,11 +382,18 @@ class RiegeliDatasetOp : public ::tensorflow::data::DatasetOpKernel {
       ::tensorflow::Status SaveInternal(
           ::tensorflow::data::IteratorStateWriter* writer) override
           LOCKS_EXCLUDED(mu_) {
+        if (dataset()->num_shards_ > 1) {
+          // Restoring would seek into the middle of a file, which desyncs the
+          // assignment of chunks to shards.
+          return ::tensorflow::errors::Unimplemented(
+              "Checkpointing is not supported for a RiegeliDataset with "
+              "num_shards > 1");
+        }
         absl::MutexLock l(&mu_);
         TF_RETURN_IF_ERROR(writer->WriteScalar(
             full_name("current_file_index"),
             IntCast<::tensorflow::int64>(current_file_index_)));
-        if (reader_.has_value()) {
+        if (reader_ != nullptr) {
           TF_RETURN_IF_ERROR(writer->WriteScalar(full_name("current_pos"),
                                                  reader_->pos().ToBytes()));
         }
@@ -190,9 +404,14 @@ class RiegeliDatasetOp : public ::tensorflow::data::DatasetOpKernel {
           ::tensorflow::data::IteratorContext* ctx,
           ::tensorflow::data::IteratorStateReader* reader) override
           LOCKS_EXCLUDED(mu_) {
+        if (dataset()->num_shards_ > 1) {
+          return ::tensorflow::errors::Unimplemented(
+              "Checkpointing is not supported for a RiegeliDataset with "
+              "num_shards > 1");
+        }
         absl::MutexLock l(&mu_);
         current_file_index_ = 0;
-        reader_.reset();
+        DropReader();
 
         ::tensorflow::int64 current_file_index;
         TF_RETURN_IF_ERROR(reader->ReadScalar(full_name("current_file_index"),
@@ -229,30 +448,632 @@ class RiegeliDatasetOp : public ::tensorflow::data::DatasetOpKernel {
      private:
       void OpenFile(::tensorflow::data::IteratorContext* ctx)
           EXCLUSIVE_LOCKS_REQUIRED(mu_) {
-        reader_.emplace(tensorflow::FileReader<>(
-            dataset()->filenames_[current_file_index_],
-            tensorflow::FileReaderBase::Options().set_env(ctx->env())));
+        reader_ = dataset()->GetReader(
+            ctx->env(), dataset()->filenames_[current_file_index_]);
+      }
+
+      // Returns true if reader_ finished its file cleanly and can be
+      // returned to the pool. Readers of sharded datasets are not reused
+      // because the assignment of chunks to shards counts from where the
+      // reader started reading.
+      bool CanRecycleReader() const EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+        return TF_PREDICT_TRUE(reader_->healthy()) && !reader_->truncated() &&
+               dataset()->num_shards_ <= 1;
+      }
+
+      // Drops reader_: returns it to the pool if it can be reused,
+      // otherwise deletes it without closing.
+      void DropReader() EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+        if (reader_ == nullptr) return;
+        if (CanRecycleReader()) {
+          reader_.reset();
+        } else {
+          delete reader_.release();
+        }
       }
 
       // Invariants:
       //   current_file_index_ <= dataset()->filenames_.size()
       //   if current_file_index_ == dataset()->filenames_.size() then
-      //       !reader_.has_value()
+      //       reader_ == nullptr
 
       absl::Mutex mu_;
       size_t current_file_index_ GUARDED_BY(mu_) = 0;
-      // nullopt means not open yet.
-      absl::optional<RecordReader<tensorflow::FileReader<>>> reader_
-          GUARDED_BY(mu_);
+      // nullptr means not open yet.
+      ReaderPool::Handle reader_ GUARDED_BY(mu_);
+    };
+
+    // Used when num_parallel_reads_ > 1: reader threads each read whole
+    // files, interleaving their records through a bounded prefetch buffer.
+    // Files are claimed by threads in order, but records of files read
+    // concurrently are interleaved nondeterministically.
+    class ParallelIterator
+        : public ::tensorflow::data::DatasetIterator<Dataset> {
+     public:
+      explicit ParallelIterator(const Params& params)
+          : DatasetIterator<Dataset>(params) {}
+
+      ~ParallelIterator() override {
+        {
+          absl::MutexLock l(&mu_);
+          cancelled_ = true;
+        }
+        // Reader threads are joined by the Thread destructors.
+        reader_threads_.clear();
+      }
+
+      ::tensorflow::Status GetNextInternal(
+          ::tensorflow::data::IteratorContext* ctx,
+          std::vector<::tensorflow::Tensor>* out_tensors,
+          bool* end_of_sequence) override LOCKS_EXCLUDED(mu_) {
+        absl::MutexLock l(&mu_);
+        EnsureThreadsStarted(ctx);
+        mu_.Await(
+            absl::Condition(this, &ParallelIterator::ElementAvailable));
+        if (buffer_.empty()) {
+          *end_of_sequence = true;
+          return ::tensorflow::Status::OK();
+        }
+        Element element = std::move(buffer_.front());
+        buffer_.pop_front();
+        *end_of_sequence = false;
+        if (TF_PREDICT_FALSE(!element.status.ok())) return element.status;
+        if (dataset()->batch_size_ > 0) {
+          // Collect further records which are already buffered, without
+          // waiting, up to batch_size records. An error stays in the buffer
+          // to be delivered by the next GetNext() call.
+          std::vector<std::string> records;
+          records.push_back(std::move(element.record));
+          while (records.size() < IntCast<size_t>(dataset()->batch_size_) &&
+                 !buffer_.empty() && buffer_.front().status.ok()) {
+            records.push_back(std::move(buffer_.front().record));
+            buffer_.pop_front();
+          }
+          ::tensorflow::Tensor result_tensor(
+              ::tensorflow::cpu_allocator(), ::tensorflow::DT_STRING,
+              {IntCast<::tensorflow::int64>(records.size())});
+          for (size_t i = 0; i < records.size(); ++i) {
+            result_tensor.vec<std::string>()(
+                IntCast<::tensorflow::int64>(i)) = std::move(records[i]);
+          }
+          out_tensors->push_back(std::move(result_tensor));
+          return ::tensorflow::Status::OK();
+        }
+        ::tensorflow::Tensor result_tensor(::tensorflow::cpu_allocator(),
+                                           ::tensorflow::DT_STRING, {});
+        result_tensor.scalar<std::string>()() = std::move(element.record);
+        out_tensors->push_back(std::move(result_tensor));
+        return ::tensorflow::Status::OK();
+      }
+
+     protected:
+      ::tensorflow::Status SaveInternal(
+          ::tensorflow::data::IteratorStateWriter* writer) override {
+        return ::tensorflow::errors::Unimplemented(
+            "Checkpointing is not supported for a RiegeliDataset with "
+            "num_parallel_reads > 1");
+      }
+
+      ::tensorflow::Status RestoreInternal(
+          ::tensorflow::data::IteratorContext* ctx,
+          ::tensorflow::data::IteratorStateReader* reader) override {
+        return ::tensorflow::errors::Unimplemented(
+            "Checkpointing is not supported for a RiegeliDataset with "
+            "num_parallel_reads > 1");
+      }
+
+     private:
+      // A prefetched record, or an error to be delivered in its place.
+      struct Element {
+        ::tensorflow::Status status;
+        std::string record;
+      };
+
+      // Number of records each reader thread may keep buffered.
+      static constexpr size_t kBufferedRecordsPerReader = 64;
+
+      void EnsureThreadsStarted(::tensorflow::data::IteratorContext* ctx)
+          EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+        if (threads_started_) return;
+        threads_started_ = true;
+        ::tensorflow::Env* const env = ctx->env();
+        const size_t num_threads =
+            UnsignedMin(IntCast<size_t>(dataset()->num_parallel_reads_),
+                        dataset()->filenames_.size());
+        num_active_readers_ = num_threads;
+        reader_threads_.reserve(num_threads);
+        for (size_t i = 0; i < num_threads; ++i) {
+          reader_threads_.emplace_back(env->StartThread(
+              ::tensorflow::ThreadOptions(),
+              absl::StrCat("riegeli_data_reader_", i),
+              [this, env] { ReaderThread(env); }));
+        }
+      }
+
+      // Reads whole files claimed from next_file_index_ until there are no
+      // more files or the iterator is cancelled.
+      void ReaderThread(::tensorflow::Env* env) LOCKS_EXCLUDED(mu_) {
+        bool cancelled = false;
+        while (!cancelled) {
+          size_t file_index;
+          {
+            absl::MutexLock l(&mu_);
+            if (cancelled_ ||
+                next_file_index_ == dataset()->filenames_.size()) {
+              break;
+            }
+            file_index = next_file_index_++;
+          }
+          ReaderPool::Handle reader =
+              dataset()->GetReader(env, dataset()->filenames_[file_index]);
+          std::string record;
+          for (;;) {
+            if (TF_PREDICT_TRUE(reader->ReadRecord(&record))) {
+              if (TF_PREDICT_FALSE(!Push(Element{
+                      ::tensorflow::Status::OK(), std::move(record)}))) {
+                cancelled = true;
+                break;
+              }
+              continue;
+            }
+            SkippedRegion skipped_region;
+            if (reader->Recover(&skipped_region)) {
+              // File has invalid contents: deliver an error in place of a
+              // record. Reading resumes after the invalid region.
+              if (TF_PREDICT_FALSE(!Push(Element{
+                      ::tensorflow::errors::DataLoss(
+                          "Skipping invalid region of a Riegeli/records "
+                          "file: ",
+                          skipped_region.ToString()),
+                      std::string()}))) {
+                cancelled = true;
+                break;
+              }
+              continue;
+            }
+            break;
+          }
+          const bool recycle = TF_PREDICT_TRUE(reader->healthy()) &&
+                               !reader->truncated() &&
+                               dataset()->num_shards_ <= 1;
+          if (cancelled) {
+            // The file was abandoned in the middle; the reader can still be
+            // reused unless it failed.
+            if (TF_PREDICT_FALSE(!recycle)) delete reader.release();
+            break;
+          }
+          if (TF_PREDICT_TRUE(recycle)) {
+            // Clean end of the file: return the reader to the pool with the
+            // file still open, to be reused when the same file is read
+            // again, e.g. by the next epoch.
+            continue;
+          }
+          const bool close_ok = reader->Close();
+          const Status status = reader->status();
+          delete reader.release();
+          if (TF_PREDICT_FALSE(!close_ok)) {
+            // Failed to read the file: deliver an error, then move on to the
+            // next file, if any.
+            if (TF_PREDICT_FALSE(!Push(Element{
+                    ::tensorflow::Status(
+                        static_cast<::tensorflow::error::Code>(status.code()),
+                        status.message()),
+                    std::string()}))) {
+              cancelled = true;
+            }
+          }
+        }
+        absl::MutexLock l(&mu_);
+        --num_active_readers_;
+      }
+
+      // Blocks until the buffer has space for the element. Returns false if
+      // the iterator was cancelled in the meantime.
+      bool Push(Element element) LOCKS_EXCLUDED(mu_) {
+        absl::MutexLock l(&mu_);
+        mu_.Await(
+            absl::Condition(this, &ParallelIterator::HasSpaceOrCancelled));
+        if (TF_PREDICT_FALSE(cancelled_)) return false;
+        buffer_.push_back(std::move(element));
+        return true;
+      }
+
+      bool HasSpaceOrCancelled() const EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+        return cancelled_ ||
+               buffer_.size() < kBufferedRecordsPerReader *
+                                    IntCast<size_t>(
+                                        dataset()->num_parallel_reads_);
+      }
+
+      bool ElementAvailable() const EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+        return !buffer_.empty() || num_active_readers_ == 0;
+      }
+
+      absl::Mutex mu_;
+      bool threads_started_ GUARDED_BY(mu_) = false;
+      bool cancelled_ GUARDED_BY(mu_) = false;
+      // Index of the next file to be claimed by a reader thread.
+      size_t next_file_index_ GUARDED_BY(mu_) = 0;
+      // Number of reader threads which have not finished yet. When it drops
+      // to 0 and the buffer is empty, iteration ends.
+      size_t num_active_readers_ GUARDED_BY(mu_) = 0;
+      std::deque<Element> buffer_ GUARDED_BY(mu_);
+      // Joined by their destructors after cancelled_ is set.
+      std::vector<std::unique_ptr<::tensorflow::Thread>> reader_threads_;
     };
 
     const std::vector<std::string> filenames_;
+    const ::tensorflow::int64 num_parallel_reads_;
+    const ::tensorflow::int64 num_shards_;
+    const ::tensorflow::int64 shard_index_;
+    const ::tensorflow::int64 batch_size_;
+    const std::vector<std::string> fields_;
+    const FieldProjection field_projection_;
   };
+
+  ::tensorflow::int64 num_parallel_reads_;
+  ::tensorflow::int64 num_shards_;
+  ::tensorflow::int64 shard_index_;
+  ::tensorflow::int64 batch_size_;
+  std::vector<std::string> fields_;
+  FieldProjection field_projection_;
 };
 
 REGISTER_KERNEL_BUILDER(Name("RiegeliDataset").Device(::tensorflow::DEVICE_CPU),
                         RiegeliDatasetOp);
 
+// Reads tf.Example records and parses dense features from them in one
+// kernel. Records are parsed directly from views into the decoded chunk,
+// without materializing the serialized record as an intermediate string
+// tensor.
+class RiegeliExampleDatasetOp : public ::tensorflow::data::DatasetOpKernel {
+ public:
+  explicit RiegeliExampleDatasetOp(::tensorflow::OpKernelConstruction* ctx)
+      : DatasetOpKernel(ctx) {
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("dense_keys", &dense_keys_));
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("dense_types", &dense_types_));
+    std::vector<::tensorflow::PartialTensorShape> dense_shapes;
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("dense_shapes", &dense_shapes));
+    OP_REQUIRES(ctx,
+                dense_types_.size() == dense_keys_.size() &&
+                    dense_shapes.size() == dense_keys_.size(),
+                ::tensorflow::errors::InvalidArgument(
+                    "`dense_keys`, `dense_types`, and `dense_shapes` must "
+                    "have the same length"));
+    dense_shapes_.reserve(dense_shapes.size());
+    for (const ::tensorflow::PartialTensorShape& dense_shape : dense_shapes) {
+      ::tensorflow::TensorShape shape;
+      OP_REQUIRES(ctx, dense_shape.AsTensorShape(&shape),
+                  ::tensorflow::errors::InvalidArgument(
+                      "Each shape in `dense_shapes` must be fully defined"));
+      dense_shapes_.push_back(std::move(shape));
+    }
+  }
+
+  void MakeDataset(::tensorflow::OpKernelContext* ctx,
+                   ::tensorflow::data::DatasetBase** output) override {
+    const ::tensorflow::Tensor* filenames_tensor;
+    OP_REQUIRES_OK(ctx, ctx->input("filenames", &filenames_tensor));
+    OP_REQUIRES(ctx, filenames_tensor->dims() <= 1,
+                ::tensorflow::errors::InvalidArgument(
+                    "`filenames` must be a scalar or a vector."));
+
+    std::vector<std::string> filenames;
+    filenames.reserve(IntCast<size_t>(filenames_tensor->NumElements()));
+    for (int i = 0; i < filenames_tensor->NumElements(); ++i) {
+      filenames.push_back(filenames_tensor->flat<std::string>()(i));
+    }
+
+    *output = new Dataset(ctx, std::move(filenames), dense_keys_,
+                          dense_types_, dense_shapes_);
+  }
+
+ private:
+  class Dataset : public ::tensorflow::data::DatasetBase {
+   public:
+    explicit Dataset(::tensorflow::OpKernelContext* ctx,
+                     std::vector<std::string> filenames,
+                     std::vector<std::string> dense_keys,
+                     ::tensorflow::DataTypeVector dense_types,
+                     std::vector<::tensorflow::TensorShape> dense_shapes)
+        : DatasetBase(::tensorflow::data::DatasetContext(ctx)),
+          filenames_(std::move(filenames)),
+          dense_keys_(std::move(dense_keys)),
+          dense_types_(std::move(dense_types)),
+          dense_shapes_(std::move(dense_shapes)),
+          output_shapes_(dense_shapes_.begin(), dense_shapes_.end()) {}
+
+    std::unique_ptr<::tensorflow::data::IteratorBase> MakeIteratorInternal(
+        const std::string& prefix) const override {
+      return std::unique_ptr<::tensorflow::data::IteratorBase>(
+          new Iterator({this, absl::StrCat(prefix, "::RiegeliExample")}));
+    }
+
+    const ::tensorflow::DataTypeVector& output_dtypes() const override {
+      return dense_types_;
+    }
+
+    const std::vector<::tensorflow::PartialTensorShape>& output_shapes()
+        const override {
+      return output_shapes_;
+    }
+
+    std::string DebugString() const override {
+      return "RiegeliExampleDatasetOp::Dataset";
+    }
+
+   protected:
+    ::tensorflow::Status AsGraphDefInternal(
+        ::tensorflow::data::SerializationContext* ctx,
+        DatasetGraphDefBuilder* b, ::tensorflow::Node** output) const override {
+      ::tensorflow::Node* filenames = nullptr;
+      TF_RETURN_IF_ERROR(b->AddVector(filenames_, &filenames));
+      ::tensorflow::AttrValue dense_keys;
+      b->BuildAttrValue(dense_keys_, &dense_keys);
+      ::tensorflow::AttrValue dense_types;
+      b->BuildAttrValue(dense_types_, &dense_types);
+      ::tensorflow::AttrValue dense_shapes;
+      b->BuildAttrValue(dense_shapes_, &dense_shapes);
+      TF_RETURN_IF_ERROR(b->AddDataset(this, {filenames},
+                                       {{"dense_keys", dense_keys},
+                                        {"dense_types", dense_types},
+                                        {"dense_shapes", dense_shapes}},
+                                       output));
+      return ::tensorflow::Status::OK();
+    }
+
+   private:
+    class Iterator : public ::tensorflow::data::DatasetIterator<Dataset> {
+     public:
+      explicit Iterator(const Params& params)
+          : DatasetIterator<Dataset>(params) {}
+
+      ~Iterator() override {
+        absl::MutexLock l(&mu_);
+        DropReader();
+      }
+
+      ::tensorflow::Status GetNextInternal(
+          ::tensorflow::data::IteratorContext* ctx,
+          std::vector<::tensorflow::Tensor>* out_tensors,
+          bool* end_of_sequence) override LOCKS_EXCLUDED(mu_) {
+        absl::MutexLock l(&mu_);
+        for (;;) {
+          if (reader_ != nullptr) {
+            // We are currently processing a file, so try to read and parse
+            // the next record. The view is valid until the RecordReader
+            // advances; the record is parsed from it before that.
+            absl::string_view record;
+            if (TF_PREDICT_TRUE(reader_->ReadRecord(&record))) {
+              ::tensorflow::Example example;
+              if (TF_PREDICT_FALSE(!example.ParseFromArray(
+                      record.data(), IntCast<int>(record.size())))) {
+                // Further iteration will continue with the next record.
+                *end_of_sequence = false;
+                return ::tensorflow::errors::DataLoss(
+                    "Failed to parse a record of a Riegeli/records file as "
+                    "a tf.Example");
+              }
+              TF_RETURN_IF_ERROR(FillFeatures(example, out_tensors));
+              *end_of_sequence = false;
+              return ::tensorflow::Status::OK();
+            }
+            SkippedRegion skipped_region;
+            if (reader_->Recover(&skipped_region)) {
+              // File has invalid contents: return an error. Further
+              // iteration will resume reading the file after the invalid
+              // region has been skipped.
+              *end_of_sequence = false;
+              return ::tensorflow::errors::DataLoss(
+                  "Skipping invalid region of a Riegeli/records file: ",
+                  skipped_region.ToString());
+            }
+            if (TF_PREDICT_TRUE(reader_->healthy() &&
+                                !reader_->truncated())) {
+              // Clean end of the file: return the reader to the pool with
+              // the file still open, to be reused when the same file is
+              // read again, e.g. by the next epoch. Further iteration will
+              // move on to the next file, if any.
+              reader_.reset();
+              ++current_file_index_;
+            } else {
+              const bool close_ok = reader_->Close();
+              const Status status = reader_->status();
+              delete reader_.release();
+              ++current_file_index_;
+              if (TF_PREDICT_FALSE(!close_ok)) {
+                // Failed to read the file: return an error. Further
+                // iteration will move on to the next file, if any.
+                *end_of_sequence =
+                    current_file_index_ == dataset()->filenames_.size();
+                return ::tensorflow::Status(
+                    static_cast<::tensorflow::error::Code>(status.code()),
+                    status.message());
+              }
+              // We have reached the end of the current file, so move on to
+              // the next file, if any.
+            }
+          }
+
+          // Iteration ends when there are no more files to process.
+          if (current_file_index_ == dataset()->filenames_.size()) {
+            *end_of_sequence = true;
+            return ::tensorflow::Status::OK();
+          }
+
+          // Actually move on to next file.
+          OpenFile(ctx);
+        }
+      }
+
+     protected:
+      ::tensorflow::Status SaveInternal(
+          ::tensorflow::data::IteratorStateWriter* writer) override
+          LOCKS_EXCLUDED(mu_) {
+        absl::MutexLock l(&mu_);
+        TF_RETURN_IF_ERROR(writer->WriteScalar(
+            full_name("current_file_index"),
+            IntCast<::tensorflow::int64>(current_file_index_)));
+        if (reader_ != nullptr) {
+          TF_RETURN_IF_ERROR(writer->WriteScalar(full_name("current_pos"),
+                                                 reader_->pos().ToBytes()));
+        }
+        return ::tensorflow::Status::OK();
+      }
+
+      ::tensorflow::Status RestoreInternal(
+          ::tensorflow::data::IteratorContext* ctx,
+          ::tensorflow::data::IteratorStateReader* reader) override
+          LOCKS_EXCLUDED(mu_) {
+        absl::MutexLock l(&mu_);
+        current_file_index_ = 0;
+        DropReader();
+
+        ::tensorflow::int64 current_file_index;
+        TF_RETURN_IF_ERROR(reader->ReadScalar(full_name("current_file_index"),
+                                              &current_file_index));
+        if (TF_PREDICT_FALSE(current_file_index < 0 ||
+                             IntCast<::tensorflow::uint64>(current_file_index) >
+                                 dataset()->filenames_.size())) {
+          return ::tensorflow::errors::Internal(
+              "current_file_index out of range");
+        }
+        current_file_index_ = IntCast<size_t>(current_file_index);
+
+        if (reader->Contains(full_name("current_pos"))) {
+          if (TF_PREDICT_FALSE(current_file_index_ ==
+                               dataset()->filenames_.size())) {
+            return ::tensorflow::errors::Internal(
+                "current_file_index out of range");
+          }
+          std::string current_pos;
+          TF_RETURN_IF_ERROR(
+              reader->ReadScalar(full_name("current_pos"), &current_pos));
+          RecordPosition pos;
+          if (TF_PREDICT_FALSE(!pos.FromBytes(current_pos))) {
+            return ::tensorflow::errors::Internal(
+                "current_pos is not a valid RecordPosition");
+          }
+          OpenFile(ctx);
+          reader_->Seek(pos);
+          // Any errors from seeking will be reported during reading.
+        }
+        return ::tensorflow::Status::OK();
+      }
+
+     private:
+      void OpenFile(::tensorflow::data::IteratorContext* ctx)
+          EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+        reader_ = GetPooledReader(ctx->env(),
+                                  dataset()->filenames_[current_file_index_],
+                                  std::string(),
+                                  RecordReaderBase::Options());
+      }
+
+      // Drops reader_: returns it to the pool if it can be reused,
+      // otherwise deletes it without closing.
+      void DropReader() EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+        if (reader_ == nullptr) return;
+        if (TF_PREDICT_TRUE(reader_->healthy() && !reader_->truncated())) {
+          reader_.reset();
+        } else {
+          delete reader_.release();
+        }
+      }
+
+      // Fills one tensor per feature in dense_keys_ from the parsed record.
+      ::tensorflow::Status FillFeatures(
+          const ::tensorflow::Example& example,
+          std::vector<::tensorflow::Tensor>* out_tensors) const {
+        const auto& feature_map = example.features().feature();
+        for (size_t i = 0; i < dataset()->dense_keys_.size(); ++i) {
+          const std::string& key = dataset()->dense_keys_[i];
+          const auto iter = feature_map.find(key);
+          if (TF_PREDICT_FALSE(iter == feature_map.end())) {
+            return ::tensorflow::errors::InvalidArgument(
+                "Feature not present in a tf.Example record: ", key);
+          }
+          const ::tensorflow::Feature& feature = iter->second;
+          ::tensorflow::Tensor tensor(::tensorflow::cpu_allocator(),
+                                      dataset()->dense_types_[i],
+                                      dataset()->dense_shapes_[i]);
+          switch (dataset()->dense_types_[i]) {
+            case ::tensorflow::DT_INT64: {
+              const auto& values = feature.int64_list().value();
+              if (TF_PREDICT_FALSE(
+                      IntCast<::tensorflow::int64>(values.size()) !=
+                      tensor.NumElements())) {
+                return ::tensorflow::errors::InvalidArgument(
+                    "Unexpected number of int64 values of feature ", key,
+                    ": expected ", tensor.NumElements(), ", found ",
+                    values.size());
+              }
+              auto flat = tensor.flat<::tensorflow::int64>();
+              for (int j = 0; j < values.size(); ++j) flat(j) = values.Get(j);
+            } break;
+            case ::tensorflow::DT_FLOAT: {
+              const auto& values = feature.float_list().value();
+              if (TF_PREDICT_FALSE(
+                      IntCast<::tensorflow::int64>(values.size()) !=
+                      tensor.NumElements())) {
+                return ::tensorflow::errors::InvalidArgument(
+                    "Unexpected number of float values of feature ", key,
+                    ": expected ", tensor.NumElements(), ", found ",
+                    values.size());
+              }
+              auto flat = tensor.flat<float>();
+              for (int j = 0; j < values.size(); ++j) flat(j) = values.Get(j);
+            } break;
+            case ::tensorflow::DT_STRING: {
+              const auto& values = feature.bytes_list().value();
+              if (TF_PREDICT_FALSE(
+                      IntCast<::tensorflow::int64>(values.size()) !=
+                      tensor.NumElements())) {
+                return ::tensorflow::errors::InvalidArgument(
+                    "Unexpected number of bytes values of feature ", key,
+                    ": expected ", tensor.NumElements(), ", found ",
+                    values.size());
+              }
+              auto flat = tensor.flat<std::string>();
+              for (int j = 0; j < values.size(); ++j) flat(j) = values.Get(j);
+            } break;
+            default:
+              return ::tensorflow::errors::Internal(
+                  "Unexpected feature type: ",
+                  ::tensorflow::DataTypeString(dataset()->dense_types_[i]));
+          }
+          out_tensors->push_back(std::move(tensor));
+        }
+        return ::tensorflow::Status::OK();
+      }
+
+      // Invariants:
+      //   current_file_index_ <= dataset()->filenames_.size()
+      //   if current_file_index_ == dataset()->filenames_.size() then
+      //       reader_ == nullptr
+
+      absl::Mutex mu_;
+      size_t current_file_index_ GUARDED_BY(mu_) = 0;
+      // nullptr means not open yet.
+      ReaderPool::Handle reader_ GUARDED_BY(mu_);
+    };
+
+    const std::vector<std::string> filenames_;
+    const std::vector<std::string> dense_keys_;
+    const ::tensorflow::DataTypeVector dense_types_;
+    const std::vector<::tensorflow::TensorShape> dense_shapes_;
+    const std::vector<::tensorflow::PartialTensorShape> output_shapes_;
+  };
+
+  std::vector<std::string> dense_keys_;
+  ::tensorflow::DataTypeVector dense_types_;
+  std::vector<::tensorflow::TensorShape> dense_shapes_;
+};
+
+REGISTER_KERNEL_BUILDER(
+    Name("RiegeliExampleDataset").Device(::tensorflow::DEVICE_CPU),
+    RiegeliExampleDatasetOp);
+
 }  // namespace
 }  // namespace tensorflow
 }  // namespace riegeli
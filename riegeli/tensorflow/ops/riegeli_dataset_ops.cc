@@ -21,6 +21,11 @@ namespace tensorflow {
 REGISTER_OP("RiegeliDataset")
     .Input("filenames: string")
     .Output("handle: variant")
+    .Attr("num_parallel_reads: int >= 1 = 1")
+    .Attr("num_shards: int >= 1 = 1")
+    .Attr("shard_index: int >= 0 = 0")
+    .Attr("batch_size: int >= 0 = 0")
+    .Attr("fields: list(string) = []")
     .SetIsStateful()
     .SetShapeFn(::tensorflow::shape_inference::ScalarShape)
     .Doc(R"doc(
@@ -28,6 +33,53 @@ Creates a dataset that emits the records from one or more Riegeli/records files.
 
 filenames: A scalar or vector containing the name(s) of the file(s) to be
   read.
+num_parallel_reads: The number of files to read in parallel, interleaving
+  their records. With 1 files are read sequentially, in order.
+num_shards: The number of shards the records are split into. Each file is
+  split at chunk boundaries; this dataset reads only the chunks of shard
+  shard_index, skipping the data of the remaining chunks. With 1 all records
+  are read.
+shard_index: The shard to read, if num_shards > 1.
+batch_size: The maximal number of records in each element of the dataset.
+  With 0 each element is a scalar containing one record. With batch_size >= 1
+  each element is a 1-D tensor containing up to batch_size records; a batch
+  does not span a chunk boundary, so it can be shorter than batch_size even
+  in the middle of a file.
+fields: Proto field paths to include when reading records written with
+  transposition, e.g. with options='transpose' passed to RecordWriter. Each
+  path is a sequence of proto field numbers separated by dots, descending
+  from the root message, e.g. '1.1.2'. Data of the remaining fields are
+  skipped before decoding, which makes reading a subset of fields cheaper.
+  An empty list includes all fields. For tf.Example, '1.1.1' is the path of
+  feature names and '1.1.2' is the path of feature values; individual
+  features cannot be distinguished at this level because all entries of the
+  feature map share one field path.
+)doc");
+
+REGISTER_OP("RiegeliExampleDataset")
+    .Input("filenames: string")
+    .Output("handle: variant")
+    .Attr("dense_keys: list(string) >= 1")
+    .Attr("dense_types: list({int64, float, string}) >= 1")
+    .Attr("dense_shapes: list(shape) >= 1")
+    .SetIsStateful()
+    .SetShapeFn(::tensorflow::shape_inference::ScalarShape)
+    .Doc(R"doc(
+Creates a dataset that emits dense feature tensors parsed from tf.Example
+records of one or more Riegeli/records files.
+
+Reading and parsing are fused: each record is parsed directly from the
+decoded chunk, without materializing the serialized record as an
+intermediate string tensor.
+
+filenames: A scalar or vector containing the name(s) of the file(s) to be
+  read.
+dense_keys: The keys of the features to emit. Each record must contain all
+  of them.
+dense_types: The type of each feature, matching the kind of its values:
+  int64 for int64_list, float for float_list, string for bytes_list.
+dense_shapes: The shape of each feature. The number of values of the
+  feature in each record must match the number of elements of the shape.
 )doc");
 
 }  // namespace tensorflow